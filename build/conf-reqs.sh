@@ -26,7 +26,9 @@
 ################################################################################
 # Requirements
 ################################################################################
-# (none)
+# Optional compression libraries of CompressedDevice
+check_for_zlib
+check_for_zstd
 
 ################################################################################
 # Project-specific requirement definitions
@@ -195,6 +195,14 @@ endif
 OPTIMIZATION = -O2
 CXXFLAGS     = -Wall
 
+# Optional libraries found by configure
+ifdef HAVE_ZLIB
+CXXFLAGS    += -DHAVE_ZLIB
+endif
+ifdef HAVE_ZSTD
+CXXFLAGS    += -DHAVE_ZSTD
+endif
+
 ifdef DEBUG
 DEBUGFLAGS   = -g
 OPTIMIZATION = 
@@ -0,0 +1,506 @@
+/***************************************************************************
+ *   This file is part of the MagiC++ library.                             *
+ *                                                                         *
+ *   Copyright (C) 1998-2005 Marko Grnroos <magi@iki.fi>                  *
+ *                                                                         *
+ ***************************************************************************
+ *                                                                         *
+ *  This library is free software; you can redistribute it and/or          *
+ *  modify it under the terms of the GNU Library General Public            *
+ *  License as published by the Free Software Foundation; either           *
+ *  version 2 of the License, or (at your option) any later version.       *
+ *                                                                         *
+ *  This library is distributed in the hope that it will be useful,        *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU      *
+ *  Library General Public License for more details.                       *
+ *                                                                         *
+ *  You should have received a copy of the GNU Library General Public      *
+ *  License along with this library; see the file COPYING.LIB.  If         *
+ *  not, write to the Free Software Foundation, Inc., 59 Temple Place      *
+ *  - Suite 330, Boston, MA 02111-1307, USA.                               *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef __MAGIC_MALGORITHM_H__
+#define __MAGIC_MALGORITHM_H__
+
+#include <string.h>
+#include "magic/mobject.h"
+
+BEGIN_NAMESPACE (MagiC);
+
+/** Partitions of at most this many items are sorted with insertion
+ *  sort.
+ **/
+#define SORT_INSERTION_LIMIT	16
+
+/*******************************************************************************
+ * Sorting and searching algorithms for items in a C-array, such as
+ * the data of a @ref PackArray or the pointers of an @ref Array.
+ *
+ * The algorithms are templates on the item class and on a comparator
+ * class, which has a method int compare(a, b) that returns a negative
+ * value, zero or a positive value, like strcmp(). Since the
+ * comparator is known at compile time, the comparisons are inlined,
+ * unlike with qsort() and @ref compareComparable, which call a
+ * function through a pointer and then the virtual
+ * Comparable::compare for each pair of items. Each algorithm has a
+ * version without the comparator parameter, which uses @ref
+ * KeyCompare of the item class.
+ *
+ * The items are moved as raw memory, without their copy constructors
+ * or assignment operators, so they must not hold pointers to
+ * themselves. This is the same requirement as @ref PackArray has for
+ * its items.
+ ******************************************************************************/
+
+/** Hint of a key in @ref OrderedMap, compared as one number of two
+ *  words; see @ref KeyCompare.
+ **/
+struct KeyHint {
+	unsigned long	high, low;
+
+					KeyHint		(unsigned long h=0, unsigned long l=0) : high (h), low (l) {}
+	bool			operator==	(const KeyHint& o) const {return high == o.high && low == o.low;}
+	bool			operator!=	(const KeyHint& o) const {return high != o.high || low != o.low;}
+	bool			operator<	(const KeyHint& o) const {return high < o.high || (high == o.high && low < o.low);}
+};
+
+/*******************************************************************************
+ * Default comparator of the sorting algorithms and of @ref
+ * OrderedMap.
+ *
+ * Calls the compare() of the item class through the static type of
+ * the item, so classes with a non-virtual compare overload for their
+ * own class, such as @ref String and @ref Int, are compared inline
+ * instead of through the virtual Comparable::compare. The primitive
+ * number types are compared with the operators.
+ *
+ * The comparator also gives a hint of each key, for @ref OrderedMap:
+ * a @ref KeyHint that never decreases as the keys grow, so that keys
+ * with different hints are ordered by them. The map keeps the hints
+ * next to the key pointers and compares the keys themselves only when
+ * the hints are equal, which saves following the pointers in most
+ * steps of a search. The default hint is zero, which is always equal.
+ *
+ * Other orders can be given as a class with similar static compare
+ * and hint methods; the sorting algorithms need only the compare.
+ ******************************************************************************/
+template <class TYPE>
+struct KeyCompare {
+	static int				compare		(const TYPE& a, const TYPE& b) {return a.compare (b);}
+	static KeyHint			hint		(const TYPE& key) {return KeyHint ();}
+};
+
+/** Comparator for @ref String keys. The hint is made of the first 16
+ *  bytes of the string, enough to tell apart most keys that share a
+ *  prefix such as "section.".
+ **/
+template <>
+struct KeyCompare<String> {
+	static int				compare		(const String& a, const String& b) {return a.compare (b);}
+	static KeyHint			hint		(const String& key) {
+		const unsigned char* data = (const unsigned char*) (const char*) key;
+		uint len = key.length ();
+		KeyHint result;
+		for (uint i=0; i<sizeof (unsigned long); i++)
+			result.high = (result.high << 8) | ((i < len)? data[i] : 0);
+		for (uint i=sizeof (unsigned long); i<2*sizeof (unsigned long); i++)
+			result.low = (result.low << 8) | ((i < len)? data[i] : 0);
+		return result;
+	}
+};
+
+/** Comparator for @ref Int keys. The hint is the value itself, with
+ *  the sign bit flipped so that negative values come first.
+ **/
+template <>
+struct KeyCompare<Int> {
+	static int				compare		(const Int& a, const Int& b) {return a.compare (b);}
+	static KeyHint			hint		(const Int& key) {return KeyHint ((unsigned long) key.toLong () ^ (1UL << (sizeof (long)*8-1)));}
+};
+
+/** Comparators for the integer types. The hint is the value, with the
+ *  sign bit flipped for the signed types.
+ **/
+#define KEYCOMPARE_INTEGER(type,signbit) \
+template <> \
+struct KeyCompare<type> { \
+	static int				compare		(type a, type b) {return (a<b)? -1 : (a>b);} \
+	static KeyHint			hint		(type key) {return KeyHint ((unsigned long) key ^ (signbit));} \
+};
+
+KEYCOMPARE_INTEGER (int,			1UL << (sizeof (long)*8-1))
+KEYCOMPARE_INTEGER (long,			1UL << (sizeof (long)*8-1))
+KEYCOMPARE_INTEGER (unsigned int,	0)
+KEYCOMPARE_INTEGER (unsigned long,	0)
+
+#undef KEYCOMPARE_INTEGER
+
+/** Comparators for the floating-point types. The hint is the bits of
+ *  the value as a double, turned so that they grow with the value.
+ *  NaNs are not ordered.
+ **/
+#define KEYCOMPARE_FLOAT(type) \
+template <> \
+struct KeyCompare<type> { \
+	static int				compare		(type a, type b) {return (a<b)? -1 : (a>b);} \
+	static KeyHint			hint		(type key) { \
+		double value = key; \
+		unsigned long long bits; \
+		memcpy (&bits, &value, sizeof (bits)); \
+		bits = (bits >> 63)? ~bits : bits | (1ULL << 63); \
+		if (sizeof (long) >= sizeof (bits)) \
+			return KeyHint ((unsigned long) bits); \
+		return KeyHint ((unsigned long) (bits >> 32), (unsigned long) bits); \
+	} \
+};
+
+KEYCOMPARE_FLOAT (float)
+KEYCOMPARE_FLOAT (double)
+
+#undef KEYCOMPARE_FLOAT
+
+/** Comparator for the pointers of @ref Array and @ref RefArray.
+ *  Compares the pointed items with the given comparator; NULL
+ *  pointers go after all items.
+ **/
+template <class TYPE, class CMP=KeyCompare<TYPE> >
+struct PointerCompare {
+	CMP		cmp;
+
+			PointerCompare	(const CMP& c=CMP ()) : cmp (c) {}
+	int		compare			(const TYPE* a, const TYPE* b) const {
+		if (a == NULL || b == NULL)
+			return (a == NULL) - (b == NULL);
+		return cmp.compare (*a, *b);
+	}
+};
+
+///////////////////////////////// Helpers ///////////////////////////////////
+
+/** Swaps two items as raw memory. */
+template <class TYPE>
+inline void swapItems (TYPE* a, TYPE* b) {
+	char tmp [sizeof (TYPE)];
+	memcpy (tmp, (void*) a, sizeof (TYPE));
+	memcpy ((void*) a, (void*) b, sizeof (TYPE));
+	memcpy ((void*) b, tmp, sizeof (TYPE));
+}
+
+/** Moves the i:th item to the j:th place, j<=i, and the items from
+ *  the j:th up by one place.
+ **/
+template <class TYPE>
+inline void rotateItem (TYPE* data, int i, int j) {
+	if (i == j)
+		return;
+	char tmp [sizeof (TYPE)];
+	memcpy (tmp, (void*) (data+i), sizeof (TYPE));
+	memmove ((void*) (data+j+1), (void*) (data+j), (i-j) * sizeof (TYPE));
+	memcpy ((void*) (data+j), tmp, sizeof (TYPE));
+}
+
+/** Sorts the items by insertion; fast for short arrays. Stable. */
+template <class TYPE, class CMP>
+void insertionSort (TYPE* data, int n, const CMP& cmp) {
+	for (int i=1; i<n; i++) {
+		int j = i;
+		while (j > 0 && cmp.compare (data[i], data[j-1]) < 0)
+			j--;
+		rotateItem (data, i, j);
+	}
+}
+
+/** Sorts the three items in place. */
+template <class TYPE, class CMP>
+inline void sortThree (TYPE* a, TYPE* b, TYPE* c, const CMP& cmp) {
+	if (cmp.compare (*b, *a) < 0)
+		swapItems (a, b);
+	if (cmp.compare (*c, *b) < 0) {
+		swapItems (b, c);
+		if (cmp.compare (*b, *a) < 0)
+			swapItems (a, b);
+	}
+}
+
+/** Sifts the i:th item down the heap of n items. */
+template <class TYPE, class CMP>
+void siftDown (TYPE* data, int i, int n, const CMP& cmp) {
+	for (int child; (child = 2*i+1) < n; i = child) {
+		if (child+1 < n && cmp.compare (data[child], data[child+1]) < 0)
+			child++;
+		if (cmp.compare (data[i], data[child]) >= 0)
+			break;
+		swapItems (data+i, data+child);
+	}
+}
+
+/** Sorts the items with heapsort. Used by @ref introSort when
+ *  quicksort degenerates.
+ **/
+template <class TYPE, class CMP>
+void heapSort (TYPE* data, int n, const CMP& cmp) {
+	for (int i=n/2-1; i>=0; i--)
+		siftDown (data, i, n, cmp);
+	for (int i=n-1; i>0; i--) {
+		swapItems (data, data+i);
+		siftDown (data, 0, i, cmp);
+	}
+}
+
+/** Partitions the items around the median of the second, middle and
+ *  last item, n>=3. Returns the final place of the pivot; the items
+ *  before it are not greater and the items after it not less than it.
+ **/
+template <class TYPE, class CMP>
+int partitionItems (TYPE* data, int n, const CMP& cmp) {
+	sortThree (data+1, data+n/2, data+n-1, cmp);
+	swapItems (data, data+n/2);
+
+	// The second and last item now stop the scans at the ends
+	int i = 0, j = n;
+	for (;;) {
+		do i++; while (cmp.compare (data[i], data[0]) < 0);
+		do j--; while (cmp.compare (data[0], data[j]) < 0);
+		if (i >= j)
+			break;
+		swapItems (data+i, data+j);
+	}
+	swapItems (data, data+j);
+	return j;
+}
+
+/** Returns the floor of the base-2 logarithm of n>0. */
+inline int floorLog2 (unsigned int n) {
+	int result = 0;
+	while (n >>= 1)
+		result++;
+	return result;
+}
+
+template <class TYPE, class CMP>
+void introSortLoop (TYPE* data, int n, int depth, const CMP& cmp) {
+	while (n > SORT_INSERTION_LIMIT) {
+		if (depth-- == 0) {
+			heapSort (data, n, cmp);
+			return;
+		}
+		int pivot = partitionItems (data, n, cmp);
+
+		// Recurse into the smaller side, so the stack stays short
+		if (pivot < n-pivot-1) {
+			introSortLoop (data, pivot, depth, cmp);
+			data += pivot+1;
+			n -= pivot+1;
+		} else {
+			introSortLoop (data+pivot+1, n-pivot-1, depth, cmp);
+			n = pivot;
+		}
+	}
+	insertionSort (data, n, cmp);
+}
+
+/** Copies the items as raw memory. */
+template <class TYPE>
+inline void copyItems (TYPE* dst, const TYPE* src, int n) {
+	memcpy ((void*) dst, (const void*) src, n * sizeof (TYPE));
+}
+
+/** Merges the sorted a and b into dst, which is not either of them.
+ *  Of equal items, those of a come first.
+ **/
+template <class TYPE, class CMP>
+void mergeItems (const TYPE* a, int na, const TYPE* b, int nb, TYPE* dst, const CMP& cmp) {
+	if (na == 0 || nb == 0 || cmp.compare (a[na-1], b[0]) <= 0) {
+		copyItems (dst, a, na);
+		copyItems (dst+na, b, nb);
+		return;
+	}
+	const TYPE* aend = a+na;
+	const TYPE* bend = b+nb;
+	while (a < aend && b < bend) {
+		if (cmp.compare (*b, *a) < 0)
+			copyItems (dst++, b++, 1);
+		else
+			copyItems (dst++, a++, 1);
+	}
+	copyItems (dst, a, aend-a);
+	copyItems (dst+(aend-a), b, bend-b);
+}
+
+/** Returns how many of the first k items of the merge of a and b
+ *  come from a, as @ref mergeItems merges them. Lets a merge be split
+ *  into independent parts.
+ **/
+template <class TYPE, class CMP>
+int mergeSplit (const TYPE* a, int na, const TYPE* b, int nb, int k, const CMP& cmp) {
+	int lo = (k > nb)? k-nb : 0;
+	int hi = (k < na)? k : na;
+	while (lo < hi) {
+		int mid = (lo+hi)/2;
+		if (cmp.compare (a[mid], b[k-mid-1]) <= 0)
+			lo = mid+1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/** Stable sort of the items into the buffer of n items; returns the
+ *  one of data and buffer that holds the sorted items.
+ **/
+template <class TYPE, class CMP>
+TYPE* mergeSortInto (TYPE* data, TYPE* buffer, int n, const CMP& cmp) {
+	for (int i=0; i<n; i+=SORT_INSERTION_LIMIT)
+		insertionSort (data+i, (n-i < SORT_INSERTION_LIMIT)? n-i : SORT_INSERTION_LIMIT, cmp);
+
+	TYPE* src = data;
+	TYPE* dst = buffer;
+	for (int width=SORT_INSERTION_LIMIT; width<n; width*=2) {
+		for (int i=0; i<n; i+=2*width) {
+			int na = (n-i < width)? n-i : width;
+			int nb = (n-i-na < width)? n-i-na : width;
+			mergeItems (src+i, na, src+i+na, nb, dst+i, cmp);
+		}
+		TYPE* tmp = src;
+		src = dst;
+		dst = tmp;
+	}
+	return src;
+}
+
+//////////////////////////////// Algorithms /////////////////////////////////
+
+/** Sorts the n items with introsort: quicksort with median-of-three
+ *  pivots, which switches to heapsort if the recursion gets too deep,
+ *  so the worst case is O(n log n), and to insertion sort for short
+ *  partitions. Not stable.
+ **/
+template <class TYPE, class CMP>
+inline void introSort (TYPE* data, int n, const CMP& cmp) {
+	if (n > 1)
+		introSortLoop (data, n, 2*floorLog2 (n), cmp);
+}
+
+template <class TYPE>
+inline void introSort (TYPE* data, int n) {
+	introSort (data, n, KeyCompare<TYPE> ());
+}
+
+/** Sorts the n items with merge sort, keeping equal items in their
+ *  order. Needs a temporary buffer of n items. Merging is skipped for
+ *  runs that are already in order, so sorting mostly sorted items is
+ *  fast.
+ **/
+template <class TYPE, class CMP>
+void mergeSort (TYPE* data, int n, const CMP& cmp) {
+	if (n <= SORT_INSERTION_LIMIT) {
+		insertionSort (data, n, cmp);
+		return;
+	}
+	TYPE* buffer = (TYPE*) new char [n * sizeof (TYPE)];
+	if (mergeSortInto (data, buffer, n, cmp) == buffer)
+		copyItems (data, buffer, n);
+	delete [] (char*) buffer;
+}
+
+template <class TYPE>
+inline void mergeSort (TYPE* data, int n) {
+	mergeSort (data, n, KeyCompare<TYPE> ());
+}
+
+/** Rearranges the items so that the nth item is the one that would be
+ *  there if the items were sorted, the items before it are not greater
+ *  and the items after it not less. Takes linear time on average.
+ **/
+template <class TYPE, class CMP>
+void selectNth (TYPE* data, int n, int nth, const CMP& cmp) {
+	ASSERT (nth >= 0 && nth < n);
+	int depth = 2*floorLog2 (n);
+	while (n > SORT_INSERTION_LIMIT) {
+		if (depth-- == 0) {
+			heapSort (data, n, cmp);
+			return;
+		}
+		int pivot = partitionItems (data, n, cmp);
+		if (pivot == nth)
+			return;
+		if (nth < pivot)
+			n = pivot;
+		else {
+			data += pivot+1;
+			n -= pivot+1;
+			nth -= pivot+1;
+		}
+	}
+	insertionSort (data, n, cmp);
+}
+
+template <class TYPE>
+inline void selectNth (TYPE* data, int n, int nth) {
+	selectNth (data, n, nth, KeyCompare<TYPE> ());
+}
+
+/** Returns the index of the first of the sorted items that is not
+ *  less than the key, or n if there is none.
+ **/
+template <class TYPE, class CMP>
+int lowerBound (const TYPE* data, int n, const TYPE& key, const CMP& cmp) {
+	int lo = 0;
+	while (n > 0) {
+		int half = n/2;
+		if (cmp.compare (data[lo+half], key) < 0) {
+			lo += half+1;
+			n -= half+1;
+		} else
+			n = half;
+	}
+	return lo;
+}
+
+template <class TYPE>
+inline int lowerBound (const TYPE* data, int n, const TYPE& key) {
+	return lowerBound (data, n, key, KeyCompare<TYPE> ());
+}
+
+/** Returns the index of the first of the sorted items that is greater
+ *  than the key, or n if there is none.
+ **/
+template <class TYPE, class CMP>
+int upperBound (const TYPE* data, int n, const TYPE& key, const CMP& cmp) {
+	int lo = 0;
+	while (n > 0) {
+		int half = n/2;
+		if (cmp.compare (key, data[lo+half]) >= 0) {
+			lo += half+1;
+			n -= half+1;
+		} else
+			n = half;
+	}
+	return lo;
+}
+
+template <class TYPE>
+inline int upperBound (const TYPE* data, int n, const TYPE& key) {
+	return upperBound (data, n, key, KeyCompare<TYPE> ());
+}
+
+/** Searches the sorted items for one equal to the key. Returns the
+ *  index of the first such item, or -1 if there is none.
+ **/
+template <class TYPE, class CMP>
+int binarySearch (const TYPE* data, int n, const TYPE& key, const CMP& cmp) {
+	int pos = lowerBound (data, n, key, cmp);
+	return (pos < n && cmp.compare (data[pos], key) == 0)? pos : -1;
+}
+
+template <class TYPE>
+inline int binarySearch (const TYPE* data, int n, const TYPE& key) {
+	return binarySearch (data, n, key, KeyCompare<TYPE> ());
+}
+
+END_NAMESPACE;
+
+#endif
@@ -0,0 +1,166 @@
+/***************************************************************************
+ *   This file is part of the MagiC++ library.                             *
+ *                                                                         *
+ *   Copyright (C) 1998-2005 Marko Grnroos <magi@iki.fi>                  *
+ *                                                                         *
+ ***************************************************************************
+ *                                                                         *
+ *  This library is free software; you can redistribute it and/or          *
+ *  modify it under the terms of the GNU Library General Public            *
+ *  License as published by the Free Software Foundation; either           *
+ *  version 2 of the License, or (at your option) any later version.       *
+ *                                                                         *
+ *  This library is distributed in the hope that it will be useful,        *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU      *
+ *  Library General Public License for more details.                       *
+ *                                                                         *
+ *  You should have received a copy of the GNU Library General Public      *
+ *  License along with this library; see the file COPYING.LIB.  If         *
+ *  not, write to the Free Software Foundation, Inc., 59 Temple Place      *
+ *  - Suite 330, Boston, MA 02111-1307, USA.                               *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef __MAGIC_MARENA_H__
+#define __MAGIC_MARENA_H__
+
+#include <new>
+#include "magic/mobject.h"
+
+// Placement new can not be used with the debugging new
+#ifdef new
+#undef new
+#define new_UNDEFD
+#endif
+
+BEGIN_NAMESPACE (MagiC);
+
+/** Size of the blocks an @ref Arena takes from the heap by default. */
+#define ARENA_BLOCK_SIZE	65536
+
+/** Alignment of the allocations from an @ref Arena; enough for any type. */
+#define ARENA_ALIGN			16
+
+/*******************************************************************************
+ * Monotonic memory arena.
+ *
+ * Allocation just moves a pointer forward in the current block, and
+ * the memory is given back only when the whole arena is released or
+ * destroyed, so a large structure of small objects, such as a parsed
+ * configuration, can be built and freed at once without a heap call
+ * for each object. A released arena keeps its blocks, so building
+ * the next structure in it does not touch new memory.
+ *
+ * @ref Map, @ref GenHash and @ref Array can be given an arena, and
+ * then make the items they copy in it. @ref String takes the buffer of
+ * a long string from the arena with the @ref String(const String&,
+ * Arena&) constructor. The arena does not call destructors; the
+ * containers do that, but return no memory.
+ *
+ * An arena is not thread-safe.
+ *
+ *  @example
+ *  @code
+ *     Arena arena;
+ *     StringMap config (arena);
+ *     config.set ("section.key", "value");
+ *  @endcode
+ ******************************************************************************/
+class Arena {
+  public:
+				Arena		(size_t blockSize=ARENA_BLOCK_SIZE);
+				~Arena		();
+
+	/** Allocates a block of the given size, aligned to ARENA_ALIGN. */
+	void*		allocate	(size_t size) {
+		size = (size + ARENA_ALIGN-1) & ~(size_t) (ARENA_ALIGN-1);
+		if (size > size_t (mEnd - mCursor))
+			return allocateBlock (size);
+		void* result = mCursor;
+		mCursor += size;
+		return result;
+	}
+
+	void		release		();
+	size_t		used		() const;
+
+	/** Returns the number of bytes the arena has taken from the heap. */
+	size_t		reserved	() const {return mReserved;}
+
+  private:
+	/** Header of a block taken from the heap. */
+	struct Block {
+		Block*	next;	/**< Previously allocated block. */
+		size_t	size;	/**< Usable size after the header. */
+	};
+
+	Block*		mBlocks;	/**< Blocks in use, the current one first. */
+	Block*		mSpare;		/**< Released standard-size blocks. */
+	char*		mCursor;	/**< Next free byte in the current block. */
+	char*		mEnd;		/**< End of the current block. */
+	size_t		mBlockSize;
+	size_t		mUsed;		/**< Bytes allocated before the current block. */
+	size_t		mReserved;
+
+	void*		allocateBlock	(size_t size);
+	void		freeBlocks		(Block* blocks);
+	Block*		newBlock		(size_t size);
+
+	// Not copyable
+				Arena		(const Arena& other);
+	void		operator=	(const Arena& other);
+};
+
+/** Makes a copy of the item in the arena. */
+template <class TYPE>
+inline TYPE* arenaCopy (Arena& arena, const TYPE& item) {
+	return ::new (arena.allocate (sizeof (TYPE))) TYPE (item);
+}
+
+/** Makes a copy of the String in the arena, with its buffer in the
+ *  arena too.
+ **/
+inline String* arenaCopy (Arena& arena, const String& item) {
+	return ::new (arena.allocate (sizeof (String))) String (item, arena);
+}
+
+/** Default-constructs an item in the arena. */
+template <class TYPE>
+inline TYPE* arenaConstruct (Arena& arena) {
+	return ::new (arena.allocate (sizeof (TYPE))) TYPE ();
+}
+
+/** Destroys an item made in an arena. The memory stays in the arena. */
+template <class TYPE>
+inline void arenaDestroy (TYPE* item) {
+	if (item)
+		item->~TYPE ();
+}
+
+#ifdef OBJECT_POOL
+/** Allocates an Object from an arena instead of the pool. */
+inline void* Object::operator new (size_t size, Arena& arena) {
+	return arena.allocate (size);
+}
+#endif
+
+END_NAMESPACE;
+
+/** Placement new for allocating from an arena: new (arena) Type (...).
+ *  Objects made so must be destroyed with @ref arenaDestroy, not
+ *  deleted.
+ **/
+inline void* operator new (size_t size, MagiC::Arena& arena) {
+	return arena.allocate (size);
+}
+
+/** Called only if a constructor throws; the memory stays in the arena. */
+inline void operator delete (void* p, MagiC::Arena& arena) {}
+
+#ifdef new_UNDEFD
+#define new DEBUG_NEW
+#undef new_UNDEFD
+#endif
+
+#endif
@@ -0,0 +1,179 @@
+/***************************************************************************
+ *   This file is part of the MagiC++ library.                             *
+ *                                                                         *
+ *   Copyright (C) 1998-2002 Marko Grnroos <magi@iki.fi>                  *
+ *                                                                         *
+ ***************************************************************************
+ *                                                                         *
+ *  This library is free software; you can redistribute it and/or          *
+ *  modify it under the terms of the GNU Library General Public            *
+ *  License as published by the Free Software Foundation; either           *
+ *  version 2 of the License, or (at your option) any later version.       *
+ *                                                                         *
+ *  This library is distributed in the hope that it will be useful,        *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU      *
+ *  Library General Public License for more details.                       *
+ *                                                                         *
+ *  You should have received a copy of the GNU Library General Public      *
+ *  License along with this library; see the file COPYING.LIB.  If         *
+ *  not, write to the Free Software Foundation, Inc., 59 Temple Place      *
+ *  - Suite 330, Boston, MA 02111-1307, USA.                               *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef __MAGIC_ASYNCIO_H__
+#define __MAGIC_ASYNCIO_H__
+
+#include <magic/miodevice.h>
+#include <magic/mnotifier.h>
+
+BEGIN_NAMESPACE (MagiC);
+
+class AsyncIO;
+class AsyncRequest;
+struct AsyncRing;
+
+/*******************************************************************************
+ * Receives the completions of @ref AsyncRequest operations.
+ ******************************************************************************/
+class AsyncHandler {
+  public:
+	virtual			~AsyncHandler	() {}
+
+	/** Called in the thread that reaps the completions of the
+	 *  @ref AsyncIO, when the request is done.
+	 **/
+	virtual void	completed		(AsyncRequest& request) = 0;
+};
+
+/*******************************************************************************
+ * A read or write submitted to an @ref AsyncIO.
+ *
+ * The request is also the future of its result: after it is
+ * submitted, @ref isDone() tells whether it has completed, and
+ * @ref AsyncIO::wait(AsyncRequest&) waits for it. The request, and
+ * its buffer, must stay alive until it is done. A done request may
+ * be prepared and submitted again.
+ ******************************************************************************/
+class AsyncRequest : public Request {
+  public:
+					AsyncRequest	();
+
+	void			prepareRead		(IODevice& device, char* data, uint length, long offset=-1);
+	void			prepareWrite	(IODevice& device, const char* data, uint length, long offset=-1);
+	void			prepareRead		(IODevice& device, int buffer, uint length, long offset=-1);
+	void			prepareWrite	(IODevice& device, int buffer, uint length, long offset=-1);
+	void			setHandler		(AsyncHandler* handler) {mpHandler = handler;}
+	void			setUserData		(void* userData) {mpUserData = userData;}
+
+	bool			isDone			() const {return __atomic_load_n (&mDone, __ATOMIC_ACQUIRE);}
+	int				result			() const {return mResult;}
+	IODevice*		device			() const {return mpDevice;}
+	char*			data			() const {return mpData;}
+	uint			length			() const {return mLength;}
+	long			offset			() const {return mOffset;}
+	void*			userData		() const {return mpUserData;}
+
+  private:
+	void			prepare			(IODevice& device, bool write, char* data, int buffer, uint length, long offset);
+
+	friend class AsyncIO;
+
+	IODevice*		mpDevice;	/**< Device to read or write.                          */
+	char*			mpData;		/**< Buffer of the data, or NULL for a registered one. */
+	int				mBuffer;	/**< Index of the registered buffer, or -1.            */
+	uint			mLength;	/**< Bytes to read or write.                           */
+	long			mOffset;	/**< Position in the device, or -1 for the current.    */
+	bool			mWrite;		/**< Is the request a write?                           */
+	bool			mSocket;	/**< Is the device a socket?                           */
+	bool			mDone;		/**< Has the request completed?                        */
+	int				mResult;	/**< Bytes transferred, or a negative errno value.     */
+	AsyncHandler*	mpHandler;	/**< Handler of the completion, or NULL.               */
+	void*			mpUserData;	/**< Data of the caller.                               */
+	AsyncRequest*	mpNext;		/**< Next in the list of completions.                  */
+};
+
+/*******************************************************************************
+ * Asynchronous reads and writes of files and sockets, with io_uring.
+ *
+ * The requests are collected into a batch with @ref submit(), and the
+ * whole batch is passed to the kernel with one system call by
+ * @ref flush(), or by reaping the completions with @ref poll() or
+ * @ref wait(). The handlers of the requests are called by the
+ * reaping thread. A single thread submits and reaps; the devices may
+ * be driven from a @ref DeviceNotifier loop with @ref attach().
+ *
+ * When io_uring is not available, or AIO_Threads is asked for, the
+ * requests are performed with blocking calls by the workers of a
+ * @ref WorkerPool instead, with the same interface.
+ *
+ * Registered buffers are mapped into the kernel once, which saves
+ * the pinning of the pages on each operation.
+ *
+ *  @example
+ *  @code
+ *     File file ("data.bin", IO_Readable);
+ *     AsyncIO aio;
+ *     aio.registerBuffers (64, 4096);
+ *     AsyncRequest requests [64];
+ *     for (int i=0; i<64; i++) {
+ *         requests[i].prepareRead (file, i, 4096, i*4096L);
+ *         aio.submit (&requests[i]);
+ *     }
+ *     aio.wait (64);
+ *  @endcode
+ ******************************************************************************/
+class AsyncIO : public IODevice, public DeviceHandler, public RequestHandler {
+  public:
+	enum backends {AIO_Auto=0, AIO_Uring=1, AIO_Threads=2};
+
+					AsyncIO			(int depth=256, int backend=AIO_Auto, int threads=4);
+	virtual			~AsyncIO		();
+
+	int				backend			() const {return mBackend;}
+	int				depth			() const {return mDepth;}
+	int				pending			() const {return mPending;}
+	virtual int		handle			() const {return mEventFd;}
+
+	bool			registerBuffers	(int count, uint size);
+	char*			buffer			(int index) const {return mBuffers[index];}
+	int				bufferCount		() const {return mBuffers.size ();}
+
+	bool			submit			(AsyncRequest* request);
+	int				submit			(AsyncRequest** requests, int count);
+	virtual void	flush			();
+	int				poll			();
+	int				wait			(int count=1, double seconds=-1.0);
+	bool			wait			(AsyncRequest& request, double seconds=-1.0);
+
+	bool			attach			(DeviceNotifier& notifier);
+	bool			detach			(DeviceNotifier& notifier);
+
+	// Implementations
+	virtual void	deviceEvent		(DeviceNotifier& notifier, IODevice* device, int events);
+	virtual void	process			(Request* pRequest);
+
+  private:
+	bool			setupRing		();
+	void			complete		(AsyncRequest* request, int result);
+	int				waitEvent		(double seconds);
+
+	int				mBackend;	/**< AIO_Uring or AIO_Threads.                     */
+	int				mDepth;		/**< Maximum number of requests in flight.         */
+	int				mPending;	/**< Requests submitted and not yet reaped.        */
+	int				mQueued;	/**< Requests in the batch not yet passed on.      */
+	int				mEventFd;	/**< Event descriptor signaled on completions.     */
+	AsyncRing*		mpRing;		/**< The io_uring, or NULL.                        */
+	WorkerPool*		mpPool;		/**< Workers of the fallback, or NULL.             */
+	DummyLog		mLog;		/**< Log of the fallback pool.                     */
+	Mutex			mLock;		/**< Guards the completions of the fallback.       */
+	AsyncRequest*	mpDone;		/**< Completions of the fallback, newest first.    */
+	PackArray<char*> mBuffers;	/**< Registered buffers.                           */
+
+					AsyncIO			(const AsyncIO& other) {FORBIDDEN}
+};
+
+END_NAMESPACE;
+
+#endif
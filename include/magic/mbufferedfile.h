@@ -0,0 +1,130 @@
+/***************************************************************************
+ *   This file is part of the MagiC++ library.                             *
+ *                                                                         *
+ *   Copyright (C) 1998-2005 Marko Grnroos <magi@iki.fi>                  *
+ *                                                                         *
+ ***************************************************************************
+ *                                                                         *
+ *  This library is free software; you can redistribute it and/or          *
+ *  modify it under the terms of the GNU Library General Public            *
+ *  License as published by the Free Software Foundation; either           *
+ *  version 2 of the License, or (at your option) any later version.       *
+ *                                                                         *
+ *  This library is distributed in the hope that it will be useful,        *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU      *
+ *  Library General Public License for more details.                       *
+ *                                                                         *
+ *  You should have received a copy of the GNU Library General Public      *
+ *  License along with this library; see the file COPYING.LIB.  If         *
+ *  not, write to the Free Software Foundation, Inc., 59 Temple Place      *
+ *  - Suite 330, Boston, MA 02111-1307, USA.                               *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef __MAGIC_MBUFFEREDFILE_H__
+#define __MAGIC_MBUFFEREDFILE_H__
+
+#include <sys/types.h>
+#include <magic/miodevice.h>
+
+BEGIN_NAMESPACE (MagiC);
+
+/** Default size of the buffer of a BufferedFile. */
+#define BUFFEREDFILE_DEFAULT_SIZE	(256*1024)
+
+/*******************************************************************************
+ * A file device with its own buffer on top of the raw system calls.
+ *
+ * Unlike File, which goes through stdio, BufferedFile reads and
+ * writes the file descriptor directly in large page-aligned blocks,
+ * scans lines with memchr(), and reads blocks at least as large as
+ * its buffer straight to the caller's memory. The single-character
+ * getch(), ungetch() and putch() are inline operations on the buffer.
+ *
+ * Read errors are not reported as end of file: they set the status
+ * to IO_ReadError, which can be checked with status() once atEnd()
+ * returns true.
+ *
+ * The buffer is either in reading or in writing state; switching
+ * between reading and writing flushes the written data or returns
+ * the unread data to the file.
+ *
+ *  @example
+ *  @code
+ *     BufferedFile in ("words.txt", IO_Readable);
+ *     String line;
+ *     while (in.readLine (line))
+ *         lines++;
+ *  @endcode
+ ******************************************************************************/
+class BufferedFile : public IODevice {
+  public:
+						BufferedFile	(const String& name, int mode=0,
+										 uint bufferSize=BUFFEREDFILE_DEFAULT_SIZE);
+	virtual				~BufferedFile	();
+
+	const String&		name			() const {return mName;}
+	virtual bool		open			(int mode);
+	virtual void		close			();
+	virtual void		flush			();
+	virtual uint		size			() const;
+	virtual int			at				() const {return int (position ());}
+	off_t				position		() const {return mOffset + mPos;}
+	virtual bool		seek			(int position) {return seekTo (position);}
+	bool				seekTo			(off_t position);
+	virtual bool		atEnd			() const;
+	virtual	int			readBlock		(char* data, uint len);
+	int					readAt			(off_t offset, char* data, uint len) const;
+	virtual int			readLine		(char* data, uint maxlen);
+	int					readLine		(String& str, int maxlen=-1);
+	virtual int			writeBlock		(const char* data, uint len);
+	int					handle			() const {return mFd;}
+
+	/** Reads one character, or returns -1 at end of file. */
+	virtual int			getch			() {
+		if (mPos < mEnd)
+			return (unsigned char) mpBuffer[mPos++];
+		return getchSlow ();
+	}
+
+	/** Returns the last character read back to the device. */
+	virtual void		ungetch			(char ch) {
+		if (mPos > 0 && !mWriting)
+			mpBuffer[--mPos] = ch;
+		else
+			ungetchSlow (ch);
+	}
+
+	/** Writes one character. */
+	virtual void		putch			(char ch) {
+		if (mWriting && mPos < mCapacity)
+			mpBuffer[mPos++] = ch;
+		else
+			putchSlow (ch);
+	}
+
+  private:
+	int		mFd;		/**< File descriptor, or -1 if closed. */
+	String	mName;		/**< File name of the file. */
+	char*	mpBuffer;	/**< Page-aligned buffer. */
+	uint	mCapacity;	/**< Size of the buffer. */
+	uint	mPos;		/**< Position of the next byte to read or write in the buffer. */
+	uint	mEnd;		/**< End of the valid data in the buffer while reading; 0 while writing. */
+	off_t	mOffset;	/**< File offset of the beginning of the buffer. */
+	bool	mWriting;	/**< The buffer holds data not yet written to the file. */
+	bool	mEof;		/**< The last read from the file hit end of file. */
+
+	int					fill			();
+	bool				startWriting	();
+	int					writeOut		(const char* data, uint len);
+	int					getchSlow		();
+	void				ungetchSlow		(char ch);
+	void				putchSlow		(char ch);
+
+						BufferedFile	(const BufferedFile& other) {FORBIDDEN}
+};
+
+END_NAMESPACE;
+
+#endif
@@ -0,0 +1,265 @@
+/***************************************************************************
+ *   This file is part of the MagiC++ library.                             *
+ *                                                                         *
+ *   Copyright (C) 1998-2002 Marko Grnroos <magi@iki.fi>                  *
+ *                                                                         *
+ ***************************************************************************
+ *                                                                         *
+ *  This library is free software; you can redistribute it and/or          *
+ *  modify it under the terms of the GNU Library General Public            *
+ *  License as published by the Free Software Foundation; either           *
+ *  version 2 of the License, or (at your option) any later version.       *
+ *                                                                         *
+ *  This library is distributed in the hope that it will be useful,        *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU      *
+ *  Library General Public License for more details.                       *
+ *                                                                         *
+ *  You should have received a copy of the GNU Library General Public      *
+ *  License along with this library; see the file COPYING.LIB.  If         *
+ *  not, write to the Free Software Foundation, Inc., 59 Temple Place      *
+ *  - Suite 330, Boston, MA 02111-1307, USA.                               *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef __MAGIC_COMPRESS_H__
+#define __MAGIC_COMPRESS_H__
+
+#include <magic/miodevice.h>
+#include <magic/mpackarray.h>
+#include <magic/mworkerthread.h>
+
+// Decoder states of the compression libraries
+struct z_stream_s;
+struct ZSTD_DCtx_s;
+
+BEGIN_NAMESPACE (MagiC);
+
+/** Default uncompressed size of the frames of a CompressedDevice. */
+#define COMPRESS_FRAME_SIZE		(1024*1024)
+
+/** Size of the input and output buffers of a decompressing device. */
+#define COMPRESS_BUFFER_SIZE	(256*1024)
+
+struct CompressFrame;
+
+/** Location of a frame in a compressed device. */
+struct CompressIndexEntry {
+	long	offset;				/**< Uncompressed position of the frame.    */
+	long	compressedOffset;	/**< Position of the frame in the device.   */
+	uint	size;				/**< Uncompressed size of the frame.        */
+	uint	compressedSize;		/**< Compressed size of the frame.          */
+};
+
+/*******************************************************************************
+ * Base of the devices that compress the data written to another
+ * device, or decompress the data read from it.
+ *
+ * The device owns the device it wraps, and is either readable or
+ * writable. Streams work on it as on any device:
+ *
+ *  @code
+ *     TextOStream out (new GzipDevice (new File ("log.gz", IO_Writable)));
+ *     out << "Compressed line\n";
+ *  @endcode
+ *
+ * Written data is cut into frames that are compressed independently,
+ * each one a complete gzip member or zstd frame, so that the standard
+ * tools decompress the result. With @ref setThreads(), a
+ * @ref WorkerPool compresses several frames at once while the next
+ * ones are filled; the frames are written in order. @ref flush()
+ * writes the completed frames, and @ref endFrame() also the data of
+ * the frame being filled.
+ *
+ * Closing a writable device appends an index of the frames, which the
+ * decompressors skip. When reading a device that can seek, @ref seek()
+ * uses the index to start decompressing at the frame that holds the
+ * position, instead of at the beginning.
+ *
+ * The devices exist if configure found their libraries: GzipDevice
+ * with HAVE_ZLIB, and ZstdDevice with HAVE_ZSTD. Programs that link
+ * with libmagic.a must then also link with -lz and -lzstd, even if
+ * they only use @ref readStringMap, which decompresses with these
+ * devices.
+ ******************************************************************************/
+class CompressedDevice : public IODevice, public RequestHandler {
+  public:
+	virtual				~CompressedDevice	();
+
+	static IODevice*	decompressor		(IODevice* device);
+
+	IODevice*			device				() const {return mpDevice;}
+	void				setThreads			(int threads);
+	void				setFrameSize		(uint size);
+	int					frameCount			() const {return mIndex.size ();}
+	bool				hasIndex			();
+	long				position			() const {return mPosition;}
+	long				compressedSize		() const {return mCompressed;}
+
+	virtual bool		open				(int mode);
+	virtual void		close				();
+	virtual void		flush				();
+	void				endFrame			();
+	virtual uint		size				() const;
+	virtual int			at					() const {return int (mPosition);}
+	virtual bool		seek				(int position) {return seekTo (position);}
+	bool				seekTo				(long position);
+	virtual bool		atEnd				() const;
+	virtual int			readBlock			(char* data, uint maxlen);
+	virtual int			readLine			(char* data, uint maxlen);
+	int					readLine			(String& str, int maxlen=-1);
+	virtual int			writeBlock			(const char* data, uint len);
+
+	/** Reads one character, or returns -1 at the end. */
+	virtual int			getch				() {
+		if (mOutPos < mOutEnd) {
+			mPosition++;
+			return (unsigned char) mpOut[mOutPos++];
+		}
+		return getchSlow ();
+	}
+
+	/** Returns the last character read back to the device. */
+	virtual void		ungetch				(char ch) {
+		if (mOutPos > 0) {
+			mpOut[--mOutPos] = ch;
+			mPosition--;
+		}
+	}
+
+	/** Writes one character. */
+	virtual void		putch				(char ch) {
+		if (mpFrame && mFrameLen < mFrameSize) {
+			mpFrame[mFrameLen++] = ch;
+			mPosition++;
+		} else
+			writeBlock (&ch, 1);
+	}
+
+	// Implementations
+	virtual void		process				(Request* pRequest);
+
+  protected:
+						CompressedDevice	(IODevice* device, int level);
+
+	/** Compresses the data into one complete frame. Called by several
+	 *  threads at once.
+	 **/
+	virtual void		compressFrame		(const char* data, uint length, PackArray<char>& out) const = 0;
+
+	/** Prepares to decompress from the beginning of a frame. */
+	virtual void		resetDecoder		() = 0;
+
+	/** Decompresses from the input into the output, advancing the
+	 *  input, and sets mFrameDone at the end of a frame.
+	 *
+	 *  @return The number of bytes decompressed, or -1 if the data
+	 *  is corrupt.
+	 **/
+	virtual int			decode				(const char*& input, uint& inputLength, char* output, uint outputLength) = 0;
+
+	/** Appends the index of the frames to the output. */
+	virtual void		writeIndex			(PackArray<char>& out) const = 0;
+
+	/** Reads the index of the frames from the end of the device. */
+	virtual bool		readIndex			() = 0;
+
+	bool				readDeviceAt		(long offset, char* data, uint length);
+	void				addIndexEntry		(uint size, uint compressedSize);
+
+	IODevice*			mpDevice;		/**< Device of the compressed data.              */
+	int					mLevel;			/**< Compression level.                          */
+	bool				mFrameDone;		/**< Is the decoder between frames?              */
+	PackArray<CompressIndexEntry> mIndex; /**< Frames written, or read from the index. */
+
+  private:
+	int					fill			();
+	int					getchSlow		();
+	void				writeFrame		(uint size, const PackArray<char>& data);
+	void				writeFrames		(bool all);
+	void				loadIndex		();
+
+	// Reading
+	char*				mpIn;			/**< Compressed input.                           */
+	uint				mInPos;
+	uint				mInEnd;
+	char*				mpOut;			/**< Decompressed output, after the kept byte.   */
+	uint				mOutPos;
+	uint				mOutEnd;
+	bool				mInputEnd;		/**< Has the device reached its end?             */
+	bool				mDecoderFull;	/**< Did the last decode fill the output?        */
+	bool				mEnd;			/**< No more data to decompress.                 */
+	bool				mIndexLoaded;	/**< Has the index been looked for?              */
+
+	// Writing
+	char*				mpFrame;		/**< Data of the frame being filled.             */
+	uint				mFrameLen;
+	uint				mFrameSize;
+	PackArray<char>		mOutput;		/**< Compressed frame, without threads.          */
+	WorkerPool*			mpPool;			/**< Compressing threads, or NULL.               */
+	int					mThreads;
+	DummyLog			mLog;
+	CompressFrame*		mpFirst;		/**< Oldest frame being compressed.              */
+	CompressFrame*		mpLast;			/**< Newest frame being compressed.              */
+	int					mInFlight;		/**< Frames being compressed.                    */
+
+	long				mPosition;		/**< Uncompressed position.                      */
+	long				mCompressed;	/**< Compressed bytes read or written.           */
+
+						CompressedDevice	(const CompressedDevice& other) {FORBIDDEN}
+};
+
+#ifdef HAVE_ZLIB
+/*******************************************************************************
+ * Compresses or decompresses the data of another device in the gzip
+ * format, with zlib.
+ *
+ * The frames are gzip members. The index is an extra empty member
+ * that holds the sizes of the frames in an extra field, for at most
+ * 8190 frames; larger outputs are written without an index.
+ ******************************************************************************/
+class GzipDevice : public CompressedDevice {
+  public:
+						GzipDevice		(IODevice* device, int mode=0, int level=6);
+	virtual				~GzipDevice		();
+
+  protected:
+	virtual void		compressFrame	(const char* data, uint length, PackArray<char>& out) const;
+	virtual void		resetDecoder	();
+	virtual int			decode			(const char*& input, uint& inputLength, char* output, uint outputLength);
+	virtual void		writeIndex		(PackArray<char>& out) const;
+	virtual bool		readIndex		();
+
+  private:
+	struct z_stream_s*	mpStream;		/**< The decoder, or NULL. */
+};
+#endif
+
+#ifdef HAVE_ZSTD
+/*******************************************************************************
+ * Compresses or decompresses the data of another device in the zstd
+ * format.
+ *
+ * The index is the seek table of the seekable zstd format, in a
+ * skippable frame at the end.
+ ******************************************************************************/
+class ZstdDevice : public CompressedDevice {
+  public:
+						ZstdDevice		(IODevice* device, int mode=0, int level=3);
+	virtual				~ZstdDevice		();
+
+  protected:
+	virtual void		compressFrame	(const char* data, uint length, PackArray<char>& out) const;
+	virtual void		resetDecoder	();
+	virtual int			decode			(const char*& input, uint& inputLength, char* output, uint outputLength);
+	virtual void		writeIndex		(PackArray<char>& out) const;
+	virtual bool		readIndex		();
+
+  private:
+	struct ZSTD_DCtx_s*	mpStream;		/**< The decoder, or NULL. */
+};
+#endif
+
+END_NAMESPACE;
+
+#endif
@@ -26,9 +26,18 @@
 #define __MAGIC_MDATASTREAM_H__
 
 #include "magic/mstream.h"
+#include "magic/mpackarray.h"
 
 BEGIN_NAMESPACE (MagiC);
 
+/** Size of the buffer of binary data streams. */
+#define DATASTREAM_BUFFER_SIZE	65536
+
+// The binary format is little-endian; other hosts swap the bytes.
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define DATASTREAM_SWAP_BYTES 1
+#endif
+
 class DataStream;
 class DataIStream;
 class DataOStream;
@@ -42,12 +51,32 @@ class DataOStream;
 //           |__/   \__|   \  \__| ___/    \ |    \__   \__| | | |           //
 ///////////////////////////////////////////////////////////////////////////////
 
-/** Abstract baseclass for data streams. */
+/** Abstract baseclass for data streams.
+ *
+ *  In binary mode, data streams use a portable format: integers and
+ *  string lengths are LEB128 varints, signed integers zigzag-encoded,
+ *  and floating-point values little-endian IEEE 754, so that int and
+ *  long are stored the same way on 32- and 64-bit hosts. Strings are
+ *  stored as their length followed by the characters. Arrays of
+ *  plain data are stored as little-endian items one after another.
+ **/
 class DataStream {
   public:
 						DataStream		() {}
-	
-  private:
+
+  protected:
+	/** Copies n items of the given size from src to dst, converting
+	 *  between the host and the little-endian byte order.
+	 **/
+	static void			copyLE			(char* dst, const char* src, uint size, uint n) {
+#ifdef DATASTREAM_SWAP_BYTES
+		for (uint i=0; i<n; i++, dst+=size, src+=size)
+			for (uint b=0; b<size; b++)
+				dst[b] = src[size-1-b];
+#else
+		memcpy (dst, src, size*n);
+#endif
+	}
 };
 
 
@@ -64,11 +93,26 @@ class DataStream {
 
 class DataOStream : public OStream, public DataStream {
   public:
-	
+	enum formattingFlags {
+		FMT_RECORD			= 0x000002, /**< Dummy recording output mode for gathering attribute data. */
+		FMT_BINARY			= 0x000000, /**< Should the stream be binary? */
+		FMT_TEXT			= 0x000010, /**< Should the stream be text? */
+		FMT_FORMATTED		= 0x000020, /**< Should the stream be formatted text? */
+		FMT_VERINFO			= 0x000040, /**< Should the stream include version info? */
+		FMT_ADDRESSES		= 0x000080, /**< Should the stream include memory addresses of the objects? */
+		FMT_OBJECTNAMES		= 0x000100, /**< Should the stream include object names? */
+		FMT_CLASSNAMES		= 0x000200, /**< Should the stream include class names of objects? */
+	};
+
 						DataOStream		(FILE* strm=stdout);
 						DataOStream		(OStream& o);
+						DataOStream		(IODevice& dev, int formatMode=FMT_TEXT);
 	virtual				~DataOStream	();
 
+	/** Is the stream in the binary format? */
+	bool				isBinary		() const {return !(mFormatMode & (FMT_TEXT | FMT_RECORD));}
+	virtual void		flush			();
+
 
 	// Implementations
 
@@ -80,6 +124,48 @@ class DataOStream : public OStream, public DataStream {
 	DataOStream&		operator<<		(const char* str);
 	DataOStream&		operator<<		(const String& str);
 	uint				writeRawBytes	(const char* p, uint n);
+	DataOStream&		writeVarint		(unsigned long long value);
+
+	/** Writes the items of a plain data array, without their count.
+	 *
+	 *  In binary mode, the items are copied to the stream as a block.
+	 **/
+	template <class TYPE>
+	DataOStream&		writeArray		(const TYPE* items, uint n) {
+		if (!isBinary ()) {
+			for (uint i=0; i<n; i++)
+				*this << items[i];
+			return *this;
+		}
+
+		ASSERT (sizeof(TYPE) == 1 || sizeof(TYPE) == 2 || sizeof(TYPE) == 4 || sizeof(TYPE) == 8);
+		const char* src = (const char*) items;
+		for (uint left = n; left > 0;) {
+			// Convert as much as fits in the buffer at once
+			uint fits = (DATASTREAM_BUFFER_SIZE - mBufLen) / sizeof(TYPE);
+			if (fits == 0 || !mpBuffer) {
+				flushBuffer ();
+				continue;
+			}
+			if (fits > left)
+				fits = left;
+			copyLE (mpBuffer + mBufLen, src, sizeof(TYPE), fits);
+			mBufLen += fits * sizeof(TYPE);
+			src += fits * sizeof(TYPE);
+			left -= fits;
+		}
+		return *this;
+	}
+
+	/** Writes the size of the array followed by its items. */
+	template <class TYPE>
+	DataOStream&		writeArray		(const PackArray<TYPE>& array) {
+		if (isBinary ())
+			writeVarint (array.size ());
+		else
+			*this << array.size ();
+		return array.size ()? writeArray (&array[0], array.size ()) : *this;
+	}
 
 	/** Sets the name of the object <<:ed next to the stream.
 	 *
@@ -104,17 +190,19 @@ class DataOStream : public OStream, public DataStream {
 	
 	friend DataOStream& operator<< (DataOStream& out, const Object& obj);
 	friend DataOStream& operator>> (DataOStream& in, Object& obj);
-	
-	enum formattingFlags {
-		FMT_RECORD			= 0x000002, /**< Dummy recording output mode for gathering attribute data. */
-		FMT_BINARY			= 0x000000, /**< Should the stream be binary? */
-		FMT_TEXT			= 0x000010, /**< Should the stream be text? */
-		FMT_FORMATTED		= 0x000020, /**< Should the stream be formatted text? */
-		FMT_VERINFO			= 0x000040, /**< Should the stream include version info? */
-		FMT_ADDRESSES		= 0x000080, /**< Should the stream include memory addresses of the objects? */
-		FMT_OBJECTNAMES		= 0x000100, /**< Should the stream include object names? */
-		FMT_CLASSNAMES		= 0x000200, /**< Should the stream include class names of objects? */
-	};
+
+	/** Adds data to the binary buffer. */
+	void				put				(const char* data, uint n) {
+		if (n == 0)
+			return;
+		if (mBufLen + n <= DATASTREAM_BUFFER_SIZE && mpBuffer) {
+			memcpy (mpBuffer + mBufLen, data, n);
+			mBufLen += n;
+		} else
+			putSlow (data, n);
+	}
+	void				putSlow			(const char* data, uint n);
+	void				flushBuffer		();
 
   protected:
 	String			mNextName;	/**< Name of the next object to output, as given with the name() function. */
@@ -122,7 +210,9 @@ class DataOStream : public OStream, public DataStream {
 	int				mPrevDepth;	/**< Indentation depth of previous output. */
 	Array<String>*	mAttribs;	/**< Stored attributes. */
 	int				mErrst;		/**< Error status. */
-	
+	char*			mpBuffer;	/**< Buffer for binary output, allocated on first use. */
+	uint			mBufLen;	/**< Number of bytes in the buffer. */
+
 	int				open		(const char* filename, int flag);
 };
 
@@ -142,15 +232,20 @@ class DataOStream : public OStream, public DataStream {
 //                                                                           //
 ///////////////////////////////////////////////////////////////////////////////
 
-/** Input stream. */
+/** Input stream for the binary format of DataOStream.
+ *
+ *  The stream reads the device in large blocks, so it may read past
+ *  the data it returns. The device should not be read otherwise while
+ *  the stream is in use.
+ **/
 class DataIStream : public IStream, public DataStream {
   public:
-							DataIStream		(IODevice& dev)			: IStream (dev) {;}
-							DataIStream		(IODevice* dev)			: IStream (dev) {;}
-							DataIStream		(const String& buffer)	: IStream (const_cast<String&> (buffer)) {;}
-							DataIStream		(FILE* strm = stdin)	: IStream (strm) {;}
-							DataIStream		(DataIStream& o)		: IStream (o) {;}
-	virtual					~DataIStream	() {}
+							DataIStream		(IODevice& dev)			: IStream (dev) {init ();}
+							DataIStream		(IODevice* dev)			: IStream (dev) {init ();}
+							DataIStream		(const String& buffer)	: IStream (const_cast<String&> (buffer)) {init ();}
+							DataIStream		(FILE* strm = stdin)	: IStream (strm) {init ();}
+							DataIStream		(DataIStream& o)		: IStream (o) {init ();}
+	virtual					~DataIStream	() {delete [] mpBuffer;}
 	
 	virtual DataIStream&	operator>>		(char& i);
 	virtual DataIStream&	operator>>		(int& i);
@@ -159,6 +254,50 @@ class DataIStream : public IStream, public DataStream {
 	virtual DataIStream&	operator>>		(double& i);
 	virtual DataIStream&	operator>>		(String& s);
 	virtual uint			readRawBytes	(char* p, uint n);
+	unsigned long long		readVarint		();
+
+	/** Reads the given number of items of a plain data array, written
+	 *  with DataOStream::writeArray().
+	 **/
+	template <class TYPE>
+	DataIStream&			readArray		(TYPE* items, uint n) {
+		ASSERT (sizeof(TYPE) == 1 || sizeof(TYPE) == 2 || sizeof(TYPE) == 4 || sizeof(TYPE) == 8);
+		readRawBytes ((char*) items, n * sizeof(TYPE));
+#ifdef DATASTREAM_SWAP_BYTES
+		for (uint i=0; i<n; i++) {
+			TYPE item = items[i];
+			copyLE ((char*) &items[i], (const char*) &item, sizeof(TYPE), 1);
+		}
+#endif
+		return *this;
+	}
+
+	/** Reads an array written with its size, resizing the array. */
+	template <class TYPE>
+	DataIStream&			readArray		(PackArray<TYPE>& array) {
+		unsigned long long size = readVarint ();
+		if (size > 0x7fffffff)
+			throw io_error (i18n("Invalid array size %1 in data stream.").arg(long (size)));
+		array.make (size);
+		return size? readArray (&array[0], size) : *this;
+	}
+
+  protected:
+	/** Reads data from the buffer. */
+	void					get				(char* data, uint n) {
+		if (mBufPos + n <= mBufEnd) {
+			memcpy (data, mpBuffer + mBufPos, n);
+			mBufPos += n;
+		} else
+			getSlow (data, n);
+	}
+	void					getSlow			(char* data, uint n);
+	void					init			() {mpBuffer = NULL; mBufPos = mBufEnd = 0;}
+
+  private:
+	char*	mpBuffer;	/**< Buffer for reading the device, allocated on first use. */
+	uint	mBufPos;	/**< Position of the next byte to read in the buffer. */
+	uint	mBufEnd;	/**< Number of bytes in the buffer. */
 };
 
 END_NAMESPACE;
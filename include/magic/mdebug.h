@@ -26,6 +26,8 @@
 #define __DEBUG_H__
 
 #include <cstddef>
+#include <new>
+#include <stdio.h>
 
 // Remove new-redefinition
 #ifdef new
@@ -167,7 +169,7 @@ extern void assertwith (const char* filename, int lineno, const char* funcname,
 
 extern void* operator new[] (size_t size, const char* filen, int lineno, const char* funcn);
 extern void* operator new (size_t size, const char* filen, int lineno, const char* funcn);
-extern void operator delete (void* p);
+extern void operator delete (void* p) throw ();
 extern void list_allocations (int number=100, FILE* out=stderr);
 extern void* _renew (void* p, size_t newsize, const char* filen, int lineno, const char* funcn);
 extern "C" void newComment (const char* comment);
@@ -178,26 +180,70 @@ extern "C" void newComment (const char* comment);
 #undef new_UNDEFD
 #endif
 
+struct AllocLedger;
+struct AllocSample;
+struct AllocClassStat;
+
+#ifdef DEBUG_OBJECT_NEW
+namespace MagiC {class Class;}
+extern void bindObjectClass (const void* object, const MagiC::Class* cls);
+
+/** Member that decl_dynamic adds to each dynamic class with
+ *  DEBUG_OBJECT_NEW.
+ *
+ *  The members are constructed after the base classes of the object,
+ *  so each dynamic class binds the object in turn and the last one is
+ *  the class of the object itself. The offset of the member is
+ *  remembered from the first constructed object, as a copied member
+ *  is not told its owner.
+ **/
+template <class TYPE, MagiC::Class** CLS>
+struct ObjectClassTag {
+	ObjectClassTag (const TYPE* owner) {
+		__atomic_store_n (&sOffset, (const char*) this - (const char*) owner, __ATOMIC_RELAXED);
+		bindObjectClass (owner, *CLS);
+	}
+	ObjectClassTag (const ObjectClassTag& other) {
+		long offset = __atomic_load_n (&sOffset, __ATOMIC_RELAXED);
+		if (offset >= 0)
+			bindObjectClass ((const char*) this - offset, *CLS);
+	}
+	ObjectClassTag&	operator= (const ObjectClassTag& other) {return *this;}
+
+	static long sOffset;	/**< Offset of the member in TYPE, -1 until known. */
+};
+
+template <class TYPE, MagiC::Class** CLS>
+long ObjectClassTag<TYPE,CLS>::sOffset = -1;
+#endif
+
+/** Information block in front of each traced allocation.
+ *
+ *  Each thread links the blocks it allocates into its own ledger, so
+ *  threads never contend on a shared list. The aligned attribute
+ *  keeps the user block aligned for any type.
+ **/
 struct mallocinfostr {
-	char			startsym[6];
-	int 			size;
+	char			startsym[6];	/**< Label "MiS_S" if traced, "MiS_U" if not. */
+	bool			renewed;
+	bool			isObject;
+	size_t			size;
 	const char*		filename;
 	int				lineno;
 	const char*		funcname;
 	char*			newcomment;
-	bool			renewed;
-	bool			isObject;
+	AllocSample*	sample;			/**< Call stack, if the allocation was sampled. */
+	AllocClassStat*	classStat;		/**< Per-class counter the block is accounted to, if any. */
+	AllocLedger*	ledger;			/**< Ledger of the allocating thread. */
 	mallocinfostr*	next;
 	mallocinfostr*	prev;
+	mallocinfostr*	nextRemote;		/**< Link in the remote free stack of the ledger. */
+} __attribute__ ((aligned (16)));
 
-	// This is required to corrent double-allocation word frame shift,
-	// which results in BUS ERROR when writing to a double reference
-	char			padding[4];
-};
-
-extern mallocinfostr* lastmalloced;		// The last malloced memory block
-extern int dbgnewmalloced;				// Total amount of memory malloced
-extern int newtrace_disabled;
+extern long dbgnewmalloced;				// Total amount of memory malloced
+extern int newtrace_disabled;			// Disables tracing; set by default
+extern int newtrace_fill;				// Fill allocated and freed blocks with 0xcc and 0xdd
+extern long newtrace_sampling;			// Bytes between stack samples; 0 samples all, -1 none
 
 #else // DISABLE_ALL_MEMORY_DEBUGGING
 // Some dummy function definitions
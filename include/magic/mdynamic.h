@@ -50,6 +50,19 @@ class GetClassInstance {
 #define CLONEMETHOD(cls) cls* clone () const {return new cls (*this);}
 #define decl_clonable(classname) public: CLONEMETHOD (classname) private:
 
+/*******************************************************************************
+ * With DEBUG_OBJECT_NEW, each dynamic class has a member that binds the
+ * allocated object to the class for the memory debugger when the
+ * object is constructed (see ObjectClassTag in mdebug.h). The member
+ * has no size.
+ ******************************************************************************/
+#if defined(DEBUG_OBJECT_NEW) && defined(MEMORY_DEBUG)
+#define decl_dynamic_tag(classname) \
+	[[no_unique_address]] ObjectClassTag<classname, &classname::class_##classname> mClassTag_##classname {this};
+#else
+#define decl_dynamic_tag(classname)
+#endif
+
 /*******************************************************************************
  * Declares the dynamic features of a class
  *
@@ -57,6 +70,7 @@ class GetClassInstance {
  ******************************************************************************/
 #define decl_dynamic(classname) \
 	static Class* class_##classname;\
+	decl_dynamic_tag (classname)\
   public:\
 	virtual	const Class&	getclass	() const {return *class_##classname;}\
   protected:
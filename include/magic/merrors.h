@@ -33,6 +33,8 @@
 #define MERR_TIMEOUT                2
 #define MERR_NULL_ARGUMENT          3
 #define MERR_LOG_INVALID_FATALITY   4
+#define MERR_LOG_DROPPED            5
+#define MERR_LOG_CORRUPT            6
 
 /*******************************************************************************
  * File errors
@@ -51,4 +53,6 @@
 #define MERR_THREAD_BASE            1000
 #define MERR_THREAD_CREATE_FAILED   (MERR_THREAD_BASE)
 #define MERR_THREAD_JOIN_FAILED     (MERR_THREAD_BASE+1)
+#define MERR_THREAD_QUEUE_FULL      (MERR_THREAD_BASE+2)
+#define MERR_THREAD_POOL_SHUTDOWN   (MERR_THREAD_BASE+3)
 #endif
@@ -69,6 +69,13 @@ enum io_states {
 	IO_EOS			= 0x00000200	/**< The device is at end-of-stream. */
 };
 
+// I/O Events
+enum io_events {
+	IO_ReadReady	= 0x00000001,	/**< The device has data to read, or is at its end. */
+	IO_WriteReady	= 0x00000002,	/**< The device can take data to write. */
+	IO_HangUp		= 0x00000004	/**< The other end has closed, or the device has an error. */
+};
+
 // I/O Statuses
 enum io_statuses {
 	IO_Ok			= 0x00000000,	/**< Operation was successful. */
@@ -134,6 +141,9 @@ class IODevice : public Object {
 	virtual void		putch				(char ch);
 	virtual void		ungetch				(char ch);
 
+	/** Returns the file descriptor of the device, or -1 if it has none. */
+	virtual int			handle				() const {return -1;}
+
   protected:
 	void				setFlags			(int flags) {mFlags = flags;}
 	void				setType				(int ftype) {mType = ftype;}
@@ -208,7 +218,7 @@ class File : public IODevice {
 	virtual int			getch		();
 	virtual void		putch		(char);
 	virtual void		ungetch		(char);
-	int					handle		();
+	virtual int			handle		() const;
 
   private:
 	FILE*	mpFile;		/**< File stream. */
@@ -25,72 +25,207 @@
 #ifndef __MAGIC_LIST_H__
 #define __MAGIC_LIST_H__
 
+#include "magic/mpackarray.h"
+
+BEGIN_NAMESPACE (MagiC);
+
+/** Number of bytes of items held by one node of a @ref List. */
+#define LIST_NODE_BYTES	512
+
+/** A node of @ref List. Holds a run of up to capacity items, which
+ *  are in the mItems block between mBegin and mEnd. Nodes are never
+ *  left empty in a list.
+ **/
 template <class T>
 class ListNode {
   public:
-	T			mData;		// Actual data object
-	ListNode*	mPrevNext;	// Previous and next nodes, with addresses XORed
+	enum {capacity = (LIST_NODE_BYTES/sizeof (T) > 8)? LIST_NODE_BYTES/sizeof (T) : 8};
 
-				ListNode	(T data) {mData=data; mPrevNext=NULL;}
-				~ListNode	() {/*delete mData;*/} // Observe that we can't delete the rest of list from here
+	ListNode*	mPrev;		// Previous node, or NULL
+	ListNode*	mNext;		// Next node, or NULL
+	int			mBegin;		// Index of the first item
+	int			mEnd;		// Index after the last item
+	T*			mItems;		// Room for capacity items
+
+				ListNode	(int begin) {
+					mPrev = mNext = NULL;
+					mBegin = mEnd = begin;
+					mItems = (T*) new char [capacity * sizeof (T)];
+				}
+				~ListNode	() {
+					for (int i=mBegin; i<mEnd; i++)
+						mItems[i].~T ();
+					delete [] (char*) mItems;
+				}
 };
 
 template <class T> class ListIter;
 
-/** Virtually double-linked list (using XOR address encoding) */
+/*******************************************************************************
+ * Double-linked list of items, kept by value.
+ *
+ * The items are kept in nodes of many items each, about
+ * LIST_NODE_BYTES bytes of them, so adding an item allocates memory
+ * only once per node, and iterating reads the items mostly from
+ * consecutive memory, instead of following a pointer per item. Items
+ * can be added to either end, and removed at any place with @ref
+ * ListIter::deleteCurrent, which closes the gap in the node by moving
+ * the items on its shorter side.
+ *
+ * The items are moved as raw memory, so as with @ref PackArray, they
+ * must not hold pointers to themselves.
+ *
+ * Lists are iterated with @ref ListIter.
+ ******************************************************************************/
 template <class T>
 class List {
   public:
-					List		() {mFirst=mLast=NULL;}
+					List		() {mFirst=mLast=NULL; mSize=0;}
 					List		(const List<T>& orig) {
 						mFirst=mLast=NULL;
+						mSize=0;
 						copy (orig);
 					}
 					~List		() {empty();}
-	
-	void			add			(T object) {
-		if (mLast) { // Append to tail
-			ListNode<T>* newNode = new ListNode<T> (object);
-			mLast->mPrevNext = (ListNode<T>*) (WORD(mLast->mPrevNext) ^ WORD(newNode));
-			newNode->mPrevNext = mLast;
-			mLast = newNode;
-		} else // First node
-			mFirst = mLast = new ListNode<T> (object);
+
+	List<T>&		operator=	(const List<T>& orig) {
+		if (this != &orig)
+			copy (orig);
+		return *this;
+	}
+
+	/** Adds a copy of the object to the end of the list. */
+	void			add			(const T& object) {
+		packConstruct (addSlot (), object);
+		mLast->mEnd++;
+		mSize++;
+	}
+
+	/** Adds a default-constructed item to the end of the list and
+	 *  returns it, so that it can be filled in place.
+	 **/
+	T&				addNew		() {
+		T* item = addSlot ();
+		packConstruct (item);
+		mLast->mEnd++;
+		mSize++;
+		return *item;
+	}
+
+	/** Adds a copy of the object to the beginning of the list. */
+	void			prepend		(const T& object) {
+		if (!mFirst || mFirst->mBegin == 0) {
+			ListNode<T>* node = new ListNode<T> (ListNode<T>::capacity);
+			node->mNext = mFirst;
+			if (mFirst)
+				mFirst->mPrev = node;
+			else
+				mLast = node;
+			mFirst = node;
+		}
+		packConstruct (mFirst->mItems + mFirst->mBegin - 1, object);
+		mFirst->mBegin--;
+		mSize++;
+	}
+
+	/** Adds copies of the given count of items to the end of the list.
+	 *  Fills the nodes a run of items at a time.
+	 **/
+	void			append		(const T* items, int count) {
+		while (count > 0) {
+			T* slot = addSlot ();
+			int room = ListNode<T>::capacity - mLast->mEnd;
+			int n = (count < room)? count : room;
+			for (int i=0; i<n; i++)
+				packConstruct (slot+i, items[i]);
+			mLast->mEnd += n;
+			mSize += n;
+			items += n;
+			count -= n;
+		}
 	}
-	//void			add			(const T& obj) {add (new T (obj));}
 
 	ListNode<T>*	getFirst	() {return mFirst;}
 	ListNode<T>*	getLast		() {return mLast;}
 
+	/** Returns the number of items in the list. */
+	int				size		() const {return mSize;}
+
 	void			empty		() {
-		for (ListNode<T>* i=mFirst, *prev=NULL; i; ) {
-			ListNode<T>* cur = i; // A temporary
-			// Iterate here, not in for(;;), because we don't want to use a deleted node.
-			i = (ListNode<T>*) (WORD(prev) ^ WORD(i->mPrevNext));
-			prev = cur;
-			delete cur;	// And now delete
+		for (ListNode<T>* i=mFirst; i; ) {
+			ListNode<T>* cur = i;
+			i = i->mNext;
+			delete cur;
 		}
 		mFirst=mLast=NULL;
+		mSize=0;
 	}
 
+	/** Makes the list a copy of the given one. */
 	void			copy		(const List<T>& orig) {
 		empty ();
+		for (const ListNode<T>* i=orig.mFirst; i; i=i->mNext)
+			append (i->mItems + i->mBegin, i->mEnd - i->mBegin);
 	}
 
-	/** Moves all items from the given list to this list */
+	/** Moves all items from the given list to the end of this list,
+	 *  leaving the given list empty. Takes constant time, as the nodes
+	 *  are moved as they are.
+	 **/
 	void			moveItemsFrom	(List<T>& orig) {
-		empty ();
-		mFirst = orig.mFirst;
+		if (&orig == this || !orig.mFirst)
+			return;
+		if (mLast) {
+			mLast->mNext = orig.mFirst;
+			orig.mFirst->mPrev = mLast;
+		} else
+			mFirst = orig.mFirst;
 		mLast = orig.mLast;
+		mSize += orig.mSize;
 		orig.mFirst = orig.mLast = NULL;
+		orig.mSize = 0;
 	}
 	
   protected:
+	/** Returns the place of a new item at the end of the list, adding
+	 *  a node if the last one is full.
+	 **/
+	T*				addSlot		() {
+		if (!mLast || mLast->mEnd == ListNode<T>::capacity) {
+			ListNode<T>* node = new ListNode<T> (0);
+			node->mPrev = mLast;
+			if (mLast)
+				mLast->mNext = node;
+			else
+				mFirst = node;
+			mLast = node;
+		}
+		return mLast->mItems + mLast->mEnd;
+	}
+
+	/** Removes an empty node from the list and deletes it. */
+	void			removeNode	(ListNode<T>* node) {
+		if (node->mPrev)
+			node->mPrev->mNext = node->mNext;
+		else
+			mFirst = node->mNext;
+		if (node->mNext)
+			node->mNext->mPrev = node->mPrev;
+		else
+			mLast = node->mPrev;
+		delete node;
+	}
+
 	ListNode<T>		*mFirst, *mLast;
+	int				mSize;
 
 	friend class ListIter<T>;
 };
 
+/** Iterator of @ref List. Stepping past either end makes the iterator
+ *  exhausted; stepping again from there starts over from the first
+ *  item with @ref next() or from the last item with @ref previous().
+ **/
 template <class T>
 class ListIter {
   public:
@@ -99,59 +234,72 @@ class ListIter {
 					ListIter		(const List<T>& list, bool backward=false)
 							: mList (const_cast<List<T>&>(list)) {backward? last() : first();}
 					ListIter		(const ListIter<T>& orig)
-							: mList(orig.mList), mCurrent(orig.mCurrent), mPrevious (orig.mPrevious) {}
-	void			first			() {mCurrent=mList.getFirst(); mPrevious=NULL;}
+							: mList(orig.mList), mNode(orig.mNode), mIndex (orig.mIndex) {}
+	void			first			() {
+		mNode = mList.mFirst;
+		mIndex = mNode? mNode->mBegin : 0;
+	}
 	void			last			() {
-		mCurrent = mList.getLast();
-		if (mCurrent)
-			mPrevious = mCurrent->mPrevNext; // Trivial as next is NULL
-		else
-			mPrevious = NULL;
+		mNode = mList.mLast;
+		mIndex = mNode? mNode->mEnd-1 : 0;
 	}
 	void			next			() {
-		if (mCurrent) {
-			ListNode<T>* cur = mCurrent;
-			mCurrent = (ListNode<T>*) (WORD(mPrevious) ^ WORD(mCurrent->mPrevNext));
-			mPrevious = cur;
-		} else
+		if (!mNode)
 			first ();
+		else if (++mIndex == mNode->mEnd) {
+			mNode = mNode->mNext;
+			if (mNode)
+				mIndex = mNode->mBegin;
+		}
 	}
 	void			previous		() {
-		ListNode<T>* cur = mCurrent;
-		mCurrent = mPrevious;
-		if (mCurrent)
-			mPrevious = (ListNode<T>*)(int(cur) ^ WORD(mCurrent->mPrevNext));
-		else
-			mPrevious = NULL;
+		if (!mNode)
+			last ();
+		else if (mIndex-- == mNode->mBegin) {
+			mNode = mNode->mPrev;
+			if (mNode)
+				mIndex = mNode->mEnd-1;
+		}
 	}
-	bool			exhausted		() const {return !mCurrent;}
-	T&				get				() {return mCurrent->mData;}
-	T*				getp			() {return &mCurrent->mData;}
+	bool			exhausted		() const {return !mNode;}
+	T&				get				() {return mNode->mItems[mIndex];}
+	T*				getp			() {return mNode->mItems + mIndex;}
+
+	/** Deletes the current item; the iterator moves to the next one. */
 	void			deleteCurrent	() {
-		if (!mCurrent)
+		if (!mNode)
 			return;
-		
-		ListNode<T>* nextNode = (ListNode<T>*) (WORD(mPrevious) ^ WORD(mCurrent->mPrevNext));
-		// Adjust links of the surrounding nodes
-		if (nextNode) {
-			ListNode<T>* nextnextNode = (ListNode<T>*) (WORD(mCurrent) ^ WORD(nextNode->mPrevNext));
-			nextNode->mPrevNext = (ListNode<T>*) (WORD(nextnextNode) ^ WORD(mPrevious));
-		} else // We are at last node
-			mList.mLast = mPrevious;
-			
-		if (mPrevious) {
-			ListNode<T>* prevprevNode = (ListNode<T>*) (WORD(mCurrent) ^ WORD(mPrevious->mPrevNext));
-			mPrevious->mPrevNext = (ListNode<T>*) (WORD(prevprevNode) ^ WORD(nextNode));
-		} else // We are at first node
-			mList.mFirst = nextNode;
-
-		delete mCurrent;
-		mCurrent = nextNode;
+
+		ListNode<T>* node = mNode;
+		T* items = node->mItems;
+		items[mIndex].~T ();
+		mList.mSize--;
+
+		// Close the gap from the shorter side
+		if (mIndex - node->mBegin < node->mEnd-1 - mIndex) {
+			memmove ((void*) (items + node->mBegin + 1), (void*) (items + node->mBegin),
+					 (mIndex - node->mBegin) * sizeof (T));
+			node->mBegin++;
+			mIndex++;
+		} else {
+			memmove ((void*) (items + mIndex), (void*) (items + mIndex + 1),
+					 (node->mEnd-1 - mIndex) * sizeof (T));
+			node->mEnd--;
+		}
+
+		if (mIndex == node->mEnd) {
+			mNode = node->mNext;
+			mIndex = mNode? mNode->mBegin : 0;
+		}
+		if (node->mBegin == node->mEnd)
+			mList.removeNode (node);
 	}
   protected:
 	List<T>&		mList;
-	ListNode<T>*	mCurrent;
-	ListNode<T>*	mPrevious;
+	ListNode<T>*	mNode;		// Current node, or NULL when exhausted
+	int				mIndex;		// Index of the current item in the node
 };
 
+END_NAMESPACE;
+
 #endif
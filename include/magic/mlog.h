@@ -30,12 +30,38 @@
 #include <magic/mmagisupp.h>
 #include <magic/mstring.h>
 #include <magic/mpararr.h>
+#include <magic/mthread.h>
 #include <stdio.h>
 
+/** Least severe fatality compiled in by @ref MLOG. Messages of higher
+ *  fatality numbers are removed by the compiler, with their arguments.
+ **/
+#ifndef MAGIC_LOG_LEVEL
+#define MAGIC_LOG_LEVEL 7
+#endif
+
+/** Writes a message to the log if its fatality is enabled, both at
+ *  compile time by MAGIC_LOG_LEVEL and at run time by @ref
+ *  Log::setLevel(). The arguments are not evaluated for a message
+ *  that is not written.
+ *
+ * \code
+ *     MLOG (mrLog, "WORKER", Log::Debug, 0, "Queue has %d items: %s",
+ *           queue.size (), describe (queue));
+ * \endcode
+ **/
+#define MLOG(log,modulename,fatality,errnum,...) \
+	do {if ((fatality) <= MAGIC_LOG_LEVEL && (log).enabled (fatality)) \
+			static_cast<MagiC::Log&> (log).message (modulename, fatality, errnum, __VA_ARGS__);} while (0)
+
 BEGIN_NAMESPACE (MagiC);
 
 /*******************************************************************************
  * Abstract log
+ *
+ * Messages less severe than the level set with @ref setLevel() are
+ * dropped before they are formatted. The module stack of @ref
+ * pushModule() is kept separately for each thread.
  ******************************************************************************/
 class Log {
   public:
@@ -59,16 +85,29 @@ class Log {
 	virtual int			message		(const char* modulename, int fatality, int errnum, const char* message, va_list v_args) = 0;
 	void				pushModule	(const char* modulename);
 	void				popModule	();
+	const char*			currentModule	() const;
+
+	/** Sets the least severe fatality that is written. */
+	void				setLevel	(int fatality) {__atomic_store_n (&mLevel, fatality, __ATOMIC_RELAXED);}
+	int					level		() const {return __atomic_load_n (&mLevel, __ATOMIC_RELAXED);}
+	bool				enabled		(int fatality) const {return fatality <= level ();}
 	
   protected:
 	virtual int			write		(const char* data, int len) = 0;
 	
   protected:
-	String        mCurrentModule;
-	Array<String> mModules;
-	int           mModuleDepth;
+	pthread_key_t	mModuleKey;	/**< Module stack of each thread. */
+	int				mLevel;		/**< Least severe fatality written. */
 };
 
+class LogWriter;
+
+/** What an asynchronous @ref LogFile does with a message when the
+ *  buffer of the thread is full.
+ **/
+enum LogOverflow {LOG_BLOCK,	/**< Wait until the writer makes room. */
+				  LOG_DROP		/**< Drop the message and count it.    */};
+
 /*******************************************************************************
  * Text-based log associated with a file stream
  *
@@ -79,6 +118,13 @@ class Log {
  * For example:
  *
  * \code MYMODULE WARNING 1234: This is a simple warning. \endcode
+ *
+ * The log may be written from several threads.
+ *
+ * By default each message is formatted and written to the stream by
+ * the calling thread. After @ref startAsync(), messages are instead
+ * put in a buffer of the calling thread, without locking, and a
+ * background thread formats and writes them in batches.
  ******************************************************************************/
 class LogFile : public Log {
   public:
@@ -91,7 +137,15 @@ class LogFile : public Log {
 	virtual int			open		();
 	virtual void		close		();
 
+	using Log::message;
 	virtual int			message		(const char* modulename, int fatality, int errnum, const char* message, va_list v_args);
+
+	int					startAsync	(int bufferSize=65536, LogOverflow overflow=LOG_BLOCK,
+									 double flushInterval=0.1, int flushBytes=262144);
+	void				stopAsync	();
+	bool				isAsync		() const {return mpWriter != NULL;}
+	void				flush		();
+	long				dropped		() const;
 	
   protected:
 	virtual int			write		(const char* data, int len);
@@ -99,7 +153,51 @@ class LogFile : public Log {
   private:
 	const char* mpFilename;
 	FILE*		mpLogStream;
-	//ThreadLock  mThreadLock;
+	Mutex		mLock;		/**< Guards the stream and the file name. */
+	LogWriter*	mpWriter;	/**< Background writer, or NULL when writing synchronously. */
+};
+
+struct LogNames;
+
+/*******************************************************************************
+ * Log of compact binary records
+ *
+ * A message is not formatted, but written as a record of its time,
+ * module, fatality, error number and format string, followed by the
+ * raw values of its arguments. Each module name and format string is
+ * written once, the first time it is used, and later referred to by
+ * its number. The records are rendered as the lines of @ref LogFile
+ * with @ref decode(), or with the mlogdump tool.
+ *
+ * The values are written in the byte order and sizes of the writing
+ * machine, so the log must be decoded on a similar one.
+ ******************************************************************************/
+class BinaryLog : public Log {
+  public:
+						BinaryLog	(const char* filename);
+	virtual 			~BinaryLog	();
+
+	virtual int			open		();
+	virtual void		close		();
+
+	using Log::message;
+	virtual int			message		(const char* modulename, int fatality, int errnum, const char* message, va_list v_args);
+	void				flush		();
+
+	static int			decode		(FILE* in, FILE* out);
+
+  protected:
+	virtual int			write		(const char* data, int len);
+
+  private:
+	int					record		(int type, const void* head, int headLen, const char* data, int len);
+	int					name		(LogNames& names, int type, const char* text);
+
+	String		mFilename;
+	FILE*		mpStream;
+	Mutex		mLock;		/**< Guards the stream and the name tables. */
+	LogNames*	mpModules;	/**< Numbers of the module names. */
+	LogNames*	mpFormats;	/**< Numbers of the format strings. */
 };
 
 /*******************************************************************************
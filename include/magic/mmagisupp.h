@@ -44,6 +44,10 @@
 
 #include "magic/mdebug.h"
 
+#include <stdlib.h>
+#include <stdint.h>
+#include <new>
+
 #ifdef MSDOS
 #define IOSBINARY binary
 #else // UNIX
@@ -59,6 +63,24 @@ BEGIN_NAMESPACE (MagiC);
 #define randomize	{srand (time (NULL));}
 //#define rnd(range) {return 
 
+/*******************************************************************************
+ * Memory blocks of the containers
+ ******************************************************************************/
+
+/** Allocates or resizes a malloc() block of the given number of items
+ *  of the given size. The size is computed as size_t and checked, and
+ *  std::bad_alloc is thrown if the block is too large or can not be
+ *  allocated. The block must be freed with free().
+ **/
+inline void* reallocItems (void* block, int items, size_t itemSize) {
+	if (items <= 0 || (size_t) items > PTRDIFF_MAX / itemSize)
+		throw std::bad_alloc ();
+	void* result = realloc (block, (size_t) items * itemSize);
+	if (!result)
+		throw std::bad_alloc ();
+	return result;
+}
+
 END_NAMESPACE;
 #endif
 
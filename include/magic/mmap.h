@@ -29,6 +29,7 @@
 #include "magic/mobject.h"
 #include "magic/mmagisupp.h"
 #include "magic/mpararr.h"
+#include "magic/marena.h"
 
 BEGIN_NAMESPACE (MagiC);
 
@@ -36,40 +37,21 @@ BEGIN_NAMESPACE (MagiC);
 // Externals
 class DataOStream;
 
-class MapPair;
-class HashBucket;
 class HashFunc;
 class GenHash;
 class GenHashIter;
 
 
-//////////////////////////////////////////////////////////////////////////////
-//                                                                          //
-//                    |   |            ----        o                        //
-//                    |\ /|  ___   --  |   )  ___                           //
-//                    | V |  ___| |  ) |---   ___| | |/\                    //
-//                    | | | (   | |--  |     (   | | |                      //
-//                    |   |  \__| |    |      \__| | |                      //
-//                                                                          //
-//////////////////////////////////////////////////////////////////////////////
-
-/** A key-value pair in @ref GenHash and thus in @ref Map; (internal).
- **/
-class MapPair : public Object {
+/*******************************************************************************
+ * An interface for hash functions in @ref Genhash (and thus in @ref Map).
+ ******************************************************************************/
+class HashFunc {
   public:
-	const Comparable*	key;
-	Object*				value;
-	bool				isref;
-						MapPair		() {key=NULL; value=NULL; isref=0;}
-						~MapPair	();
-	int					match		(const Comparable& okey) const {return (*key) == okey;}
-	DataOStream&		operator>>	(DataOStream& out) const;
-	void				check		() const;
-
-  private:
-	decl_dynamic (MapPair);
+	virtual			~HashFunc	() {}
+	virtual void	hashfunc	(int hashsize) const = 0;
 };
 
+EXCEPTIONCLASS (not_found);
 
 //////////////////////////////////////////////////////////////////////////////
 //                                                                          //
@@ -82,35 +64,36 @@ class MapPair : public Object {
 //////////////////////////////////////////////////////////////////////////////
 
 /*******************************************************************************
- * A hash bucket in @ref GenHash and thus in @ref Map; (internal).
- ******************************************************************************/
-class HashBucket : public Object {
-  public:
-	MapPair		pair;
-	HashBucket*	next;
-
-					HashBucket	();
-					~HashBucket	();
-	DataOStream&	operator>>	(DataOStream& out) const;
-	void			check		() const;
-
-  private:
-	decl_dynamic (HashBucket);
-};
-
-/*******************************************************************************
- * An interface for hash functions in @ref Genhash (and thus in @ref Map).
+ * A key-value slot in @ref GenHash; (internal).
+ *
+ * The slot is empty if the key is NULL.
  ******************************************************************************/
-class HashFunc {
-  public:
-	virtual			~HashFunc	() {}
-	virtual void	hashfunc	(int hashsize) const = 0;
+struct HashSlot {
+	uint				hash;	/**< Full hash value of the key, cached for probing and rehashing. */
+	const Comparable*	key;	/**< Owned key, or NULL if the slot is empty. */
+	Object*				value;	/**< Value, owned unless the hash is a reference hash. */
 };
 
-EXCEPTIONCLASS (not_found);
-
 /*******************************************************************************
  * Generic hash table storage, used by @ref Map.
+ *
+ * The table uses open addressing with linear probing. Keys and
+ * values are stored by pointer directly in the slot array, together
+ * with the full hash value of the key, so that a lookup touches
+ * only one contiguous run of slots and calls the virtual key
+ * comparison only when the hash values match.
+ *
+ * The slot count is always a power of two. The table is grown to
+ * double size when it becomes more than 3/4 full, so the hash size
+ * given to the constructor is only the initial capacity.
+ *
+ * Removal shifts the following entries of the probe run backwards,
+ * so the table never accumulates deleted-slot markers.
+ *
+ * A hash made with an @ref Arena expects its keys and values to be
+ * made in the arena, and only destroys them instead of deleting. The
+ * slot array is still taken from the heap, as the arena could not
+ * reuse the old arrays when the table grows.
  ******************************************************************************/
 class GenHash : public Object {
   public:
@@ -119,10 +102,16 @@ class GenHash : public Object {
 					GenHash		(HashFunc* hfunc, int hsize=16, int flags=0) {
 						make (hfunc, hsize, flags);
 					}
+					GenHash		(Arena& arena, int hsize=64, int flags=0) {
+						make (NULL, hsize, flags);
+						mArena = &arena;
+					}
+					~GenHash	();
 	void			make		(HashFunc* hashfunc, int hsize, int flags);
 
 	void			set			(const Comparable* key, Object* value);
 	const Object*	get			(const Comparable& key) const;
+	const Object*	get			(const SubString& key) const;
 	DataOStream&	operator>>	(DataOStream& out) const;
 	TextOStream&	operator>>	(TextOStream& out) const;
 	ostream&		operator>>	(ostream& out) const;
@@ -130,15 +119,43 @@ class GenHash : public Object {
 	void			remove		(const Comparable& key);
 	void			operator+=	(const GenHash& other);
 
+	/** Returns the number of items in the hash. */
+	int				size		() const {return mCount;}
+
+	/** Returns the arena of the items, or NULL if they are on the heap. */
+	Arena*			arena		() const {return mArena;}
+
+	/** Returns the current number of slots in the hash. */
+	int				capacity	() const {return mCapacity;}
+
+	/** Grows the hash so that it can hold at least the given number
+	 *  of items without rehashing.
+	 **/
+	void			reserve		(int items);
+
 	void			check		() const;
 
   protected:
-	Array<HashBucket>	hash;
-	int					hashsize;
-	HashFunc*			hashfunc;
-	bool				isref;
+	HashSlot*		mSlots;		/**< Slot array, mCapacity long. */
+	int				mCapacity;	/**< Number of slots, a power of two. */
+	int				mCount;		/**< Number of used slots. */
+	int				mShift;		/**< 32-log2(mCapacity), for reducing hash values to slot indices. */
+	HashFunc*		hashfunc;
+	bool			isref;
+	Arena*			mArena;		/**< Arena of the keys and values, or NULL. */
+
+	/** Returns the home slot of the given hash value. Uses
+	 *  Fibonacci hashing, which also scatters weak hash values, such
+	 *  as consecutive integers.
+	 **/
+	uint			homeSlot	(uint hval) const {return (hval * 2654435769U) >> mShift;}
+	int				findSlot	(const Comparable& key, uint hval) const;
+	int				findSlot	(const SubString& key, uint hval) const;
+	void			rehash		(int newcapacity);
+	void			dispose		(const Object* item) const;
 
   private:
+					GenHash		(const GenHash& other) {FORBIDDEN}
 	decl_dynamic (GenHash);
 	friend class GenHashIter;
 };
@@ -161,8 +178,7 @@ class GenHashIter {
 
   protected:
 	const GenHash*	hash;
-	int				bucket;
-	HashBucket*		currbucket;
+	int				slot;
 	int				exh;
 };
 
@@ -199,6 +215,11 @@ enum mapdefs {MAP_NONE=0, MAP_REF=1};
  *
  *  Maps can be iterated using @ref MapIter. Note also the forMap and
  *  forStringMap macros in mmap.h
+ *
+ *  A Map constructed with an @ref Arena copies the keys and values
+ *  into the arena, so that they need no heap allocations of their
+ *  own and the memory is returned at once with the arena. Such a Map
+ *  must be destroyed before the arena is released.
  ******************************************************************************/
 template <class keyclass, class valueclass>
 class Map : public Object {
@@ -214,9 +235,9 @@ class Map : public Object {
 						}
 	/** Constructor.
 	 *
-	 *  @param hashsize Hash size, should usually be larger than 16,
-	 *  around is typical. Prime numbers are often recommended (which
-	 *  16 and 64 are not).
+	 *  @param hashsize Initial hash size. The hash grows automatically
+	 *  as items are added, so this only needs to be given to avoid
+	 *  rehashing when the number of items is known in advance.
 	 *
 	 *  @param flags Mode parameters. Currently defined are: MAP_REF
 	 *  (causes objects to be not owned by the Map)
@@ -228,6 +249,19 @@ class Map : public Object {
 							mFailByThrowOnce=false;
 							mFailByNullOnce=false;
 						}
+	/** Constructor for a map that makes its items in the given arena.
+	 *
+	 *  @param hashsize Initial hash size.
+	 *
+	 *  @param flags Mode parameters, as above.
+	 **/
+						Map			(Arena& arena, int hashsize=64, int flags=MAP_NONE) {
+							hash = new GenHash (arena, hashsize, flags);
+							isref = flags & MAP_REF;
+							mFailByThrow=false;
+							mFailByThrowOnce=false;
+							mFailByNullOnce=false;
+						}
 						Map (const Map& orig) {
 							hash = new GenHash ();
 							isref = 0;
@@ -244,19 +278,22 @@ class Map : public Object {
 	 *  the copy constructor.
 	 **/
 	void				set				(const keyclass& key, const valueclass& value) {
-		keyclass* nkey = new keyclass (key);
+		Arena* arena = hash->arena ();
+		keyclass* nkey = arena? arenaCopy (*arena, key) : new keyclass (key);
 		valueclass* nvalue = NULL;
 		if (isref)
 			nvalue = const_cast<valueclass*> (&value);
 		else
-			nvalue = new valueclass (value);
+			nvalue = arena? arenaCopy (*arena, value) : new valueclass (value);
 		hash->set (nkey, nvalue);
 	}
 
 	/** Sets the _key_ to _value_; takes ownership of the passed object.
+	 *  In a map with an arena, the object must be made in the arena.
 	 **/
 	void				set				(const keyclass& key, const valueclass* value) {
-		hash->set (new keyclass (key), const_cast<valueclass*> (value));
+		Arena* arena = hash->arena ();
+		hash->set (arena? arenaCopy (*arena, key) : new keyclass (key), const_cast<valueclass*> (value));
 	}
 
 	/** Removes an item from the map.
@@ -270,6 +307,14 @@ class Map : public Object {
 		return (hash->get (key)) != NULL;
 	}
 
+	/** Queries whether the given key is in the map. The key is
+	 *  given as a view, so no String needs to be made for it; only
+	 *  String keys can match.
+	 **/
+	bool				hasKey			(const SubString& key) const {
+		return (hash->get (key)) != NULL;
+	}
+
 	/** Returns a const reference to object associated to the key.
 	 *
 	 *  For information about error handling and exceptions, see @ref
@@ -357,6 +402,22 @@ class Map : public Object {
 		return (valueclass*) hash->get (key);
 	}
 
+ 	/** Returns a const pointer to object associated to the String
+	 *  key with the characters of the view, or NULL if the object
+	 *  was not found.
+	 **/
+	const valueclass*	getp			(const SubString& key) const {
+		return (valueclass*) hash->get (key);
+	}
+
+ 	/** Returns a non-const pointer to object associated to the
+	 *  String key with the characters of the view, or NULL if the
+	 *  object was not found.
+	 **/
+	valueclass*			getvp			(const SubString& key) {
+		return (valueclass*) hash->get (key);
+	}
+
 	// Miscellaneous operators
 
 	/** Implementation for @ref Object. */
@@ -379,14 +440,16 @@ class Map : public Object {
 
 	/** Union operator; adds the other Map to self. */
 	Map<keyclass,valueclass>&	operator+=	(const Map<keyclass,valueclass>& other) {
-		hash->operator+= (*other.hash);
+		add (other);
 		return *this;
 	}
 
 	/** Copy operator. */
 	Map<keyclass,valueclass>&	operator=	(const Map<keyclass,valueclass>& other) {
+		if (&other == this)
+			return *this;
 		hash->empty ();
-		hash->operator+= (*other.hash);
+		add (other);
 		isref = other.isref;
 		mFailByThrow=other.mFailByThrow;
 		mFailByThrowOnce=other.mFailByThrowOnce;
@@ -435,6 +498,20 @@ class Map : public Object {
   private:
 	GenHash*		hash;
 	bool			isref;
+
+	/** Adds copies of the items of the other map. The hash can clone
+	 *  the items only to the heap, so a map with an arena copies them
+	 *  itself.
+	 **/
+	void				add				(const Map<keyclass,valueclass>& other) {
+		if (!hash->arena ()) {
+			hash->operator+= (*other.hash);
+			return;
+		}
+		hash->reserve (hash->size () + other.hash->size ());
+		for (GenHashIter i (other.hash); !i.exhausted(); i.next())
+			set (static_cast<const keyclass&> (i.getkey ()), static_cast<const valueclass&> (i.getvalue ()));
+	}
 	bool			mFailByThrow;
 	mutable bool	mFailByThrowOnce, mFailByNullOnce;
 };
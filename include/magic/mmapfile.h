@@ -0,0 +1,99 @@
+/***************************************************************************
+ *   This file is part of the MagiC++ library.                             *
+ *                                                                         *
+ *   Copyright (C) 1998-2005 Marko Grnroos <magi@iki.fi>                  *
+ *                                                                         *
+ ***************************************************************************
+ *                                                                         *
+ *  This library is free software; you can redistribute it and/or          *
+ *  modify it under the terms of the GNU Library General Public            *
+ *  License as published by the Free Software Foundation; either           *
+ *  version 2 of the License, or (at your option) any later version.       *
+ *                                                                         *
+ *  This library is distributed in the hope that it will be useful,        *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU      *
+ *  Library General Public License for more details.                       *
+ *                                                                         *
+ *  You should have received a copy of the GNU Library General Public      *
+ *  License along with this library; see the file COPYING.LIB.  If         *
+ *  not, write to the Free Software Foundation, Inc., 59 Temple Place      *
+ *  - Suite 330, Boston, MA 02111-1307, USA.                               *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef __MAGIC_MMAPFILE_H__
+#define __MAGIC_MMAPFILE_H__
+
+#include <sys/types.h>
+#include <magic/miodevice.h>
+
+BEGIN_NAMESPACE (MagiC);
+
+/*******************************************************************************
+ * A read-only file device over a memory mapping of the file.
+ *
+ * The whole file is mapped to memory when opened, and reading just
+ * moves the position in the mapping. Besides the usual IODevice
+ * reading methods, MMapFile hands out SubString views of lines and
+ * other parts of the file, which are not copied at all. The views
+ * remain valid until the file is closed.
+ *
+ * The device can be attached to a TextIStream like any other device,
+ * for example to read a StringMap with readStringMap().
+ *
+ * Only regular files can be mapped.
+ *
+ *  @example
+ *  @code
+ *     MMapFile in ("data.txt", IO_Readable);
+ *     SubString line;
+ *     PackArray<SubString> fields;
+ *     while (in.readLine (line)) {
+ *         line.split (fields, ',');
+ *         ...
+ *     }
+ *  @endcode
+ ******************************************************************************/
+class MMapFile : public IODevice {
+  public:
+						MMapFile		(const String& name, int mode=0);
+	virtual				~MMapFile		();
+
+	const String&		name			() const {return mName;}
+	virtual bool		open			(int mode);
+	virtual void		close			();
+	virtual void		flush			() {}
+	virtual uint		size			() const {return mSize;}
+	virtual int			at				() const {return mPos;}
+	virtual bool		seek			(int position);
+	virtual bool		atEnd			() const {return mPos >= mSize;}
+	virtual	int			readBlock		(char* data, uint len);
+	virtual int			readLine		(char* data, uint maxlen);
+	int					readLine		(String& str, int maxlen=-1);
+	int					readLine		(SubString& line);
+	virtual int			writeBlock		(const char* data, uint len);
+	virtual int			getch			() {return (mPos < mSize)? (unsigned char) mpData[mPos++] : -1;}
+	virtual void		putch			(char ch);
+	virtual void		ungetch			(char ch);
+
+	/** Returns the beginning of the mapping, or NULL if the file is
+	 *  closed or empty.
+	 **/
+	const char*			data			() const {return mpData;}
+
+	/** Returns a view of the given part of the file. */
+	SubString			view			(uint offset, uint len) const;
+
+  private:
+	String		mName;		/**< File name of the file. */
+	const char*	mpData;		/**< The mapping. */
+	size_t		mSize;		/**< Size of the mapping. */
+	size_t		mPos;		/**< Current position in the mapping. */
+
+						MMapFile		(const MMapFile& other) {FORBIDDEN}
+};
+
+END_NAMESPACE;
+
+#endif
@@ -35,11 +35,15 @@ typedef PackArray<double> Vector;
 ///////////////////////////////////////////////////////////////////////////////
 
 /** Mathematical matrix.
+ *
+ *  The elements are stored row by row. Note that the * operator
+ *  multiplies element by element; the matrix product is computed
+ *  with @ref multiply() or @ref product().
  **/
 class Matrix : public PackTable<double> {
   public:
 					Matrix			() : PackTable<double> () {;}
-					Matrix			(int rows, int cols) : PackTable<double> (rows, cols) {}
+					Matrix			(int rows, int cols) : PackTable<double> (rows, cols) {operator= (0.0);}
 					Matrix			(int rows, int cols, double* data);
 					Matrix			(const Matrix& o) : PackTable<double> (o) {;}
 					~Matrix			() {}
@@ -54,6 +58,10 @@ class Matrix : public PackTable<double> {
 	double			sum				() const;
 	double			det				() const;
 
+	void			multiply		(const Matrix& a, const Matrix& b);
+	bool			luDecompose		(PackArray<int>& pivots, int* pSign=NULL);
+	void			luSolve			(const PackArray<int>& pivots, Vector& x) const;
+
 	void			splitVertical	(Matrix& a, Matrix& b, int column) const;
 	void			splitHorizontal	(Matrix& a, Matrix& b, int column) const;
 
@@ -83,6 +91,8 @@ class Matrix : public PackTable<double> {
 	const Matrix&	operator/=		(double k) {return operator *= (1/k);}
 
 	TextOStream&	operator>>		(TextOStream&) const;
+	DataOStream&	operator>>		(DataOStream&) const;
+	DataIStream&	operator<<		(DataIStream&);
 	const Matrix&	operator= (const Matrix& other);
 
   private:
@@ -94,6 +104,22 @@ inline Matrix transpose (const Matrix& m) {
 	return res;
 }
 
+/** Returns the matrix product a*b. */
+inline Matrix product (const Matrix& a, const Matrix& b) {
+	Matrix res;
+	res.multiply (a, b);
+	return res;
+}
+
+/** Instruction sets of the matrix product kernels, for @ref
+ *  setMatrixKernel(). All the sets give the same results up to
+ *  rounding.
+ **/
+enum matrixkernelset {MATRIXKERNEL_SCALAR=0, MATRIXKERNEL_AVX2=1, MATRIXKERNEL_SETS=2};
+
+int		matrixKernel	();
+bool	setMatrixKernel	(int set);
+
 int solveLinear	(const Matrix& mat, const Vector& b, Vector& result);
 int solveLinear	(const Matrix& augmat, Vector& result, int* nbv_set = NULL);
 
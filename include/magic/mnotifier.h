@@ -26,16 +26,121 @@
 #define __MAGIC_NOTIFIER_H__
 
 #include <magic/miodevice.h>
+#include <magic/mpackarray.h>
+#include <magic/mworkerthread.h>
 
+BEGIN_NAMESPACE (MagiC);
+
+class DeviceNotifier;
+
+/** Flags added to the @ref io_events watched by a @ref DeviceNotifier. */
+enum notify_flags {
+	NOTIFY_ONESHOT	= 0x100,	/**< Disarm after one event, until modifyDevice(). */
+	NOTIFY_EDGE		= 0x200		/**< Notify only of new readiness, not of lasting. */
+};
+
+/*******************************************************************************
+ * Receives the events of the devices watched by a @ref DeviceNotifier.
+ ******************************************************************************/
+class DeviceHandler {
+  public:
+	virtual			~DeviceHandler	() {}
+
+	/** Called in the thread of the notifier when the device is
+	 *  ready, with the ready @ref io_events. A hang-up comes with
+	 *  IO_ReadReady, so that the handler reads the end of stream.
+	 **/
+	virtual void	deviceEvent		(DeviceNotifier& notifier, IODevice* device, int events) = 0;
+};
+
+/*******************************************************************************
+ * Waits for any number of devices to become ready for reading or
+ * writing, and calls their handlers, with epoll.
+ *
+ * A single thread calls @ref run() or @ref runOnce(). Other threads
+ * may add, modify and remove devices at the same time, and
+ * @ref stop() the loop. A device is removed before it is closed, as
+ * its handle identifies it; its handler is not called after
+ * removeDevice() returns in the thread of the notifier, and the
+ * notifier never deletes the devices.
+ *
+ *  @example
+ *  @code
+ *     DeviceNotifier notifier;
+ *     notifier.addDevice (&server, &acceptHandler, IO_ReadReady);
+ *     notifier.run ();
+ *  @endcode
+ ******************************************************************************/
 class DeviceNotifier : public Object {
   public:
+					DeviceNotifier	();
+	virtual			~DeviceNotifier	();
+
+	bool			addDevice		(IODevice* device, DeviceHandler* handler, int events=IO_ReadReady);
+	bool			modifyDevice	(IODevice* device, int events);
+	bool			removeDevice	(IODevice* device);
+	int				deviceCount		() const {return __atomic_load_n (&mCount, __ATOMIC_RELAXED);}
 
-	void			addDevice		();
-	void			removeDevice	(IODevice* dev);
+	int				runOnce			(double seconds=-1.0);
 	void			run				();
+	void			stop			();
+
+  private:
+	struct Entry;
+
+	bool			control			(int operation, Entry* entry, int events);
+	void			collect			();
+
+	int				mEpoll;		/**< The epoll descriptor.                        */
+	int				mWakeup;	/**< Event descriptor that interrupts the wait.   */
+	Mutex			mLock;		/**< Guards the entries.                          */
+	PackArray<Entry*> mEntries;	/**< Watched devices, indexed by their handles.  */
+	Entry*			mpRemoved;	/**< Removed entries, freed by the next wait.     */
+	int				mCount;		/**< Number of watched devices.                   */
+	bool			mStopped;	/**< Has stop() been called?                      */
+
+					DeviceNotifier	(const DeviceNotifier& other) {FORBIDDEN}
+};
+
+/*******************************************************************************
+ * Request for a @ref WorkerPool to handle an event of a device.
+ ******************************************************************************/
+class DeviceRequest : public Request {
+  public:
+					DeviceRequest	(DeviceNotifier& notifier, IODevice* device, int events)
+							: mrNotifier (notifier), mpDevice (device), mEvents (events) {}
+
+	DeviceNotifier&	notifier		() const {return mrNotifier;}
+	IODevice*		device			() const {return mpDevice;}
+	int				events			() const {return mEvents;}
+
+  private:
+	DeviceNotifier&	mrNotifier;
+	IODevice*		mpDevice;
+	int				mEvents;
+};
+
+/*******************************************************************************
+ * Device handler that passes the events to a @ref WorkerPool as
+ * @ref DeviceRequest objects.
+ *
+ * The devices are added with NOTIFY_ONESHOT, so that only one worker
+ * at a time handles a device. The request handler of the pool
+ * rearms the device with @ref DeviceNotifier::modifyDevice() when it
+ * is done, or removes it, and deletes the request.
+ ******************************************************************************/
+class PoolDeviceHandler : public DeviceHandler {
+  public:
+					PoolDeviceHandler	(WorkerPool& pool) : mrPool (pool) {}
+
+	virtual void	deviceEvent		(DeviceNotifier& notifier, IODevice* device, int events) {
+		mrPool.process (new DeviceRequest (notifier, device, events));
+	}
 
-	virtual bool	data			()=0;
+  private:
+	WorkerPool&		mrPool;
 };
 
+END_NAMESPACE;
 
 #endif
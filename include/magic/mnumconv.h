@@ -0,0 +1,67 @@
+/***************************************************************************
+ *   This file is part of the MagiC++ library.                             *
+ *                                                                         *
+ *   Copyright (C) 1998-2005 Marko Grnroos <magi@iki.fi>                  *
+ *                                                                         *
+ ***************************************************************************
+ *                                                                         *
+ *  This library is free software; you can redistribute it and/or          *
+ *  modify it under the terms of the GNU Library General Public            *
+ *  License as published by the Free Software Foundation; either           *
+ *  version 2 of the License, or (at your option) any later version.       *
+ *                                                                         *
+ *  This library is distributed in the hope that it will be useful,        *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU      *
+ *  Library General Public License for more details.                       *
+ *                                                                         *
+ *  You should have received a copy of the GNU Library General Public      *
+ *  License along with this library; see the file COPYING.LIB.  If         *
+ *  not, write to the Free Software Foundation, Inc., 59 Temple Place      *
+ *  - Suite 330, Boston, MA 02111-1307, USA.                               *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef __MAGIC_MNUMCONV_H__
+#define __MAGIC_MNUMCONV_H__
+
+#include "magic/mtypes.h"
+#include "magic/mmagisupp.h"
+
+BEGIN_NAMESPACE (MagiC);
+
+/** Buffer length that @ref formatLong and @ref formatULong need at
+ *  most, including the sign.
+ **/
+#define NUMCONV_LONG_BUFFER		24
+
+/** Buffer length that @ref formatDouble needs at most, including the
+ *  sign and the exponent.
+ **/
+#define NUMCONV_DOUBLE_BUFFER	32
+
+/*******************************************************************************
+ * Numeric conversions shared by @ref String and the text streams.
+ *
+ * The formatting functions write the characters to the beginning of
+ * the given buffer, without a terminating zero, and return their
+ * count. The parsing functions read a number from the beginning of a
+ * character range, which need not be zero-terminated, and return the
+ * end of the number, or the beginning of the range if there was no
+ * number.
+ *
+ * Doubles are printed with the fewest digits that read back to the
+ * same value (Ryu), and parsed with correct rounding (Eisel-Lemire,
+ * falling back to strtod() for more than 19 significant digits).
+ ******************************************************************************/
+
+int			formatLong		(char* buffer, long value);
+int			formatULong		(char* buffer, unsigned long value);
+int			formatDouble	(char* buffer, double value, int precision=-1);
+
+const char*	parseLong		(const char* begin, const char* end, long& value);
+const char*	parseDouble		(const char* begin, const char* end, double& value);
+
+END_NAMESPACE;
+
+#endif
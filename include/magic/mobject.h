@@ -54,6 +54,13 @@
 #endif
 #endif
 
+/** Objects are allocated from a thread-local pool (see marena.cc),
+ *  unless memory debugging is on or DISABLE_OBJECT_POOL is defined.
+ **/
+#if defined(DISABLE_ALL_MEMORY_DEBUGGING) && !defined(DEBUG_OBJECT_NEW) && !defined(DISABLE_OBJECT_POOL)
+#define OBJECT_POOL
+#endif
+
 /////////////////////////////////////////////////////////////////////////////
 // Predeclarations
 /////////////////////////////////////////////////////////////////////////////
@@ -71,8 +78,11 @@ namespace MagiC {
 	class DataOStream;
 	class DataIStream;
 	template <class TYPE> class Array;
+	template <class TYPE> class PackArray;
 	
 	class String;
+	class Arena;
+	struct WeakRefBlock;
 }
 
 // using namespace MagiC;
@@ -108,12 +118,21 @@ DataIStream& operator>> (DataIStream& in, Object& obj);
 //                      `___ |__/  \_|  \__   \__/   \                      //
 ///////////////////////////////////////////////////////////////////////////////
 
+/** Flag in the reference count of an object that has weak references. */
+#define OBJECT_WEAK_FLAG	0x40000000
+
+/** Mask of the count itself in the reference count of an object. */
+#define OBJECT_COUNT_MASK	0x3fffffff
+
 class Object {
 	decl_dynamic (Object);
 
   public:
 							Object			() {mRefCount = 0;}
+							Object			(const Object& other) {mRefCount = 0;}
 	virtual					~Object			();
+	/** Assignment does not copy the reference count. */
+	Object&					operator=		(const Object& other) {return *this;}
 	virtual	ostream&		operator>>		(ostream&) const;
 	virtual	istream&		operator<<		(istream&);
 	virtual	OStream&		operator>>		(OStream&) const;
@@ -126,9 +145,28 @@ class Object {
 	bool					isOK			() const;
 	const String&			getclassname	() const;
 	int						is_a			(const String& classname) const;
-	inline void				incRef			() {mRefCount++;} /**< Increments the reference counter of the object. */
-	inline int				decRef			() {mRefCount--; return mRefCount;} /**< Decrements the reference counter of the object. */
-	inline int				refCount		() const {return mRefCount;} /**< Returns the number of references to the object. */
+
+	// Reference counting for Ref<>. The count is atomic, so references
+	// to the same object may be taken and dropped in any threads.
+	// Taking a reference needs no ordering, as it is made from an
+	// existing one; dropping one releases the writes of the thread to
+	// the thread that deletes the object.
+	inline void				incRef			() {__atomic_fetch_add (&mRefCount, 1, __ATOMIC_RELAXED);} /**< Increments the reference counter of the object. */
+	inline int				decRef			() {return __atomic_sub_fetch (&mRefCount, 1, __ATOMIC_ACQ_REL) & OBJECT_COUNT_MASK;} /**< Decrements the reference counter of the object. */
+	inline int				refCount		() const {return __atomic_load_n (&mRefCount, __ATOMIC_RELAXED) & OBJECT_COUNT_MASK;} /**< Returns the number of references to the object. */
+
+	/** Drops a reference, and deletes the object if it was the last
+	 *  one.
+	 **/
+	inline void				unref			() {
+		if (decRef () == 0)
+			delete this;
+	}
+
+	WeakRefBlock*			weakBlock		();
+	static Object*			lockWeak		(WeakRefBlock* block);
+	static void				retainWeak		(WeakRefBlock* block);
+	static void				releaseWeak		(WeakRefBlock* block);
 	
 #ifdef DEBUG_OBJECT_NEW	
 #ifdef new
@@ -141,8 +179,19 @@ class Object {
 #endif
 #endif
 
+#ifdef OBJECT_POOL
+	static void*			operator new	(size_t size);
+	static void				operator delete	(void* p, size_t size);
+	static void*			operator new	(size_t size, void* place) {return place;}
+	static void				operator delete	(void* p, void* place) {}
+	static void*			operator new	(size_t size, Arena& arena);
+	static void				operator delete	(void* p, Arena& arena) {}
+#endif
+
   private:
-	int		mRefCount;
+	int		mRefCount;	/**< Reference count, with OBJECT_WEAK_FLAG. Accessed atomically. */
+
+	void					detachWeak		();
 };
 
 extern const char nullchar;
@@ -158,12 +207,32 @@ extern const char nullchar;
 //                      |                                                    //
 ///////////////////////////////////////////////////////////////////////////////
 
+/** Counted reference to an @ref Object, which is deleted when the last
+ *  reference to it is dropped.
+ *
+ *  The count is atomic, so references to the same object can be held
+ *  in several threads; a single Ref must not be modified by two
+ *  threads at once, though. Moving a reference, with the C++11 move
+ *  operations or with @ref detach() and @ref adopt(), does not touch
+ *  the count at all, which is the cheap way to hand an object over to
+ *  another thread.
+ *
+ *  @see WeakRef
+ **/
 template <class TYPE>
 class Ref {
   public:
 				Ref						(TYPE* object=NULL)		{mpObject = object; if (mpObject) mpObject->incRef();}
 				Ref						(const Ref<TYPE>& ref)	{mpObject = ref.mpObject; if (mpObject) mpObject->incRef();}
-				~Ref					()						{if (mpObject && mpObject->decRef() == 0) delete mpObject;}
+#if __cplusplus >= 201103L
+				Ref						(Ref<TYPE>&& ref)		{mpObject = ref.mpObject; ref.mpObject = NULL;}
+#endif
+				~Ref					()						{if (mpObject) mpObject->unref();}
+
+	/** Makes a Ref of an object whose reference has already been
+	 *  counted, typically one given up with @ref detach().
+	 **/
+	static Ref<TYPE>	adopt			(TYPE* object)			{Ref<TYPE> result; result.mpObject = object; return result;}
 
 	TYPE&		object					()						{return *mpObject;}
 	const TYPE&	object					() const				{return *mpObject;}
@@ -171,10 +240,19 @@ class Ref {
 				operator const TYPE&	() const				{return *mpObject;}
 	TYPE*		operator ->				()						{return mpObject;}
 	const TYPE*	operator ->				() const				{return mpObject;}
-	TYPE&       operator =              (TYPE* object)			{if (mpObject && mpObject->decRef() == 0) delete mpObject; mpObject = object; if (mpObject) mpObject->incRef();}
-	TYPE&       operator =              (const Ref<TYPE>& ref)	{if (mpObject && mpObject->decRef() == 0) delete mpObject; mpObject = ref.mpObject; if (mpObject) mpObject->incRef();}
+	Ref<TYPE>&	operator =				(TYPE* object)			{if (object) object->incRef(); if (mpObject) mpObject->unref(); mpObject = object; return *this;}
+	Ref<TYPE>&	operator =				(const Ref<TYPE>& ref)	{return operator= (ref.mpObject);}
+#if __cplusplus >= 201103L
+	Ref<TYPE>&	operator =				(Ref<TYPE>&& ref)		{if (&ref != this) {if (mpObject) mpObject->unref(); mpObject = ref.mpObject; ref.mpObject = NULL;} return *this;}
+#endif
 	bool		isNull					() const				{return mpObject==NULL;}
-	TYPE*       getReleasedPtr          ()						{TYPE* tmp=mpObject; mpObject->decRef(); mpObject = NULL; return tmp;}
+	TYPE*       getReleasedPtr          ()						{TYPE* tmp=mpObject; if (tmp) tmp->decRef(); mpObject = NULL; return tmp;}
+
+	/** Gives up the reference without changing the count, and
+	 *  returns the object. The reference must be taken over later with
+	 *  @ref adopt().
+	 **/
+	TYPE*		detach					()						{TYPE* tmp=mpObject; mpObject = NULL; return tmp;}
 
   private:
 	TYPE*	mpObject;
@@ -182,6 +260,42 @@ class Ref {
 
 
 
+/** Weak reference to an object held by @ref Ref. It does not keep
+ *  the object alive, but can be turned into a Ref with @ref lock()
+ *  while some Ref still holds the object.
+ *
+ *  The weak references to an object share a small block that is made
+ *  when the first one is taken, so objects without weak references
+ *  pay nothing for the feature. Locking takes a spin lock in the
+ *  block, so a WeakRef is cheap to hold and copy, but a Ref is the
+ *  faster way to access an object often.
+ **/
+template <class TYPE>
+class WeakRef {
+  public:
+				WeakRef					()						{mpBlock = NULL;}
+				WeakRef					(const Ref<TYPE>& ref)	{mpBlock = ref.isNull()? NULL : const_cast<TYPE&>(ref.object()).weakBlock();}
+				WeakRef					(const WeakRef<TYPE>& o){mpBlock = o.mpBlock; if (mpBlock) Object::retainWeak (mpBlock);}
+				~WeakRef				()						{if (mpBlock) Object::releaseWeak (mpBlock);}
+
+	WeakRef<TYPE>&	operator =			(const WeakRef<TYPE>& o){if (o.mpBlock) Object::retainWeak (o.mpBlock); if (mpBlock) Object::releaseWeak (mpBlock); mpBlock = o.mpBlock; return *this;}
+
+	/** Returns a Ref to the object, or a null Ref if it has been
+	 *  deleted.
+	 **/
+	Ref<TYPE>	lock					() const				{return Ref<TYPE>::adopt (mpBlock? static_cast<TYPE*> (Object::lockWeak (mpBlock)) : NULL);}
+
+	/** Has the object been deleted? Another thread may delete it
+	 *  right after this returns false.
+	 **/
+	bool		expired					() const				{return lock().isNull();}
+
+  private:
+	WeakRefBlock*	mpBlock;
+};
+
+
+
 ///////////////////////////////////////////////////////////////////////////////
 //             ___                                        |                  //
 //            /   \             --   ___       ___  |     |  ___             //
@@ -207,6 +321,15 @@ class Comparable : public Object {
 	 **/
 	virtual int		hashfunc	(int hashsize) const {return 0;}
 
+	/** Full-width hash value. @ref GenHash (and thus @ref Map)
+	 *  uses this, and reduces the value to the table size itself.
+	 *
+	 *  The default implementation falls back to @ref hashfunc, so
+	 *  inheritors that only overload that still work as keys, but
+	 *  should overload this too to make larger hashes efficient.
+	 **/
+	virtual unsigned int	hashvalue	() const {return hashfunc (256);}
+
 	/** Equality comparison. Must be overloaded. */
 	virtual int		operator==	(const Comparable& other) const=0;
 
@@ -247,8 +370,11 @@ class Int : public Comparable {
 	int			operator <		(const Int& o)					{return data<o.data;}
 	int			operator ==		(const Int& o)					{return data==o.data;}
 	int			hashfunc		(int hashsize) const			{return data % hashsize;}
+	unsigned int	hashvalue	() const						{return (unsigned int) (data ^ (data >> 31 >> 1));}
 	int			operator ==		(const Comparable& o) const;
 	int			operator !=		(const Int& o)					{return data!=o.data;}
+	int			compare			(const Int& o) const			{return (data<o.data)? -1 : (data>o.data);}
+	int			compare			(const Comparable& o) const;
 	Object*		clone			() const						{return new Int (*this);}
 };
 
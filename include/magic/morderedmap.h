@@ -0,0 +1,700 @@
+/***************************************************************************
+ *   This file is part of the MagiC++ library.                             *
+ *                                                                         *
+ *   Copyright (C) 1998-2005 Marko Grnroos <magi@iki.fi>                  *
+ *                                                                         *
+ ***************************************************************************
+ *                                                                         *
+ *  This library is free software; you can redistribute it and/or          *
+ *  modify it under the terms of the GNU Library General Public            *
+ *  License as published by the Free Software Foundation; either           *
+ *  version 2 of the License, or (at your option) any later version.       *
+ *                                                                         *
+ *  This library is distributed in the hope that it will be useful,        *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU      *
+ *  Library General Public License for more details.                       *
+ *                                                                         *
+ *  You should have received a copy of the GNU Library General Public      *
+ *  License along with this library; see the file COPYING.LIB.  If         *
+ *  not, write to the Free Software Foundation, Inc., 59 Temple Place      *
+ *  - Suite 330, Boston, MA 02111-1307, USA.                               *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef __MAGIC_MORDEREDMAP_H__
+#define __MAGIC_MORDEREDMAP_H__
+
+#include <string.h>
+#include "magic/mobject.h"
+#include "magic/mstring.h"
+#include "magic/mmap.h"
+#include "magic/malgorithm.h"
+
+BEGIN_NAMESPACE (MagiC);
+
+/** Number of items in a leaf node of @ref OrderedMap. */
+#define ORDMAP_LEAF_SIZE	32
+
+/** Number of children of an inner node of @ref OrderedMap. */
+#define ORDMAP_FANOUT		32
+
+template <class keyclass, class valueclass, class compareclass> class OrderedMapIter;
+
+//////////////////////////////////////////////////////////////////////////////
+//                                                                          //
+//             ___               |                   |   |                 //
+//            |   | |/\   ___    |  ___  |/\   ___   |\ /|  ___   --       //
+//            |   | |    /   ) --| /   ) |    /   )  | V |  ___| |  )      //
+//            |   | |    |---  | | |---  |    |---   | | | (   | |--       //
+//            `___' |     \__   \|  \__  |     \__   |   |  \__| |         //
+//                                                                          //
+//////////////////////////////////////////////////////////////////////////////
+
+/*******************************************************************************
+ *  Associative map that keeps its keys in order, for ordered
+ *  iteration, range queries and prefix scans. Use @ref Map when only
+ *  the lookups of single keys are needed, as hashing is faster for
+ *  them.
+ *
+ *  The map is a B+ tree. The items are kept in leaves of
+ *  ORDMAP_LEAF_SIZE keys and values, which are linked in order, and
+ *  the inner nodes hold copies of the keys that separate their
+ *  children. The nodes also hold the hints of the keys, so a lookup
+ *  mostly searches a few small arrays, instead of following a pointer
+ *  per step. The keys are compared with the static methods of the
+ *  comparator class, by default @ref KeyCompare, so no virtual calls
+ *  are needed for the common key classes.
+ *
+ *  The key class has to inherit @ref Comparable, or at least have a
+ *  copy constructor and an order given by the comparator. The value
+ *  class can be any inherit of @ref Object.
+ *
+ *  As with @ref Map, the inserted objects are owned by the map, unless
+ *  the MAP_REF flag is given to the constructor.
+ *
+ *  Leaves are split in half when they fill up, except that a key added
+ *  after all the others starts a new leaf, so that keys added in order
+ *  leave the leaves full. A leaf that becomes empty is removed, but
+ *  leaves are not merged otherwise.
+ *
+ *  OrderedMaps can be iterated in key order with @ref OrderedMapIter.
+ ******************************************************************************/
+template <class keyclass, class valueclass, class compareclass=KeyCompare<keyclass> >
+class OrderedMap : public Object {
+  public:
+	/** Constructor.
+	 *
+	 *  @param flags Mode parameters. Currently defined are: MAP_REF
+	 *  (causes objects to be not owned by the map)
+	 **/
+						OrderedMap		(int flags=MAP_NONE) {
+							mRoot = NULL;
+							mFirst = NULL;
+							mHeight = 0;
+							mCount = 0;
+							isref = flags & MAP_REF;
+						}
+						OrderedMap		(const OrderedMap& orig) {
+							mRoot = NULL;
+							mFirst = NULL;
+							mHeight = 0;
+							mCount = 0;
+							isref = false;
+							operator= (orig);
+						}
+						~OrderedMap		() {empty ();}
+
+	/** Sets the _key_ to _value_; copies the given value object using
+	 *  the copy constructor.
+	 **/
+	void				set				(const keyclass& key, const valueclass& value) {
+		insert (key, isref? const_cast<valueclass*> (&value) : new valueclass (value));
+	}
+
+	/** Sets the _key_ to _value_; takes ownership of the passed object.
+	 **/
+	void				set				(const keyclass& key, const valueclass* value) {
+		insert (key, const_cast<valueclass*> (value));
+	}
+
+	void				remove			(const keyclass& key);
+
+	/** Queries whether the given key is in the map. */
+	bool				hasKey			(const keyclass& key) const {return find (key) != NULL;}
+
+	/** Returns a const reference to object associated to the key.
+	 *
+	 *  @exception map_item_not_found If the key is not in the map.
+	 **/
+	const valueclass&	get				(const keyclass& key) const {
+		const valueclass* result = find (key);
+		if (!result)
+			throw map_item_not_found ("Map item not found");
+		return *result;
+	}
+
+	/** Returns a non-const reference to object associated to the key.
+	 *
+	 *  @exception map_item_not_found If the key is not in the map.
+	 **/
+	valueclass&			getv			(const keyclass& key) {return const_cast<valueclass&> (get (key));}
+
+	const valueclass&	operator[]		(const keyclass& key) const {return get (key);}
+	valueclass&			operator[]		(const keyclass& key) {return getv (key);}
+
+	/** Returns a const reference to object associated to the key, or
+	 *  the 'def' reference if the key is not in the map.
+	 **/
+	const valueclass&	getOr			(const keyclass& key, const valueclass& def) const {
+		const valueclass* result = find (key);
+		return result? *result : def;
+	}
+
+	/** Returns a const pointer to object associated to the key, or
+	 *  NULL if the object was not found.
+	 **/
+	const valueclass*	getp			(const keyclass& key) const {return find (key);}
+
+	/** Returns a non-const pointer to object associated to the key,
+	 *  or NULL if the object was not found.
+	 **/
+	valueclass*			getvp			(const keyclass& key) {return find (key);}
+
+	/** Returns the number of items in the map. */
+	int					size			() const {return mCount;}
+
+	/** Destroys all the items from the map. */
+	void				empty			() {
+		if (mRoot)
+			freeTree (mRoot, mHeight);
+		mRoot = NULL;
+		mFirst = NULL;
+		mHeight = 0;
+		mCount = 0;
+	}
+
+	/** Copy operator. */
+	OrderedMap&			operator=		(const OrderedMap& other) {
+		if (&other == this)
+			return *this;
+		empty ();
+		isref = other.isref;
+		// The keys come in order, so the leaves are filled full
+		for (const Leaf* leaf = other.mFirst; leaf; leaf = leaf->next)
+			for (int i=0; i<leaf->count; i++)
+				set (*leaf->keys[i], *leaf->values[i]);
+		return *this;
+	}
+
+	void				check			() const;
+
+  private:
+	/** Leaf node, with the items in key order. */
+	struct Leaf {
+		int				count;
+		Leaf*			prev;
+		Leaf*			next;
+		KeyHint			hints [ORDMAP_LEAF_SIZE];	/**< Hints of the keys. */
+		keyclass*		keys [ORDMAP_LEAF_SIZE];	/**< Owned keys. */
+		valueclass*		values [ORDMAP_LEAF_SIZE];	/**< Values, owned unless the map is a reference map. */
+	};
+
+	/** Inner node. The keys of child i+1 are greater or equal to
+	 *  separator i, and those of child i are less than it.
+	 **/
+	struct Inner {
+		int				count;						/**< Number of children, one more than the separators. */
+		KeyHint			hints [ORDMAP_FANOUT-1];	/**< Hints of the separators. */
+		keyclass*		keys [ORDMAP_FANOUT-1];		/**< Owned copies of the separating keys. */
+		void*			children [ORDMAP_FANOUT];	/**< Inner nodes or leaves, by the level. */
+	};
+
+	void*			mRoot;		/**< Root node, or NULL if the map is empty. */
+	Leaf*			mFirst;		/**< Leftmost leaf. */
+	int				mHeight;	/**< Number of inner levels above the leaves. */
+	int				mCount;
+	bool			isref;
+
+	/** Compares a key in a node to the given key, by the hints first.
+	 **/
+	static int			compareAt		(KeyHint hint, const keyclass* item,
+										 KeyHint keyHint, const keyclass& key) {
+		if (hint != keyHint)
+			return (hint < keyHint)? -1 : 1;
+		return compareclass::compare (*item, key);
+	}
+
+	/** Returns the index of the first key in the leaf that is not
+	 *  less than the given key.
+	 **/
+	static int			lowerIndex		(const Leaf* leaf, const keyclass& key, KeyHint hint) {
+		int lo = 0, hi = leaf->count;
+		while (lo < hi) {
+			int mid = (lo+hi) / 2;
+			if (compareAt (leaf->hints[mid], leaf->keys[mid], hint, key) < 0)
+				lo = mid+1;
+			else
+				hi = mid;
+		}
+		return lo;
+	}
+
+	/** Is the key at the index of the leaf equal to the given key? */
+	static bool			isAt			(const Leaf* leaf, int pos, const keyclass& key, KeyHint hint) {
+		return pos < leaf->count && leaf->hints[pos] == hint
+			&& compareclass::compare (*leaf->keys[pos], key) == 0;
+	}
+
+	/** Returns the index of the child that may hold the key. */
+	static int			childIndex		(const Inner* inner, const keyclass& key, KeyHint hint) {
+		int lo = 0, hi = inner->count-1;
+		while (lo < hi) {
+			int mid = (lo+hi) / 2;
+			if (compareAt (inner->hints[mid], inner->keys[mid], hint, key) <= 0)
+				lo = mid+1;
+			else
+				hi = mid;
+		}
+		return lo;
+	}
+
+	/** Returns the leaf that may hold the key. The map must not be
+	 *  empty.
+	 **/
+	Leaf*				findLeaf		(const keyclass& key, KeyHint hint) const {
+		void* node = mRoot;
+		for (int level=mHeight; level>0; level--) {
+			const Inner* inner = static_cast<const Inner*> (node);
+			node = inner->children[childIndex (inner, key, hint)];
+		}
+		return static_cast<Leaf*> (node);
+	}
+
+	valueclass*			find			(const keyclass& key) const {
+		if (!mRoot)
+			return NULL;
+		KeyHint hint = compareclass::hint (key);
+		const Leaf* leaf = findLeaf (key, hint);
+		int pos = lowerIndex (leaf, key, hint);
+		return isAt (leaf, pos, key, hint)? leaf->values[pos] : NULL;
+	}
+
+	void				insert			(const keyclass& key, valueclass* value);
+	void*				insertInto		(void* node, int level, const keyclass& key, KeyHint hint,
+										 valueclass* value, keyclass*& separator);
+	void*				insertLeaf		(Leaf* leaf, const keyclass& key, KeyHint hint,
+										 valueclass* value, keyclass*& separator);
+	bool				removeFrom		(void* node, int level, const keyclass& key, KeyHint hint);
+	void				freeNode		(void* node, int level);
+	void				freeTree		(void* node, int level);
+
+	friend class OrderedMapIter<keyclass,valueclass,compareclass>;
+};
+
+/*******************************************************************************
+ * Adds the item, or replaces the value of an existing key.
+ ******************************************************************************/
+template <class keyclass, class valueclass, class compareclass>
+void OrderedMap<keyclass,valueclass,compareclass>::insert (const keyclass& key, valueclass* value)
+{
+	if (!mRoot) {
+		Leaf* leaf = new Leaf;
+		leaf->count = 0;
+		leaf->prev = leaf->next = NULL;
+		mRoot = mFirst = leaf;
+		mHeight = 0;
+	}
+
+	// Grow a new root over the old one if it was split
+	keyclass* separator = NULL;
+	void* right = insertInto (mRoot, mHeight, key, compareclass::hint (key), value, separator);
+	if (right) {
+		Inner* root = new Inner;
+		root->count = 2;
+		root->hints[0] = compareclass::hint (*separator);
+		root->keys[0] = separator;
+		root->children[0] = mRoot;
+		root->children[1] = right;
+		mRoot = root;
+		mHeight++;
+	}
+}
+
+/*******************************************************************************
+ * Inserts into a subtree.
+ *
+ *  @return The new right sibling of the node if it was split, with
+ *  the separator key copy set for it; NULL otherwise.
+ ******************************************************************************/
+template <class keyclass, class valueclass, class compareclass>
+void* OrderedMap<keyclass,valueclass,compareclass>::insertInto (void* node, int level, const keyclass& key, KeyHint hint,
+																valueclass* value, keyclass*& separator)
+{
+	if (level == 0)
+		return insertLeaf (static_cast<Leaf*> (node), key, hint, value, separator);
+
+	Inner* inner = static_cast<Inner*> (node);
+	int pos = childIndex (inner, key, hint);
+	keyclass* childSeparator = NULL;
+	void* newChild = insertInto (inner->children[pos], level-1, key, hint, value, childSeparator);
+	if (!newChild)
+		return NULL;
+	KeyHint childHint = compareclass::hint (*childSeparator);
+
+	if (inner->count < ORDMAP_FANOUT) {
+		int move = inner->count-1-pos;
+		memmove (inner->hints+pos+1, inner->hints+pos, move * sizeof (KeyHint));
+		memmove (inner->keys+pos+1, inner->keys+pos, move * sizeof (keyclass*));
+		memmove (inner->children+pos+2, inner->children+pos+1, move * sizeof (void*));
+		inner->hints[pos] = childHint;
+		inner->keys[pos] = childSeparator;
+		inner->children[pos+1] = newChild;
+		inner->count++;
+		return NULL;
+	}
+
+	// Split the full node with the new child in the middle; the middle
+	// separator moves up
+	KeyHint			hints [ORDMAP_FANOUT];
+	keyclass*		keys [ORDMAP_FANOUT];
+	void*			children [ORDMAP_FANOUT+1];
+	memcpy (hints, inner->hints, pos * sizeof (KeyHint));
+	hints[pos] = childHint;
+	memcpy (hints+pos+1, inner->hints+pos, (ORDMAP_FANOUT-1-pos) * sizeof (KeyHint));
+	memcpy (keys, inner->keys, pos * sizeof (keyclass*));
+	keys[pos] = childSeparator;
+	memcpy (keys+pos+1, inner->keys+pos, (ORDMAP_FANOUT-1-pos) * sizeof (keyclass*));
+	memcpy (children, inner->children, (pos+1) * sizeof (void*));
+	children[pos+1] = newChild;
+	memcpy (children+pos+2, inner->children+pos+1, (ORDMAP_FANOUT-1-pos) * sizeof (void*));
+
+	const int leftCount = (ORDMAP_FANOUT+1) / 2;
+	Inner* right = new Inner;
+	inner->count = leftCount;
+	right->count = ORDMAP_FANOUT+1 - leftCount;
+	memcpy (inner->hints, hints, (leftCount-1) * sizeof (KeyHint));
+	memcpy (inner->keys, keys, (leftCount-1) * sizeof (keyclass*));
+	memcpy (inner->children, children, leftCount * sizeof (void*));
+	separator = keys[leftCount-1];
+	memcpy (right->hints, hints+leftCount, (right->count-1) * sizeof (KeyHint));
+	memcpy (right->keys, keys+leftCount, (right->count-1) * sizeof (keyclass*));
+	memcpy (right->children, children+leftCount, right->count * sizeof (void*));
+	return right;
+}
+
+/*******************************************************************************
+ * Inserts into a leaf, and splits it if it is full.
+ ******************************************************************************/
+template <class keyclass, class valueclass, class compareclass>
+void* OrderedMap<keyclass,valueclass,compareclass>::insertLeaf (Leaf* leaf, const keyclass& key, KeyHint hint,
+																valueclass* value, keyclass*& separator)
+{
+	int pos = lowerIndex (leaf, key, hint);
+	if (isAt (leaf, pos, key, hint)) {
+		if (!isref && leaf->values[pos] != value)
+			delete leaf->values[pos];
+		leaf->values[pos] = value;
+		return NULL;
+	}
+
+	Leaf* right = NULL;
+	if (leaf->count == ORDMAP_LEAF_SIZE) {
+		// A key after all the others starts a new leaf, otherwise the
+		// upper half moves
+		int move = (pos == ORDMAP_LEAF_SIZE && !leaf->next)? 0 : ORDMAP_LEAF_SIZE/2;
+		right = new Leaf;
+		right->count = move;
+		leaf->count -= move;
+		memcpy (right->hints, leaf->hints+leaf->count, move * sizeof (KeyHint));
+		memcpy (right->keys, leaf->keys+leaf->count, move * sizeof (keyclass*));
+		memcpy (right->values, leaf->values+leaf->count, move * sizeof (valueclass*));
+		right->prev = leaf;
+		right->next = leaf->next;
+		if (leaf->next)
+			leaf->next->prev = right;
+		leaf->next = right;
+		if (pos >= leaf->count) {
+			pos -= leaf->count;
+			leaf = right;
+		}
+	}
+
+	memmove (leaf->hints+pos+1, leaf->hints+pos, (leaf->count-pos) * sizeof (KeyHint));
+	memmove (leaf->keys+pos+1, leaf->keys+pos, (leaf->count-pos) * sizeof (keyclass*));
+	memmove (leaf->values+pos+1, leaf->values+pos, (leaf->count-pos) * sizeof (valueclass*));
+	leaf->hints[pos] = hint;
+	leaf->keys[pos] = new keyclass (key);
+	leaf->values[pos] = value;
+	leaf->count++;
+	mCount++;
+
+	if (right)
+		separator = new keyclass (*right->keys[0]);
+	return right;
+}
+
+/*******************************************************************************
+ * Removes an item from the map. Does nothing if the key is not in
+ * the map.
+ ******************************************************************************/
+template <class keyclass, class valueclass, class compareclass>
+void OrderedMap<keyclass,valueclass,compareclass>::remove (const keyclass& key)
+{
+	if (!mRoot)
+		return;
+	if (removeFrom (mRoot, mHeight, key, compareclass::hint (key))) {
+		freeNode (mRoot, mHeight);
+		mRoot = NULL;
+		mHeight = 0;
+		return;
+	}
+
+	// Drop roots that have only one child left
+	while (mHeight > 0 && static_cast<Inner*> (mRoot)->count == 1) {
+		Inner* old = static_cast<Inner*> (mRoot);
+		mRoot = old->children[0];
+		delete old;
+		mHeight--;
+	}
+}
+
+/*******************************************************************************
+ * Removes the key from a subtree. Children that become empty are
+ * removed with one of their separators.
+ *
+ *  @return true if the node itself became empty.
+ ******************************************************************************/
+template <class keyclass, class valueclass, class compareclass>
+bool OrderedMap<keyclass,valueclass,compareclass>::removeFrom (void* node, int level, const keyclass& key, KeyHint hint)
+{
+	if (level == 0) {
+		Leaf* leaf = static_cast<Leaf*> (node);
+		int pos = lowerIndex (leaf, key, hint);
+		if (!isAt (leaf, pos, key, hint))
+			return false;
+		delete leaf->keys[pos];
+		if (!isref)
+			delete leaf->values[pos];
+		leaf->count--;
+		memmove (leaf->hints+pos, leaf->hints+pos+1, (leaf->count-pos) * sizeof (KeyHint));
+		memmove (leaf->keys+pos, leaf->keys+pos+1, (leaf->count-pos) * sizeof (keyclass*));
+		memmove (leaf->values+pos, leaf->values+pos+1, (leaf->count-pos) * sizeof (valueclass*));
+		mCount--;
+		return leaf->count == 0;
+	}
+
+	Inner* inner = static_cast<Inner*> (node);
+	int pos = childIndex (inner, key, hint);
+	if (!removeFrom (inner->children[pos], level-1, key, hint))
+		return false;
+
+	freeNode (inner->children[pos], level-1);
+	if (inner->count > 1) {
+		int sep = (pos > 0)? pos-1 : 0;
+		delete inner->keys[sep];
+		memmove (inner->hints+sep, inner->hints+sep+1, (inner->count-2-sep) * sizeof (KeyHint));
+		memmove (inner->keys+sep, inner->keys+sep+1, (inner->count-2-sep) * sizeof (keyclass*));
+	}
+	inner->count--;
+	memmove (inner->children+pos, inner->children+pos+1, (inner->count-pos) * sizeof (void*));
+	return inner->count == 0;
+}
+
+/*******************************************************************************
+ * Deletes an empty node, and unlinks it from the leaf list if it is
+ * a leaf.
+ ******************************************************************************/
+template <class keyclass, class valueclass, class compareclass>
+void OrderedMap<keyclass,valueclass,compareclass>::freeNode (void* node, int level)
+{
+	if (level > 0) {
+		delete static_cast<Inner*> (node);
+		return;
+	}
+	Leaf* leaf = static_cast<Leaf*> (node);
+	if (leaf->prev)
+		leaf->prev->next = leaf->next;
+	else
+		mFirst = leaf->next;
+	if (leaf->next)
+		leaf->next->prev = leaf->prev;
+	delete leaf;
+}
+
+/*******************************************************************************
+ * Deletes a subtree with its items.
+ ******************************************************************************/
+template <class keyclass, class valueclass, class compareclass>
+void OrderedMap<keyclass,valueclass,compareclass>::freeTree (void* node, int level)
+{
+	if (level == 0) {
+		Leaf* leaf = static_cast<Leaf*> (node);
+		for (int i=0; i<leaf->count; i++) {
+			delete leaf->keys[i];
+			if (!isref)
+				delete leaf->values[i];
+		}
+		delete leaf;
+		return;
+	}
+	Inner* inner = static_cast<Inner*> (node);
+	for (int i=0; i<inner->count; i++) {
+		if (i > 0)
+			delete inner->keys[i-1];
+		freeTree (inner->children[i], level-1);
+	}
+	delete inner;
+}
+
+/*******************************************************************************
+ * Checks that the keys are in order and that the item count is right.
+ ******************************************************************************/
+template <class keyclass, class valueclass, class compareclass>
+void OrderedMap<keyclass,valueclass,compareclass>::check () const
+{
+	int count = 0;
+	const keyclass* last = NULL;
+	for (const Leaf* leaf = mFirst; leaf; leaf = leaf->next) {
+		ASSERT (leaf->count > 0 && leaf->count <= ORDMAP_LEAF_SIZE);
+		ASSERT (!leaf->next || leaf->next->prev == leaf);
+		for (int i=0; i<leaf->count; i++) {
+			ASSERT (!last || compareclass::compare (*last, *leaf->keys[i]) < 0);
+			ASSERT (leaf->hints[i] == compareclass::hint (*leaf->keys[i]));
+			ASSERT (findLeaf (*leaf->keys[i], leaf->hints[i]) == leaf);
+			last = leaf->keys[i];
+			count++;
+		}
+	}
+	ASSERT (count == mCount);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//     ___               |                   |   |            ---           //
+//    |   | |/\   ___    |  ___  |/\   ___   |\ /|  ___   --   |   |   ___  //
+//    |   | |    /   ) --| /   ) |    /   )  | V |  ___| |  )  |  -+- /   ) //
+//    |   | |    |---  | | |---  |    |---   | | | (   | |--   |   |  |---  //
+//    `___' |     \__   \|  \__  |     \__   |   |  \__| |    _|_   \  \__  //
+//////////////////////////////////////////////////////////////////////////////
+
+/** Iterator over an @ref OrderedMap in key order. Usage:
+ *
+ *  for (OrderedMapIter<String,String> iter (myMap); !iter.exhausted(); iter.next())
+ *      printf("%s=%s\n", (CONSTR) iter.key(), (CONSTR) iter.value());
+ *
+ *  The iteration can be limited to a range of keys with @ref seek()
+ *  and @ref until(), or to the String keys that begin with a prefix
+ *  with @ref prefix(). For example, all the keys under "section.":
+ *
+ *  OrderedMapIter<String,String> iter (myMap);
+ *  for (iter.prefix ("section."); !iter.exhausted(); iter.next())
+ *
+ *  The map must not be modified during the iteration.
+ **/
+template <class keyclass, class valueclass, class compareclass=KeyCompare<keyclass> >
+class OrderedMapIter {
+	typedef OrderedMap<keyclass,valueclass,compareclass> MapType;
+	typedef typename MapType::Leaf Leaf;
+
+  public:
+						OrderedMapIter	(const MapType& map) : mrMap (map), mpEnd (NULL) {first ();}
+						~OrderedMapIter	() {delete mpEnd;}
+
+	/** Points the iterator to the first item in the map. */
+	void				first			() {
+		mpLeaf = mrMap.mFirst;
+		mIndex = 0;
+		checkEnd ();
+	}
+
+	/** Points the iterator to the first key that is not less than
+	 *  the given one.
+	 **/
+	void				seek			(const keyclass& from) {
+		KeyHint hint = compareclass::hint (from);
+		mpLeaf = mrMap.mRoot? mrMap.findLeaf (from, hint) : NULL;
+		if (mpLeaf) {
+			mIndex = MapType::lowerIndex (mpLeaf, from, hint);
+			if (mIndex == mpLeaf->count) {
+				mpLeaf = mpLeaf->next;
+				mIndex = 0;
+			}
+		}
+		checkEnd ();
+	}
+
+	/** Ends the iteration before the first key that is not less
+	 *  than the given one.
+	 **/
+	void				until			(const keyclass& to) {
+		delete mpEnd;
+		mpEnd = new keyclass (to);
+		checkEnd ();
+	}
+
+	/** Limits the iteration to the keys that begin with the given
+	 *  prefix, and points the iterator to the first of them. The key
+	 *  class must be @ref String.
+	 **/
+	void				prefix			(const String& start) {
+		// The range ends at the first string after all those with the
+		// prefix, if there is one
+		delete mpEnd;
+		mpEnd = NULL;
+		int len = start.length ();
+		while (len > 0 && (unsigned char) start[len-1] == 0xff)
+			len--;
+		if (len > 0) {
+			String end = start;
+			end.dellast (end.length () - len + 1);
+			end += char ((unsigned char) start[len-1] + 1);
+			mpEnd = new keyclass (end);
+		}
+		seek (start);
+	}
+
+	/** Moves the iterator to next item in the map. */
+	void				next			() {
+		if (++mIndex == mpLeaf->count) {
+			mpLeaf = mpLeaf->next;
+			mIndex = 0;
+		}
+		checkEnd ();
+	}
+
+	/** Returns the key in the current position of the iterator. */
+	const keyclass&		key				() const {return *mpLeaf->keys[mIndex];}
+
+	/** Returns a const reference to the value in the current position
+	 *  of the iterator.
+	 **/
+	const valueclass&	value			() const {return *mpLeaf->values[mIndex];}
+
+	/** Returns a non-const reference to the value in the current
+	 *  position of the iterator.
+	 **/
+	valueclass&			value			() {return *mpLeaf->values[mIndex];}
+
+	/** Returns 1 (true) if all the items in the range have been
+	 *  iterated, 0 (false) otherwise.
+	 **/
+	int					exhausted		() const {return mpLeaf == NULL;}
+
+  private:
+	const MapType&	mrMap;
+	const Leaf*		mpLeaf;		/**< Current leaf, NULL when exhausted. */
+	int				mIndex;		/**< Current item in the leaf. */
+	keyclass*		mpEnd;		/**< Owned copy of the end of the range, or NULL. */
+
+	void				checkEnd		() {
+		if (mpLeaf && mpEnd && compareclass::compare (*mpLeaf->keys[mIndex], *mpEnd) >= 0)
+			mpLeaf = NULL;
+	}
+
+						OrderedMapIter	(const OrderedMapIter& other);
+	void				operator=		(const OrderedMapIter& other);
+};
+
+END_NAMESPACE;
+
+#endif
@@ -1,11 +1,36 @@
 #ifndef __PACKARRAY_H__
 #define __PACKARRAY_H__
 
+#include <new>
 #include "magic/mobject.h"
 #include "magic/mmagisupp.h"
+#include "magic/malgorithm.h"
 
 BEGIN_NAMESPACE (MagiC);
 
+// Placement new can not be used with the debugging new
+#ifdef new
+#undef new
+#define new_UNDEFD
+#endif
+
+/** Constructs a copy of the item in the uninitialized memory. */
+template <class TYPE>
+inline void packConstruct (TYPE* p, const TYPE& item) {
+	::new ((void*) p) TYPE (item);
+}
+
+/** Default-constructs an item in the uninitialized memory. */
+template <class TYPE>
+inline void packConstruct (TYPE* p) {
+	::new ((void*) p) TYPE ();
+}
+
+#ifdef new_UNDEFD
+#define new DEBUG_NEW
+#undef new_UNDEFD
+#endif
+
 //////////////////////////////////////////////////////////////////////////////
 //                                                                          //
 //        ----              |     _                         /    \          //
@@ -19,65 +44,72 @@ BEGIN_NAMESPACE (MagiC);
 /** Packed array/vector; saves space and is fast. Especially useful
  *  with the primitive types such as int or float. 0-based indexing.
  *
- *  NULL objects are not possible like in @ref Array. Nor is this
- *  container as dynamic as @ref Array is.
+ *  The items are stored by value in one contiguous block, so unlike
+ *  with @ref Array, adding an item does not allocate it separately.
+ *  NULL objects are not possible like in @ref Array.
+ *
+ *  The block grows geometrically when items are added with @ref
+ *  add(). It is allocated with malloc() and moved with realloc(), so
+ *  the items must not hold pointers to themselves.
  **/
 template <class TYPE>
 class PackArray : public Object {
 	TYPE*	data;		/**< The items as a C-array. */
 	int		mSize;		/**< Length of the array. */
+	int		mCapacity;	/**< Number of items the block has room for. */
   public:
 
 	PackArray	() {
 		data = NULL;
 		mSize = 0;
+		mCapacity = 0;
 	}
 
 	/** Creates an packed array with the given mSize. */
 	PackArray	(int siz) {
 		data = NULL;
-		mSize = siz;
-		make (mSize);
+		mSize = 0;
+		mCapacity = 0;
+		make (siz);
 	}
 
-	/** Copy constructor uses operator= to copy the contained
-	 *  items. Remember to define the operator= for the object class,
-	 *  as the default operator= does only a shallow copy.
+	/** Copy constructor uses the copy constructor of the object
+	 *  class to copy the contained items.
 	 **/
 	PackArray	(const PackArray& orig) {
 		data = NULL;
-		make (orig.mSize);
-		for (int i=0; i<mSize; i++)
-			data[i] = orig.data[i];
+		mSize = 0;
+		mCapacity = 0;
+		operator= (orig);
 	}
 
-	/** Creates or recreates the array with the given mSize. */
+	/** Creates or recreates the array with the given mSize. The items
+	 *  are default-constructed.
+	 **/
 	void	make	(int siz) {
-		if (data)
-			destroy ();
-		mSize = siz;
-		if (mSize>0)
-			data = new TYPE [mSize];
-		else
-			data = NULL;
+		destroy ();
+		resize (siz);
 	}
 
 	~PackArray	() {
 		destroy ();
 	}
 
-	/** Very quick copy operator. */
+	/** Very quick copy operator. Only for the primitive types. */
 	void	shallowCopy	(const PackArray& orig) {
 		if (mSize != orig.mSize)
 			make (orig.mSize);
 		memcpy (data, orig.data, mSize*sizeof(TYPE));
 	}
 	
-	/** Empties the array. */
+	/** Empties the array and releases the memory block. */
 	void	destroy	() {
-		delete data;
+		for (int i=0; i<mSize; i++)
+			data[i].~TYPE ();
+		free (data);
 		data = NULL;
 		mSize = 0;
+		mCapacity = 0;
 	}
 
 	/** Empties the array. Alias for @ref destroy(). */
@@ -111,16 +143,33 @@ class PackArray : public Object {
 	PackArray<TYPE>& operator=	(const PackArray& other) {
 		if (this != &other) {
 			destroy ();
-			if (other.mSize) {
-				data = new TYPE [other.mSize];
-				mSize = other.mSize;
-				for (int i=0; i<mSize; i++)	// We have to copy these explicitly
-					data[i] = other.data[i];
-			}
+			reserve (other.mSize);
+			for (; mSize<other.mSize; mSize++)	// We have to copy these explicitly
+				packConstruct (data+mSize, other.data[mSize]);
 		}
 		return *this;
 	}
 
+	/** Adds a copy of the given item to the end of the array; grows
+	 *  the array geometrically, so that adding costs amortized
+	 *  constant time.
+	 **/
+	void	add	(const TYPE& item) {
+		if (mSize == mCapacity) {
+			if (&item >= data && &item < data+mSize) {
+				// The item would move with the block
+				TYPE copy (item);
+				reserve (mCapacity*2);
+				packConstruct (data+mSize, copy);
+			} else {
+				reserve (mCapacity? mCapacity*2 : 8);
+				packConstruct (data+mSize, item);
+			}
+		} else
+			packConstruct (data+mSize, item);
+		mSize++;
+	}
+
 	/*
 	void	removeFill	(int pos) {
 		ASSERTWITH (i>=0 && i<mSize,
@@ -133,29 +182,103 @@ class PackArray : public Object {
 	}
 	*/
 	
-	/** Changes mSize of the array.
+	/** Changes mSize of the array. New items are default-constructed;
+	 *  shrinking keeps the reserved capacity.
 	 **/
 	void	resize	(int newsize) {
 		ASSERT (newsize>=0);
 		
-		if (newsize == mSize)
+		if (newsize > mCapacity)
+			reserve (newsize);
+		for (; mSize<newsize; mSize++)
+			packConstruct (data+mSize);
+		for (; mSize>newsize; mSize--)
+			data[mSize-1].~TYPE ();
+	}
+
+	/** Reserves room for at least the given number of items. Never
+	 *  shrinks.
+	 **/
+	void	reserve	(int capacity) {
+		if (capacity <= mCapacity)
 			return;
+		data = (TYPE*) reallocItems (data, capacity, sizeof (TYPE));
+		mCapacity = capacity;
+	}
 
-		if (newsize>0)
-			if (data)
-				data = (TYPE*) renew (data, sizeof (TYPE)*newsize);
-			else
-				data = new TYPE [newsize];
-		else
+	/** Releases the capacity reserved beyond the current size. */
+	void	shrinkToFit	() {
+		if (mCapacity == mSize)
+			return;
+		if (mSize == 0)
 			destroy ();
-
-		mSize = newsize;
+		else {
+			data = (TYPE*) reallocItems (data, mSize, sizeof (TYPE));
+			mCapacity = mSize;
+		}
 	}
 
 	int size () const {
 		return mSize;
 	}
 
+	/** Returns the number of items the array can hold without
+	 *  reallocation.
+	 **/
+	int capacity () const {
+		return mCapacity;
+	}
+
+	/** Sorts the items with @ref introSort, in the order given by the
+	 *  comparator, by default @ref KeyCompare of the item class.
+	 **/
+	void	sort		() {
+		MagiC::introSort (data, mSize);
+	}
+
+	template <class CMP>
+	void	sort		(const CMP& cmp) {
+		MagiC::introSort (data, mSize, cmp);
+	}
+
+	/** Sorts the items with @ref mergeSort, keeping equal items in
+	 *  their order.
+	 **/
+	void	stableSort	() {
+		MagiC::mergeSort (data, mSize);
+	}
+
+	template <class CMP>
+	void	stableSort	(const CMP& cmp) {
+		MagiC::mergeSort (data, mSize, cmp);
+	}
+
+	/** Searches the sorted array for an item equal to the given one.
+	 *  Returns the index of the first such item, or -1 if there is
+	 *  none.
+	 **/
+	int		binarySearch	(const TYPE& item) const {
+		return MagiC::binarySearch (data, mSize, item);
+	}
+
+	template <class CMP>
+	int		binarySearch	(const TYPE& item, const CMP& cmp) const {
+		return MagiC::binarySearch (data, mSize, item, cmp);
+	}
+
+	/** Returns the index of the first item of the sorted array that
+	 *  is not less than the given one, that is, where the item would
+	 *  be inserted to keep the order.
+	 **/
+	int		lowerBound		(const TYPE& item) const {
+		return MagiC::lowerBound (data, mSize, item);
+	}
+
+	template <class CMP>
+	int		lowerBound		(const TYPE& item, const CMP& cmp) const {
+		return MagiC::lowerBound (data, mSize, item, cmp);
+	}
+
 	/** Implementation for @ref Object. Archive support. */
 	/*
 	virtual CArchive&	operator>>	(CArchive& arc) const {
@@ -181,7 +304,8 @@ class PackArray : public Object {
 
 	/** Implementation for @ref Object. */
 	virtual void	check	() const {
-		ASSERT ((data?1:0) == (mSize?1:0));
+		ASSERT ((data?1:0) == (mCapacity?1:0));
+		ASSERT (mSize<=mCapacity);
 		ASSERT (((unsigned int&)*this) != 0xdddddddd);
 		if (data)
 			ASSERT (((unsigned int&)*data) != 0xdddddddd);
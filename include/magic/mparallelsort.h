@@ -0,0 +1,182 @@
+/***************************************************************************
+ *   This file is part of the MagiC++ library.                             *
+ *                                                                         *
+ *   Copyright (C) 1998-2005 Marko Grnroos <magi@iki.fi>                  *
+ *                                                                         *
+ ***************************************************************************
+ *                                                                         *
+ *  This library is free software; you can redistribute it and/or          *
+ *  modify it under the terms of the GNU Library General Public            *
+ *  License as published by the Free Software Foundation; either           *
+ *  version 2 of the License, or (at your option) any later version.       *
+ *                                                                         *
+ *  This library is distributed in the hope that it will be useful,        *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU      *
+ *  Library General Public License for more details.                       *
+ *                                                                         *
+ *  You should have received a copy of the GNU Library General Public      *
+ *  License along with this library; see the file COPYING.LIB.  If         *
+ *  not, write to the Free Software Foundation, Inc., 59 Temple Place      *
+ *  - Suite 330, Boston, MA 02111-1307, USA.                               *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef __MAGIC_MPARALLELSORT_H__
+#define __MAGIC_MPARALLELSORT_H__
+
+#include <unistd.h>
+#include "magic/malgorithm.h"
+#include "magic/mpackarray.h"
+#include "magic/mthread.h"
+
+BEGIN_NAMESPACE (MagiC);
+
+/** Smallest number of items @ref parallelSort gives to one thread. */
+#define SORT_PARALLEL_MIN		65536
+
+/*******************************************************************************
+ * Sorting in several threads. This is kept apart from the other
+ * algorithms of @ref malgorithm.h, so that only the programs that
+ * sort in parallel include the thread headers.
+ ******************************************************************************/
+
+/** A part of the work of @ref parallelSort. */
+template <class TYPE, class CMP>
+class SortTask : public Thread {
+  public:
+	const CMP*		cmp;
+	TYPE*			data;		/**< Items to sort, or to merge from. */
+	int				na, nb;		/**< Sizes of the runs to merge; nb<0 to sort. */
+	const TYPE*		b;			/**< Second run to merge. */
+	TYPE*			dst;		/**< Where to merge. */
+
+	/** Sorts or merges in the calling thread. */
+	void			run			() {
+		if (nb < 0)
+			introSortLoop (data, na, 2*floorLog2 (na), *cmp);
+		else
+			mergeItems (data, na, b, nb, dst, *cmp);
+	}
+
+	virtual void*	execute		() {
+		run ();
+		return NULL;
+	}
+};
+
+/** Runs the tasks, the first in the calling thread and the rest in
+ *  their own threads.
+ **/
+template <class TYPE, class CMP>
+void runSortTasks (SortTask<TYPE,CMP>* tasks, int count) {
+	for (int i=1; i<count; i++)
+		tasks[i].start ();
+	tasks[0].run ();
+	for (int i=1; i<count; i++)
+		tasks[i].join ();
+}
+
+/** Sorts the n items using several threads. The items are split into
+ *  a chunk per thread, which are sorted with @ref introSort and then
+ *  merged in rounds. The merges of each round are split between all
+ *  the threads, so that the last merges do not run in one thread. Not
+ *  stable. Needs a temporary buffer of n items.
+ *
+ *  @param threads Number of threads to use, by default the number of
+ *  processors online. Each thread gets at least SORT_PARALLEL_MIN
+ *  items, so small arrays are sorted in the calling thread.
+ **/
+template <class TYPE, class CMP>
+void parallelSort (TYPE* data, int n, int threads, const CMP& cmp) {
+	if (threads <= 0)
+		threads = sysconf (_SC_NPROCESSORS_ONLN);
+	if (threads > n/SORT_PARALLEL_MIN)
+		threads = n/SORT_PARALLEL_MIN;
+	if (threads <= 1) {
+		introSort (data, n, cmp);
+		return;
+	}
+
+	SortTask<TYPE,CMP>* tasks = new SortTask<TYPE,CMP> [threads];
+	int* bounds = new int [threads+1];
+	for (int i=0; i<=threads; i++)
+		bounds[i] = (int) ((long long) n * i / threads);
+	for (int i=0; i<threads; i++) {
+		tasks[i].cmp = &cmp;
+		tasks[i].data = data + bounds[i];
+		tasks[i].na = bounds[i+1] - bounds[i];
+		tasks[i].nb = -1;
+	}
+	runSortTasks (tasks, threads);
+
+	TYPE* buffer = (TYPE*) new char [n * sizeof (TYPE)];
+	TYPE* src = data;
+	TYPE* dst = buffer;
+	for (int runs=threads, step=1; runs>1; runs=(runs+1)/2, step*=2) {
+		// Merges the pairs of runs, each in parts
+		int merges = runs/2;
+		int parts = (threads > merges)? threads/merges : 1;
+		int count = 0;
+		for (int m=0; m<merges; m++) {
+			int start = bounds[2*m*step];
+			int middle = bounds[(2*m+1)*step];
+			int end = bounds[((2*m+2)*step < threads)? (2*m+2)*step : threads];
+			const TYPE* a = src+start;
+			const TYPE* b = src+middle;
+			int na = middle-start, nb = end-middle;
+			for (int p=0, prevK=0, prevA=0; p<parts; p++) {
+				int k = (int) ((long long) (na+nb) * (p+1) / parts);
+				int splitA = mergeSplit (a, na, b, nb, k, cmp);
+				tasks[count].data = (TYPE*) a + prevA;
+				tasks[count].na = splitA - prevA;
+				tasks[count].b = b + (prevK-prevA);
+				tasks[count].nb = (k-splitA) - (prevK-prevA);
+				tasks[count].dst = dst + start + prevK;
+				count++;
+				prevK = k;
+				prevA = splitA;
+			}
+		}
+		runSortTasks (tasks, count);
+
+		// An odd run is left as it is
+		if (runs % 2) {
+			int start = bounds[(runs-1)*step];
+			copyItems (dst+start, src+start, n-start);
+		}
+		TYPE* tmp = src;
+		src = dst;
+		dst = tmp;
+	}
+	if (src == buffer)
+		copyItems (data, buffer, n);
+
+	delete [] (char*) buffer;
+	delete [] bounds;
+	delete [] tasks;
+}
+
+template <class TYPE>
+inline void parallelSort (TYPE* data, int n, int threads=0) {
+	parallelSort (data, n, threads, KeyCompare<TYPE> ());
+}
+
+/** Sorts the items of the array with @ref parallelSort, in the given
+ *  number of threads or by default one per processor.
+ **/
+template <class TYPE>
+inline void parallelSort (PackArray<TYPE>& array, int threads=0) {
+	if (array.size () > 0)
+		parallelSort (&array[0], array.size (), threads);
+}
+
+template <class TYPE, class CMP>
+inline void parallelSort (PackArray<TYPE>& array, int threads, const CMP& cmp) {
+	if (array.size () > 0)
+		parallelSort (&array[0], array.size (), threads, cmp);
+}
+
+END_NAMESPACE;
+
+#endif
@@ -12,6 +12,8 @@
 #include <magic/mstring.h>
 #include <magic/marchive.h>
 #include <magic/mmagisupp.h>
+#include <magic/marena.h>
+#include <magic/malgorithm.h>
 
 // External:
 
@@ -47,12 +49,19 @@ BEGIN_NAMESPACE (MagiC);
  *  Object&)-function in mobject.h.
  *
  *  if (isnull(myArray[5])) {...}
+ *
+ *  An Array constructed with an @ref Arena makes the copies of the
+ *  items in the arena, and only destroys its items instead of
+ *  deleting them, so objects given to it by pointer must be made in
+ *  the arena too, for example with @ref arenaCopy.
  **/
 template <class TYPE>
 class Array : public Object {
 	bool	mIsRef;
 	int		mSize;
+	int		mCapacity;	/**< Number of allocated pointer slots. */
 	TYPE**	rep;
+	Arena*	mArena;		/**< Arena of the items, or NULL. */
   public:
 
 
@@ -64,15 +73,31 @@ class Array : public Object {
 	 **/
 	Array	(int siz=0) {
 		mSize  = 0;
+		mCapacity = 0;
+		rep    = NULL;
+		mIsRef = false;
+		mArena = NULL;
+		make (siz);
+	}
+
+	/** Creates an array that makes its items in the given arena. The
+	 *  array must be destroyed before the arena is released.
+	 **/
+	Array	(Arena& arena, int siz=0) {
+		mSize  = 0;
+		mCapacity = 0;
 		rep    = NULL;
 		mIsRef = false;
+		mArena = &arena;
 		make (siz);
 	}
 	
 	Array (const Array<TYPE>& orig) {
 		mSize  = 0;
+		mCapacity = 0;
 		rep    = NULL;
 		mIsRef = false;
+		mArena = NULL;
 		operator= (orig);
 	}
 	
@@ -83,15 +108,16 @@ class Array : public Object {
 	 *  when they are accessed first time.
 	 **/
 	void	make	(int siz) {
-		if (mSize) {
+		if (rep) {
 			empty ();
-			delete rep;
+			free (rep);
 			rep=NULL;
 			mSize=0;
+			mCapacity=0;
 		}
 		if (siz>0) {
-			mSize = siz;
-			ASSERTWITH (rep=new TYPE*[mSize], "Out of memory in array memory allocation");
+			mSize = mCapacity = siz;
+			rep = (TYPE**) reallocItems (NULL, mSize, sizeof (TYPE*));
 			for (int i=0; i<mSize; i++)
 				rep[i] = NULL;
 		}
@@ -111,8 +137,7 @@ class Array : public Object {
 	 **/
 	virtual	~Array () {
 		empty ();
-		delete rep;
-		memset (this, 0xcd, sizeof(Array<TYPE>));
+		free (rep);
 	}
 
 	/** Destroys all the objects in the Array, but does NOT change the
@@ -122,7 +147,7 @@ class Array : public Object {
 		if (rep)
 			for (int i=0;i<mSize;i++) {
 				if (!mIsRef)
-					delete rep[i];
+					destroyItem (rep[i]);
 				rep[i] = NULL;
 			}
 	}
@@ -133,9 +158,9 @@ class Array : public Object {
 	 *  NOTE: Takes the ownership of the object.
 	 **/
 	void	add	(TYPE* i) {
-		resize (mSize + 1);
-		delete rep [mSize - 1];
-		rep[mSize - 1] = i;
+		if (mSize == mCapacity)
+			grow ();
+		rep[mSize++] = i;
 	}
 
 	/** Adds the given object to the end of the array; increments the
@@ -145,12 +170,12 @@ class Array : public Object {
 	 *  copies it using the copy constructor.
 	 **/
 	void	add	(const TYPE& i) {
-		resize (mSize + 1);
-		delete rep [mSize-1];
+		if (mSize == mCapacity)
+			grow ();
 		if (mIsRef)
-			rep[mSize-1] = const_cast<TYPE*>(&i);
+			rep[mSize++] = const_cast<TYPE*>(&i);
 		else
-			rep[mSize-1] = new TYPE (i);
+			rep[mSize++] = copyItem (i);
 	}
 
 	/** Puts the given object to the given location. Old item in the
@@ -167,7 +192,7 @@ class Array : public Object {
 			throw out_of_range ((CONSTR)
 				format("Index put %d out of Array bounds (size %d)", loc, mSize));
 		if (!mIsRef)
-			delete rep [loc];
+			destroyItem (rep [loc]);
 		rep [loc] = i;
 	}
 
@@ -184,8 +209,8 @@ class Array : public Object {
 		if (loc >= mSize)
 			resize (loc+1);
 		if (!mIsRef) {
-			delete rep [loc];
-			rep[loc] = new TYPE (i);
+			destroyItem (rep [loc]);
+			rep[loc] = copyItem (i);
 		} else
 			rep[loc] = const_cast<TYPE*>(&i);
 	}
@@ -221,7 +246,7 @@ class Array : public Object {
 		else if (mIsRef)
 			return *((TYPE*)NULL);
 		else
-			return *(rep [loc] = new TYPE ());
+			return *(rep [loc] = newItem ());
 	}
 
 	/** Returns a reference to the loc:th item in the Array.
@@ -238,7 +263,7 @@ class Array : public Object {
 		else if (mIsRef)
 			return *((TYPE*)NULL);
 		else
-			return *(rep [loc] = new TYPE ());
+			return *(rep [loc] = newItem ());
 	}
 	
 	/** Returns a pointer to the loc:th item in the Array.
@@ -280,7 +305,7 @@ class Array : public Object {
 	 **/
 	void	remove	(int loc) {
 		ASSERTWITH (loc < mSize, format("Index %d out of Array bounds (size %d)", loc, mSize));
-		delete rep[loc];
+		destroyItem (rep[loc]);
 		rep[loc] = NULL;
 	}
 
@@ -291,7 +316,7 @@ class Array : public Object {
 	 **/
 	void	removeFill	(int loc) {
 		ASSERTWITH (loc < mSize, format("Index %d out of Array bounds (size %d)", loc, mSize));
-		delete rep[loc];
+		destroyItem (rep[loc]);
 		for (int i=loc+1; i<mSize; i++)
 			rep[i-1]=rep[i];
 		rep[mSize-1] = NULL;
@@ -309,28 +334,55 @@ class Array : public Object {
 	
 	/** Changes the bounds of the Array to the given ones. New size is
 	 *  calculated accordingly. Reserves or destructs as needed.
+	 *
+	 *  Shrinking keeps the reserved capacity; see @ref shrinkToFit().
 	 **/
 	void	resize	(int newsize) {
 		/* Muuttaa taulukon kokoa, old[lower] = new[lower] */
 		if (newsize < mSize) { /* Pienennetn */
-			for (int i=newsize; i<mSize; i++)
-				delete rep [i];
-			if (newsize==0) {
-				delete rep;
-				rep = NULL;
-			} else
-				rep = (TYPE**) renew (rep, sizeof (TYPE*)*(newsize));
-		} else { /* Suurennetaan */
-			if (rep)
-				rep = (TYPE**) renew (rep, sizeof (TYPE*)*(newsize));
-			else
-				rep = (TYPE**) new TYPE* [newsize];
-			for (int i=mSize; i<newsize; i++)
+			for (int i=newsize; i<mSize; i++) {
+				if (!mIsRef)
+					destroyItem (rep [i]);
 				rep [i] = NULL;
+			}
+		} else { /* Suurennetaan */
+			if (newsize > mCapacity)
+				reserve (newsize);
 		}
 		mSize	= newsize;
 	}
 
+	/** Reserves room for at least the given number of items, so that
+	 *  they can be added without reallocation. Never shrinks.
+	 **/
+	void	reserve	(int capacity) {
+		if (capacity <= mCapacity)
+			return;
+		rep = (TYPE**) reallocItems (rep, capacity, sizeof (TYPE*));
+		for (int i=mCapacity; i<capacity; i++)
+			rep [i] = NULL;
+		mCapacity = capacity;
+	}
+
+	/** Releases the capacity reserved beyond the current size. */
+	void	shrinkToFit	() {
+		if (mCapacity == mSize)
+			return;
+		if (mSize == 0) {
+			free (rep);
+			rep = NULL;
+		} else
+			rep = (TYPE**) reallocItems (rep, mSize, sizeof (TYPE*));
+		mCapacity = mSize;
+	}
+
+	/** Returns the number of items the array can hold without
+	 *  reallocation.
+	 **/
+	int		capacity	() const {
+		return mCapacity;
+	}
+
 	/** Standard =-operator. Performs deep copy.
 	 **/
 	void	operator=	(const Array<TYPE>& other) {
@@ -372,15 +424,35 @@ class Array : public Object {
 	 **/
 	virtual void	check	() const {
 		ASSERT (mSize>=0);
+		ASSERT (mSize<=mCapacity);
+		ASSERT ((rep?1:0) == (mCapacity?1:0));
 	}
 
-	/** Sorts the values in the Array.
+	/** Sorts the values in the Array with @ref introSort. The NULL
+	 *  items go last.
 	 *
-	 * NOTE: The contained objects MUST inherit @ref Comparable, and
-	 * be of the same class!
+	 *  The items are compared with @ref KeyCompare of the item class,
+	 *  which calls their compare(); the class should inherit @ref
+	 *  Comparable or otherwise have a compare for its own class.
 	 **/
 	void	quicksort	() {
-		qsort (rep, mSize, sizeof (TYPE*), compareComparable);
+		introSort (rep, mSize, PointerCompare<TYPE> ());
+	}
+
+	/** Sorts the values in the Array in the order given by the
+	 *  comparator of the item class; see @ref KeyCompare.
+	 **/
+	template <class CMP>
+	void	quicksort	(const CMP& cmp) {
+		introSort (rep, mSize, PointerCompare<TYPE,CMP> (cmp));
+	}
+
+	/** Searches the Array, sorted with @ref quicksort(), for an item
+	 *  equal to the given one. Returns the index of the first such
+	 *  item, or -1 if there is none.
+	 **/
+	int		binarySearch	(const TYPE& item) const {
+		return MagiC::binarySearch ((const TYPE**) rep, mSize, &item, PointerCompare<TYPE> ());
 	}
 
 	/** Returns number of elements (or null elements) in array. */
@@ -410,6 +482,32 @@ class Array : public Object {
 	iterator start () const {
 		return iterator (*this);
 	}
+
+  private:
+	/** Makes a copy of the item, in the arena if there is one. */
+	TYPE*	copyItem	(const TYPE& item) const {
+		return mArena? arenaCopy (*mArena, item) : new TYPE (item);
+	}
+
+	/** Default-constructs an item, in the arena if there is one. */
+	TYPE*	newItem		() const {
+		return mArena? arenaConstruct<TYPE> (*mArena) : new TYPE ();
+	}
+
+	/** Deletes an item, or only destroys it if it is in the arena. */
+	void	destroyItem	(TYPE* item) const {
+		if (mArena)
+			arenaDestroy (item);
+		else
+			delete item;
+	}
+
+	/** Grows the capacity geometrically, so that adding items one at a
+	 *  time costs amortized constant time.
+	 **/
+	void	grow	() {
+		reserve (mCapacity? mCapacity*2 : 8);
+	}
 };
 
 /** Clone operator for the @ref Array.
@@ -25,6 +25,8 @@
 #ifndef __REFARRAY_H__
 #define __REFARRAY_H__
 
+#include "magic/malgorithm.h"
+
 BEGIN_NAMESPACE (MagiC);
 
 
@@ -143,12 +145,12 @@ class RefArray {
 		mSize = newsize;
 	}
 
-	/** Sorts the references... WOW!
-	 *
-	 * The contained class MUST inherit Comparable...
+	/** Sorts the references with @ref introSort, by the compare() of
+	 *  the referenced items; see @ref KeyCompare. The NULL references
+	 *  go last.
 	 **/
 	void	quicksort	() {
-		qsort (mpRep, mSize, sizeof (TYPE*), compareComparable);
+		introSort (mpRep, mSize, PointerCompare<TYPE> ());
 	}
 };
 
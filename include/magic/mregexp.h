@@ -33,6 +33,7 @@
 namespace MagiC {
 	// Externals
 	class String;
+	class SubString;
 
 	// Internals
 	class RegExp;
@@ -40,6 +41,7 @@ namespace MagiC {
 BEGIN_NAMESPACE (MagiC);
 
 template <class TYPE> class Array;
+template <class TYPE> class PackArray;
 
 
 //////////////////////////////////////////////////////////////////////////////
@@ -72,6 +74,10 @@ class RegExp { // : public Object
 	// Kuten yll, mutta tallentaa aliekspressioiden tulokset results-vektoriin
 	int			match		(const String& string, Array<String>& results);
 
+	// Sovittaa nkymn kopioimatta sit. Tulokset ovat nkymi sen osiin.
+	int			match		(const SubString& view);
+	int			match		(const SubString& view, PackArray<SubString>& results);
+
 	// Palauttaa virheen kuvauksen merkkijonona
 	String		geterror	() const;
 };
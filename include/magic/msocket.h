@@ -27,41 +27,113 @@
 
 #include <magic/miodevice.h>
 
+BEGIN_NAMESPACE (MagiC);
 
-/** A communication socket device.
- **/
+/*******************************************************************************
+ * A stream socket device, over TCP or a Unix-domain socket.
+ *
+ * Sockets are non-blocking unless @ref setBlocking() is called. A
+ * read then returns what has arrived, possibly nothing, and a write
+ * takes what fits in the send buffer of the kernel; the caller waits
+ * for more with a @ref DeviceNotifier, or with @ref wait().
+ * @ref readBlock() returns 0 both when nothing has arrived and at
+ * the end of the stream, which @ref atEnd() tells apart. Errors set
+ * the status and return -1.
+ *
+ *  @example
+ *  @code
+ *     ClientSocket socket;
+ *     socket.setBlocking (true);
+ *     if (socket.connect ("localhost", 8080))
+ *         socket.writeBlock ("GET / HTTP/1.0\r\n\r\n");
+ *  @endcode
+ ******************************************************************************/
 class Socket : public IODevice {
   public:
 					Socket				(int mode=0);
+					Socket				(int socket, int mode);
 	virtual			~Socket				();
 
 	int				socket				() const {return mSocket;}
 	void			setSocket			(int socket);
+	virtual int		handle				() const {return mSocket;}
+	bool			isUnix				() const;
 
 	String			peerName			() const;
 	uint			port				() const;
 	uint			peerPort			() const;
 	uint			address				() const;
 	uint			peerAddress			() const;
-	
+
+	void			setBlocking			(bool blocking);
+	bool			isBlocking			() const {return mBlocking;}
+	void			setNoDelay			(bool noDelay);
+	int				wait				(int events, double seconds=-1.0);
+
 	virtual bool	open				(int mode);
+	virtual void	close				();
 	virtual uint	size				() const					{return 0;}
 	virtual int		at					() const					{return 0;}
-	bool			reset				();
+	virtual bool	atEnd				() const					{return state () & IO_EOS;}
 	virtual int		readBlock			(char* data, uint maxlen);
 	virtual int		writeBlock			(const char* data, uint len);
-	virtual int		readLine			(char* data, uint maxlen);
-	int				writeBlock			(const String&);
-	virtual char	getch				();
+	int				writeBlock			(const String& str) {return writeBlock ((const char*) str, str.length ());}
+	virtual int		getch				();
 	virtual void	putch				(char ch);
 	virtual void	ungetch				(char ch);
 
   protected:
-	int     mSocket;
-};
+	bool			create				(int family, int mode);
 
+	int		mSocket;	/**< Socket descriptor, or -1 if closed. */
+	bool	mBlocking;	/**< Do reads and writes wait? */
+	int		mUnget;		/**< Character returned with ungetch(), or -1. */
+
+					Socket				(const Socket& other) {FORBIDDEN}
+};
 
+/*******************************************************************************
+ * A socket that connects to a server.
+ *
+ * A non-blocking socket may still be connecting when @ref connect()
+ * returns; it becomes writable when the connection completes, after
+ * which @ref finishConnect() tells whether it succeeded.
+ ******************************************************************************/
 class ClientSocket : public Socket {
   public:
-	virtual void	connect				(const String& host, uint port);
+					ClientSocket		(int mode=0) : Socket (mode), mConnecting (false) {}
+
+	virtual bool	connect				(const String& host, uint port);
+	bool			connectLocal		(const String& path);
+	bool			isConnecting		() const {return mConnecting;}
+	bool			finishConnect		();
+
+  protected:
+	bool			connectTo			(const void* address, int addressLen);
+
+	bool	mConnecting;	/**< Is a non-blocking connect in progress? */
 };
+
+/*******************************************************************************
+ * A socket that listens for connections.
+ *
+ * @ref accept() returns a new non-blocking socket for each pending
+ * connection, or NULL when there are none.
+ ******************************************************************************/
+class ServerSocket : public Socket {
+  public:
+					ServerSocket		() : Socket (IO_ReadWrite) {}
+	virtual			~ServerSocket		();
+
+	bool			listen				(uint port, const String& address="127.0.0.1", int backlog=1024);
+	bool			listenLocal			(const String& path, int backlog=1024);
+	Socket*			accept				();
+	virtual void	close				();
+
+  protected:
+	String	mPath;		/**< Path of a Unix-domain socket, removed when closed. */
+};
+
+END_NAMESPACE;
+
+#endif
@@ -101,20 +101,24 @@ class Stream : public Object {
 /** Abstract baseclass for output streams. */
 class OStream : public Stream {
   public:
-						OStream			(IODevice& dev) : Stream (dev) {;}
-						OStream			(IODevice* dev) : Stream (dev) {;}
+						OStream			(IODevice& dev) : Stream (dev), mAutoFlush (false) {;}
+						OStream			(IODevice* dev) : Stream (dev), mAutoFlush (false) {;}
 						OStream			(String& buffer, int mode = IO_Writable);
 						OStream			(FILE* strm = stdout);
 						OStream			(OStream& o);
 	virtual				~OStream		() {}
 
-	void				flush			();
+	virtual void		flush			();
 	void				autoFlush		(bool afl=true)	{mAutoFlush=afl;}
 	bool				isAutoFlush		() const		{return mAutoFlush;}
 	void				operator=		(const OStream& other) {copy (other);}
 	virtual void		copy			(const OStream& other);
 	
 	virtual OStream&	printf			(const char* format, ...);
+#if __cplusplus >= 201103L
+	template <class... ARGS>
+	OStream&			printf			(const char* sformat, const ARGS&... args);
+#endif
 	virtual OStream&	operator<<		(char) = 0;
 	virtual OStream&	operator<<		(int) = 0;
 	virtual OStream&	operator<<		(long) = 0;
@@ -128,6 +132,31 @@ class OStream : public Stream {
 	bool			mAutoFlush;
 };
 
+/** Formatting target that writes to an output stream. */
+class OStreamFormatTarget : public FormatTarget {
+  public:
+					OStreamFormatTarget	(OStream& stream) : mStream (stream) {}
+
+	virtual void	write			(const char* data, uint len) {mStream.writeRawBytes (data, len);}
+
+  private:
+	OStream&	mStream;
+};
+
+#if __cplusplus >= 201103L
+/** Formatted printing to stream, type-safely like @ref strformat.
+ *  The text is written as it is formatted, without a buffer.
+ **/
+template <class... ARGS>
+OStream& OStream::printf (const char* sformat, const ARGS&... args)
+{
+	const FormatArg list[] = {FormatArg (args)..., FormatArg ()};
+	OStreamFormatTarget target (*this);
+	formatArgs (target, sformat, list, sizeof... (ARGS));
+	return *this;
+}
+#endif
+
 
 
 ///////////////////////////////////////////////////////////////////////////////
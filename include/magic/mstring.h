@@ -45,6 +45,8 @@ namespace MagiC {
 
 	class String;
 	class SubString;
+	class FormatArg;
+	class Arena;
 
 	String	strformat	(const char* format, ...);
 }
@@ -70,14 +72,32 @@ BEGIN_NAMESPACE (MagiC);
  *  Can be a heavy bottleneck in some cases.
  **/
 #ifdef STRING_NOCHECKBOUNDS // TODO!
-#define STRING_GETCHAR(n) return mData[n];
+#define STRING_GETCHAR(n) return chars()[n];
 #else
-#define STRING_GETCHAR(n) return mData[n];
+#define STRING_GETCHAR(n) return chars()[n];
 #endif
 
+/** Maximum length of a string stored inside the String object itself,
+ *  without allocating a buffer.
+ **/
+#define STRING_INLINE_LENGTH 15
+
+/** Reserved length that marks a buffer taken from an @ref Arena. The
+ *  String does not own such a buffer, and moves to a buffer of its
+ *  own when it grows.
+ **/
+#define STRING_ARENA_BUFFER -1
+
 /** Generic string and buffer class.
  *
- *  Supports cached hash-number calculation.
+ *  Supports cached hash-number calculation. The cached value is
+ *  invalidated by all modifying methods, but not by writes through
+ *  the pointer returned by @ref getbuffer().
+ *
+ *  Strings of at most STRING_INLINE_LENGTH characters are stored
+ *  inside the object, so short strings need no allocation. The inline
+ *  buffer is not referred to with a pointer, so a String may be moved
+ *  in memory as a plain block of bytes, which @ref PackArray does.
  **/
 class String : public Comparable {
 	decl_dynamic (String);
@@ -86,6 +106,10 @@ class String : public Comparable {
 
 					String				();
 					String				(const String& orig);
+					String				(const String& orig, Arena& arena);
+#if __cplusplus >= 201103L
+					String				(String&& orig);
+#endif
 					String				(const char*);
 					String				(char* str, enum strcrflags flags);
 					String				(const char*, int n);
@@ -100,32 +124,42 @@ class String : public Comparable {
 	// Manipulation
 	String&			assign				(char c);
 	String&			append				(char c);
-	String&			append				(const String& other) {return append (other.mData, other.mLen);}
+	String&			append				(const String& other) {return append (other.chars (), other.mLen);}
 	String&			append				(const char*, uint);
 	String&			replace				(uint position, const char* buffer, int length=-1);
 
 	// Operators
 	String&			operator=			(const String&);
+#if __cplusplus >= 201103L
+	String&			operator=			(String&&);
+#endif
 	String&			operator=			(const char*);
 	String&			operator=			(char c) {return assign(c);}
 	int				operator!=			(const char* b) const {return !operator== (b);}
 	int				operator==			(const char*) const;
-	int				operator==			(const String& b) const {return (*this) == b.mData;}
+	int				operator==			(const String& b) const {return (*this) == b.chars ();}
 	int				operator==			(const Comparable& other) const;
-	String&			operator+=			(const String& str) {return append (str.mData, str.mLen);}
+	String&			operator+=			(const String& str) {return append (str.chars (), str.mLen);}
 	String&			operator+=			(char c) {return append (c);}
 	String			operator+			(const String& str) const;
 	String			operator+			(const char* str) const;
+#if __cplusplus >= 201103L
+	/** Concatenations of a temporary append to it, so that a chain of
+	 *  additions makes no further temporaries.
+	 **/
+	friend String	operator+			(String&& a, const String& b) {a.append (b); return static_cast<String&&> (a);}
+	friend String	operator+			(String&& a, const char* b) {if (b) a.append (b, strlen (b)); return static_cast<String&&> (a);}
+#endif
 	const char		operator[]			(int n) const {STRING_GETCHAR(n)} // Varies on bounds checking, see above
-	char&			operator[]			(int n) {STRING_GETCHAR(n)} // Varies on bounds checking, see above
+	char&			operator[]			(int n) {mHash=0; STRING_GETCHAR(n)} // Varies on bounds checking, see above
 
 	// Information
-	bool			isNull				() const {if (this) return !mData; return 0;}
+	bool			isNull				() const {if (this) return !isInline () && !mData; return 0;}
 	void			nullify				();
-	bool			isEmpty				() const {return (!this || !mData || !mLen);}
+	bool			isEmpty				() const {return (!this || !mLen);}
 	void			empty				();
 	uint			length				() const {return mLen;}
-	int				maxLength			() const {return mMaxLen;}
+	int				maxLength			() const {return (mMaxLen == STRING_ARENA_BUFFER)? mLen : mMaxLen;}
 	//void			truncate			(uint pos);
 	//void			fill				(char c, int len=-1)
 
@@ -137,11 +171,20 @@ class String : public Comparable {
 	String			arg					(double x, int fieldwidth=0, char fmt='g', int prec=-1) const {return arg (String (x, fmt, prec), fieldwidth);}
 	String			arg					(int x, int fieldwidth=0, int base=10) const {return arg (String (x, base), fieldwidth);}
 	String			arg					(long x, int fieldwidth=0, int base=10) const {return arg (String (x, base), fieldwidth);}
+	String			args				(const FormatArg* values, int count) const;
+	String&			appendFormat		(const char* sformat, const FormatArg* values, int count);
+#if __cplusplus >= 201103L
+	template <class... ARGS>
+	String			args				(const ARGS&... values) const;
+	template <class... ARGS>
+	String&			appendFormat		(const char* sformat, const ARGS&... values);
+#endif
 	//String&		sprintf				(const char* format, ...);
 
 	// Searching
 	int				find				(const String&, uint start=0) const;
 	int				find				(const char c, uint start=0) const;
+	int				find				(const SubString&, uint start=0) const;
 	int				findRev				(const String&, int start=-1) const;
 	int				regmatch			(const char* regexpr) const;
 	int				regmatch			(const char* regexpr, Array<String>& target) const;
@@ -154,6 +197,9 @@ class String : public Comparable {
 	void			upper				() const;
 	void			lower				() const;
 	void			split				(Array<String>& target, const char delim=' ') const;
+	void			split				(PackArray<String>& target, const char delim=' ') const;
+	void			split				(PackArray<SubString>& target, const char delim=' ') const;
+	void			split				(PackArray<SubString>& target, const char* delims) const;
 	void			join				(const Array<String>& source, const char delim=' ');
 	String&			dellast				(uint n);
 	void			chop				();
@@ -164,10 +210,12 @@ class String : public Comparable {
 	void			reserve				(int amount);
 	void			ensure				(int amount) {if (mMaxLen<amount) reserve (amount);}
 	void			ensure_spontane		(int amount) {if (mMaxLen<amount) reserve (amount+amount/2+4);}
-	void			grow_spontane		() {reserve (mMaxLen+mMaxLen/2+4);}
+	void			grow_spontane		() {reserve (maxLength ()+maxLength ()/2+4);}
 
 	char			checksum			();
 	int				fast_isequal		(const String& other) const;
+	int				compare				(const String& other) const;
+	virtual int		compare				(const Comparable& other) const;
 
 	// Encodings
 	String&			hexcode				(const String& other);
@@ -183,24 +231,43 @@ class String : public Comparable {
 	ostream&		operator>>			(ostream&) const;
 
 	// Conversions
-	int				toInt				() const {if (this && mData) return atoi (mData); return 0;}
-	uint			toUInt				() const {if (this && mData) return (unsigned int) atoi (mData); return 0;}
-	long			toLong				() const {if (this && mData) return atol (mData); return 0;}
-	float			toFloat				() const {if (this && mData) return atof (mData); return 0;}
-	double		toDouble			() const {if (this && mData) return atof (mData); return 0;}
-	operator	const char*		() const {return (this != NULL)? mData : (const char*) NULL;}
+	int				toInt				() const {return (int) toLong ();}
+	uint			toUInt				() const {return (uint) toLong ();}
+	long			toLong				() const;
+	float			toFloat				() const {return (float) toDouble ();}
+	double			toDouble			() const;
+	operator	const char*		() const {return (this != NULL)? chars () : (const char*) NULL;}
 	/** Returns a non-const pointer to the string buffer. Dangerous. */
-	char*			getbuffer			() const {return mData;}
+	char*			getbuffer			() const {return chars ();}
 
 	// Implementations
 	virtual String*	clone				() const;
 	virtual int		hashfunc			(int hashsize) const;
+	virtual uint	hashvalue			() const;
 
   private:
+	/** Is the string stored in the inline buffer? A heap buffer never
+	 *  has exactly the inline length reserved.
+	 **/
+	bool			isInline			() const {return mMaxLen == STRING_INLINE_LENGTH;}
+	/** Returns the characters, wherever they are stored. */
+	char*			chars				() const {return isInline ()? (char*) mInline : mData;}
+	/** Is the buffer allocated with new[]? Such buffers are always
+	 *  longer than the inline buffer.
+	 **/
+	bool			ownsBuffer			() const {return mMaxLen > STRING_INLINE_LENGTH;}
+	void			freeBuffer			() {if (ownsBuffer ()) delete [] mData;}
+	char*			allocate			(int amount);
+	void			adopt				(char* buffer, int length, int maxLength);
+	void			steal				(String& other);
+
 	int				mLen;			/**< Current length of the string. */
-	int				mMaxLen;		/**< Reserved length */
-	char*			mData;
-	unsigned char	mChkSum;		/**< Checksum calculated with the hash function. */
+	int				mMaxLen;		/**< Reserved length, STRING_INLINE_LENGTH when inline, STRING_ARENA_BUFFER in an arena. */
+	mutable uint	mHash;			/**< Cached hash value, 0 if not calculated. */
+	union {
+		char*		mData;			/**< Allocated buffer, NULL for a null string. */
+		char		mInline [STRING_INLINE_LENGTH+1];	/**< Buffer for short strings. */
+	};
 
 	friend String	MagiC::strformat	(const char* format, ...);
 };
@@ -221,6 +288,7 @@ extern const String	emptystring;
 inline bool		isempty		(const String& str) {return (!(&str) || str.isEmpty ());}
 char*			strnchr		(const char* str, int len, char c);
 char*			safedup		(const char* orig, int maxlen=-1);
+uint			hashbytes	(const char* data, int len);
 int				fgetS		(FILE* in, String& str);
 istream&		getS		(istream& in, String& str, char term='\n');
 void			loadString	(String& str, const String& filename);
@@ -245,13 +313,208 @@ String			vstrformat	(const char* format, va_list ap);
 //                                                        __/                //
 ///////////////////////////////////////////////////////////////////////////////
 
-// Virtual substring of a string.
-class SubString : public String {
-	String*		str;
-	int			start, end;
+/** Non-owning view of a part of a character buffer.
+ *
+ *  A SubString does not copy or own the characters it refers to, so
+ *  the buffer must outlive it. The characters are not terminated with
+ *  a zero; use @ref toString() to get a String copy.
+ **/
+class SubString {
   public:
+					SubString			() : mData (NULL), mLen (0) {}
+					SubString			(const char* data, uint len) : mData (data), mLen (len) {}
+					SubString			(const String& str) : mData (str), mLen (str.length()) {}
+
+	const char*		data				() const {return mData;}
+	uint			length				() const {return mLen;}
+	bool			isEmpty				() const {return !mLen;}
+	char			operator[]			(int n) const {return mData[n];}
+	bool			operator==			(const char* str) const;
+	bool			operator==			(const SubString& other) const;
+	bool			operator!=			(const char* str) const {return !operator== (str);}
+	bool			operator!=			(const SubString& other) const {return !operator== (other);}
+
+	/** Compares the bytes of the views. A view that is the beginning
+	 *  of the other is the smaller one.
+	 *
+	 *  @return Negative, zero or positive, as with strcmp.
+	 **/
+	int				compare				(const SubString& other) const {
+		uint len = (mLen < other.mLen)? mLen : other.mLen;
+		int result = len? memcmp (mData, other.mData, len) : 0;
+		return result? result : (mLen < other.mLen)? -1 : (mLen > other.mLen);
+	}
+	bool			startsWith			(const SubString& prefix) const {return mLen >= prefix.mLen && (!prefix.mLen || !memcmp (mData, prefix.mData, prefix.mLen));}
+
+	// Searching
+	int				find				(char c, uint start=0) const;
+	int				find				(const SubString& subs, uint start=0) const;
+	int				findRev				(const SubString& subs, int start=-1) const;
+	int				regmatch			(RegExp& compiled) const;
+	int				regmatch			(RegExp& compiled, PackArray<SubString>& target) const;
+
+	// Views
+	SubString		mid					(uint start, int len=-1) const;
+	SubString		left				(uint n) const {return SubString (mData, (n<mLen)? n : mLen);}
+	SubString		right				(uint n) const {return (n<mLen)? SubString (mData+mLen-n, n) : *this;}
+	SubString		stripWhiteSpace		() const;
+	void			split				(PackArray<SubString>& target, const char delim=' ') const;
+	void			split				(PackArray<SubString>& target, const char* delims) const;
+
+	// Conversions
+	int				toInt				() const {return (int) toLong ();}
+	long			toLong				() const;
+	double			toDouble			() const;
+	String			toString			() const {return String (mData, mLen);}
+	uint			hashvalue			() const;
+
+  private:
+	const char*		mData;
+	uint			mLen;
 };
 
+/** Compares the strings byte by byte, without virtual dispatch.
+ *
+ *  @return Negative, zero or positive, as with strcmp.
+ **/
+inline int String::compare (const String& other) const {
+	return SubString (*this).compare (other);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Type-safe formatting
+///////////////////////////////////////////////////////////////////////////////
+
+/** An argument for the type-safe formatting functions.
+ *
+ *  The argument records the type of the value it was created from,
+ *  so the format needs not tell it and cannot tell it wrong. Strings
+ *  are referred to, not copied, so a FormatArg must not outlive the
+ *  value it was created from; the variadic templates only keep them
+ *  for the duration of the call.
+ **/
+class FormatArg {
+  public:
+	enum argtype {ARG_NONE=0, ARG_INT, ARG_UINT, ARG_DOUBLE, ARG_CHAR, ARG_STRING, ARG_POINTER};
+
+					FormatArg		() : mType (ARG_NONE), mSize (0) {}
+					FormatArg		(bool x) : mType (ARG_INT), mSize (sizeof (int)) {mValue.i = x;}
+					FormatArg		(char x) : mType (ARG_CHAR), mSize (1) {mValue.c = x;}
+					FormatArg		(signed char x) : mType (ARG_INT), mSize (1) {mValue.i = x;}
+					FormatArg		(unsigned char x) : mType (ARG_UINT), mSize (1) {mValue.u = x;}
+					FormatArg		(short x) : mType (ARG_INT), mSize (sizeof (x)) {mValue.i = x;}
+					FormatArg		(unsigned short x) : mType (ARG_UINT), mSize (sizeof (x)) {mValue.u = x;}
+					FormatArg		(int x) : mType (ARG_INT), mSize (sizeof (x)) {mValue.i = x;}
+					FormatArg		(unsigned int x) : mType (ARG_UINT), mSize (sizeof (x)) {mValue.u = x;}
+					FormatArg		(long x) : mType (ARG_INT), mSize (sizeof (x)) {mValue.i = x;}
+					FormatArg		(unsigned long x) : mType (ARG_UINT), mSize (sizeof (x)) {mValue.u = x;}
+					FormatArg		(long long x) : mType (ARG_INT), mSize (sizeof (x)) {mValue.i = x;}
+					FormatArg		(unsigned long long x) : mType (ARG_UINT), mSize (sizeof (x)) {mValue.u = x;}
+					FormatArg		(float x) : mType (ARG_DOUBLE), mSize (sizeof (x)) {mValue.d = x;}
+					FormatArg		(double x) : mType (ARG_DOUBLE), mSize (sizeof (x)) {mValue.d = x;}
+					FormatArg		(long double x) : mType (ARG_DOUBLE), mSize (sizeof (double)) {mValue.d = x;}
+					FormatArg		(const char* x) : mType (ARG_STRING), mSize (0) {mValue.s.data = x; mValue.s.len = x? strlen (x) : 0;}
+					FormatArg		(const String& x) : mType (ARG_STRING), mSize (0) {mValue.s.data = x; mValue.s.len = x.length ();}
+					FormatArg		(const SubString& x) : mType (ARG_STRING), mSize (0) {mValue.s.data = x.data (); mValue.s.len = x.length ();}
+					FormatArg		(const void* x) : mType (ARG_POINTER), mSize (sizeof (x)) {mValue.p = x;}
+
+	argtype			type			() const {return mType;}
+	long long		toLongLong		() const;
+	unsigned long long toULongLong	() const;
+	double			toDouble		() const;
+	SubString		toSubString		() const {return SubString (mValue.s.data, mValue.s.len);}
+	const void*		toPointer		() const {return mValue.p;}
+	char			toChar			() const {return (mType == ARG_CHAR)? mValue.c : (char) toLongLong ();}
+	uint			estimateLength	() const {return (mType == ARG_STRING)? mValue.s.len : 24;}
+
+  private:
+	argtype		mType;		/**< Type of the value. */
+	int			mSize;		/**< Size of the original integer type, for unsigned conversions of negative values. */
+	union {
+		long long			i;
+		unsigned long long	u;
+		double				d;
+		char				c;
+		const void*			p;
+		struct {
+			const char*	data;
+			uint		len;
+		} s;
+	} mValue;
+};
+
+/** Destination of the formatting functions: a String, a stream or
+ *  anything else that can take blocks of characters.
+ **/
+class FormatTarget {
+  public:
+	virtual			~FormatTarget	() {}
+
+	/** Called once before the output with an estimate of its length. */
+	virtual void	expect			(uint) {}
+	virtual void	write			(const char* data, uint len) = 0;
+};
+
+/** Formatting target that appends to a String. */
+class StringFormatTarget : public FormatTarget {
+  public:
+					StringFormatTarget	(String& target) : mTarget (target) {}
+
+	virtual void	expect			(uint len) {mTarget.ensure (mTarget.length () + len);}
+	virtual void	write			(const char* data, uint len) {mTarget.append (data, len);}
+
+  private:
+	String&		mTarget;
+};
+
+void			formatArgs		(FormatTarget& target, const char* sformat, const FormatArg* args, int count);
+void			substituteArgs	(FormatTarget& target, const SubString& pattern, const FormatArg* args, int count);
+
+#if __cplusplus >= 201103L
+/** Prints to a string with printf-style formatting, but type-safely:
+ *  the types of the arguments are known, so the conversions only
+ *  choose how to show them, and size modifiers such as "l" are not
+ *  needed. For example, "%d" of a String prints the string.
+ *
+ *  Formats with no arguments go to the C-style variadic version.
+ **/
+template <class... ARGS>
+String strformat (const char* sformat, const ARGS&... args)
+{
+	const FormatArg list[] = {FormatArg (args)..., FormatArg ()};
+	String result;
+	StringFormatTarget target (result);
+	formatArgs (target, sformat, list, sizeof... (ARGS));
+	return result;
+}
+
+/** Replaces the %n placeholders of the string with the given values
+ *  in one pass; see @ref args(const FormatArg*,int) const.
+ **/
+template <class... ARGS>
+String String::args (const ARGS&... values) const
+{
+	const FormatArg list[] = {FormatArg (values)..., FormatArg ()};
+	String result;
+	StringFormatTarget target (result);
+	substituteArgs (target, *this, list, sizeof... (ARGS));
+	return result;
+}
+
+/** Appends printf-style formatted text to the string, type-safely
+ *  like @ref strformat. Nothing is allocated when the string has
+ *  enough capacity reserved.
+ **/
+template <class... ARGS>
+String& String::appendFormat (const char* sformat, const ARGS&... values)
+{
+	const FormatArg list[] = {FormatArg (values)..., FormatArg ()};
+	StringFormatTarget target (*this);
+	formatArgs (target, sformat, list, sizeof... (ARGS));
+	return *this;
+}
+#endif
+
 END_NAMESPACE;
 
 #include "magic/mi18n.h"
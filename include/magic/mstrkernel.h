@@ -0,0 +1,94 @@
+/***************************************************************************
+ *   This file is part of the MagiC++ library.                             *
+ *                                                                         *
+ *   Copyright (C) 1998-2005 Marko Grnroos <magi@iki.fi>                  *
+ *                                                                         *
+ ***************************************************************************
+ *                                                                         *
+ *  This library is free software; you can redistribute it and/or          *
+ *  modify it under the terms of the GNU Library General Public            *
+ *  License as published by the Free Software Foundation; either           *
+ *  version 2 of the License, or (at your option) any later version.       *
+ *                                                                         *
+ *  This library is distributed in the hope that it will be useful,        *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU      *
+ *  Library General Public License for more details.                       *
+ *                                                                         *
+ *  You should have received a copy of the GNU Library General Public      *
+ *  License along with this library; see the file COPYING.LIB.  If         *
+ *  not, write to the Free Software Foundation, Inc., 59 Temple Place      *
+ *  - Suite 330, Boston, MA 02111-1307, USA.                               *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef __MAGIC_MSTRKERNEL_H__
+#define __MAGIC_MSTRKERNEL_H__
+
+#include "magic/mtypes.h"
+#include "magic/mmagisupp.h"
+
+BEGIN_NAMESPACE (MagiC);
+
+/** Instruction sets of the string kernels, for @ref stringKernels(int). */
+enum strkernelset {STRKERNEL_SCALAR=0, STRKERNEL_SSE2=1, STRKERNEL_AVX2=2, STRKERNEL_SETS=3};
+
+/*******************************************************************************
+ * Scanning kernels for character data, used by @ref String and
+ * @ref SubString.
+ *
+ * There is one table of kernels for each instruction set; @ref
+ * stringKernels() gives the fastest one the processor supports. All
+ * the sets give exactly the same results. None of the kernels needs
+ * the data to be zero-terminated or aligned, and none reads beyond
+ * the given length.
+ *
+ * Whitespace means the characters of the C locale: space, tab,
+ * newline, vertical tab, form feed and carriage return. Case folding
+ * vectorizes plain ASCII and leaves the other characters to
+ * toupper() and tolower(), so they follow the locale as before.
+ ******************************************************************************/
+struct StringKernels {
+	/** Name of the instruction set. */
+	const char*	name;
+
+	/** Returns the first occurrence of the needle in the data, or
+	 *  NULL if none. An empty needle is found at the beginning.
+	 **/
+	const char*	(*find)			(const char* data, uint len, const char* needle, uint nlen);
+
+	/** Returns the last occurrence of the needle in the data, or NULL
+	 *  if none. An empty needle is found at the end.
+	 **/
+	const char*	(*findRev)		(const char* data, uint len, const char* needle, uint nlen);
+
+	/** Returns the first character that is any of the nset
+	 *  characters in the set, or NULL if none.
+	 **/
+	const char*	(*findAny)		(const char* data, uint len, const char* set, uint nset);
+
+	/** Returns the first whitespace character, or data+len if none. */
+	const char*	(*findSpace)	(const char* data, uint len);
+
+	/** Returns the first non-whitespace character, or data+len if none. */
+	const char*	(*skipSpace)	(const char* data, uint len);
+
+	/** Returns the length of the data without its trailing whitespace. */
+	uint		(*trimSpace)	(const char* data, uint len);
+
+	/** Converts the characters to upper case in place. */
+	void		(*upper)		(char* data, uint len);
+
+	/** Converts the characters to lower case in place. */
+	void		(*lower)		(char* data, uint len);
+};
+
+const StringKernels&	stringKernels	();
+const StringKernels*	stringKernels	(int set);
+
+/** Is the character whitespace in the C locale? */
+inline bool isWhiteSpace (char c) {return c == ' ' || (unsigned char) (c - '\t') <= '\r' - '\t';}
+
+END_NAMESPACE;
+
+#endif
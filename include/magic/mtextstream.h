@@ -103,6 +103,15 @@ class TextOStream : public OStream, public TextStream {
 	// Virtual methods
 	
 	virtual TextOStream&	printf			(const char* format, ...);
+#if __cplusplus >= 201103L
+	template <class... ARGS>
+	TextOStream&			printf			(const char* sformat, const ARGS&... args) {
+		OStream::printf (sformat, args...);
+		if (isAutoFlush () && mpDevice)
+			mpDevice->flush ();
+		return *this;
+	}
+#endif
 	virtual TextOStream&	operator<<		(const char* str);
 	virtual TextOStream&	operator<<		(const String& str);
 	virtual TextOStream&	operator<<		(const char);
@@ -31,16 +31,138 @@
 #define _XOPEN_SOURCE 600
 
 #include <pthread.h>
+#include <time.h>
 
 BEGIN_NAMESPACE (MagiC);
 
 typedef int ThdResult;
 
+/*******************************************************************************
+ * Mutual exclusion lock.
+ *
+ * Implemented directly with Linux futexes: locking and unlocking an
+ * uncontended mutex is a single atomic operation. A contended lock is
+ * first spun on for a while, adaptively to how long the spinning has
+ * recently taken to succeed, before the thread parks in the kernel.
+ * No spinning is done on single-processor systems.
+ *
+ * The mutex is not recursive. Use @ref MutexLocker to lock it for
+ * the duration of a scope.
+ ******************************************************************************/
+class Mutex {
+  public:
+					Mutex		() : mState (0), mSpins (0) {}
+
+	void			lock		();
+	bool			tryLock		();
+	void			unlock		();
+
+  private:
+	void			lockContended	();
+
+	friend class ConditionVariable;
+
+	int				mState;		/**< 0 unlocked, 1 locked, 2 locked with waiters. */
+	int				mSpins;		/**< Recent spin count needed to acquire.        */
+
+					Mutex		(const Mutex& other);
+	void			operator=	(const Mutex& other);
+};
+
+/*******************************************************************************
+ * Locks a @ref Mutex for the lifetime of the locker object.
+ *
+ * \code
+ * {
+ *     MutexLocker locker (mMutex);
+ *     ...
+ * } // Unlocked here, also if an exception is thrown.
+ * \endcode
+ ******************************************************************************/
+class MutexLocker {
+  public:
+					MutexLocker		(Mutex& mutex) : mrMutex (mutex) {mrMutex.lock ();}
+					~MutexLocker	() {mrMutex.unlock ();}
+
+  private:
+	Mutex&			mrMutex;
+
+					MutexLocker	(const MutexLocker& other);
+	void			operator=	(const MutexLocker& other);
+};
+
+/*******************************************************************************
+ * Condition variable for waiting on a predicate guarded by a @ref
+ * Mutex.
+ *
+ * The caller locks the mutex, checks the predicate and waits while it
+ * does not hold. The mutex is released while waiting and locked again
+ * before the wait returns, so a signal given under the mutex after
+ * changing the predicate can not be lost. Waits may also return
+ * spuriously, so the predicate must be checked in a loop:
+ *
+ * \code
+ * MutexLocker locker (mMutex);
+ * while (mQueue.isEmpty ())
+ *     mNotEmpty.wait (mMutex);
+ * \endcode
+ *
+ * Timeouts are measured with CLOCK_MONOTONIC, so changing the system
+ * time does not affect them.
+ ******************************************************************************/
+class ConditionVariable {
+  public:
+					ConditionVariable	() : mSequence (0) {}
+
+	ThdResult		wait		(Mutex& mutex, double seconds=0.0);
+	ThdResult		waitUntil	(Mutex& mutex, const struct timespec& deadline);
+	void			signal		();
+	void			broadcast	();
+
+	static struct timespec deadline	(double seconds);
+
+  private:
+	ThdResult		waitFor		(Mutex& mutex, const struct timespec* pDeadline);
+
+	int				mSequence;	/**< Incremented by each signal. */
+
+					ConditionVariable	(const ConditionVariable& other);
+	void			operator=			(const ConditionVariable& other);
+};
+
+/*******************************************************************************
+ * Counting semaphore.
+ *
+ * @ref post() increments the count and @ref wait() decrements it,
+ * waiting while it is zero. Neither makes a system call unless a
+ * thread has to wait.
+ ******************************************************************************/
+class Semaphore {
+  public:
+					Semaphore	(int value=0) : mValue (value), mWaiters (0) {}
+
+	void			post		();
+	ThdResult		wait		(double seconds=0.0);
+	bool			tryWait		();
+	int				value		() const {return __atomic_load_n (&mValue, __ATOMIC_RELAXED);}
+
+  private:
+	int				mValue;		/**< Current count.                 */
+	int				mWaiters;	/**< Number of threads in wait().   */
+
+					Semaphore	(const Semaphore& other);
+	void			operator=	(const Semaphore& other);
+};
+
 /*******************************************************************************
  * Thread lock
  *
- * This is a trivial thread lock wrapper. Also condition variables are
- * supported.
+ * This is a trivial recursive thread lock wrapper. Also condition
+ * variables are supported.
+ *
+ * As @ref wait() locks and unlocks the lock itself, a predicate can
+ * not be checked under the same lock. New code should use @ref
+ * Mutex and @ref ConditionVariable instead.
  ******************************************************************************/
 class ThreadLock {
   public:
@@ -55,11 +177,8 @@ class ThreadLock {
 	ThdResult	broadcast	();
 	
   private:
-	void	initCond	();
-	
 	pthread_mutex_t	mThreadLock; /**< Thread lock (mutex)                        */
 	pthread_cond_t	mThreadCond; /**< Conditional variable for signalling.       */
-	bool            mCondInited; /**< Has condition been initialized?            */
 };
 
 /*******************************************************************************
@@ -22,39 +22,77 @@
  *                                                                         *
  ***************************************************************************/
 
-#ifndef __MAGICSERVER_MSRVWORKER_H__
-#define __MAGICSERVER_MSRVWORKER_H__
+#ifndef __MAGIC_MWORKERTHREAD_H__
+#define __MAGIC_MWORKERTHREAD_H__
 
-#include <magicserver/msrvdef.h>
-#include <magicserver/msrvthread.h>
-#include <magicserver/msrvserver.h>
-#include <magicserver/msrvrequest.h>
-#include <magicserver/msrvcontainer.h>
+#include <magic/mthread.h>
+#include <magic/mlog.h>
+#include <magic/mworkqueue.h>
 
-begin_namespace (MSrv);
+BEGIN_NAMESPACE (MagiC);
 
 class Worker;
 
+/*******************************************************************************
+ * Request processed by a @ref WorkerPool.
+ *
+ * Inherit to carry the data of the request.
+ ******************************************************************************/
+class Request {
+  public:
+	virtual				~Request		() {}
+};
+
+/*******************************************************************************
+ * Processes the requests dispensed by a @ref WorkerPool.
+ *
+ * The worker threads call the handler concurrently. The handler is
+ * responsible for destroying the requests.
+ ******************************************************************************/
+class RequestHandler {
+  public:
+	virtual				~RequestHandler	() {}
+
+	virtual void		process			(Request* pRequest) = 0;
+};
+
 /*******************************************************************************
  * Request dispenser that passes requests to @ref Worker threads to handle.
  *
  * Maintains a pool of @ref Worker objects that each sit in their own
  * thread, waiting for requests to process.
+ *
+ * Requests from other threads go to a bounded lock-free injection
+ * queue, from which the workers take them in batches into their own
+ * work-stealing deques. Requests given by a worker itself go directly
+ * to its own deque. Idle workers steal from the deques of the others
+ * before they park.
  ******************************************************************************/
 class WorkerPool {
   public:
-						WorkerPool		(RequestHandler& handler, Log& log, int size=10);
+						WorkerPool		(RequestHandler& handler, Log& log, int size=10, int queueSize=4096);
 	virtual				~WorkerPool		();
 
-	virtual MSrvResult	process		 	(Request* pRequest);
+	virtual ThdResult	process		 	(Request* pRequest);
+	ThdResult			tryProcess		(Request* pRequest);
+	ThdResult			shutdown		(Request* pFinal=NULL);
+
+	bool				isShutdown		() const {return __atomic_load_n (&mIsShutdown, __ATOMIC_ACQUIRE);}
 
-	bool				isShutdown		() const {return mIsShutdown;}
+	// Statistics
+	int					size			() const {return mWorkerCount;}
+	int					queueDepth		() const;
+	long				stealCount		() const;
+	long				processedCount	() const;
+	double				utilization		(int worker) const;
 
   private:
-	MSrvResult			shutdown		(Request* pRequest);
+	bool				enqueue			(Request* pRequest);
+	bool				hasWork			() const;
+	bool				park			();
+	void				wakeWorker		();
+	void				wakeProducers	();
 	RequestHandler&		handler			() {return *mrpHandler;}
-	ThreadLock&			getWaitLock		() {return mQueueWaitLock;}
-	Queue<Request>&		queue			() {return mRequestQueue;}
 
 	friend class Worker;
 
@@ -62,10 +100,14 @@ class WorkerPool {
 	RequestHandler*		mrpHandler;     /**< Handler of worker requests.         */
 	Worker**			mpWorkers;      /**< Pool of workers.                    */
 	int      			mWorkerCount;   /**< Number of workers in the pool.      */
-	Queue<Object>		mRequestQueue;  /**< Requests dispensed to workers.      */
-	ThreadLock          mQueueLock;     /**< For locking the request queue.      */
-	ThreadLock			mQueueWaitLock; /**< Lock for waiting the queue.         */
+	BoundedQueue<Request> mRequestQueue; /**< Requests from outside the pool.    */
+	Mutex				mSleepLock;     /**< Guards parking of the threads.      */
+	ConditionVariable	mWorkCond;      /**< Signals parked workers of work.     */
+	ConditionVariable	mSpaceCond;     /**< Signals producers of queue space.   */
+	int					mSleepers;      /**< Number of parked workers.           */
+	int					mBlockedProducers; /**< Producers waiting for space.     */
 	bool                mIsShutdown;    /**< Is the worker pool being shut down? */
+	long				mStartTime;     /**< Creation time, in nanoseconds.      */
 	Log&				mrLog;
 };
 
@@ -77,17 +119,27 @@ class WorkerPool {
  ******************************************************************************/
 class Worker : public Thread {
   public:
-					Worker (WorkerPool* pool);
+					Worker (WorkerPool* pool, int index);
 
 	virtual void*	execute		();
 
   private:
-	static void*	startThread	(void* pParam);
-
-	WorkerPool*		mpPool; /**< Owner pool. */
+	Request*		findWork	();
+	Request*		steal		();
+	void			setBusy		(bool busy);
+
+	friend class WorkerPool;
+
+	WorkerPool*		mpPool;     /**< Owner pool.                            */
+	int				mIndex;     /**< Index of the worker in the pool.       */
+	StealingDeque<Request> mDeque; /**< Requests taken by this worker.     */
+	unsigned int	mRandom;    /**< State for choosing steal victims.      */
+	long			mProcessed; /**< Number of requests processed.          */
+	long			mSteals;    /**< Number of requests stolen from others. */
+	long			mBusyTime;  /**< Total busy time, in nanoseconds.       */
+	long			mBusySince; /**< Start of the busy period, or 0 if idle. */
 };
 
-end_namespace (MSrv);
+END_NAMESPACE;
 
 #endif
-
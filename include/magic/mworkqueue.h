@@ -0,0 +1,283 @@
+/***************************************************************************
+ *   This file is part of the MagiC++ library.                             *
+ *                                                                         *
+ *   Copyright (C) 1998-2005 Marko Grnroos <magi@iki.fi>                  *
+ *                                                                         *
+ ***************************************************************************
+ *                                                                         *
+ *  This library is free software; you can redistribute it and/or          *
+ *  modify it under the terms of the GNU Library General Public            *
+ *  License as published by the Free Software Foundation; either           *
+ *  version 2 of the License, or (at your option) any later version.       *
+ *                                                                         *
+ *  This library is distributed in the hope that it will be useful,        *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU      *
+ *  Library General Public License for more details.                       *
+ *                                                                         *
+ *  You should have received a copy of the GNU Library General Public      *
+ *  License along with this library; see the file COPYING.LIB.  If         *
+ *  not, write to the Free Software Foundation, Inc., 59 Temple Place      *
+ *  - Suite 330, Boston, MA 02111-1307, USA.                               *
+ *                                                                         *
+ ***************************************************************************/
+
+#ifndef __MAGIC_MWORKQUEUE_H__
+#define __MAGIC_MWORKQUEUE_H__
+
+#include <magic/mobject.h>
+#include <magic/mexception.h>
+
+BEGIN_NAMESPACE (MagiC);
+
+/** Size of a cache line, for keeping the indices written by different
+ *  threads apart.
+ **/
+#define CACHE_LINE_SIZE 64
+
+/*******************************************************************************
+ * Bounded lock-free queue for many producers and many consumers.
+ *
+ * The queue is a ring of cells, each with a sequence number that
+ * tells whether the cell is ready to be written or read on the
+ * current round of the ring. Producers and consumers claim positions
+ * with compare-and-swap, so no thread ever blocks another.
+ *
+ * The queue holds pointers, but does not own the items.
+ ******************************************************************************/
+template <class TYPE>
+class BoundedQueue {
+  public:
+	/** Creates a queue for at least the given number of items. The
+	 *  capacity is rounded up to a power of two.
+	 **/
+	BoundedQueue (int capacity=1024) {
+		mCapacity = 2;
+		while (mCapacity < capacity)
+			mCapacity *= 2;
+		mCells = new Cell [mCapacity];
+		for (int i=0; i<mCapacity; i++) {
+			mCells[i].sequence = i;
+			mCells[i].item = NULL;
+		}
+		mHead = mTail = 0;
+	}
+
+	~BoundedQueue () {
+		delete [] mCells;
+	}
+
+	/** Adds the item to the queue.
+	 *
+	 *  @return false if the queue is full.
+	 **/
+	bool push (TYPE* item) {
+		unsigned long pos = __atomic_load_n (&mTail, __ATOMIC_RELAXED);
+		while (true) {
+			Cell& cell = mCells[pos & (mCapacity-1)];
+			long diff = long (__atomic_load_n (&cell.sequence, __ATOMIC_ACQUIRE) - pos);
+			if (diff == 0) {
+				if (__atomic_compare_exchange_n (&mTail, &pos, pos+1, true,
+												 __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+					cell.item = item;
+					__atomic_store_n (&cell.sequence, pos+1, __ATOMIC_RELEASE);
+					return true;
+				}
+			} else if (diff < 0)
+				return false; // A whole round behind: full
+			else
+				pos = __atomic_load_n (&mTail, __ATOMIC_RELAXED);
+		}
+	}
+
+	/** Takes the oldest item from the queue.
+	 *
+	 *  @return The item, or NULL if the queue is empty.
+	 **/
+	TYPE* pull () {
+		TYPE* item;
+		return pull (&item, 1)? item : NULL;
+	}
+
+	/** Takes at most the given number of the oldest items from the
+	 *  queue at once. The items are claimed with one compare-and-swap.
+	 *
+	 *  @return Number of items taken.
+	 **/
+	int pull (TYPE** items, int max) {
+		unsigned long pos = __atomic_load_n (&mHead, __ATOMIC_RELAXED);
+		int count;
+		while (true) {
+			// Count the items that are ready after the position
+			for (count=0; count<max; count++) {
+				Cell& cell = mCells[(pos+count) & (mCapacity-1)];
+				if (__atomic_load_n (&cell.sequence, __ATOMIC_ACQUIRE) != pos+count+1)
+					break;
+			}
+			if (count == 0) {
+				unsigned long now = __atomic_load_n (&mHead, __ATOMIC_RELAXED);
+				if (now == pos)
+					return 0; // Empty
+				pos = now;
+				continue;
+			}
+			if (__atomic_compare_exchange_n (&mHead, &pos, pos+count, true,
+											 __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		}
+
+		// The claimed cells can not change before they are released
+		for (int i=0; i<count; i++) {
+			Cell& cell = mCells[(pos+i) & (mCapacity-1)];
+			items[i] = cell.item;
+			__atomic_store_n (&cell.sequence, pos+i+mCapacity, __ATOMIC_RELEASE);
+		}
+		return count;
+	}
+
+	/** Returns the number of items in the queue. Only approximate, if
+	 *  other threads are using the queue.
+	 **/
+	int size () const {
+		long size = long (__atomic_load_n (&mTail, __ATOMIC_ACQUIRE) -
+						  __atomic_load_n (&mHead, __ATOMIC_ACQUIRE));
+		return size<0? 0 : (size>mCapacity? mCapacity : int (size));
+	}
+
+	/** Returns true if the queue is empty. Only approximate, like
+	 *  @ref size().
+	 **/
+	bool isEmpty () const {return size() == 0;}
+
+	int capacity () const {return mCapacity;}
+
+  private:
+	struct Cell {
+		unsigned long	sequence;	/**< Position that may next use the cell. */
+		TYPE*			item;
+	};
+
+	Cell*			mCells;
+	int				mCapacity;
+	char			mPad0 [CACHE_LINE_SIZE];
+	unsigned long	mHead;			/**< Next position to read. */
+	char			mPad1 [CACHE_LINE_SIZE];
+	unsigned long	mTail;			/**< Next position to write. */
+	char			mPad2 [CACHE_LINE_SIZE];
+
+				BoundedQueue	(const BoundedQueue& other) {FORBIDDEN}
+};
+
+/*******************************************************************************
+ * Work-stealing deque.
+ *
+ * The owner thread pushes and pops items at the bottom end without
+ * locking, while other threads steal the oldest items from the top
+ * end with compare-and-swap. The capacity is fixed; the owner must
+ * put the items elsewhere when @ref push() fails.
+ *
+ * The deque holds pointers, but does not own the items.
+ ******************************************************************************/
+template <class TYPE>
+class StealingDeque {
+  public:
+	/** Creates a deque for at least the given number of items. The
+	 *  capacity is rounded up to a power of two.
+	 **/
+	StealingDeque (int capacity=1024) {
+		mCapacity = 2;
+		while (mCapacity < capacity)
+			mCapacity *= 2;
+		mItems = new TYPE* [mCapacity];
+		mTop = mBottom = 0;
+	}
+
+	~StealingDeque () {
+		delete [] mItems;
+	}
+
+	/** Adds an item at the bottom. Only for the owner thread.
+	 *
+	 *  @return false if the deque is full.
+	 **/
+	bool push (TYPE* item) {
+		long bottom = __atomic_load_n (&mBottom, __ATOMIC_RELAXED);
+		long top = __atomic_load_n (&mTop, __ATOMIC_ACQUIRE);
+		if (bottom - top >= mCapacity)
+			return false;
+		__atomic_store_n (&mItems[bottom & (mCapacity-1)], item, __ATOMIC_RELAXED);
+		__atomic_store_n (&mBottom, bottom+1, __ATOMIC_RELEASE);
+		return true;
+	}
+
+	/** Takes the newest item from the bottom. Only for the owner
+	 *  thread.
+	 *
+	 *  @return The item, or NULL if the deque is empty.
+	 **/
+	TYPE* pop () {
+		long bottom = __atomic_load_n (&mBottom, __ATOMIC_RELAXED) - 1;
+		__atomic_store_n (&mBottom, bottom, __ATOMIC_RELAXED);
+		__atomic_thread_fence (__ATOMIC_SEQ_CST);
+		long top = __atomic_load_n (&mTop, __ATOMIC_RELAXED);
+
+		if (top > bottom) {
+			// Empty
+			__atomic_store_n (&mBottom, bottom+1, __ATOMIC_RELAXED);
+			return NULL;
+		}
+
+		TYPE* item = __atomic_load_n (&mItems[bottom & (mCapacity-1)], __ATOMIC_RELAXED);
+		if (top == bottom) {
+			// The last item; race against the thieves for it
+			if (!__atomic_compare_exchange_n (&mTop, &top, top+1, false,
+											  __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+				item = NULL;
+			__atomic_store_n (&mBottom, bottom+1, __ATOMIC_RELAXED);
+		}
+		return item;
+	}
+
+	/** Takes the oldest item from the top. For any thread.
+	 *
+	 *  @return The item, or NULL if the deque is empty or another
+	 *  thread took the item first.
+	 **/
+	TYPE* steal () {
+		long top = __atomic_load_n (&mTop, __ATOMIC_ACQUIRE);
+		__atomic_thread_fence (__ATOMIC_SEQ_CST);
+		long bottom = __atomic_load_n (&mBottom, __ATOMIC_ACQUIRE);
+		if (top >= bottom)
+			return NULL;
+
+		TYPE* item = __atomic_load_n (&mItems[top & (mCapacity-1)], __ATOMIC_RELAXED);
+		if (!__atomic_compare_exchange_n (&mTop, &top, top+1, false,
+										  __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+			return NULL;
+		return item;
+	}
+
+	/** Returns the number of items. Only approximate, if other threads
+	 *  are using the deque.
+	 **/
+	int size () const {
+		long size = __atomic_load_n (&mBottom, __ATOMIC_ACQUIRE) -
+			__atomic_load_n (&mTop, __ATOMIC_ACQUIRE);
+		return size<0? 0 : int (size);
+	}
+
+  private:
+	TYPE**	mItems;
+	long	mCapacity;
+	char	mPad0 [CACHE_LINE_SIZE];
+	long	mTop;		/**< Next item to steal. */
+	char	mPad1 [CACHE_LINE_SIZE];
+	long	mBottom;	/**< Next free slot of the owner. */
+	char	mPad2 [CACHE_LINE_SIZE];
+
+				StealingDeque	(const StealingDeque& other) {FORBIDDEN}
+};
+
+END_NAMESPACE;
+
+#endif
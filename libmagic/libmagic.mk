@@ -49,7 +49,16 @@ sources = mstream.cc mtextstream.cc mdatastream.cc mmath.cc \
 	mregexp.cc mattribute.cc mstring.cc mmap.cc \
 	mmatrix.cc miodevice.cc mclass.cc mdatetime.cc mhtml.cc mobject.cc \
 	mgobject.cc mgdev-eps.cc mturtle.cc mlsystem.cc mthread.cc \
-	mlog.cc
+	mlog.cc mworkerthread.cc mbufferedfile.cc mmapfile.cc \
+	mstrkernel.cc mnumconv.cc marena.cc msocket.cc \
+	mnotifier.cc masyncio.cc
+
+# Compressing devices, if configure found zlib or libzstd. Programs
+# linked with libmagic.a then need -lz or -lzstd, which configure adds
+# to EXTRA_LIBS.
+ifneq ($(HAVE_ZLIB)$(HAVE_ZSTD),)
+sources += mcompress.cc
+endif
 
 shared_headers = mclass.h mstream.h mtextstream.h \
 	mdatastream.h mdebug.h mlist.h mobject.h mset.h mmath.h \
@@ -58,7 +67,10 @@ shared_headers = mclass.h mstream.h mtextstream.h \
 	mattribute.h mdatetime.h miterator.h mmap.h mrefarray.h mconfig.h \
 	mparameter.h mgobject.h mgdev-eps.h mexception.h mtypes.h \
 	miodevice.h mi18n.h mturtle.h mlsystem.h mthread.h merrors.h \
-	mlog.h mgraph.h
+	mlog.h mgraph.h mworkqueue.h mworkerthread.h mbufferedfile.h \
+	mmapfile.h mstrkernel.h mnumconv.h marena.h morderedmap.h \
+	malgorithm.h mparallelsort.h msocket.h mnotifier.h \
+	masyncio.h mcompress.h
 
 headersubdir = magic
 
@@ -79,7 +91,7 @@ headersubdir = magic
 ################################################################################
 # Recursively compile some subprojects
 ################################################################################
-makemodules = libapp test
+makemodules = libapp test mlogdump
 # extras
 
 ################################################################################
@@ -0,0 +1,54 @@
+/***************************************************************************
+ *   This file is part of the MagiC++ library.                             *
+ *                                                                         *
+ *   Copyright (C) 1998-2005 Marko Grnroos <magi@iki.fi>                  *
+ *                                                                         *
+ ***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include <magic/mlog.h>
+
+using namespace MagiC;
+
+/*******************************************************************************
+ * Renders a binary log written by BinaryLog as text lines.
+ *
+ * \code mlogdump [file] \endcode
+ *
+ * Reads the standard input if no file, or "-", is given.
+ ******************************************************************************/
+int main (int argc, char** argv)
+{
+	if (argc > 2 || (argc == 2 && (!strcmp (argv[1], "-h") || !strcmp (argv[1], "--help")))) {
+		fprintf (stderr, "Usage: mlogdump [file]\n"
+				 "Writes the records of a binary log as text to the standard output.\n");
+		return 2;
+	}
+
+	const char* filename = (argc == 2)? argv[1] : "-";
+	FILE* in = strcmp (filename, "-")? fopen (filename, "rb") : stdin;
+	if (!in) {
+		fprintf (stderr, "mlogdump: Can not open %s: %s\n", filename, strerror (errno));
+		return 1;
+	}
+
+	int result = BinaryLog::decode (in, stdout);
+	if (in != stdin)
+		fclose (in);
+	if (result) {
+		fflush (stdout);
+		fprintf (stderr, "mlogdump: %s is damaged or ends in the middle of a record.\n", filename);
+		return 1;
+	}
+	return 0;
+}
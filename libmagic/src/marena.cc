@@ -0,0 +1,363 @@
+/***************************************************************************
+ *   This file is part of the MagiC++ library.                             *
+ *                                                                         *
+ *   Copyright (C) 1998-2005 Marko Grnroos <magi@iki.fi>                  *
+ *                                                                         *
+ ***************************************************************************
+ *                                                                         *
+ *  This library is free software; you can redistribute it and/or          *
+ *  modify it under the terms of the GNU Library General Public            *
+ *  License as published by the Free Software Foundation; either           *
+ *  version 2 of the License, or (at your option) any later version.       *
+ *                                                                         *
+ *  This library is distributed in the hope that it will be useful,        *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU      *
+ *  Library General Public License for more details.                       *
+ *                                                                         *
+ *  You should have received a copy of the GNU Library General Public      *
+ *  License along with this library; see the file COPYING.LIB.  If         *
+ *  not, write to the Free Software Foundation, Inc., 59 Temple Place      *
+ *  - Suite 330, Boston, MA 02111-1307, USA.                               *
+ *                                                                         *
+ ***************************************************************************/
+
+#include <stdlib.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "magic/marena.h"
+
+BEGIN_NAMESPACE (MagiC);
+
+//////////////////////////////// Arena ///////////////////////////////////////
+
+/** Size of the block header, rounded up to keep the data aligned. */
+#define ARENA_HEADER_SIZE ((sizeof (Block) + ARENA_ALIGN-1) & ~(size_t) (ARENA_ALIGN-1))
+
+/** Returns the first usable byte of the block. */
+#define ARENA_BLOCK_DATA(block) (((char*) (block)) + ARENA_HEADER_SIZE)
+
+/** Creates an empty arena. No memory is taken before the first
+ *  allocation.
+ **/
+Arena::Arena (size_t blockSize	/**< Size of the blocks to take from the heap. */)
+		: mBlocks (NULL), mSpare (NULL), mCursor (NULL), mEnd (NULL), mBlockSize (blockSize),
+		  mUsed (0), mReserved (0)
+{
+}
+
+/** Frees all the memory of the arena. */
+Arena::~Arena ()
+{
+	freeBlocks (mBlocks);
+	freeBlocks (mSpare);
+}
+
+/** Returns a chain of blocks to the heap. */
+void Arena::freeBlocks (Block* blocks)
+{
+	while (Block* block = blocks) {
+		blocks = block->next;
+		mReserved -= block->size;
+		free (block);
+	}
+}
+
+/** Takes a block with the given usable size from the heap. */
+Arena::Block* Arena::newBlock (size_t size)
+{
+	Block* block = (Block*) malloc (ARENA_HEADER_SIZE + size);
+	if (!block)
+		throw std::bad_alloc ();
+	block->next = NULL;
+	block->size = size;
+	mReserved += size;
+	return block;
+}
+
+/*******************************************************************************
+ * Allocates from a new block, when the current one does not have
+ * room for the given, already aligned, size.
+ *
+ * An allocation larger than a quarter of the block size gets a block
+ * of its own, which is linked behind the current block, so that the
+ * rest of the current block is still used.
+ ******************************************************************************/
+void* Arena::allocateBlock (size_t size)
+{
+	if (mBlocks && size > mBlockSize/4) {
+		Block* block = newBlock (size);
+		block->next = mBlocks->next;
+		mBlocks->next = block;
+		mUsed += size;
+		return ARENA_BLOCK_DATA (block);
+	}
+
+	if (mBlocks)
+		mUsed += mCursor - ARENA_BLOCK_DATA (mBlocks);
+	Block* block = mSpare;
+	if (block && size <= mBlockSize)
+		mSpare = block->next;
+	else
+		block = newBlock ((size > mBlockSize)? size : mBlockSize);
+	block->next = mBlocks;
+	mBlocks = block;
+	mCursor = ARENA_BLOCK_DATA (block) + size;
+	mEnd = ARENA_BLOCK_DATA (block) + block->size;
+	return ARENA_BLOCK_DATA (block);
+}
+
+/*******************************************************************************
+ * Frees everything allocated from the arena at once. The blocks of
+ * the standard size are kept for reuse, and returned to the heap only
+ * when the arena is destroyed.
+ *
+ * The objects in the arena must have been destroyed, or must not need
+ * their destructors.
+ ******************************************************************************/
+void Arena::release ()
+{
+	while (Block* block = mBlocks) {
+		mBlocks = block->next;
+		if (block->size == mBlockSize) {
+			block->next = mSpare;
+			mSpare = block;
+		} else {
+			block->next = NULL;
+			freeBlocks (block);
+		}
+	}
+	mCursor = mEnd = NULL;
+	mUsed = 0;
+}
+
+/** Returns the number of bytes allocated from the arena, including
+ *  the alignment padding.
+ **/
+size_t Arena::used () const
+{
+	return mBlocks? mUsed + (mCursor - ARENA_BLOCK_DATA (mBlocks)) : 0;
+}
+
+
+
+///////////////////////////// Object pool ///////////////////////////////////
+
+#ifdef OBJECT_POOL
+
+/** Granularity of the size classes of the Object pool. */
+#define POOL_GRANULE	16
+
+/** Number of size classes; larger objects come from the heap. */
+#define POOL_CLASSES	16
+
+/** Size of the slabs the pool carves the objects from. */
+#define POOL_SLAB_SIZE	65536
+
+/** Number of objects moved at once between a thread and the depot. */
+#define POOL_BATCH		256
+
+/** A free object in a free list. */
+struct PoolNode {
+	PoolNode*	next;
+};
+
+/*******************************************************************************
+ * Free lists of one thread.
+ *
+ * Allocation and deletion use only the lists of the calling thread,
+ * without locking. An object may be deleted by another thread than
+ * the one that allocated it; it then goes to the list of the deleting
+ * thread. A thread that collects too many free objects of a size
+ * hands a batch of them to the depot, where the threads that run out
+ * take them from.
+ ******************************************************************************/
+struct PoolCache {
+	PoolNode*	free [POOL_CLASSES];
+	int			count [POOL_CLASSES];
+	char*		slab;		/**< Next free byte in the slab of the thread. */
+	char*		slabEnd;
+	bool		registered;	/**< Is the exit handler of the thread set? */
+};
+
+/** Free objects of one size shared by all threads. */
+struct PoolDepot {
+	PoolNode*		head;
+	int				count;
+	volatile int	busy;
+};
+
+static __thread PoolCache	poolCache;
+static PoolDepot			poolDepot [POOL_CLASSES];
+static pthread_key_t		poolKey;
+static pthread_once_t		poolKeyOnce = PTHREAD_ONCE_INIT;
+
+static inline void depotLock (PoolDepot& depot) {
+	while (__sync_lock_test_and_set (&depot.busy, 1))
+		sched_yield ();
+}
+
+static inline void depotUnlock (PoolDepot& depot) {
+	__sync_lock_release (&depot.busy);
+}
+
+/** Hands a chain of free objects to the depot. */
+static void depotPush (int sizeClass, PoolNode* head, PoolNode* tail, int count)
+{
+	PoolDepot& depot = poolDepot [sizeClass];
+	depotLock (depot);
+	tail->next = depot.head;
+	depot.head = head;
+	depot.count += count;
+	depotUnlock (depot);
+}
+
+/** Gives the free objects of an exiting thread to the depot. The
+ *  unused rest of its slab is lost.
+ **/
+static void poolThreadExit (void* cache)
+{
+	PoolCache* pc = (PoolCache*) cache;
+	for (int c=0; c<POOL_CLASSES; c++)
+		if (PoolNode* head = pc->free[c]) {
+			PoolNode* tail = head;
+			while (tail->next)
+				tail = tail->next;
+			depotPush (c, head, tail, pc->count[c]);
+			pc->free[c] = NULL;
+			pc->count[c] = 0;
+		}
+}
+
+static void poolCreateKey () {
+	pthread_key_create (&poolKey, poolThreadExit);
+}
+
+/** Sets the exit handler of the calling thread, which gives its free
+ *  objects to the depot. Both allocating and deleting threads need
+ *  it, as a thread that only deletes objects also collects them.
+ **/
+static void poolRegister (PoolCache& pc)
+{
+	pthread_once (&poolKeyOnce, poolCreateKey);
+	pthread_setspecific (poolKey, &pc);
+	pc.registered = true;
+}
+
+/*******************************************************************************
+ * Fills the empty free list of the size class, with a batch from the
+ * depot if it has one, otherwise with new objects from the slab of the
+ * thread.
+ ******************************************************************************/
+static void poolRefill (int sizeClass)
+{
+	PoolCache& pc = poolCache;
+	if (!pc.registered)
+		poolRegister (pc);
+
+	PoolDepot& depot = poolDepot [sizeClass];
+	if (depot.count > 0) {
+		depotLock (depot);
+		PoolNode* head = depot.head;
+		PoolNode* tail = head;
+		int count = head? 1 : 0;
+		for (; count < POOL_BATCH && tail->next; count++)
+			tail = tail->next;
+		if (head) {
+			depot.head = tail->next;
+			depot.count -= count;
+			tail->next = NULL;
+		}
+		depotUnlock (depot);
+		if (head) {
+			pc.free [sizeClass] = head;
+			pc.count [sizeClass] = count;
+			return;
+		}
+	}
+
+	size_t size = (sizeClass+1) * POOL_GRANULE;
+	PoolNode* head = NULL;
+	int count = 0;
+	for (; count < POOL_BATCH; count++) {
+		if (pc.slab + size > pc.slabEnd) {
+			// Slabs are never freed; the objects are reused instead
+			if (count > 0)
+				break;
+			if (!(pc.slab = (char*) malloc (POOL_SLAB_SIZE)))
+				throw std::bad_alloc ();
+			pc.slabEnd = pc.slab + POOL_SLAB_SIZE;
+		}
+		PoolNode* node = (PoolNode*) pc.slab;
+		pc.slab += size;
+		node->next = head;
+		head = node;
+	}
+	pc.free [sizeClass] = head;
+	pc.count [sizeClass] = count;
+}
+
+/** Hands a batch of the free objects of the size class to the depot. */
+static void poolSpill (int sizeClass)
+{
+	PoolCache& pc = poolCache;
+	PoolNode* head = pc.free [sizeClass];
+	PoolNode* tail = head;
+	for (int i=1; i<POOL_BATCH; i++)
+		tail = tail->next;
+	pc.free [sizeClass] = tail->next;
+	pc.count [sizeClass] -= POOL_BATCH;
+	depotPush (sizeClass, head, tail, POOL_BATCH);
+}
+
+/*******************************************************************************
+ * Allocates an Object from the pool of the calling thread. Objects of
+ * up to POOL_GRANULE*POOL_CLASSES bytes are rounded up to a size class
+ * and taken from its free list; larger ones come from the heap.
+ *
+ * The memory of the pool is reused, but not returned to the system.
+ * The pool is not used with memory debugging, which needs to trace
+ * every object, or if DISABLE_OBJECT_POOL is defined.
+ ******************************************************************************/
+void* Object::operator new (size_t size)
+{
+	if (size > POOL_GRANULE*POOL_CLASSES)
+		return ::operator new (size);
+
+	int sizeClass = size? (size-1) / POOL_GRANULE : 0;
+	PoolCache& pc = poolCache;
+	if (!pc.free [sizeClass])
+		poolRefill (sizeClass);
+	PoolNode* node = pc.free [sizeClass];
+	pc.free [sizeClass] = node->next;
+	pc.count [sizeClass]--;
+	return node;
+}
+
+/** Returns an Object to the pool of the calling thread. The size is
+ *  that of the most derived class, as the destructor is virtual.
+ **/
+void Object::operator delete (void* p, size_t size)
+{
+	if (!p)
+		return;
+	if (size > POOL_GRANULE*POOL_CLASSES) {
+		::operator delete (p);
+		return;
+	}
+
+	int sizeClass = size? (size-1) / POOL_GRANULE : 0;
+	PoolCache& pc = poolCache;
+	if (!pc.registered)
+		poolRegister (pc);
+	PoolNode* node = (PoolNode*) p;
+	node->next = pc.free [sizeClass];
+	pc.free [sizeClass] = node;
+	if (++pc.count [sizeClass] > 2*POOL_BATCH)
+		poolSpill (sizeClass);
+}
+
+#endif
+
+END_NAMESPACE;
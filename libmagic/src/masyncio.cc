@@ -0,0 +1,602 @@
+/***************************************************************************
+ *   This file is part of the MagiC++ library.                             *
+ *                                                                         *
+ *   Copyright (C) 1998-2002 Marko Grnroos <magi@iki.fi>                  *
+ *                                                                         *
+ ***************************************************************************
+ *                                                                         *
+ *  This library is free software; you can redistribute it and/or          *
+ *  modify it under the terms of the GNU Library General Public            *
+ *  License as published by the Free Software Foundation; either           *
+ *  version 2 of the License, or (at your option) any later version.       *
+ *                                                                         *
+ *  This library is distributed in the hope that it will be useful,        *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU      *
+ *  Library General Public License for more details.                       *
+ *                                                                         *
+ *  You should have received a copy of the GNU Library General Public      *
+ *  License along with this library; see the file COPYING.LIB.  If         *
+ *  not, write to the Free Software Foundation, Inc., 59 Temple Place      *
+ *  - Suite 330, Boston, MA 02111-1307, USA.                               *
+ *                                                                         *
+ ***************************************************************************/
+
+#include "magic/masyncio.h"
+#include "magic/msocket.h"
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+BEGIN_NAMESPACE (MagiC);
+
+///////////////////////////////////////////////////////////////////////////////
+//                                                                           //
+//     _                          ----                                       //
+//    / \   ___              ___  |   )   ___   ___         ___   ___   |    //
+//   |   | (     |   | |/\  /   \ |---   /   ) /   | |   | /   ) (     -+-   //
+//   |---|  `--  \___| |  | |     |  \   |---  \___| |   | |---   `--   |    //
+//   |   |  __)   ___/ |  | \___/ |   \   \__      | \___/  \__   __)   \_   //
+//                                                                           //
+///////////////////////////////////////////////////////////////////////////////
+
+AsyncRequest::AsyncRequest ()
+{
+	mpDevice	= NULL;
+	mpData		= NULL;
+	mBuffer		= -1;
+	mLength		= 0;
+	mOffset		= -1;
+	mWrite		= false;
+	mSocket		= false;
+	mDone		= true;
+	mResult		= 0;
+	mpHandler	= NULL;
+	mpUserData	= NULL;
+	mpNext		= NULL;
+}
+
+void AsyncRequest::prepare (IODevice& device, bool write, char* data, int buffer, uint length, long offset)
+{
+	mpDevice	= &device;
+	mpData		= data;
+	mBuffer		= buffer;
+	mLength		= length;
+	mOffset		= offset;
+	mWrite		= write;
+	mSocket		= dynamic_cast<Socket*> (&device) != NULL;
+	mResult		= 0;
+}
+
+/*******************************************************************************
+ * Prepares a read into the given memory.
+ ******************************************************************************/
+void AsyncRequest::prepareRead (IODevice& device,	/**< Device to read from. */
+								char* data,			/**< Buffer for the data. */
+								uint length,		/**< Bytes to read at most. */
+								long offset			/**< Position to read at, or -1 for the current one. */)
+{
+	prepare (device, false, data, -1, length, offset);
+}
+
+/*******************************************************************************
+ * Prepares a write of the given data.
+ ******************************************************************************/
+void AsyncRequest::prepareWrite (IODevice& device, const char* data, uint length, long offset)
+{
+	prepare (device, true, const_cast<char*> (data), -1, length, offset);
+}
+
+/*******************************************************************************
+ * Prepares a read into a buffer registered with
+ * @ref AsyncIO::registerBuffers().
+ ******************************************************************************/
+void AsyncRequest::prepareRead (IODevice& device,	/**< Device to read from. */
+								int buffer,			/**< Index of the registered buffer. */
+								uint length,		/**< Bytes to read at most. */
+								long offset			/**< Position to read at, or -1 for the current one. */)
+{
+	prepare (device, false, NULL, buffer, length, offset);
+}
+
+/*******************************************************************************
+ * Prepares a write from a buffer registered with
+ * @ref AsyncIO::registerBuffers().
+ ******************************************************************************/
+void AsyncRequest::prepareWrite (IODevice& device, int buffer, uint length, long offset)
+{
+	prepare (device, true, NULL, buffer, length, offset);
+}
+
+
+
+///////////////////////////////////////////////////////////////////////////////
+//                                                                           //
+//                    _                          ---  ___                    //
+//                   / \   ___              ___   |  /   \                   //
+//                  |   | (     |   | |/\  /   \  |  |   |                   //
+//                  |---|  `--  \___| |  | |      |  |   |                   //
+//                  |   |  __)   ___/ |  | \___/ _|_ \___/                   //
+//                                                                           //
+///////////////////////////////////////////////////////////////////////////////
+
+/** The shared rings of an io_uring. */
+struct AsyncRing {
+	int						fd;			/**< The io_uring descriptor.     */
+	uint					entries;	/**< Size of the submission ring. */
+	void*					sqMap;
+	size_t					sqSize;
+	void*					cqMap;
+	size_t					cqSize;
+	struct io_uring_sqe*	sqes;
+	size_t					sqesSize;
+	uint*					sqHead;
+	uint*					sqTail;
+	uint*					sqMask;
+	uint*					sqArray;
+	uint*					cqHead;
+	uint*					cqTail;
+	uint*					cqMask;
+	struct io_uring_cqe*	cqes;
+};
+
+static int asyncEnter (int fd, uint submit, uint complete, uint flags)
+{
+	return (int) syscall (__NR_io_uring_enter, fd, submit, complete, flags, NULL, 0);
+}
+
+static double asyncTime ()
+{
+	struct timespec now;
+	clock_gettime (CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec*1e-9;
+}
+
+/*******************************************************************************
+ * Creates an asynchronous I/O queue.
+ *
+ * @throw system_failure if the event descriptor can not be created,
+ * or if AIO_Uring is asked for and io_uring is not available.
+ ******************************************************************************/
+AsyncIO::AsyncIO (int depth,	/**< Maximum number of requests in flight; at most 4096. */
+				  int backend,	/**< AIO_Auto, AIO_Uring or AIO_Threads. */
+				  int threads	/**< Workers of the fallback. */)
+		: IODevice ()
+{
+	mDepth		= (depth < 1)? 1 : (depth > 4096)? 4096 : depth;
+	mPending	= 0;
+	mQueued		= 0;
+	mpRing		= NULL;
+	mpPool		= NULL;
+	mpDone		= NULL;
+
+	mEventFd = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (mEventFd < 0)
+		throw system_failure (i18n ("Creating the event descriptor failed: %1").arg (strerror (errno)));
+
+	mBackend = AIO_Threads;
+	if (backend != AIO_Threads && setupRing ())
+		mBackend = AIO_Uring;
+	else if (backend == AIO_Uring) {
+		::close (mEventFd);
+		throw system_failure (i18n ("io_uring is not available: %1").arg (strerror (errno)));
+	}
+	if (mBackend == AIO_Threads)
+		mpPool = new WorkerPool (*this, mLog, threads);
+
+	setMode (IO_ReadWrite);
+	setOpen ();
+}
+
+/*******************************************************************************
+ * Waits for the requests in flight, and frees the buffers.
+ ******************************************************************************/
+AsyncIO::~AsyncIO ()
+{
+	wait (mPending);
+	if (mpPool) {
+		mpPool->shutdown ();
+		delete mpPool;
+	}
+	if (mpRing) {
+		munmap (mpRing->sqes, mpRing->sqesSize);
+		if (mpRing->cqMap != mpRing->sqMap)
+			munmap (mpRing->cqMap, mpRing->cqSize);
+		munmap (mpRing->sqMap, mpRing->sqSize);
+		::close (mpRing->fd);
+		delete mpRing;
+	}
+	for (int i=0; i<mBuffers.size (); i++)
+		free (mBuffers[i]);
+	::close (mEventFd);
+}
+
+/** Creates the io_uring and maps its rings. */
+bool AsyncIO::setupRing ()
+{
+	struct io_uring_params params;
+	memset (&params, 0, sizeof (params));
+	int fd = (int) syscall (__NR_io_uring_setup, mDepth, &params);
+	if (fd < 0)
+		return false;
+
+	// The current position (offset -1) is needed for the streams
+	if (!(params.features & IORING_FEAT_RW_CUR_POS)) {
+		::close (fd);
+		errno = ENOSYS;
+		return false;
+	}
+
+	AsyncRing* ring = new AsyncRing;
+	ring->fd		= fd;
+	ring->entries	= params.sq_entries;
+	ring->sqSize	= params.sq_off.array + params.sq_entries*sizeof (uint);
+	ring->cqSize	= params.cq_off.cqes + params.cq_entries*sizeof (struct io_uring_cqe);
+	ring->sqesSize	= params.sq_entries*sizeof (struct io_uring_sqe);
+
+	// Since Linux 5.4 both rings are in one mapping
+	bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+	if (single && ring->cqSize > ring->sqSize)
+		ring->sqSize = ring->cqSize;
+	ring->sqMap = mmap (NULL, ring->sqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	ring->cqMap = single? ring->sqMap
+		: mmap (NULL, ring->cqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+	ring->sqes = (struct io_uring_sqe*) mmap (NULL, ring->sqesSize, PROT_READ | PROT_WRITE,
+											  MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+	if (ring->sqMap == MAP_FAILED || ring->cqMap == MAP_FAILED || (void*) ring->sqes == MAP_FAILED) {
+		int error = errno;
+		if ((void*) ring->sqes != MAP_FAILED)
+			munmap (ring->sqes, ring->sqesSize);
+		if (ring->cqMap != MAP_FAILED && ring->cqMap != ring->sqMap)
+			munmap (ring->cqMap, ring->cqSize);
+		if (ring->sqMap != MAP_FAILED)
+			munmap (ring->sqMap, ring->sqSize);
+		::close (fd);
+		delete ring;
+		errno = error;
+		return false;
+	}
+
+	char* sq = (char*) ring->sqMap;
+	char* cq = (char*) ring->cqMap;
+	ring->sqHead	= (uint*) (sq + params.sq_off.head);
+	ring->sqTail	= (uint*) (sq + params.sq_off.tail);
+	ring->sqMask	= (uint*) (sq + params.sq_off.ring_mask);
+	ring->sqArray	= (uint*) (sq + params.sq_off.array);
+	ring->cqHead	= (uint*) (cq + params.cq_off.head);
+	ring->cqTail	= (uint*) (cq + params.cq_off.tail);
+	ring->cqMask	= (uint*) (cq + params.cq_off.ring_mask);
+	ring->cqes		= (struct io_uring_cqe*) (cq + params.cq_off.cqes);
+	mpRing = ring;
+
+	// Completions signal the event descriptor, for the notifier
+	syscall (__NR_io_uring_register, fd, IORING_REGISTER_EVENTFD, &mEventFd, 1);
+	return true;
+}
+
+/*******************************************************************************
+ * Allocates buffers for the requests, aligned to pages, and registers
+ * them with the kernel. May be called only once.
+ *
+ * @return true if successful, false if the buffers could not be
+ * allocated or registered, for example because of the limit of
+ * locked memory.
+ ******************************************************************************/
+bool AsyncIO::registerBuffers (int count,	/**< Number of buffers. */
+							   uint size	/**< Size of each buffer in bytes. */)
+{
+	if (mBuffers.size () > 0 || count <= 0)
+		return false;
+
+	mBuffers.resize (count);
+	PackArray<struct iovec> vectors (count);
+	bool ok = true;
+	for (int i=0; i<count; i++) {
+		void* memory = NULL;
+		ok = ok && posix_memalign (&memory, 4096, size) == 0;
+		mBuffers[i] = (char*) memory;
+		vectors[i].iov_base = memory;
+		vectors[i].iov_len = size;
+	}
+	if (ok && mpRing)
+		ok = syscall (__NR_io_uring_register, mpRing->fd, IORING_REGISTER_BUFFERS, &vectors[0], count) == 0;
+
+	if (!ok) {
+		for (int i=0; i<count; i++)
+			free (mBuffers[i]);
+		mBuffers.resize (0);
+	}
+	return ok;
+}
+
+/*******************************************************************************
+ * Adds the request to the batch. If the maximum number of requests is
+ * in flight, first waits for one of them, calling its handler.
+ *
+ * @return false if the registered buffer of the request does not
+ * exist.
+ *
+ * @throw device_not_open if the device of the request has no handle.
+ ******************************************************************************/
+bool AsyncIO::submit (AsyncRequest* request)
+{
+	int fd = request->mpDevice->handle ();
+	if (fd < 0)
+		throw device_not_open (i18n ("Device not open when submitting an asynchronous request."));
+	if (request->mBuffer >= 0) {
+		if (request->mBuffer >= mBuffers.size ())
+			return false;
+		request->mpData = mBuffers[request->mBuffer];
+	}
+	if (mPending >= mDepth)
+		wait (1);
+
+	request->mDone = false;
+	request->mpNext = NULL;
+	mPending++;
+
+	if (mpPool) {
+		mpPool->process (request);
+		return true;
+	}
+
+	AsyncRing& ring = *mpRing;
+	uint tail = *ring.sqTail;
+	if (tail - __atomic_load_n (ring.sqHead, __ATOMIC_ACQUIRE) >= ring.entries) {
+		flush ();
+		tail = *ring.sqTail;
+	}
+
+	uint index = tail & *ring.sqMask;
+	struct io_uring_sqe* sqe = &ring.sqes[index];
+	memset (sqe, 0, sizeof (*sqe));
+	if (request->mSocket && request->mWrite) {
+		// Like Socket::writeBlock, a closed peer is an error, not a signal
+		sqe->opcode = IORING_OP_SEND;
+		sqe->msg_flags = MSG_NOSIGNAL;
+	} else if (request->mBuffer >= 0) {
+		sqe->opcode = request->mWrite? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+		sqe->buf_index = request->mBuffer;
+	} else
+		sqe->opcode = request->mWrite? IORING_OP_WRITE : IORING_OP_READ;
+	sqe->fd = fd;
+	sqe->off = (request->mOffset < 0 || request->mSocket)? (__u64) -1 : (__u64) request->mOffset;
+	sqe->addr = (__u64) (unsigned long) request->mpData;
+	sqe->len = request->mLength;
+	sqe->user_data = (__u64) (unsigned long) request;
+	ring.sqArray[index] = index;
+	__atomic_store_n (ring.sqTail, tail + 1, __ATOMIC_RELEASE);
+	mQueued++;
+	return true;
+}
+
+/*******************************************************************************
+ * Adds the requests to the batch.
+ *
+ * @return The number of requests added.
+ ******************************************************************************/
+int AsyncIO::submit (AsyncRequest** requests, int count)
+{
+	int i;
+	for (i=0; i<count; i++)
+		if (!submit (requests[i]))
+			break;
+	return i;
+}
+
+/*******************************************************************************
+ * Passes the batch of requests to the kernel, with one system call.
+ * The fallback starts the requests already when they are submitted.
+ ******************************************************************************/
+void AsyncIO::flush ()
+{
+	if (!mpRing || mQueued == 0)
+		return;
+
+	int result;
+	do {
+		result = asyncEnter (mpRing->fd, mQueued, 0, 0);
+	} while (result < 0 && (errno == EINTR || errno == EAGAIN));
+	if (result < 0)
+		setStatus (IO_WriteError);
+	else
+		mQueued -= result;
+}
+
+/** Marks the request done and calls its handler. */
+void AsyncIO::complete (AsyncRequest* request, int result)
+{
+	mPending--;
+	request->mResult = result;
+	__atomic_store_n (&request->mDone, true, __ATOMIC_RELEASE);
+	if (request->mpHandler)
+		request->mpHandler->completed (*request);
+}
+
+/*******************************************************************************
+ * Passes the batch on, and reaps the completed requests without
+ * waiting. The handlers are called in the order of completion.
+ *
+ * @return The number of completed requests.
+ ******************************************************************************/
+int AsyncIO::poll ()
+{
+	int done = 0;
+	if (mpRing) {
+		flush ();
+		AsyncRing& ring = *mpRing;
+		uint head = *ring.cqHead;
+		for (uint tail; (tail = __atomic_load_n (ring.cqTail, __ATOMIC_ACQUIRE)) != head;)
+			while (head != tail) {
+				struct io_uring_cqe* cqe = &ring.cqes[head & *ring.cqMask];
+				AsyncRequest* request = (AsyncRequest*) (unsigned long) cqe->user_data;
+				int result = cqe->res;
+
+				// The entry is free before the handler may submit more
+				__atomic_store_n (ring.cqHead, ++head, __ATOMIC_RELEASE);
+				complete (request, result);
+				done++;
+			}
+	} else {
+		AsyncRequest* request;
+		{
+			MutexLocker locker (mLock);
+			request = mpDone;
+			mpDone = NULL;
+		}
+
+		// Oldest first
+		AsyncRequest* ordered = NULL;
+		while (request) {
+			AsyncRequest* next = request->mpNext;
+			request->mpNext = ordered;
+			ordered = request;
+			request = next;
+		}
+		while (ordered) {
+			AsyncRequest* next = ordered->mpNext;
+			complete (ordered, ordered->mResult);
+			ordered = next;
+			done++;
+		}
+	}
+	return done;
+}
+
+/** Waits until the event descriptor is signaled, and resets it. */
+int AsyncIO::waitEvent (double seconds)
+{
+	struct pollfd pfd;
+	pfd.fd = mEventFd;
+	pfd.events = POLLIN;
+	int result = ::poll (&pfd, 1, (seconds < 0)? -1 : int (seconds*1000 + 0.999));
+	uint64_t value;
+	if (result > 0 && ::read (mEventFd, &value, sizeof (value))) {}
+	return result;
+}
+
+/*******************************************************************************
+ * Passes the batch on, and reaps the completed requests until at
+ * least the given number of them have completed.
+ *
+ * @return The number of completed requests. It is less than asked
+ * for if the time ran out or no more requests were in flight.
+ ******************************************************************************/
+int AsyncIO::wait (int count,		/**< Completions to wait for. */
+				   double seconds	/**< Time to wait at most, or negative for no limit. */)
+{
+	double deadline = (seconds < 0)? 0 : asyncTime () + seconds;
+	int done = poll ();
+	while (done < count && mPending > 0) {
+		if (mpRing && seconds < 0) {
+			int least = (count - done < mPending)? count - done : mPending;
+			if (asyncEnter (mpRing->fd, 0, least, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR)
+				break;
+		} else {
+			double left = (seconds < 0)? -1.0 : deadline - asyncTime ();
+			if (seconds >= 0 && left <= 0)
+				break;
+			waitEvent (left);
+		}
+		done += poll ();
+	}
+	return done;
+}
+
+/*******************************************************************************
+ * Waits until the request has completed, reaping and handling the
+ * other completions meanwhile.
+ *
+ * @return true if the request is done, false if the time ran out.
+ ******************************************************************************/
+bool AsyncIO::wait (AsyncRequest& request, double seconds)
+{
+	double deadline = (seconds < 0)? 0 : asyncTime () + seconds;
+	while (!request.isDone () && mPending > 0) {
+		double left = (seconds < 0)? -1.0 : deadline - asyncTime ();
+		if (seconds >= 0 && left <= 0)
+			break;
+		wait (1, left);
+	}
+	return request.isDone ();
+}
+
+/*******************************************************************************
+ * Makes the notifier reap the completions, so that the requests are
+ * handled in its loop with the other devices. The requests submitted
+ * in the loop are passed on with @ref flush().
+ ******************************************************************************/
+bool AsyncIO::attach (DeviceNotifier& notifier)
+{
+	return notifier.addDevice (this, this, IO_ReadReady);
+}
+
+/*******************************************************************************
+ * Stops reaping the completions in the notifier.
+ ******************************************************************************/
+bool AsyncIO::detach (DeviceNotifier& notifier)
+{
+	return notifier.removeDevice (this);
+}
+
+/*******************************************************************************
+ * Reaps the completions when the notifier tells of them.
+ ******************************************************************************/
+void AsyncIO::deviceEvent (DeviceNotifier& notifier, IODevice* device, int events)
+{
+	uint64_t value;
+	if (::read (mEventFd, &value, sizeof (value))) {}
+	poll ();
+}
+
+/*******************************************************************************
+ * Performs a request of the fallback in a worker of the pool.
+ ******************************************************************************/
+void AsyncIO::process (Request* pRequest)
+{
+	AsyncRequest* request = static_cast<AsyncRequest*> (pRequest);
+	int fd = request->mpDevice->handle ();
+	ssize_t bytes;
+	for (;;) {
+		if (request->mSocket)
+			bytes = request->mWrite? ::send (fd, request->mpData, request->mLength, MSG_NOSIGNAL)
+				: ::recv (fd, request->mpData, request->mLength, 0);
+		else if (request->mOffset >= 0)
+			bytes = request->mWrite? ::pwrite (fd, request->mpData, request->mLength, request->mOffset)
+				: ::pread (fd, request->mpData, request->mLength, request->mOffset);
+		else
+			bytes = request->mWrite? ::write (fd, request->mpData, request->mLength)
+				: ::read (fd, request->mpData, request->mLength);
+		if (bytes >= 0 || (errno != EINTR && errno != EAGAIN))
+			break;
+
+		// A non-blocking device is waited for, as io_uring does
+		if (errno == EAGAIN) {
+			struct pollfd pfd;
+			pfd.fd = fd;
+			pfd.events = request->mWrite? POLLOUT : POLLIN;
+			::poll (&pfd, 1, -1);
+		}
+	}
+	request->mResult = (bytes < 0)? -errno : int (bytes);
+
+	{
+		MutexLocker locker (mLock);
+		request->mpNext = mpDone;
+		mpDone = request;
+	}
+	uint64_t one = 1;
+	if (::write (mEventFd, &one, sizeof (one))) {}
+}
+
+END_NAMESPACE;
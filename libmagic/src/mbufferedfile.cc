@@ -0,0 +1,588 @@
+/***************************************************************************
+ *   This file is part of the MagiC++ library.                             *
+ *                                                                         *
+ *   Copyright (C) 1998-2005 Marko Grnroos <magi@iki.fi>                  *
+ *                                                                         *
+ ***************************************************************************
+ *                                                                         *
+ *  This library is free software; you can redistribute it and/or          *
+ *  modify it under the terms of the GNU Library General Public            *
+ *  License as published by the Free Software Foundation; either           *
+ *  version 2 of the License, or (at your option) any later version.       *
+ *                                                                         *
+ *  This library is distributed in the hope that it will be useful,        *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU      *
+ *  Library General Public License for more details.                       *
+ *                                                                         *
+ *  You should have received a copy of the GNU Library General Public      *
+ *  License along with this library; see the file COPYING.LIB.  If         *
+ *  not, write to the Free Software Foundation, Inc., 59 Temple Place      *
+ *  - Suite 330, Boston, MA 02111-1307, USA.                               *
+ *                                                                         *
+ ***************************************************************************/
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdlib.h>
+
+#include "magic/mbufferedfile.h"
+
+BEGIN_NAMESPACE (MagiC);
+
+/*******************************************************************************
+ * Constructor.
+ *
+ *  Creates a BufferedFile object, and opens it if the mode parameter
+ *  is given. The buffer size is rounded up to a multiple of the page
+ *  size.
+ ******************************************************************************/
+BufferedFile::BufferedFile (const String& name	/**< Name of the file to open. */,
+							int mode			/**< Mode for opening. See @ref IODevice::open for details. */,
+							uint bufferSize		/**< Size of the buffer in bytes. */)
+		: IODevice ()
+{
+	mName		= name;
+	mFd			= -1;
+	mPos		= 0;
+	mEnd		= 0;
+	mOffset		= 0;
+	mWriting	= false;
+	mEof		= false;
+
+	// Page-aligned buffer, so that the kernel can copy whole pages
+	uint pageSize = sysconf (_SC_PAGESIZE);
+	mCapacity = ((bufferSize? bufferSize : 1) + pageSize - 1) / pageSize * pageSize;
+	void* buffer = NULL;
+	if (posix_memalign (&buffer, pageSize, mCapacity) != 0)
+		throw system_failure (i18n("Could not allocate a buffer of %1 bytes for file '%2'.")
+							  .arg(int(mCapacity)).arg(mName));
+	mpBuffer = (char*) buffer;
+
+	if (mode) {
+		// The device must be opened either readable or writable or both
+		if (! ((mode & IO_Readable) || (mode & IO_Writable)))
+			throw open_failure (i18n("File '%1' must be opened either readable or writable or both; mode was %2.")
+								.arg(mName).arg(mode));
+
+		if (! open (mode))
+			throw open_failure (i18n("Error '%1' while trying to open file '%2'.")
+								.arg(strerror(errno)).arg(mName));
+	}
+}
+
+/*******************************************************************************
+ * Destructor. Closes the file, flushing any data written.
+ ******************************************************************************/
+BufferedFile::~BufferedFile ()
+{
+	close ();
+	free (mpBuffer);
+}
+
+/*******************************************************************************
+ * Opens the file with the given I/O mode.
+ *
+ *  The modes are the same as for File; a file opened only for
+ *  writing is truncated.
+ *
+ *  @return true if successful, false on failure, with errno set.
+ ******************************************************************************/
+bool BufferedFile::open (int mode)
+{
+	if (isOpen())
+		close ();
+
+	int flags = 0;
+	if (mode & IO_Readable)
+		flags = (mode & IO_Writable)? O_RDWR : O_RDONLY;
+	else if (mode & IO_Writable)
+		flags = O_WRONLY | ((mode & IO_Append)? 0 : O_TRUNC);
+	else
+		return false;
+
+	if (mode & IO_Writable) {
+		if (mode & IO_Append)
+			flags |= O_APPEND | O_CREAT;
+		if (mode & IO_Truncate)
+			flags |= O_TRUNC;
+		if (!(mode & IO_Readable) || (mode & IO_Truncate))
+			flags |= O_CREAT;
+	}
+
+	int fd = ::open ((CONSTR) mName, flags, 0666);
+	if (fd < 0)
+		return false;
+
+	// Tell the kernel to read ahead aggressively
+	if (mode & IO_Readable)
+		posix_fadvise (fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+	mFd			= fd;
+	mPos		= 0;
+	mEnd		= 0;
+	mOffset		= (mode & IO_Append)? lseek (fd, 0, SEEK_END) : 0;
+	mWriting	= false;
+	mEof		= false;
+
+	setMode (mode);
+	setState (IO_EOS, false);
+	resetStatus ();
+	setOpen ();
+
+	return true;
+}
+
+/*******************************************************************************
+ * Flushes any data written and closes the file.
+ ******************************************************************************/
+void BufferedFile::close ()
+{
+	if (mFd < 0)
+		return;
+
+	flush ();
+	if (::close (mFd) != 0)
+		setStatus (IO_OnCloseError);
+
+	mFd		= -1;
+	mPos	= 0;
+	mEnd	= 0;
+	setClosed ();
+}
+
+/*******************************************************************************
+ * Writes the data in the buffer to the file.
+ ******************************************************************************/
+void BufferedFile::flush ()
+{
+	if (mFd < 0)
+		throw device_not_open (i18n ("File not open when flushing file '%1'.").arg(mName));
+
+	if (mWriting && mPos > 0) {
+		writeOut (mpBuffer, mPos);
+		mOffset += mPos;
+		mPos = 0;
+	}
+}
+
+/*******************************************************************************
+ * Returns the size of the file, including data not yet flushed.
+ ******************************************************************************/
+uint BufferedFile::size () const
+{
+	struct stat statbuf;
+	int callResult = (mFd >= 0)? fstat (mFd, &statbuf) : stat ((CONSTR) mName, &statbuf);
+	if (callResult != 0)
+		throw system_failure (i18n("System error '%1' while checking the size of file '%2'.")
+							  .arg(strerror(errno)).arg(mName));
+
+	if (mWriting && statbuf.st_size < mOffset + off_t (mPos))
+		return mOffset + mPos;
+	return statbuf.st_size;
+}
+
+/*******************************************************************************
+ * Moves to the given position in the file.
+ *
+ *  A position within the data already read is reached without a
+ *  system call.
+ *
+ *  @return true if successful, false on failure.
+ ******************************************************************************/
+bool BufferedFile::seekTo (off_t position)
+{
+	if (mFd < 0)
+		throw device_not_open (i18n ("File not open when seeking in file '%1'.").arg(mName));
+
+	flush ();
+	if (!mWriting && position >= mOffset && position <= mOffset + off_t (mEnd))
+		mPos = position - mOffset;
+	else {
+		if (lseek (mFd, position, SEEK_SET) < 0)
+			return false;
+		mOffset	= position;
+		mPos	= 0;
+		mEnd	= 0;
+	}
+
+	mEof = false;
+	setState (IO_EOS, false);
+	return true;
+}
+
+/*******************************************************************************
+ * Returns true if there is nothing more to read, either because the
+ * file is at its end, or because reading it failed.
+ *
+ *  Checking this at the end of the buffer reads the next block.
+ ******************************************************************************/
+bool BufferedFile::atEnd () const
+{
+	if (mPos < mEnd)
+		return false;
+	if (mFd < 0 || !isReadable() || mEof)
+		return true;
+
+	// Reading ahead does not change the observable state
+	BufferedFile* self = const_cast<BufferedFile*> (this);
+	if (mWriting) {
+		self->flush ();
+		self->mWriting = false;
+	}
+	return self->fill () <= 0;
+}
+
+/*******************************************************************************
+ * Reads a data block of a given length to a buffer.
+ *
+ *  Blocks at least as large as the buffer of the device are read
+ *  directly to the given buffer.
+ *
+ *  @return The number of bytes actually read. If it is less than
+ *  requested, the file is either at its end or status() tells the
+ *  error.
+ ******************************************************************************/
+int BufferedFile::readBlock (char* data,	/**< Data buffer to receive the block read. */
+							 uint len		/**< Number of bytes to read. */)
+{
+	ASSERT (data && len>0);
+	if (mFd < 0)
+		throw device_not_open (i18n ("File not open when reading from file '%1'.").arg(mName));
+	if (mWriting) {
+		flush ();
+		mWriting = false;
+	}
+
+	// First what is left in the buffer
+	uint done = mEnd - mPos;
+	if (done > len)
+		done = len;
+	memcpy (data, mpBuffer + mPos, done);
+	mPos += done;
+
+	while (done < len) {
+		if (len - done >= mCapacity) {
+			// The buffer is empty here, so read past it
+			ssize_t bytes;
+			do {
+				bytes = ::read (mFd, data + done, len - done);
+			} while (bytes < 0 && errno == EINTR);
+
+			if (bytes <= 0) {
+				if (bytes < 0)
+					setStatus (IO_ReadError);
+				else
+					setState (IO_EOS);
+				mEof = true;
+				break;
+			}
+			mOffset += mEnd + bytes;
+			mPos = mEnd = 0;
+			done += bytes;
+		} else {
+			if (fill () <= 0)
+				break;
+			uint bytes = mEnd - mPos;
+			if (bytes > len - done)
+				bytes = len - done;
+			memcpy (data + done, mpBuffer + mPos, bytes);
+			mPos += bytes;
+			done += bytes;
+		}
+	}
+
+	return done;
+}
+
+/*******************************************************************************
+ * Reads a data block from the given position, without moving the
+ * current position.
+ *
+ *  Reads the file, not the buffer, so data written but not yet
+ *  flushed is not seen.
+ *
+ *  @return The number of bytes actually read, or -1 on error.
+ ******************************************************************************/
+int BufferedFile::readAt (off_t offset,	/**< Position in the file to read from. */
+						  char* data,	/**< Data buffer to receive the block read. */
+						  uint len		/**< Number of bytes to read. */) const
+{
+	if (mFd < 0)
+		throw device_not_open (i18n ("File not open when reading from file '%1'.").arg(mName));
+
+	uint done = 0;
+	while (done < len) {
+		ssize_t bytes = pread (mFd, data + done, len - done, offset + done);
+		if (bytes < 0 && errno == EINTR)
+			continue;
+		if (bytes < 0)
+			return -1;
+		if (bytes == 0)
+			break;
+		done += bytes;
+	}
+	return done;
+}
+
+/*******************************************************************************
+ * Reads a newline-terminated line to a character buffer.
+ *
+ *  Reads at most maxlen-1 bytes, and terminates the data with a zero.
+ *
+ *  @return Number of bytes read, including the newline.
+ ******************************************************************************/
+int BufferedFile::readLine (char* data,		/**< Data buffer to receive the line. */
+							uint maxlen		/**< Size of the data buffer. */)
+{
+	ASSERT (data && maxlen>0);
+	if (mFd < 0)
+		throw device_not_open (i18n ("File not open when reading a line from file '%1'.").arg(mName));
+	if (mWriting) {
+		flush ();
+		mWriting = false;
+	}
+
+	uint count = 0;
+	while (count < maxlen-1) {
+		if (mPos >= mEnd && fill () <= 0)
+			break;
+
+		uint avail = mEnd - mPos;
+		if (avail > maxlen-1 - count)
+			avail = maxlen-1 - count;
+
+		const char* start = mpBuffer + mPos;
+		const char* newline = (const char*) memchr (start, '\n', avail);
+		uint bytes = newline? newline - start + 1 : avail;
+		memcpy (data + count, start, bytes);
+		mPos += bytes;
+		count += bytes;
+		if (newline)
+			break;
+	}
+	data[count] = '\0';
+
+	return count;
+}
+
+/*******************************************************************************
+ * Reads a newline-terminated line to a string.
+ *
+ *  @return Number of bytes read, including the newline, or 0 at the
+ *  end of the file.
+ ******************************************************************************/
+int BufferedFile::readLine (String& str,	/**< String to receive the line. */
+							int maxlen		/**< Maximum number of bytes to read or -1 for unlimited. */)
+{
+	if (mFd < 0)
+		throw device_not_open (i18n ("File not open when reading a line from file '%1'.").arg(mName));
+	if (mWriting) {
+		flush ();
+		mWriting = false;
+	}
+
+	str.empty ();
+	uint limit = (maxlen < 0)? uint(-1) : maxlen;
+	uint count = 0;
+	while (count < limit) {
+		if (mPos >= mEnd && fill () <= 0)
+			break;
+
+		uint avail = mEnd - mPos;
+		if (avail > limit - count)
+			avail = limit - count;
+
+		const char* start = mpBuffer + mPos;
+		const char* newline = (const char*) memchr (start, '\n', avail);
+		uint bytes = newline? newline - start + 1 : avail;
+		str.append (start, bytes);
+		mPos += bytes;
+		count += bytes;
+		if (newline)
+			break;
+	}
+
+	return count;
+}
+
+/*******************************************************************************
+ * Writes a block of data to the file.
+ *
+ *  Blocks at least as large as the buffer are written directly.
+ *
+ *  @return Number of bytes actually written.
+ ******************************************************************************/
+int BufferedFile::writeBlock (const char* data,	/**< Data block to write. */
+							  uint len			/**< Length of the data block. */)
+{
+	if (!startWriting ())
+		throw device_not_open (i18n ("File not open when writing to file '%1'.").arg(mName));
+
+	if (mPos + len > mCapacity)
+		flush ();
+
+	if (len >= mCapacity) {
+		int written = writeOut (data, len);
+		mOffset += written;
+		return written;
+	}
+
+	memcpy (mpBuffer + mPos, data, len);
+	mPos += len;
+	return len;
+}
+
+/*******************************************************************************
+ * Reads more data to the buffer, moving any unread data to its
+ * beginning first.
+ *
+ *  @return Number of bytes read, 0 at the end of the file, or -1 on
+ *  error.
+ ******************************************************************************/
+int BufferedFile::fill ()
+{
+	if (mPos > 0) {
+		memmove (mpBuffer, mpBuffer + mPos, mEnd - mPos);
+		mOffset += mPos;
+		mEnd -= mPos;
+		mPos = 0;
+	}
+	if (mEnd == mCapacity)
+		return 0;
+
+	ssize_t bytes;
+	do {
+		bytes = ::read (mFd, mpBuffer + mEnd, mCapacity - mEnd);
+	} while (bytes < 0 && errno == EINTR);
+
+	if (bytes <= 0) {
+		if (bytes < 0)
+			setStatus (IO_ReadError);
+		else
+			setState (IO_EOS);
+		mEof = true;
+		return bytes;
+	}
+
+	mEnd += bytes;
+	mEof = false;
+	return bytes;
+}
+
+/*******************************************************************************
+ * Puts the buffer to writing state.
+ *
+ *  Unread data in the buffer is returned to the file by moving the
+ *  file position back.
+ *
+ *  @return false if the file is not open.
+ ******************************************************************************/
+bool BufferedFile::startWriting ()
+{
+	if (mFd < 0)
+		return false;
+
+	if (!mWriting) {
+		if (mEnd != mPos)
+			lseek (mFd, mOffset + mPos, SEEK_SET);
+		mOffset += mPos;
+		mPos = mEnd = 0;
+		mWriting = true;
+	}
+	return true;
+}
+
+/*******************************************************************************
+ * Writes the given data to the file, retrying partial writes.
+ *
+ *  @return Number of bytes written.
+ ******************************************************************************/
+int BufferedFile::writeOut (const char* data, uint len)
+{
+	uint done = 0;
+	while (done < len) {
+		ssize_t bytes = ::write (mFd, data + done, len - done);
+		if (bytes < 0 && errno == EINTR)
+			continue;
+		if (bytes <= 0) {
+			setStatus (IO_WriteError);
+			break;
+		}
+		done += bytes;
+	}
+	return done;
+}
+
+/*******************************************************************************
+ * Reads one character when the buffer is empty.
+ ******************************************************************************/
+int BufferedFile::getchSlow ()
+{
+	if (mFd < 0)
+		throw device_not_open (i18n ("File not open when reading from file '%1'.").arg(mName));
+	if (mWriting) {
+		flush ();
+		mWriting = false;
+	}
+
+	if (mPos >= mEnd && fill () <= 0)
+		return -1;
+	return (unsigned char) mpBuffer[mPos++];
+}
+
+/*******************************************************************************
+ * Ungets a character when there is no room before the current
+ * position in the buffer.
+ *
+ *  The function has no meaning if the file is at its beginning.
+ ******************************************************************************/
+void BufferedFile::ungetchSlow (char ch)
+{
+	if (mFd < 0)
+		throw device_not_open (i18n ("File not open when ungetting from file '%1'.").arg(mName));
+	if (mWriting) {
+		flush ();
+		mWriting = false;
+	}
+
+	mEof = false;
+	setState (IO_EOS, false);
+
+	if (mPos > 0) {
+		mpBuffer[--mPos] = ch;
+		return;
+	}
+	if (mOffset == 0)
+		return;
+
+	// Make room at the beginning of the buffer, returning the last
+	// byte to the file if it is full.
+	if (mEnd == mCapacity) {
+		mEnd--;
+		lseek (mFd, mOffset + mEnd, SEEK_SET);
+	}
+	memmove (mpBuffer + 1, mpBuffer, mEnd);
+	mEnd++;
+	mOffset--;
+	mpBuffer[0] = ch;
+}
+
+/*******************************************************************************
+ * Writes one character when the buffer is full or not yet in
+ * writing state.
+ ******************************************************************************/
+void BufferedFile::putchSlow (char ch)
+{
+	if (!startWriting ())
+		throw device_not_open (i18n ("File not open when writing to file '%1'.").arg(mName));
+
+	if (mPos >= mCapacity)
+		flush ();
+	mpBuffer[mPos++] = ch;
+}
+
+END_NAMESPACE;
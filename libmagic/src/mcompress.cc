@@ -0,0 +1,909 @@
+/***************************************************************************
+ *   This file is part of the MagiC++ library.                             *
+ *                                                                         *
+ *   Copyright (C) 1998-2002 Marko Grnroos <magi@iki.fi>                  *
+ *                                                                         *
+ ***************************************************************************
+ *                                                                         *
+ *  This library is free software; you can redistribute it and/or          *
+ *  modify it under the terms of the GNU Library General Public            *
+ *  License as published by the Free Software Foundation; either           *
+ *  version 2 of the License, or (at your option) any later version.       *
+ *                                                                         *
+ *  This library is distributed in the hope that it will be useful,        *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU      *
+ *  Library General Public License for more details.                       *
+ *                                                                         *
+ *  You should have received a copy of the GNU Library General Public      *
+ *  License along with this library; see the file COPYING.LIB.  If         *
+ *  not, write to the Free Software Foundation, Inc., 59 Temple Place      *
+ *  - Suite 330, Boston, MA 02111-1307, USA.                               *
+ *                                                                         *
+ ***************************************************************************/
+
+#include "magic/mcompress.h"
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#include <string.h>
+
+BEGIN_NAMESPACE (MagiC);
+
+/** A frame compressed by a worker of the pool. */
+struct CompressFrame : public Request {
+	char*			input;		/**< Uncompressed data, owned.        */
+	uint			length;		/**< Length of the data.              */
+	PackArray<char>	output;		/**< Compressed frame.                */
+	Semaphore		done;		/**< Posted when output is ready.     */
+	CompressFrame*	next;		/**< Next newer frame.                */
+};
+
+#if defined(HAVE_ZLIB) || defined(HAVE_ZSTD)
+/** Stores a 16-bit little-endian number. */
+static void compressPut16 (char* p, uint value)
+{
+	p[0] = char (value);
+	p[1] = char (value >> 8);
+}
+
+/** Stores a 32-bit little-endian number. */
+static void compressPut32 (char* p, uint value)
+{
+	compressPut16 (p, value & 0xffff);
+	compressPut16 (p+2, value >> 16);
+}
+
+/** Reads a 16-bit little-endian number. */
+static uint compressGet16 (const char* p)
+{
+	return (unsigned char) p[0] | ((unsigned char) p[1] << 8);
+}
+
+/** Reads a 32-bit little-endian number. */
+static uint compressGet32 (const char* p)
+{
+	return compressGet16 (p) | (compressGet16 (p+2) << 16);
+}
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+//                                                                           //
+//        ___                                                       |        //
+//       /   \  ___           ___        ___   ___   ___   ___      |        //
+//       |     /   \ |/\/\  |   \ |/\  /   ) (     (     /   )  ___|         //
+//       |     |   | |  | | |___/ |    |---   `--   `--  |---  /   |         //
+//       \___/ \___/ |  | | |     |     \__   __)   __)   \__  \___|         //
+//                                                                           //
+///////////////////////////////////////////////////////////////////////////////
+
+/*******************************************************************************
+ * Creates a device on top of the given device, which it owns. The
+ * subclasses open it.
+ ******************************************************************************/
+CompressedDevice::CompressedDevice (IODevice* device, int level)
+		: IODevice ()
+{
+	mpDevice		= device;
+	mLevel			= level;
+	mFrameDone		= true;
+	mpIn			= NULL;
+	mInPos			= 0;
+	mInEnd			= 0;
+	mpOut			= NULL;
+	mOutPos			= 0;
+	mOutEnd			= 0;
+	mInputEnd		= false;
+	mDecoderFull	= false;
+	mEnd			= false;
+	mIndexLoaded	= false;
+	mpFrame			= NULL;
+	mFrameLen		= 0;
+	mFrameSize		= COMPRESS_FRAME_SIZE;
+	mpPool			= NULL;
+	mThreads		= 1;
+	mpFirst			= NULL;
+	mpLast			= NULL;
+	mInFlight		= 0;
+	mPosition		= 0;
+	mCompressed		= 0;
+}
+
+/*******************************************************************************
+ * Deletes the wrapped device. The subclasses close the device first,
+ * while they can still write the index.
+ ******************************************************************************/
+CompressedDevice::~CompressedDevice ()
+{
+	if (mpPool) {
+		mpPool->shutdown ();
+		delete mpPool;
+	}
+	delete mpDevice;
+	delete [] mpIn;
+	delete [] mpOut;
+	delete [] mpFrame;
+}
+
+/*******************************************************************************
+ * Opens the device for reading or for writing, and the wrapped device
+ * too if it is not open.
+ *
+ * @return true if successful, false with status IO_OpenError if the
+ * mode is not either readable or writable, or the wrapped device
+ * does not open.
+ ******************************************************************************/
+bool CompressedDevice::open (int mode)
+{
+	if (isOpen ())
+		close ();
+	bool readable = mode & IO_Readable, writable = mode & IO_Writable;
+	if (readable == writable || (!mpDevice->isOpen () && !mpDevice->open (mode))) {
+		setStatus (IO_OpenError);
+		return false;
+	}
+
+	setMode (mode);
+	resetStatus ();
+	mPosition = 0;
+	mCompressed = 0;
+	mIndex.resize (0);
+	mIndexLoaded = false;
+	if (readable) {
+		if (!mpIn) {
+			mpIn = new char [COMPRESS_BUFFER_SIZE];
+			mpOut = new char [COMPRESS_BUFFER_SIZE + 1];
+		}
+		mInPos = mInEnd = mOutPos = mOutEnd = 0;
+		mInputEnd = mDecoderFull = mEnd = false;
+		mFrameDone = true;
+		resetDecoder ();
+	} else {
+		delete [] mpFrame;
+		mpFrame = new char [mFrameSize];
+		mFrameLen = 0;
+	}
+	setOpen ();
+	return true;
+}
+
+/*******************************************************************************
+ * Closes the device and the wrapped device. A writable device first
+ * writes the remaining frames and the index.
+ ******************************************************************************/
+void CompressedDevice::close ()
+{
+	if (!isOpen ())
+		return;
+
+	if (isWritable ()) {
+		endFrame ();
+		writeFrames (true);
+
+		// Without room for the whole index, none is written
+		PackArray<char> index;
+		writeIndex (index);
+		if (index.size () > 0 && mpDevice->writeBlock (&index[0], index.size ()) != index.size ())
+			setStatus (IO_WriteError);
+		delete [] mpFrame;
+		mpFrame = NULL;
+	}
+	mpDevice->close ();
+	setClosed ();
+}
+
+/*******************************************************************************
+ * Compresses the frames in the given number of threads at once. Set
+ * before writing.
+ ******************************************************************************/
+void CompressedDevice::setThreads (int threads)
+{
+	if (mpPool || threads <= 1)
+		return;
+	mThreads = threads;
+	mpPool = new WorkerPool (*this, mLog, threads);
+}
+
+/*******************************************************************************
+ * Sets the uncompressed size of the frames. Smaller frames make
+ * seeking faster and compression weaker. Set before opening.
+ ******************************************************************************/
+void CompressedDevice::setFrameSize (uint size)
+{
+	if (!isOpen () && size > 0)
+		mFrameSize = size;
+}
+
+/*******************************************************************************
+ * Returns the uncompressed size: the data written so far, or the size
+ * in the index of a device being read. 0 if the size is not known.
+ ******************************************************************************/
+uint CompressedDevice::size () const
+{
+	if (isWritable ())
+		return uint (mPosition);
+	if (mIndex.size () == 0)
+		return 0;
+	const CompressIndexEntry& last = mIndex[mIndex.size ()-1];
+	return uint (last.offset + last.size);
+}
+
+/*******************************************************************************
+ * Returns true if a device being read has an index of frames. Looks
+ * for the index, if it has not been looked for yet.
+ ******************************************************************************/
+bool CompressedDevice::hasIndex ()
+{
+	if (isReadable ())
+		loadIndex ();
+	return mIndex.size () > 0;
+}
+
+/** Reads the index once, keeping the position of the device. */
+void CompressedDevice::loadIndex ()
+{
+	if (mIndexLoaded)
+		return;
+	mIndexLoaded = true;
+
+	int position = mpDevice->at ();
+	if (!readIndex ())
+		mIndex.resize (0);
+	mpDevice->seek (position);
+}
+
+/** Reads a block from the given position of the wrapped device. */
+bool CompressedDevice::readDeviceAt (long offset, char* data, uint length)
+{
+	if (!mpDevice->seek (int (offset)))
+		return false;
+	uint done = 0;
+	while (done < length) {
+		int bytes = mpDevice->readBlock (data + done, length - done);
+		if (bytes <= 0)
+			return false;
+		done += bytes;
+	}
+	return true;
+}
+
+/** Adds a frame after the last one to the index. */
+void CompressedDevice::addIndexEntry (uint size, uint compressedSize)
+{
+	CompressIndexEntry entry;
+	entry.offset = 0;
+	entry.compressedOffset = 0;
+	if (mIndex.size () > 0) {
+		const CompressIndexEntry& last = mIndex[mIndex.size ()-1];
+		entry.offset = last.offset + last.size;
+		entry.compressedOffset = last.compressedOffset + last.compressedSize;
+	}
+	entry.size = size;
+	entry.compressedSize = compressedSize;
+	mIndex.add (entry);
+}
+
+/*******************************************************************************
+ * Writes the completed frames, and flushes the wrapped device. The
+ * data of the frame being filled stays in it.
+ ******************************************************************************/
+void CompressedDevice::flush ()
+{
+	if (!isOpen () || !isWritable ())
+		return;
+	writeFrames (true);
+	mpDevice->flush ();
+}
+
+/*******************************************************************************
+ * Compresses the data of the frame being filled as a frame of its
+ * own, even if it is not full.
+ ******************************************************************************/
+void CompressedDevice::endFrame ()
+{
+	if (!mpFrame || mFrameLen == 0)
+		return;
+
+	if (!mpPool) {
+		compressFrame (mpFrame, mFrameLen, mOutput);
+		writeFrame (mFrameLen, mOutput);
+		mFrameLen = 0;
+		return;
+	}
+
+	// The frame takes the buffer along to the worker
+	CompressFrame* frame = new CompressFrame;
+	frame->input = mpFrame;
+	frame->length = mFrameLen;
+	frame->next = NULL;
+	if (mpLast)
+		mpLast->next = frame;
+	else
+		mpFirst = frame;
+	mpLast = frame;
+	mInFlight++;
+	mpFrame = new char [mFrameSize];
+	mFrameLen = 0;
+
+	mpPool->process (frame);
+	writeFrames (false);
+}
+
+/*******************************************************************************
+ * Compresses a frame in a worker of the pool.
+ ******************************************************************************/
+void CompressedDevice::process (Request* pRequest)
+{
+	CompressFrame* frame = static_cast<CompressFrame*> (pRequest);
+	compressFrame (frame->input, frame->length, frame->output);
+	frame->done.post ();
+}
+
+/** Writes the oldest frames compressed by the pool: all of them, or
+ *  those already done, waiting while too many are in flight.
+ **/
+void CompressedDevice::writeFrames (bool all)
+{
+	while (mpFirst) {
+		CompressFrame* frame = mpFirst;
+		if (all || mInFlight > 2*mThreads)
+			frame->done.wait ();
+		else if (!frame->done.tryWait ())
+			break;
+
+		writeFrame (frame->length, frame->output);
+		mpFirst = frame->next;
+		if (!mpFirst)
+			mpLast = NULL;
+		mInFlight--;
+		delete [] frame->input;
+		delete frame;
+	}
+}
+
+/** Writes a compressed frame to the wrapped device. */
+void CompressedDevice::writeFrame (uint size, const PackArray<char>& data)
+{
+	if (data.size () == 0 || mpDevice->writeBlock (&data[0], data.size ()) != data.size ()) {
+		setStatus (IO_WriteError);
+		return;
+	}
+	addIndexEntry (size, data.size ());
+	mCompressed += data.size ();
+}
+
+/*******************************************************************************
+ * Writes data to the frame being filled, compressing the frames that
+ * become full.
+ *
+ * @return The number of bytes written.
+ ******************************************************************************/
+int CompressedDevice::writeBlock (const char* data, uint len)
+{
+	if (!isOpen () || !mpFrame) {
+		setStatus (IO_WriteError);
+		return 0;
+	}
+
+	uint done = 0;
+	while (done < len) {
+		uint bytes = mFrameSize - mFrameLen;
+		if (bytes > len - done)
+			bytes = len - done;
+		memcpy (mpFrame + mFrameLen, data + done, bytes);
+		mFrameLen += bytes;
+		done += bytes;
+		if (mFrameLen == mFrameSize)
+			endFrame ();
+	}
+	mPosition += done;
+	return done;
+}
+
+/** Decompresses more data to the output buffer. One byte of the
+ *  previous output is kept before the new, for ungetch().
+ *
+ *  @return The number of bytes available, 0 at the end.
+ **/
+int CompressedDevice::fill ()
+{
+	if (!isOpen () || !mpOut)
+		return 0;
+	if (mOutPos < mOutEnd)
+		return mOutEnd - mOutPos;
+
+	if (mOutEnd > 0) {
+		mpOut[0] = mpOut[mOutEnd-1];
+		mOutPos = mOutEnd = 1;
+	}
+	while (mOutPos == mOutEnd && !mEnd) {
+		if (mInPos == mInEnd && !mDecoderFull) {
+			int bytes = mInputEnd? 0 : mpDevice->readBlock (mpIn, COMPRESS_BUFFER_SIZE);
+			if (bytes <= 0) {
+				// Ending in the middle of a frame means truncated data
+				if (bytes < 0 || !mFrameDone)
+					setStatus (IO_ReadError);
+				mInputEnd = mEnd = true;
+				break;
+			}
+			mInPos = 0;
+			mInEnd = bytes;
+			mCompressed += bytes;
+		}
+
+		const char* input = mpIn + mInPos;
+		uint inputLength = mInEnd - mInPos;
+		uint space = COMPRESS_BUFFER_SIZE + 1 - mOutEnd;
+		int bytes = decode (input, inputLength, mpOut + mOutEnd, space);
+		bool stalled = bytes == 0 && inputLength == mInEnd - mInPos && inputLength > 0;
+		if (bytes < 0 || stalled) {
+			setStatus (IO_ReadError);
+			mEnd = true;
+			break;
+		}
+		mInPos = mInEnd - inputLength;
+		mOutEnd += bytes;
+		mDecoderFull = uint (bytes) == space;
+	}
+	return mOutEnd - mOutPos;
+}
+
+/** Reads one character when the output buffer is empty. */
+int CompressedDevice::getchSlow ()
+{
+	if (fill () <= 0)
+		return -1;
+	mPosition++;
+	return (unsigned char) mpOut[mOutPos++];
+}
+
+/*******************************************************************************
+ * Returns true if all data has been read.
+ ******************************************************************************/
+bool CompressedDevice::atEnd () const
+{
+	if (mOutPos < mOutEnd)
+		return false;
+	if (!isOpen () || !isReadable () || mEnd)
+		return true;
+
+	// Decompressing ahead does not change the observable state
+	return const_cast<CompressedDevice*> (this)->fill () == 0;
+}
+
+/*******************************************************************************
+ * Reads decompressed data.
+ *
+ * @return The number of bytes read, less than asked only at the end.
+ ******************************************************************************/
+int CompressedDevice::readBlock (char* data, uint maxlen)
+{
+	uint done = 0;
+	while (done < maxlen && fill () > 0) {
+		uint bytes = mOutEnd - mOutPos;
+		if (bytes > maxlen - done)
+			bytes = maxlen - done;
+		memcpy (data + done, mpOut + mOutPos, bytes);
+		mOutPos += bytes;
+		done += bytes;
+	}
+	mPosition += done;
+	return done;
+}
+
+/*******************************************************************************
+ * Reads a line, including the newline, into the buffer, and
+ * terminates it with a zero.
+ *
+ * @return The number of bytes read, or 0 at the end.
+ ******************************************************************************/
+int CompressedDevice::readLine (char* data, uint maxlen)
+{
+	ASSERT (data && maxlen>0);
+	uint count = 0;
+	while (count < maxlen-1 && fill () > 0) {
+		uint avail = mOutEnd - mOutPos;
+		if (avail > maxlen-1 - count)
+			avail = maxlen-1 - count;
+
+		const char* start = mpOut + mOutPos;
+		const char* newline = (const char*) memchr (start, '\n', avail);
+		uint bytes = newline? newline - start + 1 : avail;
+		memcpy (data + count, start, bytes);
+		mOutPos += bytes;
+		count += bytes;
+		if (newline)
+			break;
+	}
+	data[count] = '\0';
+	mPosition += count;
+	return count;
+}
+
+/*******************************************************************************
+ * Reads a line, without the newline, into the string.
+ *
+ * @return The number of bytes read, including the newline, or 0 at
+ * the end.
+ ******************************************************************************/
+int CompressedDevice::readLine (String& str, int maxlen)
+{
+	str = "";
+	uint count = 0;
+	while ((maxlen < 0 || count < uint (maxlen)) && fill () > 0) {
+		uint avail = mOutEnd - mOutPos;
+		if (maxlen >= 0 && avail > maxlen - count)
+			avail = maxlen - count;
+
+		const char* start = mpOut + mOutPos;
+		const char* newline = (const char*) memchr (start, '\n', avail);
+		uint bytes = newline? newline - start + 1 : avail;
+		str.append (start, newline? bytes-1 : bytes);
+		mOutPos += bytes;
+		count += bytes;
+		if (newline)
+			break;
+	}
+	mPosition += count;
+	return count;
+}
+
+/*******************************************************************************
+ * Moves to the uncompressed position in a device being read. With an
+ * index, decompression starts at the frame of the position; without
+ * one, backward seeks start over from the beginning.
+ *
+ * @return true if successful, false if the position is past the end
+ * or the wrapped device can not seek.
+ ******************************************************************************/
+bool CompressedDevice::seekTo (long position)
+{
+	if (!isOpen () || !isReadable () || position < 0)
+		return false;
+	if (position == mPosition)
+		return true;
+
+	loadIndex ();
+	long start = 0, compressedStart = 0;
+	if (mIndex.size () > 0) {
+		int low = 0, high = mIndex.size () - 1;
+		while (low < high) {
+			int middle = (low + high + 1) / 2;
+			if (mIndex[middle].offset <= position)
+				low = middle;
+			else
+				high = middle - 1;
+		}
+		start = mIndex[low].offset;
+		compressedStart = mIndex[low].compressedOffset;
+	}
+
+	// Restart at the frame, unless it is already being read
+	if (position < mPosition || start > mPosition) {
+		if (!mpDevice->seek (int (compressedStart)))
+			return false;
+		resetDecoder ();
+		mFrameDone = true;
+		mInPos = mInEnd = mOutPos = mOutEnd = 0;
+		mInputEnd = mDecoderFull = mEnd = false;
+		mPosition = start;
+	}
+
+	while (mPosition < position) {
+		if (fill () <= 0)
+			return false;
+		uint bytes = mOutEnd - mOutPos;
+		if (bytes > position - mPosition)
+			bytes = position - mPosition;
+		mOutPos += bytes;
+		mPosition += bytes;
+	}
+	return true;
+}
+
+/*******************************************************************************
+ * Returns the device to read the data of the given device, which can
+ * seek: a decompressor if the data starts like gzip or zstd data, or
+ * the device itself.
+ ******************************************************************************/
+IODevice* CompressedDevice::decompressor (IODevice* device)
+{
+	unsigned char magic [4];
+	int bytes = device->readBlock ((char*) magic, 4);
+	if (bytes <= 0 || !device->seek (0))
+		return device;
+
+#ifdef HAVE_ZLIB
+	if (bytes >= 2 && magic[0] == 0x1f && magic[1] == 0x8b)
+		return new GzipDevice (device, IO_Readable);
+#endif
+#ifdef HAVE_ZSTD
+	if (bytes == 4 && compressGet32 ((const char*) magic) == ZSTD_MAGICNUMBER)
+		return new ZstdDevice (device, IO_Readable);
+#endif
+	return device;
+}
+
+
+
+#ifdef HAVE_ZLIB
+
+///////////////////////////////////////////////////////////////////////////////
+//                                                                           //
+//             ___       o       ___               o                         //
+//            /   \         ___  |  \   ___           ___   ___              //
+//            |     ---  | |   \ |   | /   ) |   | | /   \ /   )             //
+//            |  -+  /   | |___/ |   | |---   \ /  | |     |---              //
+//            \___/ ---  | |     |__/   \__    V   | \___/  \__              //
+//                                                                           //
+///////////////////////////////////////////////////////////////////////////////
+
+/** Magic of the index subfield of the extra field. */
+#define GZIP_INDEX_ID1	'M'
+#define GZIP_INDEX_ID2	'I'
+
+/** Size of the index member without the entries. */
+#define GZIP_INDEX_FIXED	30
+
+/*******************************************************************************
+ * Creates a gzip device on top of the given device, which it owns.
+ ******************************************************************************/
+GzipDevice::GzipDevice (IODevice* device,	/**< Device of the compressed data. */
+						int mode,			/**< IO_Readable to decompress, IO_Writable to compress, or 0 to open later. */
+						int level			/**< Compression level from 1 to 9. */)
+		: CompressedDevice (device, level)
+{
+	mpStream = NULL;
+	if (mode)
+		open (mode);
+}
+
+GzipDevice::~GzipDevice ()
+{
+	close ();
+	if (mpStream) {
+		inflateEnd (mpStream);
+		delete mpStream;
+	}
+}
+
+void GzipDevice::compressFrame (const char* data, uint length, PackArray<char>& out) const
+{
+	z_stream stream;
+	memset (&stream, 0, sizeof (stream));
+	if (deflateInit2 (&stream, mLevel, Z_DEFLATED, 15+16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+		out.resize (0);
+		return;
+	}
+	out.resize (deflateBound (&stream, length));
+	stream.next_in = (Bytef*) data;
+	stream.avail_in = length;
+	stream.next_out = (Bytef*) &out[0];
+	stream.avail_out = out.size ();
+	int result = deflate (&stream, Z_FINISH);
+	out.resize ((result == Z_STREAM_END)? stream.total_out : 0);
+	deflateEnd (&stream);
+}
+
+void GzipDevice::resetDecoder ()
+{
+	if (!mpStream) {
+		mpStream = new z_stream;
+		memset (mpStream, 0, sizeof (z_stream));
+		inflateInit2 (mpStream, 15+16);
+	} else
+		inflateReset (mpStream);
+}
+
+int GzipDevice::decode (const char*& input, uint& inputLength, char* output, uint outputLength)
+{
+	z_stream& stream = *mpStream;
+	stream.next_in = (Bytef*) input;
+	stream.avail_in = inputLength;
+	stream.next_out = (Bytef*) output;
+	stream.avail_out = outputLength;
+
+	// The members follow each other
+	while (true) {
+		uint before = stream.avail_in;
+		int result = inflate (&stream, Z_NO_FLUSH);
+		if (result == Z_STREAM_END) {
+			inflateReset (&stream);
+			mFrameDone = true;
+		} else if (result == Z_OK) {
+			if (stream.avail_in < before)
+				mFrameDone = false;
+		} else if (result != Z_BUF_ERROR)
+			return -1;
+		if (result == Z_BUF_ERROR || stream.avail_in == 0 || stream.avail_out == 0)
+			break;
+	}
+
+	input = (const char*) stream.next_in;
+	inputLength = stream.avail_in;
+	return outputLength - stream.avail_out;
+}
+
+/** Writes the index as an empty member, with the sizes of the frames
+ *  in a subfield of the extra field. The member ends with the number
+ *  of frames and the fixed end of an empty member.
+ **/
+void GzipDevice::writeIndex (PackArray<char>& out) const
+{
+	uint count = mIndex.size ();
+	if (count == 0 || count > (65535-8)/8)
+		return;
+
+	out.resize (GZIP_INDEX_FIXED + 8*count);
+	char* p = &out[0];
+	const unsigned char header [10] = {0x1f, 0x8b, 8, 4, 0, 0, 0, 0, 0, 255};
+	memcpy (p, header, 10);
+	compressPut16 (p+10, 8*count + 8);
+	p[12] = GZIP_INDEX_ID1;
+	p[13] = GZIP_INDEX_ID2;
+	compressPut16 (p+14, 8*count + 4);
+	p += 16;
+	for (uint i=0; i<count; i++, p += 8) {
+		compressPut32 (p, mIndex[i].compressedSize);
+		compressPut32 (p+4, mIndex[i].size);
+	}
+	compressPut32 (p, count);
+
+	// An empty final block, the CRC and the size
+	const unsigned char trailer [10] = {3, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+	memcpy (p+4, trailer, 10);
+}
+
+bool GzipDevice::readIndex ()
+{
+	long size = mpDevice->size ();
+	char tail [14];
+	if (size < GZIP_INDEX_FIXED || !readDeviceAt (size - 14, tail, 14))
+		return false;
+	const char trailer [10] = {3, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+	uint count = compressGet32 (tail);
+	if (memcmp (tail+4, trailer, 10) || count == 0 || count > (65535-8)/8 || long (GZIP_INDEX_FIXED + 8*count) > size)
+		return false;
+
+	PackArray<char> index (GZIP_INDEX_FIXED + 8*count);
+	if (!readDeviceAt (size - index.size (), &index[0], index.size ()))
+		return false;
+	const char* p = &index[0];
+	if ((unsigned char) p[0] != 0x1f || (unsigned char) p[1] != 0x8b || p[3] != 4
+		|| compressGet16 (p+10) != 8*count + 8 || p[12] != GZIP_INDEX_ID1 || p[13] != GZIP_INDEX_ID2
+		|| compressGet16 (p+14) != 8*count + 4)
+		return false;
+
+	mIndex.resize (0);
+	for (p += 16; count > 0; count--, p += 8)
+		addIndexEntry (compressGet32 (p+4), compressGet32 (p));
+	return true;
+}
+
+#endif // HAVE_ZLIB
+
+
+
+#ifdef HAVE_ZSTD
+
+///////////////////////////////////////////////////////////////////////////////
+//                                                                           //
+//           -----               | ___               o                       //
+//              /   ___   |      | |  \   ___           ___   ___            //
+//             /   (     -+-  ___| |   | /   ) |   | | /   \ /   )           //
+//            /     `--   |  /   | |   | |---   \ /  | |     |---            //
+//           -----  __)   \_ \___| |__/   \__    V   | \___/  \__            //
+//                                                                           //
+///////////////////////////////////////////////////////////////////////////////
+
+/** Magic numbers of the seek table of the seekable format. */
+#define ZSTD_SEEKABLE_MAGIC		0x8F92EAB1
+#define ZSTD_SEEKTABLE_MAGIC	0x184D2A5E
+
+/** Size of the footer of the seek table. */
+#define ZSTD_SEEKABLE_FOOTER	9
+
+/*******************************************************************************
+ * Creates a zstd device on top of the given device, which it owns.
+ ******************************************************************************/
+ZstdDevice::ZstdDevice (IODevice* device,	/**< Device of the compressed data. */
+						int mode,			/**< IO_Readable to decompress, IO_Writable to compress, or 0 to open later. */
+						int level			/**< Compression level from 1 to 19. */)
+		: CompressedDevice (device, level)
+{
+	mpStream = NULL;
+	if (mode)
+		open (mode);
+}
+
+ZstdDevice::~ZstdDevice ()
+{
+	close ();
+	ZSTD_freeDStream (mpStream);
+}
+
+void ZstdDevice::compressFrame (const char* data, uint length, PackArray<char>& out) const
+{
+	out.resize (ZSTD_compressBound (length));
+	size_t result = ZSTD_compress (&out[0], out.size (), data, length, mLevel);
+	out.resize (ZSTD_isError (result)? 0 : result);
+}
+
+void ZstdDevice::resetDecoder ()
+{
+	if (!mpStream)
+		mpStream = ZSTD_createDStream ();
+	ZSTD_DCtx_reset (mpStream, ZSTD_reset_session_only);
+}
+
+int ZstdDevice::decode (const char*& input, uint& inputLength, char* output, uint outputLength)
+{
+	ZSTD_inBuffer in = {input, inputLength, 0};
+	ZSTD_outBuffer out = {output, outputLength, 0};
+	size_t result = ZSTD_decompressStream (mpStream, &out, &in);
+	if (ZSTD_isError (result))
+		return -1;
+
+	// Zero when a frame is complete and flushed
+	mFrameDone = result == 0;
+	input += in.pos;
+	inputLength -= in.pos;
+	return out.pos;
+}
+
+/** Writes the seek table in a skippable frame: the compressed and
+ *  uncompressed sizes of the frames, and a footer with their number.
+ **/
+void ZstdDevice::writeIndex (PackArray<char>& out) const
+{
+	uint count = mIndex.size ();
+	if (count == 0)
+		return;
+
+	out.resize (8 + 8*count + ZSTD_SEEKABLE_FOOTER);
+	char* p = &out[0];
+	compressPut32 (p, ZSTD_SEEKTABLE_MAGIC);
+	compressPut32 (p+4, 8*count + ZSTD_SEEKABLE_FOOTER);
+	p += 8;
+	for (uint i=0; i<count; i++, p += 8) {
+		compressPut32 (p, mIndex[i].compressedSize);
+		compressPut32 (p+4, mIndex[i].size);
+	}
+	compressPut32 (p, count);
+	p[4] = 0;	// No checksums
+	compressPut32 (p+5, ZSTD_SEEKABLE_MAGIC);
+}
+
+bool ZstdDevice::readIndex ()
+{
+	long size = mpDevice->size ();
+	char footer [ZSTD_SEEKABLE_FOOTER];
+	if (size < 8 + ZSTD_SEEKABLE_FOOTER || !readDeviceAt (size - ZSTD_SEEKABLE_FOOTER, footer, ZSTD_SEEKABLE_FOOTER)
+		|| compressGet32 (footer+5) != ZSTD_SEEKABLE_MAGIC)
+		return false;
+
+	// Entries may have checksums, which are not used here
+	uint count = compressGet32 (footer);
+	uint entrySize = (footer[4] & 0x80)? 12 : 8;
+	long tableSize = 8 + long (count) * entrySize + ZSTD_SEEKABLE_FOOTER;
+	if (count == 0 || tableSize > size)
+		return false;
+
+	PackArray<char> table (tableSize);
+	if (!readDeviceAt (size - tableSize, &table[0], tableSize)
+		|| compressGet32 (&table[0]) != ZSTD_SEEKTABLE_MAGIC || compressGet32 (&table[4]) != tableSize - 8)
+		return false;
+
+	mIndex.resize (0);
+	for (const char* p = &table[8]; count > 0; count--, p += entrySize)
+		addIndexEntry (compressGet32 (p+4), compressGet32 (p));
+	return true;
+}
+
+#endif // HAVE_ZSTD
+
+END_NAMESPACE;
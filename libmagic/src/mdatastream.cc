@@ -24,6 +24,7 @@
 
 #include "magic/mdatastream.h"
 #include "magic/mpararr.h"
+#include "magic/mnumconv.h"
 
 BEGIN_NAMESPACE (MagiC);
 
@@ -57,6 +58,8 @@ DataOStream::DataOStream (FILE* strm) : OStream (strm) {
 	mPrevDepth	= -1;
 	mFormatMode	= FMT_TEXT;
 	mAttribs	= NULL;
+	mpBuffer	= NULL;
+	mBufLen		= 0;
 }
 
 DataOStream::DataOStream (OStream& o) : OStream (o) {
@@ -64,12 +67,81 @@ DataOStream::DataOStream (OStream& o) : OStream (o) {
 	mPrevDepth	= -1;
 	mFormatMode	= FMT_TEXT;
 	mAttribs	= NULL;
+	mpBuffer	= NULL;
+	mBufLen		= 0;
+}
+
+/** Creates a data stream writing to the given device, in text format
+ *  or, with FMT_BINARY, in the binary format.
+ **/
+DataOStream::DataOStream (IODevice& dev, int formatMode) : OStream (dev) {
+	mDepth		= 0;
+	mPrevDepth	= -1;
+	mFormatMode	= formatMode;
+	mAttribs	= NULL;
+	mpBuffer	= NULL;
+	mBufLen		= 0;
 }
 
 DataOStream::~DataOStream () {
+	flushBuffer ();
+	delete [] mpBuffer;
 	delete mAttribs;
 }
 
+/** Writes the buffered binary data and flushes the device. */
+void DataOStream::flush ()
+{
+	flushBuffer ();
+	OStream::flush ();
+}
+
+/** Writes the buffered binary data to the device. The buffer is
+ *  allocated on the first call.
+ **/
+void DataOStream::flushBuffer ()
+{
+	if (!mpBuffer) {
+		mpBuffer = new char [DATASTREAM_BUFFER_SIZE];
+		mBufLen = 0;
+	}
+	if (mBufLen > 0 && mpDevice)
+		mpDevice->writeBlock (mpBuffer, mBufLen);
+	mBufLen = 0;
+}
+
+/** Adds data that does not fit in the buffer. Blocks larger than the
+ *  buffer are written directly.
+ **/
+void DataOStream::putSlow (const char* data, uint n)
+{
+	flushBuffer ();
+	if (n >= DATASTREAM_BUFFER_SIZE) {
+		if (mpDevice)
+			mpDevice->writeBlock (data, n);
+	} else {
+		memcpy (mpBuffer, data, n);
+		mBufLen = n;
+	}
+}
+
+/** Writes an unsigned integer as a LEB128 varint: seven bits per
+ *  byte, least significant first, with the high bit set in all but
+ *  the last byte.
+ **/
+DataOStream& DataOStream::writeVarint (unsigned long long value)
+{
+	char bytes [10];
+	uint n = 0;
+	while (value >= 0x80) {
+		bytes[n++] = char (value | 0x80);
+		value >>= 7;
+	}
+	bytes[n++] = char (value);
+	put (bytes, n);
+	return *this;
+}
+
 /** If the formatting mode is FMT_RECORD, we just store
  *  the attribute name and do not actually print anything.
  **/
@@ -92,9 +164,8 @@ DataOStream& DataOStream::operator<< (char i)
 		printComma ();
 		printName ();
 		mpDevice->writeBlock ((char*) &i, sizeof(char));
-	} else { // FMT_BINARY
-		mpDevice->writeBlock ((char*) &i, sizeof(i));
-	}
+	} else // FMT_BINARY
+		put (&i, 1);
 
 	return *this;
 }
@@ -117,9 +188,11 @@ DataOStream& DataOStream::operator<< (long i)
 	if (mFormatMode & FMT_TEXT) {
 		printComma ();
 		printName ();
-		mpDevice->writeBlock (String(i));
-	} else { // FMT_BINARY
-		mpDevice->writeBlock ((char*) &i, sizeof(i));
+		char buffer [NUMCONV_LONG_BUFFER];
+		mpDevice->writeBlock (buffer, formatLong (buffer, i));
+	} else { // FMT_BINARY, zigzag-encoded so that small negative values are short
+		long long value = i;
+		writeVarint (((unsigned long long) value << 1) ^ (unsigned long long) (value >> 63));
 	}
 
 	return *this;
@@ -128,7 +201,17 @@ DataOStream& DataOStream::operator<< (long i)
 DataOStream& DataOStream::operator<< (float i)
 {
 	CHECKRECORD (float, i);
-	operator<< ((double) i);
+
+	if (!mpDevice)
+		return *this;
+
+	if (mFormatMode & FMT_TEXT)
+		operator<< ((double) i);
+	else { // FMT_BINARY
+		char bytes [sizeof(i)];
+		copyLE (bytes, (const char*) &i, sizeof(i), 1);
+		put (bytes, sizeof(i));
+	}
 	return *this;
 }
 
@@ -142,9 +225,12 @@ DataOStream& DataOStream::operator<< (double i)
 	if (mFormatMode & FMT_TEXT) {
 		printComma ();
 		printName ();
-		mpDevice->writeBlock (String(i));
+		char buffer [NUMCONV_DOUBLE_BUFFER];
+		mpDevice->writeBlock (buffer, formatDouble (buffer, i));
 	} else { // FMT_BINARY
-		mpDevice->writeBlock ((char*) &i, sizeof(i));
+		char bytes [sizeof(i)];
+		copyLE (bytes, (const char*) &i, sizeof(i), 1);
+		put (bytes, sizeof(i));
 	}
 
 	return *this;
@@ -160,9 +246,12 @@ DataOStream& DataOStream::operator<< (CONSTR str)
 	if (mFormatMode & FMT_TEXT) {
 		printComma ();
 		printName ();
+		mpDevice->writeBlock (str, strlen(str));
+	} else { // FMT_BINARY, as a String
+		uint len = str? strlen (str) : 0;
+		writeVarint (len);
+		put (str, len);
 	}
-
-	mpDevice->writeBlock (str, strlen(str));
 	return *this;
 }
 
@@ -173,7 +262,13 @@ DataOStream& DataOStream::operator<< (const String& str)
 	if (!mpDevice)
 		return *this;
 
-	return str.operator>> (*this);
+	if (mFormatMode & FMT_TEXT)
+		return str.operator>> (*this);
+
+	// FMT_BINARY
+	writeVarint (str.length ());
+	put (str, str.length ());
+	return *this;
 }
 
 uint DataOStream::writeRawBytes (const char* p, uint n)
@@ -197,8 +292,10 @@ uint DataOStream::writeRawBytes (const char* p, uint n)
 			mpDevice->putch ('"');
 			return wrote + 2;
 		}
-	} else // FMT_BINARY
-		return mpDevice->writeBlock (p, n);
+	} else { // FMT_BINARY
+		put (p, n);
+		return n;
+	}
 	
 	return 0;
 }
@@ -244,11 +341,66 @@ void DataOStream::printComma ()
 //                                                                           //
 ///////////////////////////////////////////////////////////////////////////////
 
+/** Reads data that is not in the buffer. Blocks larger than the
+ *  buffer are read directly.
+ *
+ *  @exception io_error if the stream ends before all the data.
+ **/
+void DataIStream::getSlow (char* data, uint n)
+{
+	if (!mpDevice)
+		throw io_error ("Reading from a data stream without a device.");
+	if (!mpBuffer)
+		mpBuffer = new char [DATASTREAM_BUFFER_SIZE];
+
+	uint done = mBufEnd - mBufPos;
+	memcpy (data, mpBuffer + mBufPos, done);
+	mBufPos = mBufEnd = 0;
+
+	while (done < n) {
+		uint left = n - done;
+		if (left >= DATASTREAM_BUFFER_SIZE) {
+			int bytes = mpDevice->readBlock (data + done, left);
+			if (bytes <= 0)
+				break;
+			done += bytes;
+		} else {
+			int bytes = mpDevice->readBlock (mpBuffer, DATASTREAM_BUFFER_SIZE);
+			if (bytes <= 0)
+				break;
+			mBufEnd = bytes;
+			mBufPos = (uint (bytes) < left)? bytes : left;
+			memcpy (data + done, mpBuffer, mBufPos);
+			done += mBufPos;
+		}
+	}
+
+	if (done != n)
+		throw io_error (String("Data stream ended unexpectedly (expected %1 bytes, got %2).")
+						.arg((int) n).arg((int) done));
+}
+
+/** Reads an unsigned LEB128 varint. */
+unsigned long long DataIStream::readVarint ()
+{
+	unsigned long long value = 0;
+	for (int shift = 0; shift < 64; shift += 7) {
+		char byte;
+		get (&byte, 1);
+		value |= (unsigned long long) (byte & 0x7f) << shift;
+		if (!(byte & 0x80))
+			return value;
+	}
+	throw io_error ("Too long varint in data stream.");
+}
+
 /** Read integer value from stream. */
 DataIStream& DataIStream::operator>> (int& i)
 {
 	long i2=i;
 	operator>> (i2);
+	if (i2 != int (i2))
+		throw io_error (String("Value %1 read from data stream does not fit in an int.").arg(i2));
 	i=i2;
 	return *this;
 }
@@ -256,44 +408,57 @@ DataIStream& DataIStream::operator>> (int& i)
 /** Read long value from stream. */
 DataIStream& DataIStream::operator>> (long& i)
 {
-	int retval = mpDevice->readBlock ((char*) &i, sizeof(i));
-	if (retval != sizeof(i))
-		throw io_error ("Reading long value from text stream failed.");
+	unsigned long long value = readVarint ();
+	long long decoded = (long long) (value >> 1) ^ -(long long) (value & 1);
+	if (decoded != (long) decoded)
+		throw io_error ("Value read from data stream does not fit in a long.");
+	i = decoded;
 	return *this;
 }
 
 /** Read character from stream. */
 DataIStream& DataIStream::operator>> (char& i)
 {
-	int retval = mpDevice->readBlock ((char*) &i, sizeof(i));
-	if (retval != sizeof(i))
-		throw io_error ("Reading char value from text stream failed.");
+	get (&i, 1);
 	return *this;
 }
 
 /** Read float from stream. */
 DataIStream& DataIStream::operator>> (float& i)
 {
-	int retval = mpDevice->readBlock ((char*) &i, sizeof(i));
-	if (retval != sizeof(i))
-		throw io_error ("Reading float value from text stream failed.");
+	char bytes [sizeof(i)];
+	get (bytes, sizeof(i));
+	copyLE ((char*) &i, bytes, sizeof(i), 1);
 	return *this;
 }
 
 /** Read double from stream. */
 DataIStream& DataIStream::operator>> (double& i /**< Output reference. */)
 {
-	int retval = mpDevice->readBlock ((char*) &i, sizeof(i));
-	if (retval != sizeof(i))
-		throw io_error ("Reading double value from text stream failed.");
+	char bytes [sizeof(i)];
+	get (bytes, sizeof(i));
+	copyLE ((char*) &i, bytes, sizeof(i), 1);
 	return *this;
 }
 
+/** Read string from stream, stored as its length and characters. */
 DataIStream& DataIStream::operator>> (String& s)
 {
-	/* Use the serialization provided by the string object. */
-	s.String::operator<< (*this);
-	
+	unsigned long long len = readVarint ();
+	if (len > 0x7fffffff)
+		throw io_error ("Invalid string length in data stream.");
+
+	s.empty ();
+	if (mBufPos + len <= mBufEnd) {
+		// Directly from the buffer
+		s.append (mpBuffer + mBufPos, len);
+		mBufPos += len;
+	} else {
+		char* data = new char [len];
+		get (data, len);
+		s.append (data, len);
+		delete [] data;
+	}
 	return *this;
 }
 
@@ -304,13 +469,8 @@ uint DataIStream::readRawBytes (char* p, /**< Buffer for reading.   */
 	if (!mpDevice)
 		return 0;
 
-	uint retval = mpDevice->readBlock (p, n);
-
-	if (retval != n)
-		throw io_error (String("Data stream ended unexpectedly (expected %1 bytes, got %2.")
-						.arg((int) n).arg((int) retval));
-
-	return retval;
+	get (p, n);
+	return n;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -51,6 +51,7 @@ IODevice::IODevice ()
 	mMode = 0;
 	mState = 0;
 	mStatus = 0;
+	mStreams = 0;
 }
 
 /*******************************************************************************
@@ -301,12 +302,33 @@ Ref<String> IODevice::readAll ()
 /*******************************************************************************
  * Reads all newline (\\n) terminated lines from device.
  *
+ *  The device is read in blocks, which are split to lines, so the
+ *  lines may be of any length. The last line is returned even if it
+ *  has no newline.
+ *
  *  @return Returns list of the lines, including the terminating
- *  newline characters.
+ *  newline characters. The caller owns the list.
  ******************************************************************************/
 List<String>* IODevice::readLines ()
 {
 	List<String>* result = new List<String> ();
+	String* partial = NULL; // Last line, if its newline is not read yet
+	char buffer[16384];
+
+	while (!atEnd()) {
+		int bytesread = readBlock (buffer, sizeof (buffer));
+		if (bytesread <= 0)
+			break;
+
+		for (const char* line = buffer; line < buffer+bytesread;) {
+			const char* newline = (const char*) memchr (line, '\n', buffer+bytesread-line);
+			const char* end = newline? newline+1 : buffer+bytesread;
+			String& item = partial? *partial : result->addNew ();
+			item.append (line, end-line);
+			partial = newline? NULL : &item;
+			line = end;
+		}
+	}
 
 	return result;
 }
@@ -526,8 +548,8 @@ uint File::size () const
 	// Get the file status
 	int callResult = stat ((CONSTR) mName, &statbuf);
 
-	if (!callResult)
-		throw system_failure (i18n("System error '%1' while checking the size of file '%1'.")
+	if (callResult != 0)
+		throw system_failure (i18n("System error '%1' while checking the size of file '%2'.")
 							  .arg(strerror(errno)).arg(mName));
 
 	return statbuf.st_size;
@@ -559,10 +581,7 @@ bool File::seek (int position)
 
 	int callResult = fseek (mpFile, (long) position, SEEK_SET);
 
-	if (!callResult)
-		return false;
-
-	return true;
+	return callResult == 0;
 }
 
 /*******************************************************************************
@@ -716,11 +735,11 @@ void File::ungetch (char ch)
 }
 
 /*******************************************************************************
- *
+ * Returns the file descriptor, or -1 if the file is not open.
  ******************************************************************************/
-int File::handle ()
+int File::handle () const
 {
-	return mFd;
+	return mpFile? mFd : -1;
 }
 
 /*******************************************************************************
@@ -889,12 +908,11 @@ int Buffer::readLine (char* data, uint maxlen)
 
 	int  remains    = mpBuffer->length() - mPosition;			    // How far is the end of buffer
 	int  maxread    = ((uint) remains > maxlen)? maxlen : remains;	// How many bytes can actually be read
-	uint newlinePos = mPosition;
+	const char* start = ((const char*) *mpBuffer) + mPosition;
 
-	// Find the next newline
-	for (uint i=0; i < (uint) maxread; i++)
-		if ((*mpBuffer)[newlinePos++] == '\n')
-			break;
+	// Find the next newline, which is included in the line
+	const char* newline = (const char*) memchr (start, '\n', maxread);
+	uint newlinePos = mPosition + (newline? newline-start+1 : maxread);
 
 	// How much was actually read
 	int readcount = newlinePos - mPosition;
@@ -22,23 +22,53 @@
  *                                                                         *
  ***************************************************************************/
 
-#include <magic/mlog.h>
-#include <magic/mstring.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdarg.h>
 #include <stdexcept>
 #include <time.h>
+#include <ctype.h>
+#include <errno.h>
+#include <sched.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <magic/mlog.h>
+#include <magic/mstring.h>
+#include <magic/mpackarray.h>
 
 BEGIN_NAMESPACE (MagiC);
 
+static const char* logFatalities[8] = {"EMERGENCY",
+									   "ALERT",
+									   "CRITICAL",
+									   "ERROR",
+									   "WARNING",
+									   "NOTICE",
+									   "INFO",
+									   "DEBUG"};
+
+/** Releases the module stack of an exiting thread. */
+static void logModulesExit (void* modules)
+{
+	delete (PackArray<String>*) modules;
+}
+
 Log::Log ()
 {
-	mModuleDepth = 0;
+	pthread_key_create (&mModuleKey, logModulesExit);
+	mLevel = Debug;
 }
 
+/*******************************************************************************
+ * Releases the module stack of the calling thread. The stacks of the
+ * other threads are released when they exit, so the log should be
+ * destroyed after the threads that pushed modules to it.
+ ******************************************************************************/
 Log::~Log ()
 {
+	delete (PackArray<String>*) pthread_getspecific (mModuleKey);
+	pthread_key_delete (mModuleKey);
 }
 
 /*******************************************************************************
@@ -56,6 +86,11 @@ Log::~Log ()
 /*******************************************************************************
  * Writes a log message
  *
+ * A message less severe than the level of the log is dropped here,
+ * before it is formatted. The arguments are evaluated nevertheless;
+ * use @ref MLOG to skip them too. Without a module name, the module
+ * pushed last by the calling thread is used.
+ *
  * \par Example:
  * \code
  * 		mpLog->message ("SERVER",
@@ -74,6 +109,13 @@ int Log::message (
 	const char* msg,        /**< Message (as a format string for printf).    */
 	...)
 {
+	/* Invalid fatalities are left for the log to report. */
+	if (!enabled (fatality) && fatality <= Debug)
+		return 0;
+
+	if (!modulename)
+		modulename = currentModule ();
+
 	/* Open ellipsis list. */
 	va_list v_args;
 	va_start (v_args, msg);
@@ -94,12 +136,14 @@ int Log::message (
 
 int Log::info (const char* msg, ...)
 {
+	if (!enabled (Info))
+		return 0;
+
 	/* Open ellipsis list. */
 	va_list v_args;
 	va_start (v_args, msg);
 
-	int result = message (mModuleDepth>0? mModules[mModuleDepth-1] : NULL,
-						  Log::Info, 0, msg, v_args);
+	int result = message (currentModule (), Log::Info, 0, msg, v_args);
 
 	/* Close the ellipsis handling. */
 	va_end (v_args);
@@ -108,27 +152,41 @@ int Log::info (const char* msg, ...)
 }
 
 /*******************************************************************************
- * Pushes module name to stack
+ * Pushes module name to the stack of the calling thread
  ******************************************************************************/
 void Log::pushModule (const char* modulename)
 {
-	if (mModules.size() < mModuleDepth+1)
-		mModules.resize (mModules.size()+1);
-	mModules[mModuleDepth++] = modulename;
+	PackArray<String>* modules = (PackArray<String>*) pthread_getspecific (mModuleKey);
+	if (!modules) {
+		modules = new PackArray<String> ();
+		pthread_setspecific (mModuleKey, modules);
+	}
+	modules->add (modulename);
 }
 
 /*******************************************************************************
- * Pops module name from stack
+ * Pops module name from the stack of the calling thread
  *
  * You must call this function before exiting the function where you
  * pushed the module.
  ******************************************************************************/
 void Log::popModule ()
 {
-	if (mModuleDepth > 0)
-		mModuleDepth--;
+	PackArray<String>* modules = (PackArray<String>*) pthread_getspecific (mModuleKey);
+	if (modules && modules->size () > 0)
+		modules->resize (modules->size ()-1);
 }
 
+/*******************************************************************************
+ * Returns the module pushed last by the calling thread, or NULL if none.
+ ******************************************************************************/
+const char* Log::currentModule () const
+{
+	PackArray<String>* modules = (PackArray<String>*) pthread_getspecific (mModuleKey);
+	if (!modules || modules->size () == 0)
+		return NULL;
+	return (*modules)[modules->size ()-1];
+}
 
 /*******************************************************************************
  * \fn int Log::write (const char* data, int len)=0;
@@ -136,6 +194,842 @@ void Log::popModule ()
  * Writes to the log.
  ******************************************************************************/
 
+/*******************************************************************************
+ * Asynchronous writing of LogFile
+ *
+ * Each thread that writes messages has a ring buffer of its own, so
+ * the threads never wait for each other. A message is put in the
+ * ring with its module name, its format string and a copy of its
+ * arguments; the arguments are read from the va_list by the
+ * conversions of the format string. The formatting is left to the
+ * writer thread, which takes the messages from all the rings, formats
+ * them to blocks of lines and writes the blocks with one writev().
+ ******************************************************************************/
+
+/** Bytes in one block of formatted lines. */
+#define LOG_WRITE_BLOCK		65536
+
+/** Bytes of a message the posting thread collects on its stack before
+ *  copying it to the ring; larger messages are allocated.
+ **/
+#define LOG_LOCAL_RECORD	512
+
+/** Kinds of records in a @ref LogRing. */
+enum {LOGREC_MESSAGE,	/**< A @ref LogMessage follows the record.             */
+	  LOGREC_HEAP,		/**< A pointer to an allocated @ref LogMessage follows. */
+	  LOGREC_PAD		/**< Unused space up to the end of the ring.           */};
+
+/** Header of a record in a @ref LogRing. */
+struct LogRecord {
+	unsigned int	size;		/**< Bytes with the header, a multiple of 8. */
+	unsigned int	type;
+};
+
+/** A message as it is posted. Followed by the module name and the
+ *  format string with their terminating zeros, and then by the
+ *  arguments at the next multiple of 8 bytes.
+ **/
+struct LogMessage {
+	time_t			time;
+	int				fatality;
+	int				errnum;
+	int				moduleLen;	/**< Length of the module name, or -1 if none.  */
+	int				formatLen;
+	int				formatted;	/**< Is the format the message itself?          */
+	int				argsLen;
+};
+
+/** Ring buffer of the messages of one thread. The thread only moves
+ *  the head and the writer only the tail.
+ **/
+struct LogRing {
+	char*			data;
+	unsigned long	capacity;	/**< A power of two. */
+	int				closed;		/**< Set when the thread has exited. */
+	char			pad1 [64];
+	unsigned long	head;
+	char			pad2 [64];
+	unsigned long	tail;
+};
+
+static inline int logAlign (int n) {return (n+7) & ~7;}
+
+/** Marks the ring of an exiting thread, for the writer to release. */
+static void logRingExit (void* ring)
+{
+	__atomic_store_n (&((LogRing*) ring)->closed, 1, __ATOMIC_RELEASE);
+}
+
+/** A printf() conversion specification. */
+struct LogSpec {
+	const char*	flags;		/**< After the '%'. */
+	const char*	flagsEnd;
+	int			width;		/**< -1 if none, -2 if given as an argument. */
+	int			precision;	/**< -1 if none, -2 if given as an argument. */
+	char		length;		/**< 0, 'H' for hh, 'h', 'l', 'q' for ll, 'j', 'z', 't' or 'L'. */
+	char		conversion;
+};
+
+/** Parses the conversion specification at the '%'. Returns the end of
+ *  the specification, or NULL if the arguments of the conversion can
+ *  not be copied, such as with %n or the wide characters.
+ **/
+static const char* logParseSpec (const char* p, LogSpec& spec)
+{
+	spec.flags = ++p;
+	while (*p && strchr ("-+ #0'", *p))
+		p++;
+	spec.flagsEnd = p;
+
+	spec.width = -1;
+	if (*p == '*') {
+		spec.width = -2;
+		p++;
+	} else if (isdigit (*p))
+		for (spec.width = 0; isdigit (*p); p++)
+			spec.width = spec.width*10 + *p-'0';
+
+	spec.precision = -1;
+	if (*p == '.') {
+		p++;
+		if (*p == '*') {
+			spec.precision = -2;
+			p++;
+		} else
+			for (spec.precision = 0; isdigit (*p); p++)
+				spec.precision = spec.precision*10 + *p-'0';
+	}
+
+	spec.length = 0;
+	if (*p == 'h' || *p == 'l') {
+		spec.length = *p++;
+		if (*p == spec.length) {
+			spec.length = (spec.length == 'h')? 'H' : 'q';
+			p++;
+		}
+	} else if (*p && strchr ("qjztL", *p))
+		spec.length = *p++;
+
+	spec.conversion = *p;
+	if (!*p || !strchr ("diouxXcspfFeEgGaA%", *p))
+		return NULL;
+	bool isFloat = strchr ("fFeEgGaA", *p);
+	if (spec.length && (strchr ("csp%", *p) || (isFloat && spec.length != 'l' && spec.length != 'L')
+						|| (!isFloat && spec.length == 'L')))
+		return NULL;
+	return p+1;
+}
+
+/** Writes the arguments to a buffer, each at a multiple of 8 bytes. */
+struct LogArgs {
+	char*	data;
+	int		room;
+	int		used;
+
+	void	put		(const void* value, int len) {
+		if (used + len <= room)
+			memcpy (data+used, value, len);
+		used += logAlign (len);
+	}
+};
+
+/** Copies the arguments of the format to the buffer of the given
+ *  room. Returns the bytes the arguments need, which may be more than
+ *  the room, or -1 if the format has a conversion that can not be
+ *  copied.
+ **/
+static int logCaptureArgs (char* data, int room, const char* fmt, va_list args)
+{
+	LogArgs out = {data, room, 0};
+	for (const char* p = fmt; (p = strchr (p, '%'));) {
+		LogSpec spec;
+		if (!(p = logParseSpec (p, spec)))
+			return -1;
+		if (spec.width == -2) {
+			int width = va_arg (args, int);
+			out.put (&width, sizeof (width));
+		}
+		int precision = spec.precision;
+		if (precision == -2) {
+			precision = va_arg (args, int);
+			out.put (&precision, sizeof (precision));
+		}
+
+		switch (spec.conversion) {
+		  case 'd': case 'i': {
+			  long long value;
+			  switch (spec.length) {
+				case 'H': value = (signed char) va_arg (args, int); break;
+				case 'h': value = (short) va_arg (args, int); break;
+				case 'l': value = va_arg (args, long); break;
+				case 'q': value = va_arg (args, long long); break;
+				case 'j': value = va_arg (args, intmax_t); break;
+				case 'z': value = va_arg (args, ssize_t); break;
+				case 't': value = va_arg (args, ptrdiff_t); break;
+				default:  value = va_arg (args, int);
+			  }
+			  out.put (&value, sizeof (value));
+		  } break;
+		  case 'o': case 'u': case 'x': case 'X': {
+			  unsigned long long value;
+			  switch (spec.length) {
+				case 'H': value = (unsigned char) va_arg (args, unsigned int); break;
+				case 'h': value = (unsigned short) va_arg (args, unsigned int); break;
+				case 'l': value = va_arg (args, unsigned long); break;
+				case 'q': value = va_arg (args, unsigned long long); break;
+				case 'j': value = va_arg (args, uintmax_t); break;
+				case 'z': value = va_arg (args, size_t); break;
+				case 't': value = va_arg (args, ptrdiff_t); break;
+				default:  value = va_arg (args, unsigned int);
+			  }
+			  out.put (&value, sizeof (value));
+		  } break;
+		  case 'c': {
+			  int value = va_arg (args, int);
+			  out.put (&value, sizeof (value));
+		  } break;
+		  case 's': {
+			  const char* value = va_arg (args, const char*);
+			  if (!value)
+				  value = "(null)";
+			  int len = (precision >= 0)? strnlen (value, precision) : strlen (value);
+			  out.put (&len, sizeof (len));
+			  if (out.used + len + 1 <= out.room) {
+				  memcpy (out.data + out.used, value, len);
+				  out.data [out.used + len] = '\0';
+			  }
+			  out.used += logAlign (len+1);
+		  } break;
+		  case 'p': {
+			  void* value = va_arg (args, void*);
+			  out.put (&value, sizeof (value));
+		  } break;
+		  case '%':
+			  break;
+		  default:
+			  if (spec.length == 'L') {
+				  long double value = va_arg (args, long double);
+				  out.put (&value, sizeof (value));
+			  } else {
+				  double value = va_arg (args, double);
+				  out.put (&value, sizeof (value));
+			  }
+		}
+	}
+	return out.used;
+}
+
+/** A line being formatted by the writer. */
+struct LogLine {
+	char*	data;
+	int		length;
+	int		capacity;
+
+			LogLine		() : data (new char [256]), length (0), capacity (256) {}
+			~LogLine	() {delete [] data;}
+
+	void	reserve		(int size) {
+		if (size <= capacity)
+			return;
+		while (capacity < size)
+			capacity *= 2;
+		char* grown = new char [capacity];
+		memcpy (grown, data, length);
+		delete [] data;
+		data = grown;
+	}
+
+	void	append		(const char* text, int len) {
+		reserve (length+len);
+		memcpy (data+length, text, len);
+		length += len;
+	}
+
+	void	appendf		(const char* fmt, ...) {
+		va_list args;
+		va_start (args, fmt);
+		int len = vsnprintf (data+length, capacity-length, fmt, args);
+		va_end (args);
+		if (len >= capacity-length) {
+			reserve (length+len+1);
+			va_start (args, fmt);
+			vsnprintf (data+length, capacity-length, fmt, args);
+			va_end (args);
+		}
+		length += len;
+	}
+};
+
+/** Reads a copied argument, if the arguments have it. */
+static bool logTake (const char*& args, const char* end, void* value, int len)
+{
+	if (end - args < len)
+		return false;
+	memcpy (value, args, len);
+	args += logAlign (len);
+	return true;
+}
+
+/** Formats the copied arguments by the format to the line. Stops at
+ *  the first conversion whose argument is missing, so that a damaged
+ *  binary log can be rendered too.
+ *
+ * \return false if the arguments ran out.
+ **/
+static bool logRenderArgs (LogLine& line, const char* fmt, const char* args, const char* end)
+{
+	const char* p = fmt;
+	for (const char* pct; (pct = strchr (p, '%')); ) {
+		line.append (p, pct-p);
+		LogSpec spec;
+		if (!(p = logParseSpec (pct, spec)))
+			return false;
+		if (spec.conversion == '%') {
+			line.append ("%", 1);
+			continue;
+		}
+
+		// The specification with the numbers and the length for the copied value
+		char conv [64];
+		int len = 0;
+		conv[len++] = '%';
+		int flagsLen = (spec.flagsEnd - spec.flags < 16)? spec.flagsEnd - spec.flags : 16;
+		memcpy (conv+len, spec.flags, flagsLen);
+		len += flagsLen;
+		int width = spec.width;
+		if (width == -2) {
+			if (!logTake (args, end, &width, sizeof (width)))
+				return false;
+			if (width < 0) {
+				conv[len++] = '-';
+				width = -width;
+			}
+		}
+		if (width >= 0)
+			len += sprintf (conv+len, "%d", width);
+		int precision = spec.precision;
+		if (precision == -2 && !logTake (args, end, &precision, sizeof (precision)))
+			return false;
+		if (precision >= 0)
+			len += sprintf (conv+len, ".%d", precision);
+
+		switch (spec.conversion) {
+		  case 'd': case 'i': case 'o': case 'u': case 'x': case 'X': {
+			  long long value;
+			  if (!logTake (args, end, &value, sizeof (value)))
+				  return false;
+			  sprintf (conv+len, "ll%c", spec.conversion);
+			  line.appendf (conv, value);
+		  } break;
+		  case 'c': {
+			  int value;
+			  if (!logTake (args, end, &value, sizeof (value)))
+				  return false;
+			  sprintf (conv+len, "c");
+			  line.appendf (conv, value);
+		  } break;
+		  case 's': {
+			  int strLen;
+			  if (!logTake (args, end, &strLen, sizeof (strLen))
+				  || strLen < 0 || end - args < strLen+1 || args[strLen])
+				  return false;
+			  sprintf (conv+len, "s");
+			  line.appendf (conv, args);
+			  args += logAlign (strLen+1);
+		  } break;
+		  case 'p': {
+			  void* value;
+			  if (!logTake (args, end, &value, sizeof (value)))
+				  return false;
+			  sprintf (conv+len, "p");
+			  line.appendf (conv, value);
+		  } break;
+		  default:
+			  if (spec.length == 'L') {
+				  long double value;
+				  if (!logTake (args, end, &value, sizeof (value)))
+					  return false;
+				  sprintf (conv+len, "L%c", spec.conversion);
+				  line.appendf (conv, value);
+			  } else {
+				  double value;
+				  if (!logTake (args, end, &value, sizeof (value)))
+					  return false;
+				  sprintf (conv+len, "%c", spec.conversion);
+				  line.appendf (conv, value);
+			  }
+		}
+	}
+	line.append (p, strlen (p));
+	return true;
+}
+
+/** Formats the time as at the start of a line. */
+static void logFormatTime (time_t time, char* text, int size)
+{
+	struct tm timeTm;
+	localtime_r (&time, &timeTm);
+	if (!strftime (text, size, "%Y/%m/%d %H:%M:%S ", &timeTm))
+		text[0] = '\0';
+}
+
+/** Seconds by the monotonic clock. */
+static double logNow ()
+{
+	struct timespec now;
+	clock_gettime (CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+/*******************************************************************************
+ * Background writer of an asynchronous @ref LogFile.
+ ******************************************************************************/
+class LogWriter : public Thread {
+  public:
+						LogWriter	(int fd, int bufferSize, LogOverflow overflow,
+									 double flushInterval, int flushBytes);
+						~LogWriter	();
+
+	int					post		(const char* modulename, int fatality, int errnum,
+									 const char* message, va_list args);
+	void				flush		();
+	void				stop		();
+	long				dropped		() const {return __atomic_load_n (&mDropped, __ATOMIC_RELAXED);}
+
+  protected:
+	virtual void*		execute		();
+
+  private:
+	LogRing*			ring		();
+	void				wake		();
+	int					drain		();
+	void				render		(const LogMessage* message);
+	void				addLine		(const char* data, int len);
+	void				writeOut	();
+	void				writeAll	(struct iovec* iov, int count);
+	const char*			timeText	(time_t time);
+
+	// Settings
+	int					mFd;
+	unsigned long		mBufferSize;
+	LogOverflow			mOverflow;
+	double				mFlushInterval;
+
+	// Shared with the posting threads
+	pthread_key_t		mKey;		/**< Ring of each thread. */
+	Mutex				mRingLock;	/**< Guards mRings. */
+	PackArray<LogRing*>	mRings;
+	Semaphore			mWake;
+	int					mWakePending;
+	int					mStopping;
+	long				mDropped;
+	long				mFlushRequested;
+	long				mFlushDone;
+	Mutex				mFlushLock;	/**< Guards mFlushDone. */
+	ConditionVariable	mFlushed;
+
+	// Used by the writer thread only
+	PackArray<LogRing*>	mSnapshot;
+	char**				mBlocks;
+	int*				mBlockUsed;
+	int					mBlockCount;
+	int					mCurrent;	/**< Block being filled. */
+	long				mPending;	/**< Bytes in the blocks. */
+	long				mDroppedReported;
+	LogLine				mLine;
+	time_t				mLineTime;
+	char				mTimeText [32];
+};
+
+LogWriter::LogWriter (int fd, int bufferSize, LogOverflow overflow, double flushInterval, int flushBytes)
+{
+	mFd = fd;
+	for (mBufferSize = 4096; mBufferSize < (unsigned long) bufferSize; mBufferSize *= 2)
+		;
+	mOverflow = overflow;
+	mFlushInterval = (flushInterval > 0.0)? flushInterval : 0.1;
+	pthread_key_create (&mKey, logRingExit);
+	mWakePending = 0;
+	mStopping = 0;
+	mDropped = 0;
+	mFlushRequested = 0;
+	mFlushDone = 0;
+
+	mBlockCount = flushBytes / LOG_WRITE_BLOCK;
+	if (mBlockCount < 1)
+		mBlockCount = 1;
+	if (mBlockCount > 64)
+		mBlockCount = 64;
+	mBlocks = new char* [mBlockCount];
+	mBlockUsed = new int [mBlockCount];
+	for (int i=0; i<mBlockCount; i++) {
+		mBlocks[i] = new char [LOG_WRITE_BLOCK];
+		mBlockUsed[i] = 0;
+	}
+	mCurrent = 0;
+	mPending = 0;
+	mDroppedReported = 0;
+	mLineTime = -1;
+}
+
+/*******************************************************************************
+ * Releases the rings. The writer must have been stopped, and the
+ * threads that posted must not exit during the destruction.
+ ******************************************************************************/
+LogWriter::~LogWriter ()
+{
+	pthread_key_delete (mKey);
+	for (int i=0; i<mRings.size (); i++) {
+		delete [] mRings[i]->data;
+		delete mRings[i];
+	}
+	for (int i=0; i<mBlockCount; i++)
+		delete [] mBlocks[i];
+	delete [] mBlocks;
+	delete [] mBlockUsed;
+}
+
+/** Returns the ring of the calling thread, making it at first call. */
+LogRing* LogWriter::ring ()
+{
+	LogRing* ring = (LogRing*) pthread_getspecific (mKey);
+	if (!ring) {
+		ring = new LogRing;
+		ring->data = new char [mBufferSize];
+		ring->capacity = mBufferSize;
+		ring->closed = 0;
+		ring->head = 0;
+		ring->tail = 0;
+		pthread_setspecific (mKey, ring);
+
+		MutexLocker locker (mRingLock);
+		mRings.add (ring);
+	}
+	return ring;
+}
+
+/** Wakes up the writer, unless it has already been woken up. */
+void LogWriter::wake ()
+{
+	if (!__atomic_exchange_n (&mWakePending, 1, __ATOMIC_ACQ_REL))
+		mWake.post ();
+}
+
+/*******************************************************************************
+ * Puts a message in the ring of the calling thread.
+ *
+ * The message is copied with its arguments to a buffer on the stack,
+ * and from there to the ring. A message too large for the stack
+ * buffer or a quarter of the ring is allocated, and only the pointer
+ * is put in the ring. A message whose arguments can not be copied is
+ * formatted here.
+ *
+ * \return 0 if successful, MERR_LOG_DROPPED if the ring was full and
+ * the overflow policy is LOG_DROP.
+ ******************************************************************************/
+int LogWriter::post (const char* modulename, int fatality, int errnum,
+					 const char* message, va_list args)
+{
+	char local [LOG_LOCAL_RECORD];
+	LogMessage head;
+	head.time = time (NULL);
+	head.fatality = fatality;
+	head.errnum = errnum;
+	head.moduleLen = modulename? strlen (modulename) : -1;
+	head.formatLen = strlen (message);
+	head.formatted = 0;
+
+	va_list argsCopy;
+	va_copy (argsCopy, args);
+	int argsAt = logAlign (sizeof (LogMessage) + head.moduleLen+1 + head.formatLen+1);
+	if (argsAt < LOG_LOCAL_RECORD)
+		head.argsLen = logCaptureArgs (local+argsAt, LOG_LOCAL_RECORD-argsAt, message, args);
+	else
+		head.argsLen = logCaptureArgs (NULL, 0, message, args);
+	String formatted;
+	if (head.argsLen < 0) {
+		formatted = vstrformat (message, argsCopy);
+		message = formatted;
+		head.formatLen = formatted.length ();
+		head.formatted = 1;
+		head.argsLen = 0;
+		argsAt = logAlign (sizeof (LogMessage) + head.moduleLen+1 + head.formatLen+1);
+	}
+
+	// The message goes to the ring itself or to an allocated buffer
+	int size = argsAt + head.argsLen;
+	bool inRing = size <= LOG_LOCAL_RECORD && (unsigned long) size + sizeof (LogRecord) <= mBufferSize/4;
+	char* record = inRing? local : new char [size];
+	if (!inRing && !head.formatted)
+		logCaptureArgs (record+argsAt, head.argsLen, message, argsCopy);
+	va_end (argsCopy);
+	memcpy (record, &head, sizeof (head));
+	char* text = record + sizeof (LogMessage);
+	if (modulename) {
+		memcpy (text, modulename, head.moduleLen+1);
+		text += head.moduleLen+1;
+	}
+	memcpy (text, message, head.formatLen+1);
+
+	// Reserves the room, with a padding record if the ring wraps
+	LogRing* pRing = ring ();
+	unsigned int recordSize = sizeof (LogRecord) + (inRing? logAlign (size) : sizeof (char*));
+	unsigned long ringHead = pRing->head;
+	unsigned long pos, contiguous, used;
+	for (;;) {
+		pos = ringHead & (pRing->capacity-1);
+		contiguous = pRing->capacity - pos;
+		used = ringHead - __atomic_load_n (&pRing->tail, __ATOMIC_ACQUIRE);
+		if (used + recordSize + ((recordSize > contiguous)? contiguous : 0) <= pRing->capacity)
+			break;
+		if (mOverflow == LOG_DROP) {
+			if (!inRing)
+				delete [] record;
+			__atomic_add_fetch (&mDropped, 1, __ATOMIC_RELAXED);
+			wake ();
+			return MERR_LOG_DROPPED;
+		}
+		wake ();
+		sched_yield ();
+	}
+	if (recordSize > contiguous) {
+		LogRecord* pad = (LogRecord*) (pRing->data + pos);
+		pad->size = contiguous;
+		pad->type = LOGREC_PAD;
+		ringHead += contiguous;
+		pos = 0;
+	}
+
+	LogRecord* rec = (LogRecord*) (pRing->data + pos);
+	rec->size = recordSize;
+	if (inRing) {
+		rec->type = LOGREC_MESSAGE;
+		memcpy (rec+1, record, size);
+	} else {
+		rec->type = LOGREC_HEAP;
+		memcpy (rec+1, &record, sizeof (record));
+	}
+	__atomic_store_n (&pRing->head, ringHead + recordSize, __ATOMIC_RELEASE);
+
+	if (used + recordSize > pRing->capacity/2)
+		wake ();
+	return 0;
+}
+
+/** Returns the time as at the start of a line. The text is made once
+ *  for each second.
+ **/
+const char* LogWriter::timeText (time_t time)
+{
+	if (time != mLineTime) {
+		logFormatTime (time, mTimeText, sizeof (mTimeText));
+		mLineTime = time;
+	}
+	return mTimeText;
+}
+
+/** Formats the message as a line to the blocks. */
+void LogWriter::render (const LogMessage* message)
+{
+	const char* text = (const char*) (message+1);
+	mLine.length = 0;
+	const char* stamp = timeText (message->time);
+	mLine.append (stamp, strlen (stamp));
+	if (message->moduleLen >= 0) {
+		mLine.append (text, message->moduleLen);
+		mLine.append (" ", 1);
+		text += message->moduleLen+1;
+	}
+	mLine.appendf ("%s %d: ", logFatalities[message->fatality], message->errnum);
+	const char* args = (const char*) message + logAlign ((text - (const char*) message) + message->formatLen+1);
+	if (message->formatted)
+		mLine.append (text, message->formatLen);
+	else
+		logRenderArgs (mLine, text, args, args + message->argsLen);
+	mLine.append ("\n", 1);
+	addLine (mLine.data, mLine.length);
+}
+
+/** Adds the line to the blocks, writing them out when they are full.
+ *  A line longer than a block is written by itself.
+ **/
+void LogWriter::addLine (const char* data, int len)
+{
+	if (mBlockUsed[mCurrent] + len > LOG_WRITE_BLOCK) {
+		if (mBlockUsed[mCurrent] > 0)
+			mCurrent++;
+		if (mCurrent == mBlockCount || len > LOG_WRITE_BLOCK) {
+			writeOut ();
+			if (len > LOG_WRITE_BLOCK) {
+				struct iovec iov = {(void*) data, (size_t) len};
+				writeAll (&iov, 1);
+				return;
+			}
+		}
+	}
+	memcpy (mBlocks[mCurrent] + mBlockUsed[mCurrent], data, len);
+	mBlockUsed[mCurrent] += len;
+	mPending += len;
+}
+
+/** Writes the filled blocks with one writev(). */
+void LogWriter::writeOut ()
+{
+	struct iovec iov [64];
+	int count = 0;
+	for (int i=0; i<mBlockCount && mBlockUsed[i] > 0; i++) {
+		iov[count].iov_base = mBlocks[i];
+		iov[count++].iov_len = mBlockUsed[i];
+		mBlockUsed[i] = 0;
+	}
+	writeAll (iov, count);
+	mCurrent = 0;
+	mPending = 0;
+}
+
+/** Writes the buffers, continuing after partial writes. Gives up on
+ *  errors, as there is nowhere to report them.
+ **/
+void LogWriter::writeAll (struct iovec* iov, int count)
+{
+	while (count > 0) {
+		ssize_t written = writev (mFd, iov, count);
+		if (written < 0) {
+			if (errno == EINTR)
+				continue;
+			return;
+		}
+		for (; count > 0 && (size_t) written >= iov->iov_len; iov++, count--)
+			written -= iov->iov_len;
+		if (count > 0) {
+			iov->iov_base = (char*) iov->iov_base + written;
+			iov->iov_len -= written;
+		}
+	}
+}
+
+/*******************************************************************************
+ * Formats the messages in all the rings. Releases the rings of the
+ * exited threads once they are empty.
+ *
+ * \return The number of messages.
+ ******************************************************************************/
+int LogWriter::drain ()
+{
+	{
+		MutexLocker locker (mRingLock);
+		mSnapshot.resize (0);
+		for (int i=0; i<mRings.size (); i++)
+			mSnapshot.add (mRings[i]);
+	}
+
+	int count = 0;
+	for (int i=0; i<mSnapshot.size (); i++) {
+		LogRing* ring = mSnapshot[i];
+		// A closed ring gets no more messages after the head read here
+		bool closed = __atomic_load_n (&ring->closed, __ATOMIC_ACQUIRE);
+		unsigned long head = __atomic_load_n (&ring->head, __ATOMIC_ACQUIRE);
+		unsigned long tail = ring->tail;
+		while (tail != head) {
+			LogRecord* rec = (LogRecord*) (ring->data + (tail & (ring->capacity-1)));
+			if (rec->type == LOGREC_MESSAGE) {
+				render ((const LogMessage*) (rec+1));
+				count++;
+			} else if (rec->type == LOGREC_HEAP) {
+				char* message;
+				memcpy (&message, rec+1, sizeof (message));
+				render ((const LogMessage*) message);
+				delete [] message;
+				count++;
+			}
+			tail += rec->size;
+			__atomic_store_n (&ring->tail, tail, __ATOMIC_RELEASE);
+		}
+
+		if (closed) {
+			MutexLocker locker (mRingLock);
+			for (int j=0; j<mRings.size (); j++)
+				if (mRings[j] == ring) {
+					mRings[j] = mRings[mRings.size ()-1];
+					mRings.resize (mRings.size ()-1);
+					break;
+				}
+			delete [] ring->data;
+			delete ring;
+		}
+	}
+
+	long dropped = __atomic_load_n (&mDropped, __ATOMIC_RELAXED);
+	if (dropped != mDroppedReported) {
+		LogLine notice;
+		notice.appendf ("%s%s %d: %ld log messages dropped.\n", timeText (time (NULL)),
+						logFatalities[Log::Warning], MERR_LOG_DROPPED, dropped - mDroppedReported);
+		addLine (notice.data, notice.length);
+		mDroppedReported = dropped;
+	}
+	return count;
+}
+
+/*******************************************************************************
+ * Main loop of the writer thread.
+ *
+ * The writer sleeps until a ring becomes half full, a flush is
+ * requested or the flush interval passes. The formatted lines are
+ * written when the blocks are full, at the flush interval, and at
+ * flush requests.
+ ******************************************************************************/
+void* LogWriter::execute ()
+{
+	double lastWrite = logNow ();
+	for (;;) {
+		bool stopping = __atomic_load_n (&mStopping, __ATOMIC_ACQUIRE);
+		long flushTicket = __atomic_load_n (&mFlushRequested, __ATOMIC_ACQUIRE);
+		int count = drain ();
+
+		double now = logNow ();
+		if (mPending == 0)
+			lastWrite = now;
+		else if (stopping || flushTicket != mFlushDone || now - lastWrite >= mFlushInterval) {
+			writeOut ();
+			lastWrite = now;
+		}
+		if (flushTicket != mFlushDone) {
+			MutexLocker locker (mFlushLock);
+			mFlushDone = flushTicket;
+			mFlushed.broadcast ();
+		}
+
+		if (count == 0) {
+			if (stopping)
+				break;
+			mWake.wait (mFlushInterval);
+			__atomic_store_n (&mWakePending, 0, __ATOMIC_RELEASE);
+		}
+	}
+	if (mPending > 0)
+		writeOut ();
+	return NULL;
+}
+
+/** Waits until the messages posted before the call are written. */
+void LogWriter::flush ()
+{
+	long ticket = __atomic_add_fetch (&mFlushRequested, 1, __ATOMIC_ACQ_REL);
+	mWake.post ();
+
+	MutexLocker locker (mFlushLock);
+	while (mFlushDone < ticket)
+		mFlushed.wait (mFlushLock, 0.1);
+}
+
+/** Writes the remaining messages and stops the thread. */
+void LogWriter::stop ()
+{
+	__atomic_store_n (&mStopping, 1, __ATOMIC_RELEASE);
+	mWake.post ();
+	join ();
+}
+
 /*******************************************************************************
  * Opens log to the given already open stream.
  *
@@ -148,7 +1042,9 @@ void Log::popModule ()
 LogFile::LogFile (
 	FILE* stream /**< Stream to write the log to. */)
 {
+	mpFilename  = NULL;
 	mpLogStream = stream;
+	mpWriter    = NULL;
 }
 
 /*******************************************************************************
@@ -161,6 +1057,7 @@ LogFile::LogFile (
 	const char* filename /**< File to write the log to. */)
 {
 	mpLogStream = NULL;
+	mpWriter    = NULL;
 
 	if (!filename)
 		mpFilename = NULL; /* A problematic situation. */
@@ -180,13 +1077,9 @@ LogFile::LogFile (
  ******************************************************************************/
 LogFile::~LogFile ()
 {
-	// mThreadLock.lock ();
-
 	close ();
 
 	delete mpFilename;
-
-	// mThreadLock.unlock ();
 }
 
 /*******************************************************************************
@@ -202,13 +1095,12 @@ int LogFile::setFilename (const char* filename)
 	if (!filename)
 		return MERR_FILE_NO_FILENAME;
 
-	// mThreadLock.lock ();
+	MutexLocker locker (mLock);
 	if (mpFilename)
 		delete mpFilename;
 
 	mpFilename = strdup (filename);
 
-	// mThreadLock.unlock ();
 	return 0;
 }
 
@@ -224,7 +1116,7 @@ int LogFile::open ()
 {
 	int result = 0;
 
-	// mThreadLock.lock ();
+	MutexLocker locker (mLock);
 
 	if (!mpFilename)
 		result = MERR_FILE_NO_FILENAME;
@@ -247,24 +1139,26 @@ int LogFile::open ()
 		}
 	}
 
-	// mThreadLock.unlock ();
 	return result;
 }
 
 /*******************************************************************************
  * Closes the log file
+ *
+ * Writes the messages of the asynchronous mode first and returns to
+ * the synchronous mode.
  ******************************************************************************/
 void LogFile::close ()
 {
-	// mThreadLock.lock ();
+	stopAsync ();
+
+	MutexLocker locker (mLock);
 
 	/* Close the file, if necessary. */
 	if (mpLogStream && mpLogStream != stdout) {
 		fclose (mpLogStream);
 		mpLogStream = 0;
 	}
-
-	// mThreadLock.unlock ();
 }
 
 /*******************************************************************************
@@ -274,7 +1168,7 @@ void LogFile::close ()
  ******************************************************************************/
 int LogFile::write (const char* data, int len)
 {
-	// mThreadLock.lock ();
+	MutexLocker locker (mLock);
 
 	if (! mpLogStream)
 		return MERR_FILE_NOT_OPEN;
@@ -282,11 +1176,17 @@ int LogFile::write (const char* data, int len)
 	if (!data)
 		return MERR_NULL_ARGUMENT;
 
+	/* The data goes after the messages of the background writer. */
+	if (mpWriter)
+		mpWriter->flush ();
+
 	int written = fwrite (data, 1, len, mpLogStream);
 	if (written < len)
 		return MERR_FILE_SHORT_WRITE;
 
-	// mThreadLock.unlock ();
+	if (mpWriter)
+		fflush (mpLogStream);
+
 	return 0;
 }
 
@@ -311,64 +1211,543 @@ int LogFile::message (
 	const char* message,     /**< Message (as a format string for printf).    */
 	va_list     v_args)
 {
-	static const char* fatalities[8] = {"EMERGENCY",
-										"ALERT",
-										"CRITICAL",
-										"ERROR",
-										"WARNING",
-										"NOTICE",
-										"INFO",
-										"DEBUG"};
-
-	// mThreadLock.lock ();
-
-	if (! mpLogStream)
-		return MERR_FILE_NOT_OPEN;
-
 	if (!message)
 		return MERR_NULL_ARGUMENT;
 
 	if (fatality < 0 || fatality > Debug)
 		return MERR_LOG_INVALID_FATALITY;
 
+	if (!enabled (fatality))
+		return 0;
+
 	/* Ensure that the error code is positive. */
 	if (errnum < 0)
 		errnum = -errnum;
 
+	/* The background writer formats the message later. */
+	if (LogWriter* writer = __atomic_load_n (&mpWriter, __ATOMIC_ACQUIRE))
+		return writer->post (modulename, fatality, errnum, message, v_args);
+
 	/* Write current time. */
 	time_t currentTime = time (NULL);
-	struct tm* pTimeTm = localtime (&currentTime);
+	struct tm timeTm;
+	localtime_r (&currentTime, &timeTm);
 	String logtime = strformat ("%04d/%02d/%02d %02d:%02d:%02d ",
-								1900+pTimeTm->tm_year,
-								pTimeTm->tm_mon+1,
-								pTimeTm->tm_mday,
-								pTimeTm->tm_hour,
-								pTimeTm->tm_min,
-								pTimeTm->tm_sec);
+								1900+timeTm.tm_year,
+								timeTm.tm_mon+1,
+								timeTm.tm_mday,
+								timeTm.tm_hour,
+								timeTm.tm_min,
+								timeTm.tm_sec);
 
 	/* Write log line header. */
 	String logheader = strformat ("%s%s%s %d: ",
 								  modulename? modulename:"",
 								  modulename? " ":"",
-								  fatalities[fatality],
+								  logFatalities[fatality],
 								  errnum);
 
 	/* Write the message with optional ellipsis. */
 	String logmessage = vstrformat (message, v_args);
 
-	/* Write the ending newline. */
-	int written = fprintf (mpLogStream, (CONSTR) (logtime + logheader + logmessage + "\n"));
+	/* Only the writing needs to be locked. */
+	MutexLocker locker (mLock);
+
+	if (! mpLogStream)
+		return MERR_FILE_NOT_OPEN;
+
+	/* Write the ending newline. The line is not a format string. */
+	String line = logtime + logheader + logmessage + "\n";
+	int written = fwrite ((CONSTR) line, 1, line.length (), mpLogStream);
 
 	if (written <= 0)
 		return MERR_FILE_WRITE_FAILED;
 
 	fflush (mpLogStream);
 
-	fprintf (stderr, (CONSTR) (logmessage + "\n"));
+	fputs ((CONSTR) (logmessage + "\n"), stderr);
 	
-	//mThreadLock.unlock ();
 	return 0;
 }
 
+/*******************************************************************************
+ * Starts writing the log in the background.
+ *
+ * The messages are then put in a buffer of the calling thread and
+ * formatted and written by a writer thread. The messages of one
+ * thread stay in order, but lines of different threads may be written
+ * out of the order of their times. Messages are no longer echoed to
+ * the standard error stream.
+ *
+ * \return 0 if successful, MERR_FILE_NOT_OPEN if the log is not open.
+ ******************************************************************************/
+int LogFile::startAsync (
+	int         bufferSize,    /**< Bytes in the buffer of each thread.           */
+	LogOverflow overflow,      /**< What to do with messages to a full buffer.    */
+	double      flushInterval, /**< Seconds the formatted lines may wait at most. */
+	int         flushBytes)    /**< Bytes of formatted lines written at once.     */
+{
+	MutexLocker locker (mLock);
+
+	if (!mpLogStream)
+		return MERR_FILE_NOT_OPEN;
+	if (mpWriter)
+		return 0;
+
+	fflush (mpLogStream);
+	LogWriter* writer = new LogWriter (fileno (mpLogStream), bufferSize, overflow,
+									   flushInterval, flushBytes);
+	writer->start ();
+	__atomic_store_n (&mpWriter, writer, __ATOMIC_RELEASE);
+	return 0;
+}
+
+/*******************************************************************************
+ * Writes the remaining messages and returns to writing synchronously.
+ *
+ * No other thread may be writing to the log during the call.
+ ******************************************************************************/
+void LogFile::stopAsync ()
+{
+	LogWriter* writer;
+	{
+		MutexLocker locker (mLock);
+		writer = __atomic_exchange_n (&mpWriter, (LogWriter*) NULL, __ATOMIC_ACQ_REL);
+	}
+	if (writer) {
+		writer->stop ();
+		delete writer;
+	}
+}
+
+/*******************************************************************************
+ * Waits until the messages written before the call are in the file.
+ ******************************************************************************/
+void LogFile::flush ()
+{
+	if (LogWriter* writer = __atomic_load_n (&mpWriter, __ATOMIC_ACQUIRE))
+		writer->flush ();
+}
+
+/*******************************************************************************
+ * Returns the number of messages dropped as the buffer of their thread
+ * was full, after @ref startAsync() with LOG_DROP.
+ ******************************************************************************/
+long LogFile::dropped () const
+{
+	LogWriter* writer = __atomic_load_n (&mpWriter, __ATOMIC_ACQUIRE);
+	return writer? writer->dropped () : 0;
+}
+
+/*******************************************************************************
+ * Binary log
+ ******************************************************************************/
+
+/** Kinds of records in a @ref BinaryLog file. Each record starts with
+ *  a @ref LogRecord and is padded to a multiple of 8 bytes.
+ **/
+enum {BLOG_START,	/**< Start of a session, "MLOGBIN1". The numbers restart. */
+	  BLOG_MODULE,	/**< A @ref BinaryLogName and the module name.           */
+	  BLOG_FORMAT,	/**< A @ref BinaryLogName and the format string.         */
+	  BLOG_MESSAGE,	/**< A @ref BinaryLogMessage and its arguments or text.  */
+	  BLOG_TEXT		/**< A @ref BinaryLogName numbered 0 and raw data.       */};
+
+#define BLOG_MAGIC	"MLOGBIN1"
+
+/** A numbered name, or the length of raw data. */
+struct BinaryLogName {
+	unsigned int	id;
+	unsigned int	length;		/**< Without the terminating zero. */
+};
+
+/** A message. Followed by the copied arguments, or by the formatted
+ *  text if the arguments could not be copied.
+ **/
+struct BinaryLogMessage {
+	int64_t			seconds;
+	int				nanoseconds;
+	int				errnum;
+	unsigned int	format;		/**< Number of the format, or 0 for text. */
+	unsigned int	module;		/**< Number of the module, or 0 if none.  */
+	int				argsLen;	/**< Bytes of the arguments or text.      */
+	unsigned char	fatality;
+	unsigned char	pad [3];
+};
+
+/** Entries in the cache of the last numbers by the address of the text. */
+#define LOG_NAME_CACHE		64
+
+/** Numbers given to names by a @ref BinaryLog, found by their text. */
+struct LogNames {
+	PackArray<char*>	texts;	/**< By number-1. */
+	PackArray<int>		slots;	/**< Hash table of the numbers, 0 if free. */
+	const char*			cachedText [LOG_NAME_CACHE];
+	int					cachedId [LOG_NAME_CACHE];
+
+	LogNames () {
+		memset (cachedText, 0, sizeof (cachedText));
+	}
+
+	~LogNames () {
+		for (int i=0; i<texts.size (); i++)
+			delete [] texts[i];
+	}
+
+	/** Returns the number of the text, or 0 after setting the slot
+	 *  where it is to be added.
+	 **/
+	int find (const char* text, int len, int& slot) const {
+		if (slots.size () == 0)
+			return slot = 0;
+		unsigned int hash = 2166136261U;
+		for (int i=0; i<len; i++)
+			hash = (hash ^ (unsigned char) text[i]) * 16777619U;
+		for (slot = hash & (slots.size ()-1); slots[slot]; slot = (slot+1) & (slots.size ()-1)) {
+			const char* known = texts[slots[slot]-1];
+			if (!memcmp (known, text, len) && !known[len])
+				return slots[slot];
+		}
+		return 0;
+	}
+
+	/** Numbers the text, which was not found in the slot. */
+	int add (const char* text, int len, int slot) {
+		char* copy = new char [len+1];
+		memcpy (copy, text, len+1);
+		texts.add (copy);
+		if (texts.size ()*2 <= slots.size ())
+			slots[slot] = texts.size ();
+		else {
+			// Rehashes all the texts to a twice larger table
+			slots.make ((slots.size () == 0)? 64 : slots.size ()*2);
+			for (int i=0; i<slots.size (); i++)
+				slots[i] = 0;
+			for (int id=1; id<=texts.size (); id++) {
+				find (texts[id-1], strlen (texts[id-1]), slot);
+				slots[slot] = id;
+			}
+		}
+		return texts.size ();
+	}
+};
+
+/*******************************************************************************
+ * Opens the binary log to the given file
+ *
+ * The records are appended to the file if it exists.
+ ******************************************************************************/
+BinaryLog::BinaryLog (
+	const char* filename /**< File to write the log to. */)
+		: mFilename (filename)
+{
+	mpStream = NULL;
+	mpModules = new LogNames;
+	mpFormats = new LogNames;
+
+	int result = open ();
+	if (result) {
+		char buffer[1024];
+		sprintf (buffer, "Opening binary log file failed with error %d.", result);
+		throw std::runtime_error (buffer);
+	}
+}
+
+/*******************************************************************************
+ * Closes the log.
+ ******************************************************************************/
+BinaryLog::~BinaryLog ()
+{
+	close ();
+
+	delete mpModules;
+	delete mpFormats;
+}
+
+/*******************************************************************************
+ * Opens the log file, starting a new session of numbered names
+ *
+ * \return 0 if successful, otherwise an error code.
+ ******************************************************************************/
+int BinaryLog::open ()
+{
+	MutexLocker locker (mLock);
+
+	if (mFilename.isEmpty ())
+		return MERR_FILE_NO_FILENAME;
+	if (mpStream)
+		return MERR_FILE_ALREADY_OPEN;
+
+	mpStream = fopen (mFilename, "ab");
+	if (!mpStream)
+		return MERR_FILE_OPEN_FAILED;
+
+	delete mpModules;
+	delete mpFormats;
+	mpModules = new LogNames;
+	mpFormats = new LogNames;
+	return record (BLOG_START, NULL, 0, BLOG_MAGIC, 8);
+}
+
+/*******************************************************************************
+ * Closes the log file
+ ******************************************************************************/
+void BinaryLog::close ()
+{
+	MutexLocker locker (mLock);
+
+	if (mpStream) {
+		fclose (mpStream);
+		mpStream = NULL;
+	}
+}
+
+/*******************************************************************************
+ * Writes the buffered records to the file
+ ******************************************************************************/
+void BinaryLog::flush ()
+{
+	MutexLocker locker (mLock);
+
+	if (mpStream)
+		fflush (mpStream);
+}
+
+/*******************************************************************************
+ * Writes a record with the given header and data. The header must be
+ * a multiple of 8 bytes; the data is padded.
+ *
+ * \return 0 if successful, otherwise an error code.
+ ******************************************************************************/
+int BinaryLog::record (int type, const void* head, int headLen, const char* data, int len)
+{
+	static const char padding [8] = {0};
+	LogRecord rec;
+	rec.size = sizeof (rec) + headLen + logAlign (len);
+	rec.type = type;
+
+	/* The stream is guarded by mLock, so it need not lock itself. */
+	if (fwrite_unlocked (&rec, sizeof (rec), 1, mpStream) != 1
+		|| (headLen && fwrite_unlocked (head, headLen, 1, mpStream) != 1)
+		|| (len && fwrite_unlocked (data, len, 1, mpStream) != 1)
+		|| (logAlign (len) > len && fwrite_unlocked (padding, logAlign (len) - len, 1, mpStream) != 1))
+		return MERR_FILE_WRITE_FAILED;
+	return 0;
+}
+
+/*******************************************************************************
+ * Returns the number of the module name or format string, writing a
+ * record that numbers it at the first use.
+ ******************************************************************************/
+int BinaryLog::name (LogNames& names, int type, const char* text)
+{
+	/* The names are mostly literals, found by their address. The text
+	 * is compared as the address may have been reused. */
+	int line = ((uintptr_t) text >> 3) & (LOG_NAME_CACHE-1);
+	if (names.cachedText[line] == text && !strcmp (names.texts[names.cachedId[line]-1], text))
+		return names.cachedId[line];
+
+	int len = strlen (text);
+	int slot;
+	int id = names.find (text, len, slot);
+	if (!id) {
+		id = names.add (text, len, slot);
+		BinaryLogName head = {(unsigned int) id, (unsigned int) len};
+		record (type, &head, sizeof (head), text, len+1);
+	}
+	names.cachedText[line] = text;
+	names.cachedId[line] = id;
+	return id;
+}
+
+/*******************************************************************************
+ * Writes a log message as a binary record
+ *
+ * The arguments are copied by the conversions of the format. A
+ * message of a format whose arguments can not be copied, such as
+ * with %n or wide characters, is formatted here and written as text.
+ * The file is flushed after messages of the Error fatality or more
+ * severe.
+ *
+ * \return 0 if successful, otherwise an error code.
+ ******************************************************************************/
+int BinaryLog::message (
+	const char* modulename,  /**< An identifier of the module writing to log. */
+	int         fatality,    /**< Severity of the event.                      */
+	int         errnum,      /**< Possible message number.                    */
+	const char* message,     /**< Message (as a format string for printf).    */
+	va_list     v_args)
+{
+	if (!message)
+		return MERR_NULL_ARGUMENT;
+
+	if (fatality < 0 || fatality > Debug)
+		return MERR_LOG_INVALID_FATALITY;
+
+	if (!enabled (fatality))
+		return 0;
+
+	struct timespec now;
+	clock_gettime (CLOCK_REALTIME, &now);
+	BinaryLogMessage head;
+	memset (&head, 0, sizeof (head));
+	head.seconds = now.tv_sec;
+	head.nanoseconds = now.tv_nsec;
+	head.errnum = (errnum < 0)? -errnum : errnum;
+	head.fatality = fatality;
+
+	/* Copy the arguments to the stack, or allocate if they are larger. */
+	char local [LOG_LOCAL_RECORD];
+	char* args = local;
+	va_list argsCopy;
+	va_copy (argsCopy, v_args);
+	head.argsLen = logCaptureArgs (local, sizeof (local), message, v_args);
+	String text;
+	bool formatted = head.argsLen < 0;
+	if (formatted) {
+		text = vstrformat (message, argsCopy);
+		args = text.getbuffer ();
+		head.argsLen = text.length ()+1;
+	} else if (head.argsLen > (int) sizeof (local)) {
+		args = new char [head.argsLen];
+		logCaptureArgs (args, head.argsLen, message, argsCopy);
+	}
+	va_end (argsCopy);
+
+	int result;
+	{
+		MutexLocker locker (mLock);
+
+		if (!mpStream)
+			result = MERR_FILE_NOT_OPEN;
+		else {
+			head.module = modulename? name (*mpModules, BLOG_MODULE, modulename) : 0;
+			head.format = formatted? 0 : name (*mpFormats, BLOG_FORMAT, message);
+			result = record (BLOG_MESSAGE, &head, sizeof (head), args, head.argsLen);
+			if (fatality <= Error)
+				fflush (mpStream);
+		}
+	}
+
+	if (args != local && !formatted)
+		delete [] args;
+	return result;
+}
+
+/*******************************************************************************
+ * Writes a block of raw data to the log, to be output as is by @ref
+ * decode().
+ *
+ * \return 0 if successful, otherwise a negative error code.
+ ******************************************************************************/
+int BinaryLog::write (const char* data, int len)
+{
+	MutexLocker locker (mLock);
+
+	if (!mpStream)
+		return MERR_FILE_NOT_OPEN;
+
+	if (!data)
+		return MERR_NULL_ARGUMENT;
+
+	BinaryLogName head = {0, (unsigned int) len};
+	return record (BLOG_TEXT, &head, sizeof (head), data, len);
+}
+
+/*******************************************************************************
+ * Renders the records of a binary log as the text lines of @ref LogFile
+ *
+ * \return 0 if successful, MERR_LOG_CORRUPT if the log is damaged or
+ * ends in the middle of a record.
+ ******************************************************************************/
+int BinaryLog::decode (
+	FILE* in,  /**< Binary log to read.     */
+	FILE* out) /**< Stream to write text to. */
+{
+	PackArray<String>	modules;	/**< By number; the 0th is unused. */
+	PackArray<String>	formats;
+	PackArray<char>		body;
+	LogLine				line;
+	time_t				lineTime = -1;
+	char				timeText [32];
+	bool				started = false;
+
+	LogRecord rec;
+	size_t read;
+	while ((read = fread (&rec, 1, sizeof (rec), in)) == sizeof (rec)) {
+		if (rec.size < sizeof (rec) || rec.size % 8 || rec.size > (1U << 30))
+			return MERR_LOG_CORRUPT;
+		int len = rec.size - sizeof (rec);
+		body.resize (len+1);
+		if (fread (&body[0], 1, len, in) != (size_t) len)
+			return MERR_LOG_CORRUPT;
+		body[len] = '\0';
+
+		switch (rec.type) {
+		  case BLOG_START:
+			  if (len < 8 || memcmp (&body[0], BLOG_MAGIC, 8))
+				  return MERR_LOG_CORRUPT;
+			  modules.make (1);
+			  formats.make (1);
+			  started = true;
+			  break;
+
+		  case BLOG_MODULE:
+		  case BLOG_FORMAT: {
+			  BinaryLogName name;
+			  PackArray<String>& names = (rec.type == BLOG_MODULE)? modules : formats;
+			  if (!started || len < (int) sizeof (name))
+				  return MERR_LOG_CORRUPT;
+			  memcpy (&name, &body[0], sizeof (name));
+			  if (name.id != (unsigned int) names.size () || name.length >= len - sizeof (name))
+				  return MERR_LOG_CORRUPT;
+			  names.add (String (&body[sizeof (name)], name.length));
+		  } break;
+
+		  case BLOG_MESSAGE: {
+			  BinaryLogMessage head;
+			  if (!started || len < (int) sizeof (head))
+				  return MERR_LOG_CORRUPT;
+			  memcpy (&head, &body[0], sizeof (head));
+			  if (head.argsLen < 0 || head.argsLen > len - (int) sizeof (head) || head.fatality > Debug
+				  || head.module >= (unsigned int) modules.size () || head.format >= (unsigned int) formats.size ())
+				  return MERR_LOG_CORRUPT;
+
+			  if (head.seconds != lineTime) {
+				  lineTime = head.seconds;
+				  logFormatTime (lineTime, timeText, sizeof (timeText));
+			  }
+			  line.length = 0;
+			  line.append (timeText, strlen (timeText));
+			  if (head.module) {
+				  line.append (modules[head.module], modules[head.module].length ());
+				  line.append (" ", 1);
+			  }
+			  line.appendf ("%s %d: ", logFatalities[head.fatality], head.errnum);
+			  const char* args = &body[sizeof (head)];
+			  if (!head.format)
+				  line.append (args, strnlen (args, head.argsLen));
+			  else if (!logRenderArgs (line, formats[head.format], args, args + head.argsLen))
+				  return MERR_LOG_CORRUPT;
+			  line.append ("\n", 1);
+			  fwrite (line.data, 1, line.length, out);
+		  } break;
+
+		  case BLOG_TEXT: {
+			  BinaryLogName name;
+			  if (len < (int) sizeof (name))
+				  return MERR_LOG_CORRUPT;
+			  memcpy (&name, &body[0], sizeof (name));
+			  if (name.length > len - sizeof (name))
+				  return MERR_LOG_CORRUPT;
+			  fwrite (&body[sizeof (name)], 1, name.length, out);
+		  } break;
+
+		  default:
+			  // Records of later versions are skipped
+			  break;
+		}
+	}
+	return (read == 0)? 0 : MERR_LOG_CORRUPT;
+}
 
 END_NAMESPACE;
@@ -25,12 +25,17 @@
 #include "magic/mobject.h"
 #include <stdio.h>
 #include <string.h>
+#include <ctype.h>
 #include <fstream>		// Needed by readStringMap, etc.
 #include "magic/mmap.h"
 #include "magic/mstream.h"
 #include "magic/mtextstream.h"
 #include "magic/mdatastream.h"
 #include "magic/mclass.h"
+#include "magic/mpackarray.h"
+#include "magic/mmapfile.h"
+#include "magic/mcompress.h"
+#include "magic/mregexp.h"
 
 BEGIN_NAMESPACE (MagiC);
 
@@ -42,201 +47,217 @@ decl_module (map);
 
 //////////////////////////////////////////////////////////////////////////////
 //                                                                          //
-//                    |   |            ----        o                        //
-//                    |\ /|  ___   --  |   )  ___    | _                    //
-//                    | V |  ___| |  ) |---   ___| | |/                     //
-//                    | | | |   | |--  |     |   | | |                      //
-//                    |   |  \__| |    |      \__| | |                      //
+//                  ----             |   |             |                    //
+//                 |      ___    __  |   |  ___   ____ | _                  //
+//                 | --- /   ) |/  | |---|  ___| (     |/ |                 //
+//                 |   \ |---  |   | |   | |   |  \__  |  |                 //
+//                 |___/  \__  |   | |   |  \__| ____) |  |                 //
 //                                                                          //
 //////////////////////////////////////////////////////////////////////////////
 
-impl_dynamic (MapPair, {Object});
+impl_dynamic (GenHash, {Object});
 
-MapPair::~MapPair	() {
-	delete key;
-	key = NULL;
-	if (!isref)
-		delete value;
-	value = NULL;
-}
+/** Smallest slot count of a hash. */
+#define GENHASH_MIN_CAPACITY 8
 
-DataOStream& MapPair::operator>> (DataOStream& out) const {
-	if (key)
-		out.name("key") << *key;
-	if (value)
-		out.name("value") << *value;
-	return out;
+GenHash::~GenHash () {
+	empty ();
+	delete [] mSlots;
 }
 
-void MapPair::check () const {
-	ASSERT (value!=(void*)0x1);
+void GenHash::make (HashFunc* hfunc, int hsize, int flags) {
+	mSlots = NULL;
+	mCapacity = 0;
+	mCount = 0;
+	mShift = 32;
+	hashfunc = hfunc;
+	isref = flags;
+	mArena = NULL;
+	rehash (hsize);
 }
 
+/** Deletes a key or a value, or only destroys it if it is in the
+ *  arena.
+ **/
+void GenHash::dispose (const Object* item) const {
+	if (mArena)
+		arenaDestroy (item);
+	else
+		delete item;
+}
 
+/*******************************************************************************
+ * Moves the items to a new slot array with at least the given number
+ * of slots. The count is rounded up to the next power of two.
+ ******************************************************************************/
+void GenHash::rehash (int newcapacity) {
+	int capacity = GENHASH_MIN_CAPACITY;
+	int shift = 32 - 3;
+	while (capacity < newcapacity) {
+		capacity <<= 1;
+		shift--;
+	}
 
-//////////////////////////////////////////////////////////////////////////////
-//                                                                          //
-//          |   |             |    ----              |                      //
-//          |   |  ___   ____ | _  |   )        ___  |    ___   |           //
-//          |---|  ___| (     |/ | |---  |   | |   \ | / /   ) -+-          //
-//          |   | |   |  \__  |  | |   ) |   | |     |/  |---   |           //
-//          |   |  \__| ____) |  | |___   \__! \___/ | \  \__    \          //
-//                                                                          //
-//////////////////////////////////////////////////////////////////////////////
-
-impl_dynamic (HashBucket, {Object});
-
-HashBucket::HashBucket	() {
-	next=NULL;
-}
+	HashSlot* oldslots = mSlots;
+	int oldcapacity = mCapacity;
+
+	mSlots = new HashSlot [capacity];
+	memset (mSlots, 0, sizeof (HashSlot) * capacity);
+	mCapacity = capacity;
+	mShift = shift;
+
+	// Reinsert the old items. The hash values are cached in the
+	// slots and the keys are known to be unique, so neither the hash
+	// function nor the key comparison needs to be called.
+	uint mask = mCapacity - 1;
+	for (int i=0; i<oldcapacity; i++)
+		if (oldslots[i].key) {
+			uint pos = homeSlot (oldslots[i].hash);
+			while (mSlots[pos].key)
+				pos = (pos + 1) & mask;
+			mSlots[pos] = oldslots[i];
+		}
 
-HashBucket::~HashBucket	() {
-	delete next;
-	next = NULL;
+	delete [] oldslots;
 }
 
-DataOStream& HashBucket::operator>> (DataOStream& out) const {
-	out << pair;
-	return out;
+void GenHash::reserve (int items) {
+	// Keep the load factor at most 3/4 after inserting the items
+	int needed = items + items/3 + 1;
+	if (needed > mCapacity)
+		rehash (needed);
 }
 
-void HashBucket::check () const {
-	pair.check ();
-	if (next)
-		next->check ();
+/*******************************************************************************
+ * Returns the slot index of the given key, or -1 if the key is not in
+ * the hash.
+ ******************************************************************************/
+int GenHash::findSlot (const Comparable& key, uint hval) const {
+	uint mask = mCapacity - 1;
+	for (uint pos = homeSlot (hval); mSlots[pos].key; pos = (pos + 1) & mask) {
+		ASSERT (mSlots[pos].value != (void*)0x1);
+		if (mSlots[pos].hash == hval && *mSlots[pos].key == key)
+			return pos;
+	}
+	return -1;
 }
 
-
-
-//////////////////////////////////////////////////////////////////////////////
-//                                                                          //
-//                  ----             |   |             |                    //
-//                 |      ___    __  |   |  ___   ____ | _                  //
-//                 | --- /   ) |/  | |---|  ___| (     |/ |                 //
-//                 |   \ |---  |   | |   | |   |  \__  |  |                 //
-//                 |___/  \__  |   | |   |  \__| ____) |  |                 //
-//                                                                          //
-//////////////////////////////////////////////////////////////////////////////
-
-impl_dynamic (GenHash, {Object});
-
-void GenHash::make (HashFunc* hfunc, int hsize, int flags) {
-	hashsize = hsize;
-	hash.resize (hashsize);
-	hashfunc = hfunc;
-	isref = flags;
+/** As above, but for a key given as a view. Only keys that are
+ *  Strings can match it; the view hashes like a String with the same
+ *  characters, so the type is checked only when the hash matches.
+ **/
+int GenHash::findSlot (const SubString& key, uint hval) const {
+	uint mask = mCapacity - 1;
+	for (uint pos = homeSlot (hval); mSlots[pos].key; pos = (pos + 1) & mask) {
+		if (mSlots[pos].hash != hval)
+			continue;
+		const String* skey = dynamic_cast<const String*> (mSlots[pos].key);
+		if (skey && key == SubString (*skey))
+			return pos;
+	}
+	return -1;
 }
 
 void GenHash::set (const Comparable* key, Object* value) {
 	// Calculate the hash value of the key. This is a feature of
 	// Comparable-inherited objects.
-	int hval = key->hashfunc (hashsize);
-
-	// Find the bucket according to the hash value
-	HashBucket* bucket = hash.getp (hval);
-
-	// If there is a bucket in that hash slot, add into it
-	if (bucket)
-		// As long as there is something in the bucket
-		for (;bucket; bucket=bucket->next) {
-			// Check if this is the matching bucket
-			if (bucket->pair.match (*key)) {
-				// It existed. Wow.
-				delete bucket->pair.value;	// Replace the old value
-				delete key;					// Dispose the excess key
-				break;
-			}
-
-			// That wasn't the right bucket. If there are no more
-			// buckets, create a new one and exit the search
-			if (!bucket->next) {
-				// Add the item to the new bucket
-				bucket->next = new HashBucket;	// Create new bucket
-				bucket = bucket->next;			// Move on to the new bucket
-				bucket->pair.key = key;			// Set the key
-				bucket->pair.isref = isref;		// Clone the global isref setting
-				break;
-			}
-		}
-	else {
-		// Add a new bucket in into the hash array
-		hash.put (bucket = new HashBucket, hval);
-		bucket->pair.key = key;
+	uint hval = key->hashvalue ();
+
+	// Check if the key exists already
+	int pos = findSlot (*key, hval);
+	if (pos >= 0) {
+		if (!isref)
+			dispose (mSlots[pos].value);	// Replace the old value
+		dispose (key);						// Dispose the excess key
+		mSlots[pos].value = value;
+		return;
 	}
 
-	// Finally set the value
-	bucket->pair.value = value;
+	// Grow when the load factor would exceed 3/4
+	if ((mCount + 1) * 4 > mCapacity * 3)
+		rehash (mCapacity * 2);
+
+	// Find the first free slot in the probe run
+	uint mask = mCapacity - 1;
+	uint slot = homeSlot (hval);
+	while (mSlots[slot].key)
+		slot = (slot + 1) & mask;
+
+	mSlots[slot].hash	= hval;
+	mSlots[slot].key	= key;
+	mSlots[slot].value	= value;
+	mCount++;
 }
 
 const Object* GenHash::get (const Comparable& key) const {
-	for (const HashBucket* sanko = hash.getp (key.hashfunc(hashsize)); sanko; sanko=sanko->next) {
-		ASSERT (sanko->pair.key != (void*)0x1);
-		ASSERT (sanko->pair.value != (void*)0x1);
-		if (sanko->pair.match (key))
-			return sanko->pair.value;
-	}
+	int pos = findSlot (key, key.hashvalue ());
+	return (pos >= 0)? mSlots[pos].value : NULL;
+}
 
-	return NULL;
-
-	/*
-	if (0) {
-		// String-avaimet kerrotaan...
-		if (key.is_a ("String")) {
-			const String& skey = static_cast<const String&> (key);
-			throw not_found (format ("CMap object not found with key '%s'", (CONSTR) skey));
-		} else
-			throw not_found ("CMap object not found with a key");
-	} else {
-		// Ilmoitetaan virheest� palauttamalla NULL
-		return NULL;
-	}
-	*/
+const Object* GenHash::get (const SubString& key) const {
+	int pos = findSlot (key, key.hashvalue ());
+	return (pos >= 0)? mSlots[pos].value : NULL;
 }
 
 void GenHash::empty () {
-	hash.empty ();
+	for (int i=0; i<mCapacity; i++)
+		if (mSlots[i].key) {
+			dispose (mSlots[i].key);
+			if (!isref)
+				dispose (mSlots[i].value);
+			mSlots[i].key = NULL;
+			mSlots[i].value = NULL;
+		}
+	mCount = 0;
 }
 
 void GenHash::remove (const Comparable& key) {
-	HashBucket* prev = NULL;
-	int bucket = key.hashfunc (hashsize);
-	for (HashBucket* sanko = hash.getp (bucket); sanko; sanko=sanko->next) {
-		if (sanko->pair.match (key)) {
-			if (prev) {
-				// Ei olla ensimm�inen
-				prev->next = sanko->next;
-				sanko->next = NULL;
-				delete sanko;
-			} else {
-				// Ollaan ensimm�inen
-
-				if (sanko->next) {
-					// Per�ss� on muita
-					HashBucket* next = sanko->next;
-					sanko->next = NULL;
-					hash.put (next, bucket);
-					delete sanko;
-				} else {
-					// Ollaan ainoa
-					hash.remove (bucket);
-					// hash.empty ();
-				}
-			}
-			break;
+	int pos = findSlot (key, key.hashvalue ());
+	if (pos < 0)
+		return;
+
+	dispose (mSlots[pos].key);
+	if (!isref)
+		dispose (mSlots[pos].value);
+	mCount--;
+
+	// Shift the rest of the probe run backwards over the hole, so
+	// that no items become unreachable from their home slots.
+	uint mask = mCapacity - 1;
+	uint hole = pos;
+	for (uint next = (hole + 1) & mask; mSlots[next].key; next = (next + 1) & mask) {
+		uint home = homeSlot (mSlots[next].hash);
+
+		// Move the item only if its home slot is not cyclically
+		// within (hole, next]
+		if (((next - home) & mask) >= ((next - hole) & mask)) {
+			mSlots[hole] = mSlots[next];
+			hole = next;
 		}
-		prev = sanko;
 	}
+	mSlots[hole].key = NULL;
+	mSlots[hole].value = NULL;
 }
 
+/** Adds clones of the items of the other hash. The clones are made on
+ *  the heap, so a hash with an arena can not be added to; @ref Map
+ *  copies the items itself then.
+ **/
 void GenHash::operator+= (const GenHash& other) {
+	ASSERTWITH (!mArena, "Can not clone items into an arena");
+	reserve (mCount + other.mCount);
 	for (GenHashIter i (&other); !i.exhausted(); i.next())
 		set (static_cast<Comparable*> (i.getkey().clone ()), i.getvalue().clone ());
 }
 
 DataOStream& GenHash::operator>> (DataOStream& out) const {
-	out.name ("hashsize") << hashsize;
+	out.name ("hashsize") << mCapacity;
 	out.name ("isref") << (int)isref;
-	out.name ("hash") << hash;
+	out.name ("count") << mCount;
+	for (GenHashIter iter (this); !iter.exhausted(); iter.next()) {
+		out.name("key") << iter.getkey();
+		out.name("value") << iter.getvalue();
+	}
 	return out;
 }
 
@@ -261,9 +282,17 @@ TextOStream& GenHash::operator>> (TextOStream& out) const
 }
 
 void GenHash::check () const {
-	for (int i=0; i<hash.size(); i++)
-		if (hash.getp(i)) // Check only non-null buckets
-			hash[i].check (); // Check the bucket
+	ASSERT (mCapacity >= GENHASH_MIN_CAPACITY && (mCapacity & (mCapacity-1)) == 0);
+	ASSERT (mCount*4 <= mCapacity*3);
+
+	int count = 0;
+	for (int i=0; i<mCapacity; i++)
+		if (mSlots[i].key) { // Check only non-empty slots
+			ASSERT (mSlots[i].value != (void*)0x1);
+			ASSERT (findSlot (*mSlots[i].key, mSlots[i].hash) == i);
+			count++;
+		}
+	ASSERT (count == mCount);
 }
 
 
@@ -284,51 +313,44 @@ GenHashIter::GenHashIter (const GenHash* ghash) {
 }
 
 void GenHashIter::first () {
-	bucket = 0;
-	currbucket = NULL;
+	slot = -1;
 	exh = 0;
 	next ();
 }
 
 void GenHashIter::next () {
-	if (currbucket) {
-		if ((currbucket = currbucket->next))
+	// Skip to the next used slot
+	for (slot++; slot < hash->mCapacity; slot++)
+		if (hash->mSlots[slot].key)
 			return;
-		else
-			bucket++;
-	}
-
-	while (bucket < hash->hash.size() && (currbucket=(HashBucket*)(hash->hash.getp (bucket))) == NULL)
-		bucket++;
 
-	if (bucket >= hash->hash.size())
-		exh = 1;
+	exh = 1;
 }
 
 Comparable& GenHashIter::getkeyv () {
-	if (currbucket)
-		return const_cast<Comparable&> (*(currbucket->pair.key));
+	if (!exh)
+		return const_cast<Comparable&> (*(hash->mSlots[slot].key));
 	else
 		return *(Comparable*)NULL;
 }
 
 Object& GenHashIter::getvaluev () {
-	if (currbucket)
-		return *(currbucket->pair.value);
+	if (!exh)
+		return *(hash->mSlots[slot].value);
 	else
 		return *(Object*) NULL;
 }
 
 const Comparable& GenHashIter::getkey () const {
-	if (currbucket)
-		return *(currbucket->pair.key);
+	if (!exh)
+		return *(hash->mSlots[slot].key);
 	else
 		return *(const Comparable*) NULL;
 }
 
 const Object& GenHashIter::getvalue () const {
-	if (currbucket)
-		return *(currbucket->pair.value);
+	if (!exh)
+		return *(hash->mSlots[slot].value);
 	else
 		return *(const Object*) NULL;
 }
@@ -352,16 +374,15 @@ void splitpairs (CMap<String,String>& trg, const String& source,
 	trg.empty ();
 
 	// Halkaistaan ensin kent�t erilleen ja laitetaan v�liaikaiseen vektoriin
-	Array<String> tmp;
+	PackArray<SubString> tmp;
 	source.split (tmp, rsep);
 
 	// K�yd��n parit sis�lt�v�t merkkijonot l�pi
 	for (int i=0; i<tmp.size(); i++) {
 		// Halkaistaan pari kahtia
 		int pos = tmp[i].find (psep);
-		String left = tmp[i].left (pos);
-		String right = tmp[i].mid (pos+1);
-		trg.set (left, right);
+		SubString right = tmp[i].mid (pos+1);
+		trg.set (tmp[i].left (pos).toString (), new String (right.data (), right.length ()));
 	}
 }
 
@@ -403,7 +424,17 @@ String toString (const StringMap& map) {
 //////////////////////////////////////////////////////////////////////////////
 
 StringMap readStringMap (const String& filename) {
-	TextIStream in (new File (filename));
+	// Map the file if possible, otherwise read it as a stream
+	IODevice* device = new MMapFile (filename);
+	if (!device->open (IO_Readable)) {
+		delete device;
+		device = new File (filename);
+	}
+#if defined(HAVE_ZLIB) || defined(HAVE_ZSTD)
+	if (device->isOpen () || device->open (IO_Readable))
+		device = CompressedDevice::decompressor (device);
+#endif
+	TextIStream in (device);
 	if (!in)
 		throw file_not_found (strformat ("Could not open file '%s' for reading StringMap",
 										 (CONSTR) filename));
@@ -417,52 +448,98 @@ StringMap readStringMap (const String& filename) {
 	return readStringMap (in, path);
 }
 
+/*******************************************************************************
+ * Reads a String Map from a stream.
+ *
+ * The lines are parsed as views, so only the keys and values that are
+ * stored in the map are copied. If the stream reads a mapped file,
+ * the lines are viewed directly in the mapping.
+ ******************************************************************************/
 StringMap readStringMap (TextIStream& in, const char* path) {
 	StringMap result;
-	String paramStr;
 	String section;
-	String buffer;
-	Array<String> regpar;
-	Array<String> pair;		// Key-value pair
+	String buffer;				// Line storage when reading from other than a mapped file
+	String fullKey;				// Key with the section prefix
+	SubString line;
+	PackArray<SubString> regpar;
+	PackArray<SubString> pair;	// Key-value pair
 
-	while (in.readLine (buffer)) {
-		buffer.chop(); // Cleanup trailing whitespaces
+	// Compile the line patterns once
+	RegExp includeExpr ("^INCLUDE\\:? *(.+)");
+	RegExp sectionExpr ("^\\[([a-zA-Z0-9]*)\\]");
+
+	MMapFile* mapped = dynamic_cast<MMapFile*> (in.device ());
+
+	while (true) {
+		if (mapped) {
+			if (!mapped->readLine (line))
+				break;
+		} else {
+			if (!in.readLine (buffer))
+				break;
+			line = buffer;
+		}
+
+		// Cleanup trailing whitespaces
+		uint len = line.length ();
+		while (len>0 && isspace (line[len-1]))
+			len--;
+		line = line.left (len);
 
 		// Map definition can be terminated with this special
 		// row. Case sensitive.
-		if (buffer == "# end-of-map")
+		if (line == "# end-of-map")
 			break;
 
-		if (buffer.regmatch ("^INCLUDE\\:? *(.+)", regpar)) {
+		// The patterns are anchored to the beginning of the line, so
+		// they need to be tried only when the first character fits.
+		const char first = line.isEmpty()? '\0' : line[0];
+
+		if (first == 'I' && line.regmatch (includeExpr, regpar)) {
 			// Include file directive. Determine path.
 			String curPath="./";
 			if (path)
 				curPath = path;
 
 			// Read the include file recursively
-			result += readStringMap (curPath+regpar[1]);
+			result += readStringMap (curPath+regpar[1].toString());
 
-		} else if (buffer.regmatch ("^\\[([a-zA-Z0-9]*)\\]", regpar)) {
+		} else if (first == '[' && line.regmatch (sectionExpr, regpar)) {
 			// Section name line
-			section = (regpar[1]=="]")? String():regpar[1];
+			section = regpar[1].toString ();
 
-		} else if (buffer.regmatch ("^[ \t]*\\#")) {
-			// Comment line, bypass
-			continue;
 		} else {
+			// Comment line, bypass
+			uint pos = 0;
+			while (pos<len && (line[pos]==' ' || line[pos]=='\t'))
+				pos++;
+			if (pos<len && line[pos]=='#')
+				continue;
+
 			// Check if key=value pair
-			buffer.split (pair, '=');
+			line.split (pair, '=');
 			if (pair.size() == 2) {
 				// Cleanup key and value
-				String key   = pair[0].stripWhiteSpace();
-				String value = pair[1].stripWhiteSpace();
+				SubString key   = pair[0].stripWhiteSpace();
+				SubString value = pair[1].stripWhiteSpace();
 
 				// If neither is empty, add to map
-				if (!isempty(key) && !isempty(value)) {
+				if (!key.isEmpty() && !value.isEmpty()) {
 					// Add section prefix to key
-					if (!isempty(section))
-						key = section+"."+key;
-					result.set (key, value); // Add to map
+					if (!isempty(section)) {
+						fullKey = section;
+						fullKey.append ('.');
+						fullKey.append (key.data(), key.length());
+						key = fullKey;
+					}
+
+					// Replace an existing value in place, otherwise
+					// add to map
+					if (String* old = result.getvp (key)) {
+						old->empty ();
+						old->append (value.data(), value.length());
+					} else
+						result.set (key.toString(), new String (value.data(), value.length()));
 				}
 			} else {
 				// Unknown line
@@ -0,0 +1,293 @@
+/***************************************************************************
+ *   This file is part of the MagiC++ library.                             *
+ *                                                                         *
+ *   Copyright (C) 1998-2005 Marko Grnroos <magi@iki.fi>                  *
+ *                                                                         *
+ ***************************************************************************
+ *                                                                         *
+ *  This library is free software; you can redistribute it and/or          *
+ *  modify it under the terms of the GNU Library General Public            *
+ *  License as published by the Free Software Foundation; either           *
+ *  version 2 of the License, or (at your option) any later version.       *
+ *                                                                         *
+ *  This library is distributed in the hope that it will be useful,        *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU      *
+ *  Library General Public License for more details.                       *
+ *                                                                         *
+ *  You should have received a copy of the GNU Library General Public      *
+ *  License along with this library; see the file COPYING.LIB.  If         *
+ *  not, write to the Free Software Foundation, Inc., 59 Temple Place      *
+ *  - Suite 330, Boston, MA 02111-1307, USA.                               *
+ *                                                                         *
+ ***************************************************************************/
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "magic/mmapfile.h"
+
+BEGIN_NAMESPACE (MagiC);
+
+/*******************************************************************************
+ * Constructor.
+ *
+ *  Creates an MMapFile object, and maps the file if the mode
+ *  parameter is given.
+ ******************************************************************************/
+MMapFile::MMapFile (const String& name	/**< Name of the file to map. */,
+					int mode			/**< Mode for opening, which must be IO_Readable. */)
+		: IODevice ()
+{
+	mName	= name;
+	mpData	= NULL;
+	mSize	= 0;
+	mPos	= 0;
+
+	if (mode)
+		if (! open (mode))
+			throw open_failure (i18n("Could not map file '%1' with mode %2: %3.")
+								.arg(mName).arg(mode).arg(strerror(errno)));
+}
+
+MMapFile::~MMapFile ()
+{
+	close ();
+}
+
+/*******************************************************************************
+ * Maps the file to memory.
+ *
+ *  @return true if successful, false if the file could not be
+ *  opened or mapped, or if the mode was not readable only.
+ ******************************************************************************/
+bool MMapFile::open (int mode)
+{
+	if (isOpen())
+		close ();
+
+	if ((mode & IO_Writable) || !(mode & IO_Readable)) {
+		errno = EINVAL;
+		return false;
+	}
+
+	int fd = ::open ((CONSTR) mName, O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	struct stat statbuf;
+	int error = 0;
+	if (fstat (fd, &statbuf) != 0)
+		error = errno;
+	else if (!S_ISREG (statbuf.st_mode))
+		error = ENODEV;
+	if (error) {
+		::close (fd);
+		errno = error;
+		return false;
+	}
+
+	// An empty file can not be mapped, and need not be
+	void* mapping = NULL;
+	if (statbuf.st_size > 0) {
+		mapping = mmap (NULL, statbuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (mapping == MAP_FAILED) {
+			::close (fd);
+			return false;
+		}
+		madvise (mapping, statbuf.st_size, MADV_SEQUENTIAL);
+	}
+
+	// The mapping stays valid without the descriptor
+	::close (fd);
+
+	mpData	= (const char*) mapping;
+	mSize	= statbuf.st_size;
+	mPos	= 0;
+
+	setMode (mode);
+	resetStatus ();
+	setOpen ();
+	return true;
+}
+
+/*******************************************************************************
+ * Unmaps the file. Any views to the file become invalid.
+ ******************************************************************************/
+void MMapFile::close ()
+{
+	if (!isOpen())
+		return;
+
+	if (mpData)
+		munmap ((void*) mpData, mSize);
+
+	mpData	= NULL;
+	mSize	= 0;
+	mPos	= 0;
+	setClosed ();
+}
+
+/*******************************************************************************
+ * Moves to the given position in the file.
+ *
+ *  @return true if successful, false if the position is outside
+ *  the file.
+ ******************************************************************************/
+bool MMapFile::seek (int position)
+{
+	if (position < 0 || size_t (position) > mSize)
+		return false;
+	mPos = position;
+	return true;
+}
+
+/*******************************************************************************
+ * Copies a data block of at most the given length to a buffer.
+ *
+ *  @return The number of bytes actually read.
+ ******************************************************************************/
+int MMapFile::readBlock (char* data,	/**< Data buffer to receive the block read. */
+						 uint len		/**< Maximum number of bytes to read. */)
+{
+	ASSERT (data && len>0);
+	if (mPos >= mSize)
+		return 0;
+	size_t bytes = mSize - mPos;
+	if (bytes > len)
+		bytes = len;
+	memcpy (data, mpData + mPos, bytes);
+	mPos += bytes;
+	return bytes;
+}
+
+/*******************************************************************************
+ * Copies a newline-terminated line to a character buffer.
+ *
+ *  Reads at most maxlen-1 bytes, and terminates the data with a zero.
+ *
+ *  @return Number of bytes read, including the newline.
+ ******************************************************************************/
+int MMapFile::readLine (char* data,		/**< Data buffer to receive the line. */
+						uint maxlen		/**< Size of the data buffer. */)
+{
+	ASSERT (data && maxlen>0);
+	if (mPos >= mSize) {
+		data[0] = '\0';
+		return 0;
+	}
+	size_t bytes = mSize - mPos;
+	if (bytes > maxlen-1)
+		bytes = maxlen-1;
+
+	const char* start = mpData + mPos;
+	const char* newline = (const char*) memchr (start, '\n', bytes);
+	if (newline)
+		bytes = newline - start + 1;
+
+	memcpy (data, start, bytes);
+	data[bytes] = '\0';
+	mPos += bytes;
+	return bytes;
+}
+
+/*******************************************************************************
+ * Copies a newline-terminated line to a string.
+ *
+ *  @return Number of bytes read, including the newline, or 0 at the
+ *  end of the file.
+ ******************************************************************************/
+int MMapFile::readLine (String& str,	/**< String to receive the line. */
+						int maxlen		/**< Maximum number of bytes to read or -1 for unlimited. */)
+{
+	str.empty ();
+	if (mPos >= mSize)
+		return 0;
+
+	size_t bytes = mSize - mPos;
+	if (maxlen >= 0 && bytes > size_t (maxlen))
+		bytes = maxlen;
+
+	const char* start = mpData + mPos;
+	const char* newline = (const char*) memchr (start, '\n', bytes);
+	if (newline)
+		bytes = newline - start + 1;
+
+	str.append (start, bytes);
+	mPos += bytes;
+	return bytes;
+}
+
+/*******************************************************************************
+ * Gives a view of the next newline-terminated line, without copying.
+ *
+ *  The view includes the newline, if any.
+ *
+ *  @return Length of the line, or 0 at the end of the file.
+ ******************************************************************************/
+int MMapFile::readLine (SubString& line	/**< View to receive the line. */)
+{
+	if (mPos >= mSize) {
+		line = SubString ();
+		return 0;
+	}
+	const char* start = mpData + mPos;
+	size_t bytes = mSize - mPos;
+	const char* newline = (const char*) memchr (start, '\n', bytes);
+	if (newline)
+		bytes = newline - start + 1;
+
+	line = SubString (start, bytes);
+	mPos += bytes;
+	return bytes;
+}
+
+/*******************************************************************************
+ * Returns a view of the given part of the file, limited to the end
+ * of the file.
+ ******************************************************************************/
+SubString MMapFile::view (uint offset, uint len) const
+{
+	if (offset > mSize)
+		offset = mSize;
+	if (len > mSize - offset)
+		len = mSize - offset;
+	return SubString (mpData + offset, len);
+}
+
+/*******************************************************************************
+ * The device is read-only; writing sets the status to IO_WriteError.
+ *
+ *  @return 0
+ ******************************************************************************/
+int MMapFile::writeBlock (const char* data, uint len)
+{
+	setStatus (IO_WriteError);
+	return 0;
+}
+
+/*******************************************************************************
+ * The device is read-only; writing sets the status to IO_WriteError.
+ ******************************************************************************/
+void MMapFile::putch (char ch)
+{
+	setStatus (IO_WriteError);
+}
+
+/*******************************************************************************
+ * Moves back by one character.
+ *
+ *  The mapping is read-only, so the character must be the one that
+ *  was read last; it is not written.
+ ******************************************************************************/
+void MMapFile::ungetch (char ch)
+{
+	if (mPos > 0)
+		mPos--;
+}
+
+END_NAMESPACE;
@@ -28,10 +28,280 @@
 #include <magic/mmatrix.h>
 #include <magic/mstream.h>
 #include <magic/mtextstream.h>
+#include <magic/mdatastream.h>
 #include <magic/mlist.h>
+#include <magic/mpackarray.h>
 
 BEGIN_NAMESPACE (MagiC);
 
+///////////////////////////////////////////////////////////////////////////////
+// Matrix multiplication kernels
+///////////////////////////////////////////////////////////////////////////////
+
+// Blocking of the matrix product. The MR x NR micro-tile of C is kept
+// in registers, a KC x NR sliver of B in L1 cache, an MC x KC block of
+// A in L2 cache, and a KC x NC panel of B in L3 cache.
+#define MATRIX_GEMM_MR	6
+#define MATRIX_GEMM_NR	8
+#define MATRIX_GEMM_KC	256
+#define MATRIX_GEMM_MC	120
+#define MATRIX_GEMM_NC	1024
+
+// Block size for transposing and the LU panel width
+#define MATRIX_TRANSPOSE_BLOCK	32
+#define MATRIX_LU_BLOCK			64
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define MATRIX_AVX2_KERNEL 1
+#include <immintrin.h>
+#endif
+
+static inline int imin (int a, int b) {return (a<b)? a : b;}
+static inline int roundUp (int a, int step) {return (a+step-1) / step * step;}
+
+typedef void MatrixMicroKernel (int kc, const double* a, const double* b,
+								double* c, int ldc, double alpha, int mr, int nr);
+
+/** Adds alpha times a micro-tile, of which the top-left mr x nr
+ *  items are used, to C.
+ **/
+static inline void addTile (const double* tile, double* c, int ldc, double alpha, int mr, int nr)
+{
+	for (int i=0; i<mr; i++)
+		for (int j=0; j<nr; j++)
+			c[i*ldc+j] += alpha * tile[i*MATRIX_GEMM_NR+j];
+}
+
+/** Portable micro-kernel: multiplies a packed MR x kc sliver of A by a
+ *  packed kc x NR sliver of B, and adds alpha times the result to C.
+ **/
+static void microKernelScalar (int kc, const double* a, const double* b,
+							   double* c, int ldc, double alpha, int mr, int nr)
+{
+	double tile [MATRIX_GEMM_MR*MATRIX_GEMM_NR];
+	for (int i=0; i<MATRIX_GEMM_MR*MATRIX_GEMM_NR; i++)
+		tile[i] = 0.0;
+
+	for (int k=0; k<kc; k++, a+=MATRIX_GEMM_MR, b+=MATRIX_GEMM_NR)
+		for (int i=0; i<MATRIX_GEMM_MR; i++)
+			for (int j=0; j<MATRIX_GEMM_NR; j++)
+				tile[i*MATRIX_GEMM_NR+j] += a[i] * b[j];
+
+	addTile (tile, c, ldc, alpha, mr, nr);
+}
+
+#ifdef MATRIX_AVX2_KERNEL
+/** AVX2/FMA micro-kernel, keeping the 6 x 8 tile in twelve registers.
+ *  Used only if the processor supports the instructions.
+ **/
+__attribute__ ((target ("avx2,fma")))
+static void microKernelAVX2 (int kc, const double* a, const double* b,
+							 double* c, int ldc, double alpha, int mr, int nr)
+{
+	__m256d c00 = _mm256_setzero_pd (), c01 = _mm256_setzero_pd ();
+	__m256d c10 = _mm256_setzero_pd (), c11 = _mm256_setzero_pd ();
+	__m256d c20 = _mm256_setzero_pd (), c21 = _mm256_setzero_pd ();
+	__m256d c30 = _mm256_setzero_pd (), c31 = _mm256_setzero_pd ();
+	__m256d c40 = _mm256_setzero_pd (), c41 = _mm256_setzero_pd ();
+	__m256d c50 = _mm256_setzero_pd (), c51 = _mm256_setzero_pd ();
+
+	for (int k=0; k<kc; k++, a+=MATRIX_GEMM_MR, b+=MATRIX_GEMM_NR) {
+		__m256d b0 = _mm256_loadu_pd (b);
+		__m256d b1 = _mm256_loadu_pd (b+4);
+		__m256d ai;
+		ai = _mm256_broadcast_sd (a);
+		c00 = _mm256_fmadd_pd (ai, b0, c00); c01 = _mm256_fmadd_pd (ai, b1, c01);
+		ai = _mm256_broadcast_sd (a+1);
+		c10 = _mm256_fmadd_pd (ai, b0, c10); c11 = _mm256_fmadd_pd (ai, b1, c11);
+		ai = _mm256_broadcast_sd (a+2);
+		c20 = _mm256_fmadd_pd (ai, b0, c20); c21 = _mm256_fmadd_pd (ai, b1, c21);
+		ai = _mm256_broadcast_sd (a+3);
+		c30 = _mm256_fmadd_pd (ai, b0, c30); c31 = _mm256_fmadd_pd (ai, b1, c31);
+		ai = _mm256_broadcast_sd (a+4);
+		c40 = _mm256_fmadd_pd (ai, b0, c40); c41 = _mm256_fmadd_pd (ai, b1, c41);
+		ai = _mm256_broadcast_sd (a+5);
+		c50 = _mm256_fmadd_pd (ai, b0, c50); c51 = _mm256_fmadd_pd (ai, b1, c51);
+	}
+
+	__m256d rows [MATRIX_GEMM_MR][2] = {{c00, c01}, {c10, c11}, {c20, c21},
+										{c30, c31}, {c40, c41}, {c50, c51}};
+	if (mr == MATRIX_GEMM_MR && nr == MATRIX_GEMM_NR) {
+		__m256d alphas = _mm256_set1_pd (alpha);
+		for (int i=0; i<MATRIX_GEMM_MR; i++, c+=ldc) {
+			_mm256_storeu_pd (c, _mm256_fmadd_pd (alphas, rows[i][0], _mm256_loadu_pd (c)));
+			_mm256_storeu_pd (c+4, _mm256_fmadd_pd (alphas, rows[i][1], _mm256_loadu_pd (c+4)));
+		}
+	} else {
+		double tile [MATRIX_GEMM_MR*MATRIX_GEMM_NR];
+		for (int i=0; i<MATRIX_GEMM_MR; i++) {
+			_mm256_storeu_pd (tile + i*MATRIX_GEMM_NR, rows[i][0]);
+			_mm256_storeu_pd (tile + i*MATRIX_GEMM_NR + 4, rows[i][1]);
+		}
+		addTile (tile, c, ldc, alpha, mr, nr);
+	}
+}
+#endif
+
+/** Returns the micro-kernel of the instruction set, or NULL if the
+ *  processor does not support it.
+ **/
+static MatrixMicroKernel* microKernel (int set)
+{
+	switch (set) {
+	  case MATRIXKERNEL_SCALAR:
+		  return microKernelScalar;
+#ifdef MATRIX_AVX2_KERNEL
+	  case MATRIXKERNEL_AVX2:
+		  if (__builtin_cpu_supports ("avx2") && __builtin_cpu_supports ("fma"))
+			  return microKernelAVX2;
+		  break;
+#endif
+	}
+	return NULL;
+}
+
+// The instruction set of the matrix product, -1 until selected
+static int matrixKernelSet = -1;
+
+/*******************************************************************************
+ * Returns the instruction set used by the matrix product, one of
+ * @ref matrixkernelset. Unless set with @ref setMatrixKernel(), it is
+ * the fastest one the processor supports.
+ ******************************************************************************/
+int matrixKernel ()
+{
+	int set = __atomic_load_n (&matrixKernelSet, __ATOMIC_RELAXED);
+	if (set < 0) {
+		set = MATRIXKERNEL_SCALAR;
+		for (int s=MATRIXKERNEL_SCALAR+1; s<MATRIXKERNEL_SETS; s++)
+			if (microKernel (s))
+				set = s;
+		__atomic_store_n (&matrixKernelSet, set, __ATOMIC_RELAXED);
+	}
+	return set;
+}
+
+/*******************************************************************************
+ * Selects the instruction set of the matrix product for all threads,
+ * for example to compare the kernels.
+ *
+ * @return false if the processor does not support the set, in which
+ * case the selection is not changed.
+ ******************************************************************************/
+bool setMatrixKernel (int set /**< One of @ref matrixkernelset. */)
+{
+	if (!microKernel (set))
+		return false;
+	__atomic_store_n (&matrixKernelSet, set, __ATOMIC_RELAXED);
+	return true;
+}
+
+/** Packing buffers of the matrix product. Each thread keeps its own,
+ *  grown to the largest blocks it has multiplied, until it exits.
+ **/
+struct GemmBuffers {
+	double*	packedA;
+	double*	packedB;
+	size_t	sizeA;
+	size_t	sizeB;
+
+			GemmBuffers		() : packedA (NULL), packedB (NULL), sizeA (0), sizeB (0) {}
+			~GemmBuffers	() {free (packedA); free (packedB);}
+};
+
+static thread_local GemmBuffers gemmBuffers;
+
+/** Makes the buffer hold at least the given number of items. The
+ *  contents are not kept.
+ **/
+static void growBuffer (double*& buffer, size_t& size, size_t items)
+{
+	if (items <= size)
+		return;
+	free (buffer);
+	buffer = NULL;
+	size = 0;
+	buffer = (double*) reallocItems (NULL, int (items), sizeof (double));
+	size = items;
+}
+
+/** Packs an mc x kc block of A into slivers of MR rows, stored column
+ *  by column. The last sliver is padded with zeroes.
+ **/
+static void packA (int mc, int kc, const double* a, int lda, double* packed)
+{
+	for (int i0=0; i0<mc; i0+=MATRIX_GEMM_MR) {
+		int mr = imin (MATRIX_GEMM_MR, mc-i0);
+		for (int k=0; k<kc; k++) {
+			for (int i=0; i<mr; i++)
+				*packed++ = a[(i0+i)*lda + k];
+			for (int i=mr; i<MATRIX_GEMM_MR; i++)
+				*packed++ = 0.0;
+		}
+	}
+}
+
+/** Packs a kc x nc panel of B into slivers of NR columns, stored row
+ *  by row. The last sliver is padded with zeroes.
+ **/
+static void packB (int kc, int nc, const double* b, int ldb, double* packed)
+{
+	for (int j0=0; j0<nc; j0+=MATRIX_GEMM_NR) {
+		int nr = imin (MATRIX_GEMM_NR, nc-j0);
+		for (int k=0; k<kc; k++) {
+			const double* row = b + k*ldb + j0;
+			for (int j=0; j<nr; j++)
+				*packed++ = row[j];
+			for (int j=nr; j<MATRIX_GEMM_NR; j++)
+				*packed++ = 0.0;
+		}
+	}
+}
+
+/*******************************************************************************
+ * Computes C += alpha*A*B for row-major m x k matrix A, k x n matrix B
+ * and m x n matrix C, with the given row strides.
+ *
+ * The operands are multiplied block by block, packing each block to
+ * the thread's buffers in the order the micro-kernel reads it. The
+ * micro-kernel is the one of @ref matrixKernel().
+ ******************************************************************************/
+static void gemm (int m, int n, int k, double alpha,
+				  const double* a, int lda, const double* b, int ldb,
+				  double* c, int ldc)
+{
+	if (m <= 0 || n <= 0 || k <= 0)
+		return;
+
+	MatrixMicroKernel* kernel = microKernel (matrixKernel ());
+
+	// Blocks are padded to whole slivers when packed
+	GemmBuffers& buffers = gemmBuffers;
+	growBuffer (buffers.packedA, buffers.sizeA,
+				size_t (roundUp (imin (m, MATRIX_GEMM_MC), MATRIX_GEMM_MR)) * imin (k, MATRIX_GEMM_KC));
+	growBuffer (buffers.packedB, buffers.sizeB,
+				size_t (roundUp (imin (n, MATRIX_GEMM_NC), MATRIX_GEMM_NR)) * imin (k, MATRIX_GEMM_KC));
+	double* packedA = buffers.packedA;
+	double* packedB = buffers.packedB;
+
+	for (int jc=0; jc<n; jc+=MATRIX_GEMM_NC) {
+		int nc = imin (MATRIX_GEMM_NC, n-jc);
+		for (int pc=0; pc<k; pc+=MATRIX_GEMM_KC) {
+			int kc = imin (MATRIX_GEMM_KC, k-pc);
+			packB (kc, nc, b + pc*ldb + jc, ldb, packedB);
+			for (int ic=0; ic<m; ic+=MATRIX_GEMM_MC) {
+				int mc = imin (MATRIX_GEMM_MC, m-ic);
+				packA (mc, kc, a + ic*lda + pc, lda, packedA);
+				for (int jr=0; jr<nc; jr+=MATRIX_GEMM_NR)
+					for (int ir=0; ir<mc; ir+=MATRIX_GEMM_MR)
+						kernel (kc, packedA + ir*kc, packedB + jr*kc,
+								c + (ic+ir)*ldc + jc+jr, ldc, alpha,
+								imin (MATRIX_GEMM_MR, mc-ir), imin (MATRIX_GEMM_NR, nc-jr));
+			}
+		}
+	}
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 //                         |   |               o                             //
 //                         |\ /|  ___   |                                    //
@@ -126,12 +396,43 @@ void Matrix::save (FILE* out) const {
 }
 
 /*******************************************************************************
+ * Transposes the matrix.
  *
+ * Square matrices are transposed in place, by swapping blocks that
+ * fit in cache. Other matrices are copied block by block to a new
+ * buffer.
  ******************************************************************************/
 const Matrix& Matrix::transpose () {
-	for (int i=0; i<rows; i++)
-		for (int j=i; j<cols; j++)
-			swap (get(i,j), get(j,i));
+	const int block = MATRIX_TRANSPOSE_BLOCK;
+	if (rows == cols) {
+		for (int ib=0; ib<rows; ib+=block)
+			for (int jb=ib; jb<cols; jb+=block) {
+				int iend = imin (ib+block, rows);
+				int jend = imin (jb+block, cols);
+				for (int i=ib; i<iend; i++)
+					for (int j=(ib==jb)? i+1 : jb; j<jend; j++)
+						swap (mData[i*cols+j], mData[j*cols+i]);
+			}
+	} else if (mData) {
+		double* transposed = new double [rows*cols];
+		for (int ib=0; ib<rows; ib+=block)
+			for (int jb=0; jb<cols; jb+=block) {
+				int iend = imin (ib+block, rows);
+				int jend = imin (jb+block, cols);
+				for (int i=ib; i<iend; i++)
+					for (int j=jb; j<jend; j++)
+						transposed[j*rows+i] = mData[i*cols+j];
+			}
+		delete [] mData;
+		mData = transposed;
+		int oldrows = rows;
+		rows = cols;
+		cols = oldrows;
+	} else {
+		int oldrows = rows;
+		rows = cols;
+		cols = oldrows;
+	}
 	return *this;
 }
 
@@ -159,41 +460,158 @@ double Matrix::sum () const
 }
 
 /*******************************************************************************
- * Computes the determinant of the matrix.
+ * Computes the determinant of the matrix from its LU decomposition.
+ *
+ * @return The determinant, or 0 if the matrix is not square.
  ******************************************************************************/
 double Matrix::det () const
 {
-	if (rows != cols || rows<2)
+	if (rows != cols || rows<1)
+		return 0;
+
+	Matrix lu (*this);
+	PackArray<int> pivots;
+	int sign;
+	if (!lu.luDecompose (pivots, &sign))
 		return 0;
 
-	if (rows == 2)
-		return mData[0]*mData[3] - mData[1]*mData[2];
+	double result = sign;
+	for (int i=0; i<rows; i++)
+		result *= lu.mData[i*cols+i];
+	return result;
+}
+
+/*******************************************************************************
+ * Sets the matrix to the matrix product a*b.
+ *
+ * Either operand may be the matrix itself.
+ ******************************************************************************/
+void Matrix::multiply (const Matrix& a, const Matrix& b)
+{
+	ASSERTWITH (a.cols == b.rows, strformat ("Matrix product of %dx%d and %dx%d matrices.",
+											 a.rows, a.cols, b.rows, b.cols));
+	if (this == &a || this == &b) {
+		Matrix result;
+		result.multiply (a, b);
+		*this = result;
+		return;
+	}
+
+	make (a.rows, b.cols);
+	gemm (a.rows, b.cols, a.cols, 1.0, a.mData, a.cols, b.mData, b.cols, mData, cols);
+}
+
+/*******************************************************************************
+ * Replaces a square matrix with its LU decomposition with partial
+ * pivoting, PA = LU.
+ *
+ * The strictly lower triangle holds L, which has a unit diagonal, and
+ * the upper triangle holds U. Row i was exchanged with row pivots[i]
+ * at step i. The decomposition proceeds in panels of columns, and the
+ * trailing part of the matrix is updated with the blocked matrix
+ * product.
+ *
+ * @return false if the matrix is singular, in which case U has a zero
+ * on its diagonal.
+ ******************************************************************************/
+bool Matrix::luDecompose (
+	PackArray<int>& pivots,	/**< Receives the row exchanges. */
+	int* pSign				/**< Receives the sign of the permutation, if given. */)
+{
+	ASSERTWITH (rows == cols, "LU decomposition of a non-square matrix.");
+
+	const int n = rows;
+	bool regular = true;
+	int sign = 1;
+	pivots.make (n);
+
+	for (int j0=0; j0<n; j0+=MATRIX_LU_BLOCK) {
+		int jend = imin (j0+MATRIX_LU_BLOCK, n);
+
+		// Factor the panel of columns j0..jend-1
+		for (int k=j0; k<jend; k++) {
+			int pivot = k;
+			for (int i=k+1; i<n; i++)
+				if (fabs (mData[i*n+k]) > fabs (mData[pivot*n+k]))
+					pivot = i;
+			pivots[k] = pivot;
+			if (pivot != k) {
+				swaprows (k, pivot);
+				sign = -sign;
+			}
 
-	// Compute determinant of a sub-matrix
+			double diag = mData[k*n+k];
+			if (diag == 0) {
+				regular = false;
+				continue;
+			}
+			const double* rowk = mData + k*n;
+			for (int i=k+1; i<n; i++) {
+				double* rowi = mData + i*n;
+				double l = (rowi[k] /= diag);
+				if (l != 0)
+					for (int j=k+1; j<jend; j++)
+						rowi[j] -= l * rowk[j];
+			}
+		}
 
-	// Find a row with non-zero first column
-	int rownon0;
-	for (rownon0=0; rownon0<rows; rownon0++)
-		if (get(rownon0,0) != 0)
+		if (jend == n)
 			break;
 
-	if (rownon0 == rows)
-		return 0;
+		// Solve the block row of U to the right of the panel
+		for (int k=j0; k<jend; k++) {
+			const double* rowk = mData + k*n;
+			for (int i=k+1; i<jend; i++) {
+				double* rowi = mData + i*n;
+				double l = rowi[k];
+				if (l != 0)
+					for (int j=jend; j<n; j++)
+						rowi[j] -= l * rowk[j];
+			}
+		}
 
-	// Prepare for taking complement by making a column with
-	// zeroes, except for one row.
-	Matrix modified (*this);
-	double scale_to = get(rownon0, 0);
-	for (int row=0; row<rows; row++)
-		if (row != rownon0 && get(row,0)!=0)
-			modified.addRowByScalar (rownon0, row, -get(row,0)/scale_to);
+		// Update the trailing matrix
+		gemm (n-jend, n-jend, jend-j0, -1.0,
+			  mData + jend*n + j0, n, mData + j0*n + jend, n, mData + jend*n + jend, n);
+	}
+
+	if (pSign)
+		*pSign = sign;
+	return regular;
+}
 
-	// Create complement
-	Matrix cmpl = modified.complement (rownon0, 0);
+/*******************************************************************************
+ * Solves Ax = b in place, when the matrix holds the LU decomposition
+ * of A made with @ref luDecompose().
+ ******************************************************************************/
+void Matrix::luSolve (
+	const PackArray<int>& pivots,	/**< Row exchanges from the decomposition. */
+	Vector& x						/**< The right-hand side b, replaced with the solution. */) const
+{
+	ASSERT (rows == cols && x.size () == rows && pivots.size () == rows);
+
+	const int n = rows;
+	for (int i=0; i<n; i++)
+		if (pivots[i] != i)
+			swap (x[i], x[pivots[i]]);
+
+	// Forward substitution with L
+	for (int i=1; i<n; i++) {
+		const double* rowi = mData + i*n;
+		double sum = x[i];
+		for (int j=0; j<i; j++)
+			sum -= rowi[j] * x[j];
+		x[i] = sum;
+	}
 
-	// Compute determinant of the complement, and multiply it by the
-	// nonzero element, and the appropriate sign.
-	return get(rownon0, 0) * cmpl.det () * (1-(rownon0%2)*2);
+	// Back substitution with U
+	for (int i=n-1; i>=0; i--) {
+		const double* rowi = mData + i*n;
+		double sum = x[i];
+		for (int j=i+1; j<n; j++)
+			sum -= rowi[j] * x[j];
+		x[i] = sum / rowi[i];
+	}
 }
 
 /*******************************************************************************
@@ -337,6 +755,28 @@ TextOStream& Matrix::operator>> (TextOStream& out) const
 	return out;
 }
 
+/*******************************************************************************
+ * Serializes the matrix as its dimensions followed by the elements,
+ * row by row.
+ ******************************************************************************/
+DataOStream& Matrix::operator>> (DataOStream& out) const
+{
+	out.name ("rows") << rows;
+	out.name ("cols") << cols;
+	return out.writeArray (mData, rows*cols);
+}
+
+/*******************************************************************************
+ * Reads a matrix serialized with the output operator.
+ ******************************************************************************/
+DataIStream& Matrix::operator<< (DataIStream& in)
+{
+	int nrows, ncols;
+	in >> nrows >> ncols;
+	make (nrows, ncols);
+	return in.readArray (mData, rows*cols);
+}
+
 /*******************************************************************************
  * Splits the matrix column-wise to the given two matrices.
  ******************************************************************************/
@@ -376,11 +816,10 @@ void Matrix::joinVertical (const Matrix& a, const Vector& b)
 
 	make (a.rows, a.cols+1);
 
-	int collen  = cols*sizeof(double);
 	int acollen = a.cols*sizeof(double);
 	for (int r=0; r<rows; r++) {
 		// Copy matrix row
-		memcpy (mData + r*collen, a.mData + r*acollen, acollen);
+		memcpy (mData + r*cols, a.mData + r*a.cols, acollen);
 
 		// Copy vector element
 		mData[r*cols + cols-1] = b[r];
@@ -475,9 +914,24 @@ double& SubMatrix::get (int row, int col) {
 
 /*******************************************************************************
  * Solves linear equation.
+ *
+ * Square systems are solved by LU decomposition, others with the
+ * Gauss-Jordan method of the augmented matrix.
+ *
+ * @return 0 if solution was found, nonzero otherwise
  ******************************************************************************/
 int solveLinear		(const Matrix& mat, const Vector& b, Vector& result)
 {
+	if (mat.rows == mat.cols) {
+		Matrix lu (mat);
+		PackArray<int> pivots;
+		if (!lu.luDecompose (pivots))
+			return 1; // Unsolvable
+		result = b;
+		lu.luSolve (pivots, result);
+		return 0;
+	}
+
 	// Create augmented matrix
 	Matrix augmat (mat);
 	augmat.joinVertical (mat, b);
@@ -0,0 +1,272 @@
+/***************************************************************************
+ *   This file is part of the MagiC++ library.                             *
+ *                                                                         *
+ *   Copyright (C) 1998-2002 Marko Grnroos <magi@iki.fi>                  *
+ *                                                                         *
+ ***************************************************************************
+ *                                                                         *
+ *  This library is free software; you can redistribute it and/or          *
+ *  modify it under the terms of the GNU Library General Public            *
+ *  License as published by the Free Software Foundation; either           *
+ *  version 2 of the License, or (at your option) any later version.       *
+ *                                                                         *
+ *  This library is distributed in the hope that it will be useful,        *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU      *
+ *  Library General Public License for more details.                       *
+ *                                                                         *
+ *  You should have received a copy of the GNU Library General Public      *
+ *  License along with this library; see the file COPYING.LIB.  If         *
+ *  not, write to the Free Software Foundation, Inc., 59 Temple Place      *
+ *  - Suite 330, Boston, MA 02111-1307, USA.                               *
+ *                                                                         *
+ ***************************************************************************/
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "magic/mnotifier.h"
+
+BEGIN_NAMESPACE (MagiC);
+
+///////////////////////////////////////////////////////////////////////////////
+//                                                                           //
+//   ___               o             |\   |           o   _  o               //
+//   |  \   ___           ___   ___  | \  |  ___   |     /      ___          //
+//   |   | /   ) |   | | /   \ /   ) |  \ | /   \ -+- | -+-  | /   ) |/\     //
+//   |   | |---   \ /  | |     |---  |   \| |   |  |  |  |   | |---  |       //
+//   |__/   \__    V   | \___/  \__  |    | \___/  \_ |  |   |  \__  |       //
+//                                                                           //
+///////////////////////////////////////////////////////////////////////////////
+
+/** A device watched by a @ref DeviceNotifier. */
+struct DeviceNotifier::Entry {
+	IODevice*		device;		/**< The watched device.                     */
+	DeviceHandler*	handler;	/**< Handler of its events.                  */
+	int				handle;		/**< Handle of the device when it was added. */
+	int				events;		/**< Watched events and flags.               */
+	bool			removed;	/**< Has the device been removed?            */
+	Entry*			next;		/**< Next in the list of removed entries.    */
+};
+
+/** Converts the watched events and flags to those of epoll. */
+static uint32_t notifyToEpoll (int events)
+{
+	return ((events & IO_ReadReady)? (EPOLLIN | EPOLLRDHUP) : 0)
+		| ((events & IO_WriteReady)? EPOLLOUT : 0)
+		| ((events & NOTIFY_ONESHOT)? EPOLLONESHOT : 0)
+		| ((events & NOTIFY_EDGE)? EPOLLET : 0);
+}
+
+/** Converts the events reported by epoll to @ref io_events. */
+static int notifyFromEpoll (uint32_t events, int watched)
+{
+	int result = ((events & (EPOLLIN | EPOLLRDHUP))? IO_ReadReady : 0)
+		| ((events & EPOLLOUT)? IO_WriteReady : 0);
+	if (events & (EPOLLHUP | EPOLLERR))
+		result |= IO_HangUp | (watched & IO_ReadReady);
+	return result;
+}
+
+/*******************************************************************************
+ * Creates a notifier without devices.
+ *
+ * @throw system_failure if epoll is not available.
+ ******************************************************************************/
+DeviceNotifier::DeviceNotifier ()
+{
+	mpRemoved = NULL;
+	mCount = 0;
+	mStopped = false;
+
+	mEpoll = epoll_create1 (EPOLL_CLOEXEC);
+	mWakeup = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (mEpoll < 0 || mWakeup < 0)
+		throw system_failure (i18n ("Creating the device notifier failed: %1").arg (strerror (errno)));
+
+	struct epoll_event event;
+	event.events = EPOLLIN;
+	event.data.ptr = NULL;
+	epoll_ctl (mEpoll, EPOLL_CTL_ADD, mWakeup, &event);
+}
+
+DeviceNotifier::~DeviceNotifier ()
+{
+	collect ();
+	for (int i=0; i<mEntries.size(); i++)
+		delete mEntries[i];
+	::close (mWakeup);
+	::close (mEpoll);
+}
+
+/*******************************************************************************
+ * Starts watching the device.
+ *
+ * @return true if successful, false if the device is not open or
+ * already watched, or epoll refused it.
+ ******************************************************************************/
+bool DeviceNotifier::addDevice (IODevice* device,		/**< An open device with a handle. */
+								DeviceHandler* handler,	/**< Handler of the events of the device. */
+								int events				/**< @ref io_events and @ref notify_flags to watch. */)
+{
+	int handle = device->handle ();
+	if (handle < 0)
+		return false;
+
+	MutexLocker locker (mLock);
+	if (handle >= mEntries.size ())
+		mEntries.resize (handle + 1 + handle/2);
+
+	if (mEntries[handle]) {
+		if (mEntries[handle]->device == device)
+			return false;
+
+		// The old device was closed without removing it
+		epoll_ctl (mEpoll, EPOLL_CTL_DEL, handle, NULL);
+		__atomic_store_n (&mEntries[handle]->removed, true, __ATOMIC_RELEASE);
+		mEntries[handle]->next = mpRemoved;
+		mpRemoved = mEntries[handle];
+		mEntries[handle] = NULL;
+		__atomic_sub_fetch (&mCount, 1, __ATOMIC_RELAXED);
+	}
+
+	Entry* entry = new Entry;
+	entry->device = device;
+	entry->handler = handler;
+	entry->handle = handle;
+	entry->events = events;
+	entry->removed = false;
+	entry->next = NULL;
+	if (!control (EPOLL_CTL_ADD, entry, events)) {
+		delete entry;
+		return false;
+	}
+	mEntries[handle] = entry;
+	__atomic_add_fetch (&mCount, 1, __ATOMIC_RELAXED);
+	return true;
+}
+
+/*******************************************************************************
+ * Changes the watched events of the device. This also rearms a
+ * device watched with NOTIFY_ONESHOT.
+ *
+ * @return false if the device is not watched.
+ ******************************************************************************/
+bool DeviceNotifier::modifyDevice (IODevice* device, int events)
+{
+	int handle = device->handle ();
+	MutexLocker locker (mLock);
+	if (handle < 0 || handle >= mEntries.size () || !mEntries[handle] || mEntries[handle]->device != device)
+		return false;
+
+	mEntries[handle]->events = events;
+	return control (EPOLL_CTL_MOD, mEntries[handle], events);
+}
+
+/*******************************************************************************
+ * Stops watching the device. Call before closing it.
+ *
+ * @return false if the device is not watched.
+ ******************************************************************************/
+bool DeviceNotifier::removeDevice (IODevice* device)
+{
+	int handle = device->handle ();
+	MutexLocker locker (mLock);
+	if (handle < 0 || handle >= mEntries.size () || !mEntries[handle] || mEntries[handle]->device != device)
+		return false;
+
+	Entry* entry = mEntries[handle];
+	epoll_ctl (mEpoll, EPOLL_CTL_DEL, handle, NULL);
+
+	// The notifier thread may have the entry among its events, so it
+	// is freed only before the next wait.
+	__atomic_store_n (&entry->removed, true, __ATOMIC_RELEASE);
+	entry->next = mpRemoved;
+	mpRemoved = entry;
+	mEntries[handle] = NULL;
+	__atomic_sub_fetch (&mCount, 1, __ATOMIC_RELAXED);
+	return true;
+}
+
+/** Adds or modifies the epoll registration of the entry. */
+bool DeviceNotifier::control (int operation, Entry* entry, int events)
+{
+	struct epoll_event event;
+	event.events = notifyToEpoll (events);
+	event.data.ptr = entry;
+	return epoll_ctl (mEpoll, operation, entry->handle, &event) == 0;
+}
+
+/** Frees the removed entries. */
+void DeviceNotifier::collect ()
+{
+	Entry* entry;
+	{
+		MutexLocker locker (mLock);
+		entry = mpRemoved;
+		mpRemoved = NULL;
+	}
+	while (entry) {
+		Entry* next = entry->next;
+		delete entry;
+		entry = next;
+	}
+}
+
+/*******************************************************************************
+ * Waits for events and calls the handlers of the ready devices.
+ *
+ * @return The number of device events handled, 0 if the time ran
+ * out or the wait was interrupted, or -1 on error.
+ ******************************************************************************/
+int DeviceNotifier::runOnce (double seconds /**< Time to wait at most, or negative for no limit. */)
+{
+	collect ();
+
+	struct epoll_event events [256];
+	int count = epoll_wait (mEpoll, events, 256, (seconds < 0)? -1 : int (seconds*1000 + 0.5));
+	if (count < 0)
+		return (errno == EINTR)? 0 : -1;
+
+	int handled = 0;
+	for (int i=0; i<count; i++) {
+		Entry* entry = (Entry*) events[i].data.ptr;
+		if (!entry) {
+			uint64_t value;
+			if (::read (mWakeup, &value, sizeof (value))) {}
+			continue;
+		}
+		if (__atomic_load_n (&entry->removed, __ATOMIC_ACQUIRE))
+			continue;
+
+		entry->handler->deviceEvent (*this, entry->device, notifyFromEpoll (events[i].events, entry->events));
+		handled++;
+	}
+	return handled;
+}
+
+/*******************************************************************************
+ * Handles events until @ref stop() is called.
+ ******************************************************************************/
+void DeviceNotifier::run ()
+{
+	while (!__atomic_load_n (&mStopped, __ATOMIC_ACQUIRE))
+		if (runOnce (-1.0) < 0 && errno != EINTR)
+			break;
+	__atomic_store_n (&mStopped, false, __ATOMIC_RELEASE);
+}
+
+/*******************************************************************************
+ * Makes @ref run() return after the events being handled. May be
+ * called from any thread, or from a handler.
+ ******************************************************************************/
+void DeviceNotifier::stop ()
+{
+	__atomic_store_n (&mStopped, true, __ATOMIC_RELEASE);
+	uint64_t one = 1;
+	if (::write (mWakeup, &one, sizeof (one))) {}
+}
+
+END_NAMESPACE;
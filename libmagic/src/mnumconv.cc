@@ -0,0 +1,723 @@
+/***************************************************************************
+ *   This file is part of the MagiC++ library.                             *
+ *                                                                         *
+ *   Copyright (C) 1998-2005 Marko Grnroos <magi@iki.fi>                  *
+ *                                                                         *
+ ***************************************************************************
+ *                                                                         *
+ *  This library is free software; you can redistribute it and/or          *
+ *  modify it under the terms of the GNU Library General Public            *
+ *  License as published by the Free Software Foundation; either           *
+ *  version 2 of the License, or (at your option) any later version.       *
+ *                                                                         *
+ *  This library is distributed in the hope that it will be useful,        *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU      *
+ *  Library General Public License for more details.                       *
+ *                                                                         *
+ *  You should have received a copy of the GNU Library General Public      *
+ *  License along with this library; see the file COPYING.LIB.  If         *
+ *  not, write to the Free Software Foundation, Inc., 59 Temple Place      *
+ *  - Suite 330, Boston, MA 02111-1307, USA.                               *
+ *                                                                         *
+ ***************************************************************************/
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <float.h>
+#include <magic/mnumconv.h>
+
+BEGIN_NAMESPACE (MagiC);
+
+///////////////////////////////////////////////////////////////////////////////
+// Helpers
+///////////////////////////////////////////////////////////////////////////////
+
+/** Multiplies two 64-bit values to 128 bits; returns the low half
+ *  and stores the high half.
+ **/
+static inline uint64_t multiply128 (uint64_t a, uint64_t b, uint64_t* high)
+{
+#ifdef __SIZEOF_INT128__
+	__uint128_t r = (__uint128_t) a * b;
+	*high = (uint64_t) (r >> 64);
+	return (uint64_t) r;
+#else
+	uint64_t ha = a >> 32, hb = b >> 32, la = (uint32_t) a, lb = (uint32_t) b;
+	uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+	uint64_t t = rl + (rm0 << 32), c = t < rl;
+	uint64_t lo = t + (rm1 << 32);
+	c += lo < t;
+	*high = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+	return lo;
+#endif
+}
+
+/** Powers of ten that fit in 64 bits. */
+static const uint64_t powersOf10[] = {
+	1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL,
+	100000000ULL, 1000000000ULL, 10000000000ULL, 100000000000ULL, 1000000000000ULL,
+	10000000000000ULL, 100000000000000ULL, 1000000000000000ULL, 10000000000000000ULL,
+	100000000000000000ULL, 1000000000000000000ULL, 10000000000000000000ULL
+};
+
+/** Number of decimal digits in a value, at least one. The bit length
+ *  times log10(2) gives it or one less, without a loop.
+ **/
+static inline int decimalLength (uint64_t v)
+{
+	v |= 1;
+	int guess = ((64 - __builtin_clzll (v)) * 1233) >> 12;
+	return guess + (v >= powersOf10[guess]);
+}
+
+/** Pairs of decimal digits from 00 to 99. */
+static const char digitPairs[] =
+	"00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+	"40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+	"8081828384858687888990919293949596979899";
+
+/** Writes the value as exactly 'length' decimal digits ending at end,
+ *  two digits at a time.
+ **/
+static inline void writeDigits (char* end, uint64_t value, int length)
+{
+	while (length >= 2) {
+		uint64_t q = value / 100;
+		const char* pair = digitPairs + 2 * (value - q*100);
+		*--end = pair[1];
+		*--end = pair[0];
+		value = q;
+		length -= 2;
+	}
+	if (length)
+		*--end = '0' + value;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Tables of powers of five
+///////////////////////////////////////////////////////////////////////////////
+
+// Ryu needs 5^i and 2^k/5^i to 125 bits, Eisel-Lemire 5^q normalized
+// to 128 bits for the decimal exponents a double can have. They are
+// computed exactly with a small big-number type on first use.
+
+#define RYU_POW5_BITCOUNT		125
+#define RYU_POW5_INV_BITCOUNT	125
+#define RYU_POW5_TABLE_SIZE		326
+#define RYU_POW5_INV_TABLE_SIZE	342
+#define LEMIRE_SMALLEST_POWER	(-342)
+#define LEMIRE_LARGEST_POWER	308
+
+/** Non-negative integer of up to 2048 bits, for building the tables. */
+class BigNumber {
+  public:
+	enum {LIMBS = 64};
+	uint32_t	limb [LIMBS];	/**< Little-endian 32-bit limbs. */
+
+				BigNumber	(uint32_t value=0) {memset (limb, 0, sizeof (limb)); limb[0] = value;}
+
+	/** Sets the number to 2^n. */
+	void		setPow2		(int n) {memset (limb, 0, sizeof (limb)); limb[n/32] = 1U << (n%32);}
+
+	void		multiply	(uint32_t m) {
+		uint64_t carry = 0;
+		for (int i=0; i<LIMBS; i++) {
+			uint64_t v = (uint64_t) limb[i] * m + carry;
+			limb[i] = (uint32_t) v;
+			carry = v >> 32;
+		}
+	}
+
+	void		divide		(uint32_t d) {
+		uint64_t rest = 0;
+		for (int i=LIMBS-1; i>=0; i--) {
+			uint64_t v = (rest << 32) | limb[i];
+			limb[i] = (uint32_t) (v / d);
+			rest = v % d;
+		}
+	}
+
+	void		increment	() {
+		for (int i=0; i<LIMBS && !++limb[i]; i++);
+	}
+
+	int			bitLength	() const {
+		for (int i=LIMBS-1; i>=0; i--)
+			if (limb[i])
+				return i*32 + 32 - __builtin_clz (limb[i]);
+		return 0;
+	}
+
+	/** Returns 64 bits of the number starting from the given bit;
+	 *  bits below zero are zero.
+	 **/
+	uint64_t	bits64		(int from) const {
+		uint64_t result = 0;
+		for (int i=63; i>=0; i--) {
+			int bit = from + i;
+			result <<= 1;
+			if (bit >= 0 && bit < LIMBS*32)
+				result |= (limb[bit/32] >> (bit%32)) & 1;
+		}
+		return result;
+	}
+};
+
+struct PowerTables {
+	uint64_t	ryuPow5 [RYU_POW5_TABLE_SIZE][2];			/**< 5^i to 125 bits, low and high. */
+	uint64_t	ryuPow5Inv [RYU_POW5_INV_TABLE_SIZE][2];	/**< 2^k/5^i to 125 bits, low and high. */
+	uint64_t	lemire [2*(LEMIRE_LARGEST_POWER-LEMIRE_SMALLEST_POWER+1)];	/**< 5^q to 128 bits, high and low. */
+
+	PowerTables ();
+};
+
+PowerTables::PowerTables ()
+{
+	BigNumber pow5 (1);
+	for (int i=0; i<RYU_POW5_INV_TABLE_SIZE; i++, pow5.multiply (5)) {
+		int length = pow5.bitLength ();
+
+		// 5^i shifted to RYU_POW5_BITCOUNT bits
+		if (i < RYU_POW5_TABLE_SIZE) {
+			int shift = length - RYU_POW5_BITCOUNT;
+			ryuPow5[i][0] = pow5.bits64 (shift);
+			ryuPow5[i][1] = pow5.bits64 (shift+64);
+		}
+
+		// floor(2^(length-1+RYU_POW5_INV_BITCOUNT) / 5^i) + 1
+		BigNumber inverse;
+		inverse.setPow2 (length - 1 + RYU_POW5_INV_BITCOUNT);
+		for (int j=0; j<i; j++)
+			inverse.divide (5);
+		inverse.increment ();
+		ryuPow5Inv[i][0] = inverse.bits64 (0);
+		ryuPow5Inv[i][1] = inverse.bits64 (64);
+	}
+
+	// Positive powers truncated to 128 bits
+	pow5 = BigNumber (1);
+	for (int q=0; q<=LEMIRE_LARGEST_POWER; q++, pow5.multiply (5)) {
+		int index = 2 * (q - LEMIRE_SMALLEST_POWER);
+		int shift = pow5.bitLength () - 128;
+		lemire[index]	= pow5.bits64 (shift+64);
+		lemire[index+1]	= pow5.bits64 (shift);
+	}
+
+	// Negative powers as 2^b/5^-q, rounded up and truncated to 128 bits
+	pow5 = BigNumber (5);
+	for (int q=-1; q>=LEMIRE_SMALLEST_POWER; q--, pow5.multiply (5)) {
+		int length = pow5.bitLength ();
+		BigNumber inverse;
+		inverse.setPow2 ((q >= -27)? length + 127 : 2*length + 128);
+		for (int j=0; j<-q; j++)
+			inverse.divide (5);
+		inverse.increment ();
+		int shift = inverse.bitLength () - 128;
+		if (shift < 0)
+			shift = 0;
+		int index = 2 * (q - LEMIRE_SMALLEST_POWER);
+		lemire[index]	= inverse.bits64 (shift+64);
+		lemire[index+1]	= inverse.bits64 (shift);
+	}
+}
+
+/** Returns the tables, computing them on the first call. */
+static const PowerTables& powerTables ()
+{
+	static const PowerTables tables;
+	return tables;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Shortest double to decimal (Ryu)
+///////////////////////////////////////////////////////////////////////////////
+
+static inline int pow5bits (int e) {return ((e * 1217359) >> 19) + 1;}
+static inline int log10Pow2 (int e) {return (e * 78913) >> 18;}
+static inline int log10Pow5 (int e) {return (e * 732923) >> 20;}
+
+static inline int pow5Factor (uint64_t value)
+{
+	int count = 0;
+	for (; value % 5 == 0; value /= 5)
+		count++;
+	return count;
+}
+
+static inline bool multipleOfPowerOf5 (uint64_t value, int p) {return pow5Factor (value) >= p;}
+static inline bool multipleOfPowerOf2 (uint64_t value, int p) {return (value & ((1ULL << p) - 1)) == 0;}
+
+/** Returns (m * mul) >> j, where mul is 128 bits and j >= 64. */
+static inline uint64_t mulShift64 (uint64_t m, const uint64_t* mul, int j)
+{
+	uint64_t high1;
+	uint64_t low1 = multiply128 (m, mul[1], &high1);
+	uint64_t high0;
+	multiply128 (m, mul[0], &high0);
+	uint64_t sum = high0 + low1;
+	if (sum < high0)
+		high1++;
+	int shift = j - 64;
+	return (shift == 0)? sum : ((high1 << (64 - shift)) | (sum >> shift));
+}
+
+/*******************************************************************************
+ * Converts a positive finite double to the shortest decimal that
+ * reads back to it: value = digits * 10^exponent.
+ ******************************************************************************/
+static void shortestDecimal (uint64_t ieeeMantissa, int ieeeExponent, uint64_t& digits, int& exponent)
+{
+	const PowerTables& tables = powerTables ();
+
+	int e2;
+	uint64_t m2;
+	if (ieeeExponent == 0) {
+		e2 = 1 - 1023 - 52 - 2;
+		m2 = ieeeMantissa;
+	} else {
+		e2 = ieeeExponent - 1023 - 52 - 2;
+		m2 = (1ULL << 52) | ieeeMantissa;
+	}
+	const bool acceptBounds = (m2 & 1) == 0;
+
+	// The interval of values that read back to the double
+	const uint64_t mv = 4 * m2;
+	const int mmShift = ieeeMantissa != 0 || ieeeExponent <= 1;
+
+	uint64_t vr, vp, vm;
+	int e10;
+	bool vmIsTrailingZeros = false;
+	bool vrIsTrailingZeros = false;
+	if (e2 >= 0) {
+		const int q = log10Pow2 (e2) - (e2 > 3);
+		e10 = q;
+		const int k = RYU_POW5_INV_BITCOUNT + pow5bits (q) - 1;
+		const int i = -e2 + q + k;
+		vr = mulShift64 (4*m2, tables.ryuPow5Inv[q], i);
+		vp = mulShift64 (4*m2 + 2, tables.ryuPow5Inv[q], i);
+		vm = mulShift64 (4*m2 - 1 - mmShift, tables.ryuPow5Inv[q], i);
+		if (q <= 21) {
+			// Only one of mp, mv and mm can be a multiple of 5, if any
+			if (mv % 5 == 0)
+				vrIsTrailingZeros = multipleOfPowerOf5 (mv, q);
+			else if (acceptBounds)
+				vmIsTrailingZeros = multipleOfPowerOf5 (mv - 1 - mmShift, q);
+			else
+				vp -= multipleOfPowerOf5 (mv + 2, q);
+		}
+	} else {
+		const int q = log10Pow5 (-e2) - (-e2 > 1);
+		e10 = q + e2;
+		const int i = -e2 - q;
+		const int k = pow5bits (i) - RYU_POW5_BITCOUNT;
+		const int j = q - k;
+		vr = mulShift64 (4*m2, tables.ryuPow5[i], j);
+		vp = mulShift64 (4*m2 + 2, tables.ryuPow5[i], j);
+		vm = mulShift64 (4*m2 - 1 - mmShift, tables.ryuPow5[i], j);
+		if (q <= 1) {
+			// mv has at least q trailing zero bits
+			vrIsTrailingZeros = true;
+			if (acceptBounds)
+				vmIsTrailingZeros = mmShift == 1;
+			else
+				--vp;
+		} else if (q < 63)
+			vrIsTrailingZeros = multipleOfPowerOf2 (mv, q);
+	}
+
+	// Remove the digits that are not needed to tell the value apart
+	int removed = 0;
+	int lastRemovedDigit = 0;
+	uint64_t output;
+	if (vmIsTrailingZeros || vrIsTrailingZeros) {
+		// The general, rare case
+		for (; vp / 10 > vm / 10; removed++) {
+			vmIsTrailingZeros &= vm % 10 == 0;
+			vrIsTrailingZeros &= lastRemovedDigit == 0;
+			lastRemovedDigit = vr % 10;
+			vr /= 10;
+			vp /= 10;
+			vm /= 10;
+		}
+		if (vmIsTrailingZeros)
+			for (; vm % 10 == 0; removed++) {
+				vrIsTrailingZeros &= lastRemovedDigit == 0;
+				lastRemovedDigit = vr % 10;
+				vr /= 10;
+				vp /= 10;
+				vm /= 10;
+			}
+		// Round even if exactly halfway
+		if (vrIsTrailingZeros && lastRemovedDigit == 5 && vr % 2 == 0)
+			lastRemovedDigit = 4;
+		output = vr + ((vr == vm && (!acceptBounds || !vmIsTrailingZeros)) || lastRemovedDigit >= 5);
+	} else {
+		// The common case
+		bool roundUp = false;
+		if (vp / 100 > vm / 100) {
+			roundUp = vr % 100 >= 50;
+			vr /= 100;
+			vp /= 100;
+			vm /= 100;
+			removed += 2;
+		}
+		for (; vp / 10 > vm / 10; removed++) {
+			roundUp = vr % 10 >= 5;
+			vr /= 10;
+			vp /= 10;
+			vm /= 10;
+		}
+		output = vr + (vr == vm || roundUp);
+	}
+
+	digits = output;
+	exponent = e10 + removed;
+}
+
+/** Lays out the decimal digits, whose first digit has the given
+ *  decimal exponent, like printf's %g does with the given precision.
+ *  Trailing zeros are removed.
+ **/
+static int layoutDecimal (char* buffer, bool negative, uint64_t digits, int length, int exponent, int precision)
+{
+	while (length > 1 && digits % 10 == 0) {
+		digits /= 10;
+		length--;
+	}
+	char text [20];
+	writeDigits (text + length, digits, length);
+
+	char* pos = buffer;
+	if (negative)
+		*pos++ = '-';
+
+	if (exponent < -4 || exponent >= precision) {
+		// Exponential notation
+		*pos++ = text[0];
+		if (length > 1) {
+			*pos++ = '.';
+			memcpy (pos, text+1, length-1);
+			pos += length-1;
+		}
+		*pos++ = 'e';
+		*pos++ = (exponent < 0)? '-' : '+';
+		int absexp = (exponent < 0)? -exponent : exponent;
+		int explength = (absexp >= 100)? 3 : 2;
+		writeDigits (pos + explength, absexp, explength);
+		pos += explength;
+	} else if (exponent < 0) {
+		// 0.000ddd
+		*pos++ = '0';
+		*pos++ = '.';
+		for (int i=-1; i>exponent; i--)
+			*pos++ = '0';
+		memcpy (pos, text, length);
+		pos += length;
+	} else if (length <= exponent+1) {
+		// ddd000
+		memcpy (pos, text, length);
+		pos += length;
+		for (int i=length; i<=exponent; i++)
+			*pos++ = '0';
+	} else {
+		// ddd.ddd
+		memcpy (pos, text, exponent+1);
+		pos += exponent+1;
+		*pos++ = '.';
+		memcpy (pos, text+exponent+1, length-exponent-1);
+		pos += length-exponent-1;
+	}
+	return pos - buffer;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Formatting
+///////////////////////////////////////////////////////////////////////////////
+
+/*******************************************************************************
+ * Formats an unsigned integer in decimal.
+ *
+ * @return Number of characters written, at most NUMCONV_LONG_BUFFER-1.
+ ******************************************************************************/
+int formatULong (char* buffer, unsigned long value)
+{
+	// Count the digits, then write them from the end two at a time
+	int length = decimalLength (value);
+	writeDigits (buffer + length, value, length);
+	return length;
+}
+
+/*******************************************************************************
+ * Formats a signed integer in decimal.
+ *
+ * @return Number of characters written, at most NUMCONV_LONG_BUFFER-1.
+ ******************************************************************************/
+int formatLong (char* buffer, long value)
+{
+	if (value >= 0)
+		return formatULong (buffer, value);
+	*buffer = '-';
+	return 1 + formatULong (buffer+1, 0UL - (unsigned long) value);
+}
+
+/*******************************************************************************
+ * Formats a double in decimal.
+ *
+ * With a negative precision, the number is printed with the fewest
+ * digits that read back to the same double, in fixed notation for
+ * exponents from -5 to 16 and exponential notation otherwise. With a
+ * precision from 1 to 15, the result is the same as that of printf's
+ * %.<precision>g.
+ *
+ * @return Number of characters written, at most
+ * NUMCONV_DOUBLE_BUFFER-1, or -1 if the precision is not supported,
+ * the value is subnormal or it falls halfway between two results;
+ * printf has to be used for those.
+ ******************************************************************************/
+int formatDouble (char* buffer, double value, int precision)
+{
+	if (precision == 0 || precision > 15)
+		return -1;
+
+	uint64_t bits;
+	memcpy (&bits, &value, sizeof (bits));
+	const bool negative = bits >> 63;
+	const uint64_t ieeeMantissa = bits & ((1ULL << 52) - 1);
+	const int ieeeExponent = (int) ((bits >> 52) & 0x7ff);
+
+	char* pos = buffer;
+	if (ieeeExponent == 0x7ff || (ieeeExponent == 0 && ieeeMantissa == 0)) {
+		if (negative)
+			*pos++ = '-';
+		const char* text = (ieeeExponent == 0)? "0" : ieeeMantissa? "nan" : "inf";
+		memcpy (pos, text, strlen (text));
+		return pos + strlen (text) - buffer;
+	}
+
+	uint64_t digits;
+	int exponent;
+	shortestDecimal (ieeeMantissa, ieeeExponent, digits, exponent);
+	int length = decimalLength (digits);
+
+	if (precision < 0)
+		return layoutDecimal (buffer, negative, digits, length, exponent+length-1, 17);
+
+	// Subnormals have fewer significant digits than the precision may
+	// ask for, and printf prints their exact value
+	if (ieeeExponent == 0)
+		return -1;
+
+	// The shortest digits are within half an ulp of the value, so when
+	// there are more than the precision, rounding them rounds the
+	// value, unless they end exactly halfway.
+	if (length > precision) {
+		uint64_t divisor = 1;
+		for (int i=precision; i<length; i++)
+			divisor *= 10;
+		uint64_t rest = digits % divisor;
+		digits /= divisor;
+		if (rest == divisor/2)
+			return -1;
+		if (rest > divisor/2)
+			digits++;
+		exponent += length - precision;
+		length = decimalLength (digits);
+	}
+	return layoutDecimal (buffer, negative, digits, length, exponent+length-1, precision);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Parsing
+///////////////////////////////////////////////////////////////////////////////
+
+static inline bool isDigit (char c) {return (unsigned char) (c - '0') < 10;}
+
+/*******************************************************************************
+ * Parses an integer: an optional sign and decimal digits. Overflowing
+ * values wrap around.
+ ******************************************************************************/
+const char* parseLong (const char* begin, const char* end, long& value)
+{
+	const char* pos = begin;
+	bool negative = false;
+	if (pos < end && (*pos == '-' || *pos == '+'))
+		negative = *pos++ == '-';
+
+	const char* digits = pos;
+	unsigned long result = 0;
+	for (; pos < end && isDigit (*pos); pos++)
+		result = result*10 + (*pos - '0');
+	if (pos == digits)
+		return begin;
+
+	value = negative? (long) (0UL - result) : (long) result;
+	return pos;
+}
+
+/** Exact powers of ten for the fast path. */
+static const double exactPowers[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+/*******************************************************************************
+ * Converts w*10^q to a double with the Eisel-Lemire algorithm. w has
+ * to be nonzero.
+ ******************************************************************************/
+static uint64_t eiselLemire (uint64_t w, int q)
+{
+	if (q < LEMIRE_SMALLEST_POWER)
+		return 0;
+	if (q > LEMIRE_LARGEST_POWER)
+		return 0x7ffULL << 52;
+
+	// Multiply the normalized significand by the truncated power of
+	// five; the second half of the power is needed only when the
+	// bits below the result are all ones.
+	const uint64_t* power = powerTables().lemire + 2 * (q - LEMIRE_SMALLEST_POWER);
+	const int lz = __builtin_clzll (w);
+	w <<= lz;
+	uint64_t high;
+	uint64_t low = multiply128 (w, power[0], &high);
+	const uint64_t precisionMask = 0xffffffffffffffffULL >> 55;
+	if ((high & precisionMask) == precisionMask) {
+		uint64_t high2;
+		multiply128 (w, power[1], &high2);
+		low += high2;
+		if (high2 > low)
+			high++;
+	}
+
+	const int upperbit = (int) (high >> 63);
+	const int shift = upperbit + 64 - 52 - 3;
+	uint64_t mantissa = high >> shift;
+	int power2 = (((152170 + 65536) * q) >> 16) + 63 + upperbit - lz + 1023;
+
+	if (power2 <= 0) {
+		// Subnormal
+		if (-power2 + 1 >= 64)
+			return 0;
+		mantissa >>= -power2 + 1;
+		mantissa += mantissa & 1;
+		mantissa >>= 1;
+		power2 = (mantissa < (1ULL << 52))? 0 : 1;
+		return ((uint64_t) power2 << 52) | (mantissa & ((1ULL << 52) - 1));
+	}
+
+	// Round to even when exactly halfway
+	if (low <= 1 && q >= -4 && q <= 23 && (mantissa & 3) == 1
+		&& (mantissa << shift) == high)
+		mantissa &= ~1ULL;
+
+	mantissa += mantissa & 1;
+	mantissa >>= 1;
+	if (mantissa >= (2ULL << 52)) {
+		mantissa = 1ULL << 52;
+		power2++;
+	}
+	if (power2 >= 0x7ff)
+		return 0x7ffULL << 52;
+	return ((uint64_t) power2 << 52) | (mantissa & ((1ULL << 52) - 1));
+}
+
+/*******************************************************************************
+ * Parses a floating-point number in the format
+ * [+-]?([0-9]+\.?[0-9]*|\.[0-9]+)([eE][+-]?[0-9]+)? with correct
+ * rounding.
+ ******************************************************************************/
+const char* parseDouble (const char* begin, const char* end, double& value)
+{
+	const char* pos = begin;
+	bool negative = false;
+	if (pos < end && (*pos == '-' || *pos == '+'))
+		negative = *pos++ == '-';
+
+	// Up to 19 significant digits fit in the significand
+	uint64_t w = 0;
+	int digits = 0;
+	int exponent = 0;
+	bool truncated = false;
+	const char* start = pos;
+	for (; pos < end && isDigit (*pos); pos++) {
+		int digit = *pos - '0';
+		if (digits < 19) {
+			w = w*10 + digit;
+			digits += (w != 0);
+		} else {
+			exponent++;
+			truncated |= (digit != 0);
+		}
+	}
+	int mantissaDigits = pos - start;
+	if (pos < end && *pos == '.') {
+		start = ++pos;
+		for (; pos < end && isDigit (*pos); pos++) {
+			int digit = *pos - '0';
+			if (digits < 19) {
+				w = w*10 + digit;
+				digits += (w != 0);
+				exponent--;
+			} else
+				truncated |= (digit != 0);
+		}
+		mantissaDigits += pos - start;
+	}
+	if (mantissaDigits == 0)
+		return begin;
+
+	// The exponent is part of the number only if it has digits
+	if (pos < end && (*pos == 'e' || *pos == 'E')) {
+		const char* exppos = pos+1;
+		bool expnegative = false;
+		if (exppos < end && (*exppos == '-' || *exppos == '+'))
+			expnegative = *exppos++ == '-';
+		if (exppos < end && isDigit (*exppos)) {
+			int exp10 = 0;
+			for (; exppos < end && isDigit (*exppos); exppos++)
+				if (exp10 < 100000)
+					exp10 = exp10*10 + (*exppos - '0');
+			exponent += expnegative? -exp10 : exp10;
+			pos = exppos;
+		}
+	}
+
+	if (truncated) {
+		// More digits than the significand holds; rare enough to
+		// leave to the C library
+		char buffer [128];
+		int length = pos - begin;
+		char* text = (length < (int) sizeof (buffer))? buffer : new char [length+1];
+		memcpy (text, begin, length);
+		text [length] = '\0';
+		value = strtod (text, NULL);
+		if (text != buffer)
+			delete [] text;
+		return pos;
+	}
+
+	double result;
+#if FLT_EVAL_METHOD == 0
+	if (w <= (1ULL << 53) && exponent >= -22 && exponent <= 22) {
+		// Both the significand and the power of ten are exact, so a
+		// single rounded operation gives the correctly rounded result
+		result = (double) w;
+		if (exponent < 0)
+			result /= exactPowers [-exponent];
+		else
+			result *= exactPowers [exponent];
+	} else
+#endif
+	if (w == 0)
+		result = 0.0;
+	else {
+		uint64_t bits = eiselLemire (w, exponent);
+		memcpy (&result, &bits, sizeof (result));
+	}
+
+	value = negative? -result : result;
+	return pos;
+}
+
+END_NAMESPACE;
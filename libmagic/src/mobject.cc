@@ -25,6 +25,7 @@
 #include <iostream>
 #include <malloc.h>
 #include <stdlib.h>
+#include <sched.h>
 
 #include "magic/mobject.h"
 #include "magic/mclass.h"
@@ -190,7 +191,12 @@ DataIStream& operator>> (DataIStream& in, Object& obj) {
  *  NOTE: Not actually abstract because of the RTTI system we use.
  **/
 
+/** The weak references are detached here, and not when the last Ref
+ *  is dropped, as objects are also deleted directly.
+ **/
 Object::~Object () {
+	if (__atomic_load_n (&mRefCount, __ATOMIC_RELAXED) & OBJECT_WEAK_FLAG)
+		detachWeak ();
 }
 
 /** Output to standard C++ streams. */
@@ -289,7 +295,179 @@ int Object::is_a (const String& classname) const
 	return getclass().getname () == classname;
 }
 
-bool nextNewIsObject = false;
+/*******************************************************************************
+* Weak references
+*
+* The weak block of an object is found through a registry keyed by the
+* object address, so that the objects need no extra member for it. The
+* registry is touched only when a weak reference is first taken and
+* when an object that has one is deleted; OBJECT_WEAK_FLAG in the
+* reference count tells which objects have a block.
+*******************************************************************************/
+
+/** Shared block of the weak references to an object. */
+struct WeakRefBlock {
+	Object*			object;		/**< The object, or NULL when it has been deleted. */
+	int				weakCount;	/**< Number of WeakRefs, plus one for the object itself. */
+	volatile int	busy;		/**< Spin lock for object. */
+};
+
+/** Open addressing table from objects to their weak blocks. */
+struct WeakRegistry {
+	Object**		keys;
+	WeakRefBlock**	blocks;
+	int				size;		/**< Number of slots, a power of two. */
+	int				count;
+	volatile int	busy;
+};
+
+static WeakRegistry weakRegistry = {NULL, NULL, 0, 0, 0};
+
+static inline void spinLock (volatile int* busy) {
+	while (__sync_lock_test_and_set (busy, 1))
+		sched_yield ();
+}
+
+static inline void spinUnlock (volatile int* busy) {
+	__sync_lock_release (busy);
+}
+
+static inline int weakSlot (const Object* object, int size) {
+	return (int) ((((size_t) object) >> 4) * 2654435761u) & (size-1);
+}
+
+/** Inserts into the registry, which must have room. */
+static void weakInsert (WeakRegistry& reg, Object* object, WeakRefBlock* block) {
+	int i = weakSlot (object, reg.size);
+	while (reg.keys[i])
+		i = (i+1) & (reg.size-1);
+	reg.keys[i] = object;
+	reg.blocks[i] = block;
+	reg.count++;
+}
+
+/** Doubles the registry when it gets half full. */
+static void weakGrow (WeakRegistry& reg) {
+	WeakRegistry old = reg;
+	reg.size = old.size? old.size*2 : 64;
+	reg.keys = (Object**) calloc (reg.size, sizeof (Object*));
+	reg.blocks = (WeakRefBlock**) calloc (reg.size, sizeof (WeakRefBlock*));
+	reg.count = 0;
+	for (int i=0; i<old.size; i++)
+		if (old.keys[i])
+			weakInsert (reg, old.keys[i], old.blocks[i]);
+	free (old.keys);
+	free (old.blocks);
+}
+
+/** Removes an object from the registry, shifting the following
+ *  entries of the probe sequence back. Returns its block.
+ **/
+static WeakRefBlock* weakRemove (WeakRegistry& reg, const Object* object) {
+	int mask = reg.size-1;
+	int i = weakSlot (object, reg.size);
+	while (reg.keys[i] != object)
+		i = (i+1) & mask;
+	WeakRefBlock* block = reg.blocks[i];
+	for (int j = (i+1) & mask; reg.keys[j]; j = (j+1) & mask) {
+		int home = weakSlot (reg.keys[j], reg.size);
+		// Move the entry to the hole if its home is not between them
+		if (((j-home) & mask) >= ((j-i) & mask)) {
+			reg.keys[i] = reg.keys[j];
+			reg.blocks[i] = reg.blocks[j];
+			i = j;
+		}
+	}
+	reg.keys[i] = NULL;
+	reg.blocks[i] = NULL;
+	reg.count--;
+	return block;
+}
+
+/** Returns the weak block of the object, making it if needed, with
+ *  a weak reference counted for the caller. The caller must hold a
+ *  reference to the object.
+ **/
+WeakRefBlock* Object::weakBlock ()
+{
+	WeakRegistry& reg = weakRegistry;
+	spinLock (&reg.busy);
+	WeakRefBlock* block = NULL;
+	if (__atomic_load_n (&mRefCount, __ATOMIC_RELAXED) & OBJECT_WEAK_FLAG) {
+		int i = weakSlot (this, reg.size);
+		while (reg.keys[i] != this)
+			i = (i+1) & (reg.size-1);
+		block = reg.blocks[i];
+	} else {
+		if ((reg.count+1)*2 > reg.size)
+			weakGrow (reg);
+		block = (WeakRefBlock*) malloc (sizeof (WeakRefBlock));
+		block->object = this;
+		block->weakCount = 1;
+		block->busy = 0;
+		weakInsert (reg, this, block);
+		__atomic_fetch_or (&mRefCount, OBJECT_WEAK_FLAG, __ATOMIC_RELAXED);
+	}
+	__atomic_fetch_add (&block->weakCount, 1, __ATOMIC_RELAXED);
+	spinUnlock (&reg.busy);
+	return block;
+}
+
+/** Takes a strong reference to the object of a weak block, if it
+ *  still exists. Returns the object with the reference counted, or
+ *  NULL.
+ **/
+Object* Object::lockWeak (WeakRefBlock* block)
+{
+	spinLock (&block->busy);
+	Object* object = block->object;
+	if (object) {
+		int count = __atomic_load_n (&object->mRefCount, __ATOMIC_RELAXED);
+		do {
+			// The last Ref is being dropped
+			if ((count & OBJECT_COUNT_MASK) == 0) {
+				object = NULL;
+				break;
+			}
+		} while (!__atomic_compare_exchange_n (&object->mRefCount, &count, count+1, true,
+											   __ATOMIC_ACQUIRE, __ATOMIC_RELAXED));
+	}
+	spinUnlock (&block->busy);
+	return object;
+}
+
+/** Counts a new weak reference to the block. */
+void Object::retainWeak (WeakRefBlock* block)
+{
+	__atomic_fetch_add (&block->weakCount, 1, __ATOMIC_RELAXED);
+}
+
+/** Drops a weak reference to the block, and frees it with the last
+ *  one.
+ **/
+void Object::releaseWeak (WeakRefBlock* block)
+{
+	if (__atomic_sub_fetch (&block->weakCount, 1, __ATOMIC_ACQ_REL) == 0)
+		free (block);
+}
+
+/** Cuts the weak references off an object that is being deleted. */
+void Object::detachWeak ()
+{
+	spinLock (&weakRegistry.busy);
+	WeakRefBlock* block = weakRemove (weakRegistry, this);
+	spinUnlock (&weakRegistry.busy);
+
+	spinLock (&block->busy);
+	block->object = NULL;
+	spinUnlock (&block->busy);
+	releaseWeak (block);
+}
+
+/** Set by the Object new operators for the global new operator that
+ *  they call. Thread-local, as threads allocate concurrently.
+ **/
+__thread bool nextNewIsObject = false;
 
 #ifdef DEBUG_OBJECT_NEW
 #ifdef new
@@ -386,6 +564,13 @@ int Int::operator == (const Comparable& o) const {
 	return -1; // Undefined value. Should we throw an exception?
 }
 
+int Int::compare (const Comparable& o) const {
+	if (o.is_a ("Int"))
+		return compare ((const Int&) o);
+
+	return 0;
+}
+
 
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -494,61 +679,334 @@ void assertwith (const char* filename,
 ///////////////////////////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////////////////////////
 
+END_NAMESPACE;
+
+
+
+///////////////////////////////////////////////////////////////////////////////
+//                                                                           //
+//     |   |                         -----                  |                //
+//     |\ /|  ___                      |        ___   ___   |      ___       //
+//     | V | /   ) |/|/|  __  |/\ \   |  |/\   ___| |   \  | /   /   ) |/\   //
+//     | | | |---  | | | /  \ |    \  |  |    (   | |      |/    |---  |     //
+//     |   |  \__  | | | \__/ |     \_/  |     \__|  \__/  | \    \__  |     //
+//                                 \_/                                       //
+///////////////////////////////////////////////////////////////////////////////
+
 #ifndef DISABLE_ALL_MEMORY_DEBUGGING
 #ifdef new
 #undef new
 #endif
 #warning "Memory debugging enabled"
 
-int dbgnewmalloced=0;
-mallocinfostr* lastmalloced=NULL;
+#include <pthread.h>
+#include <sched.h>
+#include <execinfo.h>
+
+/** Maximum depth of a sampled call stack. */
+#define ALLOC_SAMPLE_DEPTH 16
+
+/** Number of slots in the per-class counter table. Power of two. */
+#define ALLOC_CLASS_SLOTS 1024
+
+/** Maximum number of objects under construction in one thread. */
+#define ALLOC_CONSTRUCT_DEPTH 32
+
+/*******************************************************************************
+ * Call stack captured for a sampled allocation.
+ ******************************************************************************/
+struct AllocSample {
+	int		depth;
+	void*	frames [ALLOC_SAMPLE_DEPTH];
+};
+
+/*******************************************************************************
+ * Live bytes of the objects of one class.
+ *
+ * Objects are accounted to their class by @ref bindObjectClass while
+ * they are constructed, and unaccounted when deleted. The counters are
+ * updated atomically.
+ ******************************************************************************/
+struct AllocClassStat {
+	const MagiC::Class*	cls;
+	long				liveBytes;
+	long				liveBlocks;
+};
+
+/*******************************************************************************
+ * Allocation ledger of one thread.
+ *
+ * The list is modified only while holding the busy flag. The owning
+ * thread is practically the only one taking it, so the flag costs one
+ * uncontended atomic exchange per allocation. A thread deleting a
+ * block of another ledger takes the flag only if it is free, and
+ * otherwise pushes the block onto the remote free stack with
+ * compare-and-swap; the next holder of the flag unlinks such blocks.
+ *
+ * Ledgers are never freed, as their blocks can outlive the thread.
+ * When a thread exits, its ledger is marked orphaned and the next new
+ * thread adopts it.
+ *
+ * The objects that the thread has allocated, and may still be
+ * constructing, are kept on a short stack for @ref bindObjectClass.
+ * Deleted objects are removed from it, so the stack only refers to
+ * live blocks.
+ ******************************************************************************/
+struct AllocLedger {
+	mallocinfostr*			last;			/**< Most recent block in the ledger. */
+	mallocinfostr* volatile	remote;			/**< Blocks deleted by other threads. */
+	volatile int			busy;			/**< Taken while the list is modified or read. */
+	volatile int			orphaned;		/**< Owner thread has exited. */
+	long					bytesToSample;	/**< Bytes left until the next stack sample. */
+	AllocLedger*			nextLedger;		/**< Next ledger in the global ledger list. */
+	int						constructingDepth;	/**< Number of objects on the stack. */
+	mallocinfostr*			constructing [ALLOC_CONSTRUCT_DEPTH]; /**< Recently allocated objects. */
+};
+
+long dbgnewmalloced = 0;
 int newtrace_disabled = 1;
-char* newcomment=NULL;
+int newtrace_fill = 0;
+long newtrace_sampling = 512*1024;
 
-void newComment (const char* comment) {
+static AllocLedger* volatile	allLedgers = NULL;
+static __thread AllocLedger*	threadLedger = NULL;
+static __thread char*			newcomment = NULL;
+static pthread_key_t			ledgerKey;
+static pthread_once_t			ledgerKeyOnce = PTHREAD_ONCE_INIT;
+static AllocClassStat			classStats [ALLOC_CLASS_SLOTS];
+
+extern "C" void newComment (const char* comment) {
 	if (newcomment)
 		free (newcomment);
 	newcomment = strdup(comment);
 }
 
+static inline void ledgerLock (AllocLedger* ledger) {
+	while (__sync_lock_test_and_set (&ledger->busy, 1))
+		sched_yield ();
+}
 
-void* operator new[] (size_t size, const char* filename, int lineno, const char* fname)
-{
-	// fprintf (stderr, "filename=%s, lineno=%d, fname=%s\n", filename, lineno, fname);
+static inline bool ledgerTryLock (AllocLedger* ledger) {
+	return !__sync_lock_test_and_set (&ledger->busy, 1);
+}
 
-	if (newtrace_disabled) {
-		void* res = malloc(size);
-		if (!res)
+static inline void ledgerUnlock (AllocLedger* ledger) {
+	__sync_lock_release (&ledger->busy);
+}
+
+/** Marks the ledger of an exiting thread orphaned. */
+static void ledgerOrphan (void* ledger) {
+	((AllocLedger*) ledger)->orphaned = 1;
+}
+
+static void ledgerCreateKey () {
+	pthread_key_create (&ledgerKey, ledgerOrphan);
+}
+
+/** Returns the ledger of the current thread; adopts an orphaned one or
+ *  creates a new one on the first allocation of the thread.
+ **/
+static AllocLedger* currentLedger () {
+	if (threadLedger)
+		return threadLedger;
+
+	AllocLedger* ledger = NULL;
+	for (AllocLedger* l = allLedgers; l && !ledger; l = l->nextLedger)
+		if (l->orphaned && __sync_bool_compare_and_swap (&l->orphaned, 1, 0))
+			ledger = l;
+
+	if (!ledger) {
+		ledger = (AllocLedger*) calloc (1, sizeof (AllocLedger));
+		if (!ledger)
 			*((char*)0x0)=0;
-		return res;
+		ledger->bytesToSample = newtrace_sampling;
+		do {
+			ledger->nextLedger = allLedgers;
+		} while (!__sync_bool_compare_and_swap (&allLedgers, ledger->nextLedger, ledger));
 	}
 
+	pthread_once (&ledgerKeyOnce, ledgerCreateKey);
+	pthread_setspecific (ledgerKey, ledger);
+	return threadLedger = ledger;
+}
+
+/** Returns the live byte counter of the given class, or NULL if the
+ *  counter table is full.
+ **/
+static AllocClassStat* classStat (const MagiC::Class* cls) {
+	uint pos = (uint) (((unsigned long) cls) >> 4);
+	for (int i=0; i<ALLOC_CLASS_SLOTS; i++, pos++) {
+		AllocClassStat* stat = &classStats[pos & (ALLOC_CLASS_SLOTS-1)];
+		if (stat->cls == cls)
+			return stat;
+		if (!stat->cls && __sync_bool_compare_and_swap (&stat->cls, (const MagiC::Class*) NULL, cls))
+			return stat;
+		if (stat->cls == cls) // Another thread inserted the same class
+			return stat;
+	}
+	return NULL;
+}
+
+/** Pushes an allocated object on the construction stack of the
+ *  ledger, dropping the oldest one if the stack is full. The ledger
+ *  must be locked.
+ **/
+static void ledgerPushObject (AllocLedger* ledger, mallocinfostr* mp) {
+	if (ledger->constructingDepth == ALLOC_CONSTRUCT_DEPTH) {
+		memmove (ledger->constructing, ledger->constructing + 1,
+				 sizeof (mallocinfostr*) * (ALLOC_CONSTRUCT_DEPTH - 1));
+		ledger->constructingDepth--;
+	}
+	ledger->constructing [ledger->constructingDepth++] = mp;
+}
+
+/** Returns the position of an object on the construction stack of the
+ *  ledger, or -1. The ledger must be locked.
+ **/
+static int ledgerFindObject (AllocLedger* ledger, mallocinfostr* mp) {
+	for (int i = ledger->constructingDepth - 1; i >= 0; i--)
+		if (ledger->constructing [i] == mp)
+			return i;
+	return -1;
+}
+
+/** Unlinks a block from its ledger and frees it. The ledger must be
+ *  locked.
+ **/
+static void ledgerRelease (AllocLedger* ledger, mallocinfostr* mp) {
+	if (mp->isObject) {
+		int pos = ledgerFindObject (ledger, mp);
+		if (pos >= 0) {
+			memmove (ledger->constructing + pos, ledger->constructing + pos + 1,
+					 sizeof (mallocinfostr*) * (ledger->constructingDepth - pos - 1));
+			ledger->constructingDepth--;
+		}
+	}
+
+	if (mp->next)
+		mp->next->prev = mp->prev;
+	if (mp->prev)
+		mp->prev->next = mp->next;
+	if (mp == ledger->last)
+		ledger->last = mp->prev;
+
+	if (mp->classStat) {
+		__sync_fetch_and_sub (&mp->classStat->liveBytes, (long) mp->size);
+		__sync_fetch_and_sub (&mp->classStat->liveBlocks, 1L);
+	}
+	__sync_fetch_and_sub (&dbgnewmalloced, (long) (mp->size + sizeof (mallocinfostr)));
+
+	free (mp->newcomment);
+	free (mp->sample);
+
+	// Fill the block with 0xdd
+	if (newtrace_fill)
+		memset (mp, '\xdd', mp->size + sizeof (mallocinfostr));
+	else
+		mp->startsym[0] = '\0';
+
+	free (mp);
+}
+
+/** Releases the blocks deleted by other threads. The ledger must be
+ *  locked.
+ **/
+static void ledgerDrain (AllocLedger* ledger) {
+	if (!ledger->remote)
+		return;
+
+	// Take the whole stack at once, so pushes and this pop can never
+	// mix up the stack.
+	mallocinfostr* mp = __sync_lock_test_and_set (&ledger->remote, (mallocinfostr*) NULL);
+	while (mp) {
+		mallocinfostr* next = mp->nextRemote;
+		ledgerRelease (ledger, mp);
+		mp = next;
+	}
+}
+
+/** Allocates a block that is not traced. It still has the info
+ *  header, labeled "MiS_U", so that the delete operator rarely needs
+ *  to look at memory before a block without one; only blocks from
+ *  malloc() and strdup() deleted with delete are such.
+ **/
+static void* untracedNew (size_t size) {
+	mallocinfostr* p = (mallocinfostr*) malloc (size+sizeof(mallocinfostr));
+	if (!p)
+		*((char*)0x0)=0;
+	strcpy (p->startsym, "MiS_U");
+	p->size = size;
+	return ((char*)p)+sizeof (mallocinfostr);
+}
+
+#if __cplusplus >= 201103L
+#define THROW_BAD_ALLOC
+#else
+#define THROW_BAD_ALLOC throw (std::bad_alloc)
+#endif
+
+void* operator new[] (size_t size) THROW_BAD_ALLOC {
+	return untracedNew (size);
+}
+
+void* operator new (size_t size) THROW_BAD_ALLOC {
+	return untracedNew (size);
+}
+
+void* operator new[] (size_t size, const char* filename, int lineno, const char* fname)
+{
+	if (newtrace_disabled)
+		return untracedNew (size);
+
 	// Reserve the memory block PLUS space for the info structure
 	mallocinfostr* p = (mallocinfostr*) malloc (size+sizeof(mallocinfostr));
 	if (!p)
 		*((char*)0x0)=0;
 
+	AllocLedger* ledger = currentLedger ();
+
 	strcpy (p->startsym, "MiS_S");	// Set a recognition label
 	p->size			= size;
 	p->filename		= filename;
 	p->lineno		= lineno;
 	p->funcname		= fname;
-	p->newcomment	= newcomment? newcomment : NULL;
+	p->newcomment	= newcomment;
 	newcomment		= NULL;
 	p->renewed		= false;
-	p->isObject		= nextNewIsObject;
-	nextNewIsObject	= false;
-	p->prev			= lastmalloced;
+	p->isObject		= MagiC::nextNewIsObject;
+	MagiC::nextNewIsObject = false;
+	p->classStat	= NULL;
+	p->ledger		= ledger;
 	p->next			= NULL;
+	p->nextRemote	= NULL;
+	p->sample		= NULL;
+
+	// Capture the call stack of every newtrace_sampling bytes
+	if (newtrace_sampling >= 0) {
+		ledger->bytesToSample -= size;
+		if (ledger->bytesToSample <= 0) {
+			ledger->bytesToSample = newtrace_sampling;
+			if ((p->sample = (AllocSample*) malloc (sizeof (AllocSample))))
+				p->sample->depth = backtrace (p->sample->frames, ALLOC_SAMPLE_DEPTH);
+		}
+	}
+
+	// Fill with 0xcc
+	if (newtrace_fill)
+		memset (((char*)p)+sizeof (mallocinfostr), '\xcc', p->size);
+
+	ledgerLock (ledger);
+	ledgerDrain (ledger);
+	p->prev = ledger->last;
 	if (p->prev)
 		p->prev->next = p;
-	lastmalloced	= p;
-	
-	// Fill with 0x00
-	memset (((char*)p)+sizeof (mallocinfostr), '\xcc', p->size);
+	ledger->last = p;
+	if (p->isObject)
+		ledgerPushObject (ledger, p);
+	ledgerUnlock (ledger);
 
 	// Add to global counter
-	dbgnewmalloced += size + sizeof(mallocinfostr);
+	__sync_fetch_and_add (&dbgnewmalloced, (long) (size + sizeof(mallocinfostr)));
 	return ((char*)p)+sizeof (mallocinfostr);
 }
 
@@ -557,21 +1015,37 @@ void* operator new (size_t size, const char* filename, int lineno, const char* f
 }
 
 void* _renew (void* p, size_t newsize, const char* filename, int lineno, const char* fname) {
-	if (memcmp (((char*)p)-sizeof(mallocinfostr), "MiS_S", 5) || newtrace_disabled) {
+	if (!p) {
+		return operator new[] (newsize, filename, lineno, fname);
+	} else if (!memcmp (((char*)p)-sizeof(mallocinfostr), "MiS_U", 5)) {
+		mallocinfostr* np = (mallocinfostr*) realloc (((char*)p)-sizeof(mallocinfostr),
+													  newsize+sizeof(mallocinfostr));
+		// Again, should not be null
+		if (!np)
+			*((char*)0x0)=0;
+		np->size = newsize;
+		return ((char*)np)+sizeof (mallocinfostr);
+	} else if (memcmp (((char*)p)-sizeof(mallocinfostr), "MiS_S", 5)) {
 		void* res = realloc ((char*) p, newsize);
 		// Again, should not be null
 		if (!res)
 			*((char*)0x0)=0;
 		return res;
 	} else {
+		mallocinfostr* op = (mallocinfostr*) (((char*)p)-sizeof(mallocinfostr));
+		AllocLedger* ledger = op->ledger;
+		size_t oldsize = op->size;
+
+		// The block may move, so its neighbours must not be read or
+		// modified meanwhile.
+		ledgerLock (ledger);
+
 		// Realloc the memory block PLUS space for the info structure
-		mallocinfostr* np = (mallocinfostr*) realloc (((char*)p)-sizeof(mallocinfostr),
-													  newsize+sizeof(mallocinfostr));
+		mallocinfostr* np = (mallocinfostr*) realloc (op, newsize+sizeof(mallocinfostr));
 		// Again, should not be null
 		if (!np)
 			*((char*)0x0)=0;
-		
-		dbgnewmalloced -= np->size;	// Substract old size from total size register
+
 		np->size = newsize;			// Refresh
 		np->filename = filename;	// Refresh
 		np->lineno = lineno;		// Refresh
@@ -586,66 +1060,143 @@ void* _renew (void* p, size_t newsize, const char* filename, int lineno, const c
 			np->prev->next = np;
 		if (np->next)
 			np->next->prev = np;
-		if ((void*) (((char*)p)-sizeof(mallocinfostr)) == (void*) lastmalloced)
-			lastmalloced = np;
-		dbgnewmalloced += newsize;	// Add new size to total size register
+		if (op == ledger->last)
+			ledger->last = np;
+		if (np->isObject) {
+			int pos = ledgerFindObject (ledger, op);
+			if (pos >= 0)
+				ledger->constructing [pos] = np;
+		}
+		if (np->classStat)
+			__sync_fetch_and_add (&np->classStat->liveBytes, (long) newsize - (long) oldsize);
+		ledgerUnlock (ledger);
+
+		// Substract old size from and add new size to total size register
+		__sync_fetch_and_add (&dbgnewmalloced, (long) newsize - (long) oldsize);
 		return ((char*)np)+sizeof (mallocinfostr);
 	}
 }
 
-void operator delete (void* p) {
+void operator delete[] (void* p) throw () {
+	operator delete (p);
+}
+
+void operator delete (void* p) throw () {
 	if (p) {
-		if (memcmp (((char*)p)-sizeof(mallocinfostr), "MiS_S", 5)) {
-			free (p); // Allocated with ordinary malloc or new
+		if (!memcmp (((char*)p)-sizeof(mallocinfostr), "MiS_U", 5)) {
+			((char*)p)[-(int)sizeof(mallocinfostr)] = '\0';
+			free (((char*)p)-sizeof(mallocinfostr)); // Not traced
+		} else if (memcmp (((char*)p)-sizeof(mallocinfostr), "MiS_S", 5)) {
+			free (p); // Allocated with ordinary malloc
 		} else {
 			mallocinfostr* mp=(mallocinfostr*)(((char*)p)-sizeof(mallocinfostr));
-			//TRACE3 ("%d, %s, %d", mp->size, mp->filename, mp->lineno);
-			if (mp->next)
-				mp->next->prev = mp->prev; 
-			if (mp->prev)
-				mp->prev->next = mp->next;
-			if (mp == lastmalloced)
-				if (mp->next)
-					while (lastmalloced->next)
-						lastmalloced=lastmalloced->next;
-				else
-					lastmalloced = mp->prev;
-			if (mp->newcomment)
-				free (mp->newcomment);
-			dbgnewmalloced -= mp->size + sizeof (mallocinfostr);
-
-			// Fill the block with 0xdd
-			memset (mp, '\xdd', mp->size + sizeof (mallocinfostr));
-
-			free (mp);
+			AllocLedger* ledger = mp->ledger;
+
+			if (ledger == threadLedger) {
+				ledgerLock (ledger);
+				ledgerRelease (ledger, mp);
+				ledgerUnlock (ledger);
+			} else if (ledgerTryLock (ledger)) {
+				ledgerRelease (ledger, mp);
+				ledgerUnlock (ledger);
+			} else {
+				// The ledger is busy; leave the block for the holder
+				mallocinfostr* head;
+				do {
+					head = ledger->remote;
+					mp->nextRemote = head;
+				} while (!__sync_bool_compare_and_swap (&ledger->remote, head, mp));
+			}
 		}
 	}
 }
 
 // int listAllocationsLimit=100;
 
+/*******************************************************************************
+ * Accounts an object to the given class while it is constructed.
+ *
+ * Called by the members that decl_dynamic adds with DEBUG_OBJECT_NEW,
+ * for the base classes of the object first and for its own class
+ * last. Only the objects that the calling thread allocated are looked
+ * up, so the class of an object is never read by another thread, and
+ * objects that are not allocated with new, or are members of other
+ * objects, are not found. Objects allocated after this one, during
+ * its construction, have been constructed and are dropped from the
+ * stack.
+ ******************************************************************************/
+void bindObjectClass (const void* object, const MagiC::Class* cls) {
+	AllocLedger* ledger = threadLedger;
+	if (!ledger || !cls)
+		return;
+
+	ledgerLock (ledger);
+	for (int i = ledger->constructingDepth - 1; i >= 0; i--) {
+		mallocinfostr* p = ledger->constructing [i];
+		if (((char*)p)+sizeof(mallocinfostr) != object)
+			continue;
+
+		AllocClassStat* stat = classStat (cls);
+		if (stat != p->classStat) {
+			if (p->classStat) {
+				__sync_fetch_and_sub (&p->classStat->liveBytes, (long) p->size);
+				__sync_fetch_and_sub (&p->classStat->liveBlocks, 1L);
+			}
+			if (stat) {
+				__sync_fetch_and_add (&stat->liveBytes, (long) p->size);
+				__sync_fetch_and_add (&stat->liveBlocks, 1L);
+			}
+			p->classStat = stat;
+		}
+		ledger->constructingDepth = i + 1;
+		break;
+	}
+	ledgerUnlock (ledger);
+}
+
+/*******************************************************************************
+ * Lists the traced memory blocks of all threads, newest first within
+ * each thread, followed by the live bytes of each class of objects.
+ ******************************************************************************/
 void list_allocations (int number, FILE* out) {
 	fprintf (out, "Dumping all reserved memory blocks:\n");
 	int i=0;
-	for (mallocinfostr* p=lastmalloced; p && (number==0 || i<number); p=p->prev, i++) {
-		fprintf (out, "%9d bytes (%8x) %s at %s#%d %s",
-				 p->size, (char*) (((char*)p) + sizeof (mallocinfostr)),
-				 (p->renewed)? "renewed  ":"allocated",
-				 p->filename, p->lineno, p->funcname);
-		if (p->isObject) {
-			Object* op = (Object*)(void*)(((char*)p)+sizeof(mallocinfostr));
-			fprintf (out, " (%s)", (CONSTR) op->getclassname());
+	for (AllocLedger* ledger = allLedgers; ledger; ledger = ledger->nextLedger) {
+		ledgerLock (ledger);
+		ledgerDrain (ledger);
+		for (mallocinfostr* p=ledger->last; p; p=p->prev) {
+			if (number!=0 && i>=number)
+				continue;
+			i++;
+
+			fprintf (out, "%9ld bytes (%p) %s at %s#%d %s",
+					 (long) p->size, (((char*)p) + sizeof (mallocinfostr)),
+					 (p->renewed)? "renewed  ":"allocated",
+					 p->filename, p->lineno, p->funcname);
+			if (p->classStat)
+				fprintf (out, " (%s)", (CONSTR) p->classStat->cls->getname());
+			if (p->newcomment)
+				fprintf (out, " : \042%s\042", (CONSTR) p->newcomment);
+			fprintf (out, "\n");
+			if (p->sample) {
+				fflush (out);
+				backtrace_symbols_fd (p->sample->frames, p->sample->depth, fileno (out));
+			}
 		}
-		if (p->newcomment)
-			fprintf (out, " : \042%s\042", (CONSTR) p->newcomment);
-		fprintf (out, "\n");
+		ledgerUnlock (ledger);
 	}
 	if (number>0 && i>=number)
 		fprintf (out, "** Only %d first items listed\n", number);
-	fprintf (out, "Total amount of memory allocated: %d "
+
+	fprintf (out, "Live objects by class:\n");
+	for (int c=0; c<ALLOC_CLASS_SLOTS; c++)
+		if (classStats[c].cls && classStats[c].liveBlocks)
+			fprintf (out, "%12ld bytes in %9ld objects of %s\n",
+					 classStats[c].liveBytes, classStats[c].liveBlocks,
+					 (CONSTR) classStats[c].cls->getname());
+
+	fprintf (out, "Total amount of memory allocated: %ld "
 			 "(including the DEBUG_NEW overhead)\n", dbgnewmalloced);
 }
 
 #endif
-
-END_NAMESPACE;
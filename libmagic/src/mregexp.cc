@@ -26,6 +26,7 @@
 #include <magic/mstring.h>
 #include <magic/mmagisupp.h>
 #include <magic/mpararr.h>
+#include <magic/mpackarray.h>
 #include <magic/mregexp.h>
 
 // impl_dynamic (RegExp, {Object});
@@ -56,7 +57,8 @@ int RegExp::make (const char* expr) {
 }
 	
 int RegExp::match (const char* str) {
-	return !(errcode = regexec (regt, str, 0, NULL, REG_NOSUB));
+	// REG_NOSUB is a compilation flag; regexec() rejects it.
+	return !(errcode = regexec (regt, str, 0, NULL, 0));
 }
 
 int RegExp::match (const String& str, Array<String>& results) {
@@ -84,6 +86,53 @@ int RegExp::match (const String& str, Array<String>& results) {
 	return 1;
 }
 
+/** Matches a view that is not zero-terminated. Uses REG_STARTEND
+ *  where the C library has it, and a copy of the view otherwise.
+ **/
+static int execView (regex_t* regt, const SubString& view, int nmatch, regmatch_t* matches, int flags) {
+#ifdef REG_STARTEND
+	regmatch_t range;
+	if (!matches) {
+		matches = &range;
+		nmatch = 1;
+	}
+	matches[0].rm_so = 0;
+	matches[0].rm_eo = view.length ();
+	return regexec (regt, view.data()? view.data() : "", nmatch, matches, flags | REG_STARTEND);
+#else
+	String copy = view.toString ();
+	return regexec (regt, copy.isNull()? "" : (const char*) copy, nmatch, matches, flags);
+#endif
+}
+
+int RegExp::match (const SubString& view) {
+	return !(errcode = execView (regt, view, 0, NULL, 0));
+}
+
+int RegExp::match (const SubString& view, PackArray<SubString>& results) {
+	regmatch_t matches [20];
+	errcode = execView (regt, view, 20, matches, 0);
+	if (errcode) {
+		if (errcode == REG_NOMATCH)
+			return 0;
+		else
+			throw invalid_format (geterror());
+	}
+
+	int rescnt=0;
+	for (; rescnt<19; rescnt++)
+		if (matches[rescnt].rm_so > int(view.length()) || matches[rescnt].rm_eo > int(view.length()) ||
+			matches[rescnt].rm_so < 0 || matches[rescnt].rm_eo < 0 ||
+			matches[rescnt].rm_so > matches[rescnt].rm_eo)
+			break;
+
+	results.resize (rescnt);
+	for (int i=0; i<rescnt; i++)
+		results[i] = view.mid (matches[i].rm_so, matches[i].rm_eo-matches[i].rm_so);
+
+	return 1;
+}
+
 String RegExp::geterror () const {
 	char errbuf [256];
 	regerror (errcode, regt, errbuf, 256);
@@ -22,20 +22,575 @@
  *                                                                         *
  ***************************************************************************/
 
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+
 #include <magic/msocket.h>
 
+BEGIN_NAMESPACE (MagiC);
+
+///////////////////////////////////////////////////////////////////////////////
+//                                                                           //
+//                      ----              |                                  //
+//                     (       ___   ___  |     ___   |                      //
+//                      `---  /   \ /   \ |  / /   ) -+-                     //
+//                          ) |   | |     |-<  |---   |                      //
+//                      ___/  \___/ \___/ |  \  \__   \_                     //
+//                                                                           //
+///////////////////////////////////////////////////////////////////////////////
+
+/*******************************************************************************
+ * Creates a socket device, which is opened when it connects or
+ * listens.
+ ******************************************************************************/
+Socket::Socket (int mode /**< Mode for opening; IO_ReadWrite if 0. */)
+		: IODevice ()
+{
+	mSocket = -1;
+	mBlocking = false;
+	mUnget = -1;
+	setMode (mode? mode : IO_ReadWrite);
+}
+
+/*******************************************************************************
+ * Creates a socket device for an already open socket, such as one
+ * returned by accept().
+ ******************************************************************************/
+Socket::Socket (int socket,	/**< Open socket descriptor, owned by the device from now on. */
+				int mode	/**< Mode of the device; IO_ReadWrite if 0. */)
+		: IODevice ()
+{
+	mSocket = -1;
+	mBlocking = false;
+	mUnget = -1;
+	setMode (mode? mode : IO_ReadWrite);
+	setSocket (socket);
+}
+
+Socket::~Socket ()
+{
+	close ();
+}
+
+/*******************************************************************************
+ * Gives an open socket descriptor to the device, closing the old one.
+ * The descriptor is made non-blocking, unless the device is blocking.
+ ******************************************************************************/
+void Socket::setSocket (int socket)
+{
+	close ();
+	mSocket = socket;
+	if (mSocket >= 0) {
+		setBlocking (mBlocking);
+		resetStatus ();
+		setState (IO_EOS, false);
+		setOpen ();
+	}
+}
+
+/*******************************************************************************
+ * Opens a TCP socket. It is not connected anywhere.
+ *
+ * @return true if successful, false with errno set otherwise.
+ ******************************************************************************/
 bool Socket::open (int mode)
 {
-	/* Create socket. */
+	return create (AF_INET, mode);
+}
+
+/*******************************************************************************
+ * Opens a new stream socket of the given address family.
+ *
+ * @return true if successful, false with errno set otherwise.
+ ******************************************************************************/
+bool Socket::create (int family, int mode)
+{
+	if (mSocket >= 0)
+		throw file_already_open (i18n ("Socket %1 is already open.").arg(mSocket));
+	if (mode)
+		setMode (mode);
+
+	int socket = ::socket (family, SOCK_STREAM | SOCK_CLOEXEC | (mBlocking? 0 : SOCK_NONBLOCK), 0);
+	if (socket < 0) {
+		setStatus (IO_OpenError);
+		return false;
+	}
+	mSocket = socket;
+	mUnget = -1;
+	resetStatus ();
+	setState (IO_EOS, false);
+	setOpen ();
+	return true;
+}
+
+/*******************************************************************************
+ * Closes the socket.
+ ******************************************************************************/
+void Socket::close ()
+{
+	if (mSocket < 0)
+		return;
+	if (::close (mSocket) != 0 && errno != EINTR)
+		setStatus (IO_OnCloseError);
+	mSocket = -1;
+	setClosed ();
+}
+
+/*******************************************************************************
+ * Sets whether the reads and writes wait until they can be done.
+ ******************************************************************************/
+void Socket::setBlocking (bool blocking)
+{
+	mBlocking = blocking;
+	if (mSocket >= 0) {
+		int flags = fcntl (mSocket, F_GETFL);
+		fcntl (mSocket, F_SETFL, blocking? (flags & ~O_NONBLOCK) : (flags | O_NONBLOCK));
+	}
+}
+
+/*******************************************************************************
+ * Sets whether small writes to a TCP socket are sent at once, instead
+ * of being collected while there is unacknowledged data.
+ ******************************************************************************/
+void Socket::setNoDelay (bool noDelay)
+{
+	int on = noDelay;
+	if (mSocket >= 0 && !isUnix ())
+		setsockopt (mSocket, IPPROTO_TCP, TCP_NODELAY, &on, sizeof (on));
+}
+
+/*******************************************************************************
+ * Returns true if the socket is a Unix-domain socket.
+ ******************************************************************************/
+bool Socket::isUnix () const
+{
+	struct sockaddr_storage address;
+	socklen_t len = sizeof (address);
+	return mSocket >= 0 && getsockname (mSocket, (struct sockaddr*) &address, &len) == 0
+		&& address.ss_family == AF_UNIX;
+}
+
+/*******************************************************************************
+ * Waits until the socket is ready for the given events.
+ *
+ * @return The ready events of @ref io_events, 0 if the time ran out,
+ * or -1 on error.
+ ******************************************************************************/
+int Socket::wait (int events,		/**< IO_ReadReady, IO_WriteReady or both. */
+				  double seconds	/**< Time to wait at most, or negative for no limit. */)
+{
+	if (mSocket < 0)
+		throw device_not_open (i18n ("Socket not open when waiting for it."));
+	if (mUnget >= 0 && (events & IO_ReadReady))
+		return IO_ReadReady;
+
+	struct pollfd pfd;
+	pfd.fd = mSocket;
+	pfd.events = ((events & IO_ReadReady)? POLLIN : 0) | ((events & IO_WriteReady)? POLLOUT : 0);
+	int result;
+	do {
+		result = poll (&pfd, 1, (seconds < 0)? -1 : int (seconds*1000 + 0.5));
+	} while (result < 0 && errno == EINTR);
+	if (result <= 0)
+		return result;
+
+	return ((pfd.revents & POLLIN)? IO_ReadReady : 0) | ((pfd.revents & POLLOUT)? IO_WriteReady : 0)
+		| ((pfd.revents & (POLLHUP | POLLERR))? IO_HangUp : 0);
+}
+
+/*******************************************************************************
+ * Reads the data that has arrived, at most the given length.
+ *
+ * @return The number of bytes read. 0 if there was no data or the
+ * other end has closed the connection, as told by atEnd(). -1 on
+ * error, with status IO_ReadError.
+ ******************************************************************************/
+int Socket::readBlock (char* data,		/**< Buffer for the data. */
+					   uint maxlen		/**< Size of the buffer. */)
+{
+	if (mSocket < 0)
+		throw device_not_open (i18n ("Socket not open when reading from it."));
+	if (maxlen == 0)
+		return 0;
+
+	int done = 0;
+	if (mUnget >= 0) {
+		data[done++] = mUnget;
+		mUnget = -1;
+		if (--maxlen == 0)
+			return done;
+	}
+
+	ssize_t bytes;
+	do {
+		bytes = ::recv (mSocket, data + done, maxlen, 0);
+	} while (bytes < 0 && errno == EINTR);
+
+	if (bytes > 0)
+		return done + bytes;
+	if (bytes == 0)
+		setState (IO_EOS);
+	else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+		setStatus (IO_ReadError);
+		return done? done : -1;
+	}
+	return done;
+}
+
+/*******************************************************************************
+ * Writes as much of the data as the socket takes. A blocking socket
+ * takes all of it.
+ *
+ * @return The number of bytes written, possibly 0 for a non-blocking
+ * socket. -1 on error, with status IO_WriteError.
+ ******************************************************************************/
+int Socket::writeBlock (const char* data,	/**< Data to write. */
+						uint len			/**< Length of the data. */)
+{
+	if (mSocket < 0)
+		throw device_not_open (i18n ("Socket not open when writing to it."));
+
+	uint done = 0;
+	while (done < len) {
+		// The closing of the other end is an error here, not a signal
+		ssize_t bytes = ::send (mSocket, data + done, len - done, MSG_NOSIGNAL);
+		if (bytes < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
+			setStatus (IO_WriteError);
+			return done? int (done) : -1;
+		}
+		done += bytes;
+	}
+	return done;
+}
+
+/*******************************************************************************
+ * Reads one character.
+ *
+ * @return The character, or -1 if none has arrived or at the end of
+ * the stream.
+ ******************************************************************************/
+int Socket::getch ()
+{
+	char ch;
+	return (readBlock (&ch, 1) == 1)? (unsigned char) ch : -1;
+}
+
+/*******************************************************************************
+ * Writes one character.
+ ******************************************************************************/
+void Socket::putch (char ch)
+{
+	writeBlock (&ch, 1);
+}
+
+/*******************************************************************************
+ * Returns one character to be read again.
+ ******************************************************************************/
+void Socket::ungetch (char ch)
+{
+	mUnget = (unsigned char) ch;
+}
+
+/*******************************************************************************
+ * Returns the numeric address of the other end, as "a.b.c.d", or the
+ * path of a Unix-domain socket.
+ ******************************************************************************/
+String Socket::peerName () const
+{
+	struct sockaddr_storage address;
+	socklen_t len = sizeof (address);
+	if (mSocket < 0 || getpeername (mSocket, (struct sockaddr*) &address, &len) != 0)
+		return String ();
+
+	if (address.ss_family == AF_UNIX)
+		return ((struct sockaddr_un*) &address)->sun_path;
+
+	char name [INET6_ADDRSTRLEN];
+	const void* addr = (address.ss_family == AF_INET)? (const void*) &((struct sockaddr_in*) &address)->sin_addr
+		: (const void*) &((struct sockaddr_in6*) &address)->sin6_addr;
+	if (!inet_ntop (address.ss_family, addr, name, sizeof (name)))
+		return String ();
+	return name;
+}
+
+/** Returns the IPv4 address and port of the local or the remote end. */
+static bool socketAddress (int socket, bool peer, struct sockaddr_in& address)
+{
+	socklen_t len = sizeof (address);
+	if (socket < 0)
+		return false;
+	int result = peer? getpeername (socket, (struct sockaddr*) &address, &len)
+		: getsockname (socket, (struct sockaddr*) &address, &len);
+	return result == 0 && address.sin_family == AF_INET;
+}
+
+/*******************************************************************************
+ * Returns the local port of a TCP socket, or 0.
+ ******************************************************************************/
+uint Socket::port () const
+{
+	struct sockaddr_in address;
+	return socketAddress (mSocket, false, address)? ntohs (address.sin_port) : 0;
+}
+
+/*******************************************************************************
+ * Returns the remote port of a TCP socket, or 0.
+ ******************************************************************************/
+uint Socket::peerPort () const
+{
+	struct sockaddr_in address;
+	return socketAddress (mSocket, true, address)? ntohs (address.sin_port) : 0;
+}
 
-	/* Bind. */
+/*******************************************************************************
+ * Returns the local IPv4 address of a TCP socket in host byte order,
+ * or 0.
+ ******************************************************************************/
+uint Socket::address () const
+{
+	struct sockaddr_in address;
+	return socketAddress (mSocket, false, address)? ntohl (address.sin_addr.s_addr) : 0;
 }
 
+/*******************************************************************************
+ * Returns the remote IPv4 address of a TCP socket in host byte order,
+ * or 0.
+ ******************************************************************************/
+uint Socket::peerAddress () const
+{
+	struct sockaddr_in address;
+	return socketAddress (mSocket, true, address)? ntohl (address.sin_addr.s_addr) : 0;
+}
+
+
 
-void ClientSocket::connect (const String& host, uint port)
+///////////////////////////////////////////////////////////////////////////////
+//                                                                           //
+//         ___  | o                 ----              |                      //
+//        /   \ |    ___        |  (       ___   ___  |     ___   |          //
+//        |     | | /   ) |/\  -+-  `---  /   \ /   \ |  / /   ) -+-         //
+//        |     | | |---  |  |  |       ) |   | |     |-<  |---   |          //
+//        \___/ | |  \__  |  |  \_  ___/  \___/ \___/ |  \  \__   \_         //
+//                                                                           //
+///////////////////////////////////////////////////////////////////////////////
+
+/*******************************************************************************
+ * Connects to the TCP port of the host. The host name may be a
+ * numeric address.
+ *
+ * @return true if connected, or still connecting if non-blocking.
+ * false on failure, with status IO_ConnectError.
+ ******************************************************************************/
+bool ClientSocket::connect (const String& host,	/**< Host name or address. */
+							uint port			/**< TCP port. */)
 {
-	/* Ensure that it's open. */
+	struct addrinfo hints;
+	memset (&hints, 0, sizeof (hints));
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+	struct addrinfo* found = NULL;
+	if (getaddrinfo (host, NULL, &hints, &found) != 0 || !found) {
+		setStatus (IO_ConnectError);
+		return false;
+	}
+	struct sockaddr_in address;
+	memcpy (&address, found->ai_addr, sizeof (address));
+	address.sin_port = htons (port);
+	freeaddrinfo (found);
+
+	if (mSocket < 0 && !create (AF_INET, mode ()))
+		return false;
+	return connectTo (&address, sizeof (address));
+}
+
+/*******************************************************************************
+ * Connects to the Unix-domain socket at the path.
+ *
+ * @return true if connected, or still connecting if non-blocking.
+ * false on failure, with status IO_ConnectError.
+ ******************************************************************************/
+bool ClientSocket::connectLocal (const String& path)
+{
+	struct sockaddr_un address;
+	memset (&address, 0, sizeof (address));
+	address.sun_family = AF_UNIX;
+	if ((uint) path.length () >= sizeof (address.sun_path)) {
+		setStatus (IO_ConnectError);
+		return false;
+	}
+	memcpy (address.sun_path, (const char*) path, path.length ());
+
+	if (mSocket < 0 && !create (AF_UNIX, mode ()))
+		return false;
+	return connectTo (&address, sizeof (address));
+}
 
-	/* Connect. */
+/** Connects the open socket to the address. */
+bool ClientSocket::connectTo (const void* address, int addressLen)
+{
+	int result;
+	do {
+		result = ::connect (mSocket, (const struct sockaddr*) address, addressLen);
+	} while (result < 0 && errno == EINTR && mBlocking);
+
+	mConnecting = false;
+	if (result == 0)
+		return true;
+	if (errno == EINPROGRESS || (errno == EINTR && !mBlocking) || (errno == EAGAIN && !mBlocking)) {
+		mConnecting = true;
+		return true;
+	}
+	setStatus (IO_ConnectError);
+	return false;
+}
+
+/*******************************************************************************
+ * Checks the result of a non-blocking connect, after the socket has
+ * become writable.
+ *
+ * @return true if connected, false if the connection failed, with
+ * status IO_ConnectError.
+ ******************************************************************************/
+bool ClientSocket::finishConnect ()
+{
+	if (!mConnecting)
+		return status () != IO_ConnectError;
+	mConnecting = false;
+
+	int error = 0;
+	socklen_t len = sizeof (error);
+	if (getsockopt (mSocket, SOL_SOCKET, SO_ERROR, &error, &len) != 0 || error != 0) {
+		setStatus (IO_ConnectError);
+		return false;
+	}
+	return true;
+}
+
+
+
+///////////////////////////////////////////////////////////////////////////////
+//                                                                           //
+//    ----                               ----              |                 //
+//   (       ___              ___       (       ___   ___  |     ___   |     //
+//    `---  /   ) |/\  |   | /   ) |/\   `---  /   \ /   \ |  / /   ) -+-    //
+//        ) |---  |     \ /  |---  |         ) |   | |     |-<  |---   |     //
+//    ___/   \__  |      V    \__  |     ___/  \___/ \___/ |  \  \__   \_    //
+//                                                                           //
+///////////////////////////////////////////////////////////////////////////////
+
+ServerSocket::~ServerSocket ()
+{
+	close ();
+}
+
+/*******************************************************************************
+ * Starts listening for TCP connections at the port of the address.
+ * Port 0 picks a free port, which @ref port() then tells.
+ *
+ * @return true if successful, false with status IO_OpenError.
+ ******************************************************************************/
+bool ServerSocket::listen (uint port,				/**< TCP port, or 0 for any. */
+						   const String& address,	/**< Numeric IPv4 address, or empty for all. */
+						   int backlog				/**< Connections that may wait for accept(). */)
+{
+	struct sockaddr_in addr;
+	memset (&addr, 0, sizeof (addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons (port);
+	addr.sin_addr.s_addr = htonl (INADDR_ANY);
+	if (!address.isEmpty () && inet_pton (AF_INET, address, &addr.sin_addr) != 1) {
+		setStatus (IO_OpenError);
+		return false;
+	}
+
+	if (mSocket < 0 && !create (AF_INET, 0))
+		return false;
+	int on = 1;
+	setsockopt (mSocket, SOL_SOCKET, SO_REUSEADDR, &on, sizeof (on));
+	if (bind (mSocket, (struct sockaddr*) &addr, sizeof (addr)) != 0 || ::listen (mSocket, backlog) != 0) {
+		setStatus (IO_OpenError);
+		return false;
+	}
+	return true;
+}
+
+/*******************************************************************************
+ * Starts listening for connections at a Unix-domain socket. An old
+ * socket file at the path is replaced, and the file is removed when
+ * the socket is closed.
+ *
+ * @return true if successful, false with status IO_OpenError.
+ ******************************************************************************/
+bool ServerSocket::listenLocal (const String& path, int backlog)
+{
+	struct sockaddr_un addr;
+	memset (&addr, 0, sizeof (addr));
+	addr.sun_family = AF_UNIX;
+	if ((uint) path.length () >= sizeof (addr.sun_path)) {
+		setStatus (IO_OpenError);
+		return false;
+	}
+	memcpy (addr.sun_path, (const char*) path, path.length ());
+
+	if (mSocket < 0 && !create (AF_UNIX, 0))
+		return false;
+	unlink (path);
+	if (bind (mSocket, (struct sockaddr*) &addr, sizeof (addr)) != 0 || ::listen (mSocket, backlog) != 0) {
+		setStatus (IO_OpenError);
+		return false;
+	}
+	mPath = path;
+	return true;
+}
+
+/*******************************************************************************
+ * Accepts a pending connection.
+ *
+ * @return A new non-blocking socket for the connection, owned by the
+ * caller, or NULL if no connection is pending or on error.
+ ******************************************************************************/
+Socket* ServerSocket::accept ()
+{
+	if (mSocket < 0)
+		throw device_not_open (i18n ("Server socket not open when accepting."));
+
+	int socket;
+	do {
+		socket = accept4 (mSocket, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+	} while (socket < 0 && errno == EINTR);
+	if (socket < 0) {
+		if (errno != EAGAIN && errno != EWOULDBLOCK && errno != ECONNABORTED)
+			setStatus (IO_ReadError);
+		return NULL;
+	}
+	return new Socket (socket, IO_ReadWrite);
+}
+
+/*******************************************************************************
+ * Stops listening, and removes the file of a Unix-domain socket.
+ ******************************************************************************/
+void ServerSocket::close ()
+{
+	Socket::close ();
+	if (!mPath.isEmpty ()) {
+		unlink (mPath);
+		mPath = String ();
+	}
 }
 
+END_NAMESPACE;
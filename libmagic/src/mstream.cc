@@ -241,6 +241,7 @@ OStream::OStream (String& buffer,	/**< String buffer to use. */
 				  int mode			/**< (Optional) opening mode. IO_Writable is always enabled, but IO_Append and IO_Truncate may be very useful. */)
 		: Stream (new Buffer (buffer, mode | IO_Writable))
 {
+	mAutoFlush = false;
 }
 
 /*******************************************************************************
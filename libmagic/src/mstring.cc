@@ -24,6 +24,7 @@
 
 #include <ctype.h>
 #include <stdio.h>
+#include <stdint.h>
 
 #ifdef SunOS
 #include <sys/varargs.h>
@@ -33,13 +34,17 @@
 
 #include "magic/mobject.h"
 #include "magic/mstring.h"
+#include "magic/marena.h"
 #include "magic/mclass.h"
 #include "magic/mregexp.h"
+#include "magic/mstrkernel.h"
+#include "magic/mnumconv.h"
 #include "magic/mstream.h"
 #include "magic/mtextstream.h"
 #include "magic/mdatastream.h"
 #include "magic/mexception.h"
 #include "magic/mpararr.h"
+#include "magic/mpackarray.h"
 
 BEGIN_NAMESPACE (MagiC);
 
@@ -59,70 +64,99 @@ MagiC::String::String () {
 	mLen	= 0;
 	mMaxLen	= 0;
 	mData	= NULL;
-	mChkSum	= 0;
+	mHash	= 0;
 }
 
 /** Copy constructor. */
 MagiC::String::String (const String& orig	/**< String to copy. */)
 {
-	if (&orig == NULL || orig.mData==NULL) {
-		mLen = 0;
-		mMaxLen = 0;
-		mData = NULL;
+	mLen = mMaxLen = 0;
+	mData = NULL;
+	mHash = 0;
+	if (&orig == NULL || orig.isNull ())
+		return;
+	memcpy (allocate (orig.mLen), orig.chars (), orig.mLen+1);
+	mLen = orig.mLen;
+	mHash = orig.mHash;
+}
+
+/** Copies the string, taking the buffer of a long string from the
+ *  arena. The copy must not be used after the arena is released.
+ **/
+MagiC::String::String (const String& orig,	/**< String to copy. */
+					   Arena& arena			/**< Arena to take the buffer from. */)
+{
+	mLen = mMaxLen = 0;
+	mData = NULL;
+	mHash = 0;
+	if (orig.isNull ())
 		return;
+	if (orig.mLen <= STRING_INLINE_LENGTH)
+		allocate (orig.mLen);
+	else {
+		mData = (char*) arena.allocate (orig.mLen+1);
+		mMaxLen = STRING_ARENA_BUFFER;
 	}
+	memcpy (chars (), orig.chars (), orig.mLen+1);
 	mLen = orig.mLen;
-	mMaxLen = orig.mMaxLen;
-	mData = new char [mMaxLen+1];
-	memcpy (mData, orig.mData, mMaxLen+1);
-	mChkSum	= 0;
+	mHash = orig.mHash;
+}
+
+#if __cplusplus >= 201103L
+/** Move constructor. Takes the buffer of the original, which becomes
+ *  a null string.
+ **/
+MagiC::String::String (String&& orig	/**< String to move. */)
+{
+	steal (orig);
 }
+#endif
 
 /** Create from a NULL-terminated string. */
 MagiC::String::String (const char* chrp		/**< NULL-terminated C-style string. */ )
 {
+	mLen = mMaxLen = 0;
+	mData = NULL;
+	mHash = 0;
 	if (chrp) {
-		mLen	= strlen (chrp);
-		mMaxLen	= mLen;
-		mData	= new char [mMaxLen+1];
-		memcpy (mData, chrp, mLen+1);
-	} else {
-		mLen = mMaxLen = 0;
-		mData = NULL;
+		int len = strlen (chrp);
+		memcpy (allocate (len), chrp, len+1);
+		mLen = len;
 	}
-	mChkSum	= 0;
 }
 
 /** Create String from a NULL-terminated char buffer. */
 MagiC::String::String (char* str,			 /**< NULL-terminated C-style string. */
 					   enum strcrflags flags /**< Should the String object take the ownership of the character buffer? */)
 {
-	if (flags & STRCRFL_OWN)
-		mData = str;
-	else if (str)
-		mData = strdup (str); // TODO
-	else
-		mData = NULL;
+	mLen = mMaxLen = 0;
+	mData = NULL;
+	mHash = 0;
+	if (!str)
+		return;
 
-	mLen = mMaxLen = str? strlen (str) : 0;
-	mChkSum = 0;
+	int len = strlen (str);
+	if (flags & STRCRFL_OWN)
+		adopt (str, len, len);
+	else {
+		memcpy (allocate (len), str, len+1);
+		mLen = len;
+	}
 }
 
 /** Create from a NULL-terminated string with given maximum length. */
 MagiC::String::String (const char* chrp,	/**< NULL-terminated C-style string. */
 					   int n				/**< Maximum (allocated) length of the buffer. There must be allocated one byte more than this, to store the end \x00.) */)
 {
+	mLen = mMaxLen = 0;
+	mData = NULL;
+	mHash = 0;
 	if (chrp && n) {
-		mLen	= n;
-		mMaxLen	= mLen;
-		mData	= new char [mMaxLen+1];
-		memcpy (mData, chrp, mLen);
-		mData [mMaxLen] = 0x00;
-	} else {
-		mLen = mMaxLen = 0;
-		mData = NULL;
+		char* data = allocate (n);
+		memcpy (data, chrp, n);
+		data [n] = 0x00;
+		mLen = n;
 	}
-	mChkSum	= 0;
 }
 
 /** Create String from a NULL-terminated char buffer. */
@@ -130,31 +164,86 @@ MagiC::String::String (char* str,			/**< The buffer must contain the terminating
 					   uint maxLen,			/**< Maximum (allocated) length of the buffer. There must be allocated one byte more than this, to store the end \x00. */
 					   bool own				/**< Should the string object take ownership of the buffer? */)
 {
-	if (own)
-		mData = str;
-	else
-		mData = strdup (str); // TODO
+	mLen = mMaxLen = 0;
+	mData = NULL;
+	mHash = 0;
+	if (!str)
+		return;
 
-	mData[maxLen]	= '\0';
-	mLen			= str? strlen (str) : 0;
-	mMaxLen			= maxLen;
-	mChkSum			= 0;
+	str[maxLen] = '\0';
+	int len = strlen (str);
+	if (own)
+		adopt (str, len, maxLen);
+	else {
+		memcpy (allocate (len), str, len+1);
+		mLen = len;
+	}
 }
 
 MagiC::String::~String () {
-	delete mData;
+	freeBuffer ();
 	IFDEBUG (mData = (char*) 0xdddddddd);
 }
 
+/** Makes room for at least the given length, discarding the current
+ *  contents. Short strings are stored inline.
+ *
+ *  @return The buffer.
+ **/
+char* MagiC::String::allocate (int amount)
+{
+	freeBuffer ();
+	if (amount <= STRING_INLINE_LENGTH)
+		mMaxLen = STRING_INLINE_LENGTH;
+	else {
+		mData = new char [amount+1];
+		mMaxLen = amount;
+	}
+	mLen = 0;
+	mHash = 0;
+	return chars ();
+}
+
+/** Takes the ownership of a buffer allocated with new[]. Short strings
+ *  are copied inline.
+ **/
+void MagiC::String::adopt (char* buffer, int length, int maxLength)
+{
+	if (maxLength <= STRING_INLINE_LENGTH) {
+		memcpy (allocate (length), buffer, length+1);
+		delete [] buffer;
+	} else {
+		freeBuffer ();
+		mData = buffer;
+		mMaxLen = maxLength;
+	}
+	mLen = length;
+	mHash = 0;
+}
+
+/** Takes the contents of another string, leaving it a null string. */
+void MagiC::String::steal (String& other)
+{
+	mLen	= other.mLen;
+	mMaxLen	= other.mMaxLen;
+	mHash	= other.mHash;
+	memcpy (mInline, other.mInline, sizeof(mInline));
+	other.mLen = other.mMaxLen = 0;
+	other.mData = NULL;
+	other.mHash = 0;
+}
+
+/** Formats an integer to the end of the given buffer.
+ *
+ *  @return The start of the formatted number.
+ **/
 template<class TYPE>
-inline char* intToString(TYPE value, uint base) {
+inline char* intToString(TYPE value, uint base, char* bufend) {
 	const char digits[] = "0123456789abcdefghijklmnopqrstuvwxyz";
 	if (base > sizeof(digits))
 		throw Exception (strformat ("Too large base %d for integer-to-String conversion", base));
 	
-	const int	maxintlen = 40;
-	char		buf[maxintlen];
-	char*		loc = buf + (maxintlen-1);
+	char*		loc = bufend;
 	*(loc--) = '\x00'; // Terminate
 
 	bool isNeg = false; // Remember negative sign
@@ -171,33 +260,68 @@ inline char* intToString(TYPE value, uint base) {
 	if (isNeg) // Add sign if negative
 		*(loc--) = '-';
 
-	return strdup (loc+1);
+	return loc+1;
 }
 
+/** Length of the buffer for formatting numbers. */
+#define STRING_NUMBER_BUFFER 40
+
 /** Conversion from an integer */
 MagiC::String::String (int i, int base) {
-	mData = intToString<int> (i, base);
-	mLen = mMaxLen = strlen(mData);
-	mChkSum	= 0;
+	char buf [STRING_NUMBER_BUFFER];
+	mLen = mMaxLen = 0;
+	mData = NULL;
+	mHash = 0;
+	if (base == 10) {
+		append (buf, formatLong (buf, i));
+		return;
+	}
+	char* start = intToString<int> (i, base, buf + STRING_NUMBER_BUFFER-1);
+	append (start, buf + STRING_NUMBER_BUFFER-1 - start);
 }
 
 /** Conversion from an integer */
 MagiC::String::String (uint i, int base) {
-	mData = intToString<uint> (i, base);
-	mLen = mMaxLen = strlen(mData);
-	mChkSum	= 0;
+	char buf [STRING_NUMBER_BUFFER];
+	mLen = mMaxLen = 0;
+	mData = NULL;
+	mHash = 0;
+	if (base == 10) {
+		append (buf, formatULong (buf, i));
+		return;
+	}
+	char* start = intToString<uint> (i, base, buf + STRING_NUMBER_BUFFER-1);
+	append (start, buf + STRING_NUMBER_BUFFER-1 - start);
 }
 
 /** Conversion from an integer */
 MagiC::String::String (long i, int base) {
-	mData = intToString<long> (i, base);
-	mLen = mMaxLen = strlen(mData);
-	mChkSum	= 0;
+	char buf [STRING_NUMBER_BUFFER];
+	mLen = mMaxLen = 0;
+	mData = NULL;
+	mHash = 0;
+	if (base == 10) {
+		append (buf, formatLong (buf, i));
+		return;
+	}
+	char* start = intToString<long> (i, base, buf + STRING_NUMBER_BUFFER-1);
+	append (start, buf + STRING_NUMBER_BUFFER-1 - start);
 }
 
+/** Formats a floating-point number to the string. */
 template <class TYPE>
-inline char* formatFloat(TYPE f, char fmt, int prec)
+inline void formatFloat(String& result, TYPE f, char fmt, int prec)
 {
+	// The common %g case does not need printf
+	if (fmt == 'g') {
+		char buf [NUMCONV_DOUBLE_BUFFER];
+		int len = formatDouble (buf, f, (prec < 0)? 6 : (prec == 0)? 1 : prec);
+		if (len >= 0) {
+			result.append (buf, len);
+			return;
+		}
+	}
+
 	// Create formatting string
 	char formatBuf [20];
 	if (prec >= 0)
@@ -207,9 +331,9 @@ inline char* formatFloat(TYPE f, char fmt, int prec)
 
 	// Create actual string with the created format
 	char buf [80+prec]; // Add prec, because it could be "high".
-	sprintf (buf, formatBuf, f);
+	int len = sprintf (buf, formatBuf, f);
 
-	return strdup (buf); // TODO: Use safedup
+	result.append (buf, len);
 }
 
 /** Conversion from a float */
@@ -217,9 +341,10 @@ MagiC::String::String (float f,		/**< Value to convert to string.			*/
 					   char fmt,	/**< Formatting mode, either 'g' or 'f'.	*/
 					   int prec		/**< Precision.								*/)
 {
-	mData = formatFloat<float> (f, fmt, prec);
-	mLen = mMaxLen = strlen(mData);
-	mChkSum	= 0;
+	mLen = mMaxLen = 0;
+	mData = NULL;
+	mHash = 0;
+	formatFloat<float> (*this, f, fmt, prec);
 }
 
 /** Conversion from a double */
@@ -227,20 +352,20 @@ MagiC::String::String (double f,	/**< Value to convert to string.			*/
 					   char fmt,	/**< Formatting mode, either 'g' or 'f'.	*/
 					   int prec		/**< Precision.								*/)
 {
-	mData = formatFloat<double> (f, fmt, prec);
-	mLen = mMaxLen = strlen(mData);
-	mChkSum	= 0;
+	mLen = mMaxLen = 0;
+	mData = NULL;
+	mHash = 0;
+	formatFloat<double> (*this, f, fmt, prec);
 }
 
 /** Assignment from a single character. */
 String& MagiC::String::assign (char c)
 {
-	if (!mData)
-		mData = new char [2];
-	mData[0] = c;
-	mData[1] = '\x00';
+	char* data = (mMaxLen >= 1)? chars () : allocate (1);
+	data[0] = c;
+	data[1] = '\x00';
 	mLen = 1;
-	mChkSum = 0;
+	mHash = 0;
 	return *this;
 }
 
@@ -254,9 +379,10 @@ String& MagiC::String::append (char c)
 	// Ensure that our buffer is large enough
 	ensure_spontane (mLen + 1);
 
-	mData[mLen++]	= c;
-	mData[mLen]		= '\x00'; // Terminate properly with \0
-	mChkSum			= 0;
+	char* data		= chars ();
+	data[mLen++]	= c;
+	data[mLen]		= '\x00'; // Terminate properly with \0
+	mHash			= 0;
 
 	return *this;
 }
@@ -266,6 +392,9 @@ String& MagiC::String::append (char c)
  **/
 
 /** Concatenates another String to the string.
+ *
+ *  A string that already has contents grows its buffer by half, so
+ *  appending repeatedly takes linear time.
  **/
 String& MagiC::String::append (const char* str,	/**< Char buffer, not necessarily \0-terminated. */
 							   uint strlength	/**< Length of the buffer, not including a possible terminating\0. */)
@@ -274,16 +403,27 @@ String& MagiC::String::append (const char* str,	/**< Char buffer, not necessaril
 	if (!str || strlength==0)
 		return *this;
 	
-	// Ensure that our buffer is large enough
-	if (mLen + int(strlength) > mMaxLen)
-		ensure (mLen + strlength + 1);
+	// Ensure that our buffer is large enough. The appended data may
+	// be in our own buffer.
+	if (mLen + int(strlength) > mMaxLen) {
+		const char* data = chars ();
+		bool own = data && str >= data && str < data + mLen;
+		int offset = own? str - data : 0;
+		if (mLen > 0)
+			ensure_spontane (mLen + strlength);
+		else
+			ensure (strlength);
+		if (own)
+			str = chars () + offset;
+	}
 
 	// Copy, but without a trailing \0
-	memcpy (mData+mLen, str, strlength);
+	char* data = chars ();
+	memmove (data+mLen, str, strlength);
 
 	mLen		+= strlength;
-	mData[mLen]	=  '\x00'; // Terminate properly with \0
-	mChkSum		=  0;
+	data[mLen]	=  '\x00'; // Terminate properly with \0
+	mHash		=  0;
 
 	return *this;
 }
@@ -314,12 +454,14 @@ String& MagiC::String::replace (uint position,			/**< Start position for replaci
 	ensure_spontane (position + buflen);
 
 	// Replace
-	memcpy (mData+position, buffer, buflen);
+	char* data = chars ();
+	memcpy (data+position, buffer, buflen);
 
 	if ((int) (position + buflen) > mLen) {
 		mLen = position + buflen;
-		mData[mLen] = '\x00';
+		data[mLen] = '\x00';
 	}
+	mHash = 0;
 
 	return *this;
 }
@@ -331,27 +473,41 @@ String& MagiC::String::replace (uint position,			/**< Start position for replaci
  **/
 String& MagiC::String::operator= (const String& other /**< String to copy with assignment. */)
 {
-	if (&other == NULL || other.mData==NULL || other.mLen==0) {
+	if (&other == this)
+		return *this;
+
+	if (other.isNull () || other.mLen==0) {
 		// The string was null
-		if (mData) {
-			mLen	= 0;
-			*mData	= '\x00'; // Preserve it
+		if (!isNull ()) {
+			mLen		= 0;
+			*chars ()	= '\x00'; // Preserve it
 		}
 	} else {
-		// The string contains something
+		// The string contains something. Reallocate only if necessary.
+		char* data = (other.mLen > mMaxLen || isNull ())? allocate (other.mLen) : chars ();
 		mLen = other.mLen;
-		if (mLen > mMaxLen) { // Reallocate only if necessary
-			if (mData)
-				delete mData;
-			mMaxLen = mLen;
-			mData = new char [mMaxLen+1];
-		}
-		memcpy (mData, other.mData, mLen+1);
+		memcpy (data, other.chars (), mLen+1);
 	}
-	mChkSum = other.mChkSum;
+	mHash = other.mHash;
 	return *this;
 }
 
+#if __cplusplus >= 201103L
+/** Move assignment. Takes the buffer of the other string, which
+ *  becomes a null string.
+ *
+ *  @return Self.
+ **/
+String& MagiC::String::operator= (String&& other /**< String to move. */)
+{
+	if (&other != this) {
+		freeBuffer ();
+		steal (other);
+	}
+	return *this;
+}
+#endif
+
 /*******************************************************************************
  * DESCRIPTION: Assignment from a null-terminated C-style string.
  *
@@ -361,22 +517,19 @@ String& MagiC::String::operator= (const char* chrp	/**< Zero-terminated char buf
 {
 	if (!chrp || !*chrp) {
 		// The string was null or empty
-		if (mData) {
-			mLen	= 0;
-			*mData	= '\x00'; // Preserve it
+		if (!isNull ()) {
+			mLen		= 0;
+			*chars ()	= '\x00'; // Preserve it
 		}
 	} else {
-		// The string has something
-		mLen = strlen (chrp);
-		if (mLen > mMaxLen) { // Reallocate only if necessary
-			if (mData)
-				delete mData;
-			mMaxLen = mLen;
-			mData = new char [mMaxLen+1];
-		}
-		memcpy (mData, chrp, mLen+1);
+		// The string has something. Reallocate only if necessary; the
+		// source may then be within our own buffer.
+		int len = strlen (chrp);
+		char* data = (len > mMaxLen || isNull ())? allocate (len) : chars ();
+		memmove (data, chrp, len+1);
+		mLen = len;
 	}
-	mChkSum	= 0;
+	mHash	= 0;
 	return *this;
 }
 
@@ -401,8 +554,8 @@ ostream& MagiC::String::dump (ostream& out) const {
  ******************************************************************************/
 ostream& MagiC::String::operator>> (ostream& out) const
 {
-	if (mData)
-		out << mData;
+	if (!isNull ())
+		out << chars ();
 	else
 		out << "(null)";
 	return out;
@@ -419,8 +572,8 @@ ostream& MagiC::String::operator>> (ostream& out) const
  ******************************************************************************/
 TextOStream& MagiC::String::operator>> (TextOStream& out) const
 {
-	if (mData)
-		out << mData;
+	if (!isNull ())
+		out << chars ();
 	else
 		out << "(null)";
 	return out;
@@ -438,7 +591,8 @@ TextIStream& MagiC::String::operator<< (TextIStream& is)
 {
 	ensure_spontane (80);
 	mLen		= 0;
-	mData[0]	= '\x00';
+	mHash		= 0;
+	*chars ()	= '\x00';
 
 	int w = is.width (0);
 	IODevice *dev = is.device (); // Read the device directly
@@ -472,9 +626,13 @@ TextIStream& MagiC::String::operator<< (TextIStream& is)
  ******************************************************************************/
 DataOStream& MagiC::String::operator>> (DataOStream& arc) const
 {
+	// The binary format has a compact representation of its own
+	if (arc.isBinary ())
+		return arc << *this;
+
 	arc.name ("mLen") << mLen;
 	arc.name ("mMaxLen") << mMaxLen;
-	arc.name ("mData").writeRawBytes (mData, mLen? mLen+1 : 0);
+	arc.name ("mData").writeRawBytes (chars (), mLen? mLen+1 : 0);
 	return arc;
 }
 
@@ -483,15 +641,7 @@ DataOStream& MagiC::String::operator>> (DataOStream& arc) const
  ******************************************************************************/
 DataIStream& MagiC::String::operator<< (DataIStream& arc)
 {
-	arc >> mLen;
-	arc >> mMaxLen;
-
-	ensure (mMaxLen);
-	arc.readRawBytes (mData, mLen+1);
-	mData[mLen] = '\x00';
-	mChkSum=0;
-	
-	return arc;
+	return arc >> *this;
 }
 
 /******************************************************************************/
@@ -499,8 +649,13 @@ DataIStream& MagiC::String::operator<< (DataIStream& arc)
  ******************************************************************************/
 String MagiC::String::operator+ (const String& other) const
 {
-	String result = *this;
-	result += other;
+	if (mLen + other.mLen == 0)
+		return *this;
+
+	String result;
+	result.reserve (mLen + other.mLen);
+	result.append (chars (), mLen);
+	result.append (other.chars (), other.mLen);
 	return result;
 }
 
@@ -509,8 +664,14 @@ String MagiC::String::operator+ (const String& other) const
  ******************************************************************************/
 String MagiC::String::operator+ (const char* str /**< Zero-terminated char buffer. */) const
 {
-	String result = *this;
-	result += String(str);
+	int len = str? strlen (str) : 0;
+	if (mLen + len == 0)
+		return *this;
+
+	String result;
+	result.reserve (mLen + len);
+	result.append (chars (), mLen);
+	result.append (str, len);
 	return result;
 }
 
@@ -542,22 +703,28 @@ bool findLowestNum (const String& str, uint& start, uint& end)
 			  if (isdigit(str[i]))
 				  number = number*10 + int(str[i]-'0');
 			  else {
-				  if (number < lowest) {
+				  // A '%' without a number is not a placeholder
+				  if (i > (uint) curPos+1 && number < lowest) {
 					  // Found a new lowest
 					  lowest	= number;
 					  start		= curPos;
 					  end		= i;
 				  }
-				  state = NORMAL;
+				  // The character may start the next placeholder
+				  if (str[i] == '%') {
+					  number = 0;
+					  curPos = i;
+				  } else
+					  state = NORMAL;
 			  }
 			  break;
 		}
 	}
-	if (state == FOUNDPERCENT && number < lowest) {
+	if (state == FOUNDPERCENT && str.length() > (uint) curPos+1 && number < lowest) {
 		// Found a new lowest in the end of the string
 		start	= curPos;
 		end		= str.length();
-		lowest	= 0;
+		lowest	= number;
 	}
 
 	return (lowest!=999999);
@@ -571,12 +738,14 @@ String MagiC::String::arg (const String& replacement, int fieldwidth) const {
 	if (findLowestNum (*this, start, end)) {
 		int		realwidth	= (replacement.length() > (uint)fieldwidth)? replacement.length() : fieldwidth;
 		int		maxLen		= start + realwidth + (length()-end);
-		char*	buf			= new char[maxLen + 1];
-		char*	resultPos	= buf;
+		String	result;
+		result.reserve (maxLen);
+		char*	resultPos	= result.chars ();
+		const char* data	= chars ();
 
 		// Concatenate beginning of the string, if not in the beginning
 		if (start > 0) {
-			memcpy (resultPos, mData, start);
+			memcpy (resultPos, data, start);
 			resultPos += start;
 		}
 
@@ -584,19 +753,19 @@ String MagiC::String::arg (const String& replacement, int fieldwidth) const {
 		if (realwidth > 0) {
 			for (int padding = (realwidth>fieldwidth)? 0 : fieldwidth-replacement.length(); padding>0; padding--)
 				*(resultPos++) = ' ';
-			memcpy (resultPos, replacement.mData, replacement.length());
+			memcpy (resultPos, replacement.chars (), replacement.length());
 			resultPos += replacement.length();
 		}
 
 		// Concatenate rest of the string, if not at end
 		if (end < (uint) mLen) {
-			memcpy (resultPos, mData+end, mLen-end);
+			memcpy (resultPos, data+end, mLen-end);
 			resultPos += mLen-end;
 		}
 		*resultPos = '\x00';
+		result.mLen = resultPos - result.chars ();
 
-		// Create return object using the buffer.
-		return String (buf, maxLen, true);
+		return result;
 	} else
 		// This is an error situation, basicly, but we return something nevertheless.
 		return *this;
@@ -617,37 +786,36 @@ String MagiC::String::arg (const String& replacement, int fieldwidth) const {
  ******************************************************************************/
 String& MagiC::String::dellast (uint n)
 {
-	if (!mData)
+	if (isNull ())
 		return *this;
 
 	// Delete at most the length of the string
 	if (n >= (uint) mLen)
 		n = mLen;
 	mLen -= n;
-	mData[mLen] = 0;
-	mChkSum = 0;
+	chars ()[mLen] = 0;
+	mHash = 0;
 	return *this;
 }
 
 /** Removes all trailing newline (\r, \n) characters. */
 void MagiC::String::chop ()
 {
-	while (mLen>0 && isspace(mData[mLen-1]))
-		dellast (1);
-	mChkSum=0;
+	dellast (mLen - stringKernels().trimSpace (chars (), mLen));
+	mHash=0;
 }
 
 /** Fast comparison operator, based on cached checksum (hash
  *  value). Very quick if the hash values differ.
  *
  *  OBSERVE! This method doesn't calculate the checksums for the
- *  strings; you must calculate them manually!
+ *  strings; if either one has not been calculated, the strings are
+ *  compared normally.
  **/
 int MagiC::String::fast_isequal (const String& other) const {
-	if (other.mChkSum == mChkSum)
-		return operator== (other.mData);
-	else
+	if (mHash && other.mHash && other.mHash != mHash)
 		return 0;
+	return operator== (other.chars ());
 }
 
 /** @fn int MagiC::String::maxLength () const
@@ -659,12 +827,13 @@ int MagiC::String::fast_isequal (const String& other) const {
 String& MagiC::String::hexcode (const String& other) {
 	const char hexcodes[] = "0123456789abcdef";
 	int otherlen = other.length();
+	const char* data = other.chars ();
 	ensure (otherlen*2);
 	for (int i=0; i<otherlen; i++) {
-		*this += hexcodes [((unsigned int) other.mData[i])/16];
-		*this += hexcodes [((unsigned int) other.mData[i])%16];
+		*this += hexcodes [((unsigned int) data[i])/16];
+		*this += hexcodes [((unsigned int) data[i])%16];
 	}
-	mChkSum=0;
+	mHash=0;
 	return *this;
 }
 
@@ -768,8 +937,6 @@ void MagiC::String::unquote (char quotechar, int flags) {
 
 /** Returns a substring (0-based indexing). */
 String MagiC::String::mid (uint from, int n) const {
-	String result;
-	
 	// Jos pituus on -1, otetaan loput merkkijonosta
 	if (n==-1)
 		n = mLen-from;
@@ -782,15 +949,10 @@ String MagiC::String::mid (uint from, int n) const {
 	if (((from + n) > (uint) mLen))
 		n = mLen-from;
 
-	ASSERT (mMaxLen>=n);
-	
 	// Luodaan uusi merkkijono
-	result.mLen = n;
-	result.mMaxLen = mMaxLen;
-	result.mData = new char [mMaxLen+1];
-	strncpy (result.mData, mData+from, n);
-	result.mData [n] = 0;
-
+	String result;
+	result.reserve (n);
+	result.append (chars ()+from, n);
 	return result;
 }
 
@@ -801,14 +963,9 @@ String MagiC::String::left (uint n) const {
 
 /** Returns new string that contains n rightmost letters of the string. */
 String MagiC::String::right (uint n) const {
-	String result;
-	
 	if (n < (uint) mLen)
-		result = mid (mLen-n);
-	else
-		result = *this;
-
-	return result;
+		return mid (mLen-n);
+	return *this;
 }
 
 /** Searches for a substring.
@@ -816,10 +973,16 @@ String MagiC::String::right (uint n) const {
  *  @return Position of the substring, or -1 of not found.
  **/
 int MagiC::String::find (const String& subs, uint n) const {
-	for (int i=n; i <= (mLen-subs.mLen); i++)
-		if (!strncmp (mData+i, subs.mData, subs.mLen))
-			return i;
-	return -1;
+	return SubString (*this).find (SubString (subs), n);
+}
+
+/** Searches for the characters of a view, without making a copy of
+ *  them.
+ *
+ *  @return Position of the substring, or -1 of not found.
+ **/
+int MagiC::String::find (const SubString& subs, uint n) const {
+	return SubString (*this).find (subs, n);
 }
 
 /** Searches for a single character.
@@ -827,8 +990,11 @@ int MagiC::String::find (const String& subs, uint n) const {
  *  @return Position of the character, or -1 of not found.
  **/
 int MagiC::String::find (const char c, uint n) const {
-	char* pos = (char*) memchr (mData+n, c, mLen);
-	return pos? pos-mData : -1;
+	if (n >= (uint) mLen)
+		return -1;
+	const char* data = chars ();
+	const char* pos = (const char*) memchr (data+n, c, mLen-n);
+	return pos? pos-data : -1;
 }
 
 /** Reverse substring search.
@@ -839,12 +1005,7 @@ int MagiC::String::find (const char c, uint n) const {
  *  @return Position of the character, or -1 of not found.
  **/
 int MagiC::String::findRev (const String& subs, int n) const {
-	if (n<0)
-		n += mLen;
-	for (int i=n; i>=0; i--)
-		if (!strncmp (mData+i, subs.mData, subs.mLen))
-			return i;
-	return -1;
+	return SubString (*this).findRev (SubString (subs), n);
 }
 
 String* MagiC::String::clone () const {
@@ -855,13 +1016,25 @@ String* MagiC::String::clone () const {
 int MagiC::String::operator== (const char* other) const {
 	if (!this)
 		return 0;
-	if (mData && other)
-		return (!strcmp (mData, other));
-	if ((!mData) && (!other))
+	const char* data = chars ();
+	if (data && other)
+		return (!strcmp (data, other));
+	if ((!data) && (!other))
 		return 1;
 	return 0;
 }
 
+/** Orders the String against another Comparable, which should be a
+ *  string; other classes compare as equal. This implements the
+ *  Comparable::compare that is used for sorting.
+ **/
+int MagiC::String::compare (const Comparable& other) const {
+	if (getclass().issameclass (other))
+		return compare ((const String&) other);
+	else
+		return 0;
+}
+
 /** Checks if the String equals another Comparable, which *MUST*
  *  be a string. This implements the Comparable::operator== that
  *  is used for sorting
@@ -874,24 +1047,36 @@ int MagiC::String::operator== (const Comparable& other) const {
 }
 
 /** Reserves exactly the given length for the string (shortens the
- *  string if necessary).
+ *  string if necessary). Lengths up to STRING_INLINE_LENGTH are
+ *  stored inline.
  **/
 void MagiC::String::reserve (int amount) {
-	if (mData) {
-		char* newmData = new char [amount+1];
-		if (!newmData)
-			throw runtime_error ("Out of memory or something in MagiC::String::reserve()");
-		memcpy (newmData, mData, mLen+1);
-		delete mData;
-		mData = newmData;
-		mData [amount] = 0x00;
+	int len = (mLen < amount)? mLen : amount;
+	if (amount <= STRING_INLINE_LENGTH) {
+		if (!isInline ()) {
+			// The buffer and the inline storage overlap
+			char* old = mData;
+			bool owned = ownsBuffer ();
+			mMaxLen = STRING_INLINE_LENGTH;
+			if (old)
+				memcpy (mInline, old, len);
+			if (owned)
+				delete [] old;
+		}
 	} else {
-		mData = new char[amount+1];
-		if (!mData)
+		char* newData = new char [amount+1];
+		if (!newData)
 			throw runtime_error ("Out of memory or something in MagiC::String::reserve()");
-		*mData = 0x00;
+		if (!isNull ())
+			memcpy (newData, chars (), len);
+		freeBuffer ();
+		mData = newData;
+		mMaxLen = amount;
 	}
-	mMaxLen = amount;
+	if (len < mLen)
+		mHash = 0;
+	mLen = len;
+	chars () [len] = 0x00;
 }
 
 /** @fn void MagiC::String::ensure (int amount)
@@ -932,34 +1117,90 @@ char& MagiC::String::operator[] (uint n) {
 }
 */
 
+/** Counts the occurrences of the character in the buffer. */
+static int countChar (const char* data, int len, char c) {
+	int count = 0;
+	for (const char* end = data+len; (data = (const char*) memchr (data, c, end-data)); data++)
+		count++;
+	return count;
+}
+
 /*******************************************************************************
  * Splits the string into an array according to the given delimiter.
+ *
+ * A delimiter at the end of the string leaves the last item NULL.
  ******************************************************************************/
 void MagiC::String::split (Array<String>& trg, const char delim) const {
 	if (!this || !mLen)
 		return;
 
-	// Use temporary copy
-	char* tmp = new char [mLen+1];
-	memcpy (tmp, mData, mLen+1);
-	tmp[mLen]=0;
-
-	// Change delimiters to null-characters
-	int delimcount = 0;
-	for (int i=0; i<mLen; i++)
-		if (tmp[i]==delim) {
-			tmp[i]=0;
-			delimcount++;
-		}
+	// Create result array
+	const char* data = chars ();
+	trg.make (countChar (data, mLen, delim)+1);
+
+	// Fill in response
+	const char* end = data+mLen;
+	int i = 0;
+	for (const char* pos = data; pos<end; i++) {
+		const char* next = (const char*) memchr (pos, delim, end-pos);
+		if (!next)
+			next = end;
+		trg.put ((next>pos)? new String (pos, next-pos) : new String (""), i);
+		pos = next+1;
+	}
+}
+
+/*******************************************************************************
+ * Splits the string into a packed array according to the given
+ * delimiter.
+ *
+ * Faster than splitting into an @ref Array, as the items are not
+ * allocated one by one, and the array keeps its capacity from one
+ * split to another. Empty items are null strings.
+ ******************************************************************************/
+void MagiC::String::split (PackArray<String>& trg, const char delim) const {
+	trg.resize (0);
+	if (!this || !mLen)
+		return;
 
 	// Create result array
-	trg.make (delimcount+1);
+	const char* data = chars ();
+	trg.resize (countChar (data, mLen, delim)+1);
 
 	// Fill in response
-	for (int pos = 0, i=0; pos<mLen; pos+=strlen (tmp+pos)+1, i++)
-		trg.put (new String (tmp+pos), i);
+	const char* end = data+mLen;
+	int i = 0;
+	for (const char* pos = data; pos<end; i++) {
+		const char* next = (const char*) memchr (pos, delim, end-pos);
+		if (!next)
+			next = end;
+		trg[i].append (pos, next-pos);
+		pos = next+1;
+	}
+}
+
+/*******************************************************************************
+ * Splits the string into views of its fields according to the given
+ * delimiter. Nothing is copied, so the string must not be modified
+ * or destroyed while the views are used.
+ ******************************************************************************/
+void MagiC::String::split (PackArray<SubString>& trg, const char delim) const {
+	if (!this) {
+		trg.resize (0);
+		return;
+	}
+	SubString (*this).split (trg, delim);
+}
 
-	delete tmp;
+/** As above, but the fields are separated by any of the characters in
+ *  the zero-terminated delimiter set.
+ **/
+void MagiC::String::split (PackArray<SubString>& trg, const char* delims) const {
+	if (!this) {
+		trg.resize (0);
+		return;
+	}
+	SubString (*this).split (trg, delims);
 }
 
 /** Forms the string by joining the substrings in the given array with
@@ -983,19 +1224,15 @@ void MagiC::String::join (const Array<String>& src, const char delim) {
 				*this += delim;
 		}
 
-	mChkSum=0;
+	mHash=0;
 }
 
 /** Returns the string without any whitespace (space, tab, newline,
  *  cr, ff, vt) characters in the beginning or the end.
  **/
 String MagiC::String::stripWhiteSpace () const {
-	uint s=0, e=mLen;
-	while (s < (uint) mLen && strchr (" \t\r\n",(*this)[s])) // TODO: Add ff, vt
-		s++;
-	while (e>s && strchr (" \t\r\n",(*this)[e-1])) // TODO: Add ff, vt
-		e--;
-	return mid (s, e-s);
+	SubString stripped = SubString (*this).stripWhiteSpace ();
+	return mid (stripped.data () - chars (), stripped.length ());
 }
 
 /** Returns the string without any whitespace (space, tab, newline cr,
@@ -1006,51 +1243,47 @@ String MagiC::String::simplifyWhiteSpace () const {
 	if (mLen == 0)
 		return String();
 
-	char* 	buffer	= new char[mLen+1]; // Add 1 for terminating \x00
-	char*	trgPos	= buffer;
-	int		pos		= 0;
-
-	// Strip whitespace from beginning
-	for (pos=0; pos<mLen; pos++)
-		if (!isspace(mData[pos]))
+	const StringKernels& kernels = stringKernels ();
+	const char*	data	= chars ();
+	const char*	end		= data+mLen;
+	String		result;
+	result.reserve (mLen);
+	char*		buffer	= result.chars ();
+	char*		trgPos	= buffer;
+
+	// Copy the words, each followed by the first whitespace after it.
+	// Whitespace at the beginning is skipped.
+	for (const char* pos = kernels.skipSpace (data, mLen); pos<end; ) {
+		const char* space = kernels.findSpace (pos, end-pos);
+		memcpy (trgPos, pos, space-pos);
+		trgPos += space-pos;
+		if (space == end)
 			break;
-
-	// Strip duplicate whitespaces
-	bool oneWhitespace=false;
-	for (; pos<mLen; pos++) {
-		if (isspace(mData[pos])) {
-			if (!oneWhitespace)
-				*(trgPos++) = mData[pos];
-			oneWhitespace = true;
-		} else {
-			*(trgPos++) = mData[pos];
-			oneWhitespace = false;
-		}
+		*(trgPos++) = *space;
+		pos = kernels.skipSpace (space+1, end-space-1);
 	}
 
 	// Strip whitespace from end (there can be only one)
-	if (isspace (*(trgPos-1)))
+	if (trgPos > buffer && isWhiteSpace (*(trgPos-1)))
 		trgPos--;
 	*trgPos = '\x00';
 
-	if (trgPos > buffer)
-		// Construct using the buffer.
-		return String (buffer, mLen+1, true);
-	else {
+	if (trgPos > buffer) {
+		result.mLen = trgPos - buffer;
+		return result;
+	} else
 		// The string became empty -> return really empty string.
-		delete buffer;
 		return String ();
-	}
 }
 
 void MagiC::String::upper() const {
-	for (int i=0; i<mLen; i++)
-		mData[i] = toupper (mData[i]);
+	stringKernels().upper (chars (), mLen);
+	mHash = 0;
 }
 
 void MagiC::String::lower() const {
-	for (int i=0; i<mLen; i++)
-		mData[i] = tolower (mData[i]);
+	stringKernels().lower (chars (), mLen);
+	mHash = 0;
 }
 
 /** Tries to match the given regular expression to the
@@ -1059,10 +1292,10 @@ void MagiC::String::lower() const {
  *  @return true if the string matches.
  **/
 int MagiC::String::regmatch (const char* expr) const {
-	if (!mData)
+	if (isNull ())
 		return 0;
 	RegExp rexp (expr);
-	return rexp.match (mData);
+	return rexp.match (chars ());
 }
 
 /** Tries to match the given regular expression to the string.
@@ -1076,7 +1309,7 @@ int MagiC::String::regmatch (const char* expr) const {
  *  the array.
  **/
 int MagiC::String::regmatch (const char* expr, Array<String>& target) const {
-	if (!mData)
+	if (isNull ())
 		return 0;
 	RegExp rexp (expr);
 	return rexp.match (*this, target);
@@ -1085,7 +1318,7 @@ int MagiC::String::regmatch (const char* expr, Array<String>& target) const {
 /** As above, but uses a precompiled regular expression.
  **/
 int MagiC::String::regmatch (RegExp& compiled, Array<String>& target) const {
-	if (!mData)
+	if (isNull ())
 		return 0;
 	return compiled.match (*this, target);
 }
@@ -1108,18 +1341,33 @@ int MagiC::String::regmatch (RegExp& compiled, Array<String>& target) const {
  **/
 void MagiC::String::empty ()
 {
-	if (mData) {
+	if (!isNull ()) {
 		mLen = 0;
-		mData[mLen] = '\x00';
+		mHash = 0;
+		*chars () = '\x00';
 	}
 }
 
 /** Calculates an 8-bit checksum for the string.
+ *
+ *  The checksum is the low byte of the cached hash value.
  **/
 char MagiC::String::checksum () {
-	mChkSum = 0;
-	hashfunc (256);
-	return mChkSum;
+	return (char) hashvalue ();
+}
+
+/** Converts the string to an integer in the manner of atol(). */
+long MagiC::String::toLong () const
+{
+	return isNull ()? 0 : SubString (*this).toLong ();
+}
+
+/** Converts the string to a floating-point number in the manner of
+ *  atof(), but with correct rounding.
+ **/
+double MagiC::String::toDouble () const
+{
+	return isNull ()? 0 : SubString (*this).toDouble ();
 }
 
 /** @fn char* MagiC::String::getbuffer () const
@@ -1131,41 +1379,31 @@ char MagiC::String::checksum () {
  *
  *  Defined for the use of Comparable::hashfunc.
  *
- *  The hash function is simply h(c)=c%hashsize. Once the hash
- *  number has been calculated for the string, it is cached. This
- *  gives a considerable speedup for evaluating this method.
+ *  The hash is the full-width @ref hashvalue reduced to the hash
+ *  size, so any hash size can be used.
  **/
 int	MagiC::String::hashfunc (int hashsize) const
 {
-	ASSERTWITH (hashsize<=256, format ("String hash size maximum is 256 slots",
-									   " (hashsize was %d)", hashsize));
-	
-	// Jos on checksum laskettu, palautetaan sen mukainen arvo
-	if (mChkSum)
-		return mChkSum % hashsize;
-
-	if (!mLen)
-		return 0;
-
-	int sum = 0;
-	if (mLen < 10) {
-		// Lyhyille merkkijonoille
-		
-		for (int i=0; i<mLen; i++)
-			sum += mData[i];
-
-		(unsigned char&) mChkSum = sum % 256;
-	} else {
-		// Pitemmille merkkijonoille
+	return hashvalue () % (uint) hashsize;
+}
 
-		// Sum of the first, middle and last character
-		sum = int(mData[0]) + int(mData[mLen/2]) + mLen*int(mData[mLen-1]);
+/** Computes a full-width hash value for the string.
+ *
+ *  Defined for the use of Comparable::hashvalue, which @ref Map
+ *  uses. The whole content of the string is hashed with @ref
+ *  hashbytes. Once the hash value has been calculated, it is cached
+ *  until the string is modified.
+ **/
+uint MagiC::String::hashvalue () const
+{
+	if (!mHash) {
+		mHash = hashbytes (chars (), mLen);
 
-		(unsigned char&) mChkSum = sum % 256;
+		// Zero marks the hash as not calculated
+		if (!mHash)
+			mHash = 1;
 	}
-
-	// TRACE4 ("%s -> %d/%d/%d", mData, sum, int(mChkSum), int(mChkSum%hashsize));
-	return mChkSum % hashsize;
+	return mHash;
 }
 
 /** @fn char* MagiC::String::getbuffer () const
@@ -1238,6 +1476,126 @@ char* safedup (const char* orig, int maxlen) {
 		return (char*) NULL;
 }
 
+/*******************************************************************************
+ * Helpers for hashbytes().
+ ******************************************************************************/
+
+/** Multiplies two 64-bit values to 128 bits; returns the low half
+ *  in a and the high half in b.
+ **/
+static inline void hashMultiply (uint64_t& a, uint64_t& b)
+{
+#ifdef __SIZEOF_INT128__
+	__uint128_t r = (__uint128_t) a * b;
+	a = (uint64_t) r;
+	b = (uint64_t) (r >> 64);
+#else
+	uint64_t ha = a >> 32, hb = b >> 32, la = (uint32_t) a, lb = (uint32_t) b;
+	uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+	uint64_t t = rl + (rm0 << 32), c = t < rl;
+	uint64_t lo = t + (rm1 << 32);
+	c += lo < t;
+	a = lo;
+	b = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+#endif
+}
+
+/** Multiplies two 64-bit values to 128 bits and folds the halves. */
+static inline uint64_t hashMix (uint64_t a, uint64_t b)
+{
+	hashMultiply (a, b);
+	return a ^ b;
+}
+
+/** Unaligned little-endian 64-bit read. */
+static inline uint64_t hashRead8 (const unsigned char* p)
+{
+	uint64_t v;
+	memcpy (&v, p, 8);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	v = __builtin_bswap64 (v);
+#endif
+	return v;
+}
+
+/** Unaligned little-endian 32-bit read. */
+static inline uint64_t hashRead4 (const unsigned char* p)
+{
+	uint32_t v;
+	memcpy (&v, p, 4);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	v = __builtin_bswap32 (v);
+#endif
+	return v;
+}
+
+/*******************************************************************************
+ * Computes a 32-bit hash value of a memory block.
+ *
+ * The function is the public domain wyhash (final version 4), with a
+ * zero seed, folded to 32 bits. Short inputs are read with a few
+ * overlapping loads and no loop. Inputs longer than 48 bytes are
+ * consumed with three independent multiply chains per iteration, so
+ * that the multiplications of a long string run in parallel.
+ *
+ * The same bytes always give the same value on all platforms, which
+ * is what @ref String::hashvalue and any other hashed views of
+ * string data rely on. For this reason there is no vectorized path
+ * for long inputs: the 64x64-bit multiplications of wyhash have no
+ * SSE or AVX2 counterpart, so a vector path would be a different
+ * hash function. The three chains already hash about 20 GB/s.
+ ******************************************************************************/
+uint hashbytes (const char* data, /**< Data to hash, may be NULL if len is 0. */
+				int len)          /**< Length of the data in bytes. */
+{
+	static const uint64_t secret[4] = {
+		0xa0761d6478bd642fULL, 0xe7037ed1a0b428dbULL,
+		0x8ebc6af09c88c6e3ULL, 0x589965cc75374cc3ULL};
+
+	const unsigned char* p = (const unsigned char*) data;
+	uint64_t seed = hashMix (secret[0], secret[1]);
+	uint64_t a, b;
+
+	if (len <= 16) {
+		if (len >= 4) {
+			int shift = (len >> 3) << 2;
+			a = (hashRead4 (p) << 32) | hashRead4 (p + shift);
+			b = (hashRead4 (p + len - 4) << 32) | hashRead4 (p + len - 4 - shift);
+		} else if (len > 0) {
+			a = (((uint64_t) p[0]) << 16) | (((uint64_t) p[len >> 1]) << 8) | p[len - 1];
+			b = 0;
+		} else
+			a = b = 0;
+	} else {
+		int i = len;
+		if (i > 48) {
+			uint64_t seed1 = seed, seed2 = seed;
+			do {
+				seed  = hashMix (hashRead8 (p)      ^ secret[1], hashRead8 (p + 8)  ^ seed);
+				seed1 = hashMix (hashRead8 (p + 16) ^ secret[2], hashRead8 (p + 24) ^ seed1);
+				seed2 = hashMix (hashRead8 (p + 32) ^ secret[3], hashRead8 (p + 40) ^ seed2);
+				p += 48;
+				i -= 48;
+			} while (i > 48);
+			seed ^= seed1 ^ seed2;
+		}
+		while (i > 16) {
+			seed = hashMix (hashRead8 (p) ^ secret[1], hashRead8 (p + 8) ^ seed);
+			p += 16;
+			i -= 16;
+		}
+		a = hashRead8 (p + i - 16);
+		b = hashRead8 (p + i - 8);
+	}
+
+	// Final avalanche
+	a ^= secret[1];
+	b ^= seed;
+	hashMultiply (a, b);
+	uint64_t h = hashMix (a ^ secret[0] ^ (uint64_t) len, b ^ secret[1]);
+	return (uint) (h ^ (h >> 32));
+}
+
 /*******************************************************************************
  * Reads one \n-terminated row from a stream to a String.
  *
@@ -1349,29 +1707,749 @@ String /*MagiC::*/ vstrformat (const char* sformat, /**< Formatting, as in C pri
 {
 	va_list args;
 
-	// Reserve a smallish buffer
-	char* buffer = new char [STRFORMAT_SMALL_BUFFER_SIZE + 1];
-
 	// Try writing to a smallish buffer.
 	// The vsnprintf() modifies the va_list, and we have to end it.
+	char buffer [STRFORMAT_SMALL_BUFFER_SIZE + 1];
 	va_copy (args, ap);
 	int written = vsnprintf (buffer, STRFORMAT_SMALL_BUFFER_SIZE + 1, sformat, args);
 	va_end (args);
 
-	// Check if it was enough
-	if (written > STRFORMAT_SMALL_BUFFER_SIZE) {
-		// Grow the buffer to the required size
-		delete buffer;
-		buffer = new char [written+1];
-
-		// Reprint to the larger buffer.
-		// The args has become invalid, so we have to reset it.
-		va_copy (args, ap);
-		vsnprintf (buffer, written+1, sformat, args);
-		va_end (args);
+	// Check if it was enough; short results are stored inline
+	if (written <= STRFORMAT_SMALL_BUFFER_SIZE) {
+		String result ("");
+		result.append (buffer, written);
+		return result;
 	}
 
-	return String (buffer, String::STRCRFL_OWN);
+	// Reprint to a buffer of the required size.
+	// The args has become invalid, so we have to reset it.
+	char* large = new char [written+1];
+	va_copy (args, ap);
+	vsnprintf (large, written+1, sformat, args);
+	va_end (args);
+
+	return String (large, String::STRCRFL_OWN);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Type-safe formatting
+///////////////////////////////////////////////////////////////////////////////
+
+/** Returns the value as a signed integer. */
+long long FormatArg::toLongLong () const
+{
+	switch (mType) {
+	  case ARG_INT:		return mValue.i;
+	  case ARG_UINT:	return (long long) mValue.u;
+	  case ARG_DOUBLE:	return (long long) mValue.d;
+	  case ARG_CHAR:	return mValue.c;
+	  case ARG_POINTER:	return (long long) (uintptr_t) mValue.p;
+	  default:			return 0;
+	}
+}
+
+/** Returns the value as an unsigned integer. Negative values are
+ *  taken modulo the size of their original type, like printf does.
+ **/
+unsigned long long FormatArg::toULongLong () const
+{
+	if (mType == ARG_INT && mSize < (int) sizeof (long long))
+		return (unsigned long long) mValue.i & ((1ULL << (mSize*8)) - 1);
+	if (mType == ARG_CHAR)
+		return (unsigned char) mValue.c;
+	return (unsigned long long) toLongLong ();
+}
+
+/** Returns the value as a floating-point number. */
+double FormatArg::toDouble () const
+{
+	switch (mType) {
+	  case ARG_DOUBLE:	return mValue.d;
+	  case ARG_UINT:	return (double) mValue.u;
+	  default:			return (double) toLongLong ();
+	}
+}
+
+/** A parsed printf conversion specification. */
+struct FormatSpec {
+	bool	left;		/**< '-' flag: pad on the right. */
+	bool	zero;		/**< '0' flag: pad numbers with zeros. */
+	bool	alternate;	/**< '#' flag: prefix hex and octal numbers. */
+	char	sign;		/**< '+' or ' ' flag for non-negative numbers, or 0. */
+	int		width;		/**< Minimum width. */
+	int		precision;	/**< Precision, or -1 if not given. */
+	char	conversion;	/**< Conversion character. */
+};
+
+/** Collects the formatted pieces, so that the target gets them in a
+ *  few large blocks instead of one call for each piece.
+ **/
+class FormatBuffer {
+  public:
+				FormatBuffer	(FormatTarget& target) : mTarget (target), mLen (0) {}
+				~FormatBuffer	() {flush ();}
+
+	void		write			(const char* data, uint len) {
+		if (mLen + len > sizeof (mBuffer)) {
+			flush ();
+			if (len > sizeof (mBuffer)) {
+				mTarget.write (data, len);
+				return;
+			}
+		}
+		memcpy (mBuffer + mLen, data, len);
+		mLen += len;
+	}
+
+	void		flush			() {
+		if (mLen)
+			mTarget.write (mBuffer, mLen);
+		mLen = 0;
+	}
+
+  private:
+	FormatTarget&	mTarget;
+	uint			mLen;
+	char			mBuffer [256];
+};
+
+/** Writes the given number of copies of the character. */
+static void writeFill (FormatBuffer& target, char c, int count)
+{
+	static const char spaces[] = "                                ";
+	static const char zeros[] = "00000000000000000000000000000000";
+	const char* fill = (c == '0')? zeros : spaces;
+	for (; count > 0; count -= 32)
+		target.write (fill, (count < 32)? count : 32);
+}
+
+/** Writes a formatted field: the prefix (sign or "0x"), leading zeros
+ *  and the body, padded to the field width.
+ **/
+static void writeField (FormatBuffer& target, const FormatSpec& spec, const char* prefix, int prefixLen,
+						int zeros, const char* body, int bodyLen)
+{
+	int padding = spec.width - prefixLen - zeros - bodyLen;
+	if (padding > 0 && !spec.left && spec.zero && spec.precision < 0 && strchr ("diouxX", spec.conversion)) {
+		// Zero-padding goes between the prefix and the digits
+		zeros += padding;
+		padding = 0;
+	}
+	if (padding > 0 && !spec.left)
+		writeFill (target, ' ', padding);
+	if (prefixLen)
+		target.write (prefix, prefixLen);
+	if (zeros > 0)
+		writeFill (target, '0', zeros);
+	target.write (body, bodyLen);
+	if (padding > 0 && spec.left)
+		writeFill (target, ' ', padding);
+}
+
+/** Formats an integer according to the conversion. */
+static void formatInteger (FormatBuffer& target, const FormatSpec& spec, const FormatArg& arg)
+{
+	char buffer [72];
+	char* end = buffer + sizeof (buffer);
+	char* digits = end;
+	char prefix [2];
+	int prefixLen = 0;
+
+	if (spec.conversion == 'd' || spec.conversion == 'i') {
+		long long value = (arg.type () == FormatArg::ARG_UINT)? (long long) arg.toULongLong () : arg.toLongLong ();
+		unsigned long long magnitude = (value < 0)? 0ULL - (unsigned long long) value : value;
+		if (arg.type () == FormatArg::ARG_UINT)
+			magnitude = arg.toULongLong ();
+		else if (value < 0)
+			prefix [prefixLen++] = '-';
+		if (!prefixLen && spec.sign)
+			prefix [prefixLen++] = spec.sign;
+		if (magnitude || spec.precision != 0) {
+			int len = formatULong (buffer, magnitude);
+			digits = end - len;
+			memmove (digits, buffer, len);
+		}
+	} else {
+		unsigned long long value = arg.toULongLong ();
+		const char* alphabet = (spec.conversion == 'X')? "0123456789ABCDEF" : "0123456789abcdef";
+		int shift = (spec.conversion == 'o')? 3 : (spec.conversion == 'u')? 0 : 4;
+		if (shift == 0) {
+			if (value || spec.precision != 0) {
+				int len = formatULong (buffer, value);
+				digits = end - len;
+				memmove (digits, buffer, len);
+			}
+		} else if (value || spec.precision != 0) {
+			unsigned long long mask = (1ULL << shift) - 1;
+			do {
+				*--digits = alphabet [value & mask];
+				value >>= shift;
+			} while (value);
+		}
+		if (spec.alternate && shift == 4 && arg.toULongLong ()) {
+			prefix [prefixLen++] = '0';
+			prefix [prefixLen++] = spec.conversion;
+		} else if (spec.alternate && shift == 3 && (digits == end || *digits != '0'))
+			*--digits = '0';
+	}
+
+	int len = end - digits;
+	int zeros = (spec.precision > len)? spec.precision - len : 0;
+	writeField (target, spec, prefix, prefixLen, zeros, digits, len);
+}
+
+/** Formats a floating-point number according to the conversion. */
+static void formatFloating (FormatBuffer& target, const FormatSpec& spec, double value)
+{
+	char buffer [NUMCONV_DOUBLE_BUFFER];
+
+	// %g without flags is the common case that needs no printf
+	if (spec.conversion == 'g' && !spec.width && !spec.sign && !spec.alternate) {
+		int len = formatDouble (buffer, value, (spec.precision < 0)? 6 : (spec.precision == 0)? 1 : spec.precision);
+		if (len >= 0) {
+			target.write (buffer, len);
+			return;
+		}
+	}
+
+	// Rebuild the conversion specification for snprintf()
+	char cformat [32];
+	char* pos = cformat;
+	*pos++ = '%';
+	if (spec.left)		*pos++ = '-';
+	if (spec.zero)		*pos++ = '0';
+	if (spec.alternate)	*pos++ = '#';
+	if (spec.sign)		*pos++ = spec.sign;
+	*pos++ = '*';
+	*pos++ = '.';
+	*pos++ = '*';
+	*pos++ = spec.conversion;
+	*pos = '\0';
+
+	// The default precision of %a is exact, not 6
+	int precision = spec.precision;
+	if (precision < 0 && (spec.conversion == 'a' || spec.conversion == 'A'))
+		precision = -1;
+	else if (precision < 0)
+		precision = 6;
+
+	char large [128];
+	int len = snprintf (large, sizeof (large), cformat, spec.width, precision, value);
+	if (len < (int) sizeof (large)) {
+		target.write (large, len);
+		return;
+	}
+	char* huge = new char [len+1];
+	snprintf (huge, len+1, cformat, spec.width, precision, value);
+	target.write (huge, len);
+	delete [] huge;
+}
+
+/** Formats a value other than a string as text: integers in decimal,
+ *  floating-point numbers like %g and characters as they are.
+ *
+ *  @return Length of the text, at most NUMCONV_DOUBLE_BUFFER.
+ **/
+static int argText (const FormatArg& arg, char* buffer)
+{
+	int len;
+	switch (arg.type ()) {
+	  case FormatArg::ARG_CHAR:
+		  buffer [0] = arg.toChar ();
+		  return 1;
+	  case FormatArg::ARG_DOUBLE:
+		  len = formatDouble (buffer, arg.toDouble (), 6);
+		  if (len < 0)
+			  len = snprintf (buffer, NUMCONV_DOUBLE_BUFFER, "%g", arg.toDouble ());
+		  return len;
+	  case FormatArg::ARG_UINT:
+		  return formatULong (buffer, arg.toULongLong ());
+	  case FormatArg::ARG_POINTER:
+		  return snprintf (buffer, NUMCONV_DOUBLE_BUFFER, "%p", arg.toPointer ());
+	  default:
+		  return formatLong (buffer, arg.toLongLong ());
+	}
+}
+
+/** Writes the argument as text, strings as they are. */
+static void writeArgText (FormatBuffer& target, const FormatArg& arg)
+{
+	if (arg.type () == FormatArg::ARG_STRING) {
+		SubString str = arg.toSubString ();
+		target.write (str.data (), str.length ());
+	} else {
+		char buffer [NUMCONV_DOUBLE_BUFFER];
+		target.write (buffer, argText (arg, buffer));
+	}
+}
+
+/** Formats one argument according to the conversion specification. */
+static void formatOne (FormatBuffer& target, const FormatSpec& spec, const FormatArg& arg)
+{
+	switch (spec.conversion) {
+	  case 'd': case 'i': case 'u': case 'x': case 'X': case 'o':
+		  if (arg.type () == FormatArg::ARG_STRING)
+			  break;
+		  if (arg.type () == FormatArg::ARG_DOUBLE) {
+			  // Shown as it is, not truncated to garbage
+			  FormatSpec gspec = spec;
+			  gspec.conversion = 'g';
+			  gspec.precision = -1;
+			  formatFloating (target, gspec, arg.toDouble ());
+			  return;
+		  }
+		  formatInteger (target, spec, arg);
+		  return;
+
+	  case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+		  if (arg.type () == FormatArg::ARG_STRING)
+			  break;
+		  formatFloating (target, spec, arg.toDouble ());
+		  return;
+
+	  case 'c':
+		  if (arg.type () == FormatArg::ARG_STRING)
+			  break;
+		  {
+			  char c = arg.toChar ();
+			  writeField (target, spec, NULL, 0, 0, &c, 1);
+		  }
+		  return;
+
+	  case 'p': {
+		  char buffer [32];
+		  int len = snprintf (buffer, sizeof (buffer), "%p", arg.toPointer ());
+		  writeField (target, spec, NULL, 0, 0, buffer, len);
+		  return;
+	  }
+	}
+
+	// Strings, and other types for %s
+	if (arg.type () == FormatArg::ARG_STRING) {
+		SubString str = arg.toSubString ();
+		if (!str.data ()) {
+			writeField (target, spec, NULL, 0, 0, "(null)", 6);
+			return;
+		}
+		uint len = (spec.precision >= 0 && (uint) spec.precision < str.length ())? spec.precision : str.length ();
+		writeField (target, spec, NULL, 0, 0, str.data (), len);
+	} else {
+		char buffer [NUMCONV_DOUBLE_BUFFER];
+		writeField (target, spec, NULL, 0, 0, buffer, argText (arg, buffer));
+	}
+}
+
+/*****************************************************************************/
+/** Formats the arguments with a printf-style format in one pass.
+ *
+ *  The conversions are those of printf: d, i, u, o, x, X, c, s, f,
+ *  F, e, E, g, G, a, A and p with the flags -, 0, #, + and space, and
+ *  with a width and precision, also given as * arguments. Size
+ *  modifiers (h, l, ll, L, q, j, z, t) are accepted and ignored, as
+ *  the types of the arguments are known. A value that does not suit
+ *  the conversion is shown as it is: a string for %d prints the
+ *  string, a number for %s prints the number. Conversions without an
+ *  argument are copied to the output as they are.
+ *****************************************************************************/
+void formatArgs (FormatTarget& output,		/**< Where to write. */
+				 const char* sformat,		/**< Formatting, as in C printf. */
+				 const FormatArg* args,		/**< Arguments for the conversions. */
+				 int count)					/**< Number of arguments. */
+{
+	uint estimate = strlen (sformat);
+	for (int i=0; i<count; i++)
+		estimate += args[i].estimateLength ();
+	output.expect (estimate);
+
+	FormatBuffer target (output);
+	int next = 0;
+	const char* pos = sformat;
+	while (*pos) {
+		// Copy the text up to the next conversion
+		const char* percent = strchr (pos, '%');
+		if (!percent) {
+			target.write (pos, strlen (pos));
+			break;
+		}
+		if (percent > pos)
+			target.write (pos, percent - pos);
+		pos = percent + 1;
+		if (*pos == '%') {
+			target.write (pos++, 1);
+			continue;
+		}
+
+		// Parse the conversion specification
+		FormatSpec spec = {false, false, false, 0, 0, -1, 0};
+		for (;; pos++) {
+			if (*pos == '-')		spec.left = true;
+			else if (*pos == '0')	spec.zero = true;
+			else if (*pos == '#')	spec.alternate = true;
+			else if (*pos == '+')	spec.sign = '+';
+			else if (*pos == ' ')	{if (!spec.sign) spec.sign = ' ';}
+			else break;
+		}
+		if (*pos == '*') {
+			pos++;
+			spec.width = (next < count)? (int) args[next++].toLongLong () : 0;
+			if (spec.width < 0) {
+				spec.left = true;
+				spec.width = -spec.width;
+			}
+		} else
+			for (; isdigit (*pos); pos++)
+				spec.width = spec.width*10 + (*pos - '0');
+		if (*pos == '.') {
+			pos++;
+			spec.precision = 0;
+			if (*pos == '*') {
+				pos++;
+				spec.precision = (next < count)? (int) args[next++].toLongLong () : 0;
+				if (spec.precision < 0)
+					spec.precision = -1;
+			} else
+				for (; isdigit (*pos); pos++)
+					spec.precision = spec.precision*10 + (*pos - '0');
+		}
+		while (*pos && strchr ("hlLqjzt", *pos))
+			pos++;
+
+		spec.conversion = *pos;
+		if (!*pos || !strchr ("diouxXcsfFeEgGaAp", *pos) || next >= count) {
+			// Not a conversion we know, or no argument for it
+			if (*pos)
+				pos++;
+			target.write (percent, pos - percent);
+			continue;
+		}
+		pos++;
+		formatOne (target, spec, args[next++]);
+	}
+}
+
+/** A %n placeholder found by substituteArgs(). */
+struct ArgPlaceholder {
+	uint	start;		/**< Position of the '%'. */
+	uint	end;		/**< Position after the number. */
+	long	number;		/**< The number. */
+	int		rank;		/**< Index of the argument that replaces it. */
+};
+
+/*****************************************************************************/
+/** Replaces the %n placeholders in the pattern with the arguments, in
+ *  one pass.
+ *
+ *  The placeholders are filled in the same order as by a chain of
+ *  @ref String::arg calls: the first argument replaces the lowest
+ *  number, and repeated numbers are filled from left to right.
+ *  Placeholders left without an argument are kept as they are, and
+ *  the inserted values are not scanned for placeholders.
+ *****************************************************************************/
+void substituteArgs (FormatTarget& output,			/**< Where to write. */
+					 const SubString& pattern,		/**< Text with %n placeholders. */
+					 const FormatArg* args,			/**< Values for the placeholders. */
+					 int count)						/**< Number of values. */
+{
+	const char* data = pattern.data ();
+	uint len = pattern.length ();
+
+	// Find the placeholders; a few fit on the stack
+	ArgPlaceholder local [32];
+	ArgPlaceholder* found = local;
+	int capacity = 32;
+	int placeholders = 0;
+	for (const char* pos = data; (pos = (const char*) memchr (pos, '%', data+len-pos)); ) {
+		const char* digit = ++pos;
+		long number = 0;
+		for (; pos < data+len && isdigit (*pos); pos++)
+			number = number*10 + (*pos - '0');
+		if (pos == digit)
+			continue;
+
+		if (placeholders == capacity) {
+			ArgPlaceholder* larger = new ArgPlaceholder [capacity*2];
+			memcpy (larger, found, placeholders * sizeof (ArgPlaceholder));
+			if (found != local)
+				delete [] found;
+			found = larger;
+			capacity *= 2;
+		}
+		ArgPlaceholder& placeholder = found [placeholders++];
+		placeholder.start = digit - 1 - data;
+		placeholder.end = pos - data;
+		placeholder.number = number;
+	}
+
+	// Rank them in the order chained arg() calls would fill them
+	for (int i=0; i<placeholders; i++) {
+		found[i].rank = 0;
+		for (int j=0; j<placeholders; j++)
+			if (found[j].number < found[i].number || (found[j].number == found[i].number && j < i))
+				found[i].rank++;
+	}
+
+	uint estimate = len;
+	for (int i=0; i<placeholders; i++)
+		if (found[i].rank < count)
+			estimate += args[found[i].rank].estimateLength ();
+	output.expect (estimate);
+
+	FormatBuffer target (output);
+	uint copied = 0;
+	for (int i=0; i<placeholders; i++)
+		if (found[i].rank < count) {
+			target.write (data + copied, found[i].start - copied);
+			writeArgText (target, args[found[i].rank]);
+			copied = found[i].end;
+		}
+	target.write (data + copied, len - copied);
+
+	if (found != local)
+		delete [] found;
+}
+
+/** Replaces the %n placeholders of the string with the values in one
+ *  pass, like a chain of @ref arg calls with them would, but without
+ *  rescanning and copying the string for each value.
+ *
+ *  The C++11 variadic template version takes the values directly:
+ *  String ("%1 took %2 ms").args (name, time).
+ **/
+String MagiC::String::args (const FormatArg* values,	/**< Values for the placeholders. */
+							int count					/**< Number of values. */) const
+{
+	String result;
+	StringFormatTarget target (result);
+	substituteArgs (target, *this, values, count);
+	return result;
+}
+
+/** Appends printf-style formatted text to the string, as with
+ *  @ref formatArgs.
+ **/
+String& MagiC::String::appendFormat (const char* sformat,		/**< Formatting, as in C printf. */
+									 const FormatArg* values,	/**< Arguments for the conversions. */
+									 int count					/**< Number of arguments. */)
+{
+	StringFormatTarget target (*this);
+	formatArgs (target, sformat, values, count);
+	return *this;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//                ----              ----         o                           //
+//               (           |     (      |          _                       //
+//                ---  |   | |---   ---  -+- |/\ | |/ \   ___                //
+//                   ) |   | |   )     )  |  |   | |   | (   \               //
+//               ___/   \__! |__/  ___/    \ |   | |   |  ---/               //
+//                                                        __/                //
+///////////////////////////////////////////////////////////////////////////////
+
+/** Compares the view to a zero-terminated string. A view that
+ *  contains zero bytes is never equal to one.
+ **/
+bool SubString::operator== (const char* str) const
+{
+	if (!str)
+		return mLen == 0;
+	return strnlen (str, mLen+1) == mLen && (!mLen || !memcmp (mData, str, mLen));
+}
+
+/** Compares the characters of two views. */
+bool SubString::operator== (const SubString& other) const
+{
+	return mLen == other.mLen && (mLen == 0 || !memcmp (mData, other.mData, mLen));
+}
+
+/** Returns the position of the character in the view, or -1 if not found. */
+int SubString::find (char c, uint start) const
+{
+	if (start >= mLen)
+		return -1;
+	const char* pos = (const char*) memchr (mData+start, c, mLen-start);
+	return pos? pos-mData : -1;
+}
+
+/** Returns the position of the characters of another view in the
+ *  view, or -1 if not found. An empty view is found at the start
+ *  position.
+ **/
+int SubString::find (const SubString& subs, uint start) const
+{
+	if (start > mLen || subs.mLen > mLen-start)
+		return -1;
+	const char* pos = stringKernels().find (mData+start, mLen-start, subs.mData, subs.mLen);
+	return pos? pos-mData : -1;
+}
+
+/** Returns the position of the last occurrence of another view that
+ *  begins at or before the start position, or -1 if not found. If
+ *  start<0, it is calculated from the end of the view.
+ **/
+int SubString::findRev (const SubString& subs, int start) const
+{
+	if (start < 0)
+		start += mLen;
+	if (start < 0)
+		return -1;
+
+	// The occurrence has to fit within the view
+	uint end = (uint) start + subs.mLen;
+	if (end > mLen)
+		end = mLen;
+	if (subs.mLen == 0)
+		return ((uint) start < mLen)? start : mLen;
+	const char* pos = stringKernels().findRev (mData, end, subs.mData, subs.mLen);
+	return pos? pos-mData : -1;
+}
+
+/** Tries to match a precompiled regular expression to the view.
+ *
+ *  @return != 0 if the expression matched.
+ **/
+int SubString::regmatch (RegExp& compiled) const
+{
+	return compiled.match (*this);
+}
+
+/** As above, but places views of the subexpression matches into the
+ *  array. The first item is the whole match.
+ **/
+int SubString::regmatch (RegExp& compiled, PackArray<SubString>& target) const
+{
+	return compiled.match (*this, target);
+}
+
+/** Returns a view of a part of the view. */
+SubString SubString::mid (uint start, int len) const
+{
+	if (start > mLen)
+		start = mLen;
+	if (len < 0 || start+len > mLen)
+		len = mLen-start;
+	return SubString (mData+start, len);
+}
+
+/** Returns a view without the leading and trailing whitespace. */
+SubString SubString::stripWhiteSpace () const
+{
+	const StringKernels& kernels = stringKernels ();
+	const char* begin = kernels.skipSpace (mData, mLen);
+	return SubString (begin, kernels.trimSpace (begin, mData+mLen-begin));
+}
+
+/*******************************************************************************
+ * Splits the view into views of its fields according to the given
+ * delimiter. Nothing is copied.
+ ******************************************************************************/
+void SubString::split (PackArray<SubString>& trg, const char delim) const
+{
+	trg.resize (0);
+	if (!mLen)
+		return;
+
+	trg.resize (countChar (mData, mLen, delim)+1);
+
+	const char* end = mData+mLen;
+	int i = 0;
+	for (const char* pos = mData; pos<end; i++) {
+		const char* next = (const char*) memchr (pos, delim, end-pos);
+		if (!next)
+			next = end;
+		trg[i] = SubString (pos, next-pos);
+		pos = next+1;
+	}
+}
+
+/*******************************************************************************
+ * Splits the view into views of its fields, which are separated by
+ * any of the characters in the zero-terminated delimiter set.
+ ******************************************************************************/
+void SubString::split (PackArray<SubString>& trg, const char* delims) const
+{
+	trg.resize (0);
+	if (!mLen)
+		return;
+
+	const StringKernels& kernels = stringKernels ();
+	const uint ndelims = strlen (delims);
+	const char* end = mData+mLen;
+	for (const char* pos = mData; ; ) {
+		const char* next = kernels.findAny (pos, end-pos, delims, ndelims);
+		if (!next) {
+			trg.add (SubString (pos, end-pos));
+			break;
+		}
+		trg.add (SubString (pos, next-pos));
+		pos = next+1;
+	}
+}
+
+/** Copies the view to a zero-terminated buffer for conversion by the
+ *  C library. Short views are copied to the given stack buffer,
+ *  longer ones to the given String.
+ **/
+static const char* terminated (const SubString& view, char* buffer, int bufsize, String& heap)
+{
+	if (view.length() < (uint) bufsize) {
+		memcpy (buffer, view.data(), view.length());
+		buffer [view.length()] = '\0';
+		return buffer;
+	}
+	heap = view.toString ();
+	return heap;
+}
+
+/** Converts the view to an integer in the manner of atol(). */
+long SubString::toLong () const
+{
+	// Skip leading whitespace like atol() does
+	const char* begin = mData;
+	const char* end = mData + mLen;
+	while (begin < end && isspace (*begin))
+		begin++;
+
+	// Values long enough to overflow saturate in atol()
+	long value;
+	const char* stop = parseLong (begin, end, value);
+	if (stop == begin)
+		return 0;
+	if (stop - begin < 19)
+		return value;
+
+	char buffer [32];
+	String heap;
+	return atol (terminated (*this, buffer, sizeof(buffer), heap));
+}
+
+/** Converts the view to a floating-point number in the manner of atof(). */
+double SubString::toDouble () const
+{
+	// Skip leading whitespace like atof() does
+	const char* begin = mData;
+	const char* end = mData + mLen;
+	while (begin < end && isspace (*begin))
+		begin++;
+
+	// Infinities, NaNs, hexadecimal and the like are left to atof()
+	double value;
+	const char* stop = parseDouble (begin, end, value);
+	if (stop != begin && (stop == end || !isalpha (*stop)))
+		return value;
+
+	char buffer [64];
+	String heap;
+	return atof (terminated (*this, buffer, sizeof(buffer), heap));
+}
+
+/** Computes the hash value of the characters of the view. It equals
+ *  the @ref String::hashvalue of a String with the same characters,
+ *  so views can be used to look up String keys in a @ref Map.
+ **/
+uint SubString::hashvalue () const
+{
+	uint hash = hashbytes (mData, mLen);
+	return hash? hash : 1;
 }
 
 END_NAMESPACE;
@@ -0,0 +1,516 @@
+/***************************************************************************
+ *   This file is part of the MagiC++ library.                             *
+ *                                                                         *
+ *   Copyright (C) 1998-2005 Marko Grnroos <magi@iki.fi>                  *
+ *                                                                         *
+ ***************************************************************************
+ *                                                                         *
+ *  This library is free software; you can redistribute it and/or          *
+ *  modify it under the terms of the GNU Library General Public            *
+ *  License as published by the Free Software Foundation; either           *
+ *  version 2 of the License, or (at your option) any later version.       *
+ *                                                                         *
+ *  This library is distributed in the hope that it will be useful,        *
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of         *
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU      *
+ *  Library General Public License for more details.                       *
+ *                                                                         *
+ *  You should have received a copy of the GNU Library General Public      *
+ *  License along with this library; see the file COPYING.LIB.  If         *
+ *  not, write to the Free Software Foundation, Inc., 59 Temple Place      *
+ *  - Suite 330, Boston, MA 02111-1307, USA.                               *
+ *                                                                         *
+ ***************************************************************************/
+
+#include <string.h>
+#include <ctype.h>
+#include <magic/mstrkernel.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define STRKERNEL_X86 1
+#include <immintrin.h>
+#endif
+
+BEGIN_NAMESPACE (MagiC);
+
+///////////////////////////////////////////////////////////////////////////////
+// Scalar kernels
+///////////////////////////////////////////////////////////////////////////////
+
+/** Checks the candidate positions [from,to) of the needle one by one.
+ *  The vector kernels use this for the positions left over from
+ *  their blocks.
+ **/
+static inline const char* findFrom (const char* data, uint from, uint to,
+									const char* needle, uint nlen)
+{
+	const char first = needle[0];
+	const char last = needle[nlen-1];
+	for (uint i=from; i<to; i++)
+		if (data[i] == first && data[i+nlen-1] == last && !memcmp (data+i, needle, nlen))
+			return data+i;
+	return NULL;
+}
+
+/** As above, but checks the positions from the last to the first. */
+static inline const char* findRevFrom (const char* data, uint from, uint to,
+									   const char* needle, uint nlen)
+{
+	const char first = needle[0];
+	const char last = needle[nlen-1];
+	for (uint i=to; i>from; i--)
+		if (data[i-1] == first && data[i+nlen-2] == last && !memcmp (data+i-1, needle, nlen))
+			return data+i-1;
+	return NULL;
+}
+
+/** Looks for the first character of the needle with memchr(), and
+ *  compares the rest only there.
+ **/
+static const char* findScalar (const char* data, uint len, const char* needle, uint nlen)
+{
+	if (nlen == 0)
+		return data;
+	if (nlen > len)
+		return NULL;
+
+	const char* last = data+len-nlen;
+	for (const char* pos = data; pos <= last; pos++) {
+		pos = (const char*) memchr (pos, needle[0], last-pos+1);
+		if (!pos)
+			break;
+		if (pos[nlen-1] == needle[nlen-1] && !memcmp (pos, needle, nlen))
+			return pos;
+	}
+	return NULL;
+}
+
+static const char* findRevScalar (const char* data, uint len, const char* needle, uint nlen)
+{
+	if (nlen == 0)
+		return data+len;
+	if (nlen > len)
+		return NULL;
+	return findRevFrom (data, 0, len-nlen+1, needle, nlen);
+}
+
+static const char* findAnyScalar (const char* data, uint len, const char* set, uint nset)
+{
+	if (nset == 1)
+		return (const char*) memchr (data, set[0], len);
+
+	bool member [256];
+	memset (member, 0, sizeof (member));
+	for (uint i=0; i<nset; i++)
+		member [(unsigned char) set[i]] = true;
+	for (uint i=0; i<len; i++)
+		if (member [(unsigned char) data[i]])
+			return data+i;
+	return NULL;
+}
+
+static const char* findSpaceScalar (const char* data, uint len)
+{
+	const char* end = data+len;
+	while (data < end && !isWhiteSpace (*data))
+		data++;
+	return data;
+}
+
+static const char* skipSpaceScalar (const char* data, uint len)
+{
+	const char* end = data+len;
+	while (data < end && isWhiteSpace (*data))
+		data++;
+	return data;
+}
+
+static uint trimSpaceScalar (const char* data, uint len)
+{
+	while (len > 0 && isWhiteSpace (data[len-1]))
+		len--;
+	return len;
+}
+
+static void upperScalar (char* data, uint len)
+{
+	for (uint i=0; i<len; i++)
+		data[i] = toupper ((unsigned char) data[i]);
+}
+
+static void lowerScalar (char* data, uint len)
+{
+	for (uint i=0; i<len; i++)
+		data[i] = tolower ((unsigned char) data[i]);
+}
+
+static const StringKernels scalarKernels = {
+	"scalar", findScalar, findRevScalar, findAnyScalar,
+	findSpaceScalar, skipSpaceScalar, trimSpaceScalar, upperScalar, lowerScalar
+};
+
+#ifdef STRKERNEL_X86
+
+///////////////////////////////////////////////////////////////////////////////
+// SSE2 kernels, 16 characters at a time
+///////////////////////////////////////////////////////////////////////////////
+
+// The position of a candidate is tested by comparing both the first
+// and the last character of the needle, so that few false candidates
+// get to memcmp().
+
+#define SSE2_TARGET __attribute__((target("sse2")))
+
+/** Mask of the whitespace characters in the block. */
+SSE2_TARGET static inline uint spaceMaskSSE2 (__m128i block)
+{
+	__m128i shifted = _mm_sub_epi8 (block, _mm_set1_epi8 ('\t'));
+	__m128i control = _mm_cmpeq_epi8 (_mm_min_epu8 (shifted, _mm_set1_epi8 ('\r'-'\t')), shifted);
+	__m128i space = _mm_cmpeq_epi8 (block, _mm_set1_epi8 (' '));
+	return _mm_movemask_epi8 (_mm_or_si128 (control, space));
+}
+
+SSE2_TARGET static const char* findSSE2 (const char* data, uint len, const char* needle, uint nlen)
+{
+	if (nlen == 0)
+		return data;
+	if (nlen > len)
+		return NULL;
+
+	const uint positions = len-nlen+1;
+	const __m128i first = _mm_set1_epi8 (needle[0]);
+	const __m128i last = _mm_set1_epi8 (needle[nlen-1]);
+	uint i = 0;
+	for (; i+16 <= positions; i+=16) {
+		__m128i head = _mm_loadu_si128 ((const __m128i*) (data+i));
+		__m128i tail = _mm_loadu_si128 ((const __m128i*) (data+i+nlen-1));
+		uint mask = _mm_movemask_epi8 (_mm_and_si128 (_mm_cmpeq_epi8 (head, first),
+													  _mm_cmpeq_epi8 (tail, last)));
+		for (; mask; mask &= mask-1) {
+			uint pos = i + __builtin_ctz (mask);
+			if (!memcmp (data+pos, needle, nlen))
+				return data+pos;
+		}
+	}
+	return findFrom (data, i, positions, needle, nlen);
+}
+
+SSE2_TARGET static const char* findRevSSE2 (const char* data, uint len, const char* needle, uint nlen)
+{
+	if (nlen == 0)
+		return data+len;
+	if (nlen > len)
+		return NULL;
+
+	const __m128i first = _mm_set1_epi8 (needle[0]);
+	const __m128i last = _mm_set1_epi8 (needle[nlen-1]);
+	uint end = len-nlen+1;
+	for (; end >= 16; end-=16) {
+		uint i = end-16;
+		__m128i head = _mm_loadu_si128 ((const __m128i*) (data+i));
+		__m128i tail = _mm_loadu_si128 ((const __m128i*) (data+i+nlen-1));
+		uint mask = _mm_movemask_epi8 (_mm_and_si128 (_mm_cmpeq_epi8 (head, first),
+													  _mm_cmpeq_epi8 (tail, last)));
+		while (mask) {
+			uint bit = 31 - __builtin_clz (mask);
+			if (!memcmp (data+i+bit, needle, nlen))
+				return data+i+bit;
+			mask &= ~(1U << bit);
+		}
+	}
+	return findRevFrom (data, 0, end, needle, nlen);
+}
+
+SSE2_TARGET static const char* findAnySSE2 (const char* data, uint len, const char* set, uint nset)
+{
+	uint i = 0;
+	for (; i+16 <= len; i+=16) {
+		__m128i block = _mm_loadu_si128 ((const __m128i*) (data+i));
+		__m128i hits = _mm_setzero_si128 ();
+		for (uint j=0; j<nset; j++)
+			hits = _mm_or_si128 (hits, _mm_cmpeq_epi8 (block, _mm_set1_epi8 (set[j])));
+		if (uint mask = _mm_movemask_epi8 (hits))
+			return data + i + __builtin_ctz (mask);
+	}
+	return findAnyScalar (data+i, len-i, set, nset);
+}
+
+SSE2_TARGET static const char* findSpaceSSE2 (const char* data, uint len)
+{
+	uint i = 0;
+	for (; i+16 <= len; i+=16)
+		if (uint mask = spaceMaskSSE2 (_mm_loadu_si128 ((const __m128i*) (data+i))))
+			return data + i + __builtin_ctz (mask);
+	return findSpaceScalar (data+i, len-i);
+}
+
+SSE2_TARGET static const char* skipSpaceSSE2 (const char* data, uint len)
+{
+	uint i = 0;
+	for (; i+16 <= len; i+=16)
+		if (uint mask = ~spaceMaskSSE2 (_mm_loadu_si128 ((const __m128i*) (data+i))) & 0xffff)
+			return data + i + __builtin_ctz (mask);
+	return skipSpaceScalar (data+i, len-i);
+}
+
+SSE2_TARGET static uint trimSpaceSSE2 (const char* data, uint len)
+{
+	for (; len >= 16; len-=16)
+		if (uint mask = ~spaceMaskSSE2 (_mm_loadu_si128 ((const __m128i*) (data+len-16))) & 0xffff)
+			return len-16 + (32 - __builtin_clz (mask));
+	return trimSpaceScalar (data, len);
+}
+
+/** Adds the difference to the characters from 'from' to 'to', as long
+ *  as the block is plain ASCII. Returns false if it is not.
+ **/
+SSE2_TARGET static inline bool foldCaseSSE2 (char* data, char from, char to, char diff)
+{
+	__m128i block = _mm_loadu_si128 ((const __m128i*) data);
+	if (_mm_movemask_epi8 (block))
+		return false;
+	__m128i shifted = _mm_sub_epi8 (block, _mm_set1_epi8 (from));
+	__m128i inside = _mm_cmpeq_epi8 (_mm_min_epu8 (shifted, _mm_set1_epi8 (to-from)), shifted);
+	block = _mm_add_epi8 (block, _mm_and_si128 (inside, _mm_set1_epi8 (diff)));
+	_mm_storeu_si128 ((__m128i*) data, block);
+	return true;
+}
+
+SSE2_TARGET static void upperSSE2 (char* data, uint len)
+{
+	uint i = 0;
+	for (; i+16 <= len; i+=16)
+		if (!foldCaseSSE2 (data+i, 'a', 'z', 'A'-'a'))
+			upperScalar (data+i, 16);
+	upperScalar (data+i, len-i);
+}
+
+SSE2_TARGET static void lowerSSE2 (char* data, uint len)
+{
+	uint i = 0;
+	for (; i+16 <= len; i+=16)
+		if (!foldCaseSSE2 (data+i, 'A', 'Z', 'a'-'A'))
+			lowerScalar (data+i, 16);
+	lowerScalar (data+i, len-i);
+}
+
+static const StringKernels sse2Kernels = {
+	"SSE2", findSSE2, findRevSSE2, findAnySSE2,
+	findSpaceSSE2, skipSpaceSSE2, trimSpaceSSE2, upperSSE2, lowerSSE2
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// AVX2 kernels, 32 characters at a time
+///////////////////////////////////////////////////////////////////////////////
+
+// The remainders shorter than a vector are left to the SSE2 and
+// scalar kernels. The upper halves of the registers have to be
+// cleared before, as GCC does not do that for tail calls, and mixing
+// them with SSE code is very slow on many processors.
+
+#define AVX2_TARGET __attribute__((target("avx2")))
+
+/** Mask of the whitespace characters in the block. */
+AVX2_TARGET static inline uint spaceMaskAVX2 (__m256i block)
+{
+	__m256i shifted = _mm256_sub_epi8 (block, _mm256_set1_epi8 ('\t'));
+	__m256i control = _mm256_cmpeq_epi8 (_mm256_min_epu8 (shifted, _mm256_set1_epi8 ('\r'-'\t')), shifted);
+	__m256i space = _mm256_cmpeq_epi8 (block, _mm256_set1_epi8 (' '));
+	return _mm256_movemask_epi8 (_mm256_or_si256 (control, space));
+}
+
+AVX2_TARGET static const char* findAVX2 (const char* data, uint len, const char* needle, uint nlen)
+{
+	if (nlen == 0)
+		return data;
+	if (nlen > len)
+		return NULL;
+
+	const uint positions = len-nlen+1;
+	const __m256i first = _mm256_set1_epi8 (needle[0]);
+	const __m256i last = _mm256_set1_epi8 (needle[nlen-1]);
+	uint i = 0;
+	for (; i+32 <= positions; i+=32) {
+		__m256i head = _mm256_loadu_si256 ((const __m256i*) (data+i));
+		__m256i tail = _mm256_loadu_si256 ((const __m256i*) (data+i+nlen-1));
+		uint mask = _mm256_movemask_epi8 (_mm256_and_si256 (_mm256_cmpeq_epi8 (head, first),
+															_mm256_cmpeq_epi8 (tail, last)));
+		for (; mask; mask &= mask-1) {
+			uint pos = i + __builtin_ctz (mask);
+			if (!memcmp (data+pos, needle, nlen))
+				return data+pos;
+		}
+	}
+	return findFrom (data, i, positions, needle, nlen);
+}
+
+AVX2_TARGET static const char* findRevAVX2 (const char* data, uint len, const char* needle, uint nlen)
+{
+	if (nlen == 0)
+		return data+len;
+	if (nlen > len)
+		return NULL;
+
+	const __m256i first = _mm256_set1_epi8 (needle[0]);
+	const __m256i last = _mm256_set1_epi8 (needle[nlen-1]);
+	uint end = len-nlen+1;
+	for (; end >= 32; end-=32) {
+		uint i = end-32;
+		__m256i head = _mm256_loadu_si256 ((const __m256i*) (data+i));
+		__m256i tail = _mm256_loadu_si256 ((const __m256i*) (data+i+nlen-1));
+		uint mask = _mm256_movemask_epi8 (_mm256_and_si256 (_mm256_cmpeq_epi8 (head, first),
+															_mm256_cmpeq_epi8 (tail, last)));
+		while (mask) {
+			uint bit = 31 - __builtin_clz (mask);
+			if (!memcmp (data+i+bit, needle, nlen))
+				return data+i+bit;
+			mask &= ~(1U << bit);
+		}
+	}
+	return findRevFrom (data, 0, end, needle, nlen);
+}
+
+AVX2_TARGET static const char* findAnyAVX2 (const char* data, uint len, const char* set, uint nset)
+{
+	if (len < 32)
+		return findAnySSE2 (data, len, set, nset);
+	uint i = 0;
+	for (; i+32 <= len; i+=32) {
+		__m256i block = _mm256_loadu_si256 ((const __m256i*) (data+i));
+		__m256i hits = _mm256_setzero_si256 ();
+		for (uint j=0; j<nset; j++)
+			hits = _mm256_or_si256 (hits, _mm256_cmpeq_epi8 (block, _mm256_set1_epi8 (set[j])));
+		if (uint mask = _mm256_movemask_epi8 (hits))
+			return data + i + __builtin_ctz (mask);
+	}
+	_mm256_zeroupper ();
+	return findAnySSE2 (data+i, len-i, set, nset);
+}
+
+AVX2_TARGET static const char* findSpaceAVX2 (const char* data, uint len)
+{
+	if (len < 32)
+		return findSpaceSSE2 (data, len);
+	uint i = 0;
+	for (; i+32 <= len; i+=32)
+		if (uint mask = spaceMaskAVX2 (_mm256_loadu_si256 ((const __m256i*) (data+i))))
+			return data + i + __builtin_ctz (mask);
+	_mm256_zeroupper ();
+	return findSpaceSSE2 (data+i, len-i);
+}
+
+AVX2_TARGET static const char* skipSpaceAVX2 (const char* data, uint len)
+{
+	if (len < 32)
+		return skipSpaceSSE2 (data, len);
+	uint i = 0;
+	for (; i+32 <= len; i+=32)
+		if (uint mask = ~spaceMaskAVX2 (_mm256_loadu_si256 ((const __m256i*) (data+i))))
+			return data + i + __builtin_ctz (mask);
+	_mm256_zeroupper ();
+	return skipSpaceSSE2 (data+i, len-i);
+}
+
+AVX2_TARGET static uint trimSpaceAVX2 (const char* data, uint len)
+{
+	if (len < 32)
+		return trimSpaceSSE2 (data, len);
+	for (; len >= 32; len-=32)
+		if (uint mask = ~spaceMaskAVX2 (_mm256_loadu_si256 ((const __m256i*) (data+len-32))))
+			return len-32 + (32 - __builtin_clz (mask));
+	_mm256_zeroupper ();
+	return trimSpaceSSE2 (data, len);
+}
+
+/** Adds the difference to the characters from 'from' to 'to', as long
+ *  as the block is plain ASCII. Returns false if it is not.
+ **/
+AVX2_TARGET static inline bool foldCaseAVX2 (char* data, char from, char to, char diff)
+{
+	__m256i block = _mm256_loadu_si256 ((const __m256i*) data);
+	if (_mm256_movemask_epi8 (block))
+		return false;
+	__m256i shifted = _mm256_sub_epi8 (block, _mm256_set1_epi8 (from));
+	__m256i inside = _mm256_cmpeq_epi8 (_mm256_min_epu8 (shifted, _mm256_set1_epi8 (to-from)), shifted);
+	block = _mm256_add_epi8 (block, _mm256_and_si256 (inside, _mm256_set1_epi8 (diff)));
+	_mm256_storeu_si256 ((__m256i*) data, block);
+	return true;
+}
+
+AVX2_TARGET static void upperAVX2 (char* data, uint len)
+{
+	if (len < 32) {
+		upperSSE2 (data, len);
+		return;
+	}
+	uint i = 0;
+	for (; i+32 <= len; i+=32)
+		if (!foldCaseAVX2 (data+i, 'a', 'z', 'A'-'a'))
+			upperScalar (data+i, 32);
+	_mm256_zeroupper ();
+	upperSSE2 (data+i, len-i);
+}
+
+AVX2_TARGET static void lowerAVX2 (char* data, uint len)
+{
+	if (len < 32) {
+		lowerSSE2 (data, len);
+		return;
+	}
+	uint i = 0;
+	for (; i+32 <= len; i+=32)
+		if (!foldCaseAVX2 (data+i, 'A', 'Z', 'a'-'A'))
+			lowerScalar (data+i, 32);
+	_mm256_zeroupper ();
+	lowerSSE2 (data+i, len-i);
+}
+
+static const StringKernels avx2Kernels = {
+	"AVX2", findAVX2, findRevAVX2, findAnyAVX2,
+	findSpaceAVX2, skipSpaceAVX2, trimSpaceAVX2, upperAVX2, lowerAVX2
+};
+
+#endif // STRKERNEL_X86
+
+///////////////////////////////////////////////////////////////////////////////
+// Selection
+///////////////////////////////////////////////////////////////////////////////
+
+/*******************************************************************************
+ * Returns the kernels of the given instruction set, or NULL if the
+ * processor does not support it or it is not compiled in. Mostly for
+ * testing; use @ref stringKernels() otherwise.
+ ******************************************************************************/
+const StringKernels* stringKernels (int set)
+{
+	switch (set) {
+	  case STRKERNEL_SCALAR:
+		  return &scalarKernels;
+#ifdef STRKERNEL_X86
+	  case STRKERNEL_SSE2:
+		  return __builtin_cpu_supports ("sse2")? &sse2Kernels : NULL;
+	  case STRKERNEL_AVX2:
+		  return __builtin_cpu_supports ("avx2")? &avx2Kernels : NULL;
+#endif
+	}
+	return NULL;
+}
+
+/*******************************************************************************
+ * Returns the fastest kernels the processor supports. They are
+ * selected on the first call.
+ ******************************************************************************/
+const StringKernels& stringKernels ()
+{
+	static const StringKernels* selected = NULL;
+	if (!selected) {
+		const StringKernels* best = &scalarKernels;
+		for (int set=STRKERNEL_SCALAR+1; set<STRKERNEL_SETS; set++)
+			if (const StringKernels* kernels = stringKernels (set))
+				best = kernels;
+		selected = best;
+	}
+	return *selected;
+}
+
+END_NAMESPACE;
@@ -23,6 +23,7 @@
  ***************************************************************************/
 
 #include "magic/mtextstream.h"
+#include "magic/mnumconv.h"
 
 #include <ctype.h>
 #include <math.h>
@@ -168,15 +169,19 @@ TextOStream& TextOStream::operator<< (const char c)
 
 TextOStream& TextOStream::operator<< (int x)
 {
-	if (mpDevice)
-		mpDevice->writeBlock (String(x));
+	if (mpDevice) {
+		char buffer [NUMCONV_LONG_BUFFER];
+		mpDevice->writeBlock (buffer, formatLong (buffer, x));
+	}
 	return *this;
 }
 
 TextOStream& TextOStream::operator<< (long x)
 {
-	if (mpDevice)
-		mpDevice->writeBlock (String(x));
+	if (mpDevice) {
+		char buffer [NUMCONV_LONG_BUFFER];
+		mpDevice->writeBlock (buffer, formatLong (buffer, x));
+	}
 	return *this;
 }
 
@@ -187,10 +192,15 @@ TextOStream& TextOStream::operator<< (float x)
 	return *this;
 }
 
+/** Prints the value with the fewest digits that read back to the
+ *  same double.
+ **/
 TextOStream& TextOStream::operator<< (double x)
 {
-	if (mpDevice)
-		mpDevice->writeBlock (String(x));
+	if (mpDevice) {
+		char buffer [NUMCONV_DOUBLE_BUFFER];
+		mpDevice->writeBlock (buffer, formatDouble (buffer, x));
+	}
 	return *this;
 }
 
@@ -283,108 +293,68 @@ TextIStream& TextIStream::operator>> (int& rValue)
  *  \t\n42". Does not skip any whitespace after the value.
  *
  *  The following regular expression defines the number format:
- *  [+-]?[0-9]+(\.[0-9]*)?([Ee][+-]?[0-9]+)?
+ *  [+-]?[0-9]*(\.[0-9]*)?([Ee][+-]?[0-9]+)?
  *
  *  For example, values such as "42", "-42", "+42", "+42.12345",
- *  "0.123", "1.5E10", "4.2E+10", and "4.2E-10" are valid.
+ *  "0.123", ".5", "42.", "1.5E10", "4.2E+10", and "4.2E-10" are
+ *  valid. The value is rounded correctly.
  *
- *  Strings such as "42.", "42E" are not valid.
+ *  In "42E", the "E" is consumed but ignored.
  **/
 TextIStream& TextIStream::operator>> (double& rValue)
 {
 	checkDevice (mpDevice);
 
-	// We parse the value with a state machine
-	enum   states {NONE, SIGNFOUND, DOTFOUND, EXPFOUND, EXPSIGNFOUND, END} state = NONE;
-	char   ch      = 0;     // Character read from device
-	int    sign    = 1;     // Positive
-	double fract   = 1.0;   // Multiplier for past-dot digits
-	int    exp     = 0;     // Exponent
-	int    expsign = 1;     // Sign of the exponent
-
 	// Skip whitespace
-	ch = mpDevice->getch ();
-	while (isspace (ch))
+	int ch;
+	do {
 		ch = mpDevice->getch ();
-	
-	// 	Read the value character by character, until value ends, or EOF.
-	rValue = 0;
-	while ((!mpDevice->atEnd()) && (state != END)) {
-		// If the character is a digit, add it to the value
-		switch (state) {
-		  case NONE:
-			  // Check for sign
-			  if (state == NONE && ch == '-') {
-				  sign = -1;
-				  break;
-			  } else if (state == NONE && ch == '+') {
-				  sign = 1;
-				  break;
-			  }
-			  state = SIGNFOUND; // It wasn't sign, so it might be a number.
-			  // Fall through:
-			  
-		  case SIGNFOUND:
-			  if (isdigit(ch)) {
-				  rValue = rValue*10.0 + float (ch - '0');
-			  } else if (ch == '.')
-				  state = DOTFOUND;
-			  else if (ch == 'e' || ch == 'E')
-				  state = EXPFOUND;
-			  else
-				  state = END;
-			  break;
-			  
-		  case DOTFOUND:
-			  if (isdigit (ch)) {
-				  // Handle post-comma digit
-				  fract /= 10.0;
-				  rValue = rValue + double (ch - '0')*fract;
-			  } else if (ch == 'e' || ch == 'E')
-				  state = EXPFOUND;
-			  else
-				  state = END;
-			  break;
-			  
-		  case EXPFOUND:
-			  // Check for sign
-			  if (ch == '-') {
-				  expsign = -1;
-				  break;
-			  } else if (ch == '+') {
-				  expsign = 1;
-				  break;
-			  }
-			  state = EXPSIGNFOUND; // It wasn't sign, so it might be a number.
-			  // Fall through:
-			  
-		  case EXPSIGNFOUND:
-			  if (isdigit(ch))
-				  exp = exp*10 + int (ch - '0');
-			  else
-				  state = END;
-			  break;
-
-		  case END:
-			  break;
-		};
-
-		// Read the next character
+	} while (ch >= 0 && isspace (ch));
+
+	// Collect the characters that can belong to the number, so that it
+	// can be parsed as a whole; short numbers need no allocation
+	enum parts {SIGN, MANTISSA, EXPSIGN, EXPONENT} part = SIGN;
+	bool dotFound = false;
+	char buffer [64];
+	String overflow;
+	int len = 0;
+	while (ch >= 0) {
+		if (isdigit (ch)) {
+			if (part == SIGN)
+				part = MANTISSA;
+			else if (part == EXPSIGN)
+				part = EXPONENT;
+		} else if ((ch == '-' || ch == '+') && (part == SIGN || part == EXPSIGN))
+			part = parts (part + 1);
+		else if (ch == '.' && part <= MANTISSA && !dotFound) {
+			dotFound = true;
+			part = MANTISSA;
+		} else if ((ch == 'e' || ch == 'E') && part == MANTISSA)
+			part = EXPSIGN;
+		else
+			break;
+
+		if (len == sizeof (buffer)) {
+			overflow.append (buffer, len);
+			len = 0;
+		}
+		buffer [len++] = ch;
 		ch = mpDevice->getch ();
 	}
 
-	if (state == END) {
-		// It wasn't a digit, so we didn't want to read it.
+	// It wasn't part of the number, so we didn't want to read it.
+	if (ch >= 0)
 		mpDevice->ungetch (ch);
+
+	const char* begin = buffer;
+	if (!overflow.isEmpty ()) {
+		overflow.append (buffer, len);
+		begin = overflow;
+		len = overflow.length ();
 	}
-	
-	// Correct the sign
-	rValue *= sign;
+	if (parseDouble (begin, begin + len, rValue) == begin)
+		rValue = 0;
 
-	// Apply exponent
-	if (exp != 0)
-		rValue *= pow (10, double (exp*expsign));
-	
 	return *this;
 }
 
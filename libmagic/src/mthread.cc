@@ -26,10 +26,266 @@
 #include <magic/merrors.h>
 
 #include <sys/time.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <unistd.h>
+#include <limits.h>
 #include <errno.h>
 
 BEGIN_NAMESPACE (MagiC);
 
+/** Maximum number of spins before parking a thread on a contended mutex. */
+#define MUTEX_MAX_SPINS 100
+
+/*******************************************************************************
+ * Waits on the futex word while it contains the given value.
+ *
+ * @return 0 when woken up or if the value differed, MERR_TIMEOUT if
+ * the deadline passed.
+ ******************************************************************************/
+static int futexWait (int* pWord, int value,
+					  const struct timespec* pDeadline /**< CLOCK_MONOTONIC, or NULL. */)
+{
+	/* The bitset variant takes an absolute deadline. */
+	if (syscall (SYS_futex, pWord, FUTEX_WAIT_BITSET | FUTEX_PRIVATE_FLAG,
+				 value, pDeadline, NULL, FUTEX_BITSET_MATCH_ANY) < 0
+		&& errno == ETIMEDOUT)
+		return MERR_TIMEOUT;
+	return 0;
+}
+
+/*******************************************************************************
+ * Wakes at most the given number of threads waiting on the futex word.
+ ******************************************************************************/
+static void futexWake (int* pWord, int count)
+{
+	syscall (SYS_futex, pWord, FUTEX_WAKE | FUTEX_PRIVATE_FLAG, count, NULL, NULL, 0);
+}
+
+/** Hints the processor that the thread is spinning. */
+static inline void cpuRelax ()
+{
+#if defined(__i386__) || defined(__x86_64__)
+	__builtin_ia32_pause ();
+#else
+	__asm__ __volatile__ ("" ::: "memory");
+#endif
+}
+
+/** Returns the spin limit; spinning only helps with several processors. */
+static int mutexSpinLimit ()
+{
+	static int limit = -1;
+	if (limit < 0)
+		limit = (sysconf (_SC_NPROCESSORS_ONLN) > 1)? MUTEX_MAX_SPINS : 0;
+	return limit;
+}
+
+/*******************************************************************************
+ * Locks the mutex, waiting if another thread holds it.
+ ******************************************************************************/
+void Mutex::lock ()
+{
+	int expected = 0;
+	if (!__atomic_compare_exchange_n (&mState, &expected, 1, false,
+									  __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+		lockContended ();
+}
+
+/*******************************************************************************
+ * Locks the mutex if no other thread holds it.
+ *
+ * @return true if the mutex was locked.
+ ******************************************************************************/
+bool Mutex::tryLock ()
+{
+	int expected = 0;
+	return __atomic_compare_exchange_n (&mState, &expected, 1, false,
+										__ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+/*******************************************************************************
+ * Unlocks the mutex, waking one waiting thread, if any.
+ ******************************************************************************/
+void Mutex::unlock ()
+{
+	if (__atomic_exchange_n (&mState, 0, __ATOMIC_RELEASE) == 2)
+		futexWake (&mState, 1);
+}
+
+/*******************************************************************************
+ * Spins on the mutex for a while, then parks until it is free.
+ *
+ * The spin limit follows twice the number of spins that recently
+ * succeeded, so a mutex held for long stops being spun on.
+ ******************************************************************************/
+void Mutex::lockContended ()
+{
+	int limit = mutexSpinLimit ();
+	int spins = __atomic_load_n (&mSpins, __ATOMIC_RELAXED);
+	if (limit > spins*2 + 10)
+		limit = spins*2 + 10;
+
+	for (int i=0; i<limit; i++) {
+		cpuRelax ();
+		int expected = 0;
+		if (__atomic_load_n (&mState, __ATOMIC_RELAXED) == 0 &&
+			__atomic_compare_exchange_n (&mState, &expected, 1, false,
+										 __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+			__atomic_store_n (&mSpins, spins + (i - spins)/8, __ATOMIC_RELAXED);
+			return;
+		}
+	}
+	if (limit)
+		__atomic_store_n (&mSpins, spins + (limit - spins)/8, __ATOMIC_RELAXED);
+
+	/* Mark the mutex contended, so that the unlocker wakes us. */
+	while (__atomic_exchange_n (&mState, 2, __ATOMIC_ACQUIRE) != 0)
+		futexWait (&mState, 2, NULL);
+}
+
+/*******************************************************************************
+ * Returns the CLOCK_MONOTONIC time the given number of seconds from
+ * now, for @ref waitUntil().
+ ******************************************************************************/
+struct timespec ConditionVariable::deadline (double seconds)
+{
+	struct timespec deadline;
+	clock_gettime (CLOCK_MONOTONIC, &deadline);
+
+	long wholeSeconds = long (seconds);
+	deadline.tv_sec  += wholeSeconds;
+	deadline.tv_nsec += long ((seconds - wholeSeconds) * 1e9);
+	if (deadline.tv_nsec >= 1000000000L) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000L;
+	}
+	return deadline;
+}
+
+/*******************************************************************************
+ * Releases the mutex and waits for a signal, then locks the mutex
+ * again.
+ *
+ * The mutex must be locked by the caller.
+ *
+ * @return 0 if signaled or woken up spuriously, MERR_TIMEOUT if the
+ * given time passed.
+ ******************************************************************************/
+ThdResult ConditionVariable::wait (Mutex& mutex,
+								   double seconds /**< Timeout, or 0 to wait indefinitely. */)
+{
+	if (seconds <= 0.0)
+		return waitFor (mutex, NULL);
+
+	struct timespec until = deadline (seconds);
+	return waitFor (mutex, &until);
+}
+
+/*******************************************************************************
+ * Like @ref wait(), but waits at most until the given CLOCK_MONOTONIC
+ * time.
+ *
+ * @return 0 if signaled or woken up spuriously, MERR_TIMEOUT if the
+ * deadline passed.
+ ******************************************************************************/
+ThdResult ConditionVariable::waitUntil (Mutex& mutex, const struct timespec& deadline)
+{
+	return waitFor (mutex, &deadline);
+}
+
+/*******************************************************************************
+ * Implementation of @ref wait() and @ref waitUntil().
+ ******************************************************************************/
+ThdResult ConditionVariable::waitFor (Mutex& mutex, const struct timespec* pDeadline)
+{
+	/* A signal after reading the sequence changes it, so the futex */
+	/* wait returns immediately; the signal can not be lost.        */
+	int sequence = __atomic_load_n (&mSequence, __ATOMIC_ACQUIRE);
+	mutex.unlock ();
+	int result = futexWait (&mSequence, sequence, pDeadline);
+
+	/* Other threads may be waiting for the mutex as well. */
+	while (__atomic_exchange_n (&mutex.mState, 2, __ATOMIC_ACQUIRE) != 0)
+		futexWait (&mutex.mState, 2, NULL);
+
+	return result;
+}
+
+/*******************************************************************************
+ * Wakes one of the threads that are waiting, if any.
+ ******************************************************************************/
+void ConditionVariable::signal ()
+{
+	__atomic_add_fetch (&mSequence, 1, __ATOMIC_RELEASE);
+	futexWake (&mSequence, 1);
+}
+
+/*******************************************************************************
+ * Wakes all the threads that are waiting.
+ ******************************************************************************/
+void ConditionVariable::broadcast ()
+{
+	__atomic_add_fetch (&mSequence, 1, __ATOMIC_RELEASE);
+	futexWake (&mSequence, INT_MAX);
+}
+
+/*******************************************************************************
+ * Increments the count, waking a waiting thread, if any.
+ ******************************************************************************/
+void Semaphore::post ()
+{
+	__atomic_add_fetch (&mValue, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n (&mWaiters, __ATOMIC_SEQ_CST) > 0)
+		futexWake (&mValue, 1);
+}
+
+/*******************************************************************************
+ * Decrements the count if it is positive.
+ *
+ * @return true if the count was decremented.
+ ******************************************************************************/
+bool Semaphore::tryWait ()
+{
+	int value = __atomic_load_n (&mValue, __ATOMIC_RELAXED);
+	while (value > 0)
+		if (__atomic_compare_exchange_n (&mValue, &value, value-1, true,
+										 __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+			return true;
+	return false;
+}
+
+/*******************************************************************************
+ * Decrements the count, waiting while it is zero.
+ *
+ * @return 0 if successful, MERR_TIMEOUT if the given time passed.
+ ******************************************************************************/
+ThdResult Semaphore::wait (double seconds /**< Timeout, or 0 to wait indefinitely. */)
+{
+	for (int i=mutexSpinLimit (); i>0; i--) {
+		if (tryWait ())
+			return 0;
+		cpuRelax ();
+	}
+
+	struct timespec deadline;
+	if (seconds > 0.0)
+		deadline = ConditionVariable::deadline (seconds);
+
+	/* The waiter count is raised before the last check, and post()  */
+	/* checks it after raising the value, so a post can not be lost. */
+	__atomic_add_fetch (&mWaiters, 1, __ATOMIC_SEQ_CST);
+	int result = 0;
+	while (!tryWait ()) {
+		if (futexWait (&mValue, 0, seconds > 0.0? &deadline : NULL) == MERR_TIMEOUT) {
+			result = tryWait ()? 0 : MERR_TIMEOUT;
+			break;
+		}
+	}
+	__atomic_sub_fetch (&mWaiters, 1, __ATOMIC_SEQ_CST);
+	return result;
+}
+
 /*******************************************************************************
  * Creates a mutually exclusive (mutex) thread lock.
  *
@@ -45,10 +301,14 @@ ThreadLock::ThreadLock ()
 
 	/* Initialize the mutex. */
 	pthread_mutex_init (&mThreadLock, &attribs);
-	/* Question: is it ok to have the attributes temporary? */
-
-	/* Conditional variables are not initialized in creation. */
-	mCondInited = false;
+	pthread_mutexattr_destroy (&attribs);
+
+	/* Initialize the condition variable to time out by the monotonic clock. */
+	pthread_condattr_t condattr;
+	pthread_condattr_init (&condattr);
+	pthread_condattr_setclock (&condattr, CLOCK_MONOTONIC);
+	pthread_cond_init (&mThreadCond, &condattr);
+	pthread_condattr_destroy (&condattr);
 }
 
 /*******************************************************************************
@@ -59,11 +319,8 @@ ThreadLock::ThreadLock ()
  ******************************************************************************/
 ThreadLock::~ThreadLock ()
 {
-	if (mCondInited) {
-		pthread_cond_destroy (&mThreadCond);
-	}
-
-	/* Should we do something else here? Probably not. */
+	pthread_cond_destroy (&mThreadCond);
+	pthread_mutex_destroy (&mThreadLock);
 }
 
 /*******************************************************************************
@@ -101,26 +358,14 @@ ThdResult ThreadLock::wait (double seconds)
 	/* We must enter lock before calling wait. */
 	lock ();
 
-	/* Initialize condition variable, if not yet initialized. */
-	if (!mCondInited)
-		initCond ();
-
 	/* If no timeout. */
 	if (seconds <= 0.0) {
 		/* Wait indefinitely. */
 		pthread_cond_wait (&mThreadCond, &mThreadLock);
 	}
 	else {
-		/* Timed wait. */
-
-		/* Get current time. */
-		struct timeval  now;
-		gettimeofday (&now, NULL);
-
-		/* Determine timeout time. */
-		struct timespec timeout;
-		timeout.tv_sec  = now.tv_sec + long (seconds);
-		timeout.tv_nsec = long ((now.tv_usec + (seconds - double (long (seconds))) * 1000000)*1000);
+		/* Timed wait, with a normalized monotonic deadline. */
+		struct timespec timeout = ConditionVariable::deadline (seconds);
 
 		/* Start waiting. */
 		int tresult = pthread_cond_timedwait (&mThreadCond, &mThreadLock, &timeout);
@@ -144,12 +389,6 @@ ThdResult ThreadLock::wait (double seconds)
  ******************************************************************************/
 ThdResult ThreadLock::signal ()
 {
-	lock ();
-	/* Initialize condition variable, if not yet initialized. */
-	if (!mCondInited)
-		initCond ();
-	unlock ();
-
 	pthread_cond_signal (&mThreadCond); /* Never returns error. */
 
 	return 0;
@@ -162,31 +401,11 @@ ThdResult ThreadLock::signal ()
  ******************************************************************************/
 ThdResult ThreadLock::broadcast ()
 {
-	lock ();
-	/* Initialize condition variable, if not yet initialized. */
-	if (!mCondInited)
-		initCond ();
-	unlock ();
-
 	pthread_cond_broadcast (&mThreadCond); /* Never returns error. */
 
 	return 0;
 }
 
-/*******************************************************************************
- * Initializes condition variable
- ******************************************************************************/
-void ThreadLock::initCond ()
-{
-	if (!mCondInited) {
-		pthread_condattr_t condattr; /* Condition variable attributes. */
-		
-		pthread_cond_init (&mThreadCond, &condattr); /* Never returns error. */
-		
-		mCondInited = true;
-	}
-}
-
 /*******************************************************************************
  * Creates a thread object.
  *
@@ -23,25 +23,54 @@
  ***************************************************************************/
 
 #include <magic/mworkerthread.h>
+#include <magic/merrors.h>
 
-begin_namespace (MagiC);
+#include <sched.h>
+#include <time.h>
+
+BEGIN_NAMESPACE (MagiC);
+
+/** Maximum number of requests a worker takes from the injection queue at once. */
+#define WORKER_BATCH_SIZE	32
+
+/** Capacity of the deque of each worker. Must exceed the batch size. */
+#define WORKER_DEQUE_SIZE	1024
+
+/** Number of times an idle worker looks for work before parking. */
+#define WORKER_SPIN_ROUNDS	16
+
+/** The worker running in the current thread, if any. */
+static __thread Worker* currentWorker = NULL;
+
+/** Returns monotonic time in nanoseconds. */
+static long monotonicTime ()
+{
+	struct timespec now;
+	clock_gettime (CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000000L + now.tv_nsec;
+}
 
 /*******************************************************************************
  * Creates a worker pool of given size.
  ******************************************************************************/
-WorkerPool::WorkerPool (RequestHandler& rHandler, Log& log, int size)
-		: mrLog (log)
+WorkerPool::WorkerPool (RequestHandler& rHandler, Log& log, int size,
+						int queueSize /**< Capacity of the injection queue. */)
+		: mRequestQueue (queueSize), mrLog (log)
 {
-	mrpHandler       = &rHandler;
-	mIsShutdown      = false;
-	mWorkerCount     = size;
-	mpWorkers        = new Worker* [size];
+	mrpHandler        = &rHandler;
+	mIsShutdown       = false;
+	mSleepers         = 0;
+	mBlockedProducers = 0;
+	mStartTime        = monotonicTime ();
+	mWorkerCount      = size;
+	mpWorkers         = new Worker* [size];
 
-	/* Create the workers. */
-	for (int i=0; i<mWorkerCount; ++i) {
-		mpWorkers[i] = new Worker (this);
+	/* Create all the workers before starting any, as they steal */
+	/* from each other.                                          */
+	for (int i=0; i<mWorkerCount; ++i)
+		mpWorkers[i] = new Worker (this, i);
+	for (int i=0; i<mWorkerCount; ++i)
 		mpWorkers[i]->start ();
-	}
 
 	mrLog.message ("WORKER", Log::Info, 0,
 				   "Started %d worker threads successfully.",
@@ -54,15 +83,12 @@ WorkerPool::WorkerPool (RequestHandler& rHandler, Log& log, int size)
 /*******************************************************************************
  * Destroys worker pool.
  *
- * Shuts down all the workers violently if they not already
- * shut down.
+ * Shuts down the workers, if they are not already shut down.
  ******************************************************************************/
 WorkerPool::~WorkerPool ()
 {
-	/* Ensure that the children have been shutdown before destroying them.  */
-	/* This may happen if the workerpool was not properly shut down by the  */
-	/* Listener by sending it a Shutdown request.                           */
-	if (!mIsShutdown)
+	/* Ensure that the children have been shutdown before destroying them. */
+	if (!isShutdown ())
 		shutdown (NULL);
 	
 	/* Destroy the workers. */
@@ -73,67 +99,240 @@ WorkerPool::~WorkerPool ()
 }
 
 /*******************************************************************************
- * Process a request
+ * Passes a request to the workers.
+ *
+ * If the injection queue is full, waits until the workers have taken
+ * requests from it. A worker of the pool processes the request itself
+ * instead.
+ *
+ * @return 0 if successful, otherwise a negative error code.
+ * MERR_THREAD_POOL_SHUTDOWN is returned if the pool has been shut
+ * down.
  ******************************************************************************/
-MSrvResult WorkerPool::process (Request* pRequest)
+ThdResult WorkerPool::process (Request* pRequest)
 {
-	switch (pRequest->getType ()) {
-	  case Request::Shutdown:
-		  return shutdown (pRequest);
-		  break;
+	while (!enqueue (pRequest)) {
+		/* A worker must not wait for the others, or they all could */
+		/* end up waiting; it processes the request itself.         */
+		if (currentWorker && currentWorker->mpPool == this) {
+			mrpHandler->process (pRequest);
+			return 0;
+		}
+
+		if (isShutdown ())
+			return MERR_THREAD_POOL_SHUTDOWN;
+
+		/* Give the workers a chance to catch up before parking. */
+		for (int spin=0; spin<WORKER_SPIN_ROUNDS && mRequestQueue.size() >= mRequestQueue.capacity(); spin++)
+			sched_yield ();
 
-	  default:
-		/* Put the request in queue. */
-		mRequestQueue.push (pRequest);
-		
-		/* Awaken one worker. */
-		getWaitLock().signal ();
+		MutexLocker locker (mSleepLock);
+		__atomic_add_fetch (&mBlockedProducers, 1, __ATOMIC_SEQ_CST);
+		if (mRequestQueue.size() >= mRequestQueue.capacity() && !isShutdown ())
+			mSpaceCond.wait (mSleepLock);
+		__atomic_sub_fetch (&mBlockedProducers, 1, __ATOMIC_SEQ_CST);
 	}
-	
 	return 0;
 }
 
+/*******************************************************************************
+ * Passes a request to the workers, if the injection queue has room.
+ *
+ * @return 0 if successful, otherwise a negative error code.
+ * MERR_THREAD_QUEUE_FULL is returned if the queue is full, and
+ * MERR_THREAD_POOL_SHUTDOWN if the pool has been shut down.
+ ******************************************************************************/
+ThdResult WorkerPool::tryProcess (Request* pRequest)
+{
+	if (!enqueue (pRequest))
+		return isShutdown ()? MERR_THREAD_POOL_SHUTDOWN : MERR_THREAD_QUEUE_FULL;
+	return 0;
+}
+
+/*******************************************************************************
+ * Puts a request in the deque of the current worker, or in the
+ * injection queue, and wakes a parked worker.
+ *
+ * The workers of the pool may pass requests also during the
+ * shutdown, as they process their queues before exiting.
+ *
+ * @return false if the pool is shut down or the queue is full.
+ ******************************************************************************/
+bool WorkerPool::enqueue (Request* pRequest)
+{
+	bool fromWorker = currentWorker && currentWorker->mpPool == this;
+	if (isShutdown () && !fromWorker)
+		return false;
+
+	if (!(fromWorker && currentWorker->mDeque.push (pRequest)))
+		if (!mRequestQueue.push (pRequest))
+			return false;
+
+	wakeWorker ();
+	return true;
+}
+
 /*******************************************************************************
  * Orders all worker threads to shut down.
  *
- * After shutting down the request handler threads, the optional final
+ * The workers process all queued requests before exiting. After
+ * shutting down the request handler threads, the optional final
  * request will be passed to the request handler and processed,
- * exceptionally in the main thread.
+ * exceptionally in the calling thread.
+ *
+ * @return 0 if successful, otherwise a negative error code.
  ******************************************************************************/
-MSrvResult WorkerPool::shutdown (Request* pRequest /**< Final request. May be NULL. */)
+ThdResult WorkerPool::shutdown (Request* pFinal /**< Final request. May be NULL. */)
 {
-	if (mIsShutdown)
-		return MSRVERR_REPEAT_SHUTDOWN_REQUEST;
-	
-	/* Go to shutdown state. */
-	mIsShutdown = true;
+	{
+		/* Setting the flag under the lock ensures that no worker is */
+		/* between checking it and parking when it is awakened.      */
+		MutexLocker locker (mSleepLock);
+		if (mIsShutdown)
+			return MERR_THREAD_POOL_SHUTDOWN;
+		__atomic_store_n (&mIsShutdown, true, __ATOMIC_SEQ_CST);
+
+		/* Awaken all workers and waiting producers. */
+		mWorkCond.broadcast ();
+		mSpaceCond.broadcast ();
+	}
 
 	mrLog.message ("WORKER", Log::Info, 0,
 				   "Shutting down worker threads...");
 
-	/* Awaken all workers. */
-	getWaitLock().broadcast ();
-
-	/* Join all the workers except one. */
-	for (int i=1; i<mWorkerCount; ++i)
+	/* Join all the workers. */
+	for (int i=0; i<mWorkerCount; ++i)
 		mpWorkers[i]->join (NULL);
 
+	/* Requests that were queued while the workers were exiting. */
+	while (Request* pRequest = mRequestQueue.pull ())
+		mrpHandler->process (pRequest);
+
 	mrLog.message ("WORKER", Log::Info, 0,
 				   "All %d worker threads joined successfully.",
 				   mWorkerCount);
 
-	mrLog.message ("WORKER", Log::Info, 0,
-				   "Handling shutdown request in main thread...");
+	if (pFinal)
+		mrpHandler->process (pFinal);
 
-	/* Send the shutdown notification. */
+	return 0;
+}
 
-	/* It would have been nicer to send it to one of the threads,  */
-	/* as we might in future have separate handler in each thread. */
-	/* This has to be reconsidered later.                          */
-	if (pRequest)
-		mrpHandler->process (pRequest);
+/*******************************************************************************
+ * Returns the number of requests waiting in the injection queue and
+ * in the deques of the workers. Only approximate while the workers
+ * are running.
+ ******************************************************************************/
+int WorkerPool::queueDepth () const
+{
+	int depth = mRequestQueue.size ();
+	for (int i=0; i<mWorkerCount; ++i)
+		depth += mpWorkers[i]->mDeque.size ();
+	return depth;
+}
 
-	return 0;
+/*******************************************************************************
+ * Returns the number of requests the workers have stolen from each
+ * other.
+ ******************************************************************************/
+long WorkerPool::stealCount () const
+{
+	long steals = 0;
+	for (int i=0; i<mWorkerCount; ++i)
+		steals += __atomic_load_n (&mpWorkers[i]->mSteals, __ATOMIC_RELAXED);
+	return steals;
+}
+
+/*******************************************************************************
+ * Returns the number of requests the workers have processed.
+ ******************************************************************************/
+long WorkerPool::processedCount () const
+{
+	long processed = 0;
+	for (int i=0; i<mWorkerCount; ++i)
+		processed += __atomic_load_n (&mpWorkers[i]->mProcessed, __ATOMIC_RELAXED);
+	return processed;
+}
+
+/*******************************************************************************
+ * Returns the fraction of time the given worker has been busy since
+ * the pool was created.
+ *
+ * A worker is busy from finding a request until it finds no more
+ * requests to process.
+ ******************************************************************************/
+double WorkerPool::utilization (int worker) const
+{
+	ASSERT (worker>=0 && worker<mWorkerCount);
+	const Worker* pWorker = mpWorkers[worker];
+	long now   = monotonicTime ();
+	long busy  = __atomic_load_n (&pWorker->mBusyTime, __ATOMIC_RELAXED);
+	long since = __atomic_load_n (&pWorker->mBusySince, __ATOMIC_RELAXED);
+	if (since)
+		busy += now - since;
+	return (now > mStartTime)? double (busy) / (now - mStartTime) : 0.0;
+}
+
+/*******************************************************************************
+ * Returns true if any request is waiting anywhere in the pool.
+ ******************************************************************************/
+bool WorkerPool::hasWork () const
+{
+	if (!mRequestQueue.isEmpty ())
+		return true;
+	for (int i=0; i<mWorkerCount; ++i)
+		if (mpWorkers[i]->mDeque.size () > 0)
+			return true;
+	return false;
+}
+
+/*******************************************************************************
+ * Parks the calling worker until there is work or the pool is shut
+ * down.
+ *
+ * The worker registers itself as a sleeper before checking for work
+ * for the last time, and the producers check for sleepers after
+ * queueing, so a wakeup can not be lost in between.
+ *
+ * @return false if the worker should exit.
+ ******************************************************************************/
+bool WorkerPool::park ()
+{
+	MutexLocker locker (mSleepLock);
+	__atomic_add_fetch (&mSleepers, 1, __ATOMIC_SEQ_CST);
+	bool work = hasWork ();
+	if (!work && !isShutdown ()) {
+		mWorkCond.wait (mSleepLock);
+		work = hasWork ();
+	}
+	__atomic_sub_fetch (&mSleepers, 1, __ATOMIC_SEQ_CST);
+
+	return work || !isShutdown ();
+}
+
+/*******************************************************************************
+ * Wakes one parked worker, if any.
+ ******************************************************************************/
+void WorkerPool::wakeWorker ()
+{
+	__atomic_thread_fence (__ATOMIC_SEQ_CST);
+	if (__atomic_load_n (&mSleepers, __ATOMIC_SEQ_CST) > 0) {
+		MutexLocker locker (mSleepLock);
+		mWorkCond.signal ();
+	}
+}
+
+/*******************************************************************************
+ * Wakes the producers waiting for space in the injection queue, if
+ * any.
+ ******************************************************************************/
+void WorkerPool::wakeProducers ()
+{
+	__atomic_thread_fence (__ATOMIC_SEQ_CST);
+	if (__atomic_load_n (&mBlockedProducers, __ATOMIC_SEQ_CST) > 0) {
+		MutexLocker locker (mSleepLock);
+		mSpaceCond.broadcast ();
+	}
 }
 
 /*******************************************************************************
@@ -141,44 +340,122 @@ MSrvResult WorkerPool::shutdown (Request* pRequest /**< Final request. May be NU
  *
  * The worker thread must be started with @ref start().
  ******************************************************************************/
-Worker::Worker (WorkerPool* pPool)
+Worker::Worker (WorkerPool* pPool, int index)
+		: mDeque (WORKER_DEQUE_SIZE)
 {
-	mpPool = pPool;
+	mpPool     = pPool;
+	mIndex     = index;
+	mRandom    = index*2654435761U + 1;
+	mProcessed = 0;
+	mSteals    = 0;
+	mBusyTime  = 0;
+	mBusySince = 0;
 }
 
 /*******************************************************************************
  * Executes a worker thread.
  *
  * The execution is continued until the WorkerPool goes to shutdown
- * state. The request queue will be processed before exiting.
+ * state. The queued requests will be processed before exiting.
  ******************************************************************************/
 void* Worker::execute ()
 {
+	currentWorker = this;
+
 	while (1) {
-		if (mpPool->isShutdown ())
+		Request* pRequest = findWork ();
+
+		/* Look for work for a while before parking, as parking and */
+		/* waking up is slow.                                       */
+		if (!pRequest) {
+			setBusy (false);
+			for (int spin=0; !pRequest && spin<WORKER_SPIN_ROUNDS; spin++) {
+				sched_yield ();
+				pRequest = findWork ();
+			}
+		}
+
+		if (pRequest) {
+			setBusy (true);
+
+			/* Invoke the request handler to handle the request. */
+			mpPool->handler ().process (pRequest);
+			__atomic_store_n (&mProcessed, mProcessed+1, __ATOMIC_RELAXED);
+		} else if (!mpPool->park ())
 			break;
+	}
 
-		/* Wait for a signal from the worker pool, indicating either */
-		/* that there is a new request to process, or the server is  */
-		/* shutting down.                                            */
-		mpPool->getWaitLock ().wait ();
+	currentWorker = NULL;
+	return NULL;
+}
 
-		/* Process requests until queue is empty.                   */
+/*******************************************************************************
+ * Takes the next request to process: the newest one in the own deque,
+ * a batch from the injection queue, or one stolen from another
+ * worker.
+ *
+ * @return The request, or NULL if no work was found.
+ ******************************************************************************/
+Request* Worker::findWork ()
+{
+	if (Request* pRequest = mDeque.pop ())
+		return pRequest;
 
-		/* Pull the topmost request from the request queue. */
-		while (Request* pRequest = mpPool->queue ().pull ()) {
-			/* NOTICE that as the shutdown flag is not checked here,    */
-			/* we WILL empty the queue before letting server shut down. */
-			/* I guess we could have an "immediate" flag to leave       */
-			/* the queue unclean.                                       */
+	Request* batch [WORKER_BATCH_SIZE];
+	int count = mpPool->mRequestQueue.pull (batch, WORKER_BATCH_SIZE);
+	if (count > 0) {
+		mpPool->wakeProducers ();
 
-			/* Invoke the request handler to handle the request. */
-			if (pRequest)
-				mpPool->handler ().process (pRequest);
-		}
+		/* Keep the rest available for stealing. The deque is empty, */
+		/* so they fit.                                              */
+		for (int i=count-1; i>0; i--)
+			mDeque.push (batch[i]);
+		if (count > 1)
+			mpPool->wakeWorker ();
+		return batch[0];
 	}
 
+	return steal ();
+}
+
+/*******************************************************************************
+ * Steals the oldest request of another worker, trying the workers in
+ * a random order.
+ *
+ * @return The request, or NULL if no work was found.
+ ******************************************************************************/
+Request* Worker::steal ()
+{
+	int count = mpPool->mWorkerCount;
+	mRandom = mRandom*1103515245U + 12345U;
+	int start = (mRandom >> 16) % count;
+	for (int i=0; i<count; i++) {
+		Worker* pVictim = mpPool->mpWorkers[(start+i) % count];
+		if (pVictim == this)
+			continue;
+		if (Request* pRequest = pVictim->mDeque.steal ()) {
+			__atomic_store_n (&mSteals, mSteals+1, __ATOMIC_RELAXED);
+			return pRequest;
+		}
+	}
 	return NULL;
 }
 
-end_namespace (MagiC);
+/*******************************************************************************
+ * Records the transitions between busy and idle for the utilization
+ * statistics.
+ ******************************************************************************/
+void Worker::setBusy (bool busy)
+{
+	if (busy == (mBusySince != 0))
+		return;
+	long now = monotonicTime ();
+	if (busy)
+		__atomic_store_n (&mBusySince, now, __ATOMIC_RELAXED);
+	else {
+		__atomic_store_n (&mBusyTime, mBusyTime + now - mBusySince, __ATOMIC_RELAXED);
+		__atomic_store_n (&mBusySince, 0L, __ATOMIC_RELAXED);
+	}
+}
+
+END_NAMESPACE;
@@ -12,17 +12,88 @@
  *                                                                             *
  ******************************************************************************/
 
+// Benchmark timer, seconds
+double benchtime ();
+
+// Allocations made by the calling thread, -1 if not counted
+long test_allocations ();
+
 // Object tests
 
+// Memory tests
+bool memory_ledgerTests ();
+bool memory_ledgerBenchmark ();
+bool memory_poolTests ();
+
 // String tests
 bool string_basicTests ();
+bool string_hashTests ();
+bool string_hashBenchmark ();
+bool string_splitTests ();
+bool string_splitBenchmark ();
+bool string_inlineTests ();
+bool string_viewTests ();
+bool string_allocBenchmark ();
+bool string_kernelTests ();
+bool string_kernelBenchmark ();
+bool string_numberTests ();
+bool string_numberBenchmark ();
+bool string_formatTests ();
+bool string_formatBenchmark ();
+
+// Array tests
+bool array_basicTests ();
+bool array_sortTests ();
+bool array_sortBenchmark ();
+bool array_listTests ();
+bool array_listBenchmark ();
+
+// Map tests
+bool map_basicTests ();
+bool map_readTests ();
+bool map_arenaTests ();
+bool map_orderedTests ();
+bool map_benchmark ();
+bool map_readBenchmark ();
+bool map_arenaBenchmark ();
+bool map_orderedBenchmark ();
+
+// Thread tests
+bool thread_basicTests ();
+bool thread_benchmark ();
+bool thread_refTests ();
+bool thread_refBenchmark ();
+bool thread_logTests ();
+bool thread_logBenchmark ();
+bool thread_logLevelTests ();
+bool thread_logLevelBenchmark ();
+
+// Worker tests
+bool worker_basicTests ();
+bool worker_benchmark ();
 
 // Stream tests
 bool stream_fileStream ();
 bool stream_stringStream ();
+bool stream_dataStream ();
+bool stream_dataBenchmark ();
 
 // IODevice tests
 bool iodevice_fileWriting ();
+bool iodevice_readLines ();
+bool iodevice_bufferedFile ();
+bool iodevice_bufferedFileBenchmark ();
+bool iodevice_mmapFile ();
+bool iodevice_mmapFileBenchmark ();
+bool iodevice_socket ();
+bool iodevice_notifier ();
+bool iodevice_socketBenchmark ();
+bool iodevice_asyncIO ();
+bool iodevice_asyncIOBenchmark ();
+bool iodevice_compressed ();
+bool iodevice_compressedBenchmark ();
 
 // Matrix tests
 bool matrix_basicTests ();
+bool matrix_kernelTests ();
+bool matrix_benchmark ();
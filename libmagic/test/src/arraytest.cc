@@ -0,0 +1,580 @@
+/***************************************************************************
+ *   This file is part of the MagiC++ library.                             *
+ *                                                                         *
+ *   Copyright (C) 1998-2002 Marko Grnroos <magi@iki.fi>                  *
+ *                                                                         *
+ ***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#include <magic/mpararr.h>
+#include <magic/mpackarray.h>
+#include <magic/malgorithm.h>
+#include <magic/mparallelsort.h>
+#include <magic/mlist.h>
+#include <magic/miodevice.h>
+
+#include "tests.h"
+
+using namespace MagiC;
+
+/*******************************************************************************
+* NAME:        array_basicTests
+*
+* DESCRIPTION: Grows, shrinks and copies Array and PackArray, checking
+*              that the capacity is managed separately from the size.
+*
+* RETURNS:     true if successful, false on failure.
+*******************************************************************************/
+bool array_basicTests ()
+{
+	const int count = 10000;
+
+	// Array: appending grows the capacity geometrically
+	Array<String> arr;
+	int reallocs = 0;
+	for (int i=0; i<count; i++) {
+		int oldCapacity = arr.capacity ();
+		arr.add (new String (i));
+		if (arr.capacity () != oldCapacity)
+			reallocs++;
+	}
+	arr.check ();
+	if (arr.size () != count || reallocs > 20 || arr[4321] != "4321")
+		return false;
+
+	// Shrinking keeps the capacity and nullifies the cut slots
+	arr.resize (10);
+	if (arr.size () != 10 || arr.capacity () < count)
+		return false;
+	arr.resize (20);
+	if (arr.getp (15) != NULL || arr[9] != "9")
+		return false;
+	arr.shrinkToFit ();
+	arr.check ();
+	if (arr.capacity () != 20)
+		return false;
+
+	arr.reserve (100);
+	if (arr.capacity () != 100 || arr.size () != 20)
+		return false;
+	arr.removeFill (0);
+	if (arr.size () != 19 || arr[0] != "1")
+		return false;
+
+	// PackArray: items are constructed and copied by value
+	PackArray<String> pack;
+	for (int i=0; i<count; i++)
+		pack.add (String (i));
+	pack.check ();
+	if (pack.size () != count || pack[count-1] != String (count-1))
+		return false;
+
+	// Adding an item of the array itself while the block moves
+	while (pack.size () < pack.capacity ())
+		pack.add ("filler");
+	pack.add (pack[0]);
+	if (pack[pack.size ()-1] != "0")
+		return false;
+
+	PackArray<String> copy = pack;
+	pack.resize (5);
+	pack.shrinkToFit ();
+	pack.check ();
+	if (pack.capacity () != 5 || copy.size () <= count || copy[7] != "7")
+		return false;
+
+	pack.resize (8);
+	if (!pack[7].isNull () || pack[4] != "4")
+		return false;
+
+	pack.make (0);
+	pack.check ();
+	return pack.size () == 0 && pack.capacity () == 0;
+}
+
+// Item of the stability test: sorted by the key, the order tells the
+// original place.
+struct SortPair {
+	int	key, order;
+};
+
+struct SortPairCompare {
+	static int compare (const SortPair& a, const SortPair& b) {return KeyCompare<int>::compare (a.key, b.key);}
+};
+
+template <class TYPE>
+static bool isSorted (const PackArray<TYPE>& arr)
+{
+	for (int i=1; i<arr.size (); i++)
+		if (KeyCompare<TYPE>::compare (arr[i-1], arr[i]) > 0)
+			return false;
+	return true;
+}
+
+/*******************************************************************************
+* NAME:        array_sortTests
+*
+* DESCRIPTION: Sorts arrays of different orders with the algorithms of
+*              malgorithm.h and through the arrays, and searches them.
+*
+* RETURNS:     true if successful, false on failure.
+*******************************************************************************/
+bool array_sortTests ()
+{
+	const int count = 300000;
+
+	// Random, sorted, reversed and equal items, and few distinct ones
+	for (int pattern=0; pattern<5; pattern++) {
+		PackArray<int> orig;
+		for (int i=0; i<count; i++) {
+			int value = int ((i * 2654435761U) % count);
+			switch (pattern) {
+			  case 1: value = i; break;
+			  case 2: value = count-i; break;
+			  case 3: value = 7; break;
+			  case 4: value %= 3; break;
+			}
+			orig.add (value);
+		}
+
+		PackArray<int> intro = orig, merge = orig, par = orig, heap = orig;
+		intro.sort ();
+		merge.stableSort ();
+		parallelSort (par, 3);
+		heapSort (&heap[0], heap.size (), KeyCompare<int> ());
+		if (!isSorted (intro) || !isSorted (heap))
+			return false;
+		for (int i=0; i<count; i++)
+			if (merge[i] != intro[i] || par[i] != intro[i] || heap[i] != intro[i])
+				return false;
+
+		// Selection matches the sorted order
+		for (int nth=0; nth<count; nth+=count/7) {
+			PackArray<int> sel = orig;
+			selectNth (&sel[0], count, nth);
+			if (sel[nth] != intro[nth])
+				return false;
+			for (int i=0; i<count; i+=97)
+				if ((i < nth && sel[i] > sel[nth]) || (i > nth && sel[i] < sel[nth]))
+					return false;
+		}
+	}
+
+	// Parallel merging with an even number of runs, split in parts
+	PackArray<double> reals;
+	for (int i=0; i<count; i++)
+		reals.add (double (int ((i * 2654435761U) % 1000)) - 500.5);
+	PackArray<double> reals2 = reals;
+	parallelSort (reals, 4);
+	reals2.sort ();
+	for (int i=0; i<count; i++)
+		if (reals[i] != reals2[i])
+			return false;
+
+	// Searching the duplicates
+	PackArray<int> dups;
+	for (int i=0; i<100; i++)
+		dups.add (i/3*3);
+	const int* ints = &dups[0];
+	int key = 17;
+	if (lowerBound (ints, 100, key) != 18 || upperBound (ints, 100, key) != 18
+		|| dups.binarySearch (18) != 18 || dups.binarySearch (17) != -1
+		|| dups.lowerBound (99) != 99 || upperBound (ints, 100, 99) != 100
+		|| dups.lowerBound (1000) != 100 || dups.lowerBound (-1) != 0)
+		return false;
+
+	// Merge sort keeps equal items in order
+	PackArray<SortPair> pairs;
+	for (int i=0; i<count; i++) {
+		SortPair pair = {int ((i * 2654435761U) % 100), i};
+		pairs.add (pair);
+	}
+	pairs.stableSort (SortPairCompare ());
+	for (int i=1; i<count; i++)
+		if (pairs[i-1].key > pairs[i].key
+			|| (pairs[i-1].key == pairs[i].key && pairs[i-1].order >= pairs[i].order))
+			return false;
+
+	// Strings and the hints of numbers keep the order
+	PackArray<String> strs;
+	for (int i=0; i<10000; i++)
+		strs.add (String (i * 7919 % 10000));
+	strs.sort ();
+	if (!isSorted (strs) || strs[0] != "0" || strs[1] != "1" || strs[2] != "10"
+		|| strs.binarySearch ("5000") < 0 || strs.binarySearch ("x") != -1)
+		return false;
+	if (!(KeyCompare<double>::hint (-2.5) < KeyCompare<double>::hint (-1.0))
+		|| !(KeyCompare<double>::hint (-1.0) < KeyCompare<double>::hint (0.0))
+		|| !(KeyCompare<double>::hint (0.5) < KeyCompare<double>::hint (1e10))
+		|| !(KeyCompare<int>::hint (-1) < KeyCompare<int>::hint (0)))
+		return false;
+
+	// Array sorts by the pointed items and puts NULLs last
+	Array<String> arr;
+	for (int i=0; i<1000; i++)
+		arr.add (new String (i * 7919 % 1000));
+	arr.resize (1010);
+	arr.quicksort ();
+	arr.check ();
+	for (int i=1; i<1000; i++)
+		if (arr[i-1].compare (arr[i]) > 0)
+			return false;
+	if (arr.getp (999) == NULL || arr.getp (1000) != NULL || arr.getp (1009) != NULL)
+		return false;
+	return arr.binarySearch ("500") >= 0 && arr[arr.binarySearch ("500")] == "500"
+		&& arr.binarySearch ("-1") == -1;
+}
+
+static int compareDouble (const void* a, const void* b)
+{
+	double x = *(const double*) a, y = *(const double*) b;
+	return (x<y)? -1 : (x>y);
+}
+
+/** Fills the array with the same pseudo-random doubles every time. */
+static void fillDoubles (PackArray<double>& arr)
+{
+	unsigned long long state = 12345;
+	for (int i=0; i<arr.size (); i++) {
+		state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+		arr[i] = double (state >> 11) / double (1ULL << 53) - 0.5;
+	}
+}
+
+/*******************************************************************************
+* NAME:        array_sortBenchmark
+*
+* DESCRIPTION: Sorts 10M Strings and 100M doubles with qsort() and with
+*              the algorithms of malgorithm.h.
+*
+* RETURNS:     true if successful, false on failure.
+*******************************************************************************/
+bool array_sortBenchmark ()
+{
+	// Strings: through pointers, as Array sorts them, and by value
+	const int strCount = 10000000;
+	PackArray<String> source;
+	source.reserve (strCount);
+	for (int i=0; i<strCount; i++)
+		source.add (String ("key%1").arg (int ((i * 2654435761U) % strCount)));
+
+	const String** ptrs = new const String* [strCount];
+	for (int i=0; i<strCount; i++)
+		ptrs[i] = &source[i];
+	double start = benchtime ();
+	qsort (ptrs, strCount, sizeof (const String*), compareComparable);
+	double strQsort = benchtime () - start;
+
+	for (int i=0; i<strCount; i++)
+		ptrs[i] = &source[i];
+	start = benchtime ();
+	introSort (ptrs, strCount, PointerCompare<String> ());
+	double strPointers = benchtime () - start;
+	delete [] ptrs;
+
+	PackArray<String> strs = source;
+	start = benchtime ();
+	strs.sort ();
+	double strIntro = benchtime () - start;
+	bool ok = isSorted (strs);
+
+	strs = source;
+	start = benchtime ();
+	strs.stableSort ();
+	double strMerge = benchtime () - start;
+
+	strs = source;
+	start = benchtime ();
+	parallelSort (strs);
+	double strParallel = benchtime () - start;
+	ok = ok && isSorted (strs);
+	strs.empty ();
+	source.empty ();
+
+	// Doubles
+	const int realCount = 100000000;
+	PackArray<double> reals (realCount);
+	fillDoubles (reals);
+	start = benchtime ();
+	qsort (&reals[0], realCount, sizeof (double), compareDouble);
+	double realQsort = benchtime () - start;
+
+	fillDoubles (reals);
+	start = benchtime ();
+	reals.sort ();
+	double realIntro = benchtime () - start;
+	ok = ok && isSorted (reals);
+
+	fillDoubles (reals);
+	start = benchtime ();
+	reals.stableSort ();
+	double realMerge = benchtime () - start;
+
+	fillDoubles (reals);
+	start = benchtime ();
+	parallelSort (reals);
+	double realParallel = benchtime () - start;
+	ok = ok && isSorted (reals);
+
+	fillDoubles (reals);
+	start = benchtime ();
+	selectNth (&reals[0], realCount, realCount/2);
+	double realSelect = benchtime () - start;
+
+	printf ("  seconds            %dM Strings  %dM doubles\n", strCount/1000000, realCount/1000000);
+	printf ("  qsort              %9.3f  %9.3f\n", strQsort, realQsort);
+	printf ("  introSort pointers %9.3f\n", strPointers);
+	printf ("  introSort          %9.3f  %9.3f\n", strIntro, realIntro);
+	printf ("  mergeSort          %9.3f  %9.3f\n", strMerge, realMerge);
+	printf ("  parallelSort       %9.3f  %9.3f  (%ld processors)\n", strParallel, realParallel,
+			sysconf (_SC_NPROCESSORS_ONLN));
+	printf ("  selectNth                   %9.3f\n", realSelect);
+	return ok;
+}
+
+/** Checks that the list holds the items in the array, both forwards
+ *  and backwards.
+ **/
+static bool listEquals (const List<int>& list, const PackArray<int>& items)
+{
+	if (list.size () != items.size ())
+		return false;
+	int i = 0;
+	for (ListIter<int> iter (list); !iter.exhausted (); iter.next (), i++)
+		if (i >= items.size () || iter.get () != items[i])
+			return false;
+	if (i != items.size ())
+		return false;
+	for (ListIter<int> iter (list, true); !iter.exhausted (); iter.previous ())
+		if (iter.get () != items[--i])
+			return false;
+	return i == 0;
+}
+
+/*******************************************************************************
+* NAME:        array_listTests
+*
+* DESCRIPTION: Adds, deletes, copies and moves items of List, across
+*              its node boundaries.
+*
+* RETURNS:     true if successful, false on failure.
+*******************************************************************************/
+bool array_listTests ()
+{
+	const int count = 1000;
+	List<int> list;
+	PackArray<int> items;
+	for (int i=0; i<count; i++) {
+		list.add (i);
+		items.add (i);
+	}
+	if (!listEquals (list, items))
+		return false;
+
+	// Adding to the beginning
+	PackArray<int> expected;
+	for (int i=0; i<count; i++) {
+		list.prepend (-1-i);
+		expected.add (-count+i);
+	}
+	for (int i=0; i<count; i++)
+		expected.add (i);
+	if (!listEquals (list, expected))
+		return false;
+
+	// Deleting every third item, from both sides of the nodes
+	items.empty ();
+	int n = 0;
+	for (ListIter<int> iter (list); !iter.exhausted (); n++)
+		if (n % 3 == 0)
+			iter.deleteCurrent ();
+		else {
+			items.add (iter.get ());
+			iter.next ();
+		}
+	if (!listEquals (list, items))
+		return false;
+
+	// Stepping over the ends starts over
+	ListIter<int> iter (list);
+	iter.previous ();
+	if (!iter.exhausted ())
+		return false;
+	iter.previous ();
+	if (iter.exhausted () || iter.get () != items[items.size ()-1])
+		return false;
+	iter.next ();
+	iter.next ();
+	if (iter.exhausted () || iter.get () != items[0])
+		return false;
+
+	// Copying, bulk appending and splicing to the end
+	PackArray<int> spliced = items;
+	List<int> copy = list;
+	copy.append (&expected[0], expected.size ());
+	for (int i=0; i<expected.size (); i++)
+		items.add (expected[i]);
+	if (!listEquals (copy, items) || !listEquals (list, spliced))
+		return false;
+	list.moveItemsFrom (copy);
+	for (int i=0; i<items.size (); i++)
+		spliced.add (items[i]);
+	if (!listEquals (list, spliced) || copy.size () != 0 || copy.getFirst () != NULL)
+		return false;
+	copy.add (7);
+	spliced.add (7);
+	list.moveItemsFrom (copy);
+	if (!listEquals (list, spliced))
+		return false;
+
+	// Deleting all items from the end leaves no nodes
+	for (ListIter<int> del (list, true); !del.exhausted (); del.last ()) {
+		del.deleteCurrent ();
+		if (!del.exhausted ())
+			return false;
+	}
+	if (list.size () != 0 || list.getFirst () != NULL || list.getLast () != NULL)
+		return false;
+
+	// Items with destructors
+	List<String> strs;
+	for (int i=0; i<count; i++)
+		strs.add (String (i));
+	strs.addNew () = "last";
+	List<String> strs2;
+	strs2 = strs;
+	int i = 0;
+	for (ListIter<String> siter (strs2); !siter.exhausted (); i++)
+		if (i % 2)
+			siter.deleteCurrent ();
+		else
+			siter.next ();
+	ListIter<String> last (strs2, true);
+	return strs2.size () == count/2 + 1 && last.get () == "last" && strs.size () == count+1;
+}
+
+// List as it was before the nodes of many items: a node per item,
+// linked with the XOR of the previous and next address.
+template <class T>
+struct XorNode {
+	T			mData;
+	XorNode*	mPrevNext;
+};
+
+template <class T>
+class XorList {
+  public:
+	XorNode<T>	*mFirst, *mLast;
+
+			XorList		() {mFirst=mLast=NULL;}
+			~XorList	() {
+				for (XorNode<T>* i=mFirst, *prev=NULL; i;) {
+					XorNode<T>* cur = i;
+					i = (XorNode<T>*) (WORD (prev) ^ WORD (i->mPrevNext));
+					prev = cur;
+					delete cur;
+				}
+			}
+	void	add			(const T& object) {
+		XorNode<T>* node = new XorNode<T>;
+		node->mData = object;
+		node->mPrevNext = mLast;
+		if (mLast)
+			mLast->mPrevNext = (XorNode<T>*) (WORD (mLast->mPrevNext) ^ WORD (node));
+		else
+			mFirst = node;
+		mLast = node;
+	}
+};
+
+/*******************************************************************************
+* NAME:        array_listBenchmark
+*
+* DESCRIPTION: Appends and iterates 10M items with List, with a list of
+*              a node per item and with PackArray, and reads a file
+*              to lines with IODevice::readLines.
+*
+* RETURNS:     true if the sums agree.
+*******************************************************************************/
+bool array_listBenchmark ()
+{
+	const int count = 10000000;
+
+	double start = benchtime ();
+	XorList<long> xorList;
+	for (int i=0; i<count; i++)
+		xorList.add (i);
+	double xorAppend = benchtime () - start;
+
+	start = benchtime ();
+	List<long> list;
+	for (int i=0; i<count; i++)
+		list.add (i);
+	double listAppend = benchtime () - start;
+
+	start = benchtime ();
+	PackArray<long> pack;
+	for (int i=0; i<count; i++)
+		pack.add (i);
+	double packAppend = benchtime () - start;
+
+	start = benchtime ();
+	List<long> bulk;
+	for (int i=0; i<count; i+=1000)
+		bulk.append (&pack[i], 1000);
+	double listBulk = benchtime () - start;
+
+	long xorSum = 0, listSum = 0, packSum = 0;
+	start = benchtime ();
+	for (XorNode<long>* i=xorList.mFirst, *prev=NULL; i;) {
+		xorSum += i->mData;
+		XorNode<long>* cur = i;
+		i = (XorNode<long>*) (WORD (prev) ^ WORD (i->mPrevNext));
+		prev = cur;
+	}
+	double xorIter = benchtime () - start;
+
+	start = benchtime ();
+	for (ListIter<long> iter (list); !iter.exhausted (); iter.next ())
+		listSum += iter.get ();
+	double listIter = benchtime () - start;
+
+	start = benchtime ();
+	for (int i=0; i<count; i++)
+		packSum += pack[i];
+	double packIter = benchtime () - start;
+
+	// Lines of a file
+	const char* filename = "/tmp/readlines-bench.txt";
+	{
+		File out (filename, IO_Writable);
+		String line;
+		for (int i=0; i<2000000; i++) {
+			line = String ("line %1 of the file to read in lines\n").arg (i);
+			out.IODevice::writeBlock (line);
+		}
+		out.close ();
+	}
+	long bytes = File (filename).size ();
+	start = benchtime ();
+	File in (filename, IO_Readable);
+	List<String>* lines = in.readLines ();
+	in.close ();
+	double readLines = benchtime () - start;
+	bool ok = lines->size () == 2000000;
+	delete lines;
+	File (filename).remove ();
+
+	printf ("  %dM longs, seconds  node per item     List  PackArray\n", count/1000000);
+	printf ("  append                %9.3f %9.3f  %9.3f\n", xorAppend, listAppend, packAppend);
+	printf ("  append 1000 at a time           %9.3f\n", listBulk);
+	printf ("  iterate               %9.3f %9.3f  %9.3f\n", xorIter, listIter, packIter);
+	printf ("  readLines %.0f MB/s\n", bytes / readLines / 1e6);
+	return ok && xorSum == listSum && listSum == packSum && bulk.size () == count;
+}
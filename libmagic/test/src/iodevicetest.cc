@@ -1,5 +1,21 @@
 #include <magic/mstring.h>
 #include <magic/mtextstream.h>
+#include <magic/mbufferedfile.h>
+#include <magic/mmapfile.h>
+#include <magic/mpackarray.h>
+#include <magic/mmap.h>
+#include <magic/msocket.h>
+#include <magic/mnotifier.h>
+#include <magic/masyncio.h>
+#include <magic/mcompress.h>
+#include <magic/mdatastream.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "tests.h"
+
 using namespace MagiC;
 
 bool iodevice_fileWriting ()
@@ -69,3 +85,1330 @@ bool iodevice_bufferOperations ()
 	return true;
 }
 
+/** Returns a string of the given character repeated. */
+static String iodevice_repeat (char ch, int count)
+{
+	String result;
+	for (int i=0; i<count; i++)
+		result += ch;
+	return result;
+}
+
+/*******************************************************************************
+* NAME:        iodevice_readLines
+*
+* DESCRIPTION: Reads a file with empty, long and unterminated lines with
+*              readLines() through File and BufferedFile.
+*
+* RETURNS:     true if successful, false on failure.
+*******************************************************************************/
+bool iodevice_readLines ()
+{
+	const char* filename = "/tmp/readlines-test.txt";
+	PackArray<String> expected;
+	expected.add ("first\n");
+	expected.add ("\n");
+	expected.add (iodevice_repeat ('x', 40000) + "\n");
+	for (int i=0; i<5000; i++)
+		expected.add (String ("line %1\n").arg (i));
+	expected.add ("no newline");
+
+	File out (filename, IO_Writable);
+	for (int i=0; i<expected.size (); i++)
+		out.IODevice::writeBlock (expected[i]);
+	out.close ();
+
+	for (int pass=0; pass<2; pass++) {
+		File file (filename, IO_Readable);
+		BufferedFile buffered (filename, IO_Readable);
+		IODevice& device = pass? (IODevice&) buffered : (IODevice&) file;
+		List<String>* lines = device.readLines ();
+		int i = 0;
+		for (ListIter<String> iter (*lines); !iter.exhausted (); iter.next (), i++)
+			if (i >= expected.size () || iter.get () != expected[i])
+				break;
+		bool ok = i == expected.size () && lines->size () == i;
+		delete lines;
+		file.close ();
+		if (!ok)
+			return false;
+	}
+
+	// An empty file has no lines
+	File empty (filename, IO_Writable);
+	empty.close ();
+	File in (filename, IO_Readable);
+	List<String>* lines = in.readLines ();
+	bool ok = lines->size () == 0;
+	delete lines;
+	in.close ();
+	in.remove ();
+	return ok;
+}
+
+/*******************************************************************************
+* NAME:        iodevice_bufferedFile
+*
+* DESCRIPTION: Writes and reads back a file through a BufferedFile
+*              with a small buffer, so that lines, characters and
+*              blocks cross the buffer boundaries, and compares the
+*              results with File.
+*
+* RETURNS:     true if successful, false on failure.
+*******************************************************************************/
+bool iodevice_bufferedFile ()
+{
+	const char* filename = "/tmp/bufferedfile.txt";
+	const int lines = 3000;
+
+	// Write with a buffer of one page, mixing characters and blocks
+	{
+		BufferedFile out (filename, IO_Writable, 1);
+		for (int i=0; i<lines; i++) {
+			String line = String("line %1 ").arg(i) + iodevice_repeat ('x', i % 50) + "\n";
+			if (i % 2)
+				out.IODevice::writeBlock (line);
+			else
+				for (uint j=0; j<line.length(); j++)
+					out.putch (line[j]);
+		}
+
+		// A block larger than the buffer goes directly to the file
+		String big = iodevice_repeat ('y', 10000) + "\n";
+		out.IODevice::writeBlock (big);
+	}
+
+	// Lines must match those read with File, which mangles lines
+	// longer than 4k, so the last line is checked separately
+	File reference (filename, IO_Readable);
+	BufferedFile in (filename, IO_Readable, 1);
+	String expected, line;
+	for (int i=0; i<lines; i++) {
+		reference.readLine (expected);
+		if (in.readLine (line) != int (expected.length()) || line != expected)
+			return false;
+	}
+	reference.close ();
+	if (in.readLine (line) != 10001 || line != iodevice_repeat ('y', 10000) + "\n")
+		return false;
+	if (!in.atEnd() || in.readLine (line) != 0 || in.status() != IO_Ok)
+		return false;
+
+	// Characters, ungetting over the buffer boundaries
+	in.seekTo (0);
+	int words = 0, bytes = 0;
+	bool inWord = false;
+	for (int ch; (ch = in.getch ()) != -1; bytes++) {
+		if (bytes % 4093 == 0) {
+			in.ungetch (ch);
+			if (in.getch () != ch)
+				return false;
+		}
+		if (isspace (ch))
+			inWord = false;
+		else if (!inWord) {
+			inWord = true;
+			words++;
+		}
+	}
+	if (words != lines*3 - lines/50 + 1 || uint (bytes) != in.size())
+		return false;
+
+	// Large blocks, and positioned reads that do not move the position
+	char* block = new char [bytes];
+	char head [10];
+	in.seek (5);
+	if (in.readAt (0, head, 10) != 10 || strncmp (head, "line 0 \nli", 10)
+		|| in.readBlock (block, bytes) != bytes-5 || block[0] != '0'
+		|| block[bytes-7] != 'y' || !in.atEnd())
+		return false;
+	delete [] block;
+
+	// Appending, after reading a read-write file partially
+	in.close ();
+	BufferedFile rw (filename, IO_ReadWrite);
+	rw.readLine (line);
+	rw.IODevice::writeBlock ("LINE");
+	rw.seek (0);
+	if (rw.readLine (line) != 8 || rw.readLine (line) != 9 || line != "LINE 1 x\n")
+		return false;
+	rw.close ();
+
+	return File (filename).remove () == false;
+}
+
+/** Writes a text file of roughly the given size, with lines of
+ *  words of varying length.
+ **/
+static void iodevice_writeText (const char* filename, long bytes)
+{
+	BufferedFile out (filename, IO_Writable);
+	String line;
+	for (long written = 0, i = 0; written < bytes; i++) {
+		line = "";
+		for (int w = 0; w < 3 + int (i % 17); w++) {
+			line += iodevice_repeat ('a' + (i+w) % 26, 1 + (i*7 + w) % 11);
+			line += ' ';
+		}
+		line += '\n';
+		out.IODevice::writeBlock (line);
+		written += line.length ();
+	}
+}
+
+/** Counts lines with readLine(String&) and words with getch(), and
+ *  prints the throughput.
+ **/
+template <class DEVICE>
+static void iodevice_count (const char* name, const char* filename, long bytes,
+							long& rLines, long& rWords)
+{
+	double start = benchtime ();
+	rLines = 0;
+	{
+		DEVICE in (filename, IO_Readable);
+		String line;
+		while (in.readLine (line) > 0)
+			rLines++;
+	}
+	double lined = benchtime ();
+
+	rWords = 0;
+	{
+		DEVICE in (filename, IO_Readable);
+		bool inWord = false;
+		for (int ch; (ch = in.getch ()) != -1;)
+			if (ch == ' ' || ch == '\n')
+				inWord = false;
+			else if (!inWord) {
+				inWord = true;
+				rWords++;
+			}
+	}
+	double worded = benchtime ();
+
+	printf ("  %-12s line count %7.1f MB/s, word count %7.1f MB/s\n", name,
+			bytes / (lined - start) / 1e6, bytes / (worded - lined) / 1e6);
+}
+
+/*******************************************************************************
+* NAME:        iodevice_bufferedFileBenchmark
+*
+* DESCRIPTION: Counts lines and words in a 2 GB file with File and
+*              with BufferedFile.
+*
+* RETURNS:     true if the counts agree.
+*******************************************************************************/
+bool iodevice_bufferedFileBenchmark ()
+{
+	const char* filename = "/tmp/bufferedfile-bench.txt";
+	iodevice_writeText (filename, 2048L*1024*1024);
+	long bytes = BufferedFile (filename).size ();
+
+	long fileLines, fileWords, bufLines, bufWords;
+	iodevice_count<File> ("File", filename, bytes, fileLines, fileWords);
+	iodevice_count<BufferedFile> ("BufferedFile", filename, bytes, bufLines, bufWords);
+
+	File (filename).remove ();
+	return fileLines == bufLines && fileWords == bufWords;
+}
+
+/*******************************************************************************
+* NAME:        iodevice_mmapFile
+*
+* DESCRIPTION: Reads a file through MMapFile as views, as characters
+*              and through a TextIStream, and reads a StringMap from
+*              a mapped file.
+*
+* RETURNS:     true if successful, false on failure.
+*******************************************************************************/
+bool iodevice_mmapFile ()
+{
+	const char* filename = "/tmp/mmapfile.txt";
+	{
+		BufferedFile out (filename, IO_Writable);
+		out.IODevice::writeBlock ("# Comment\n[main]\nname = mapped\n\nsize=3,4,5\nlast=no newline");
+	}
+
+	// Lines and fields as views
+	MMapFile in (filename, IO_Readable);
+	SubString line, last;
+	PackArray<SubString> fields;
+	int lines = 0;
+	while (in.readLine (line)) {
+		if (lines == 4) {
+			line.mid (5).stripWhiteSpace().split (fields, ',');
+			if (fields.size() != 3 || fields[0] != "3" || fields[2] != "5")
+				return false;
+		}
+		last = line;
+		lines++;
+	}
+	if (lines != 6 || last != "last=no newline" || !in.atEnd() || in.getch () != -1)
+		return false;
+
+	// Characters and blocks
+	char block [8];
+	in.seek (10);
+	if (in.getch () != '[' || (in.ungetch ('['), in.readBlock (block, 6)) != 6
+		|| strncmp (block, "[main]", 6) || in.at () != 16
+		|| in.view (17, 4) != "name" || in.view (50, 10).length() != 8)
+		return false;
+	if (in.writeBlock ("x", 1) != 0 || in.status () != IO_WriteError)
+		return false;
+	in.close ();
+
+	// Views of binary data compare equal only to the whole C string
+	if (SubString ("ab\0cd", 5) == "ab" || SubString ("ab\0", 3) == "ab"
+		|| SubString ("abc", 3) == "ab" || SubString ("ab", 2) == "abc"
+		|| !(SubString ("ab\0cd", 2) == "ab") || !(SubString () == ""))
+		return false;
+
+	// Through a stream
+	TextIStream stream (new MMapFile (filename));
+	String buffer;
+	for (lines = 0; stream.readLine (buffer); lines++);
+	if (lines != 6)
+		return false;
+
+	StringMap map = readStringMap (filename);
+	if (map.gethash()->size() != 3 || map["main.name"] != "mapped" || map["main.last"] != "no newline")
+		return false;
+
+	// Empty and missing files
+	{
+		BufferedFile out (filename, IO_Writable);
+	}
+	MMapFile empty (filename, IO_Readable);
+	buffer = "old";
+	if (empty.size () != 0 || !empty.atEnd () || empty.readLine (line) != 0 || line.length () != 0
+		|| empty.readLine (buffer) != 0 || buffer.length () != 0
+		|| empty.readLine (block, sizeof (block)) != 0 || block[0] != '\0'
+		|| empty.readBlock (block, sizeof (block)) != 0)
+		return false;
+	File (filename).remove ();
+	try {
+		MMapFile missing (filename, IO_Readable);
+		return false;
+	} catch (open_failure& e) {
+	}
+	return true;
+}
+
+/*******************************************************************************
+* NAME:        iodevice_mmapFileBenchmark
+*
+* DESCRIPTION: Loads a 500 MB StringMap file read through File and
+*              through MMapFile, and iterates its lines with both.
+*
+* RETURNS:     true if the results agree.
+*******************************************************************************/
+bool iodevice_mmapFileBenchmark ()
+{
+	const char* filename = "/tmp/mmapfile-bench.txt";
+	const long bytes = 500L*1024*1024;
+	{
+		// Keys repeat, so that the map stays small
+		BufferedFile out (filename, IO_Writable);
+		String line;
+		for (long written = 0, i = 0; written < bytes; i++) {
+			if (i % 1000 == 0)
+				line = String ("[section%1]\n").arg (int (i/1000 % 50));
+			else
+				line = String ("key%1 = value number %2 of the map\n").arg (int (i % 100000)).arg (int (i));
+			out.IODevice::writeBlock (line);
+			written += line.length ();
+		}
+	}
+
+	// Lines copied to a String, and viewed in place
+	double start = benchtime ();
+	long fileLines = 0, mapLines = 0;
+	{
+		File in (filename, IO_Readable);
+		String line;
+		while (in.readLine (line) > 0)
+			fileLines++;
+	}
+	double fileRead = benchtime ();
+	{
+		MMapFile in (filename, IO_Readable);
+		SubString line;
+		while (in.readLine (line))
+			mapLines++;
+	}
+	double mapRead = benchtime ();
+	printf ("  lines      File %7.3f s  MMapFile %7.3f s\n", fileRead-start, mapRead-fileRead);
+
+	// Loading the map
+	start = benchtime ();
+	TextIStream in (new File (filename));
+	StringMap fileMap = readStringMap (in);
+	double fileLoad = benchtime ();
+	StringMap mapMap = readStringMap (filename);
+	double mapLoad = benchtime ();
+	printf ("  StringMap  File %7.3f s  MMapFile %7.3f s\n", fileLoad-start, mapLoad-fileLoad);
+
+	File (filename).remove ();
+	return fileLines == mapLines && fileMap.gethash()->size() == mapMap.gethash()->size()
+		&& fileMap.hasKey ("section7.key7001") && fileMap["section7.key7001"] == mapMap["section7.key7001"];
+}
+
+/** Echoes what the clients send, either in the thread of the
+ *  notifier or in the workers of a pool.
+ **/
+class EchoServer : public Thread, public DeviceHandler, public RequestHandler {
+  public:
+	EchoServer (int workers=0) : mpPool (NULL), mpPoolHandler (NULL), mAccepted (0) {
+		if (workers) {
+			mpPool = new WorkerPool (*this, mLog, workers);
+			mpPoolHandler = new PoolDeviceHandler (*mpPool);
+		}
+	}
+
+	~EchoServer () {
+		if (mpPool)
+			mpPool->shutdown ();
+		delete mpPoolHandler;
+		delete mpPool;
+	}
+
+	/** Listens at a free port, and starts the notifier thread. */
+	bool startTCP () {
+		if (!mServer.listen (0) || !mNotifier.addDevice (&mServer, this))
+			return false;
+		return start () == 0;
+	}
+
+	/** Waits until the clients have closed, and stops the thread. */
+	bool finish () {
+		for (int i=0; i<5000 && mNotifier.deviceCount () > 1; i++)
+			usleep (1000);
+		mNotifier.stop ();
+		join ();
+		return mNotifier.deviceCount () == 1;
+	}
+
+	virtual void* execute () {
+		mNotifier.run ();
+		return NULL;
+	}
+
+	virtual void deviceEvent (DeviceNotifier& notifier, IODevice* device, int events) {
+		if (device == &mServer) {
+			while (Socket* socket = mServer.accept ()) {
+				socket->setNoDelay (true);
+				mAccepted++;
+				if (mpPoolHandler)
+					notifier.addDevice (socket, mpPoolHandler, IO_ReadReady | NOTIFY_ONESHOT);
+				else
+					notifier.addDevice (socket, this, IO_ReadReady);
+			}
+		} else if (!echo (static_cast<Socket*> (device))) {
+			notifier.removeDevice (device);
+			delete device;
+		}
+	}
+
+	virtual void process (Request* pRequest) {
+		DeviceRequest* request = static_cast<DeviceRequest*> (pRequest);
+		if (echo (static_cast<Socket*> (request->device ())))
+			request->notifier().modifyDevice (request->device (), IO_ReadReady | NOTIFY_ONESHOT);
+		else {
+			request->notifier().removeDevice (request->device ());
+			delete request->device ();
+		}
+		delete request;
+	}
+
+	/** Writes back what has arrived. Returns false at the end. */
+	bool echo (Socket* socket) {
+		char buffer [4096];
+		int bytes;
+		while ((bytes = socket->readBlock (buffer, sizeof (buffer))) > 0)
+			socket->writeBlock (buffer, bytes);
+		return bytes == 0 && !socket->atEnd ();
+	}
+
+	ServerSocket		mServer;
+	DeviceNotifier		mNotifier;
+	DummyLog			mLog;
+	WorkerPool*			mpPool;
+	PoolDeviceHandler*	mpPoolHandler;
+	int					mAccepted;
+};
+
+/** Reads from a blocking socket until the given length has arrived. */
+static String iodevice_receive (Socket& socket, int length)
+{
+	String result;
+	char buffer [256];
+	while (int (result.length ()) < length && socket.wait (IO_ReadReady, 5.0) > 0) {
+		int bytes = socket.readBlock (buffer, sizeof (buffer));
+		if (bytes <= 0)
+			break;
+		result.append (buffer, bytes);
+	}
+	return result;
+}
+
+/*******************************************************************************
+* NAME:        iodevice_socket
+*
+* DESCRIPTION: Connects blocking and non-blocking TCP and Unix-domain
+*              sockets, and checks the reading of partial data, the
+*              end of the stream, and the errors.
+*
+* RETURNS:     true if successful, false on failure.
+*******************************************************************************/
+bool iodevice_socket ()
+{
+	// Blocking client, non-blocking server end
+	ServerSocket server;
+	if (!server.listen (0) || server.port () == 0 || server.address () != 0x7f000001)
+		return false;
+	if (server.accept () != NULL || server.status () != IO_Ok)
+		return false;
+
+	ClientSocket client;
+	client.setBlocking (true);
+	if (!client.connect ("localhost", server.port ()) || client.isConnecting ())
+		return false;
+	if (server.wait (IO_ReadReady, 5.0) != IO_ReadReady)
+		return false;
+	Socket* peer = server.accept ();
+	if (!peer || peer->peerPort () != client.port () || client.peerPort () != server.port ()
+		|| peer->peerName () != "127.0.0.1" || peer->isBlocking () || peer->isUnix ())
+		return false;
+
+	char buffer [16];
+	if (peer->readBlock (buffer, sizeof (buffer)) != 0 || peer->atEnd ())
+		return false;
+	if (client.writeBlock ("hello, world") != 12 || iodevice_receive (*peer, 12) != "hello, world")
+		return false;
+	peer->writeBlock ("xyz");
+	if (client.getch () != 'x' || (client.ungetch ('x'), client.wait (IO_ReadReady, 0)) != IO_ReadReady
+		|| client.readBlock (buffer, 3) != 3 || strncmp (buffer, "xyz", 3))
+		return false;
+
+	// The end of the stream
+	client.close ();
+	if (peer->wait (IO_ReadReady, 5.0) <= 0 || peer->readBlock (buffer, sizeof (buffer)) != 0 || !peer->atEnd ())
+		return false;
+	delete peer;
+	try {
+		client.readBlock (buffer, 1);
+		return false;
+	} catch (device_not_open& e) {
+	}
+
+	// Non-blocking connect
+	ClientSocket nonblocking;
+	if (!nonblocking.connect ("127.0.0.1", server.port ()))
+		return false;
+	if (!(nonblocking.wait (IO_WriteReady, 5.0) & IO_WriteReady) || !nonblocking.finishConnect ())
+		return false;
+	server.wait (IO_ReadReady, 5.0);
+	peer = server.accept ();
+	if (!peer)
+		return false;
+	delete peer;
+
+	// Connection refused, to the port of the closed server
+	uint closedPort = server.port ();
+	server.close ();
+	ClientSocket refused;
+	refused.setBlocking (true);
+	if (refused.connect ("127.0.0.1", closedPort) || refused.status () != IO_ConnectError)
+		return false;
+
+	// Unix-domain sockets
+	const char* path = "/tmp/magic-socket-test";
+	ServerSocket local;
+	ClientSocket localClient;
+	localClient.setBlocking (true);
+	if (!local.listenLocal (path) || !localClient.connectLocal (path) || !localClient.isUnix ())
+		return false;
+	local.wait (IO_ReadReady, 5.0);
+	peer = local.accept ();
+	if (!peer || !peer->isUnix () || peer->writeBlock ("local") != 5 || iodevice_receive (localClient, 5) != "local")
+		return false;
+	delete peer;
+	local.close ();
+	return access (path, F_OK) != 0;
+}
+
+/*******************************************************************************
+* NAME:        iodevice_notifier
+*
+* DESCRIPTION: Runs an echo server on a DeviceNotifier, handling the
+*              connections in the thread of the notifier and in a
+*              WorkerPool, with several clients at once.
+*
+* RETURNS:     true if successful, false on failure.
+*******************************************************************************/
+bool iodevice_notifier ()
+{
+	for (int workers = 0; workers <= 4; workers += 4) {
+		EchoServer server (workers);
+		if (!server.startTCP ())
+			return false;
+
+		const int clients = 20;
+		ClientSocket* sockets [clients];
+		for (int i=0; i<clients; i++) {
+			sockets[i] = new ClientSocket ();
+			sockets[i]->setBlocking (true);
+			if (!sockets[i]->connect ("127.0.0.1", server.mServer.port ()))
+				return false;
+		}
+		for (int round=0; round<10; round++)
+			for (int i=0; i<clients; i++) {
+				String message = String ("message %1 from %2").arg (round).arg (i);
+				sockets[i]->writeBlock (message);
+				if (iodevice_receive (*sockets[i], message.length ()) != message)
+					return false;
+			}
+		for (int i=0; i<clients; i++)
+			delete sockets[i];
+
+		if (!server.finish () || server.mAccepted != clients)
+			return false;
+	}
+
+	// Timing out, and devices that are not watched
+	DeviceNotifier notifier;
+	ClientSocket closed;
+	return notifier.runOnce (0.01) == 0 && !notifier.addDevice (&closed, NULL)
+		&& !notifier.removeDevice (&closed) && notifier.deviceCount () == 0;
+}
+
+/** Client of the echo benchmark, which sends messages one at a time
+ *  and waits for each to return.
+ **/
+class EchoClient : public ClientSocket {
+  public:
+	EchoClient (int messages) : mRemaining (messages), mReceived (0) {}
+
+	int		mRemaining;	/**< Messages still to send.                       */
+	int		mReceived;	/**< Bytes of the current message received so far. */
+};
+
+/** Runs the given number of echo connections through the server,
+ *  keeping the given number of them open at a time.
+ **/
+class EchoBench : public DeviceHandler {
+  public:
+	EchoBench (uint port, int connections, int concurrent, int messages)
+			: mPort (port), mToConnect (connections), mMessages (messages), mOpen (0), mRoundTrips (0), mFailed (false) {
+		memset (mMessage, 'm', sizeof (mMessage));
+		for (int i=0; i<concurrent && mToConnect > 0; i++)
+			connect ();
+	}
+
+	/** Handles the events until the connections are done. */
+	bool run () {
+		for (int idle = 0; mOpen > 0 && !mFailed && idle < 5;)
+			idle = (mNotifier.runOnce (1.0) > 0)? 0 : idle+1;
+		return mOpen == 0 && !mFailed;
+	}
+
+	void connect () {
+		EchoClient* client = new EchoClient (mMessages);
+		mToConnect--;
+		if (!client->connect ("127.0.0.1", mPort)) {
+			mFailed = true;
+			delete client;
+			return;
+		}
+		client->setNoDelay (true);
+		mNotifier.addDevice (client, this, IO_WriteReady);
+		mOpen++;
+	}
+
+	void send (EchoClient* client) {
+		if (client->writeBlock (mMessage, sizeof (mMessage)) != sizeof (mMessage))
+			mFailed = true;
+		client->mReceived = 0;
+		client->mRemaining--;
+	}
+
+	virtual void deviceEvent (DeviceNotifier& notifier, IODevice* device, int events) {
+		EchoClient* client = static_cast<EchoClient*> (device);
+		if (events & IO_WriteReady) {
+			if (!client->finishConnect ())
+				mFailed = true;
+			send (client);
+			notifier.modifyDevice (client, IO_ReadReady);
+			return;
+		}
+
+		char buffer [sizeof (mMessage)];
+		int bytes;
+		while ((bytes = client->readBlock (buffer, sizeof (buffer))) > 0)
+			client->mReceived += bytes;
+		if (client->atEnd () || bytes < 0)
+			mFailed = true;
+		if (client->mReceived < int (sizeof (mMessage)))
+			return;
+
+		mRoundTrips++;
+		if (client->mRemaining > 0)
+			send (client);
+		else {
+			notifier.removeDevice (client);
+			delete client;
+			mOpen--;
+			if (mToConnect > 0)
+				connect ();
+		}
+	}
+
+	DeviceNotifier	mNotifier;
+	uint			mPort;
+	int				mToConnect;		/**< Connections still to open.  */
+	int				mMessages;		/**< Messages per connection.    */
+	int				mOpen;			/**< Connections open now.       */
+	long			mRoundTrips;	/**< Messages echoed back.       */
+	bool			mFailed;
+	char			mMessage [64];
+};
+
+/*******************************************************************************
+* NAME:        iodevice_socketBenchmark
+*
+* DESCRIPTION: Runs loopback echo connections with 1000 concurrent
+*              clients through a DeviceNotifier, against an echo
+*              server on another notifier, which handles the
+*              connections in its own thread or in a WorkerPool.
+*              Reports connections/s with one message per connection,
+*              and messages/s over long-lived connections.
+*
+* RETURNS:     true if all messages came back.
+*******************************************************************************/
+bool iodevice_socketBenchmark ()
+{
+	const int concurrent = 1000;
+	bool ok = true;
+	for (int workers = 0; workers <= 4; workers += 4) {
+		EchoServer server (workers);
+		if (!server.startTCP ())
+			return false;
+
+		double start = benchtime ();
+		const int connections = 10000;
+		EchoBench connecting (server.mServer.port (), connections, concurrent, 1);
+		ok = ok && connecting.run () && connecting.mRoundTrips == connections;
+		double connected = benchtime ();
+
+		const int messages = 200;
+		EchoBench messaging (server.mServer.port (), concurrent, concurrent, messages);
+		ok = ok && messaging.run () && messaging.mRoundTrips == long (concurrent) * messages;
+		double messaged = benchtime ();
+
+		printf ("  %-14s %8.0f connections/s %9.0f msgs/s\n", workers? "WorkerPool (4)" : "notifier",
+				connections / (connected - start), concurrent * messages / (messaged - connected));
+		ok = server.finish () && ok;
+	}
+	return ok;
+}
+
+/** Counts the completed requests, and checks their results. */
+class AsyncCounter : public AsyncHandler {
+  public:
+	AsyncCounter () : mCompleted (0), mFailed (0) {}
+
+	virtual void completed (AsyncRequest& request) {
+		mCompleted++;
+		if (request.result () != int (request.length ()))
+			mFailed++;
+	}
+
+	int		mCompleted;
+	int		mFailed;
+};
+
+/** Tests one backend of AsyncIO. */
+static bool iodevice_asyncBackend (int backend)
+{
+	AsyncIO aio (16, backend, 4);
+	if (backend != AsyncIO::AIO_Auto && aio.backend () != backend)
+		return false;
+
+	// Batched writes at offsets, from registered buffers
+	const char* filename = "/tmp/asyncio-test.bin";
+	File file (filename, IO_ReadWrite | IO_Truncate);
+	const int blocks = 40;
+	if (!aio.registerBuffers (blocks, 4096) || aio.bufferCount () != blocks || aio.registerBuffers (1, 1))
+		return false;
+	AsyncCounter counter;
+	AsyncRequest requests [blocks];
+	for (int i=0; i<blocks; i++) {
+		memset (aio.buffer (i), 'a' + i % 26, 4096);
+		requests[i].prepareWrite (file, i, 4096, (blocks-1-i) * 4096L);
+		requests[i].setHandler (&counter);
+		if (!aio.submit (&requests[i]))
+			return false;
+	}
+	aio.wait (blocks);
+	if (counter.mCompleted != blocks || counter.mFailed || aio.pending () != 0)
+		return false;
+
+	// Reads into memory, waited for as futures
+	char data [blocks][4096];
+	for (int i=0; i<blocks; i++) {
+		requests[i].prepareRead (file, data[i], 4096, i * 4096L);
+		requests[i].setHandler (NULL);
+		aio.submit (&requests[i]);
+	}
+	aio.flush ();
+	for (int i=blocks-1; i>=0; i--)
+		if (!aio.wait (requests[i]) || requests[i].result () != 4096 || data[i][4095] != 'a' + (blocks-1-i) % 26)
+			return false;
+
+	// Reads at the current position, and past the end
+	AsyncRequest request;
+	lseek (file.handle (), 4096 * (blocks-1), SEEK_SET);
+	request.prepareRead (file, data[0], 8192);
+	aio.submit (&request);
+	if (!aio.wait (request, 5.0) || request.result () != 4096 || lseek (file.handle (), 0, SEEK_CUR) != 4096L * blocks)
+		return false;
+	request.prepareRead (file, data[0], 4096, 4096L * blocks);
+	aio.submit (&request);
+	if (!aio.wait (request, 5.0) || request.result () != 0)
+		return false;
+
+	// Errors come as negative errno values
+	File readOnly (filename, IO_Readable);
+	request.prepareWrite (readOnly, data[0], 10, 0);
+	aio.submit (&request);
+	if (!aio.wait (request) || request.result () != -EBADF)
+		return false;
+	file.close ();
+	request.prepareRead (file, data[0], 10, 0);
+	try {
+		aio.submit (&request);
+		return false;
+	} catch (device_not_open& e) {
+	}
+	File (filename).remove ();
+
+	// Sockets, with the completions reaped by a notifier
+	ServerSocket server;
+	ClientSocket client;
+	client.setBlocking (true);
+	if (!server.listen (0) || !client.connect ("127.0.0.1", server.port ()) || server.wait (IO_ReadReady, 5.0) <= 0)
+		return false;
+	Socket* peer = server.accept ();
+	if (!peer)
+		return false;
+
+	DeviceNotifier notifier;
+	if (!aio.attach (notifier))
+		return false;
+	AsyncRequest receive, send;
+	receive.prepareRead (*peer, data[0], sizeof (data[0]));
+	send.prepareWrite (client, "asynchronous", 12);
+	aio.submit (&receive);
+	aio.submit (&send);
+	aio.flush ();
+	for (int i=0; i<100 && !(receive.isDone () && send.isDone ()); i++)
+		notifier.runOnce (0.1);
+	bool ok = receive.result () == 12 && send.result () == 12 && !strncmp (data[0], "asynchronous", 12);
+
+	// The peer has gone
+	delete peer;
+	send.prepareWrite (client, "lost", 4);
+	for (int i=0; i<10 && ok; i++) {
+		aio.submit (&send);
+		aio.wait (send, 5.0);
+		if (send.result () < 0)
+			break;
+	}
+	ok = ok && (send.result () == -EPIPE || send.result () == -ECONNRESET);
+	return aio.detach (notifier) && ok;
+}
+
+/*******************************************************************************
+* NAME:        iodevice_asyncIO
+*
+* DESCRIPTION: Writes and reads a file and a socket with AsyncIO, with
+*              io_uring when available and with the thread fallback.
+*
+* RETURNS:     true if successful, false on failure.
+*******************************************************************************/
+bool iodevice_asyncIO ()
+{
+	return iodevice_asyncBackend (AsyncIO::AIO_Auto) && iodevice_asyncBackend (AsyncIO::AIO_Threads);
+}
+
+/** Returns a pseudo-random number below the range. */
+static long iodevice_random (unsigned long& state, long range)
+{
+	state = state * 6364136223846793005UL + 1442695040888963407UL;
+	return (state >> 17) % range;
+}
+
+/** Reads random 4 KB blocks and checks their numbers, keeping the
+ *  given number of reads in flight.
+ **/
+class RandomReader : public AsyncHandler {
+  public:
+	RandomReader (AsyncIO& aio, File& file, long blocks, int depth)
+			: mrAIO (aio), mrFile (file), mBlocks (blocks), mDepth (depth), mToRead (0),
+			  mCompleted (0), mFailed (0), mRandom (12345) {
+		mpRequests = new AsyncRequest [depth];
+	}
+
+	~RandomReader () {
+		delete [] mpRequests;
+	}
+
+	/** Fills the queue, and passes the batch on. */
+	void start (long reads) {
+		mToRead = reads;
+		for (int i=0; i<mDepth; i++)
+			next (mpRequests[i]);
+		mrAIO.flush ();
+	}
+
+	/** Submits the next read with the request, if any are left. */
+	void next (AsyncRequest& request) {
+		if (mToRead <= 0)
+			return;
+		mToRead--;
+		long block = iodevice_random (mRandom, mBlocks);
+		request.prepareRead (mrFile, int (&request - mpRequests), 4096, block * 4096);
+		request.setHandler (this);
+		request.setUserData ((void*) block);
+		mrAIO.submit (&request);
+	}
+
+	virtual void completed (AsyncRequest& request) {
+		mCompleted++;
+		if (request.result () != 4096 || *(long*) request.data () != (long) request.userData ())
+			mFailed++;
+		next (request);
+	}
+
+	AsyncIO&		mrAIO;
+	File&			mrFile;
+	AsyncRequest*	mpRequests;
+	long			mBlocks;
+	int				mDepth;
+	long			mToRead;	/**< Reads still to submit. */
+	long			mCompleted;
+	long			mFailed;
+	unsigned long	mRandom;
+};
+
+/** Drops the file from the page cache, so that the reads go to the disk. */
+static void iodevice_dropCache (File& file)
+{
+	posix_fadvise (file.handle (), 0, 0, POSIX_FADV_DONTNEED);
+	posix_fadvise (file.handle (), 0, 0, POSIX_FADV_RANDOM);
+}
+
+/*******************************************************************************
+* NAME:        iodevice_asyncIOBenchmark
+*
+* DESCRIPTION: Reads random 4 KB blocks of a 10 GB file with blocking
+*              reads of a File, and with AsyncIO at queue depths 1 to
+*              256, with io_uring and with the thread fallback. Each
+*              run drops the file from the page cache first, and
+*              lasts 50000 reads or about 2 seconds.
+*
+* RETURNS:     true if all reads returned the right blocks.
+*******************************************************************************/
+bool iodevice_asyncIOBenchmark ()
+{
+	const char* filename = "/tmp/asyncio-bench.bin";
+	const long blocks = 10L*1024*1024*1024 / 4096;
+	const long reads = 50000;
+	const double seconds = 2.0;
+	{
+		// Each block starts with its number
+		File out (filename, IO_Writable);
+		const int chunk = 1024*1024;
+		char* data = new char [chunk];
+		memset (data, 'x', chunk);
+		for (long block = 0; block < blocks; block += chunk/4096) {
+			for (int i=0; i<chunk/4096; i++)
+				*(long*) (data + i*4096) = block + i;
+			if (::write (out.handle (), data, chunk) != chunk) {
+				delete [] data;
+				return false;
+			}
+		}
+		delete [] data;
+	}
+	File file (filename, IO_Readable);
+	bool ok = true;
+
+	// Blocking reads of the File, one at a time
+	iodevice_dropCache (file);
+	char buffer [4096];
+	unsigned long state = 12345;
+	long done = 0;
+	double start = benchtime ();
+	for (; done < reads && benchtime () - start < seconds; done++) {
+		long block = iodevice_random (state, blocks);
+		if (pread (file.handle (), buffer, 4096, block * 4096) != 4096 || *(long*) buffer != block)
+			ok = false;
+	}
+	double elapsed = benchtime () - start;
+	printf ("  %-10s depth %3d %8.0f reads/s %7.1f MB/s %8.1f us/read\n", "File", 1,
+			done / elapsed, done * 4096 / elapsed / 1e6, elapsed / done * 1e6);
+
+	const int depths [] = {1, 4, 16, 64, 256};
+	for (int backend = AsyncIO::AIO_Uring; backend <= AsyncIO::AIO_Threads; backend++) {
+		if (backend == AsyncIO::AIO_Uring && AsyncIO (1).backend () != AsyncIO::AIO_Uring) {
+			printf ("  io_uring is not available\n");
+			continue;
+		}
+		for (int d=0; d<5; d++) {
+			int depth = depths[d];
+			AsyncIO aio (depth, backend, (depth < 64)? depth : 64);
+			if (!aio.registerBuffers (depth, 4096))
+				return false;
+			RandomReader reader (aio, file, blocks, depth);
+
+			iodevice_dropCache (file);
+			start = benchtime ();
+			reader.start (reads);
+			while (aio.pending () > 0) {
+				aio.wait (1);
+				if (benchtime () - start > seconds)
+					reader.mToRead = 0;
+			}
+			elapsed = benchtime () - start;
+			ok = ok && reader.mFailed == 0;
+			printf ("  %-10s depth %3d %8.0f reads/s %7.1f MB/s %8.1f us/read\n",
+					(backend == AsyncIO::AIO_Uring)? "io_uring" : "threads", depth,
+					reader.mCompleted / elapsed, reader.mCompleted * 4096 / elapsed / 1e6,
+					elapsed / reader.mCompleted * depth * 1e6);
+		}
+	}
+
+	File (filename).remove ();
+	return ok;
+}
+
+#if defined(HAVE_ZLIB) || defined(HAVE_ZSTD)
+
+/** Is the gzip format 0, or the zstd format 1, compiled in? */
+static bool iodevice_hasFormat (int format)
+{
+#ifdef HAVE_ZLIB
+	if (format == 0)
+		return true;
+#endif
+#ifdef HAVE_ZSTD
+	if (format == 1)
+		return true;
+#endif
+	return false;
+}
+
+/** Creates a gzip device for format 0, or a zstd device. */
+static CompressedDevice* iodevice_compressor (int format, IODevice* device, int mode, int level)
+{
+#ifdef HAVE_ZLIB
+	if (format == 0)
+		return new GzipDevice (device, mode, level);
+#endif
+#ifdef HAVE_ZSTD
+	if (format == 1)
+		return new ZstdDevice (device, mode, level);
+#endif
+	return NULL;
+}
+
+/** Runs a shell command, which returns 0 if successful. */
+static int iodevice_shell (const String& command)
+{
+	return system ((CONSTR) command);
+}
+
+/** Reads a file to a string. */
+static String iodevice_readFile (const char* filename)
+{
+	String contents;
+	File in (filename, IO_Readable);
+	char buffer [65536];
+	int bytes;
+	while ((bytes = in.readBlock (buffer, sizeof (buffer))) > 0)
+		contents.append (buffer, bytes);
+	return contents;
+}
+
+/*******************************************************************************
+* NAME:        iodevice_compressed
+*
+* DESCRIPTION: Writes and reads gzip and zstd data through streams,
+*              with and without compressing threads, seeks with the
+*              index of frames, and checks that the command line tools
+*              and the devices read the data of each other. Formats
+*              whose library is not compiled in are skipped.
+*
+* RETURNS:     true if successful, false on failure.
+*******************************************************************************/
+bool iodevice_compressed ()
+{
+	const char* filenames [2] = {"/tmp/compressed.gz", "/tmp/compressed.zst"};
+	const char* tools [2] = {"gzip", "zstd"};
+	const int levels [2] = {6, 3};
+
+	String text;
+	for (int i=0; i<20000; i++)
+		text += String ("Line %1 of the compressed file\n").arg (i);
+
+	for (int format = 0; format < 2; format++) {
+		if (!iodevice_hasFormat (format)) {
+			printf ("  %s is not compiled in\n", tools[format]);
+			continue;
+		}
+		const char* filename = filenames[format];
+		for (int threads = 1; threads <= 3; threads += 2) {
+			{
+				CompressedDevice* device = iodevice_compressor (format, new File (filename), 0, levels[format]);
+				device->setFrameSize (10000);
+				device->setThreads (threads);
+				device->open (IO_Writable);
+				TextOStream out (device);
+				for (int i=0; i<20000; i++) {
+					out << "Line " << i << " of the compressed file\n";
+					if (i == 100)
+						device->flush ();
+				}
+
+				// The last frame is not full yet
+				device->flush ();
+				if (device->size () != text.length () || device->frameCount () != int (text.length () / 10000))
+					return false;
+			}
+
+			// Lines through a stream
+			TextIStream in (iodevice_compressor (format, new File (filename), IO_Readable, levels[format]));
+			String line, lines;
+			while (in.readLine (line))
+				lines += line;
+			if (lines != text)
+				return false;
+
+			// Seeking with the index
+			CompressedDevice* device = iodevice_compressor (format, new File (filename), IO_Readable, levels[format]);
+			if (!device->hasIndex () || device->size () != text.length ())
+				return false;
+			unsigned long state = 4321;
+			char block [40];
+			for (int i=0; i<200; i++) {
+				int position = iodevice_random (state, text.length () - 40);
+				if (!device->seek (position) || device->readBlock (block, 40) != 40
+					|| memcmp (block, ((CONSTR) text) + position, 40) || device->at () != position + 40)
+					return false;
+			}
+			if (device->seek (text.length () + 1) || device->status () != 0)
+				return false;
+			delete device;
+		}
+
+		// The tools read the frames and skip the index
+		if (iodevice_shell (String ("%1 --version >/dev/null 2>&1").arg (tools[format])) != 0) {
+			printf ("  %s is not available\n", tools[format]);
+			continue;
+		}
+		if (iodevice_shell (String ("%1 -dc %2 > /tmp/compressed.txt").arg (tools[format]).arg (filename)) != 0
+			|| iodevice_readFile ("/tmp/compressed.txt") != text)
+			return false;
+
+		// The devices read the output of the tools, without an index
+		if (iodevice_shell (String ("%1 -c %2 > %3").arg (tools[format]).arg ("/tmp/compressed.txt").arg (filename)) != 0)
+			return false;
+		CompressedDevice* device = iodevice_compressor (format, new File (filename), IO_Readable, levels[format]);
+		char block [40];
+		if (device->hasIndex () || !device->seek (100000) || device->readBlock (block, 40) != 40
+			|| memcmp (block, ((CONSTR) text) + 100000, 40) || !device->seek (5) || device->getch () != text[5])
+			return false;
+		delete device;
+		File ("/tmp/compressed.txt").remove ();
+	}
+
+	// Binary data of a data stream, in the last available format
+	int format = iodevice_hasFormat (1)? 1 : 0;
+	{
+		CompressedDevice* device = iodevice_compressor (format, new File (filenames[format]), 0, 1);
+		device->setThreads (2);
+		device->setFrameSize (4096);
+		device->open (IO_Writable);
+		{
+			DataOStream out (*device, DataOStream::FMT_BINARY);
+			for (int i=0; i<10000; i++)
+				out << i << i * 0.5 << String ("item");
+		}
+		delete device;
+	}
+	{
+		CompressedDevice* device = iodevice_compressor (format, new File (filenames[format]), IO_Readable, 1);
+		bool ok = true;
+		{
+			DataIStream in (*device);
+			int value;
+			double half;
+			String name;
+			for (int i=0; i<10000 && ok; i++) {
+				in >> value >> half >> name;
+				ok = value == i && half == i * 0.5 && name == "item";
+			}
+		}
+		ok = ok && device->getch () == -1 && device->atEnd () && device->status () == 0;
+		delete device;
+		if (!ok)
+			return false;
+	}
+
+	// Maps read from compressed files
+	{
+		TextOStream out (iodevice_compressor (format, new File (filenames[format]), IO_Writable, 1));
+		out << "[main]\nname = compressed\nsize = 3\n";
+	}
+	StringMap map = readStringMap (filenames[format]);
+	if (map["main.name"] != "compressed" || map["main.size"] != "3")
+		return false;
+
+	// Plain files pass through, truncated files are errors
+	File* plain = new File ("/tmp/testfile.txt", IO_Writable);
+	plain->IODevice::writeBlock ("Not compressed\n");
+	plain->close ();
+	plain->open (IO_Readable);
+	IODevice* device = CompressedDevice::decompressor (plain);
+	delete device;
+	if (device != plain)
+		return false;
+	File ("/tmp/testfile.txt").remove ();
+
+	for (int format = 0; format < 2; format++) {
+		if (!iodevice_hasFormat (format))
+			continue;
+		{
+			CompressedDevice* device = iodevice_compressor (format, new File (filenames[format]), IO_Writable, 1);
+			device->IODevice::writeBlock (text);
+			delete device;
+		}
+		if (truncate (filenames[format], 1000) != 0)
+			return false;
+		CompressedDevice* device = iodevice_compressor (format, new File (filenames[format]), IO_Readable, 1);
+		char buffer [4096];
+		while (device->readBlock (buffer, sizeof (buffer)) > 0);
+		if (device->status () != IO_ReadError)
+			return false;
+		delete device;
+		File (filenames[format]).remove ();
+	}
+	return true;
+}
+
+/** Compresses data in a file and decompresses it, printing the ratio
+ *  and the speeds.
+ **/
+static bool iodevice_compressRun (const String& data, int format, int level, int threads)
+{
+	const char* filename = "/tmp/compressed-bench";
+	const uint chunk = 65536;
+	double start = benchtime ();
+	long compressed;
+	{
+		CompressedDevice* device = iodevice_compressor (format, new File (filename), 0, level);
+		device->setThreads (threads);
+		device->open (IO_Writable);
+		for (uint i=0; i<data.length (); i += chunk)
+			device->writeBlock (((CONSTR) data) + i, (data.length () - i < chunk)? data.length () - i : chunk);
+		device->close ();
+		compressed = device->compressedSize ();
+		delete device;
+	}
+	double written = benchtime ();
+
+	CompressedDevice* device = iodevice_compressor (format, new File (filename), IO_Readable, level);
+	char* buffer = new char [chunk];
+	uint total = 0;
+	bool ok = true;
+	int bytes;
+	while ((bytes = device->readBlock (buffer, chunk)) > 0) {
+		ok = ok && total + bytes <= data.length () && !memcmp (buffer, ((CONSTR) data) + total, bytes);
+		total += bytes;
+	}
+	double read = benchtime ();
+	delete [] buffer;
+	delete device;
+	File (filename).remove ();
+
+	printf ("  %-4s level %d threads %d  ratio %5.2f  compress %7.1f MB/s  decompress %7.1f MB/s\n",
+			format? "zstd" : "gzip", level, threads, double (data.length ()) / compressed,
+			data.length () / (written - start) / 1e6, data.length () / (read - written) / 1e6);
+	return ok && total == data.length ();
+}
+
+/*******************************************************************************
+* NAME:        iodevice_compressedBenchmark
+*
+* DESCRIPTION: Compresses and decompresses 64 MB of binary archive
+*              data written with a DataOStream, and 64 MB of log
+*              lines, with gzip and zstd at several levels, in one
+*              and in four threads.
+*
+* RETURNS:     true if the data decompresses back to the original.
+*******************************************************************************/
+bool iodevice_compressedBenchmark ()
+{
+	const uint bytes = 64*1024*1024;
+	const char* levels [] = {"WARNING", "INFO", "INFO", "DEBUG", "INFO", "ERROR", "INFO", "DEBUG"};
+	const char* filename = "/tmp/compressed-archive.bin";
+	{
+		BufferedFile file (filename, IO_Writable);
+		DataOStream out (file, DataOStream::FMT_BINARY);
+		unsigned long state = 1;
+		for (int i=0; file.at () < int (bytes); i++)
+			out << i << long (1792224000L + i / 8) << iodevice_random (state, 1000) * 0.01
+				<< String ("customer%1").arg (int (iodevice_random (state, 5000))) << char ('A' + i % 4);
+	}
+	String archive = iodevice_readFile (filename), log;
+	File (filename).remove ();
+	{
+		unsigned long state = 2;
+		char line [256];
+		for (int i=0; log.length () < bytes; i++) {
+			int length = sprintf (line, "2026-10-17 %02d:%02d:%02d.%03d [%s] worker-%d: request %d from 10.0.%d.%d handled in %d ms\n",
+								  i / 3600000 % 24, i / 60000 % 60, i / 1000 % 60, i % 1000, levels [i % 8],
+								  int (iodevice_random (state, 8)), i, int (iodevice_random (state, 4)),
+								  int (iodevice_random (state, 256)), int (iodevice_random (state, 200)));
+			log.append (line, length);
+		}
+	}
+
+	const int formats [] = {0, 0, 1, 1, 1};
+	const int compressLevels [] = {1, 6, 1, 3, 9};
+	bool ok = true;
+	for (int data = 0; data < 2; data++) {
+		printf ("  %s, %d MB\n", data? "Log lines" : "Archive data", bytes / (1024*1024));
+		for (int i=0; i<5; i++)
+			for (int threads = 1; threads <= 4 && iodevice_hasFormat (formats[i]); threads += 3)
+				ok = iodevice_compressRun (data? log : archive, formats[i], compressLevels[i], threads) && ok;
+	}
+	return ok;
+}
+
+#else
+
+bool iodevice_compressed ()
+{
+	printf ("  gzip and zstd are not compiled in\n");
+	return true;
+}
+
+bool iodevice_compressedBenchmark ()
+{
+	return true;
+}
+
+#endif
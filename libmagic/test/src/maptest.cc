@@ -0,0 +1,634 @@
+/***************************************************************************
+ *   This file is part of the MagiC++ library.                             *
+ *                                                                         *
+ *   Copyright (C) 1998-2002 Marko Grnroos <magi@iki.fi>                  *
+ *                                                                         *
+ ***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#include <magic/mmap.h>
+#include <magic/mtextstream.h>
+#include <magic/mbufferedfile.h>
+#include <magic/mpackarray.h>
+#include <magic/marena.h>
+#include <magic/morderedmap.h>
+
+#include "tests.h"
+
+using namespace MagiC;
+
+/*******************************************************************************
+* NAME:        map_basicTests
+*
+* DESCRIPTION: Inserts, replaces, looks up, iterates and removes enough
+*              items to force the hash to grow several times.
+*
+* RETURNS:     true if successful, false on failure.
+*******************************************************************************/
+bool map_basicTests ()
+{
+	const int count = 5000;
+	Map<String,String> map (4, MAP_NONE);
+
+	for (int i=0; i<count; i++)
+		map.set (String("section.key%1").arg(i), String(i));
+	if (map.gethash()->size() != count)
+		return false;
+
+	// Replacing must not add items
+	map.set ("section.key42", "replaced");
+	if (map.gethash()->size() != count || map["section.key42"] != "replaced")
+		return false;
+
+	for (int i=0; i<count; i++)
+		if (i != 42 && map[String("section.key%1").arg(i)] != String(i))
+			return false;
+	if (map.getp ("section.key5000") != NULL)
+		return false;
+
+	// Remove every other item; the rest must remain reachable
+	for (int i=0; i<count; i+=2)
+		map.remove (String("section.key%1").arg(i));
+	map.check ();
+	for (int i=0; i<count; i++)
+		if (map.hasKey (String("section.key%1").arg(i)) != (i%2 == 1))
+			return false;
+
+	// Iteration visits every remaining item exactly once
+	int visited = 0;
+	forStringMap (map, iter)
+		visited++;
+	if (visited != count/2)
+		return false;
+
+	// Copying
+	StringMap copy = map;
+	if (copy.gethash()->size() != count/2 || copy["section.key4999"] != "4999")
+		return false;
+
+	map.empty ();
+	return map.gethash()->size() == 0 && !map.hasKey ("section.key1");
+}
+
+
+
+/** Writes the given text to a file. */
+static void map_writeFile (const char* filename, const char* text)
+{
+	BufferedFile out (filename, IO_Writable);
+	out.writeBlock (text, strlen (text));
+}
+
+/*******************************************************************************
+* NAME:        map_readTests
+*
+* DESCRIPTION: Reads a StringMap file with sections, comments, an include
+*              and replaced keys, both mapped and through a File stream.
+*
+* RETURNS:     true if successful, false on failure.
+*******************************************************************************/
+bool map_readTests ()
+{
+	const char* filename = "/tmp/maptest-read.txt";
+	map_writeFile ("/tmp/maptest-include.txt", "[inc]\nkey = included\n");
+	map_writeFile (filename,
+				   "# comment\n"
+				   " \t # indented comment = not a pair\n"
+				   "top = level\n"
+				   "[main]\n"
+				   "name = first\n"
+				   "  name\t=   second  \n"
+				   "a=b=c\n"
+				   "empty =\n"
+				   "\n"
+				   "INCLUDE maptest-include.txt\n"
+				   "[]\n"
+				   "plain=yes\r\n"
+				   "# end-of-map\n"
+				   "after = ignored\n");
+
+	for (int pass=0; pass<2; pass++) {
+		StringMap map;
+		if (pass == 0)
+			map = readStringMap (String (filename));
+		else {
+			TextIStream in (new File (filename));
+			map = readStringMap (in, "/tmp/");
+		}
+
+		if (map.gethash()->size() != 4 || map["top"] != "level" || map["main.name"] != "second"
+			|| map["inc.key"] != "included" || map["plain"] != "yes"
+			|| map.hasKey ("main.a") || map.hasKey ("main.empty") || map.hasKey ("after"))
+			return false;
+	}
+
+	File (filename).remove ();
+	File ("/tmp/maptest-include.txt").remove ();
+	return true;
+}
+
+
+
+/*******************************************************************************
+* NAME:        map_arenaTests
+*
+* DESCRIPTION: Allocates from an Arena directly, and builds, modifies,
+*              copies and destroys a StringMap and an Array that make
+*              their items in one.
+*
+* RETURNS:     true if successful, false on failure.
+*******************************************************************************/
+bool map_arenaTests ()
+{
+	Arena arena (4096);
+	if (arena.used () != 0 || arena.reserved () != 0)
+		return false;
+
+	// Alignment, and large blocks that do not waste the current one
+	char* a = (char*) arena.allocate (3);
+	char* b = (char*) arena.allocate (1);
+	char* big = (char*) arena.allocate (10000);
+	char* c = (char*) arena.allocate (1);
+	if ((long) a % ARENA_ALIGN || b != a + ARENA_ALIGN || c != b + ARENA_ALIGN || !big
+		|| arena.used () != 3*ARENA_ALIGN + 10000 || arena.reserved () != 4096 + 10000)
+		return false;
+	memset (big, 1, 10000);
+	arena.release ();
+	if (arena.used () != 0 || arena.reserved () != 4096 || arena.allocate (1) != a)
+		return false;
+	arena.release ();
+
+	{
+		const int count = 2000;
+		StringMap map (arena);
+		for (int i=0; i<count; i++)
+			map.set (String("section.long.key%1").arg(i), String("value %1").arg(i));
+		if (map.gethash()->size() != count || map["section.long.key1999"] != "value 1999")
+			return false;
+
+		// Replacing and removing destroy the items in the arena
+		map.set ("section.long.key5", "a replaced value that is long");
+		for (int i=0; i<count; i+=2)
+			map.remove (String("section.long.key%1").arg(i));
+		map.check ();
+		if (map.gethash()->size() != count/2 || map.hasKey ("section.long.key4")
+			|| map["section.long.key5"] != "a replaced value that is long")
+			return false;
+
+		// A string in the arena moves to the heap when it grows
+		map["section.long.key7"] += " and then some more characters";
+		if (map["section.long.key7"] != "value 7 and then some more characters")
+			return false;
+
+		// Copies to and from the heap
+		StringMap heap = map;
+		StringMap other (arena);
+		other = heap;
+		other += map;
+		if (heap.gethash()->size() != count/2 || other.gethash()->size() != count/2
+			|| heap["section.long.key5"] != map["section.long.key5"]
+			|| other["section.long.key1999"] != "value 1999")
+			return false;
+
+		Array<String> array (arena);
+		for (int i=0; i<100; i++)
+			array.add (String ("array item number %1").arg (i));
+		array.put (*arenaCopy (arena, String ("put into an arena array")), 5);
+		array.resize (50);
+		if (array.size () != 50 || array[49] != "array item number 49"
+			|| array[5] != "put into an arena array")
+			return false;
+	}
+	return arena.used () > 0;
+}
+
+
+/*******************************************************************************
+* NAME:        map_orderedTests
+*
+* DESCRIPTION: Inserts keys out of order into an OrderedMap, and checks
+*              the ordering, lookups, ranges, prefix scans and removal.
+*
+* RETURNS:     true if successful, false on failure.
+*******************************************************************************/
+bool map_orderedTests ()
+{
+	// String order is byte order, shorter first
+	if (String ("a").compare (String ("ab")) >= 0 || String ("ab").compare (String ("b")) >= 0
+		|| String ("\xe4").compare (String ("z")) <= 0 || String ("").compare (String ()) != 0
+		|| ((const Comparable&) String ("b")).compare (String ("a")) <= 0
+		|| Int (-5).compare (Int (3)) >= 0)
+		return false;
+
+	const int count = 5000;
+	OrderedMap<String,String> map;
+	for (int i=0; i<count; i++) {
+		int k = (i * 7919) % count;
+		map.set (String("section.key%1").arg(k), String(k));
+	}
+	map.check ();
+	if (map.size () != count)
+		return false;
+
+	// Replacing must not add items
+	map.set ("section.key42", "replaced");
+	if (map.size () != count || map["section.key42"] != "replaced"
+		|| map.getp ("section.key5000") != NULL || map.getOr ("none", "default") != "default")
+		return false;
+	for (int i=0; i<count; i++)
+		if (i != 42 && map[String("section.key%1").arg(i)] != String(i))
+			return false;
+
+	// Iteration is in order
+	int visited = 0;
+	String last;
+	for (OrderedMapIter<String,String> iter (map); !iter.exhausted(); iter.next(), visited++) {
+		if (visited && last.compare (iter.key ()) >= 0)
+			return false;
+		last = iter.key ();
+	}
+	if (visited != count)
+		return false;
+
+	// Ranges: "section.key100" <= key < "section.key101" are 100, and
+	// 1000 to 1009
+	OrderedMapIter<String,String> range (map);
+	range.seek ("section.key100");
+	range.until ("section.key101");
+	for (visited = 0; !range.exhausted(); range.next(), visited++)
+		if (!SubString (range.key ()).startsWith (String ("section.key100")))
+			return false;
+	if (visited != 11)
+		return false;
+
+	// Prefix scan: 12, 120-129 and 1200-1299
+	range.prefix ("section.key12");
+	for (visited = 0; !range.exhausted(); range.next(), visited++)
+		if (!SubString (range.key ()).startsWith (String ("section.key12")))
+			return false;
+	if (visited != 111)
+		return false;
+	range.prefix ("other.");
+	if (!range.exhausted ())
+		return false;
+
+	// Remove every other item; the rest must remain reachable
+	for (int i=0; i<count; i+=2)
+		map.remove (String("section.key%1").arg(i));
+	map.remove ("not.there");
+	map.check ();
+	if (map.size () != count/2)
+		return false;
+	for (int i=0; i<count; i++)
+		if (map.hasKey (String("section.key%1").arg(i)) != (i%2 == 1))
+			return false;
+
+	// Copying
+	OrderedMap<String,String> copy = map;
+	copy.check ();
+	if (copy.size () != count/2 || copy["section.key4999"] != "4999")
+		return false;
+
+	// Removing everything empties the tree, which must work again
+	for (int i=1; i<count; i+=2)
+		map.remove (String("section.key%1").arg(i));
+	if (map.size () != 0 || !OrderedMapIter<String,String> (map).exhausted ())
+		return false;
+	map.set ("again", "1");
+	if (map.size () != 1 || map["again"] != "1")
+		return false;
+
+	// Integer keys in descending order, with values that are not owned
+	Int values [1000];
+	OrderedMap<Int,Int> ints (MAP_REF);
+	for (int i=999; i>=0; i--) {
+		values[i] = Int (i);
+		ints.set (Int (i*3), values[i]);
+	}
+	ints.check ();
+	OrderedMapIter<Int,Int> iter (ints);
+	iter.seek (Int (301));
+	if (iter.exhausted () || iter.key().toInt() != 303 || &iter.value() != &values[101])
+		return false;
+	ints.empty ();
+	return ints.size () == 0;
+}
+
+/*******************************************************************************
+* Reference implementation of the former chained GenHash, for the
+* benchmark: a fixed number of buckets chosen at construction,
+* one heap node per item, and keys hashed with hashfunc(hashsize).
+*******************************************************************************/
+class ChainedHash {
+	struct Node {
+		const Comparable*	key;
+		Object*				value;
+		Node*				next;
+	};
+	Node**	mBuckets;
+	int		mHashSize;
+
+  public:
+	ChainedHash (int hashsize=64) : mHashSize (hashsize) {
+		mBuckets = new Node* [mHashSize];
+		memset (mBuckets, 0, sizeof(Node*) * mHashSize);
+	}
+
+	~ChainedHash () {
+		for (int i=0; i<mHashSize; i++)
+			while (Node* node = mBuckets[i]) {
+				mBuckets[i] = node->next;
+				delete node->key;
+				delete node->value;
+				delete node;
+			}
+		delete [] mBuckets;
+	}
+
+	void set (const Comparable* key, Object* value) {
+		Node** link = &mBuckets[key->hashfunc (mHashSize)];
+		for (; *link; link = &(*link)->next)
+			if (*(*link)->key == *key) {
+				delete (*link)->value;
+				delete key;
+				(*link)->value = value;
+				return;
+			}
+		Node* node = new Node;
+		node->key = key;
+		node->value = value;
+		node->next = NULL;
+		*link = node;
+	}
+
+	const Object* get (const Comparable& key) const {
+		for (Node* node = mBuckets[key.hashfunc (mHashSize)]; node; node = node->next)
+			if (*node->key == key)
+				return node->value;
+		return NULL;
+	}
+
+	void remove (const Comparable& key) {
+		for (Node** link = &mBuckets[key.hashfunc (mHashSize)]; *link; link = &(*link)->next)
+			if (*(*link)->key == key) {
+				Node* node = *link;
+				*link = node->next;
+				delete node->key;
+				delete node->value;
+				delete node;
+				return;
+			}
+	}
+};
+
+/** Runs insert, lookup and remove over the given number of Int keys,
+ *  and prints the throughput of each in millions of operations per
+ *  second.
+ **/
+template <class HASH>
+static void map_benchmarkOne (const char* name, HASH& hash, int count)
+{
+	double start = benchtime ();
+	for (int i=0; i<count; i++)
+		hash.set (new Int (i*7), new Int (i));
+	double inserted = benchtime ();
+
+	int found = 0;
+	for (int i=0; i<count; i++)
+		if (hash.get (Int (i*7)))
+			found++;
+	double looked = benchtime ();
+
+	for (int i=0; i<count; i++)
+		hash.remove (Int (i*7));
+	double removed = benchtime ();
+
+	ASSERT (found == count);
+	printf ("  %-8s %9d  insert %8.2f  lookup %8.2f  remove %8.2f Mops/s\n",
+			name, count,
+			count / (inserted - start) / 1e6,
+			count / (looked - inserted) / 1e6,
+			count / (removed - looked) / 1e6);
+}
+
+/*******************************************************************************
+* NAME:        map_benchmark
+*
+* DESCRIPTION: Compares GenHash to the former chained implementation,
+*              both created with the old default hash size of 64.
+*
+* RETURNS:     true.
+*******************************************************************************/
+bool map_benchmark ()
+{
+	const int counts[] = {1000, 100000, 10000000};
+
+	for (int c=0; c<3; c++) {
+		GenHash open (64);
+		map_benchmarkOne ("GenHash", open, counts[c]);
+
+		// The chains grow linearly with the item count, so the
+		// largest count would take hours.
+		if (counts[c] <= 100000) {
+			ChainedHash chained (64);
+			map_benchmarkOne ("chained", chained, counts[c]);
+		} else
+			printf ("  %-8s %9d  skipped, quadratic\n", "chained", counts[c]);
+	}
+
+	return true;
+}
+
+/** Builds a StringMap of the given keys and values and destroys it,
+ *  and prints the times and heap allocations of both.
+ **/
+static void map_arenaBenchmarkOne (const char* name, const PackArray<String>& keys,
+								   const PackArray<String>& values, Arena* arena)
+{
+	long allocs = test_allocations ();
+	double start = benchtime ();
+	StringMap* map = arena? new StringMap (*arena) : new StringMap ();
+	for (int i=0; i<keys.size(); i++)
+		map->set (keys[i], values[i]);
+	double built = benchtime ();
+	long buildAllocs = test_allocations () - allocs;
+	ASSERT (map->gethash()->size() == keys.size() && (*map)[keys[1234]] == values[1234]);
+
+	delete map;
+	if (arena)
+		arena->release ();
+	double destroyed = benchtime ();
+
+	printf ("  %-6s %8d items  build %7.3f s  destroy %7.3f s  total %7.3f s  %8ld heap allocations\n",
+			name, keys.size(), built - start, destroyed - built, destroyed - start,
+			(allocs < 0)? -1 : buildAllocs);
+}
+
+/*******************************************************************************
+* NAME:        map_arenaBenchmark
+*
+* DESCRIPTION: Builds and destroys a 1M-entry StringMap with its items
+*              on the heap, in a new Arena and in a released one.
+*
+* RETURNS:     true.
+*******************************************************************************/
+bool map_arenaBenchmark ()
+{
+	const int count = 1000000;
+	PackArray<String> keys, values;
+	keys.reserve (count);
+	values.reserve (count);
+	for (int i=0; i<count; i++) {
+		keys.add (String ("section%1.key.number%2").arg (i % 100).arg (i));
+		values.add (String ("a value of item %1").arg (i));
+	}
+
+	// The first build in the arena touches new memory, the second
+	// reuses the released blocks
+	Arena arena;
+	for (int pass=0; pass<2; pass++) {
+		map_arenaBenchmarkOne ("heap", keys, values, NULL);
+		map_arenaBenchmarkOne (pass? "reused" : "arena", keys, values, &arena);
+	}
+	return true;
+}
+
+/*******************************************************************************
+* NAME:        map_readBenchmark
+*
+* DESCRIPTION: Parses a 1 GB key=value file with readStringMap, both
+*              mapped and through a File stream.
+*
+* RETURNS:     true if both give the same map.
+*******************************************************************************/
+bool map_readBenchmark ()
+{
+	const char* filename = "/tmp/maptest-bench.txt";
+	const long bytes = 1024L*1024*1024;
+	{
+		// Keys repeat, so that the map stays small and the time goes
+		// to parsing
+		BufferedFile out (filename, IO_Writable);
+		String line;
+		for (long written = 0, i = 0; written < bytes; i++) {
+			if (i % 1000 == 0)
+				line = String ("[section%1]\n").arg (int (i/1000 % 50));
+			else if (i % 100 == 0)
+				line = "# a comment line between the pairs\n";
+			else
+				line = String ("key%1 = value number %2 of the map\n").arg (int (i % 100000)).arg (int (i));
+			out.IODevice::writeBlock (line);
+			written += line.length ();
+		}
+	}
+
+	double start = benchtime ();
+	StringMap mapped = readStringMap (String (filename));
+	double mapLoad = benchtime ();
+	TextIStream in (new File (filename));
+	StringMap streamed = readStringMap (in);
+	double fileLoad = benchtime ();
+
+	printf ("  MMapFile %7.3f s %7.1f MB/s   File %7.3f s %7.1f MB/s   %d keys\n",
+			mapLoad-start, bytes/(mapLoad-start)/1e6,
+			fileLoad-mapLoad, bytes/(fileLoad-mapLoad)/1e6, mapped.gethash()->size());
+
+	File (filename).remove ();
+	return mapped.gethash()->size() == streamed.gethash()->size()
+		&& mapped["section7.key7001"] == streamed["section7.key7001"];
+}
+
+/*******************************************************************************
+* NAME:        map_orderedBenchmark
+*
+* DESCRIPTION: Compares OrderedMap to Map with 1M String keys: inserting
+*              in random order, looking up every key, scanning ranges of
+*              1000 keys, and iterating all the keys in order, which a
+*              Map can do only by sorting them.
+*
+* RETURNS:     true.
+*******************************************************************************/
+bool map_orderedBenchmark ()
+{
+	const int count = 1000000;
+	PackArray<String> keys;
+	keys.reserve (count);
+	for (int i=0; i<count; i++) {
+		int k = int ((i * 2654435761U) % count);
+		keys.add (String ("section%1.key%2").arg (k % 100).arg (k));
+	}
+
+	double start = benchtime ();
+	StringMap hash (count, MAP_NONE);
+	for (int i=0; i<count; i++)
+		hash.set (keys[i], keys[i]);
+	double hashInsert = benchtime () - start;
+
+	start = benchtime ();
+	OrderedMap<String,String> ordered;
+	for (int i=0; i<count; i++)
+		ordered.set (keys[i], keys[i]);
+	double orderedInsert = benchtime () - start;
+
+	int found = 0;
+	start = benchtime ();
+	for (int i=0; i<count; i++)
+		if (hash.getp (keys[count-1-i]))
+			found++;
+	double hashLookup = benchtime () - start;
+	start = benchtime ();
+	for (int i=0; i<count; i++)
+		if (ordered.getp (keys[count-1-i]))
+			found++;
+	double orderedLookup = benchtime () - start;
+
+	// Ranges of 1000 keys; the Map has to go through all its items
+	// for each
+	const int ranges = 1000, hashRanges = 10;
+	long scanned = 0;
+	start = benchtime ();
+	for (int r=0; r<ranges; r++) {
+		OrderedMapIter<String,String> iter (ordered);
+		iter.seek (keys[r]);
+		for (int n=0; n<1000 && !iter.exhausted(); n++, iter.next())
+			scanned += iter.value().length ();
+	}
+	double orderedRange = (benchtime () - start) / ranges;
+	start = benchtime ();
+	for (int r=0; r<hashRanges; r++) {
+		String end = String ("section%1.key%2").arg (r).arg (count);
+		forStringMap (hash, iter)
+			if (iter.key().compare (keys[r]) >= 0 && iter.key().compare (end) < 0)
+				scanned += iter.value().length ();
+	}
+	double hashRange = (benchtime () - start) / hashRanges;
+
+	// All the keys in order
+	start = benchtime ();
+	const String** sorted = new const String* [count];
+	int n = 0;
+	forStringMap (hash, iter)
+		sorted[n++] = &iter.key ();
+	qsort (sorted, n, sizeof (const String*), compareComparable);
+	double hashSorted = benchtime () - start;
+	start = benchtime ();
+	n = 0;
+	for (OrderedMapIter<String,String> iter (ordered); !iter.exhausted(); iter.next())
+		if (sorted[n++]->compare (iter.key ()) != 0)
+			found = -1;
+	double orderedSorted = benchtime () - start;
+	delete [] sorted;
+
+	printf ("  %d keys, seconds     Map   OrderedMap\n", count);
+	printf ("  insert            %7.3f  %7.3f\n", hashInsert, orderedInsert);
+	printf ("  lookup            %7.3f  %7.3f\n", hashLookup, orderedLookup);
+	printf ("  range of 1000     %7.5f  %7.5f\n", hashRange, orderedRange);
+	printf ("  in order          %7.3f  %7.3f\n", hashSorted, orderedSorted);
+	return found == 2*count && scanned > 0;
+}
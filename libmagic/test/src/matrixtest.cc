@@ -12,13 +12,245 @@
  *                                                                         *
  ***************************************************************************/
 
-#include "magic/mmatrix.h"
+#include <magic/mmatrix.h>
+#include <magic/mpackarray.h>
+#include <math.h>
+
+#include "tests.h"
 
 using namespace MagiC;
 
+/** Fills the matrix with reproducible pseudo-random values in [-1,1). */
+static void matrix_fill (Matrix& m, int seed)
+{
+	unsigned int state = seed * 2654435761u + 1;
+	for (int i=0; i<m.rows; i++)
+		for (int j=0; j<m.cols; j++) {
+			state = state * 1103515245 + 12345;
+			m.get (i, j) = (state >> 8) / double (1 << 23) - 1.0;
+		}
+}
+
+/** Multiplies the matrices with the textbook triple loop. */
+static void matrix_naiveProduct (Matrix& c, const Matrix& a, const Matrix& b)
+{
+	c.make (a.rows, b.cols);
+	for (int i=0; i<a.rows; i++)
+		for (int k=0; k<a.cols; k++) {
+			double aik = a.get (i, k);
+			for (int j=0; j<b.cols; j++)
+				c.get (i, j) += aik * b.get (k, j);
+		}
+}
+
+/** Returns the largest absolute difference between two matrices of
+ *  the same dimensions.
+ **/
+static double matrix_maxDiff (const Matrix& a, const Matrix& b)
+{
+	double diff = 0;
+	for (int i=0; i<a.rows; i++)
+		for (int j=0; j<a.cols; j++)
+			if (fabs (a.get (i, j) - b.get (i, j)) > diff)
+				diff = fabs (a.get (i, j) - b.get (i, j));
+	return diff;
+}
+
+/*******************************************************************************
+* NAME:        matrix_basicTests
+*
+* DESCRIPTION: Checks the matrix product against the triple loop for
+*              sizes around the block edges, transposing, determinants
+*              and solving linear equations.
+*
+* RETURNS:     true if successful, false on failure.
+*******************************************************************************/
 bool matrix_basicTests ()
 {
-	Matrix matrix;
+	// Products, also of sizes that do not divide into the blocks
+	const int sizes[][3] = {{1, 1, 1}, {5, 7, 3}, {6, 8, 256}, {13, 300, 17},
+							{121, 9, 1030}, {130, 257, 70}};
+	for (int s=0; s<6; s++) {
+		Matrix a (sizes[s][0], sizes[s][1]), b (sizes[s][1], sizes[s][2]);
+		matrix_fill (a, s);
+		matrix_fill (b, s+100);
+		Matrix c, reference;
+		c.multiply (a, b);
+		matrix_naiveProduct (reference, a, b);
+		if (c.rows != a.rows || c.cols != b.cols || matrix_maxDiff (c, reference) > 1e-12 * a.cols)
+			return false;
+	}
+
+	// Product in place
+	Matrix a (40, 40), b (40, 40), reference;
+	matrix_fill (a, 1);
+	matrix_fill (b, 2);
+	matrix_naiveProduct (reference, a, b);
+	a.multiply (a, b);
+	if (matrix_maxDiff (a, reference) > 1e-12)
+		return false;
+
+	// Transposing square and non-square matrices
+	for (int s=0; s<2; s++) {
+		Matrix m (70, s? 45 : 70);
+		matrix_fill (m, 3);
+		Matrix t = transpose (m);
+		if (t.rows != m.cols || t.cols != m.rows)
+			return false;
+		for (int i=0; i<m.rows; i++)
+			for (int j=0; j<m.cols; j++)
+				if (t.get (j, i) != m.get (i, j))
+					return false;
+	}
+
+	// Determinants
+	double values[] = {2, 0, 1,
+					   1, 3, 2,
+					   1, 1, 2};
+	if (fabs (Matrix (3, 3, values).det () - 6) > 1e-12)
+		return false;
+	double singular[] = {1, 2, 3,
+						 2, 4, 6,
+						 1, 0, 1};
+	if (Matrix (3, 3, singular).det () != 0)
+		return false;
+	double single = -4;
+	if (Matrix (1, 1, &single).det () != -4)
+		return false;
+
+	// A permuted triangular matrix has the product of the diagonal
+	// as its determinant, with the sign of the permutation
+	const int n = 150;
+	Matrix tri (n, n);
+	double expected = 1;
+	for (int i=0; i<n; i++) {
+		for (int j=i; j<n; j++)
+			tri.get (i, j) = (i == j)? 1.0 + (i % 3) * 0.01 : 0.5;
+		expected *= tri.get (i, i);
+	}
+	tri.swaprows (0, n-1);
+	if (fabs (tri.det () + expected) > 1e-9 * fabs (expected))
+		return false;
+
+	// Linear equations
+	Matrix m (n, n);
+	matrix_fill (m, 4);
+	Vector x (n), bv (n), solution;
+	for (int i=0; i<n; i++)
+		x[i] = i - n/2;
+	for (int i=0; i<n; i++)
+		for (int j=0; j<n; j++)
+			bv[i] += m.get (i, j) * x[j];
+	if (solveLinear (m, bv, solution) != 0 || solution.size () != n)
+		return false;
+	for (int i=0; i<n; i++)
+		if (fabs (solution[i] - x[i]) > 1e-8)
+			return false;
+	if (solveLinear (Matrix (3, 3, singular), Vector (3), solution) == 0)
+		return false;
+
 	return true;
 }
 
+/*******************************************************************************
+* NAME:        matrix_kernelTests
+*
+* DESCRIPTION: Checks the product of each kernel the processor supports
+*              against the triple loop, also through the LU
+*              decomposition.
+*
+* RETURNS:     true if successful, false on failure.
+*******************************************************************************/
+bool matrix_kernelTests ()
+{
+	int original = matrixKernel ();
+	if (setMatrixKernel (-1) || setMatrixKernel (MATRIXKERNEL_SETS) || matrixKernel () != original)
+		return false;
+	if (!setMatrixKernel (MATRIXKERNEL_SCALAR) || matrixKernel () != MATRIXKERNEL_SCALAR)
+		return false;
+
+	const int sizes[][3] = {{1, 1, 1}, {7, 9, 5}, {6, 8, 256}, {125, 17, 1030}, {130, 257, 70}};
+	bool ok = true;
+	for (int set=MATRIXKERNEL_SCALAR; set<MATRIXKERNEL_SETS && ok; set++) {
+		if (!setMatrixKernel (set)) {
+			printf ("  kernel %d not supported ", set);
+			continue;
+		}
+
+		for (int s=0; s<5 && ok; s++) {
+			Matrix a (sizes[s][0], sizes[s][1]), b (sizes[s][1], sizes[s][2]);
+			matrix_fill (a, s+set);
+			matrix_fill (b, s+200);
+			Matrix c, reference;
+			c.multiply (a, b);
+			matrix_naiveProduct (reference, a, b);
+			ok = matrix_maxDiff (c, reference) <= 1e-12 * a.cols;
+		}
+
+		// The trailing updates of the LU decomposition
+		const int n = 150;
+		Matrix m (n, n);
+		matrix_fill (m, 5+set);
+		Vector x (n), bv (n), solution;
+		for (int i=0; i<n; i++)
+			x[i] = i % 7 - 3;
+		for (int i=0; i<n; i++)
+			for (int j=0; j<n; j++)
+				bv[i] += m.get (i, j) * x[j];
+		if (ok)
+			ok = solveLinear (m, bv, solution) == 0;
+		for (int i=0; i<n && ok; i++)
+			ok = fabs (solution[i] - x[i]) <= 1e-8;
+	}
+
+	setMatrixKernel (original);
+	return ok;
+}
+
+/*******************************************************************************
+* NAME:        matrix_benchmark
+*
+* DESCRIPTION: Reports the GFLOP/s of the matrix product, the LU-based
+*              determinant and transposing for square matrices, and of
+*              the triple-loop product for comparison.
+*
+* RETURNS:     true.
+*******************************************************************************/
+bool matrix_benchmark ()
+{
+	for (int n=64; n<=2048; n*=2) {
+		Matrix a (n, n), b (n, n), c;
+		matrix_fill (a, 1);
+		matrix_fill (b, 2);
+		double flops = 2.0 * n * n * n;
+
+		// Repeat the small sizes to get measurable times
+		int repeats = (n < 256)? 256*256*256 / (n*n*n) : 1;
+
+		double start = benchtime ();
+		for (int r=0; r<repeats; r++)
+			c.multiply (a, b);
+		double multiplied = benchtime ();
+		for (int r=0; r<repeats; r++)
+			a.det ();
+		double lu = benchtime ();
+		for (int r=0; r<repeats; r++)
+			a.transpose ();
+		double transposed = benchtime ();
+
+		printf ("  %5d  multiply %6.2f GFLOP/s  det %6.2f GFLOP/s  transpose %7.3f ms",
+				n, flops * repeats / (multiplied - start) / 1e9,
+				flops / 3 * repeats / (lu - multiplied) / 1e9,
+				(transposed - lu) / repeats * 1e3);
+
+		if (n <= 512) {
+			Matrix reference;
+			start = benchtime ();
+			matrix_naiveProduct (reference, a, b);
+			printf ("  triple loop %6.2f GFLOP/s", flops / (benchtime () - start) / 1e9);
+		}
+		printf ("\n");
+	}
+
+	return true;
+}
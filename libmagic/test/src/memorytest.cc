@@ -0,0 +1,415 @@
+/***************************************************************************
+ *   This file is part of the MagiC++ library.                             *
+ *                                                                         *
+ *   Copyright (C) 1998-2005 Marko Grnroos <magi@iki.fi>                  *
+ *                                                                         *
+ ***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#include <magic/mobject.h>
+#include <magic/mclass.h>
+#include <magic/mthread.h>
+#include <magic/mworkqueue.h>
+#include <sched.h>
+
+#include "tests.h"
+
+using namespace MagiC;
+
+/** Thread that allocates blocks of mixed sizes and deletes them in
+ *  the order they were allocated, keeping 64 alive.
+ **/
+class AllocThread : public Thread {
+  public:
+	AllocThread (int count) : mCount (count) {}
+
+	virtual void* execute () {
+		char* blocks [64];
+		memset (blocks, 0, sizeof (blocks));
+		for (int i=0; i<mCount; i++) {
+			delete [] blocks[i % 64];
+			blocks[i % 64] = new char [16 + (i * 37) % 240];
+		}
+		for (int i=0; i<64; i++)
+			delete [] blocks[i];
+		return NULL;
+	}
+
+  private:
+	int		mCount;
+};
+
+/** Runs the given number of allocating threads, and returns the time
+ *  taken per allocation, in nanoseconds.
+ **/
+static double memory_allocRun (int threads, int count)
+{
+	AllocThread* pThreads [16];
+	double start = benchtime ();
+	for (int i=0; i<threads; i++) {
+		pThreads[i] = new AllocThread (count);
+		pThreads[i]->start ();
+	}
+	for (int i=0; i<threads; i++) {
+		pThreads[i]->join ();
+		delete pThreads[i];
+	}
+	return (benchtime () - start) / count * 1e9;
+}
+
+#ifndef DISABLE_ALL_MEMORY_DEBUGGING
+
+/** Object of its own class, for the per-class counters. */
+class LedgerTestObject : public Object {
+	decl_dynamic (LedgerTestObject);
+  public:
+	char	mPayload [40];
+};
+
+impl_dynamic (LedgerTestObject, {Object});
+
+/** Derived object that allocates objects, and has one as a member,
+ *  while it is constructed.
+ **/
+class LedgerTestOwner : public LedgerTestObject {
+	decl_dynamic (LedgerTestOwner);
+  public:
+	LedgerTestOwner () {mpOther = new LedgerTestObject ();}
+	~LedgerTestOwner () {delete mpOther;}
+
+	LedgerTestObject	mMember;
+	LedgerTestObject*	mpOther;
+};
+
+impl_dynamic (LedgerTestOwner, {LedgerTestObject});
+
+/** Thread that keeps constructing and deleting objects until told
+ *  to stop.
+ **/
+class LedgerConstructor : public Thread {
+  public:
+	LedgerConstructor () : mStop (0) {}
+
+	virtual void* execute () {
+		while (!__atomic_load_n (&mStop, __ATOMIC_RELAXED))
+			delete new LedgerTestOwner ();
+		return NULL;
+	}
+
+	int		mStop;
+};
+
+/** Thread that allocates blocks and hands them through a queue to
+ *  another thread, which deletes them.
+ **/
+class LedgerProducer : public Thread {
+  public:
+	LedgerProducer (BoundedQueue<char>& queue, int count) : mrQueue (queue), mCount (count) {}
+
+	virtual void* execute () {
+		for (int i=0; i<mCount; i++) {
+			char* block = new char [16 + i % 64];
+			while (!mrQueue.push (block))
+				sched_yield ();
+		}
+		return NULL;
+	}
+
+  private:
+	BoundedQueue<char>&	mrQueue;
+	int					mCount;
+};
+
+/** Thread that allocates a commented block and keeps running, and so
+ *  keeps its own ledger, until released.
+ **/
+class LedgerKeeper : public Thread {
+  public:
+	LedgerKeeper (const char* comment) : mpComment (comment), mpBlock (NULL) {}
+
+	virtual void* execute () {
+		newComment (mpComment);
+		mpBlock = new char [100];
+		mReady.post ();
+		mRelease.wait ();
+		return NULL;
+	}
+
+	const char*	mpComment;
+	char*		mpBlock;
+	Semaphore	mReady;
+	Semaphore	mRelease;
+};
+
+/** Returns the output of list_allocations. */
+static String memory_listing ()
+{
+	String listing;
+	FILE* out = tmpfile ();
+	list_allocations (0, out);
+	fseek (out, 0, SEEK_SET);
+	char buffer [4096];
+	size_t bytes;
+	while ((bytes = fread (buffer, 1, sizeof (buffer), out)) > 0)
+		listing.append (buffer, bytes);
+	fclose (out);
+	return listing;
+}
+
+#ifdef DEBUG_OBJECT_NEW
+/** Returns the class line of list_allocations for the test objects. */
+static String memory_classLine (int objects, const char* name = "LedgerTestObject",
+								size_t size = sizeof (LedgerTestObject))
+{
+	char line [200];
+	sprintf (line, "%12ld bytes in %9ld objects of %s\n",
+			 (long) (objects * size), (long) objects, name);
+	return line;
+}
+#endif
+
+#endif
+
+/*******************************************************************************
+* NAME:        memory_ledgerTests
+*
+* DESCRIPTION: Checks the per-thread allocation ledgers of MEMORY_DEBUG:
+*              blocks deleted in another thread while their own thread
+*              allocates more, the listing of the blocks of all
+*              threads, and, with DEBUG_OBJECT_NEW, the per-class
+*              counters that objects are bound to when constructed.
+*
+* RETURNS:     true if successful, false on failure.
+*******************************************************************************/
+bool memory_ledgerTests ()
+{
+#ifdef DISABLE_ALL_MEMORY_DEBUGGING
+	printf ("  not compiled with MEMORY_DEBUG\n");
+	return true;
+#else
+	int disabled = newtrace_disabled;
+	newtrace_disabled = 0;
+	bool ok = true;
+	long before = dbgnewmalloced;
+
+	// Blocks deleted in another thread, while the thread that made
+	// them keeps allocating. Those left on the remote free stack of
+	// its ledger are released when the ledgers are listed.
+	{
+		const int count = 100000;
+		BoundedQueue<char> queue (256);
+		LedgerProducer producer (queue, count);
+		producer.start ();
+		for (int deleted = 0; deleted < count; ) {
+			char* block = queue.pull ();
+			if (block) {
+				delete [] block;
+				deleted++;
+			} else
+				sched_yield ();
+		}
+		producer.join ();
+	}
+	memory_listing ();
+	ok = ok && dbgnewmalloced == before;
+
+	// The blocks of all threads are listed together
+	{
+		LedgerKeeper first ("first keeper"), second ("second keeper");
+		first.start ();
+		second.start ();
+		first.mReady.wait ();
+		second.mReady.wait ();
+		newComment ("main thread");
+		char* mine = new char [100];
+		{
+			String listing = memory_listing ();
+			ok = ok && listing.find ("\"first keeper\"") >= 0 && listing.find ("\"second keeper\"") >= 0
+				&& listing.find ("\"main thread\"") >= 0;
+		}
+		first.mRelease.post ();
+		second.mRelease.post ();
+		first.join ();
+		second.join ();
+		delete [] mine;
+		delete [] first.mpBlock;
+		delete [] second.mpBlock;
+	}
+	memory_listing ();
+	ok = ok && dbgnewmalloced == before;
+
+#ifdef DEBUG_OBJECT_NEW
+	// Objects are counted for their class when constructed, and
+	// uncounted when deleted
+	{
+		LedgerTestObject* objects [10];
+		for (int i=0; i<10; i++)
+			objects[i] = new LedgerTestObject ();
+		ok = ok && memory_listing ().find (memory_classLine (10)) >= 0;
+		for (int i=0; i<5; i++)
+			delete objects[i];
+		ok = ok && memory_listing ().find (memory_classLine (5)) >= 0;
+
+		// Copies are counted too
+		LedgerTestObject* copy = new LedgerTestObject (*objects[5]);
+		ok = ok && memory_listing ().find (memory_classLine (6)) >= 0;
+		delete copy;
+
+		for (int i=5; i<10; i++)
+			delete objects[i];
+		ok = ok && memory_listing ().find ("objects of LedgerTestObject") < 0;
+	}
+
+	// A derived object is counted for its own class, and neither its
+	// member nor the objects it allocates are counted for it
+	{
+		LedgerTestOwner* owner = new LedgerTestOwner ();
+		String listing = memory_listing ();
+		ok = ok && listing.find (memory_classLine (1, "LedgerTestOwner", sizeof (LedgerTestOwner))) >= 0
+			&& listing.find (memory_classLine (1)) >= 0;
+		delete owner;
+	}
+
+	// Listing while another thread constructs objects
+	{
+		LedgerConstructor constructor;
+		constructor.start ();
+		for (int i=0; i<200; i++)
+			memory_listing ();
+		__atomic_store_n (&constructor.mStop, 1, __ATOMIC_RELAXED);
+		constructor.join ();
+		String listing = memory_listing ();
+		ok = ok && listing.find ("objects of LedgerTestObject") < 0
+			&& listing.find ("objects of LedgerTestOwner") < 0;
+	}
+#else
+	printf ("  per-class counters need DEBUG_OBJECT_NEW\n");
+#endif
+
+	newtrace_disabled = disabled;
+	return ok;
+#endif
+}
+
+#ifdef OBJECT_POOL
+
+/** Object of a size that the other tests do not allocate. */
+class PoolTestObject : public Object {
+  public:
+	char	mPayload [220];
+};
+
+/** Thread that deletes or allocates the given number of objects. It
+ *  makes no other pooled objects.
+ **/
+class PoolThread : public Thread {
+  public:
+	PoolThread (PoolTestObject** objects, int count, bool deletes)
+			: mpObjects (objects), mCount (count), mDeletes (deletes) {}
+
+	virtual void* execute () {
+		for (int i=0; i<mCount; i++)
+			if (mDeletes)
+				delete mpObjects[i];
+			else
+				mpObjects[i] = new PoolTestObject ();
+		return NULL;
+	}
+
+  private:
+	PoolTestObject**	mpObjects;
+	int					mCount;
+	bool				mDeletes;
+};
+
+#endif
+
+/*******************************************************************************
+* NAME:        memory_poolTests
+*
+* DESCRIPTION: Checks that the Objects that a thread deletes, but did
+*              not allocate, are handed to the other threads of the
+*              pool when the deleting thread exits.
+*
+* RETURNS:     true if successful, false on failure.
+*******************************************************************************/
+bool memory_poolTests ()
+{
+#ifndef OBJECT_POOL
+	printf ("  the Object pool is not in use\n");
+	return true;
+#else
+	const int count = 300;
+	PoolTestObject* objects [count];
+	for (int i=0; i<count; i++)
+		objects[i] = new PoolTestObject ();
+
+	// A thread that only deletes objects
+	PoolThread deleter (objects, count, true);
+	deleter.start ();
+	deleter.join ();
+
+	// A new thread gets the same objects, from the depot
+	const int reused = 200;
+	PoolTestObject* again [reused];
+	PoolThread allocator (again, reused, false);
+	allocator.start ();
+	allocator.join ();
+
+	bool ok = true;
+	for (int i=0; i<reused; i++) {
+		bool found = false;
+		for (int j=0; j<count && !found; j++)
+			found = (again[i] == objects[j]);
+		ok = ok && found;
+		delete again[i];
+	}
+	return ok;
+#endif
+}
+
+/*******************************************************************************
+* NAME:        memory_ledgerBenchmark
+*
+* DESCRIPTION: Measures the time of an allocation and deletion in 1 and
+*              4 threads. With MEMORY_DEBUG, compares tracing off,
+*              tracing without stack samples, and tracing with the
+*              default sampling; otherwise measures the plain
+*              allocator, for comparison with a MEMORY_DEBUG build.
+*
+* RETURNS:     true.
+*******************************************************************************/
+bool memory_ledgerBenchmark ()
+{
+	const int count = 2000000;
+	const int threads [] = {1, 4};
+
+#ifdef DISABLE_ALL_MEMORY_DEBUGGING
+	for (int t=0; t<2; t++)
+		printf ("  %d threads: plain new %6.1f ns/op (build with MEMORY_DEBUG to compare tracing)\n",
+				threads[t], memory_allocRun (threads[t], count));
+#else
+	int disabled = newtrace_disabled;
+	long sampling = newtrace_sampling;
+	for (int t=0; t<2; t++) {
+		newtrace_disabled = 1;
+		double off = memory_allocRun (threads[t], count);
+		newtrace_disabled = 0;
+		newtrace_sampling = -1;
+		double traced = memory_allocRun (threads[t], count);
+		newtrace_sampling = sampling;
+		double sampled = memory_allocRun (threads[t], count);
+		newtrace_disabled = disabled;
+
+		printf ("  %d threads: untraced %6.1f ns/op, traced %6.1f ns/op (%+5.1f%%), sampled %6.1f ns/op (%+5.1f%%)\n",
+				threads[t], off, traced, (traced / off - 1) * 100, sampled, (sampled / off - 1) * 100);
+	}
+#endif
+	return true;
+}
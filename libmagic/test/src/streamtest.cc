@@ -14,7 +14,13 @@
 
 #include <magic/mstring.h>
 #include <magic/mtextstream.h>
+#include <magic/mdatastream.h>
+#include <magic/mbufferedfile.h>
+#include <magic/mmatrix.h>
 #include <math.h>
+#include <limits.h>
+
+#include "tests.h"
 
 using namespace MagiC;
 
@@ -137,3 +143,224 @@ bool stream_stringStream ()
 
 	return true;
 }
+
+/*******************************************************************************
+* NAME:        stream_dataStream
+*
+* DESCRIPTION: Writes values of all types to a binary DataOStream,
+*              checks the bytes of the portable encoding, and reads
+*              the values back with a DataIStream.
+*
+* RETURNS:     true if successful, false on failure.
+*******************************************************************************/
+bool stream_dataStream ()
+{
+	const char* filename = "/tmp/datastream.bin";
+
+	// The encoding does not depend on the host
+	{
+		BufferedFile file (filename, IO_Writable);
+		DataOStream out (file, DataOStream::FMT_BINARY);
+		out << 300 << -1L << 1.0 << String ("ab");
+	}
+	{
+		const unsigned char expected[] = {0xd8, 0x04, 0x01, 0, 0, 0, 0, 0, 0, 0xf0, 0x3f, 2, 'a', 'b'};
+		unsigned char bytes [32];
+		BufferedFile file (filename, IO_Readable);
+		if (file.readBlock ((char*) bytes, sizeof(bytes)) != sizeof(expected)
+			|| memcmp (bytes, expected, sizeof(expected)))
+			return false;
+	}
+
+	// Values of all types, strings longer than the buffer, and arrays
+	String big;
+	for (int i=0; i<200000; i++)
+		big += char ('a' + i % 26);
+	PackArray<double> doubles;
+	for (int i=0; i<100000; i++)
+		doubles.add (i * 0.25 - 1000);
+	PackArray<int> ints;
+	for (int i=-500; i<500; i++)
+		ints.add (i * 1000003);
+	Matrix matrix (3, 4);
+	for (int i=0; i<3; i++)
+		for (int j=0; j<4; j++)
+			matrix.get (i, j) = i * 10 + j + 0.5;
+
+	{
+		BufferedFile file (filename, IO_Writable);
+		DataOStream out (file, DataOStream::FMT_BINARY);
+		out << 'x' << 0 << INT_MIN << INT_MAX << LONG_MIN << LONG_MAX << 1.5f << -2.25e100;
+		out << big << String () << "plain";
+		out.writeArray (doubles);
+		out.writeArray (ints);
+		out << matrix;
+		out.writeRawBytes ("raw", 3);
+		out << (long) (1L << 40);
+	}
+
+	BufferedFile file (filename, IO_Readable);
+	DataIStream in (file);
+	char c;
+	int i0, imin, imax;
+	long lmin, lmax;
+	float f;
+	double d;
+	in >> c >> i0 >> imin >> imax >> lmin >> lmax >> f >> d;
+	if (c != 'x' || i0 != 0 || imin != INT_MIN || imax != INT_MAX
+		|| lmin != LONG_MIN || lmax != LONG_MAX || f != 1.5f || d != -2.25e100)
+		return false;
+
+	String s1, s2, s3;
+	in >> s1 >> s2 >> s3;
+	if (s1 != big || !s2.isEmpty () || s3 != "plain")
+		return false;
+
+	PackArray<double> doublesIn;
+	PackArray<int> intsIn;
+	Matrix matrixIn;
+	in.readArray (doublesIn);
+	in.readArray (intsIn);
+	in >> matrixIn;
+	if (doublesIn.size () != doubles.size () || intsIn.size () != ints.size ()
+		|| memcmp (&doublesIn[0], &doubles[0], doubles.size () * sizeof(double))
+		|| memcmp (&intsIn[0], &ints[0], ints.size () * sizeof(int))
+		|| matrixIn.rows != 3 || matrixIn.cols != 4 || matrixIn.get (2, 3) != 23.5)
+		return false;
+
+	char raw [3];
+	in.readRawBytes (raw, 3);
+	if (strncmp (raw, "raw", 3))
+		return false;
+
+	// A value that does not fit is an error, as is the end of the data
+	try {
+		in >> i0;
+		if (sizeof(long) > sizeof(int))
+			return false;
+	} catch (io_error& e) {
+	}
+	try {
+		in >> c;
+		return false;
+	} catch (io_error& e) {
+	}
+
+	file.close ();
+	return File (filename).remove () == false;
+}
+
+/*******************************************************************************
+* NAME:        stream_dataBenchmark
+*
+* DESCRIPTION: Measures binary serialization throughput of integers,
+*              doubles and strings, and of a bulk array, compared to
+*              the former format of one sizeof(long) device write per
+*              value.
+*
+* RETURNS:     true if the values read back match.
+*******************************************************************************/
+bool stream_dataBenchmark ()
+{
+	const char* filename = "/tmp/datastream-bench.bin";
+	const int count = 10000000;
+
+	// Former format: host-endian longs, one write to the device each
+	double start = benchtime ();
+	{
+		File file (filename, IO_Writable);
+		for (long i=0; i<count; i++) {
+			long value = i * 7 - count;
+			file.writeBlock ((char*) &value, sizeof(value));
+		}
+		file.close ();
+	}
+	double written = benchtime ();
+	long sum = 0;
+	{
+		File file (filename, IO_Readable);
+		long value;
+		for (int i=0; i<count; i++) {
+			file.readBlock ((char*) &value, sizeof(value));
+			sum += value;
+		}
+	}
+	double read = benchtime ();
+	long bytes = count * sizeof(long);
+	printf ("  former ints    write %7.1f Mvalues/s  read %7.1f Mvalues/s  %6.1f MB\n",
+			count / (written-start) / 1e6, count / (read-written) / 1e6, bytes / 1e6);
+
+	// Integers
+	start = benchtime ();
+	{
+		BufferedFile file (filename, IO_Writable);
+		DataOStream out (file, DataOStream::FMT_BINARY);
+		for (int i=0; i<count; i++)
+			out << i * 7 - count;
+	}
+	written = benchtime ();
+	long sum2 = 0;
+	{
+		BufferedFile file (filename, IO_Readable);
+		DataIStream in (file);
+		int value;
+		for (int i=0; i<count; i++) {
+			in >> value;
+			sum2 += value;
+		}
+	}
+	read = benchtime ();
+	bytes = BufferedFile (filename).size ();
+	printf ("  varint ints    write %7.1f Mvalues/s  read %7.1f Mvalues/s  %6.1f MB\n",
+			count / (written-start) / 1e6, count / (read-written) / 1e6, bytes / 1e6);
+
+	// Doubles and strings
+	start = benchtime ();
+	{
+		BufferedFile file (filename, IO_Writable);
+		DataOStream out (file, DataOStream::FMT_BINARY);
+		String str = "a string of some length";
+		for (int i=0; i<count/10; i++)
+			out << i * 0.5 << str;
+	}
+	written = benchtime ();
+	double dsum = 0;
+	{
+		BufferedFile file (filename, IO_Readable);
+		DataIStream in (file);
+		double value;
+		String str;
+		for (int i=0; i<count/10; i++) {
+			in >> value >> str;
+			dsum += value + str.length ();
+		}
+	}
+	read = benchtime ();
+	bytes = BufferedFile (filename).size ();
+	printf ("  double+string  write %7.1f MB/s       read %7.1f MB/s\n",
+			bytes / (written-start) / 1e6, bytes / (read-written) / 1e6);
+
+	// Bulk array
+	PackArray<double> array (count);
+	for (int i=0; i<count; i++)
+		array[i] = i;
+	start = benchtime ();
+	{
+		BufferedFile file (filename, IO_Writable);
+		DataOStream out (file, DataOStream::FMT_BINARY);
+		out.writeArray (array);
+	}
+	written = benchtime ();
+	{
+		BufferedFile file (filename, IO_Readable);
+		DataIStream in (file);
+		in.readArray (array);
+	}
+	read = benchtime ();
+	bytes = count * sizeof(double);
+	printf ("  double array   write %7.1f MB/s       read %7.1f MB/s\n",
+			bytes / (written-start) / 1e6, bytes / (read-written) / 1e6);
+
+	File (filename).remove ();
+	return sum == sum2 && array[count-1] == count-1 && dsum > 0;
+}
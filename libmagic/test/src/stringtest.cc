@@ -13,8 +13,58 @@
  ***************************************************************************/
 
 #include "magic/mstring.h"
+#include "magic/mpackarray.h"
+#include "magic/mmap.h"
+#include "magic/mregexp.h"
+#include "magic/mstrkernel.h"
+#include "magic/mnumconv.h"
+#include "magic/mtextstream.h"
+
+#include <float.h>
+#include <limits.h>
+#include <math.h>
+
+#include <new>
+
+#include "tests.h"
+
 using namespace MagiC;
 
+#ifdef DISABLE_ALL_MEMORY_DEBUGGING
+// Without memory debugging, the library leaves the global allocation
+// operators alone, so the test program counts the allocations with
+// its own.
+static __thread long allocations = 0;
+
+#if __cplusplus >= 201103L
+#define THROW_BAD_ALLOC
+#else
+#define THROW_BAD_ALLOC throw (std::bad_alloc)
+#endif
+
+void* operator new (size_t size) THROW_BAD_ALLOC {
+	allocations++;
+	void* p = malloc (size? size : 1);
+	if (!p)
+		throw std::bad_alloc ();
+	return p;
+}
+void* operator new[] (size_t size) THROW_BAD_ALLOC {return operator new (size);}
+void operator delete (void* p) throw () {free (p);}
+void operator delete[] (void* p) throw () {free (p);}
+
+/** Returns the number of allocations the calling thread has made with
+ *  new, or -1 if they are not counted.
+ **/
+long test_allocations () {
+	return allocations;
+}
+#else
+long test_allocations () {
+	return -1;
+}
+#endif
+
 bool string_basicTests ()
 {
 	String str1;
@@ -45,6 +95,68 @@ bool string_basicTests ()
 	return true;
 }
 
+/*******************************************************************************
+* NAME:        string_hashTests
+*
+* DESCRIPTION: Checks that equal strings hash equally, and that
+*              modifying or shortening a string invalidates its cached
+*              hash value.
+*
+* RETURNS:     true if successful, false on failure.
+*******************************************************************************/
+bool string_hashTests ()
+{
+	String a = "section.key00042";
+	String b = "section.key00043";
+	if (a.hashvalue() == b.hashvalue())
+		return false;
+
+	// Copies and separately built strings hash equally
+	String c = a;
+	String d = "section.";
+	d += "key00042";
+	if (c.hashvalue() != a.hashvalue() || d.hashvalue() != a.hashvalue())
+		return false;
+
+	// Modification resets the cached value
+	uint before = a.hashvalue ();
+	a[15] = '3';
+	if (a.hashvalue() != b.hashvalue() || a.hashvalue() == before)
+		return false;
+	a.upper ();
+	if (a.hashvalue() == b.hashvalue())
+		return false;
+
+	// Map keys are found after each kind of shortening
+	StringMap map;
+	map.set ("abc", "short");
+	map.set ("", "empty");
+	String key = "abcdefghij";
+	key.hashvalue ();
+	key.reserve (3);
+	if (!map.hasKey (key) || map[key] != "short")
+		return false;
+	key = "abcdefghij";
+	key.hashvalue ();
+	key.dellast (7);
+	if (!map.hasKey (key))
+		return false;
+	key.hashvalue ();
+	key.empty ();
+	if (!map.hasKey (key) || map[key] != "empty")
+		return false;
+	key = "abcdefghij";
+	key.hashvalue ();
+	String source = "   ";
+	TextIStream in (new Buffer (source));
+	in >> key;
+	if (!map.hasKey (key))
+		return false;
+
+	// Hash sizes above 256 are allowed
+	return a.hashfunc (100003) < 100003;
+}
+
 bool string_arg ()
 {
 	cout << "'"
@@ -57,3 +169,1141 @@ bool string_arg ()
 
 	return true;
 }
+
+
+/** The former String::hashfunc: sums at most three characters into
+ *  8 bits. Kept for comparison in the benchmark.
+ **/
+static uint string_oldHash (const String& str)
+{
+	int len = str.length ();
+	if (!len)
+		return 0;
+	int sum = 0;
+	if (len < 10)
+		for (int i=0; i<len; i++)
+			sum += str[i];
+	else
+		sum = int(str[0]) + int(str[len/2]) + len*int(str[len-1]);
+	return (unsigned char) (sum % 256);
+}
+
+/** Prints the number of distinct hash values, and the longest chain
+ *  when the keys are spread into 65536 slots by the hash value.
+ **/
+static void string_hashCollisions (const char* name, const Array<String>& keys)
+{
+	const uint slots = 65536;
+	PackArray<int> oldLoad (slots), newLoad (slots);
+	for (uint i=0; i<slots; i++)
+		oldLoad[i] = newLoad[i] = 0;
+
+	for (int i=0; i<keys.size(); i++) {
+		oldLoad[string_oldHash (keys[i]) % slots]++;
+		newLoad[keys[i].hashvalue () % slots]++;
+	}
+
+	int oldDistinct=0, oldMax=0, newDistinct=0, newMax=0;
+	for (uint i=0; i<slots; i++) {
+		oldDistinct += oldLoad[i]? 1:0;
+		newDistinct += newLoad[i]? 1:0;
+		oldMax = (oldLoad[i]>oldMax)? oldLoad[i] : oldMax;
+		newMax = (newLoad[i]>newMax)? newLoad[i] : newMax;
+	}
+
+	printf ("  %-22s %7d keys  old: %5d slots, longest %6d  new: %5d slots, longest %3d\n",
+			name, keys.size(), oldDistinct, oldMax, newDistinct, newMax);
+}
+
+/*******************************************************************************
+* NAME:        string_hashBenchmark
+*
+* DESCRIPTION: Compares the collisions of the former 8-bit string hash
+*              and the current one over typical key sets, and measures
+*              the hashing throughput at various string lengths.
+*
+* RETURNS:     true.
+*******************************************************************************/
+bool string_hashBenchmark ()
+{
+	const int count = 100000;
+
+	// StringMap keys read with readStringMap
+	Array<String> keys (count);
+	for (int i=0; i<count; i++)
+		keys.put (new String (strformat ("section.key%05d", i)), i);
+	string_hashCollisions ("section.keyNNNNN", keys);
+
+	// File paths
+	for (int i=0; i<count; i++)
+		keys.put (new String (strformat ("/usr/share/doc/package-%d/README", i)), i);
+	string_hashCollisions ("file paths", keys);
+
+	// Short identifiers
+	for (int i=0; i<count; i++)
+		keys.put (new String (strformat ("v%x", i*2654435761U)), i);
+	string_hashCollisions ("hex identifiers", keys);
+
+	// Throughput of hashbytes over different lengths
+	const int lengths[] = {16, 64, 1024, 65536};
+	for (int l=0; l<4; l++) {
+		String data;
+		for (int i=0; i<lengths[l]; i++)
+			data += char('a' + i%26);
+
+		int rounds = 256*1024*1024 / lengths[l];
+		uint sum = 0;
+		double start = benchtime ();
+		for (int i=0; i<rounds; i++) {
+			data[0] = char('a' + i%26); // Defeats caching, and gives distinct inputs
+			sum += data.hashvalue ();
+		}
+		double secs = benchtime () - start;
+		printf ("  hashvalue %6d bytes: %8.1f MB/s, %7.1f Mhash/s (%x)\n",
+				lengths[l], rounds*double(lengths[l])/secs/1e6, rounds/secs/1e6, sum);
+	}
+
+	// Map with StringMap-style keys, now that hashes are full-width
+	StringMap map;
+	double start = benchtime ();
+	for (int i=0; i<count; i++)
+		map.set (strformat ("section.key%05d", i), "value");
+	int found = 0;
+	for (int i=0; i<count; i++)
+		if (map.getp (strformat ("section.key%05d", i)))
+			found++;
+	printf ("  StringMap %d keys set+get: %.3f s\n", count, benchtime () - start);
+
+	return found == count;
+}
+
+
+
+/*******************************************************************************
+* NAME:        string_splitTests
+*
+* DESCRIPTION: Splits into Array and PackArray, including empty items,
+*              and splits key-value pairs into a StringMap.
+*
+* RETURNS:     true if successful, false on failure.
+*******************************************************************************/
+bool string_splitTests ()
+{
+	String line = "alpha,,beta,gamma";
+
+	Array<String> arr;
+	line.split (arr, ',');
+	if (arr.size () != 4 || arr[0] != "alpha" || arr[1] != "" || arr[3] != "gamma")
+		return false;
+
+	PackArray<String> pack;
+	line.split (pack, ',');
+	if (pack.size () != 4 || pack[0] != "alpha" || pack[1].length () != 0 || pack[3] != "gamma")
+		return false;
+
+	// A trailing delimiter gives an empty last item
+	String ("a b ").split (pack);
+	if (pack.size () != 3 || pack[1] != "b" || pack[2].length () != 0)
+		return false;
+	String ().split (pack);
+	if (pack.size () != 0)
+		return false;
+
+	StringMap map;
+	splitpairs (map, "a=1&b=two&c=");
+	return map.gethash()->size() == 3 && map["b"] == "two" && map["a"] == "1";
+}
+
+/** The former String::split: copies the string, and allocates each
+ *  item separately. Kept for comparison in the benchmark.
+ **/
+static void string_oldSplit (const String& str, Array<String>& trg, const char delim)
+{
+	int len = str.length ();
+	char* tmp = new char [len+1];
+	memcpy (tmp, (const char*) str, len+1);
+
+	int delimcount = 0;
+	for (int i=0; i<len; i++)
+		if (tmp[i]==delim) {
+			tmp[i]=0;
+			delimcount++;
+		}
+
+	trg.make (delimcount+1);
+	for (int pos = 0, i=0; pos<len; pos+=strlen (tmp+pos)+1, i++)
+		trg.put (new String (tmp+pos), i);
+
+	delete [] tmp;
+}
+
+/*******************************************************************************
+* NAME:        string_splitBenchmark
+*
+* DESCRIPTION: Splits about 100 MB of CSV lines with the former split,
+*              the current Array split and the PackArray split, and
+*              measures appending to an Array one item at a time.
+*
+* RETURNS:     true.
+*******************************************************************************/
+bool string_splitBenchmark ()
+{
+	// Lines of thirteen fields, about 100 MB in all
+	const int lines = 1130000;
+	PackArray<String> csv;
+	csv.reserve (lines);
+	int bytes = 0;
+	for (int i=0; i<lines; i++) {
+		csv.add (strformat ("%d,%s,%d.%02d,2002-%02d-%02d,%x,%s,%d,,%d,%s,%d,end",
+							i, "customer name", i%1000, i%100, i%12+1, i%28+1,
+							i*2654435761U, "some,quoted text", i%7, i*3,
+							"status", i%2));
+		bytes += csv[i].length ()+1;
+	}
+
+	int fields = 0;
+	double start = benchtime ();
+	for (int i=0; i<lines; i++) {
+		Array<String> items;
+		string_oldSplit (csv[i], items, ',');
+		fields += items.size ();
+	}
+	double secs = benchtime () - start;
+	printf ("  former split     %6.1f MB: %6.3f s, %6.1f MB/s\n",
+			bytes/1e6, secs, bytes/secs/1e6);
+
+	start = benchtime ();
+	for (int i=0; i<lines; i++) {
+		Array<String> items;
+		csv[i].split (items, ',');
+		fields -= items.size ();
+	}
+	secs = benchtime () - start;
+	printf ("  Array split      %6.1f MB: %6.3f s, %6.1f MB/s\n",
+			bytes/1e6, secs, bytes/secs/1e6);
+
+	// The items of the previous line are reused
+	PackArray<String> items;
+	start = benchtime ();
+	for (int i=0; i<lines; i++) {
+		csv[i].split (items, ',');
+		fields += items.size ();
+	}
+	secs = benchtime () - start;
+	printf ("  PackArray split  %6.1f MB: %6.3f s, %6.1f MB/s\n",
+			bytes/1e6, secs, bytes/secs/1e6);
+
+	// Appending one item at a time used to reallocate every time
+	const int count = 10000000;
+	Array<Int> arr;
+	arr.isRef (true);
+	start = benchtime ();
+	Int dummy (0);
+	for (int i=0; i<count; i++)
+		arr.add (&dummy);
+	printf ("  Array add %d items: %.3f s\n", count, benchtime () - start);
+
+	return fields == lines*13;
+}
+
+/*******************************************************************************
+* NAME:        string_inlineTests
+*
+* DESCRIPTION: Checks that short strings are stored without allocation,
+*              and the moves between the inline and allocated storage,
+*              also when the source of an operation is the string
+*              itself.
+*
+* RETURNS:     true if successful, false on failure.
+*******************************************************************************/
+bool string_inlineTests ()
+{
+	// Short strings and their copies do not allocate, when that can be
+	// measured
+	long before = test_allocations ();
+	String shortstr = "fifteen chars!!";
+	String copy = shortstr;
+	String number (-1234567890);
+	String sub = String ("key = value").mid (6);
+	String formatted = String ("%1.%2").arg ("a").arg (42);
+	String joined = shortstr.left (3) + "." + number.right (3);
+	if (before >= 0 && test_allocations () != before)
+		return false;
+	if (copy != "fifteen chars!!" || number != "-1234567890" || sub != "value"
+		|| formatted != "a.42" || joined != "fif.890" || shortstr.maxLength () != STRING_INLINE_LENGTH)
+		return false;
+
+	// Null and empty strings
+	String null, empty ("");
+	if (!null.isNull () || empty.isNull () || !empty.isEmpty ())
+		return false;
+	null = "";
+	if (!null.isNull ())
+		return false;
+
+	// Growing beyond the inline buffer and shrinking back
+	String grown;
+	for (int i=0; i<100; i++)
+		grown += char ('a' + i % 26);
+	if (grown.length () != 100 || grown.right (4) != "stuv" || grown.maxLength () < 100)
+		return false;
+	grown.reserve (5);
+	if (grown != "abcde" || grown.maxLength () != STRING_INLINE_LENGTH)
+		return false;
+
+	// Appending and assigning the string to itself
+	String self = "abc";
+	self += self;
+	self.append (self);
+	self += self;
+	if (self != "abcabcabcabcabcabcabcabc")
+		return false;
+	self = self.getbuffer () + 21;
+	if (self != "abc")
+		return false;
+
+	// Moved in memory by a packed array as it grows
+	PackArray<String> items;
+	for (int i=0; i<1000; i++)
+		items.add (String (i));
+	for (int i=0; i<1000; i++)
+		if (items[i].toInt () != i)
+			return false;
+
+#if __cplusplus >= 201103L
+	// Moving takes the buffer
+	String large = "a string longer than the inline buffer";
+	const char* buffer = large;
+	String moved (static_cast<String&&> (large));
+	if ((const char*) moved != buffer || !large.isNull ())
+		return false;
+	large = static_cast<String&&> (moved);
+	if ((const char*) large != buffer || !moved.isNull ())
+		return false;
+#endif
+
+	// Concatenation chains
+	String section = "a-long-section-name";
+	String key = section + "." + "key" + String (7);
+	if (key != "a-long-section-name.key7")
+		return false;
+
+	// Whitespace and formatting
+	if (String ("\t  two   words \n").simplifyWhiteSpace () != "two words"
+		|| !String ("   ").simplifyWhiteSpace ().isEmpty ()
+		|| String ("abcabc").find ('a', 1) != 3 || String ("abc").find ('a', 5) != -1)
+		return false;
+	String longformat = strformat ("%s%s%s", (CONSTR) grown, (CONSTR) section, (CONSTR) String (100, 10));
+	if (strformat ("%0100d", 1).length () != 100 || longformat != "abcdea-long-section-name100")
+		return false;
+
+	return true;
+}
+
+/*******************************************************************************
+* NAME:        string_viewTests
+*
+* DESCRIPTION: Searches, splits, matches and converts SubString views,
+*              and looks up Map keys with them, without allocating.
+*
+* RETURNS:     true if successful, false on failure.
+*******************************************************************************/
+bool string_viewTests ()
+{
+	String line = "  server.port = 8080 ; timeout=2.5e1  ";
+	RegExp keyExpr ("^([a-z.]+) *= *([0-9]+)$");
+	StringMap map;
+	map.set ("server.port", "old");
+
+	// Only the arrays allocate, and they keep their capacity
+	PackArray<SubString> fields (4), pair (4), matches (4);
+	long before = test_allocations ();
+	line.split (fields, ';');
+	if (fields.size () != 2)
+		return false;
+	SubString first = fields[0].stripWhiteSpace ();
+	SubString second = fields[1].stripWhiteSpace ();
+
+	// Searching
+	if (first.find (SubString ("port", 4)) != 7 || first.find (SubString ("port", 4), 8) != -1
+		|| first.find (SubString ()) != 0 || second.find (SubString ("2.5e1", 5)) != 8
+		|| line.find (second) != 23 || first.find (SubString ("8080!", 5)) != -1)
+		return false;
+
+	// Regular expressions see only the view
+	if (!first.regmatch (keyExpr, matches) || matches.size () != 3
+		|| matches[1] != "server.port" || matches[2] != "8080"
+		|| second.regmatch (keyExpr) || !first.left (18).regmatch (keyExpr)
+		|| first.left (14).regmatch (keyExpr, matches))
+		return false;
+
+	// Conversions stop at the end of the view
+	second.split (pair, '=');
+	if (matches[2].toInt () != 8080 || first.right (3).toLong () != 80
+		|| pair[1].toDouble () != 25.0 || SubString ("123456", 3).toInt () != 123)
+		return false;
+
+	// Map lookups hash the view like a String
+	if (matches[1].hashvalue () != String ("server.port").hashvalue ()
+		|| !map.hasKey (matches[1]) || map.hasKey (matches[1].left (6))
+		|| *map.getp (matches[1]) != "old")
+		return false;
+	*map.getvp (matches[1]) = "new";
+	if (map["server.port"] != "new")
+		return false;
+	if (before >= 0 && test_allocations () != before)
+		return false;
+
+	// Views longer than the conversion buffer
+	String longnumber = String ("0000000000000000000000000000000000000000000000000000000000000000017");
+	if (SubString (longnumber).toInt () != 17 || SubString (longnumber).toDouble () != 17.0)
+		return false;
+
+	// Old String searches go through the views
+	if (String ("abcabc").find ("ca") != 2 || String ("abc").find ("abcd") != -1
+		|| String ("abc").find ("", 3) != 3 || String ("abc").find ("c", 4) != -1)
+		return false;
+
+	return true;
+}
+
+/** Prints the allocations and time per operation of a benchmark. */
+static void string_printAllocs (const char* name, int count, long allocs, double secs)
+{
+	if (test_allocations () < 0)
+		printf ("  %-28s   not counted with MEMORY_DEBUG  %7.1f ns/op\n", name, secs / count * 1e9);
+	else
+		printf ("  %-28s %6.2f allocations/op  %7.1f ns/op\n",
+			name, double (allocs) / count, secs / count * 1e9);
+}
+
+/*******************************************************************************
+* NAME:        string_allocBenchmark
+*
+* DESCRIPTION: Counts the allocations made by common string operations,
+*              those of readStringMap and splitpairs among them.
+*
+* RETURNS:     true.
+*******************************************************************************/
+bool string_allocBenchmark ()
+{
+	const int count = 500000;
+	String line = "1042,customer name,42.17,2002-07-21,3e8f21,open,3,,3126,status,1,end";
+	String section = "database";
+	int total = 0;
+
+	PackArray<String> packed;
+	long allocs = test_allocations ();
+	double start = benchtime ();
+	for (int i=0; i<count; i++) {
+		line.split (packed, ',');
+		total += packed.size ();
+	}
+	string_printAllocs ("split to PackArray", count, test_allocations () - allocs, benchtime () - start);
+
+	allocs = test_allocations ();
+	start = benchtime ();
+	for (int i=0; i<count; i++) {
+		Array<String> items;
+		line.split (items, ',');
+		total += items.size ();
+	}
+	string_printAllocs ("split to Array", count, test_allocations () - allocs, benchtime () - start);
+
+	allocs = test_allocations ();
+	start = benchtime ();
+	for (int i=0; i<count; i++) {
+		String result = String ("%1.key%2=%3").arg (section).arg (i).arg (i * 0.5);
+		total += result.length ();
+	}
+	string_printAllocs ("arg", count, test_allocations () - allocs, benchtime () - start);
+
+	allocs = test_allocations ();
+	start = benchtime ();
+	for (int i=0; i<count; i++) {
+		String key = section + "." + packed[1] + "." + packed[5];
+		total += key.length ();
+	}
+	string_printAllocs ("operator+ chain", count, test_allocations () - allocs, benchtime () - start);
+
+	// The key-value handling of readStringMap
+	allocs = test_allocations ();
+	start = benchtime ();
+	for (int i=0; i<count; i++) {
+		String("  timeout = 30 ").split (packed, '=');
+		String key   = packed[0].stripWhiteSpace ();
+		String value = packed[1].stripWhiteSpace ();
+		key = section + "." + key;
+		total += key.length () + value.length ();
+	}
+	string_printAllocs ("readStringMap line", count, test_allocations () - allocs, benchtime () - start);
+
+	// The same with views, as readStringMap now does it
+	PackArray<SubString> views;
+	String fullKey;
+	String viewLine = "  timeout = 30 ";
+	allocs = test_allocations ();
+	start = benchtime ();
+	for (int i=0; i<count; i++) {
+		viewLine.split (views, '=');
+		SubString key   = views[0].stripWhiteSpace ();
+		SubString value = views[1].stripWhiteSpace ();
+		fullKey = section;
+		fullKey.append ('.');
+		fullKey.append (key.data (), key.length ());
+		total += fullKey.length () + value.length ();
+	}
+	string_printAllocs ("readStringMap line, views", count, test_allocations () - allocs, benchtime () - start);
+
+	StringMap map;
+	allocs = test_allocations ();
+	start = benchtime ();
+	for (int i=0; i<count/10; i++) {
+		splitpairs (map, "name=value&id=42&mode=edit&page=3&lang=fi");
+		total += map.gethash ()->size ();
+	}
+	string_printAllocs ("splitpairs, 5 pairs", count/10, test_allocations () - allocs, benchtime () - start);
+
+	return total > 0;
+}
+
+
+
+/*******************************************************************************
+* NAME:        string_kernelTests
+*
+* DESCRIPTION: Runs each available set of string kernels over random
+*              data of many lengths and alignments, and compares them
+*              to the scalar kernels. Then checks the String methods
+*              that use them.
+*
+* RETURNS:     true if successful, false on failure.
+*******************************************************************************/
+bool string_kernelTests ()
+{
+	const StringKernels* scalar = stringKernels (STRKERNEL_SCALAR);
+	const char alphabet[] = "aab \t\n\v\f\r,;xyzAZ\344\304";
+	const int lengths[] = {0, 1, 2, 15, 16, 17, 31, 32, 33, 63, 64, 65, 100, 1000, 4099};
+	char data [4099+8];
+	char folded [2][4099+8];
+	srand (42);
+
+	for (int set=STRKERNEL_SCALAR+1; set<STRKERNEL_SETS; set++) {
+		const StringKernels* kernels = stringKernels (set);
+		if (!kernels)
+			continue;
+
+		for (int l=0; l<int (sizeof (lengths)/sizeof (int)); l++)
+			for (int offset=0; offset<4; offset++)
+				for (int round=0; round<20; round++) {
+					uint len = lengths[l];
+					char* text = data+offset;
+					for (uint i=0; i<len; i++)
+						text[i] = alphabet [rand () % (sizeof (alphabet)-1)];
+
+					// Runs of whitespace at either end
+					if (round % 4 == 1)
+						for (uint i=0; i<len/2; i++)
+							text[i] = " \t\n"[i%3];
+					if (round % 4 == 2)
+						for (uint i=len/2; i<len; i++)
+							text[i] = " \r\v"[i%3];
+
+					// Needles from the text, and some that are rarely found
+					char needle [8];
+					uint nlen = rand () % 6;
+					if (round % 2 && len > nlen)
+						memcpy (needle, text + rand () % (len-nlen+1), nlen);
+					else
+						for (uint i=0; i<nlen; i++)
+							needle[i] = alphabet [rand () % (sizeof (alphabet)-1)];
+
+					if (kernels->find (text, len, needle, nlen) != scalar->find (text, len, needle, nlen)
+						|| kernels->findRev (text, len, needle, nlen) != scalar->findRev (text, len, needle, nlen)
+						|| kernels->findAny (text, len, ",;", 2) != scalar->findAny (text, len, ",;", 2)
+						|| kernels->findAny (text, len, needle, nlen) != scalar->findAny (text, len, needle, nlen)
+						|| kernels->findSpace (text, len) != scalar->findSpace (text, len)
+						|| kernels->skipSpace (text, len) != scalar->skipSpace (text, len)
+						|| kernels->trimSpace (text, len) != scalar->trimSpace (text, len)) {
+						printf ("%s kernels differ, length %d, offset %d\n", kernels->name, len, offset);
+						return false;
+					}
+
+					for (int upper=0; upper<2; upper++) {
+						memcpy (folded[0], text, len);
+						memcpy (folded[1], text, len);
+						(upper? kernels->upper : kernels->lower) (folded[0], len);
+						(upper? scalar->upper : scalar->lower) (folded[1], len);
+						if (memcmp (folded[0], folded[1], len))
+							return false;
+					}
+				}
+	}
+
+	// String methods on the kernels
+	String text = " \v key = value ;\tother=\f ";
+	if (text.stripWhiteSpace () != "key = value ;\tother="
+		|| text.simplifyWhiteSpace () != "key = value ;\tother="
+		|| String ("a  b\t\t\tc\n").simplifyWhiteSpace () != "a b\tc"
+		|| text.find ("value") != 9 || text.find ("value", 10) != -1
+		|| text.findRev ("e") != 20 || text.findRev ("e", 12) != 4
+		|| text.findRev (" \v") != 0 || text.findRev ("zz") != -1
+		|| String ("a/b/c").findRev ("/") != 3)
+		return false;
+
+	PackArray<SubString> fields;
+	text.split (fields, "=;");
+	if (fields.size () != 4 || fields[0].stripWhiteSpace () != "key"
+		|| fields[2] != "\tother" || fields[3] != "\f ")
+		return false;
+	String ("a,b,").split (fields, ",;");
+	if (fields.size () != 3 || fields[2].length () != 0)
+		return false;
+
+	String mixed = "Hyv\344\344 P\344iv\344\344 and a long enough tail for vectors 0123456789";
+	mixed.upper ();
+	if (mixed.find ("HYV") != 0 || mixed.find ("VECTORS 0123") == -1)
+		return false;
+	mixed.lower ();
+	if (mixed.find ("hyv") != 0 || mixed.find ("p") != 6)
+		return false;
+
+	text = "line with trailing space \t\r\n";
+	text.chop ();
+	return text == "line with trailing space";
+}
+
+/*******************************************************************************
+* NAME:        string_kernelBenchmark
+*
+* DESCRIPTION: Measures each available set of string kernels at 16 B,
+*              1 KB and 1 MB inputs.
+*
+* RETURNS:     true if all the sets agree.
+*******************************************************************************/
+bool string_kernelBenchmark ()
+{
+	const uint sizes[] = {16, 1024, 1024*1024};
+	const char* names[] = {"find", "findRev", "findAny", "skipSpace", "trimSpace", "upper"};
+	bool agree = true;
+
+	for (int s=0; s<3; s++) {
+		uint len = sizes[s];
+
+		// Text without the needle, delimiters or whitespace, which all
+		// come only at the end
+		char* text = new char [len];
+		for (uint i=0; i<len; i++)
+			text[i] = "abcdefghijklmnopqrstuvwxyz"[(i*7) % 26];
+		char* spaces = new char [len];
+		memset (spaces, ' ', len);
+		spaces [len-1] = 'x';
+		char* trailing = new char [len];
+		memset (trailing, '\t', len);
+		trailing [0] = 'x';
+		const char* needle = "needle";
+		memcpy (text+len-6, needle, 6);
+		text [len-7] = ',';
+
+		long rounds = 1024L*1024*1024 / len;
+		printf ("  %7d bytes:", len);
+		for (int k=0; k<6; k++)
+			printf (" %9s", names[k]);
+		printf ("  (GB/s)\n");
+
+		for (int set=STRKERNEL_SCALAR; set<STRKERNEL_SETS; set++) {
+			const StringKernels* kernels = stringKernels (set);
+			if (!kernels)
+				continue;
+
+			printf ("  %13s", kernels->name);
+			long check [6] = {0, 0, 0, 0, 0, 0};
+			for (int k=0; k<6; k++) {
+				double start = benchtime ();
+				for (long r=0; r<rounds; r++)
+					switch (k) {
+					  case 0: check[k] += kernels->find (text, len, needle, 6) - text; break;
+					  case 1: check[k] += kernels->findRev (text, len-6, needle, 6) == NULL; break;
+					  case 2: check[k] += kernels->findAny (text, len, ",;", 2) - text; break;
+					  case 3: check[k] += kernels->skipSpace (spaces, len) - spaces; break;
+					  case 4: check[k] += kernels->trimSpace (trailing, len); break;
+					  case 5: kernels->upper (text, len-7); kernels->lower (text, len-7); check[k] += text[0]; break;
+					}
+				double secs = benchtime () - start;
+				printf (" %9.2f", rounds * double (len) * (k==5? 2 : 1) / secs / 1e9);
+			}
+			printf ("\n");
+
+			static long expected [6];
+			if (set == STRKERNEL_SCALAR)
+				memcpy (expected, check, sizeof (check));
+			else if (memcmp (expected, check, sizeof (check)))
+				agree = false;
+		}
+
+		delete [] text;
+		delete [] spaces;
+		delete [] trailing;
+	}
+
+	return agree;
+}
+
+
+
+/** Returns reproducible pseudo-random 64 bits (xorshift64). */
+static uint64_t string_random64 (uint64_t& state)
+{
+	state ^= state << 13;
+	state ^= state >> 7;
+	state ^= state << 17;
+	return state;
+}
+
+/** Returns a reproducible pseudo-random finite double: arbitrary bit
+ *  patterns, short decimals and values over the whole exponent range.
+ **/
+static double string_randomDouble (uint64_t& state)
+{
+	uint64_t bits = string_random64 (state);
+	double value;
+	switch (bits % 3) {
+	  case 0:
+		  memcpy (&value, &bits, sizeof (value));
+		  if (value != value || value - value != 0)
+			  value = 1.0;
+		  return value;
+	  case 1:
+		  return double (string_random64 (state) % 1000000) / (1 + string_random64 (state) % 1000);
+	  default:
+		  return ldexp (double (string_random64 (state) >> 11), int (string_random64 (state) % 2040) - 1100);
+	}
+}
+
+/*******************************************************************************
+* NAME:        string_numberTests
+*
+* DESCRIPTION: Checks the numeric conversions against the C library:
+*              doubles are printed with the fewest digits that read
+*              back exactly, %g matches printf, parsing rounds like
+*              strtod(), and the String and TextIStream conversions
+*              use them.
+*
+* RETURNS:     true if successful, false on failure.
+*******************************************************************************/
+bool string_numberTests ()
+{
+	uint64_t state = 88172645463325252ULL;
+	char buffer [NUMCONV_DOUBLE_BUFFER+1];
+	char expected [64];
+
+	for (int i=0; i<300000; i++) {
+		double value = string_randomDouble (state);
+
+		// Shortest representation reads back exactly
+		int len = formatDouble (buffer, value);
+		buffer [len] = '\0';
+		if (strtod (buffer, NULL) != value) {
+			printf ("%.17g printed as %s\n", value, buffer);
+			return false;
+		}
+
+		// ...and no shorter one would
+		if (i % 10 == 0) {
+			int digits = 0, shortest = 17;
+			for (const char* c = buffer; *c && *c != 'e'; c++)
+				if (isdigit (*c) && (digits || *c != '0'))
+					digits++;
+			if (!strchr (buffer, 'e') && !strchr (buffer, '.'))
+				for (const char* c = buffer+len-1; c > buffer && *c == '0'; c--)
+					digits--;
+			for (int p=1; p<17; p++) {
+				snprintf (expected, sizeof (expected), "%.*e", p-1, value);
+				if (strtod (expected, NULL) == value) {
+					shortest = p;
+					break;
+				}
+			}
+			if (digits > shortest) {
+				printf ("%s is not the shortest form of %.17g\n", buffer, value);
+				return false;
+			}
+		}
+
+		// Parsing is exact, both for the shortest form and for others
+		double parsed;
+		if (parseDouble (buffer, buffer+len, parsed) != buffer+len || parsed != value)
+			return false;
+		snprintf (expected, sizeof (expected), "%.*e", i % 20, value);
+		if (parseDouble (expected, expected+strlen (expected), parsed) == expected
+			|| parsed != strtod (expected, NULL)) {
+			printf ("%s parsed as %.17g\n", expected, parsed);
+			return false;
+		}
+
+		// %g with a precision, with or without the fallback to printf
+		int precision = 1 + i % 15;
+		snprintf (expected, sizeof (expected), "%.*g", precision, value);
+		if (String (value, 'g', precision) != expected)
+			return false;
+		len = formatDouble (buffer, value, precision);
+		if (len >= 0 && String (buffer, len) != expected)
+			return false;
+	}
+
+	// Special and boundary values
+	const double specials[] = {0.0, -0.0, 1.0, -1.0, 0.1, 1e21, 1e22, 1e23, 5e-324, DBL_MIN, DBL_MAX,
+							   HUGE_VAL, -HUGE_VAL, 9007199254740993.0, 123456.0, 1e16, 1e-5, 1e-4};
+	const char* printed[] = {"0", "-0", "1", "-1", "0.1", "1e+21", "1e+22", "1e+23", "5e-324",
+							 "2.2250738585072014e-308", "1.7976931348623157e+308", "inf", "-inf", "9007199254740992",
+							 "123456", "10000000000000000", "1e-05", "0.0001"};
+	for (int i=0; i<int (sizeof (specials)/sizeof (double)); i++)
+		if (String (buffer, formatDouble (buffer, specials[i])) != printed[i])
+			return false;
+
+	const char* inputs[] = {"1e400", "-1e400", "1e-400", "2.4703282292062327e-324", "2.4703282292062328e-324",
+							"1.7976931348623158e308", "1.7976931348623159e308", "9007199254740993", "42.", ".5",
+							"-.5e-1", "123456789012345678901234567890", "0.000000000000000000000000000000000001",
+							"2.2250738585072011e-308", "7.2057594037927933e16", "1e-7x", "+3"};
+	for (int i=0; i<int (sizeof (inputs)/sizeof (char*)); i++) {
+		double parsed;
+		const char* end = inputs[i] + strlen (inputs[i]);
+		const char* stop = parseDouble (inputs[i], end, parsed);
+		if (parsed != strtod (inputs[i], NULL) || (stop != end && *stop != 'x'))
+			return false;
+	}
+
+	// Integers
+	const long longs[] = {0, 1, -1, 9, 10, -99, 100, 12345678, LONG_MAX, LONG_MIN, INT_MAX, INT_MIN};
+	for (int i=0; i<int (sizeof (longs)/sizeof (long)); i++) {
+		snprintf (expected, sizeof (expected), "%ld", longs[i]);
+		long parsed = 0;
+		int len = formatLong (buffer, longs[i]);
+		if (String (buffer, len) != expected || String (longs[i]) != expected
+			|| parseLong (buffer, buffer+len, parsed) != buffer+len || parsed != longs[i])
+			return false;
+	}
+	if (String (buffer, formatULong (buffer, ULONG_MAX)) != "18446744073709551615"
+		|| String (4000000000U) != "4000000000" || String (INT_MIN) != "-2147483648"
+		|| String (255, 16) != "ff" || String (-255L, 16) != "-ff")
+		return false;
+
+	// String and view conversions behave like atol() and atof()
+	const char* texts[] = {"  42", "\t-17.25e2xyz", "99999999999999999999", "-99999999999999999999",
+						   "0x1p4", "inf", "-nan", "abc", "", "1e", "  .5", "0.1", "12,5"};
+	for (int i=0; i<int (sizeof (texts)/sizeof (char*)); i++) {
+		String text (texts[i]);
+		double d = text.toDouble ();
+		double ad = atof (texts[i]);
+		if (text.toLong () != atol (texts[i]) || SubString (text).toLong () != atol (texts[i])
+			|| (d != ad && !(d != d && ad != ad)) || text.toInt () != (int) atol (texts[i]))
+			return false;
+	}
+	if (String ().toDouble () != 0 || String ().toInt () != 0)
+		return false;
+
+	// Text streams write the shortest form and read it back exactly;
+	// the last value ends the file
+	const char* filename = "/tmp/stringtest-numbers.txt";
+	state = 1;
+	{
+		File file (filename, IO_Writable);
+		TextOStream out (file);
+		for (int i=0; i<1000; i++)
+			out << string_randomDouble (state) << ((i % 2)? "\n" : " \t");
+		out << -1.5e-10;
+		file.close ();
+	}
+	{
+		TextIStream in (new File (filename));
+		state = 1;
+		for (int i=0; i<1000; i++) {
+			double value = 0;
+			in >> value;
+			if (value != string_randomDouble (state))
+				return false;
+		}
+		double last = 0;
+		in >> last;
+		if (last != -1.5e-10)
+			return false;
+	}
+	File (filename).remove ();
+
+	return true;
+}
+
+/*******************************************************************************
+* NAME:        string_numberBenchmark
+*
+* DESCRIPTION: Converts 100 million integers and doubles each way, and
+*              10 million with the C library for comparison.
+*
+* RETURNS:     true if the conversions agree with the C library.
+*******************************************************************************/
+bool string_numberBenchmark ()
+{
+	const int count = 1000000;
+	const int rounds = 100;
+	const int libcRounds = 10;
+
+	// Doubles with varying lengths and exponents, and integers of
+	// varying lengths
+	uint64_t state = 88172645463325252ULL;
+	double* doubles = new double [count];
+	long* longs = new long [count];
+	for (int i=0; i<count; i++) {
+		doubles[i] = string_randomDouble (state);
+		longs[i] = long (string_random64 (state) >> (string_random64 (state) % 64));
+		if (i % 2)
+			longs[i] = -longs[i];
+	}
+
+	char* doubleTexts = new char [count * NUMCONV_DOUBLE_BUFFER];
+	char* longTexts = new char [count * NUMCONV_LONG_BUFFER];
+	bool agree = true;
+
+	printf ("  %8s %10s %10s %10s %10s  (Mconv/s)\n", "", "format", "printf", "parse", "strto*");
+
+	for (int type=0; type<2; type++) {
+		double times [4];
+		long check = 0, libcCheck = 0;
+
+		// Formatting
+		double start = benchtime ();
+		for (int r=0; r<rounds; r++)
+			for (int i=0; i<count; i++) {
+				char* text = (type? doubleTexts + i*NUMCONV_DOUBLE_BUFFER : longTexts + i*NUMCONV_LONG_BUFFER);
+				int len = type? formatDouble (text, doubles[i]) : formatLong (text, longs[i]);
+				text [len] = '\0';
+				check += len;
+			}
+		times[0] = benchtime () - start;
+
+		char libcText [64];
+		start = benchtime ();
+		for (int r=0; r<libcRounds; r++)
+			for (int i=0; i<count; i++)
+				libcCheck += type? snprintf (libcText, sizeof (libcText), "%.17g", doubles[i])
+					: snprintf (libcText, sizeof (libcText), "%ld", longs[i]);
+		times[1] = benchtime () - start;
+
+		// Parsing
+		start = benchtime ();
+		for (int r=0; r<rounds; r++)
+			for (int i=0; i<count; i++) {
+				if (type) {
+					const char* text = doubleTexts + i*NUMCONV_DOUBLE_BUFFER;
+					double value;
+					parseDouble (text, text + strlen (text), value);
+					check += value > 0;
+				} else {
+					const char* text = longTexts + i*NUMCONV_LONG_BUFFER;
+					long value;
+					parseLong (text, text + strlen (text), value);
+					check += value > 0;
+				}
+			}
+		times[2] = benchtime () - start;
+
+		start = benchtime ();
+		for (int r=0; r<libcRounds; r++)
+			for (int i=0; i<count; i++)
+				if (type)
+					libcCheck += strtod (doubleTexts + i*NUMCONV_DOUBLE_BUFFER, NULL) > 0;
+				else
+					libcCheck += strtol (longTexts + i*NUMCONV_LONG_BUFFER, NULL, 10) > 0;
+		times[3] = benchtime () - start;
+
+		printf ("  %8s %10.1f %10.1f %10.1f %10.1f\n", type? "double" : "long",
+				rounds * double (count) / times[0] / 1e6, libcRounds * double (count) / times[1] / 1e6,
+				rounds * double (count) / times[2] / 1e6, libcRounds * double (count) / times[3] / 1e6);
+
+		// Every text reads back to the original value
+		for (int i=0; i<count; i++)
+			if (type) {
+				const char* text = doubleTexts + i*NUMCONV_DOUBLE_BUFFER;
+				double value;
+				parseDouble (text, text + strlen (text), value);
+				agree = agree && value == doubles[i] && strtod (text, NULL) == doubles[i];
+			} else {
+				const char* text = longTexts + i*NUMCONV_LONG_BUFFER;
+				long value;
+				parseLong (text, text + strlen (text), value);
+				agree = agree && value == longs[i] && strtol (text, NULL, 10) == longs[i];
+			}
+		agree = agree && check > 0 && libcCheck > 0;
+	}
+
+	delete [] doubles;
+	delete [] longs;
+	delete [] doubleTexts;
+	delete [] longTexts;
+	return agree;
+}
+
+
+
+#if __cplusplus >= 201103L
+/** Formats with both strformat() and snprintf(), and compares. */
+#define string_checkFormat(...) \
+	do { \
+		snprintf (expected, sizeof (expected), __VA_ARGS__); \
+		if (strformat (__VA_ARGS__) != expected) { \
+			printf ("'%s' differs from '%s'\n", (CONSTR) strformat (__VA_ARGS__), expected); \
+			return false; \
+		} \
+	} while (0)
+#endif
+
+/*******************************************************************************
+* NAME:        string_formatTests
+*
+* DESCRIPTION: Compares the type-safe strformat() to snprintf(), checks
+*              how it shows values that do not suit the conversion, and
+*              that String::args() fills placeholders like chained
+*              arg() calls.
+*
+* RETURNS:     true if successful, false on failure.
+*******************************************************************************/
+bool string_formatTests ()
+{
+#if __cplusplus >= 201103L
+	char expected [256];
+	string_checkFormat ("%d %i %u %x %X %o|", 42, -42, 42U, 255, 255U, 8);
+	string_checkFormat ("%5d|%-5d|%05d|%+d|% d|%.3d|%+.0d|%5.3d", 42, 42, -42, 42, 42, 7, 0, -7);
+	string_checkFormat ("%#x %#X %#o %#o %#x", 255, 255, 8, 0, 0);
+	string_checkFormat ("%u %x %hhd %ld %lu %lld %zu", -1, -1, 65, LONG_MIN, ULONG_MAX, LLONG_MAX, (size_t) 7);
+	string_checkFormat ("%s|%10s|%-10s|%.2s|%c|%3c|%-3c|", "abc", "abc", "abc", "abc", 'x', 'y', 'z');
+	string_checkFormat ("%f %.2f %10.3e %-12.4E| %g %G %.3g %#g %+g %08.2f", 3.14159, 2.5, 12345.678,
+						0.000123, 1e-7, 1e20, 2.0/3, 1.0, 5.5, -3.25);
+	string_checkFormat ("%02.2g %g %g %.15g %.0g %a", 9.0, 100000.0, 1e6, 0.1, 0.5, 1.5);
+	string_checkFormat ("%*d|%-*d|%.*f|%*.*s|", 6, 42, 6, 42, 3, 1.0/3, 5, 2, "abcdef");
+	string_checkFormat ("100%% %s %%d", "done");
+	string_checkFormat ("%s %s %d", (CONSTR) String ("String"), "x", INT_MIN);
+	string_checkFormat ("%0100d", 1);
+
+	// Types that do not suit the conversion are shown as they are
+	if (strformat ("%d|%5d|%s|%s|%x|%c|%d", String ("text"), "ab", 42, 2.5, "s", "str", 1.5) != "text|   ab|42|2.5|s|str|1.5"
+		|| strformat ("%s", (const char*) NULL) != "(null)"
+		|| strformat ("%d %s %d", 1, "two") != "1 two %d"
+		|| strformat ("%w %d", 5) != "%w 5"
+		|| strformat ("%5s|%-4s|", 42, 'c') != "   42|c   |"
+		|| strformat ("%d %s", SubString ("abcdef", 3), true) != "abc 1")
+		return false;
+
+	// Appending into reserved capacity does not allocate
+	String line;
+	line.reserve (200);
+	line.appendFormat ("%s: %d items", "warmup", 1);
+	long before = test_allocations ();
+	for (int i=0; i<100; i++) {
+		line.empty ();
+		line.appendFormat ("%04d/%02d/%02d [%s] %s took %.3f ms", 2026, 10, i%31, "worker", String ("request"), i*0.5);
+	}
+	if (before >= 0 && test_allocations () != before)
+		return false;
+	if (line != "2026/10/06 [worker] request took 49.500 ms")
+		return false;
+
+	// Streams
+	String buffer;
+	{
+		TextOStream out (buffer);
+		out.printf ("%s=%d;", "key", 42).printf ("%5.1f|", 2.25);
+	}
+	if (buffer != "key=42;  2.2|")
+		return false;
+
+	// Placeholders in the same order as chained arg() calls
+	const char* patterns[] = {"%1 %2 %3", "%3-%1-%2", "%1 %1 %2", "50% of %1 is %2%", "%2 and %10 but %1", "%1%2%3", "no placeholders", "%1 %5"};
+	for (int i=0; i<int (sizeof (patterns)/sizeof (char*)); i++) {
+		String pattern (patterns[i]);
+		String chained = pattern.arg ("a").arg (42).arg (2.5);
+		if (pattern.args ("a", 42, 2.5) != chained) {
+			printf ("'%s' differs from '%s'\n", (CONSTR) pattern.args ("a", 42, 2.5), (CONSTR) chained);
+			return false;
+		}
+	}
+	if (String ("%1 %2 %3").args ("x") != "x %2 %3" || String ("%1 %2").args ("%2", "y") != "%2 y"
+		|| String ("%2 %1").args ('c', 'd') != "d c" || String ("50%").arg (1) != "50%")
+		return false;
+#endif
+	return true;
+}
+
+/** Allocations per operation, or "-" when they cannot be counted. */
+static void string_printFormat (const char* name, int count, long allocs, double secs)
+{
+	if (allocs >= 0)
+		printf ("  %-28s %8.1f ns/op %6.2f allocs/op\n", name, secs / count * 1e9, double (allocs) / count);
+	else
+		printf ("  %-28s %8.1f ns/op      - allocs/op\n", name, secs / count * 1e9);
+}
+
+/*******************************************************************************
+* NAME:        string_formatBenchmark
+*
+* DESCRIPTION: Formats log lines with the C-style strformat(), the
+*              type-safe strformat() and appendFormat(), and fills
+*              placeholders with chained arg() calls and args().
+*
+* RETURNS:     true if the results agree.
+*******************************************************************************/
+bool string_formatBenchmark ()
+{
+#if __cplusplus >= 201103L
+	const int count = 2000000;
+	String (*cformat) (const char*, ...) = &strformat;
+	String module ("worker");
+	String request ("GET /index.html");
+	String reference, result;
+
+	double start = benchtime ();
+	long allocs = test_allocations ();
+	for (int i=0; i<count; i++)
+		result = cformat ("%04d/%02d/%02d %02d:%02d:%02d [%s] thread %d: %s took %d ms, %d bytes",
+						  2026, 10, 17, i%24, i%60, i%60, (CONSTR) module, i%16, (CONSTR) request, i%1000, i);
+	string_printFormat ("strformat, C varargs", count, (allocs >= 0)? test_allocations () - allocs : -1, benchtime () - start);
+	reference = result;
+
+	start = benchtime ();
+	allocs = test_allocations ();
+	for (int i=0; i<count; i++)
+		result = strformat ("%04d/%02d/%02d %02d:%02d:%02d [%s] thread %d: %s took %d ms, %d bytes",
+							2026, 10, 17, i%24, i%60, i%60, module, i%16, request, i%1000, i);
+	string_printFormat ("strformat, type-safe", count, (allocs >= 0)? test_allocations () - allocs : -1, benchtime () - start);
+	bool agree = result == reference;
+
+	String line;
+	line.reserve (200);
+	start = benchtime ();
+	allocs = test_allocations ();
+	for (int i=0; i<count; i++) {
+		line.empty ();
+		line.appendFormat ("%04d/%02d/%02d %02d:%02d:%02d [%s] thread %d: %s took %d ms, %d bytes",
+						   2026, 10, 17, i%24, i%60, i%60, module, i%16, request, i%1000, i);
+	}
+	string_printFormat ("appendFormat, reserved", count, (allocs >= 0)? test_allocations () - allocs : -1, benchtime () - start);
+	agree = agree && line == reference;
+
+	String pattern ("[%1] thread %2: %3 took %4 ms, %5 bytes, %6");
+	start = benchtime ();
+	allocs = test_allocations ();
+	for (int i=0; i<count; i++)
+		result = pattern.arg (module).arg (i%16).arg (request).arg (i%1000).arg (i).arg (0.25);
+	string_printFormat ("chained arg", count, (allocs >= 0)? test_allocations () - allocs : -1, benchtime () - start);
+	reference = result;
+
+	start = benchtime ();
+	allocs = test_allocations ();
+	for (int i=0; i<count; i++)
+		result = pattern.args (module, i%16, request, i%1000, i, 0.25);
+	string_printFormat ("args", count, (allocs >= 0)? test_allocations () - allocs : -1, benchtime () - start);
+	agree = agree && result == reference;
+
+	return agree;
+#else
+	return true;
+#endif
+}
@@ -13,6 +13,7 @@
  ***************************************************************************/
 
 #include <stdio.h>
+#include <sys/time.h>
 
 #include <magic/mstring.h>
 #include <magic/mapplic.h>
@@ -41,6 +42,29 @@ void testf (CONSTR funcname,   /* Name of the function to be tested. */
 
 #define test(fname) testf (#fname, fname)
 
+/******************************************************************************/
+double benchtime ()
+{
+	struct timeval tv;
+	gettimeofday (&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+/******************************************************************************/
+void benchf (CONSTR funcname,   /* Name of the benchmark function. */
+			 bool (* func) ())  /* Benchmark function to run.      */
+{
+	printf ("Benchmark %s:\n", funcname);
+	fflush (stdout);
+
+	double start = benchtime ();
+	bool ok = func ();
+
+	printf (ok? "  (%.2f s)\n" : "  FAIL! (%.2f s)\n", benchtime () - start);
+}
+
+#define bench(fname) benchf (#fname, fname)
+
 /******************************************************************************/
 using namespace MagiC;
 
@@ -52,17 +76,90 @@ Main () {
 
 		// String tests
 		test (string_basicTests);
+		test (string_hashTests);
+		test (string_splitTests);
+		test (string_inlineTests);
+		test (string_viewTests);
+		test (string_kernelTests);
+		test (string_numberTests);
+		test (string_formatTests);
+
+		// Array tests
+		test (array_basicTests);
+		test (array_sortTests);
+		test (array_listTests);
+
+		// Map tests
+		test (map_basicTests);
+		test (map_readTests);
+		test (map_arenaTests);
+		test (map_orderedTests);
+
+		// Thread tests
+		test (thread_basicTests);
+		test (thread_refTests);
+		test (thread_logTests);
+		test (thread_logLevelTests);
+
+		// Worker tests
+		test (worker_basicTests);
+
+		// Memory tests
+		test (memory_ledgerTests);
+		test (memory_poolTests);
 
 		// IODevice tests
 		test (iodevice_fileWriting);
+		test (iodevice_readLines);
+		test (iodevice_bufferedFile);
+		test (iodevice_mmapFile);
+		test (iodevice_socket);
+		test (iodevice_notifier);
+		test (iodevice_asyncIO);
+		test (iodevice_compressed);
 
 		// Stream tests
 		test (stream_fileStream);
 		test (stream_stringStream);
+		test (stream_dataStream);
+
+		// Matrix tests
+		test (matrix_basicTests);
+		test (matrix_kernelTests);
 
 		printout = false;
 	}
 
+	// Benchmarks take a while, so they are run only when requested
+	// with the "bench" parameter.
+	if (params().size() > 0 && params()[0] == "bench") {
+		bench (string_hashBenchmark);
+		bench (string_splitBenchmark);
+		bench (string_allocBenchmark);
+		bench (string_kernelBenchmark);
+		bench (string_numberBenchmark);
+		bench (string_formatBenchmark);
+		bench (array_sortBenchmark);
+		bench (array_listBenchmark);
+		bench (map_benchmark);
+		bench (map_readBenchmark);
+		bench (map_arenaBenchmark);
+		bench (map_orderedBenchmark);
+		bench (thread_benchmark);
+		bench (thread_refBenchmark);
+		bench (thread_logBenchmark);
+		bench (thread_logLevelBenchmark);
+		bench (worker_benchmark);
+		bench (memory_ledgerBenchmark);
+		bench (iodevice_bufferedFileBenchmark);
+		bench (iodevice_mmapFileBenchmark);
+		bench (iodevice_socketBenchmark);
+		bench (iodevice_asyncIOBenchmark);
+		bench (iodevice_compressedBenchmark);
+		bench (stream_dataBenchmark);
+		bench (matrix_benchmark);
+	}
+
 	printf ("---------------------------------------------------\n");
 	printf ("MagiC++ library test program exiting...\n");
 }
@@ -0,0 +1,1046 @@
+/***************************************************************************
+ *   This file is part of the MagiC++ library.                             *
+ *                                                                         *
+ *   Copyright (C) 1998-2005 Marko Gr�nroos <magi@iki.fi>                  *
+ *                                                                         *
+ ***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+/* Debug messages of MLOG are compiled out of these tests. */
+#define MAGIC_LOG_LEVEL 6
+
+#include <magic/mthread.h>
+#include <magic/mworkqueue.h>
+#include <magic/miodevice.h>
+#include <magic/mstring.h>
+#include <magic/merrors.h>
+#include <magic/mlog.h>
+#include <magic/mpackarray.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <wchar.h>
+
+#include "tests.h"
+
+using namespace MagiC;
+
+/** Thread that increments a shared counter under a lock. */
+template <class LOCK>
+class CounterThread : public Thread {
+  public:
+	CounterThread (LOCK& lock, long& counter, int count)
+			: mrLock (lock), mrCounter (counter), mCount (count) {}
+
+	virtual void* execute () {
+		for (int i=0; i<mCount; i++) {
+			mrLock.lock ();
+			mrCounter++;
+			mrLock.unlock ();
+		}
+		return NULL;
+	}
+
+  private:
+	LOCK&	mrLock;
+	long&	mrCounter;
+	int		mCount;
+};
+
+/** Runs the given number of counter threads, and returns the time
+ *  taken.
+ **/
+template <class LOCK>
+static double thread_count (LOCK& lock, long& counter, int threads, int count)
+{
+	CounterThread<LOCK>* pThreads [64];
+	double start = benchtime ();
+	for (int i=0; i<threads; i++) {
+		pThreads[i] = new CounterThread<LOCK> (lock, counter, count);
+		pThreads[i]->start ();
+	}
+	for (int i=0; i<threads; i++) {
+		pThreads[i]->join ();
+		delete pThreads[i];
+	}
+	return benchtime () - start;
+}
+
+/** Thread that moves items from one semaphore to another through a
+ *  predicate guarded by a mutex and a condition variable.
+ **/
+class HandoffThread : public Thread {
+  public:
+	HandoffThread (Semaphore& items, Mutex& mutex, ConditionVariable& cond, int& ready, int count)
+			: mrItems (items), mrMutex (mutex), mrCond (cond), mrReady (ready), mCount (count) {}
+
+	virtual void* execute () {
+		for (int i=0; i<mCount; i++) {
+			mrItems.wait ();
+			MutexLocker locker (mrMutex);
+			mrReady++;
+			mrCond.signal ();
+		}
+		return NULL;
+	}
+
+  private:
+	Semaphore&			mrItems;
+	Mutex&				mrMutex;
+	ConditionVariable&	mrCond;
+	int&				mrReady;
+	int					mCount;
+};
+
+/*******************************************************************************
+* NAME:        thread_basicTests
+*
+* DESCRIPTION: Checks mutual exclusion under contention, handing items
+*              through a semaphore and a condition variable, and the
+*              timeouts of all the waits.
+*
+* RETURNS:     true if successful, false on failure.
+*******************************************************************************/
+bool thread_basicTests ()
+{
+	// Mutual exclusion
+	Mutex mutex;
+	long counter = 0;
+	thread_count (mutex, counter, 4, 100000);
+	if (counter != 400000)
+		return false;
+
+	// Items posted to a semaphore are handed back through a predicate
+	const int count = 10000;
+	Semaphore items;
+	ConditionVariable cond;
+	int ready = 0;
+	HandoffThread consumer (items, mutex, cond, ready, count);
+	consumer.start ();
+	for (int i=0; i<count; i++) {
+		items.post ();
+		MutexLocker locker (mutex);
+		while (ready <= i)
+			cond.wait (mutex);
+	}
+	consumer.join ();
+	if (ready != count || items.value () != 0 || items.tryWait ())
+		return false;
+
+	// Timeouts
+	if (items.wait (0.05) != MERR_TIMEOUT)
+		return false;
+	{
+		MutexLocker locker (mutex);
+		if (cond.wait (mutex, 0.05) != MERR_TIMEOUT)
+			return false;
+	}
+
+	// A fractional wait must not be rounded to whole seconds
+	ThreadLock threadLock;
+	double start = benchtime ();
+	if (threadLock.wait (0.999) != MERR_TIMEOUT)
+		return false;
+	double waited = benchtime () - start;
+	return waited > 0.95 && waited < 1.5;
+}
+
+/*******************************************************************************
+* NAME:        thread_benchmark
+*
+* DESCRIPTION: Compares the contended locking throughput of Mutex to
+*              the pthread-based ThreadLock with 1 to 8 threads.
+*
+* RETURNS:     true.
+*******************************************************************************/
+bool thread_benchmark ()
+{
+	const int total = 4000000;
+	const int threads[] = {1, 2, 4, 8};
+
+	for (int t=0; t<4; t++) {
+		int count = total / threads[t];
+		long counter = 0;
+
+		ThreadLock threadLock;
+		double lockSecs = thread_count (threadLock, counter, threads[t], count);
+
+		Mutex mutex;
+		double mutexSecs = thread_count (mutex, counter, threads[t], count);
+
+		printf ("  %d threads: ThreadLock %6.1f ns/op, Mutex %6.1f ns/op\n",
+				threads[t], lockSecs/total*1e9, mutexSecs/total*1e9);
+		if (counter != 2L*count*threads[t])
+			return false;
+	}
+	return true;
+}
+
+/** Object that counts the live instances. */
+class RefTestObject : public Object {
+  public:
+	RefTestObject () {__atomic_fetch_add (&live, 1, __ATOMIC_RELAXED);}
+	~RefTestObject () {__atomic_fetch_sub (&live, 1, __ATOMIC_RELAXED);}
+
+	static int	live;
+};
+
+int RefTestObject::live = 0;
+
+/** Thread that copies and drops references to an object. Locks a
+ *  weak reference instead, if one is given.
+ **/
+class RefCopyThread : public Thread {
+  public:
+	RefCopyThread (const Ref<RefTestObject>& ref, int count)
+			: mRef (ref), mCount (count) {}
+	RefCopyThread (const WeakRef<RefTestObject>& weak, int count)
+			: mWeak (weak), mCount (count) {}
+
+	virtual void* execute () {
+		if (mRef.isNull ())
+			for (int i=0; i<mCount; i++)
+				mWeak.lock ();
+		else
+			for (int i=0; i<mCount; i++) {
+				Ref<RefTestObject> copy (mRef);
+				__asm__ __volatile__ ("" : : : "memory");
+			}
+		return NULL;
+	}
+
+  private:
+	Ref<RefTestObject>		mRef;
+	WeakRef<RefTestObject>	mWeak;
+	int						mCount;
+};
+
+/** Thread that reads a file and hands the contents over through a
+ *  queue without copying the reference.
+ **/
+class ReadAllThread : public Thread {
+  public:
+	ReadAllThread (const char* filename, BoundedQueue<String>& queue)
+			: mFilename (filename), mrQueue (queue) {}
+
+	virtual void* execute () {
+		File file (mFilename, IO_Readable);
+		Ref<String> contents = file.readAll ();
+		file.close ();
+		mrQueue.push (contents.detach ());
+		return NULL;
+	}
+
+  private:
+	const char*				mFilename;
+	BoundedQueue<String>&	mrQueue;
+};
+
+/*******************************************************************************
+* NAME:        thread_refTests
+*
+* DESCRIPTION: Checks the copying, moving and assignment of Ref, weak
+*              references, and sharing references between threads.
+*
+* RETURNS:     true if successful, false on failure.
+*******************************************************************************/
+bool thread_refTests ()
+{
+	// Copies and assignment, also to itself
+	{
+		Ref<RefTestObject> a = new RefTestObject ();
+		Ref<RefTestObject> b = a;
+		Ref<RefTestObject> c;
+		c = b;
+		if (a->refCount () != 3)
+			return false;
+		c = c;
+		Ref<RefTestObject>& alias = c;
+		c = alias;
+		if (a->refCount () != 3 || RefTestObject::live != 1)
+			return false;
+		(c = new RefTestObject ()) = a;
+		if (a->refCount () != 3 || RefTestObject::live != 1)
+			return false;
+
+		// Detaching and adopting do not touch the count
+		RefTestObject* raw = b.detach ();
+		if (!b.isNull () || raw->refCount () != 3)
+			return false;
+		Ref<RefTestObject> d = Ref<RefTestObject>::adopt (raw);
+		if (d->refCount () != 3)
+			return false;
+
+#if __cplusplus >= 201103L
+		Ref<RefTestObject> e (static_cast<Ref<RefTestObject>&&> (d));
+		if (!d.isNull () || e->refCount () != 3)
+			return false;
+		e = static_cast<Ref<RefTestObject>&&> (e);
+		if (e->refCount () != 3)
+			return false;
+		c = static_cast<Ref<RefTestObject>&&> (e);
+		if (!e.isNull () || a->refCount () != 2)
+			return false;
+#endif
+	}
+	if (RefTestObject::live != 0)
+		return false;
+
+	// Weak references
+	{
+		Ref<RefTestObject> a = new RefTestObject ();
+		WeakRef<RefTestObject> weak (a);
+		WeakRef<RefTestObject> weak2;
+		weak2 = weak;
+		Ref<RefTestObject> locked = weak2.lock ();
+		if (weak.expired () || locked.isNull () || locked->refCount () != 2)
+			return false;
+		locked = NULL;
+		if (a->refCount () != 1)
+			return false;
+
+		// Many objects with weak references, dropped in mixed order
+		Ref<RefTestObject> objects [300];
+		WeakRef<RefTestObject> weaks [300];
+		for (int i=0; i<300; i++) {
+			objects[i] = new RefTestObject ();
+			weaks[i] = objects[i];
+			WeakRef<RefTestObject> again (objects[i]);
+		}
+		for (int i=0; i<300; i+=3)
+			objects[(i*7) % 300] = NULL;
+		for (int i=0; i<300; i++)
+			if (weaks[i].expired () != objects[i].isNull ())
+				return false;
+		for (int i=0; i<300; i++)
+			objects[i] = NULL;
+		for (int i=0; i<300; i++)
+			if (!weaks[i].expired ())
+				return false;
+
+		a = NULL;
+		if (!weak.expired () || !weak2.lock ().isNull () || RefTestObject::live != 0)
+			return false;
+	}
+
+	// Weak references to objects deleted without a Ref, and to new
+	// objects made in their place
+	for (int i=0; i<100; i++) {
+		Ref<RefTestObject> a = new RefTestObject ();
+		WeakRef<RefTestObject> weak (a);
+		RefTestObject* released = a.getReleasedPtr ();
+		if (!released || released->refCount () != 0)
+			return false;
+		delete released;
+		if (!weak.expired () || !weak.lock ().isNull ())
+			return false;
+
+		Ref<RefTestObject> b = new RefTestObject ();
+		WeakRef<RefTestObject> weakB (b);
+		if (!weak.expired () || weakB.lock ().isNull ())
+			return false;
+	}
+	if (RefTestObject::live != 0)
+		return false;
+
+	// References to a shared object copied in many threads
+	{
+		Ref<RefTestObject> shared = new RefTestObject ();
+		RefCopyThread* threads [8];
+		for (int i=0; i<8; i++) {
+			threads[i] = new RefCopyThread (shared, 100000);
+			threads[i]->start ();
+		}
+		for (int i=0; i<8; i++) {
+			threads[i]->join ();
+			delete threads[i];
+		}
+		if (shared->refCount () != 1)
+			return false;
+	}
+
+	// Weak references locked while the last Ref is dropped
+	for (int round=0; round<20; round++) {
+		Ref<RefTestObject> object = new RefTestObject ();
+		RefCopyThread* threads [4];
+		for (int i=0; i<4; i++) {
+			threads[i] = new RefCopyThread (WeakRef<RefTestObject> (object), 10000);
+			threads[i]->start ();
+		}
+		object = NULL;
+		for (int i=0; i<4; i++) {
+			threads[i]->join ();
+			delete threads[i];
+		}
+		if (RefTestObject::live != 0)
+			return false;
+	}
+
+	// The result of readAll handed over from another thread
+	const char* filename = "/tmp/reftest.txt";
+	{
+		File out (filename, IO_Writable);
+		for (int i=0; i<100; i++)
+			out.IODevice::writeBlock (String("line %1\n").arg (i));
+		out.close ();
+	}
+	BoundedQueue<String> queue (4);
+	ReadAllThread reader (filename, queue);
+	reader.start ();
+	reader.join ();
+	Ref<String> contents = Ref<String>::adopt (queue.pull ());
+	File (filename).remove ();
+	return !contents.isNull () && contents->refCount () == 1
+		&& contents->length () == 790 && contents->right (8) == "line 99\n";
+}
+
+/** Reference counted object with a plain counter, for comparing
+ *  against the atomic counts of Object.
+ **/
+struct PlainCounted {
+	int count;
+};
+
+/** Minimal single-threaded reference to a PlainCounted. */
+class PlainRef {
+  public:
+	PlainRef (PlainCounted* object=NULL) : mpObject (object) {if (mpObject) mpObject->count++;}
+	PlainRef (const PlainRef& o) : mpObject (o.mpObject) {if (mpObject) mpObject->count++;}
+	~PlainRef () {if (mpObject && --mpObject->count == 0) delete mpObject;}
+	PlainRef& operator= (const PlainRef& o) {
+		if (o.mpObject) o.mpObject->count++;
+		if (mpObject && --mpObject->count == 0) delete mpObject;
+		mpObject = o.mpObject;
+		return *this;
+	}
+  private:
+	PlainCounted* mpObject;
+};
+
+/** Thread in a ring that passes strings from its queue to the queue
+ *  of the next thread, either moving the reference or copying it and
+ *  dropping its own.
+ **/
+class RefRingThread : public Thread {
+  public:
+	RefRingThread (BoundedQueue<String>& in, BoundedQueue<String>& out, int count, bool move)
+			: mrIn (in), mrOut (out), mCount (count), mMove (move) {}
+
+	virtual void* execute () {
+		for (int i=0; i<mCount; i++) {
+			String* item;
+			while (!(item = mrIn.pull ()))
+				sched_yield ();
+			Ref<String> held = Ref<String>::adopt (item);
+			if (mMove)
+				mrOut.push (held.detach ());
+			else {
+				mrOut.push (Ref<String> (held).detach ());
+				held = NULL;
+			}
+		}
+		return NULL;
+	}
+
+  private:
+	BoundedQueue<String>&	mrIn;
+	BoundedQueue<String>&	mrOut;
+	int						mCount;
+	bool					mMove;
+};
+
+/** Passes strings around a ring of 8 threads, and returns the time
+ *  taken.
+ **/
+static double thread_refRing (int hops, bool move)
+{
+	BoundedQueue<String>* queues [8];
+	RefRingThread* threads [8];
+	for (int i=0; i<8; i++) {
+		queues[i] = new BoundedQueue<String> (16);
+		queues[i]->push (Ref<String> (new String ("token")).detach ());
+	}
+	double start = benchtime ();
+	for (int i=0; i<8; i++) {
+		threads[i] = new RefRingThread (*queues[i], *queues[(i+1)%8], hops/8, move);
+		threads[i]->start ();
+	}
+	for (int i=0; i<8; i++) {
+		threads[i]->join ();
+		delete threads[i];
+	}
+	double secs = benchtime () - start;
+	for (int i=0; i<8; i++) {
+		while (String* item = queues[i]->pull ())
+			Ref<String>::adopt (item);
+		delete queues[i];
+	}
+	return secs;
+}
+
+/*******************************************************************************
+* NAME:        thread_refBenchmark
+*
+* DESCRIPTION: Measures the cost of the atomic reference counts: copying
+*              a Ref against a plain counter, 8 threads copying references
+*              to one shared object or to objects of their own, and
+*              handing objects around a ring of threads by copying or
+*              by moving the references.
+*
+* RETURNS:     true.
+*******************************************************************************/
+bool thread_refBenchmark ()
+{
+	const int count = 20000000;
+
+	// Copy and release in one thread
+	{
+		Ref<RefTestObject> objects [4] = {new RefTestObject (), new RefTestObject (),
+										  new RefTestObject (), new RefTestObject ()};
+		Ref<RefTestObject> refs [16];
+		double start = benchtime ();
+		for (int i=0; i<count; i++) {
+			refs[i & 15] = objects[i & 3];
+			__asm__ __volatile__ ("" : : : "memory");
+		}
+		double atomicSecs = benchtime () - start;
+
+		PlainRef plainObjects [4] = {new PlainCounted (), new PlainCounted (),
+									 new PlainCounted (), new PlainCounted ()};
+		PlainRef plainRefs [16];
+		start = benchtime ();
+		for (int i=0; i<count; i++) {
+			plainRefs[i & 15] = plainObjects[i & 3];
+			__asm__ __volatile__ ("" : : : "memory");
+		}
+		double plainSecs = benchtime () - start;
+		printf ("  1 thread:   atomic Ref %5.1f ns/op, plain count %5.1f ns/op\n",
+				atomicSecs/count*1e9, plainSecs/count*1e9);
+	}
+
+	// Copies in 8 threads, to one object or to their own
+	{
+		Ref<RefTestObject> shared = new RefTestObject ();
+		RefCopyThread* threads [8];
+		double secs [2];
+		for (int own=0; own<2; own++) {
+			double start = benchtime ();
+			for (int i=0; i<8; i++) {
+				threads[i] = new RefCopyThread (own? Ref<RefTestObject> (new RefTestObject ()) : shared, count/8);
+				threads[i]->start ();
+			}
+			for (int i=0; i<8; i++) {
+				threads[i]->join ();
+				delete threads[i];
+			}
+			secs[own] = benchtime () - start;
+		}
+		printf ("  8 threads:  shared object %5.1f ns/op, own objects %5.1f ns/op\n",
+				secs[0]/count*1e9, secs[1]/count*1e9);
+	}
+
+	// Handoff around a ring of 8 threads
+	const int hops = 800000;
+	double copySecs = thread_refRing (hops, false);
+	double moveSecs = thread_refRing (hops, true);
+	printf ("  8 thread ring: copy %6.1f ns/hop, move %6.1f ns/hop\n",
+			copySecs/hops*1e9, moveSecs/hops*1e9);
+	return true;
+}
+
+/** Thread that writes numbered messages of several formats to a log. */
+class LogTestThread : public Thread {
+  public:
+	LogTestThread (Log& log, int id, int count)
+			: mrLog (log), mId (id), mCount (count) {}
+
+	virtual void* execute () {
+		for (int i=0; i<mCount; i++)
+			logTestMessage (mrLog, mId, i);
+		return NULL;
+	}
+
+	/** Writes the message of the index, or formats it to the buffer
+	 *  if a buffer is given.
+	 **/
+	static void logTestMessage (Log& log, int id, int i, char* buffer=NULL, int size=0) {
+		static char longText [3001];
+		if (!longText[0]) {
+			memset (longText, 'x', 3000);
+			longText[3000] = '\0';
+		}
+		switch (i % 6) {
+		  case 0: logTestPrint (log, buffer, size, "t%d i%d %*d|%-8s|%lld|%-*d|", id, i, 6, i*3, "abc", (long long) i << 33, -5, i);
+			  break;
+		  case 1: logTestPrint (log, buffer, size, "t%d i%d %.3f %e %Lg %c %5.2s %%", id, i, i*0.5, i*1e10, (long double) i/3, 'a'+i%26, "hello");
+			  break;
+		  case 2: logTestPrint (log, buffer, size, "t%d i%d %hhd %hu %lx %zu %p %s %.*s", id, i, i*7, i*3, (long) i*977, (size_t) i,
+								(void*) 0x1234, (const char*) NULL, 3, "precision");
+			  break;
+		  case 3: logTestPrint (log, buffer, size, "t%d i%d %s", id, i, longText + i%100);
+			  break;
+		  case 4: logTestPrint (log, buffer, size, "t%d i%d wide %lc", id, i, (wint_t) 'w');
+			  break;
+		  default: logTestPrint (log, buffer, size, "t%d i%d plain", id, i);
+		}
+	}
+
+	static void logTestPrint (Log& log, char* buffer, int size, const char* message, ...) {
+		va_list args;
+		va_start (args, message);
+		if (buffer)
+			vsnprintf (buffer, size, message, args);
+		else
+			log.message ("TEST", Log::Info, 7, message, args);
+		va_end (args);
+	}
+
+  private:
+	Log&		mrLog;
+	int			mId;
+	int			mCount;
+};
+
+/** Reads the lines of the log, checking that each line of the log has
+ *  the expected message and that the messages of each thread are in
+ *  order. Returns the number of lines, or -1 if a line was wrong.
+ **/
+static int thread_logCheck (const char* filename, int threads, int count)
+{
+	FILE* in = fopen (filename, "r");
+	if (!in)
+		return -1;
+
+	int next [64] = {0};
+	int lines = 0;
+	static char line [8192];
+	static char expected [8192];
+	DummyLog dummy;
+	while (fgets (line, sizeof (line), in)) {
+		const char* text = strstr (line, " TEST INFO 7: t");
+		int id, index;
+		if (!text || sscanf (text + 14, "t%d i%d", &id, &index) != 2 || id < 0 || id >= threads
+			|| index < next[id] || index >= count) {
+			lines = -1;
+			break;
+		}
+		LogTestThread::logTestMessage (dummy, id, index, expected, sizeof (expected));
+		if (strlen (text+14) != strlen (expected)+1 || strncmp (text+14, expected, strlen (expected))) {
+			lines = -1;
+			break;
+		}
+		next[id] = index+1;
+		lines++;
+	}
+	fclose (in);
+	return lines;
+}
+
+/*******************************************************************************
+* NAME:        thread_logTests
+*
+* DESCRIPTION: Writes messages of several formats from several threads
+*              to an asynchronous LogFile, and checks that the file has
+*              the messages as the synchronous log would have written
+*              them, in order for each thread. Checks that a full
+*              buffer drops and counts the messages with LOG_DROP.
+*
+* RETURNS:     true if the log was written correctly.
+*******************************************************************************/
+bool thread_logTests ()
+{
+	const char* filename = "/tmp/magic-logtest.log";
+	const int threads = 4;
+	const int count = 3000;
+
+	// All messages in the blocking mode
+	unlink (filename);
+	LogFile* log = new LogFile (filename);
+	if (log->startAsync (8192) || !log->isAsync ())
+		return false;
+	LogTestThread* pThreads [threads];
+	for (int i=0; i<threads; i++) {
+		pThreads[i] = new LogTestThread (*log, i, count);
+		pThreads[i]->start ();
+	}
+	for (int i=0; i<threads; i++) {
+		pThreads[i]->join ();
+		delete pThreads[i];
+	}
+	log->flush ();
+	bool ok = thread_logCheck (filename, threads, count) == threads*count && log->dropped () == 0;
+
+	// A message written after a flush is in the file after the next one
+	LogTestThread::logTestMessage (*log, 0, count);
+	log->flush ();
+	ok = ok && thread_logCheck (filename, threads, count+1) == threads*count+1;
+	log->stopAsync ();
+	ok = ok && !log->isAsync ();
+	delete log;
+
+	// Some messages dropped from a small buffer
+	unlink (filename);
+	log = new LogFile (filename);
+	log->startAsync (4096, LOG_DROP, 10.0);
+	Log& base = *log;
+	int results [2] = {0, 0};
+	for (int i=0; i<count; i++) {
+		int result = base.message ("TEST", Log::Info, 7, "t%d i%d plain", 0, 6*i+5);
+		results[result == MERR_LOG_DROPPED]++;
+	}
+	long dropped = log->dropped ();
+	log->close ();
+	delete log;
+
+	FILE* in = fopen (filename, "r");
+	char line [256];
+	int lines = 0;
+	long droppedReported = 0;
+	String notice = strformat ("WARNING %d: ", MERR_LOG_DROPPED);
+	while (in && fgets (line, sizeof (line), in)) {
+		const char* text = strstr (line, notice);
+		long reported;
+		if (strstr (line, " TEST INFO 7: "))
+			lines++;
+		else if (text && sscanf (text + notice.length (), "%ld log messages dropped.", &reported) == 1)
+			droppedReported += reported;
+	}
+	if (in)
+		fclose (in);
+	unlink (filename);
+	return ok && dropped > 0 && results[1] == dropped && lines == results[0] && lines + dropped == count
+		&& droppedReported == dropped;
+}
+
+/** Thread that writes messages to a log, timing each call. */
+class LogBenchThread : public Thread {
+  public:
+	LogBenchThread (Log& log, unsigned int* latencies, int id, int count)
+			: mrLog (log), mpLatencies (latencies), mId (id), mCount (count) {}
+
+	virtual void* execute () {
+		struct timespec before, after;
+		for (int i=0; i<mCount; i++) {
+			clock_gettime (CLOCK_MONOTONIC, &before);
+			mrLog.message ("BENCH", Log::Info, 0, "request %d of worker %d from %s took %.3f ms, status %d",
+						   i, mId, "10.0.0.1", i*0.001, 200);
+			clock_gettime (CLOCK_MONOTONIC, &after);
+			mpLatencies[i] = (after.tv_sec - before.tv_sec) * 1000000000 + after.tv_nsec - before.tv_nsec;
+		}
+		return NULL;
+	}
+
+  private:
+	Log&			mrLog;
+	unsigned int*	mpLatencies;
+	int				mId;
+	int				mCount;
+};
+
+/*******************************************************************************
+* NAME:        thread_logBenchmark
+*
+* DESCRIPTION: Compares the synchronous LogFile with the asynchronous one,
+*              with 16 threads writing messages to a file. Reports the
+*              throughput and the median and 99th percentile latencies of
+*              the calls. The standard error stream, to which the
+*              synchronous log echoes the messages, is sent to /dev/null.
+*
+* RETURNS:     true.
+*******************************************************************************/
+bool thread_logBenchmark ()
+{
+	const char* filename = "/tmp/magic-logbench.log";
+	const int threads = 16;
+	const int count = 10000000;
+	const char* modes [3] = {"sync", "async, block", "async, drop"};
+
+	int savedErr = dup (2);
+	int null = ::open ("/dev/null", O_WRONLY);
+	dup2 (null, 2);
+	::close (null);
+
+	PackArray<unsigned int> latencies (count);
+	for (int mode=0; mode<3; mode++) {
+		unlink (filename);
+		LogFile* log = new LogFile (filename);
+		if (mode)
+			log->startAsync (1 << 20, (mode == 1)? LOG_BLOCK : LOG_DROP);
+
+		LogBenchThread* pThreads [threads];
+		double start = benchtime ();
+		for (int i=0; i<threads; i++) {
+			pThreads[i] = new LogBenchThread (*log, &latencies[i*(count/threads)], i, count/threads);
+			pThreads[i]->start ();
+		}
+		for (int i=0; i<threads; i++) {
+			pThreads[i]->join ();
+			delete pThreads[i];
+		}
+		double posted = benchtime () - start;
+		long dropped = log->dropped ();
+		log->close ();
+		double written = benchtime () - start;
+		delete log;
+
+		selectNth (&latencies[0], count, count/2);
+		unsigned int p50 = latencies[count/2];
+		selectNth (&latencies[0], count, count/100*99);
+		unsigned int p99 = latencies[count/100*99];
+		printf ("  %-13s %5.2f s posted, %5.2f s written, %6.0f k msg/s, p50 %6u ns, p99 %7u ns, %ld dropped\n",
+				modes[mode], posted, written, count/written/1000, p50, p99, dropped);
+	}
+	unlink (filename);
+
+	dup2 (savedErr, 2);
+	::close (savedErr);
+	return true;
+}
+
+/** Returns the number of lines of the file that contain the text. */
+static int thread_logCount (const char* filename, const char* text)
+{
+	FILE* in = fopen (filename, "r");
+	if (!in)
+		return -1;
+	char line [1024];
+	int count = 0;
+	while (fgets (line, sizeof (line), in))
+		if (strstr (line, text))
+			count++;
+	fclose (in);
+	return count;
+}
+
+/** Thread that writes a message in a module of its own. */
+class LogModuleThread : public Thread {
+  public:
+	LogModuleThread (Log& log) : mrLog (log), mHadModule (true) {}
+
+	virtual void* execute () {
+		mHadModule = mrLog.currentModule () != NULL;
+		mrLog.pushModule ("WORKER");
+		mPushed = mrLog.currentModule ();
+		mrLog.info ("from worker");
+		return NULL;
+	}
+
+	Log&		mrLog;
+	bool		mHadModule;
+	String		mPushed;
+};
+
+/*******************************************************************************
+* NAME:        thread_logLevelTests
+*
+* DESCRIPTION: Checks that messages below the level of the log are not
+*              written, that MLOG does not evaluate their arguments and
+*              removes those below MAGIC_LOG_LEVEL at compile time, that
+*              the module stacks of the threads are separate, and that
+*              a BinaryLog decodes to the lines of LogFile.
+*
+* RETURNS:     true if all went as expected.
+*******************************************************************************/
+bool thread_logLevelTests ()
+{
+	const char* filename = "/tmp/magic-leveltest.log";
+	unlink (filename);
+
+	// LogFile echoes the messages to the standard error stream
+	int savedErr = dup (2);
+	int null = ::open ("/dev/null", O_WRONLY);
+	dup2 (null, 2);
+	::close (null);
+
+	LogFile* log = new LogFile (filename);
+	Log& base = *log;
+
+	// Runtime level
+	base.setLevel (Log::Warning);
+	bool ok = base.level () == Log::Warning && !base.enabled (Log::Notice) && base.enabled (Log::Error);
+	ok = ok && base.message ("TEST", Log::Info, 1, "not written %d", 1) == 0;
+	ok = ok && base.message ("TEST", Log::Error, 2, "written %d", 2) == 0;
+	ok = ok && base.message ("TEST", 8, 3, "invalid") == MERR_LOG_INVALID_FATALITY;
+	ok = ok && base.info ("not written") == 0;
+
+	// Arguments of MLOG
+	int evaluated = 0;
+	MLOG (*log, "TEST", Log::Notice, 4, "not evaluated %d", ++evaluated);
+	ok = ok && evaluated == 0;
+	base.setLevel (Log::Debug);
+	MLOG (*log, "TEST", Log::Info, 5, "evaluated %d", ++evaluated);
+	MLOG (*log, "TEST", Log::Debug, 6, "compiled out %d", ++evaluated);
+	ok = ok && evaluated == 1;
+
+	// Modules of the threads
+	base.pushModule ("MAIN");
+	LogModuleThread thread (base);
+	thread.start ();
+	thread.join ();
+	base.info ("from main");
+	ok = ok && !thread.mHadModule && thread.mPushed == "WORKER" && !strcmp (base.currentModule (), "MAIN");
+	base.message (NULL, Log::Notice, 7, "in module");
+	base.popModule ();
+	ok = ok && base.currentModule () == NULL;
+	delete log;
+	dup2 (savedErr, 2);
+	::close (savedErr);
+
+	ok = ok && thread_logCount (filename, " TEST ") == 2
+		&& thread_logCount (filename, " TEST ERROR 2: written 2") == 1
+		&& thread_logCount (filename, " TEST INFO 5: evaluated 1") == 1
+		&& thread_logCount (filename, " WORKER INFO 0: from worker") == 1
+		&& thread_logCount (filename, " MAIN INFO 0: from main") == 1
+		&& thread_logCount (filename, " MAIN NOTICE 7: in module") == 1;
+	unlink (filename);
+
+	// Binary log from several threads, in two sessions
+	const char* binname = "/tmp/magic-leveltest.bin";
+	const int threads = 4;
+	const int count = 1000;
+	unlink (binname);
+	BinaryLog* binlog = new BinaryLog (binname);
+	LogTestThread* pThreads [threads];
+	for (int i=0; i<threads; i++) {
+		pThreads[i] = new LogTestThread (*binlog, i, count);
+		pThreads[i]->start ();
+	}
+	for (int i=0; i<threads; i++) {
+		pThreads[i]->join ();
+		delete pThreads[i];
+	}
+	binlog->setLevel (Log::Notice);
+	LogTestThread::logTestMessage (*binlog, 1, count+1);
+	binlog->close ();
+	ok = ok && binlog->open () == 0;
+	binlog->setLevel (Log::Info);
+	LogTestThread::logTestMessage (*binlog, 0, count);
+	delete binlog;
+
+	FILE* in = fopen (binname, "rb");
+	FILE* out = fopen (filename, "w");
+	ok = ok && in && out && BinaryLog::decode (in, out) == 0;
+	if (in)
+		fclose (in);
+	if (out)
+		fclose (out);
+	ok = ok && thread_logCheck (filename, threads, count+1) == threads*count+1;
+
+	// A log ending in the middle of a record
+	in = fopen (binname, "rb");
+	fseek (in, 0, SEEK_END);
+	long size = ftell (in);
+	fclose (in);
+	ok = ok && truncate (binname, size-4) == 0;
+	in = fopen (binname, "rb");
+	out = fopen (filename, "w");
+	ok = ok && BinaryLog::decode (in, out) == MERR_LOG_CORRUPT;
+	fclose (in);
+	fclose (out);
+	ok = ok && thread_logCheck (filename, threads, count) == threads*count;
+
+	unlink (filename);
+	unlink (binname);
+	return ok;
+}
+
+/** Returns its argument as a string, as an example of an argument that
+ *  costs to evaluate.
+ **/
+static String thread_describe (int i)
+{
+	return strformat ("item %d", i);
+}
+
+/*******************************************************************************
+* NAME:        thread_logLevelBenchmark
+*
+* DESCRIPTION: Measures the cost of a message that is filtered out by
+*              the level of the log, through Log::message() and through
+*              MLOG, against the cost of a message that is written by
+*              LogFile and by BinaryLog. The standard error stream, to
+*              which LogFile echoes the messages, is sent to /dev/null.
+*
+* RETURNS:     true.
+*******************************************************************************/
+bool thread_logLevelBenchmark ()
+{
+	const char* filename = "/tmp/magic-levelbench.log";
+	const int written = 1000000;
+	const int filtered = 20000000;
+
+	int savedErr = dup (2);
+	int null = ::open ("/dev/null", O_WRONLY);
+	dup2 (null, 2);
+	::close (null);
+
+	// Written by LogFile, as every message was before the levels
+	unlink (filename);
+	LogFile* log = new LogFile (filename);
+	Log& base = *log;
+	double start = benchtime ();
+	for (int i=0; i<written; i++)
+		base.message ("BENCH", Log::Info, 0, "request %d from %s took %.3f ms", i, "10.0.0.1", i*0.001);
+	double textSecs = benchtime () - start;
+
+	start = benchtime ();
+	for (int i=0; i<written/10; i++)
+		base.message ("BENCH", Log::Info, 0, "request %d is %s", i, (CONSTR) thread_describe (i));
+	double textDescribeSecs = benchtime () - start;
+
+	// Filtered out at run time
+	base.setLevel (Log::Notice);
+	start = benchtime ();
+	for (int i=0; i<filtered; i++)
+		base.message ("BENCH", Log::Info, 0, "request %d from %s took %.3f ms", i, "10.0.0.1", i*0.001);
+	double messageSecs = benchtime () - start;
+
+	start = benchtime ();
+	for (int i=0; i<filtered; i++)
+		MLOG (*log, "BENCH", Log::Info, 0, "request %d from %s took %.3f ms", i, "10.0.0.1", i*0.001);
+	double mlogSecs = benchtime () - start;
+
+	start = benchtime ();
+	for (int i=0; i<filtered/10; i++)
+		base.message ("BENCH", Log::Info, 0, "request %d is %s", i, (CONSTR) thread_describe (i));
+	double messageDescribeSecs = benchtime () - start;
+
+	start = benchtime ();
+	for (int i=0; i<filtered; i++)
+		MLOG (*log, "BENCH", Log::Info, 0, "request %d is %s", i, (CONSTR) thread_describe (i));
+	double mlogDescribeSecs = benchtime () - start;
+
+	// Filtered out at compile time
+	start = benchtime ();
+	for (int i=0; i<filtered; i++)
+		MLOG (*log, "BENCH", Log::Debug, 0, "request %d is %s", i, (CONSTR) thread_describe (i));
+	double compiledSecs = benchtime () - start;
+	delete log;
+	unlink (filename);
+
+	// Written by BinaryLog
+	BinaryLog* binlog = new BinaryLog (filename);
+	start = benchtime ();
+	for (int i=0; i<written; i++)
+		binlog->message ("BENCH", Log::Info, 0, "request %d from %s took %.3f ms", i, "10.0.0.1", i*0.001);
+	double binarySecs = benchtime () - start;
+	delete binlog;
+	unlink (filename);
+
+	dup2 (savedErr, 2);
+	::close (savedErr);
+
+	printf ("  ns/call                    plain args   with a String argument\n");
+	printf ("  LogFile, written          %9.1f     %9.1f\n", textSecs/written*1e9, textDescribeSecs/(written/10)*1e9);
+	printf ("  BinaryLog, written        %9.1f\n", binarySecs/written*1e9);
+	printf ("  filtered in message()     %9.1f     %9.1f\n", messageSecs/filtered*1e9, messageDescribeSecs/(filtered/10)*1e9);
+	printf ("  filtered by MLOG          %9.1f     %9.1f\n", mlogSecs/filtered*1e9, mlogDescribeSecs/filtered*1e9);
+	printf ("  compiled out by MLOG                    %9.1f\n", compiledSecs/filtered*1e9);
+	return true;
+}
@@ -0,0 +1,169 @@
+/***************************************************************************
+ *   This file is part of the MagiC++ library.                             *
+ *                                                                         *
+ *   Copyright (C) 1998-2005 Marko Grnroos <magi@iki.fi>                  *
+ *                                                                         *
+ ***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+#include <magic/mworkerthread.h>
+#include <magic/merrors.h>
+
+#include "tests.h"
+
+using namespace MagiC;
+
+/** Request that counts its processing and may spawn more requests. */
+class CountRequest : public Request {
+  public:
+	CountRequest (int children=0, double delay=0.0) : mChildren (children), mDelay (delay) {mQueued = benchtime ();}
+
+	int		mChildren;	/**< Requests to pass to the pool when processed. */
+	double	mDelay;		/**< Busy-wait in the handler, in seconds. */
+	double	mQueued;	/**< Time when the request was created. */
+};
+
+/** Handler that counts the processed requests and their latency. */
+class CountHandler : public RequestHandler {
+  public:
+	CountHandler () : mpPool (NULL), mProcessed (0), mLatency (0), mMaxLatency (0) {}
+
+	virtual void process (Request* pRequest) {
+		CountRequest* pCount = static_cast<CountRequest*> (pRequest);
+		long latency = long ((benchtime () - pCount->mQueued) * 1e9);
+		__atomic_add_fetch (&mLatency, latency, __ATOMIC_RELAXED);
+		for (long max = mMaxLatency; latency > max; )
+			if (__atomic_compare_exchange_n (&mMaxLatency, &max, latency, false,
+											 __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+
+		if (pCount->mDelay > 0.0)
+			for (double end = benchtime () + pCount->mDelay; benchtime () < end; )
+				;
+		for (int i=0; i<pCount->mChildren; i++)
+			mpPool->process (new CountRequest (0, pCount->mDelay));
+
+		__atomic_add_fetch (&mProcessed, 1, __ATOMIC_RELAXED);
+		delete pCount;
+	}
+
+	WorkerPool*	mpPool;
+	long		mProcessed;
+	long		mLatency;		/**< Sum of the latencies, in nanoseconds. */
+	long		mMaxLatency;	/**< In nanoseconds. */
+};
+
+/** Thread that passes requests to a pool. */
+class ProducerThread : public Thread {
+  public:
+	ProducerThread (WorkerPool& pool, int count, int children=0, double delay=0.0)
+			: mPool (pool), mCount (count), mChildren (children), mDelay (delay) {}
+
+	virtual void* execute () {
+		for (int i=0; i<mCount; i++)
+			mPool.process (new CountRequest (mChildren, mDelay));
+		return NULL;
+	}
+
+  private:
+	WorkerPool&	mPool;
+	int			mCount;
+	int			mChildren;
+	double		mDelay;
+};
+
+/*******************************************************************************
+* NAME:        worker_basicTests
+*
+* DESCRIPTION: Passes requests from several producers and from the
+*              workers themselves through a small queue, and checks
+*              that each is processed once before the shutdown returns.
+*
+* RETURNS:     true if successful, false on failure.
+*******************************************************************************/
+bool worker_basicTests ()
+{
+	const int producers = 4, count = 5000, children = 3;
+	DummyLog log;
+	CountHandler handler;
+
+	// The small queue makes the producers wait for space
+	WorkerPool pool (handler, log, 4, 16);
+	handler.mpPool = &pool;
+
+	ProducerThread* threads [producers];
+	for (int i=0; i<producers; i++) {
+		threads[i] = new ProducerThread (pool, count, children);
+		threads[i]->start ();
+	}
+	for (int i=0; i<producers; i++) {
+		threads[i]->join ();
+		delete threads[i];
+	}
+
+	if (pool.shutdown (new CountRequest ()) != 0)
+		return false;
+
+	// Nothing is accepted after the shutdown
+	CountRequest late;
+	if (pool.tryProcess (&late) != MERR_THREAD_POOL_SHUTDOWN || pool.shutdown () == 0)
+		return false;
+
+	const long total = producers*count*(1+children) + 1;
+	return handler.mProcessed == total && pool.processedCount () == total - 1
+		&& pool.queueDepth () == 0 && pool.utilization (0) <= 1.0;
+}
+
+/** Runs the given number of requests through a pool, and prints the
+ *  throughput, the mean and maximum latency and the pool statistics.
+ **/
+static void worker_benchmarkOne (int workers, int count, double delay)
+{
+	DummyLog log;
+	CountHandler handler;
+	WorkerPool pool (handler, log, workers);
+	handler.mpPool = &pool;
+
+	double start = benchtime ();
+	ProducerThread producer (pool, count, 0, delay);
+	producer.start ();
+	producer.join ();
+	while (handler.mProcessed < count)
+		sched_yield ();
+	double secs = benchtime () - start;
+
+	double utilization = 0.0;
+	for (int i=0; i<workers; i++)
+		utilization += pool.utilization (i);
+
+	printf ("  %2d workers %5s: %9.0f req/s, latency mean %8.1f us max %9.1f us, "
+			"%6ld steals, utilization %3.0f%%\n",
+			workers, delay>0.0? "10us":"no-op", count/secs,
+			handler.mLatency/1e3/count, handler.mMaxLatency/1e3,
+			pool.stealCount (), 100*utilization/workers);
+	pool.shutdown ();
+}
+
+/*******************************************************************************
+* NAME:        worker_benchmark
+*
+* DESCRIPTION: Measures the throughput and latency of WorkerPool with
+*              1, 4, 16 and 64 workers, with no-op and 10 s handlers.
+*
+* RETURNS:     true.
+*******************************************************************************/
+bool worker_benchmark ()
+{
+	const int workers[] = {1, 4, 16, 64};
+	for (int w=0; w<4; w++) {
+		worker_benchmarkOne (workers[w], 1000000, 0.0);
+		worker_benchmarkOne (workers[w], 100000, 10e-6);
+	}
+	return true;
+}
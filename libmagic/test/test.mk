@@ -42,7 +42,7 @@ include $(SRCDIR)/build/magicdef.mk
 ################################################################################
 # Source files for libmagic.a
 ################################################################################
-sources = test.cc stringtest.cc iodevicetest.cc streamtest.cc matrixtest.cc
+sources = test.cc stringtest.cc arraytest.cc maptest.cc threadtest.cc workertest.cc memorytest.cc iodevicetest.cc streamtest.cc matrixtest.cc
 
 headers = tests.h
 